@@ -0,0 +1,89 @@
+#include "bench.h"
+
+#include <parserutils/charset/mibenum.h>
+
+/* Measures charset name lookups, in ns per lookup */
+
+static const char *names[] = {
+	"UTF-8", "utf-8", "utf8", "ISO-8859-1", "latin1", "windows-1252",
+	"Shift_JIS", "x-sjis", "EUC-KR", "gb2312", "Big5", "us-ascii",
+	"UTF-16LE", "koi8-r", "csISOLatinCyrillic", "ibm367"
+};
+
+static const char *misses[] = {
+	"moose", "utf-9", "x-unknown-charset", "latin99"
+};
+
+#define N_NAMES (sizeof(names) / sizeof(names[0]))
+#define N_MISSES (sizeof(misses) / sizeof(misses[0]))
+
+typedef struct alias_case {
+	const char **names;
+	size_t lens[N_NAMES];
+	size_t count;
+	uint16_t mibs[N_NAMES];
+	volatile uint32_t sink;		/**< Keeps results live */
+} alias_case;
+
+static void from_name(void *pw)
+{
+	alias_case *c = pw;
+	uint32_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < c->count; i++)
+		sum += parserutils_charset_mibenum_from_name(c->names[i],
+				c->lens[i]);
+
+	c->sink = sum;
+}
+
+static void to_name(void *pw)
+{
+	alias_case *c = pw;
+	uint32_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < c->count; i++) {
+		const char *name = parserutils_charset_mibenum_to_name(
+				c->mibs[i]);
+
+		sum += (name != NULL) ? (uint8_t) name[0] : 0;
+	}
+
+	c->sink = sum;
+}
+
+int main(int argc, char **argv)
+{
+	alias_case c;
+	size_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	bench_init();
+
+	c.names = names;
+	c.count = N_NAMES;
+	for (i = 0; i < N_NAMES; i++) {
+		c.lens[i] = strlen(names[i]);
+		c.mibs[i] = parserutils_charset_mibenum_from_name(names[i],
+				c.lens[i]);
+	}
+
+	bench_report("aliases", "mibenum_from_name hit",
+			bench_measure(from_name, &c) / c.count * 1e9, "ns");
+	bench_report("aliases", "mibenum_to_name",
+			bench_measure(to_name, &c) / c.count * 1e9, "ns");
+
+	c.names = misses;
+	c.count = N_MISSES;
+	for (i = 0; i < N_MISSES; i++)
+		c.lens[i] = strlen(misses[i]);
+
+	bench_report("aliases", "mibenum_from_name miss",
+			bench_measure(from_name, &c) / c.count * 1e9, "ns");
+
+	return 0;
+}
@@ -0,0 +1,327 @@
+#ifndef bench_bench_h_
+#define bench_bench_h_
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/charset/codec.h>
+
+#ifndef UNUSED
+#define UNUSED(x) ((x) = (x))
+#endif
+
+/* Each benchmark prints one line per measurement, thus:
+ *
+ * 	<benchmark> TAB <case> TAB <value> TAB <unit> LF
+ *
+ * Higher values are better, except where the unit is a time. */
+
+/** Number of characters in each synthetic document */
+#define BENCH_DOC_CHARS (1024 * 1024)
+
+/**
+ * Charset measured by the codec, filter and inputstream benchmarks
+ */
+typedef struct bench_charset {
+	const char *name;		/**< Charset name */
+	const char *script;		/**< Script of its synthetic document */
+} bench_charset;
+
+static const bench_charset bench_charsets[] = {
+	{ "UTF-8", "mixed" },
+	{ "UTF-16LE", "mixed" },
+	{ "UTF-16BE", "mixed" },
+	{ "UTF-32LE", "mixed" },
+	{ "US-ASCII", "ascii" },
+	{ "ISO-8859-1", "latin" },
+	{ "windows-1252", "latin" },
+	{ "ISO-8859-5", "cyrillic" },
+	{ "windows-1251", "cyrillic" },
+	{ "KOI8-R", "cyrillic" },
+	{ "Shift_JIS", "japanese" },
+	{ "EUC-JP", "japanese" },
+	{ "GBK", "chinese" },
+	{ "GB18030", "chinese" },
+	{ "Big5", "chinese" },
+	{ "EUC-KR", "korean" }
+};
+
+#define BENCH_N_CHARSETS (sizeof(bench_charsets) / sizeof(bench_charsets[0]))
+
+/** Minimum time, in seconds, to spend measuring each case */
+static double bench_min_time = 0.2;
+
+typedef void (*bench_func)(void *pw);
+
+/**
+ * Abandon benchmarking
+ *
+ * \param what  Description of what failed
+ */
+static inline void bench_fail(const char *what)
+{
+	fprintf(stderr, "FAIL - %s\n", what);
+
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Set up benchmarking
+ *
+ * The minimum time spent on each case may be set, in seconds, with the
+ * PARSERUTILS_BENCH_TIME environment variable.
+ */
+static inline void bench_init(void)
+{
+	const char *t = getenv("PARSERUTILS_BENCH_TIME");
+
+	if (t != NULL && atof(t) > 0)
+		bench_min_time = atof(t);
+}
+
+/**
+ * Read a monotonic clock
+ *
+ * \return Time, in seconds, from an arbitrary epoch
+ */
+static inline double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Measure how long a function takes
+ *
+ * \param func  Function to measure
+ * \param pw    Client private data for func
+ * \return Mean time per call, in seconds
+ *
+ * The function is called once to warm up, then in batches of doubling size
+ * until a batch takes at least the minimum time.
+ */
+static inline double bench_measure(bench_func func, void *pw)
+{
+	size_t iterations = 1, i;
+	double start, elapsed;
+
+	func(pw);
+
+	while (true) {
+		start = bench_now();
+		for (i = 0; i < iterations; i++)
+			func(pw);
+		elapsed = bench_now() - start;
+
+		if (elapsed >= bench_min_time)
+			break;
+
+		iterations *= 2;
+	}
+
+	return elapsed / iterations;
+}
+
+/**
+ * Report a measurement
+ *
+ * \param bench  Name of benchmark
+ * \param which  Name of case measured
+ * \param value  Measurement
+ * \param unit   Unit of measurement
+ */
+static inline void bench_report(const char *bench, const char *which,
+		double value, const char *unit)
+{
+	printf("%s\t%s\t%.3f\t%s\n", bench, which, value, unit);
+	fflush(stdout);
+}
+
+static inline void *bench_realloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/**
+ * Read a file into memory
+ *
+ * \param dir   Directory containing file
+ * \param name  Name of file, relative to dir
+ * \param len   Pointer to location to receive length of file
+ * \return Pointer to file data, or NULL if it couldn't be read
+ */
+static inline uint8_t *bench_read_file(const char *dir, const char *name,
+		size_t *len)
+{
+	char path[4096];
+	uint8_t *data;
+	FILE *fp;
+	long size;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return NULL;
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(size > 0 ? size : 1);
+	if (data == NULL || fread(data, 1, size, fp) != (size_t) size) {
+		free(data);
+		fclose(fp);
+		return NULL;
+	}
+
+	fclose(fp);
+
+	*len = size;
+
+	return data;
+}
+
+/**
+ * Pick a letter of a script
+ *
+ * \param script  The script
+ * \param seed    Pointer to random number generator state, updated
+ * \return Letter
+ */
+static inline uint32_t bench_letter(const char *script, uint32_t *seed)
+{
+	uint32_t r;
+
+	*seed = *seed * 1103515245 + 12345;
+	r = (*seed >> 8) & 0xFFFF;
+
+	if (strcmp(script, "mixed") == 0) {
+		static const char *scripts[] = {
+			"latin", "latin", "latin", "cyrillic", "japanese",
+			"chinese", "korean", "emoji"
+		};
+
+		script = scripts[(*seed >> 24) & 7];
+	}
+
+	if (strcmp(script, "latin") == 0)
+		return (r % 8 == 0) ? 0xE0 + r % 0x20 : 'a' + r % 26;
+	if (strcmp(script, "cyrillic") == 0)
+		return 0x410 + r % 0x40;
+	if (strcmp(script, "japanese") == 0)
+		return (r % 4 == 0) ? 0x4E00 + r % 0x60 : 0x3041 + r % 0x52;
+	if (strcmp(script, "chinese") == 0)
+		return 0x4E00 + r % 0x800;
+	if (strcmp(script, "korean") == 0)
+		return 0xAC00 + r % 0x100;
+	if (strcmp(script, "emoji") == 0)
+		return 0x1F600 + r % 0x50;
+
+	return 'a' + r % 26;
+}
+
+/**
+ * Generate a synthetic document, as HTML-like markup around text
+ *
+ * \param script  Script of the text
+ * \param len     Pointer to location to receive number of characters
+ * \return Pointer to document, as host-endian UCS-4
+ *
+ * The same document is generated for a given script on every run.
+ */
+static inline uint32_t *bench_document(const char *script, size_t *len)
+{
+	uint32_t *doc = malloc((BENCH_DOC_CHARS + 64) * sizeof(uint32_t));
+	uint32_t seed = 1;
+	size_t n = 0;
+
+	if (doc == NULL)
+		bench_fail("allocating document");
+
+	while (n < BENCH_DOC_CHARS) {
+		const char *markup = "<p class=\"text\">";
+		uint32_t words = 5 + seed % 10, w;
+
+		while (*markup != '\0')
+			doc[n++] = (uint8_t) *markup++;
+
+		for (w = 0; w < words && n < BENCH_DOC_CHARS; w++) {
+			uint32_t letters = 2 + (seed >> 4) % 7, l;
+
+			for (l = 0; l < letters; l++)
+				doc[n++] = bench_letter(script, &seed);
+
+			doc[n++] = ' ';
+		}
+
+		for (markup = "</p>\n"; *markup != '\0'; markup++)
+			doc[n++] = (uint8_t) *markup;
+	}
+
+	*len = n;
+
+	return doc;
+}
+
+/**
+ * Encode a document into a charset
+ *
+ * \param charset  The charset
+ * \param doc      The document, as host-endian UCS-4
+ * \param chars    Number of characters in document
+ * \param len      Pointer to location to receive length of result
+ * \return Pointer to encoded document, or NULL if the charset is unsupported
+ *
+ * Characters the charset can't represent are replaced.
+ */
+static inline uint8_t *bench_encode(const char *charset, const uint32_t *doc,
+		size_t chars, size_t *len)
+{
+	parserutils_charset_codec_optparams params;
+	parserutils_charset_codec *codec;
+	const uint8_t *src = (const uint8_t *) doc;
+	size_t srclen = chars * 4, space = chars * 4 + 16;
+	uint8_t *out, *dest;
+
+	if (parserutils_charset_codec_create(charset, bench_realloc, NULL,
+			&codec) != PARSERUTILS_OK)
+		return NULL;
+
+	params.ucs4_order.order = PARSERUTILS_CHARSET_CODEC_UCS4_HOST;
+	if (parserutils_charset_codec_setopt(codec,
+			PARSERUTILS_CHARSET_CODEC_UCS4_ORDER,
+			&params) != PARSERUTILS_OK)
+		bench_fail("setting UCS-4 order");
+
+	out = dest = malloc(space);
+	if (out == NULL)
+		bench_fail("allocating encoded document");
+
+	if (parserutils_charset_codec_encode(codec, &src, &srclen,
+			&dest, &space) != PARSERUTILS_OK || srclen != 0)
+		bench_fail("encoding document");
+
+	parserutils_charset_codec_destroy(codec);
+
+	*len = dest - out;
+
+	return out;
+}
+
+#endif
+
@@ -0,0 +1,137 @@
+#include "bench.h"
+
+/* Measures the throughput of each codec, decoding to and encoding from
+ * host-endian UCS-4, in MB/s of charset data */
+
+#define OUT_SIZE (64 * 1024)
+
+typedef struct codec_case {
+	parserutils_charset_codec *codec;
+	const uint8_t *data;		/**< Data to convert */
+	size_t len;			/**< Length of data, in bytes */
+	uint8_t out[OUT_SIZE];		/**< Output, repeatedly overwritten */
+} codec_case;
+
+static void decode(void *pw)
+{
+	codec_case *c = pw;
+	const uint8_t *src = c->data;
+	size_t srclen = c->len;
+
+	while (srclen > 0) {
+		uint8_t *dest = c->out;
+		size_t space = OUT_SIZE;
+		parserutils_error error;
+
+		error = parserutils_charset_codec_decode(c->codec, &src,
+				&srclen, &dest, &space);
+		if (error != PARSERUTILS_OK && error != PARSERUTILS_NOMEM)
+			bench_fail("decoding");
+	}
+
+	parserutils_charset_codec_reset(c->codec);
+}
+
+static void encode(void *pw)
+{
+	codec_case *c = pw;
+	const uint8_t *src = c->data;
+	size_t srclen = c->len;
+
+	while (srclen > 0) {
+		uint8_t *dest = c->out;
+		size_t space = OUT_SIZE;
+		parserutils_error error;
+
+		error = parserutils_charset_codec_encode(c->codec, &src,
+				&srclen, &dest, &space);
+		if (error != PARSERUTILS_OK && error != PARSERUTILS_NOMEM)
+			bench_fail("encoding");
+	}
+
+	parserutils_charset_codec_reset(c->codec);
+}
+
+/* Measure one charset, given a document in it */
+static void run(codec_case *c, const char *charset, const char *label,
+		uint8_t *data, size_t len)
+{
+	parserutils_charset_codec_optparams params;
+	const uint8_t *src = data;
+	size_t srclen = len, space = len * 4 + 16;
+	uint8_t *ucs4, *dest;
+	char which[64];
+	double t;
+
+	if (parserutils_charset_codec_create(charset, bench_realloc, NULL,
+			&c->codec) != PARSERUTILS_OK)
+		return;
+
+	params.ucs4_order.order = PARSERUTILS_CHARSET_CODEC_UCS4_HOST;
+	parserutils_charset_codec_setopt(c->codec,
+			PARSERUTILS_CHARSET_CODEC_UCS4_ORDER, &params);
+
+	c->data = data;
+	c->len = len;
+	t = bench_measure(decode, c);
+	snprintf(which, sizeof(which), "%s decode", label);
+	bench_report("codec", which, len / t / 1e6, "MB/s");
+
+	/* Encode what was decoded, so it's all representable */
+	ucs4 = dest = malloc(space);
+	if (ucs4 == NULL)
+		bench_fail("allocating UCS-4");
+	if (parserutils_charset_codec_decode(c->codec, &src, &srclen,
+			&dest, &space) != PARSERUTILS_OK)
+		bench_fail("decoding");
+	parserutils_charset_codec_reset(c->codec);
+
+	c->data = ucs4;
+	c->len = dest - ucs4;
+	t = bench_measure(encode, c);
+	snprintf(which, sizeof(which), "%s encode", label);
+	bench_report("codec", which, len / t / 1e6, "MB/s");
+
+	free(ucs4);
+	parserutils_charset_codec_destroy(c->codec);
+}
+
+int main(int argc, char **argv)
+{
+	codec_case *c = malloc(sizeof(codec_case));
+	const char *dir = (argc > 1) ? argv[1] : "test/data";
+	uint8_t *data;
+	size_t i, len;
+
+	if (c == NULL)
+		bench_fail("allocating case");
+
+	bench_init();
+
+	for (i = 0; i < BENCH_N_CHARSETS; i++) {
+		uint32_t *doc;
+		size_t chars;
+
+		doc = bench_document(bench_charsets[i].script, &chars);
+		data = bench_encode(bench_charsets[i].name, doc, chars, &len);
+		free(doc);
+
+		if (data == NULL)
+			continue;
+
+		run(c, bench_charsets[i].name, bench_charsets[i].name,
+				data, len);
+
+		free(data);
+	}
+
+	data = bench_read_file(dir, "input/UTF-8-test.txt", &len);
+	if (data != NULL) {
+		run(c, "UTF-8", "UTF-8 UTF-8-test.txt", data, len);
+		free(data);
+	}
+
+	free(c);
+
+	return 0;
+}
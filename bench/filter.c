@@ -0,0 +1,101 @@
+#include "bench.h"
+
+#include "input/filter.h"
+
+/* Measures the input filter's throughput converting each charset to UTF-8,
+ * in MB/s of input. This uses iconv, unless built WITHOUT_ICONV_FILTER. */
+
+#define OUT_SIZE (64 * 1024)
+
+typedef struct filter_case {
+	parserutils_filter *filter;
+	const uint8_t *data;		/**< Data to convert */
+	size_t len;			/**< Length of data, in bytes */
+	uint8_t out[OUT_SIZE];		/**< Output, repeatedly overwritten */
+} filter_case;
+
+static void convert(void *pw)
+{
+	filter_case *c = pw;
+	const uint8_t *src = c->data;
+	size_t srclen = c->len;
+
+	while (srclen > 0) {
+		uint8_t *dest = c->out;
+		size_t space = OUT_SIZE;
+		parserutils_error error;
+
+		error = parserutils__filter_process_chunk(c->filter, &src,
+				&srclen, &dest, &space);
+		if (error != PARSERUTILS_OK && error != PARSERUTILS_NOMEM)
+			bench_fail("converting");
+	}
+
+	parserutils__filter_reset(c->filter);
+}
+
+/* Measure one charset, given a document in it */
+static void run(filter_case *c, const char *charset, const char *label,
+		const uint8_t *data, size_t len)
+{
+	parserutils_filter_optparams params;
+	char which[64];
+	double t;
+
+	if (parserutils__filter_create("UTF-8", bench_realloc, NULL,
+			&c->filter) != PARSERUTILS_OK)
+		bench_fail("creating filter");
+
+	params.encoding.name = charset;
+	if (parserutils__filter_setopt(c->filter,
+			PARSERUTILS_FILTER_SET_ENCODING,
+			&params) == PARSERUTILS_OK) {
+		c->data = data;
+		c->len = len;
+		t = bench_measure(convert, c);
+		snprintf(which, sizeof(which), "%s->UTF-8", label);
+		bench_report("filter", which, len / t / 1e6, "MB/s");
+	}
+
+	parserutils__filter_destroy(c->filter);
+}
+
+int main(int argc, char **argv)
+{
+	filter_case *c = malloc(sizeof(filter_case));
+	const char *dir = (argc > 1) ? argv[1] : "test/data";
+	uint8_t *data;
+	size_t i, len;
+
+	if (c == NULL)
+		bench_fail("allocating case");
+
+	bench_init();
+
+	for (i = 0; i < BENCH_N_CHARSETS; i++) {
+		uint32_t *doc;
+		size_t chars;
+
+		doc = bench_document(bench_charsets[i].script, &chars);
+		data = bench_encode(bench_charsets[i].name, doc, chars, &len);
+		free(doc);
+
+		if (data == NULL)
+			continue;
+
+		run(c, bench_charsets[i].name, bench_charsets[i].name,
+				data, len);
+
+		free(data);
+	}
+
+	data = bench_read_file(dir, "input/UTF-8-test.txt", &len);
+	if (data != NULL) {
+		run(c, "UTF-8", "UTF-8-test.txt", data, len);
+		free(data);
+	}
+
+	free(c);
+
+	return 0;
+}
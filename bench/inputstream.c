@@ -0,0 +1,244 @@
+#include "bench.h"
+
+#include <parserutils/input/cache.h>
+#include <parserutils/input/inputstream.h>
+
+/* Measures reading documents through an input stream, appended in chunks
+ * of various sizes, in MB/s of input. Each character is read with peek and
+ * advance, or each run with peek_span, or the text between markup
+ * characters is skipped with scan_until. Whole documents are also read a
+ * run at a time while being normalised to NFC, while being lent to the
+ * stream in chunks, not copied, and when already in a decode cache. */
+
+static const char *charsets[] = {
+	"UTF-8", "UTF-16LE", "windows-1252", "Shift_JIS"
+};
+
+static const size_t chunk_sizes[] = { 64, 1024, 16384, 0 };
+
+typedef struct stream_case {
+	const char *charset;
+	const uint8_t *data;		/**< Document */
+	size_t len;			/**< Length of document, in bytes */
+	size_t chunk;			/**< Bytes per append, or 0 for all */
+	const char *mode;		/**< How to read: peek, span or scan */
+	bool nfc;			/**< Whether to normalise to NFC */
+	bool lend;			/**< Whether to lend the chunks */
+	parserutils_decode_cache *cache; /**< Decode cache, or NULL */
+} stream_case;
+
+/* The bytes an HTML tokeniser looks for in text */
+static parserutils_byteset markup;
+
+static void consume(parserutils_inputstream *stream, const char *mode)
+{
+	const uint8_t *ptr;
+	size_t len;
+
+	if (strcmp(mode, "span") == 0) {
+		while (parserutils_inputstream_peek_span(stream, 0,
+				&ptr, &len) == PARSERUTILS_OK)
+			parserutils_inputstream_advance(stream, len);
+	} else if (strcmp(mode, "scan") == 0) {
+		/* Skip to each markup character, then step over it */
+		while (parserutils_inputstream_scan_until(stream, &markup,
+				&len) == PARSERUTILS_OK)
+			parserutils_inputstream_advance(stream, len + 1);
+
+		parserutils_inputstream_advance(stream, len);
+	} else {
+		while (parserutils_inputstream_peek(stream, 0,
+				&ptr, &len) == PARSERUTILS_OK)
+			parserutils_inputstream_advance(stream, len);
+	}
+}
+
+static void release(const uint8_t *data, size_t len, void *pw)
+{
+	UNUSED(data);
+	UNUSED(len);
+	UNUSED(pw);
+}
+
+static void read_document(void *pw)
+{
+	stream_case *c = pw;
+	parserutils_inputstream *stream;
+	size_t chunk = (c->chunk != 0) ? c->chunk : c->len;
+	size_t off;
+
+	if (parserutils_inputstream_create(c->charset, 1, NULL,
+			bench_realloc, NULL, &stream) != PARSERUTILS_OK)
+		bench_fail("creating stream");
+
+	if (c->nfc) {
+		parserutils_inputstream_optparams params;
+
+		params.normalise.nfc = true;
+		if (parserutils_inputstream_setopt(stream,
+				PARSERUTILS_INPUTSTREAM_SET_NORMALISE,
+				&params) != PARSERUTILS_OK)
+			bench_fail("setting normalisation");
+	}
+
+	if (c->cache != NULL) {
+		parserutils_inputstream_optparams params;
+
+		params.cache.cache = c->cache;
+		if (parserutils_inputstream_setopt(stream,
+				PARSERUTILS_INPUTSTREAM_SET_CACHE,
+				&params) != PARSERUTILS_OK)
+			bench_fail("setting cache");
+	}
+
+	for (off = 0; off < c->len; off += chunk) {
+		size_t len = (c->len - off < chunk) ? c->len - off : chunk;
+
+		parserutils_error error;
+
+		if (c->lend) {
+			error = parserutils_inputstream_append_borrowed(stream,
+					c->data + off, len, release, NULL);
+		} else {
+			error = parserutils_inputstream_append(stream,
+					c->data + off, len);
+		}
+		if (error != PARSERUTILS_OK)
+			bench_fail("appending");
+
+		/* The cache is only used for documents read after EOF */
+		if (c->cache == NULL || off + len < c->len)
+			consume(stream, c->mode);
+	}
+
+	parserutils_inputstream_append(stream, NULL, 0);
+	consume(stream, c->mode);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = (argc > 1) ? argv[1] : "test/data";
+	static const char *modes[] = { "peek", "span", "scan" };
+	stream_case c;
+	uint8_t *data;
+	size_t i, j, k, len;
+
+	bench_init();
+
+	if (parserutils_byteset_init(&markup, (const uint8_t *) "<&\r",
+			4) != PARSERUTILS_OK)
+		bench_fail("compiling byte set");
+
+	for (i = 0; i < sizeof(charsets) / sizeof(charsets[0]); i++) {
+		const char *script = "mixed";
+		char which[64];
+		uint32_t *doc;
+		size_t chars;
+
+		if (strcmp(charsets[i], "windows-1252") == 0)
+			script = "latin";
+		else if (strcmp(charsets[i], "Shift_JIS") == 0)
+			script = "japanese";
+
+		doc = bench_document(script, &chars);
+		data = bench_encode(charsets[i], doc, chars, &len);
+		free(doc);
+
+		if (data == NULL)
+			continue;
+
+		c.charset = charsets[i];
+		c.data = data;
+		c.len = len;
+		c.nfc = false;
+		c.lend = false;
+		c.cache = NULL;
+
+		for (j = 0; j < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]);
+				j++) {
+			char chunk[16];
+
+			if (chunk_sizes[j] != 0)
+				snprintf(chunk, sizeof(chunk), "%u",
+						(unsigned) chunk_sizes[j]);
+			else
+				strcpy(chunk, "all");
+
+			c.chunk = chunk_sizes[j];
+
+			for (k = 0; k < sizeof(modes) / sizeof(modes[0]);
+					k++) {
+				c.mode = modes[k];
+				snprintf(which, sizeof(which),
+						"%s chunk=%s %s", charsets[i],
+						chunk, modes[k]);
+				bench_report("inputstream", which,
+						len / bench_measure(
+						read_document, &c) / 1e6,
+						"MB/s");
+			}
+		}
+
+		c.chunk = 0;
+		c.mode = "span";
+		c.nfc = true;
+		snprintf(which, sizeof(which), "%s chunk=all span nfc",
+				charsets[i]);
+		bench_report("inputstream", which,
+				len / bench_measure(read_document, &c) / 1e6,
+				"MB/s");
+
+		c.chunk = 16384;
+		c.nfc = false;
+		c.lend = true;
+		snprintf(which, sizeof(which), "%s chunk=16384 span lent",
+				charsets[i]);
+		bench_report("inputstream", which,
+				len / bench_measure(read_document, &c) / 1e6,
+				"MB/s");
+
+		/* UTF-8 is only validated, so isn't cached */
+		if (strcmp(charsets[i], "UTF-8") != 0) {
+			/* The first read adds the document to the cache */
+			if (parserutils_decode_cache_create(8 * len,
+					NULL, NULL, bench_realloc, NULL,
+					&c.cache) != PARSERUTILS_OK)
+				bench_fail("creating cache");
+
+			c.chunk = 0;
+			c.lend = false;
+			snprintf(which, sizeof(which),
+					"%s chunk=all span cached",
+					charsets[i]);
+			bench_report("inputstream", which,
+					len / bench_measure(read_document,
+					&c) / 1e6, "MB/s");
+
+			parserutils_decode_cache_destroy(c.cache);
+			c.cache = NULL;
+		}
+
+		free(data);
+	}
+
+	data = bench_read_file(dir, "input/UTF-8-test.txt", &len);
+	if (data != NULL) {
+		c.charset = "UTF-8";
+		c.data = data;
+		c.len = len;
+		c.chunk = 0;
+		c.mode = "peek";
+		c.nfc = false;
+		c.lend = false;
+
+		bench_report("inputstream", "UTF-8-test.txt peek",
+				len / bench_measure(read_document, &c) / 1e6,
+				"MB/s");
+
+		free(data);
+	}
+
+	return 0;
+}
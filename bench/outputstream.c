@@ -0,0 +1,140 @@
+#include "bench.h"
+
+#include <parserutils/output/outputstream.h>
+
+/* Measures writing documents through an output stream, appended as UTF-8
+ * in chunks of various sizes, in MB/s of UTF-8. Text in its own script is
+ * encoded to each charset, and mixed text to windows-1252 with references
+ * in place of the characters it lacks. */
+
+static const struct {
+	const char *charset;
+	const char *script;
+	parserutils_outputstream_fallback fallback;
+	const char *label;
+} charsets[] = {
+	{ "windows-1252", "latin", PARSERUTILS_OUTPUTSTREAM_FALLBACK_LOOSE,
+	  "windows-1252" },
+	{ "ISO-8859-5", "cyrillic", PARSERUTILS_OUTPUTSTREAM_FALLBACK_LOOSE,
+	  "ISO-8859-5" },
+	{ "UTF-16LE", "mixed", PARSERUTILS_OUTPUTSTREAM_FALLBACK_LOOSE,
+	  "UTF-16LE" },
+	{ "Shift_JIS", "japanese", PARSERUTILS_OUTPUTSTREAM_FALLBACK_LOOSE,
+	  "Shift_JIS" },
+	{ "windows-1252", "mixed", PARSERUTILS_OUTPUTSTREAM_FALLBACK_NCR,
+	  "windows-1252 mixed ncr" }
+};
+
+static const size_t chunk_sizes[] = { 16, 256, 16384 };
+
+typedef struct stream_case {
+	const char *charset;
+	parserutils_outputstream_fallback fallback;
+	const uint8_t *data;		/**< Document, in UTF-8 */
+	size_t len;			/**< Length of document, in bytes */
+	size_t chunk;			/**< Bytes per append */
+	size_t written;			/**< Bytes given to the writer */
+} stream_case;
+
+static parserutils_error writer(const uint8_t *data, size_t len, void *pw)
+{
+	stream_case *c = pw;
+
+	UNUSED(data);
+
+	c->written += len;
+
+	return PARSERUTILS_OK;
+}
+
+static void write_document(void *pw)
+{
+	parserutils_outputstream_optparams params;
+	parserutils_outputstream *stream;
+	stream_case *c = pw;
+	size_t off;
+
+	if (parserutils_outputstream_create(c->charset, writer, c,
+			bench_realloc, NULL, &stream) != PARSERUTILS_OK)
+		bench_fail("creating stream");
+
+	params.fallback.mode = c->fallback;
+	if (parserutils_outputstream_setopt(stream,
+			PARSERUTILS_OUTPUTSTREAM_SET_FALLBACK,
+			&params) != PARSERUTILS_OK)
+		bench_fail("setting fallback");
+
+	for (off = 0; off < c->len; off += c->chunk) {
+		size_t len = (c->len - off < c->chunk) ? c->len - off
+				: c->chunk;
+
+		if (parserutils_outputstream_append(stream, c->data + off,
+				len) != PARSERUTILS_OK)
+			bench_fail("appending");
+	}
+
+	if (parserutils_outputstream_append(stream, NULL, 0) !=
+			PARSERUTILS_OK)
+		bench_fail("ending");
+
+	parserutils_outputstream_destroy(stream);
+}
+
+int main(int argc, char **argv)
+{
+	stream_case c;
+	size_t i, j;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	bench_init();
+
+	for (i = 0; i < sizeof(charsets) / sizeof(charsets[0]); i++) {
+		parserutils_outputstream *probe;
+		uint8_t *data;
+		uint32_t *doc;
+		size_t chars, len;
+
+		doc = bench_document(charsets[i].script, &chars);
+		data = bench_encode("UTF-8", doc, chars, &len);
+		free(doc);
+
+		if (data == NULL)
+			continue;
+
+		c.charset = charsets[i].charset;
+		c.fallback = charsets[i].fallback;
+		c.data = data;
+		c.len = len;
+
+		c.written = 0;
+
+		/* Skip charsets unsupported by the build */
+		if (parserutils_outputstream_create(c.charset, writer, &c,
+				bench_realloc, NULL, &probe) !=
+				PARSERUTILS_OK) {
+			free(data);
+			continue;
+		}
+		parserutils_outputstream_destroy(probe);
+
+		for (j = 0; j < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]);
+				j++) {
+			char which[64];
+
+			c.chunk = chunk_sizes[j];
+
+			snprintf(which, sizeof(which), "%s chunk=%u",
+					charsets[i].label,
+					(unsigned) chunk_sizes[j]);
+			bench_report("outputstream", which,
+					len / bench_measure(write_document,
+					&c) / 1e6, "MB/s");
+		}
+
+		free(data);
+	}
+
+	return 0;
+}
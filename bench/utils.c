@@ -0,0 +1,181 @@
+#include "bench.h"
+
+#include <parserutils/charset/utf8.h>
+#include <parserutils/utils/hash.h>
+#include <parserutils/utils/interner.h>
+#include <parserutils/utils/stack.h>
+#include <parserutils/utils/vector.h>
+
+/* Measures the utility data structures, in millions of operations per
+ * second, and the UTF-8 string functions, in MB/s */
+
+#define N_OPS (100000)
+#define N_NAMES (1000)
+
+typedef struct item {
+	void *node;
+	uint32_t type;
+	uint32_t flags;
+} item;
+
+static char names[N_NAMES][16];
+
+/**
+ * A UTF-8 document
+ */
+typedef struct utf8_doc {
+	uint8_t *data;
+	size_t len;
+	size_t chars;
+} utf8_doc;
+
+static void stack_push_pop(void *pw)
+{
+	parserutils_stack *stack;
+	item it = { NULL, 0, 0 };
+	size_t i;
+
+	UNUSED(pw);
+
+	if (parserutils_stack_create(sizeof(item), 16, bench_realloc, NULL,
+			&stack) != PARSERUTILS_OK)
+		bench_fail("creating stack");
+
+	for (i = 0; i < N_OPS; i++) {
+		it.type = i;
+		parserutils_stack_push(stack, &it);
+	}
+
+	for (i = 0; i < N_OPS; i++)
+		parserutils_stack_pop(stack, &it);
+
+	parserutils_stack_destroy(stack);
+}
+
+static void vector_append(void *pw)
+{
+	parserutils_vector *vector;
+	item it = { NULL, 0, 0 };
+	size_t i;
+
+	UNUSED(pw);
+
+	if (parserutils_vector_create(sizeof(item), 16, bench_realloc, NULL,
+			&vector) != PARSERUTILS_OK)
+		bench_fail("creating vector");
+
+	for (i = 0; i < N_OPS; i++) {
+		it.type = i;
+		parserutils_vector_append(vector, &it);
+	}
+
+	parserutils_vector_destroy(vector);
+}
+
+static void interner_intern(void *pw)
+{
+	parserutils_interner *interner;
+	const parserutils_interned *s;
+	size_t i;
+
+	UNUSED(pw);
+
+	if (parserutils_interner_create(bench_realloc, NULL,
+			&interner) != PARSERUTILS_OK)
+		bench_fail("creating interner");
+
+	/* Few distinct names, as in a document's tags and attributes */
+	for (i = 0; i < N_OPS; i++) {
+		const char *name = names[(i * 7919) % N_NAMES];
+
+		parserutils_interner_intern(interner, (const uint8_t *) name,
+				strlen(name), &s);
+	}
+
+	parserutils_interner_destroy(interner);
+}
+
+static void utf8_length(void *pw)
+{
+	utf8_doc *doc = pw;
+	size_t chars;
+
+	if (parserutils_charset_utf8_length(doc->data, doc->len,
+			&chars) != PARSERUTILS_OK || chars != doc->chars)
+		bench_fail("measuring UTF-8 length");
+}
+
+static void utf8_count(void *pw)
+{
+	utf8_doc *doc = pw;
+	size_t chars, units;
+
+	if (parserutils_charset_utf8_count(doc->data, doc->len,
+			&chars, &units) != PARSERUTILS_OK ||
+			chars != doc->chars)
+		bench_fail("counting UTF-8");
+}
+
+static void utf8_advance(void *pw)
+{
+	utf8_doc *doc = pw;
+	size_t off;
+
+	if (parserutils_charset_utf8_advance(doc->data, doc->len,
+			doc->chars, &off) != PARSERUTILS_OK ||
+			off != doc->len)
+		bench_fail("advancing through UTF-8");
+}
+
+static void bench_utf8(const char *script)
+{
+	char which[64];
+	uint32_t *ucs4;
+	utf8_doc doc;
+
+	ucs4 = bench_document(script, &doc.chars);
+	doc.data = bench_encode("UTF-8", ucs4, doc.chars, &doc.len);
+	if (doc.data == NULL)
+		bench_fail("encoding UTF-8");
+
+	snprintf(which, sizeof(which), "utf8 length %s", script);
+	bench_report("utils", which, doc.len /
+			bench_measure(utf8_length, &doc) / 1e6, "MB/s");
+	snprintf(which, sizeof(which), "utf8 count %s", script);
+	bench_report("utils", which, doc.len /
+			bench_measure(utf8_count, &doc) / 1e6, "MB/s");
+	snprintf(which, sizeof(which), "utf8 advance %s", script);
+	bench_report("utils", which, doc.len /
+			bench_measure(utf8_advance, &doc) / 1e6, "MB/s");
+
+	free(doc.data);
+	free(ucs4);
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	bench_init();
+
+	for (i = 0; i < N_NAMES; i++)
+		snprintf(names[i], sizeof(names[i]), "name-%u", (unsigned) i);
+
+	bench_report("utils", "stack push+pop",
+			2 * N_OPS / bench_measure(stack_push_pop, NULL) / 1e6,
+			"Mops/s");
+	bench_report("utils", "vector append",
+			N_OPS / bench_measure(vector_append, NULL) / 1e6,
+			"Mops/s");
+	bench_report("utils", "interner intern",
+			N_OPS / bench_measure(interner_intern, NULL) / 1e6,
+			"Mops/s");
+
+	bench_utf8("ascii");
+	bench_utf8("mixed");
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+#!/usr/bin/perl
+
+use warnings;
+use strict;
+
+# Convert multibyte mapping tables to C structures
+# Input files are in the format of those at http://unicode.org/Public/MAPPINGS
+# (byte sequence and Unicode code point, in hex, in the first two columns).
+#
+# Usage: conv-mb.pl <name> <lead_range> <trail_range> <input_file>
+#        conv-mb.pl -ranges <name> <input_file>
+#
+# The first form emits a table of the characters for two byte sequences,
+# indexed by (lead - first lead) * trails + (trail - first trail). Ranges are
+# given as hex pairs, such as A1-FE. The lead range may be preceded by a
+# prefix byte, as in 8F:A1-FE for EUC-JP's three byte sequences, in which
+# case only sequences starting with the prefix are considered. Undefined
+# entries are mapped to U+FFFF; characters outside the BMP are mapped to
+# U+FFFE, and must be handled by the codec.
+#
+# The second form emits ranges of four byte GB18030 sequences which map
+# to consecutive code points, as { first index, first code point, count }.
+
+die "Usage: conv-mb.pl <name> <lead_range> <trail_range> <input_file>\n" .
+	"       conv-mb.pl -ranges <name> <input_file>\n"
+		if (scalar(@ARGV) != 4 && scalar(@ARGV) != 3);
+
+sub read_map {
+	my ($file) = @_;
+	my @map;
+
+	open MAP, "<$file" or die "Failed opening $file: $!\n";
+
+	while (<MAP>) {
+		next if (/^#/ || /^\s*$/);
+
+		my @parts = split(/\s+/);
+
+		next if ($parts[1] =~ /^#/);
+
+		push(@map, [ hex($parts[0]), hex($parts[1]) ]);
+	}
+
+	close MAP;
+
+	return @map;
+}
+
+if ($ARGV[0] eq '-ranges') {
+	my $name = $ARGV[1];
+	my @ranges;
+
+	foreach my $entry (sort { $a->[0] <=> $b->[0] } read_map($ARGV[2])) {
+		my ($seq, $ucs) = @$entry;
+		my $index = (((($seq >> 24) & 0xFF) - 0x81) * 10 +
+				((($seq >> 16) & 0xFF) - 0x30)) * 1260 +
+				((($seq >> 8) & 0xFF) - 0x81) * 10 +
+				(($seq & 0xFF) - 0x30);
+
+		if (@ranges && $ranges[-1][0] + $ranges[-1][2] == $index &&
+				$ranges[-1][1] + $ranges[-1][2] == $ucs) {
+			$ranges[-1][2]++;
+		} else {
+			push(@ranges, [ $index, $ucs, 1 ]);
+		}
+	}
+
+	print "static const gb18030_range ${name}[" . scalar(@ranges) .
+			"] = {\n";
+
+	foreach my $range (@ranges) {
+		printf("\t{ %5d, 0x%04X, %5d },\n", @$range);
+	}
+
+	print "};\n\n";
+
+	exit 0;
+}
+
+my ($name, $leads, $trails, $file) = @ARGV;
+
+my $prefix = ($leads =~ s/^([0-9A-Fa-f]{2})://) ? hex($1) : undef;
+my ($first_lead, $last_lead) = map { hex } split(/-/, $leads);
+my ($first_trail, $last_trail) = map { hex } split(/-/, $trails);
+my $width = $last_trail - $first_trail + 1;
+my $size = ($last_lead - $first_lead + 1) * $width;
+
+my @table = ("0xFFFF") x $size;
+
+foreach my $entry (read_map($file)) {
+	my ($seq, $ucs) = @$entry;
+	my $lead = ($seq >> 8) & 0xFF;
+	my $trail = $seq & 0xFF;
+
+	if (defined($prefix)) {
+		next if (($seq >> 16) != $prefix);
+	} else {
+		next if ($seq < 0x100 || $seq > 0xFFFF);
+	}
+
+	next if ($lead < $first_lead || $lead > $last_lead);
+	next if ($trail < $first_trail || $trail > $last_trail);
+
+	$table[($lead - $first_lead) * $width + $trail - $first_trail] =
+			$ucs > 0xFFFF ? "0xFFFE" : sprintf("0x%04X", $ucs);
+}
+
+print "static const uint16_t ${name}[$size] = {\n\t";
+
+my $count = 0;
+foreach my $item (@table) {
+	print "$item, ";
+	$count++;
+
+	if ($count % 8 == 0 && $count != $size) {
+		print "\n\t";
+	}
+}
+
+print "\n};\n\n";
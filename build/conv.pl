@@ -3,47 +3,192 @@
 use warnings;
 use strict;
 
-# Convert Unicode mapping tables to C structures
-# Input files may be found at http://unicode.org/Public/MAPPINGS
+use Encode ();
+
+# Generate the tables used by the single-byte charset codec, from the
+# mappings built into Perl's Encode module.
+#
+# Usage: conv.pl
+#
+# This writes src/charset/sbcs_tables.inc. Each charset has:
 #
-# Usage: conv.pl <input_file>
+#   + The character for each of bytes 0x80-0xFF, with U+FFFF for bytes
+#     which are undefined. Outside ISO-8859-n, bytes which Encode maps to
+#     C1 controls are treated as undefined, as they fill holes in the
+#     charset and don't appear in text. In ISO-8859-n, 0x80-0x9F are the
+#     C1 controls themselves, and iconv decodes them as such, so they're
+#     kept.
+#   + The first byte from which each byte up to 0xFF is the code point of
+#     the same value and no lower byte maps to any of those code points;
+#     0x100 if there is no such byte. The codec converts these without
+#     consulting the tables.
+#   + A reverse map, as described by parserutils_charset_reverse_map in
+#     src/charset/codecs/codec_impl.h, for the other bytes 0x80-0xFF.
+#     Where a character appears twice, it maps to the lower byte.
+#
+# To support another charset, add it below and to the SBCS codec handler
+# in build/make-aliases.pl.
+
+use constant ALIAS_FILE => 'build/Aliases';
+use constant SBCS_INC   => 'src/charset/sbcs_tables.inc';
+
+use constant REVERSE_MAP_SIZE => 256;
 
-die "Usage: conv.pl <input_file>\n" if (scalar(@ARGV) != 1);
+# Canonical name in build/Aliases, and name known to Encode
+my @CHARSETS = (
+	[ 'US-ASCII', 'ascii' ],
+	(map { [ "ISO-8859-$_", "iso-8859-$_" ] }
+			(1 .. 11, 13 .. 16)),
+	(map { [ "windows-$_", "cp$_" ] } (1250 .. 1258)),
+	[ 'KOI8-R', 'koi8-r' ],
+	[ 'KOI8-U', 'koi8-u' ]
+);
 
-my @table;
+my %mibenums;
 
-open MAP, "<$ARGV[0]" or die "Failed opening $ARGV[0]: $!\n";
+open(ALIASES, "<", ALIAS_FILE) || die "Unable to open " . ALIAS_FILE . "\n";
 
-while (<MAP>) {
-	next if (/^#/);
+while (my $line = <ALIASES>) {
+	next if ($line =~ /^#/ || $line =~ /^\s*$/);
 
-	my @parts = split(/\s+/);
+	my ($canon, $mibenum) = split(/\s+/, $line);
 
-	# Ignore ASCII part
-	next if (hex($parts[0]) < 0x80);
+	$mibenums{$canon} = $mibenum;
+}
+
+close(ALIASES);
+
+sub reverse_map_hash {
+	my ($ucs4) = @_;
+
+	return (($ucs4 * 0x9E3779B1) & 0xFFFFFFFF) >> 24;
+}
 
-	# Convert undefined entries to U+FFFF
-	if ($parts[1] =~ /^#/) {
-		push(@table, "0xFFFF");
-	} else {
-		push(@table, $parts[1]);
+sub emit {
+	my ($indent, $format, $perline, @values) = @_;
+	my $out = '';
+
+	for (my $i = 0; $i < scalar(@values); $i += $perline) {
+		my $end = $i + $perline - 1;
+
+		$out .= $indent . join(', ', map { sprintf($format, $_) }
+				@values[$i .. $end]) . ",\n";
 	}
+
+	return $out;
 }
 
-close MAP;
+my $output = <<'EOH';
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ *
+ * Note: This file is automatically generated by conv.pl
+ *
+ * Do not edit this file, changes will be overwritten during build.
+ */
+
+EOH
+
+my (@charsets, @indices);
+
+foreach my $charset (@CHARSETS) {
+	my ($canon, $encoding) = @$charset;
+	my $mibenum = $mibenums{$canon};
+	my $ident = lc($canon);
+	my $c1 = ($canon =~ /^ISO-8859-/);
+	my (@table, @ucs4, @bytes, %seen);
+
+	die "$canon is not in " . ALIAS_FILE . "\n" unless (defined $mibenum);
+	die "Encode doesn't know $encoding\n"
+			unless (defined Encode::find_encoding($encoding));
+
+	$ident =~ s/[^a-z0-9]/_/g;
+
+	for (my $byte = 0x80; $byte < 0x100; $byte++) {
+		my $chars = Encode::decode($encoding, chr($byte),
+				Encode::FB_QUIET);
+		my $ucs4 = 0xFFFF;
+
+		if (length($chars) == 1) {
+			$ucs4 = ord($chars);
+			$ucs4 = 0xFFFF if (!$c1 && $ucs4 >= 0x80 &&
+					$ucs4 < 0xA0);
+		}
 
-# You'll have to go through and fix up the structure name
-print "static uint32_t ${ARGV[0]}[128] = {\n\t";
+		die sprintf("%s byte 0x%02X is beyond the BMP\n", $canon, $byte)
+				if ($ucs4 > 0xFFFF);
 
-my $count = 0;
-foreach my $item (@table) {
-	print "$item, ";
-	$count++;
+		push(@table, $ucs4);
+	}
+
+	# Find the bytes which are their own code point
+	my $direct = 0x100;
+
+	while ($direct > 0x80 && $table[$direct - 1 - 0x80] == $direct - 1) {
+		$direct--;
+	}
+
+	for (my $byte = 0x80; $byte < $direct; $byte++) {
+		my $ucs4 = $table[$byte - 0x80];
 
-	if ($count % 8 == 0 && $count != 128) {
-		print "\n\t";
+		$direct = $ucs4 + 1 if ($ucs4 >= $direct && $ucs4 < 0x100);
 	}
+
+	# Hash the remaining bytes
+	@ucs4 = (0) x REVERSE_MAP_SIZE;
+	@bytes = (0) x REVERSE_MAP_SIZE;
+
+	for (my $byte = 0x80; $byte < $direct; $byte++) {
+		my $ucs4 = $table[$byte - 0x80];
+
+		next if ($ucs4 == 0xFFFF || exists($seen{$ucs4}));
+		$seen{$ucs4} = 1;
+
+		my $slot = reverse_map_hash($ucs4);
+
+		$slot = ($slot + 1) % REVERSE_MAP_SIZE while ($ucs4[$slot] != 0);
+
+		$ucs4[$slot] = $ucs4;
+		$bytes[$slot] = $byte;
+	}
+
+	die "$canon has too many characters for a reverse map\n"
+			if (scalar(keys %seen) > REVERSE_MAP_SIZE / 2);
+
+	$output .= "/* $canon */\n";
+	$output .= "static const uint16_t sbcs_${ident}_table[128] = {\n" .
+			emit("\t", '0x%04X', 8, @table) . "};\n\n";
+	$output .= "static const parserutils_charset_reverse_map " .
+			"sbcs_${ident}_reverse = {\n\t{\n" .
+			emit("\t\t", '0x%04X', 8, @ucs4) . "\t},\n\t{\n" .
+			emit("\t\t", '0x%02X', 8, @bytes) . "\t}\n};\n\n";
+
+	push(@indices, "#define SBCS_" . uc($ident) . " (" .
+			scalar(@charsets) . ")\n");
+	push(@charsets, sprintf("\t{ %d, 0x%X, sbcs_%s_table, &sbcs_%s_reverse }",
+			$mibenum, $direct, $ident, $ident));
 }
 
-print "\n};\n\n";
+$output .= "/* Index of each charset in sbcs_charsets */\n" . join('', @indices);
+$output .= "\nstatic const sbcs_charset sbcs_charsets[" .
+		scalar(@charsets) . "] = {\n" . join(",\n", @charsets) .
+		"\n};\n\n";
+
+# Only replace the output if it's changed, like make-aliases.pl
+my $new = 1;
 
+if (open(EXISTING, "<", SBCS_INC)) {
+	local $/ = undef;
+
+	$new = 0 if (<EXISTING> eq $output);
+
+	close(EXISTING);
+}
+
+if ($new) {
+	open(OUTF, ">", SBCS_INC) || die "Unable to open " . SBCS_INC . "\n";
+	print OUTF $output;
+	close(OUTF);
+}
@@ -18,6 +18,18 @@ use constant UNICODE_CHARSETS =>
    qr'^UTF-32'
   ];
 
+# Codec handler for each natively supported charset; the first match wins.
+# Names must match parserutils_charset_handler_id in src/charset/aliases.h,
+# and the SBCS charsets must be those with tables generated by conv.pl
+use constant CODEC_HANDLERS =>
+  [
+   [ 'UTF8',  qr'^UTF-8$' ],
+   [ 'UTF16', qr'^UTF-16(BE|LE)?$' ],
+   [ 'UTF32', qr'^UTF-32(BE|LE)?$' ],
+   [ 'SBCS',  qr'^(US-ASCII|ISO-8859-([1-9]|1[013-6])|windows-125[0-8]|KOI8-[RU])$' ],
+   [ 'CJK',   qr'^(Shift_JIS|EUC-JP|GBK|GB18030|Big5|EUC-KR)$' ]
+  ];
+
 open(INFILE, "<", ALIAS_FILE) || die "Unable to open " . ALIAS_FILE;
 
 my %charsets;
@@ -49,15 +61,25 @@ my $output = <<'EOH';
  * Do not edit file file, changes will be overwritten during build.
  */
 
-static parserutils_charset_aliases_canon canonical_charset_names[] = {
+static const parserutils_charset_aliases_canon canonical_charset_names[] = {
 EOH
 
 my %aliases;
+my @bymib;
 my $canonnr = 0;
 foreach my $canon (sort keys %charsets) {
    my ($mibenum, $elements) = @{$charsets{$canon}};
+   my $handler = 'NONE';
+   foreach my $entry (@{CODEC_HANDLERS()}) {
+      my ($name, $rexp) = @$entry;
+      if ($canon =~ $rexp) {
+         $handler = $name;
+         last;
+      }
+   }
    # Ordering must match struct in src/charset/aliases.h
-   $output .= "\t{ " . $mibenum . ", " . length($canon) . ', "' . $canon . '" },' . "\n";
+   $output .= "\t{ " . $mibenum . ", " . length($canon) . ', "' . $canon . '", PARSERUTILS_CHARSET_HANDLER_' . $handler . " },\n";
+   $bymib[$mibenum] = $canonnr + 1 unless (defined $bymib[$mibenum]);
    my $isunicode = 0;
    foreach my $unirexp (@{UNICODE_CHARSETS()}) {
       $isunicode = 1 if ($canon =~ $unirexp);
@@ -78,26 +100,95 @@ foreach my $canon (sort keys %charsets) {
 
 $output .= "};\n\nstatic const uint16_t charset_aliases_canon_count = ${canonnr};\n\n";
 
+# Index into canonical_charset_names, plus one, for each MIB enum; 0 if none
+$output .= "static const uint16_t canonical_charset_by_mib[] = {";
+for (my $i = 0; $i < scalar(@bymib); $i++) {
+   $output .= ($i % 8 == 0) ? "\n\t" : " ";
+   $output .= (defined $bymib[$i] ? $bymib[$i] : 0) . ",";
+}
+$output .= "\n};\n\nstatic const uint16_t canonical_charset_by_mib_count = " . scalar(@bymib) . ";\n\n";
+
 $output .= <<'EOT';
 typedef struct {
 	uint16_t name_len;
 	const char *name;
-	parserutils_charset_aliases_canon *canon;
+	const parserutils_charset_aliases_canon *canon;
 } parserutils_charset_aliases_alias;
 
-static parserutils_charset_aliases_alias charset_aliases[] = {
+static const parserutils_charset_aliases_alias charset_aliases[] = {
 EOT
 
-my $aliascount = 0;
+# Lay the aliases out by a minimal perfect hash of their names, built by
+# hash and displace. Each alias is first hashed with seed 0 to a bucket.
+# Buckets holding several aliases are given the smallest seed that hashes
+# all of their aliases to free slots; a bucket holding one alias takes a
+# free slot directly, recorded as -(slot + 1). Must match the lookup in
+# src/charset/aliases.c
+sub alias_hash {
+   my ($seed, $key) = @_;
+   my $h = ($seed == 0) ? 0x01000193 : $seed;
+   foreach my $c (unpack("C*", $key)) {
+      $h = (($h * 0x01000193) & 0xffffffff) ^ $c;
+   }
+   return $h;
+}
 
-foreach my $alias (sort keys %aliases) {
+my @keys = sort keys %aliases;
+my $aliascount = scalar(@keys);
+my $maxlen = 0;
+my @buckets;
+my @displace = (0) x $aliascount;
+my @slots;
+
+foreach my $alias (@keys) {
+   push @{$buckets[alias_hash(0, $alias) % $aliascount]}, $alias;
+   $maxlen = length($alias) if (length($alias) > $maxlen);
+}
+
+my @order = sort { scalar(@{$buckets[$b] || []}) <=> scalar(@{$buckets[$a] || []}) or $a <=> $b } (0 .. $aliascount - 1);
+
+my $bucketnr;
+foreach $bucketnr (@order) {
+   my @bucket = @{$buckets[$bucketnr] || []};
+   last if (scalar(@bucket) <= 1);
+
+   SEED: for (my $seed = 1; ; $seed++) {
+      my %taken;
+      foreach my $alias (@bucket) {
+         my $slot = alias_hash($seed, $alias) % $aliascount;
+         next SEED if (defined $slots[$slot] || $taken{$slot});
+         $taken{$slot} = $alias;
+      }
+      foreach my $slot (keys %taken) {
+         $slots[$slot] = $taken{$slot};
+      }
+      $displace[$bucketnr] = $seed;
+      last;
+   }
+}
+
+my $free = 0;
+foreach $bucketnr (@order) {
+   next unless (defined $buckets[$bucketnr] && scalar(@{$buckets[$bucketnr]}) == 1);
+   $free++ while (defined $slots[$free]);
+   $slots[$free] = $buckets[$bucketnr][0];
+   $displace[$bucketnr] = -($free + 1);
+}
+
+foreach my $alias (@slots) {
    my $canonnr = $aliases{$alias};
    $output .= "\t{ " . length($alias) . ', "' . $alias . '", &canonical_charset_names[' . $canonnr . "] },\n";
-   $aliascount += 1;
 }
 
 $output .= "};\n\n";
 
+$output .= "static const int32_t charset_aliases_displace[] = {";
+for (my $i = 0; $i < $aliascount; $i++) {
+   $output .= ($i % 8 == 0) ? "\n\t" : " ";
+   $output .= $displace[$i] . ",";
+}
+$output .= "\n};\n\n";
+
 # Drop the final " || "
 chop $unicodeexp;
 chop $unicodeexp;
@@ -107,6 +198,8 @@ chop $unicodeexp;
 $output .= <<"EOS";
 static const uint16_t charset_aliases_count = ${aliascount};
 
+#define CHARSET_ALIASES_MAX_LEN (${maxlen})
+
 #define MIBENUM_IS_UNICODE(x) ($unicodeexp)
 EOS
 
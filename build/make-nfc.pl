@@ -0,0 +1,165 @@
+#!/usr/bin/perl
+
+use warnings;
+use strict;
+
+use Unicode::Normalize qw(getCanon getComposite getCombinClass isComp_Ex
+		isNFC_NO isNFC_MAYBE);
+use Unicode::UCD;
+
+# Generate the tables used for Unicode Normalisation Form C, from the
+# character database built into Perl.
+#
+# Usage: make-nfc.pl > src/input/nfc_tables.h
+#
+# Three tables are emitted:
+#
+#   + Properties of each code point below NFC_LIMIT, in two stages: the
+#     first indexed by code point / NFC_BLOCK, and the second by the code
+#     point within its block. Each entry holds the canonical combining class
+#     in its low 8 bits, the NFC_Quick_Check value above those, and a flag
+#     for code points which have a canonical decomposition. Every code
+#     point from NFC_LIMIT up is a starter, is NFC, and doesn't decompose.
+#   + The full canonical decomposition of each code point that has one,
+#     sorted by code point, as ranges of a pool of code points.
+#   + The primary composites, sorted by the pair of code points they are
+#     composed from.
+#
+# Hangul syllables are decomposed and composed algorithmically, so aren't
+# included in the latter two.
+
+use constant BLOCK => 128;
+use constant LIMIT => 0x30000;
+
+sub hangul {
+	my ($cp) = @_;
+
+	return ($cp >= 0xAC00 && $cp <= 0xD7A3);
+}
+
+my (@props, @decomps, @pool, @comps);
+
+for (my $cp = 0; $cp < 0x110000; $cp++) {
+	next if ($cp >= 0xD800 && $cp <= 0xDFFF);
+
+	my $ccc = getCombinClass($cp);
+	my $qc = isNFC_NO($cp) ? 1 : isNFC_MAYBE($cp) ? 2 : 0;
+	my $canon = getCanon($cp);
+	my $decomposes = (defined($canon) && !hangul($cp)) ? 1 : 0;
+
+	die sprintf("U+%04X is beyond the property table\n", $cp)
+			if ($cp >= LIMIT && ($ccc || $qc || $decomposes));
+
+	$props[$cp] = $ccc | ($qc << 8) | ($decomposes << 10) if ($cp < LIMIT);
+
+	next unless ($decomposes);
+
+	my @cps = map { ord } split(//, $canon);
+
+	push(@decomps, [ $cp, scalar(@pool), scalar(@cps) ]);
+	push(@pool, @cps);
+
+	# Primary composites are canonical decompositions of two code points,
+	# which aren't excluded from composition
+	next if (isComp_Ex($cp));
+
+	my @pair = map { hex } split(/ /,
+			Unicode::UCD::charinfo($cp)->{decomposition});
+
+	next unless (scalar(@pair) == 2 &&
+			getComposite($pair[0], $pair[1]) == $cp);
+
+	push(@comps, [ @pair, $cp ]);
+}
+
+# Merge identical blocks of properties
+my (@stage1, @stage2, %blocks);
+
+for (my $block = 0; $block < LIMIT / BLOCK; $block++) {
+	my @entries = map { $props[$_] || 0 }
+			($block * BLOCK .. ($block + 1) * BLOCK - 1);
+	my $key = join(',', @entries);
+
+	if (!exists($blocks{$key})) {
+		$blocks{$key} = scalar(@stage2) / BLOCK;
+		push(@stage2, @entries);
+	}
+
+	push(@stage1, $blocks{$key});
+}
+
+die "Too many distinct blocks of properties\n"
+		if (scalar(@stage2) / BLOCK > 256);
+
+@comps = sort { $a->[0] <=> $b->[0] || $a->[1] <=> $b->[1] } @comps;
+
+sub emit {
+	my ($type, $name, $format, $perline, @values) = @_;
+
+	print "static const $type $name\[" . scalar(@values) . "] = {\n";
+
+	for (my $i = 0; $i < scalar(@values); $i += $perline) {
+		my $end = $i + $perline - 1;
+
+		$end = $#values if ($end > $#values);
+
+		print "\t" . join(', ', map { sprintf($format, $_) }
+				@values[$i .. $end]) . ",\n";
+	}
+
+	print "};\n\n";
+}
+
+print <<EOF;
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#ifndef parserutils_input_nfctables_h_
+#define parserutils_input_nfctables_h_
+
+/* Unicode Normalisation Form C tables, generated by build/make-nfc.pl from
+ * the Unicode ${\Unicode::UCD::UnicodeVersion()} character database. See there for their layout.
+ */
+
+#define NFC_BLOCK (${\BLOCK})
+#define NFC_LIMIT (0x${\sprintf('%X', LIMIT)})
+
+#define NFC_CCC_MASK   (0x00FF)	/**< Canonical combining class */
+#define NFC_QC_SHIFT   (8)
+#define NFC_QC_MASK    (0x0300)	/**< NFC_Quick_Check */
+#define NFC_QC_YES     (0)
+#define NFC_QC_NO      (1)
+#define NFC_QC_MAYBE   (2)
+#define NFC_DECOMPOSES (0x0400)	/**< Has a canonical decomposition */
+
+/** Canonical decomposition of a code point */
+typedef struct nfc_decomposition {
+	uint32_t cp;		/**< Code point */
+	uint16_t index;		/**< Index of decomposition in nfc_pool */
+	uint16_t length;	/**< Length of decomposition */
+} nfc_decomposition;
+
+/** Primary composite of a pair of code points */
+typedef struct nfc_composition {
+	uint32_t first;		/**< First code point */
+	uint32_t second;	/**< Second code point */
+	uint32_t composite;	/**< Composite */
+} nfc_composition;
+
+EOF
+
+emit('uint8_t', 'nfc_stage1', '%3d', 16, @stage1);
+emit('uint16_t', 'nfc_stage2', '0x%04X', 8, @stage2);
+print "static const nfc_decomposition nfc_decompositions[" .
+		scalar(@decomps) . "] = {\n";
+print "\t{ " . sprintf('0x%05X, %4d, %d', @$_) . " },\n" foreach (@decomps);
+print "};\n\n";
+emit('uint32_t', 'nfc_pool', '0x%05X', 8, @pool);
+print "static const nfc_composition nfc_compositions[" .
+		scalar(@comps) . "] = {\n";
+print "\t{ " . sprintf('0x%05X, 0x%05X, 0x%05X', @$_) . " },\n"
+		foreach (@comps);
+print "};\n\n#endif\n";
@@ -68,12 +68,29 @@ typedef enum parserutils_charset_codec_errormode {
 	PARSERUTILS_CHARSET_CODEC_ERROR_TRANSLIT = 2
 } parserutils_charset_codec_errormode;
 
+/**
+ * Charset codec UCS-4 byte order
+ *
+ * This determines the byte order of the UCS-4 data produced by decoding
+ * and consumed by encoding. The default is big endian. Choosing the host's
+ * byte order avoids swapping each character on little endian hosts.
+ */
+typedef enum parserutils_charset_codec_ucs4_order {
+	/** UCS-4 data is big endian */
+	PARSERUTILS_CHARSET_CODEC_UCS4_BIG  = 0,
+	/** UCS-4 data is in the host's byte order */
+	PARSERUTILS_CHARSET_CODEC_UCS4_HOST = 1
+} parserutils_charset_codec_ucs4_order;
+
 /**
  * Charset codec option types
  */
 typedef enum parserutils_charset_codec_opttype {
 	/** Set codec error mode */
-	PARSERUTILS_CHARSET_CODEC_ERROR_MODE  = 1
+	PARSERUTILS_CHARSET_CODEC_ERROR_MODE  = 1,
+
+	/** Set byte order of UCS-4 data */
+	PARSERUTILS_CHARSET_CODEC_UCS4_ORDER  = 2
 } parserutils_charset_codec_opttype;
 
 /**
@@ -85,6 +102,12 @@ typedef union parserutils_charset_codec_optparams {
 		/** The desired error handling mode */
 		parserutils_charset_codec_errormode mode;
 	} error_mode;
+
+	/** Parameters for UCS-4 byte order setting */
+	struct {
+		/** The desired byte order */
+		parserutils_charset_codec_ucs4_order order;
+	} ucs4_order;
 } parserutils_charset_codec_optparams;
 
 
@@ -92,6 +115,10 @@ typedef union parserutils_charset_codec_optparams {
 parserutils_error parserutils_charset_codec_create(const char *charset,
 		parserutils_alloc alloc, void *pw,
 		parserutils_charset_codec **codec);
+/* Create a charset codec from the MIB enum of its charset */
+parserutils_error parserutils_charset_codec_create_mib(uint16_t mibenum,
+		parserutils_alloc alloc, void *pw,
+		parserutils_charset_codec **codec);
 /* Destroy a charset codec */
 parserutils_error parserutils_charset_codec_destroy(
 		parserutils_charset_codec *codec);
@@ -23,6 +23,9 @@ extern "C"
 uint16_t parserutils_charset_mibenum_from_name(const char *alias, size_t len);
 /* Convert a MIB enum value into an encoding alias */
 const char *parserutils_charset_mibenum_to_name(uint16_t mibenum);
+/* Convert a MIB enum value into an encoding alias and its length */
+const char *parserutils_charset_mibenum_to_name_len(uint16_t mibenum,
+		size_t *len);
 /* Determine if a MIB enum value represents a Unicode variant */
 bool parserutils_charset_mibenum_is_unicode(uint16_t mibenum);
 
@@ -0,0 +1,42 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_charset_pool_h_
+#define parserutils_charset_pool_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <parserutils/errors.h>
+#include <parserutils/functypes.h>
+
+/**
+ * Pool of charset converters, for reuse between input streams
+ *
+ * Streams created with a pool take their charset codecs and iconv
+ * descriptors from it, and return them to it when destroyed, so that
+ * creating a stream for a commonly used charset need not open a new
+ * converter. A pool is owned by its creator and must outlive any stream
+ * using it. It performs no locking, so each thread needs its own.
+ */
+typedef struct parserutils_charset_pool parserutils_charset_pool;
+
+/* Create a charset converter pool */
+parserutils_error parserutils_charset_pool_create(parserutils_alloc alloc,
+		void *pw, parserutils_charset_pool **pool);
+/* Destroy a charset converter pool */
+parserutils_error parserutils_charset_pool_destroy(
+		parserutils_charset_pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
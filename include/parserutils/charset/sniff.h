@@ -0,0 +1,53 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_charset_sniff_h_
+#define parserutils_charset_sniff_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <parserutils/errors.h>
+
+/**
+ * Number of bytes at the start of a document considered when sniffing
+ */
+#define PARSERUTILS_CHARSET_SNIFF_LENGTH (1024)
+
+/**
+ * Confidence in a sniffed charset
+ */
+typedef enum parserutils_charset_confidence {
+	/** No charset could be determined */
+	PARSERUTILS_CHARSET_CONFIDENCE_NONE      = 0,
+	/** Guessed from the distribution of bytes */
+	PARSERUTILS_CHARSET_CONFIDENCE_TENTATIVE = 1,
+	/** Data is ASCII, or valid UTF-8 containing non-ASCII characters */
+	PARSERUTILS_CHARSET_CONFIDENCE_HIGH      = 2,
+	/** Data starts with a byte order mark */
+	PARSERUTILS_CHARSET_CONFIDENCE_CERTAIN   = 3
+} parserutils_charset_confidence;
+
+/* Guess the charset of a document from its first few bytes */
+parserutils_error parserutils_charset_sniff(const uint8_t *data, size_t len,
+		uint16_t *mibenum, parserutils_charset_confidence *confidence);
+
+/* Charset detection function for input streams, using the sniffer */
+parserutils_error parserutils_charset_detect(const uint8_t *data, size_t len,
+		uint16_t *mibenum, uint32_t *source);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -28,6 +28,10 @@ parserutils_error parserutils_charset_utf8_from_ucs4(uint32_t ucs4, uint8_t **s,
 
 parserutils_error parserutils_charset_utf8_length(const uint8_t *s, size_t max,
 		size_t *len);
+parserutils_error parserutils_charset_utf8_count(const uint8_t *s, size_t len,
+		size_t *chars, size_t *units);
+parserutils_error parserutils_charset_utf8_advance(const uint8_t *s,
+		size_t len, size_t n, size_t *off);
 parserutils_error parserutils_charset_utf8_char_byte_length(const uint8_t *s,
 		size_t *len);
 
@@ -22,6 +22,26 @@ extern "C"
 /* Type of allocation function for parserutils */
 typedef void *(*parserutils_alloc)(void *ptr, size_t size, void *pw);
 
+/* Type of a task, given to a parserutils_run_tasks function to run */
+typedef void (*parserutils_task)(void *ctx, size_t index);
+
+/* Type of function running tasks, which may run them concurrently. It must
+ * call task(ctx, index) once for each index below count, in any order and
+ * on any threads, returning only once all have finished. */
+typedef void (*parserutils_run_tasks)(parserutils_task task, void *ctx,
+		size_t count, void *pw);
+
+/* Type of function starting a task in the background. It must arrange for
+ * task(ctx, 0) to be called once, on any thread, and may return before it
+ * has been. */
+typedef void (*parserutils_submit_task)(parserutils_task task, void *ctx,
+		void *pw);
+
+/* Type of function taking or releasing a lock. It is called with acquire
+ * true to take the lock, waiting until no other thread holds it, and false
+ * to release it. It is never called to take a lock the thread holds. */
+typedef void (*parserutils_lock)(bool acquire, void *pw);
+
 #ifdef __cplusplus
 }
 #endif
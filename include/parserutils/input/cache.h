@@ -0,0 +1,70 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_input_cache_h_
+#define parserutils_input_cache_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <parserutils/errors.h>
+#include <parserutils/functypes.h>
+
+/**
+ * Cache of decoded documents, for reuse between input streams
+ *
+ * Streams given a cache look in it for the UTF-8 decoded from a document
+ * with the same raw data, in the same charset, and copy that rather than
+ * decoding the document again. Documents not found are decoded in one go,
+ * and the result added to the cache. The least recently used documents are
+ * discarded to keep the cache within its size. A cache is owned by its
+ * creator and must outlive any stream using it.
+ *
+ * A cache created with a lock function may be shared by streams on any
+ * number of threads. The lock is held only while looking a document up and
+ * while adding one; a cached document is never changed once added, so the
+ * comparison with a stream's data and the copy of its UTF-8 are done
+ * without it. A cache created without a lock must be used by one thread at
+ * a time.
+ */
+typedef struct parserutils_decode_cache parserutils_decode_cache;
+
+/**
+ * Decode cache statistics
+ */
+typedef struct parserutils_decode_cache_stats {
+	uint32_t hits;		/**< Documents found in the cache */
+	uint32_t misses;	/**< Documents looked for and not found */
+	uint32_t evictions;	/**< Documents discarded to make room */
+	uint32_t entries;	/**< Documents in the cache */
+	size_t size;		/**< Bytes used by the documents */
+} parserutils_decode_cache_stats;
+
+/* Create a decode cache */
+parserutils_error parserutils_decode_cache_create(size_t size,
+		parserutils_lock lock, void *lock_pw,
+		parserutils_alloc alloc, void *pw,
+		parserutils_decode_cache **cache);
+/* Destroy a decode cache */
+parserutils_error parserutils_decode_cache_destroy(
+		parserutils_decode_cache *cache);
+/* Read a decode cache's statistics */
+parserutils_error parserutils_decode_cache_get_stats(
+		const parserutils_decode_cache *cache,
+		parserutils_decode_cache_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
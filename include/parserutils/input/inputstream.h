@@ -22,9 +22,13 @@ extern "C"
 
 #include <parserutils/errors.h>
 #include <parserutils/functypes.h>
+#include <parserutils/trace.h>
 #include <parserutils/types.h>
+#include <parserutils/charset/pool.h>
 #include <parserutils/charset/utf8.h>
+#include <parserutils/input/cache.h>
 #include <parserutils/utils/buffer.h>
+#include <parserutils/utils/byteset.h>
 
 /**
  * Type of charset detection function
@@ -33,6 +37,28 @@ typedef parserutils_error (*parserutils_charset_detect_func)(
 		const uint8_t *data, size_t len, 
 		uint16_t *mibenum, uint32_t *source);
 
+/**
+ * Type of function releasing data lent to an input stream
+ *
+ * \param data  The data, as appended
+ * \param len   Length, in bytes, of data
+ * \param pw    Client private data given with the data
+ */
+typedef void (*parserutils_inputstream_release)(const uint8_t *data,
+		size_t len, void *pw);
+
+/**
+ * A segment of data to append to an input stream
+ */
+typedef struct parserutils_inputstream_iov {
+	const uint8_t *data;	/**< Data, in document charset */
+	size_t len;		/**< Length, in bytes, of data */
+	/** Function releasing the data once it's been decoded, or NULL for
+	 * the stream to copy it */
+	parserutils_inputstream_release release;
+	void *pw;		/**< Client private data for release */
+} parserutils_inputstream_iov;
+
 /**
  * Input stream object
  */
@@ -45,19 +71,261 @@ typedef struct parserutils_inputstream
 	bool had_eof;			/**< Whether EOF has been reached */
 } parserutils_inputstream;
 
+/**
+ * Input stream option types
+ */
+typedef enum parserutils_inputstream_opttype {
+	PARSERUTILS_INPUTSTREAM_SET_LIMITS    = 0,
+	PARSERUTILS_INPUTSTREAM_SET_RETENTION = 1,
+	PARSERUTILS_INPUTSTREAM_SET_SIZE_HINT = 2,
+	PARSERUTILS_INPUTSTREAM_SET_PARALLEL  = 3,
+	PARSERUTILS_INPUTSTREAM_SET_TRACE     = 4,
+	PARSERUTILS_INPUTSTREAM_SET_PIPELINE  = 5,
+	PARSERUTILS_INPUTSTREAM_SET_NORMALISE = 6,
+	PARSERUTILS_INPUTSTREAM_SET_CACHE     = 7,
+	PARSERUTILS_INPUTSTREAM_SET_REPLACEMENTS = 8
+} parserutils_inputstream_opttype;
+
+/**
+ * Input stream option parameters
+ */
+typedef union parserutils_inputstream_optparams {
+	/**
+	 * Parameters for buffer size limits
+	 *
+	 * Setting buffer limits places the stream in a bounded-memory mode.
+	 * Appending data that would take the raw buffer beyond its limit fails
+	 * with PARSERUTILS_FULL; the data should be appended again once some of
+	 * the stream has been read. Chunks larger than the limit are never
+	 * accepted. The UTF-8 buffer will not be grown beyond its limit, so
+	 * peeking further ahead than it can hold fails with PARSERUTILS_NOMEM.
+	 * Both buffers are shrunk again as their contents are consumed.
+	 *
+	 * The buffers grow in powers of two from 4kB, so limits that are also
+	 * powers of two are used most efficiently. Data inserted into the
+	 * stream is not subject to the limits.
+	 */
+	struct {
+		/** Maximum length of undecoded data, or 0 for no limit */
+		size_t raw;
+		/** Maximum size of decoded data buffer, or 0 for no limit */
+		size_t utf8;
+	} limits;
+
+	/**
+	 * Parameters for retaining decoded raw data
+	 *
+	 * Setting a retention limit, before any data has been read from the
+	 * stream, causes the stream to keep the raw data it has decoded, for as
+	 * long as there is no more of it than the limit. Until then, the
+	 * charset may be changed by parserutils_inputstream_change_charset, and
+	 * the stream will be decoded again from its start. Retained data counts
+	 * towards the raw buffer limit.
+	 */
+	struct {
+		/** Maximum length of raw data to keep, or 0 to keep none */
+		size_t limit;
+	} retention;
+
+	/**
+	 * Parameters for presizing buffers
+	 *
+	 * Giving a size hint, before any data has been appended, allocates
+	 * buffers large enough for a document of that length up front, within
+	 * any limits, rather than growing them as data arrives.
+	 */
+	struct {
+		/** Expected length of the document, in bytes */
+		size_t length;
+	} size_hint;
+
+	/** Parameters for decoding in parallel */
+	struct {
+		/** Function running decoding tasks, or NULL to decode
+		 * serially */
+		parserutils_run_tasks run;
+		/** Client private data for run */
+		void *pw;
+		/** Raw bytes for each task to decode, or 0 for a default */
+		size_t segment;
+		/** Maximum number of tasks per refill, or 0 for a default */
+		uint32_t tasks;
+	} parallel;
+
+	/**
+	 * Parameters for tracing
+	 *
+	 * Setting a trace function attaches it to the stream's buffers and
+	 * charset filter, to be called at their trace points. Only builds with
+	 * WITH_TRACE defined have trace points; other builds accept the option
+	 * and never call the function.
+	 */
+	struct {
+		/** Function receiving trace events, or NULL to detach */
+		parserutils_trace_func func;
+		/** Client private data for func */
+		void *pw;
+	} trace;
+
+	/**
+	 * Parameters for decoding ahead in the background
+	 *
+	 * Setting a pipeline submit function decodes the raw data a segment at
+	 * a time in the background, while the reader works through what has
+	 * already been decoded. A task is started as each segment's worth of
+	 * data arrives and after each refill, and its output is used by the
+	 * next refill, which waits for it first. Only one task runs at a time,
+	 * as each continues from where the last left off. Decoding ahead can't
+	 * honour a retention limit or a UTF-8 buffer limit, so setting either
+	 * while the pipeline is in use fails with PARSERUTILS_INVALID, as does
+	 * starting it with either set. Builds without GCC-style atomics return
+	 * PARSERUTILS_BADPARM.
+	 */
+	struct {
+		/** Function starting decoding tasks, or NULL to decode
+		 * only when the data is read */
+		parserutils_submit_task submit;
+		/** Function called repeatedly while waiting for a task to
+		 * finish, or NULL to spin */
+		void (*wait)(void *pw);
+		/** Client private data for submit and wait */
+		void *pw;
+		/** Raw bytes for each task to decode, or 0 for a default */
+		size_t segment;
+	} pipeline;
+
+	/**
+	 * Parameters for normalisation
+	 *
+	 * Setting normalisation converts the decoded data to Unicode
+	 * Normalisation Form C. Text which is already NFC, as most is, is
+	 * recognised and copied a run at a time; only the characters around
+	 * combining marks and the like are decomposed and recomposed. Even
+	 * UTF-8 input is then decoded through the charset filter, and only
+	 * serially, as a character may combine with those after it. For the
+	 * same reason, the last characters of the data appended so far are held
+	 * back until more arrives, or EOF is flagged. The position reported for
+	 * normalised data counts its characters, not those of the raw data, and
+	 * its source offset may be that of the start of a refill. Normalisation
+	 * conflicts with the pipeline, in the same way as a retention limit or
+	 * UTF-8 buffer limit.
+	 */
+	struct {
+		/** Whether to normalise decoded data to NFC */
+		bool nfc;
+	} normalise;
+
+	/**
+	 * Parameters for reusing decoded documents
+	 *
+	 * Setting a decode cache reuses the UTF-8 decoded from earlier
+	 * documents with the same raw data and charset, which is copied from
+	 * the cache rather than decoded again. A document is looked for when it
+	 * is first read, or read again after its charset is changed, provided
+	 * it has all been appended and EOF flagged by then, and nothing
+	 * inserted. One not found is decoded in one go, and added to the cache.
+	 * Lent data must be in a single segment. UTF-8 documents, which are
+	 * only validated unless normalised, don't use the cache, nor do any
+	 * while the pipeline or a UTF-8 buffer limit is in use.
+	 */
+	struct {
+		/** Cache of decoded documents, or NULL to use none */
+		parserutils_decode_cache *cache;
+	} cache;
+
+	/**
+	 * Parameters for recording replacements of invalid input
+	 *
+	 * Setting a replacement limit records where invalid input is replaced
+	 * by U+FFFD as it is decoded, up to that many times, for
+	 * parserutils_inputstream_get_replacements to report.
+	 */
+	struct {
+		/** Maximum number of replacements to record, or 0 to record
+		 * none */
+		size_t limit;
+	} replacements;
+} parserutils_inputstream_optparams;
+
+/**
+ * Input stream performance counters
+ */
+typedef struct parserutils_inputstream_stats {
+	uint32_t peek_slow;	/**< Calls to the slow form of peek */
+	uint32_t refills;	/**< Times the UTF-8 buffer was refilled */
+	uint64_t decoded;	/**< Raw bytes decoded */
+	uint64_t moved;		/**< Bytes moved within the buffers */
+	uint32_t grows;		/**< Times a buffer's allocation grew */
+	size_t peak;		/**< Largest buffer allocation, in bytes */
+	uint32_t replacements;	/**< U+FFFD substituted for invalid input */
+} parserutils_inputstream_stats;
+
+/**
+ * Position of an input stream's cursor
+ */
+typedef struct parserutils_inputstream_pos {
+	size_t offset;		/**< UTF-8 bytes read */
+	size_t source;		/**< Raw bytes the next character follows */
+	uint32_t line;		/**< Line number, from 1 */
+	uint32_t column;	/**< Characters since the line began, from 1 */
+} parserutils_inputstream_pos;
+
+/**
+ * Replacement of invalid input by U+FFFD
+ */
+typedef struct parserutils_inputstream_replacement {
+	size_t offset;		/**< UTF-8 offset of the U+FFFD */
+	size_t source;		/**< Raw offset of the input replaced */
+} parserutils_inputstream_replacement;
+
+/** Depth to which marks may be nested */
+#define PARSERUTILS_INPUTSTREAM_MAX_MARKS (8)
+
 /* Create an input stream */
 parserutils_error parserutils_inputstream_create(const char *enc,
 		uint32_t encsrc, parserutils_charset_detect_func csdetect,
 		parserutils_alloc alloc, void *pw, 
 		parserutils_inputstream **stream);
+/* Create an input stream which takes its converters from a pool */
+parserutils_error parserutils_inputstream_create_pooled(const char *enc,
+		uint32_t encsrc, parserutils_charset_detect_func csdetect,
+		parserutils_charset_pool *pool,
+		parserutils_alloc alloc, void *pw,
+		parserutils_inputstream **stream);
+/* Create an input stream reading from a file */
+parserutils_error parserutils_inputstream_create_from_file(const char *path,
+		const char *enc, uint32_t encsrc,
+		parserutils_charset_detect_func csdetect,
+		parserutils_alloc alloc, void *pw,
+		parserutils_inputstream **stream);
 /* Destroy an input stream */
 parserutils_error parserutils_inputstream_destroy(
 		parserutils_inputstream *stream);
+/* Reset an input stream, to read another document */
+parserutils_error parserutils_inputstream_reset(
+		parserutils_inputstream *stream,
+		const char *enc, uint32_t encsrc,
+		parserutils_charset_detect_func csdetect);
+
+/* Configure an input stream */
+parserutils_error parserutils_inputstream_setopt(
+		parserutils_inputstream *stream,
+		parserutils_inputstream_opttype type,
+		parserutils_inputstream_optparams *params);
 
 /* Append data to an input stream */
 parserutils_error parserutils_inputstream_append(
 		parserutils_inputstream *stream,
 		const uint8_t *data, size_t len);
+/* Append segments of data to stream, each copied or lent */
+parserutils_error parserutils_inputstream_append_iov(
+		parserutils_inputstream *stream,
+		const parserutils_inputstream_iov *iov, uint32_t count);
+/* Append data to stream, lent until it has been decoded */
+parserutils_error parserutils_inputstream_append_borrowed(
+		parserutils_inputstream *stream,
+		const uint8_t *data, size_t len,
+		parserutils_inputstream_release release, void *pw);
 /* Insert data into stream at current location */
 parserutils_error parserutils_inputstream_insert(
 		parserutils_inputstream *stream,
@@ -172,6 +440,49 @@ static inline void parserutils_inputstream_advance(
 	stream->cursor += bytes;
 }
 
+/* Out-of-line forms of the above, for bindings which can't use inlines */
+parserutils_error parserutils_inputstream_peek_extern(
+		parserutils_inputstream *stream,
+		size_t offset, const uint8_t **ptr, size_t *length);
+void parserutils_inputstream_advance_extern(
+		parserutils_inputstream *stream, size_t bytes);
+
+/* Look at the run of complete characters starting at an offset */
+parserutils_error parserutils_inputstream_peek_span(
+		parserutils_inputstream *stream,
+		size_t offset, const uint8_t **ptr, size_t *length);
+
+/* Find the next member of a byte set after the cursor */
+parserutils_error parserutils_inputstream_scan_until(
+		parserutils_inputstream *stream,
+		const parserutils_byteset *set, size_t *length);
+
+/* Retrieve the stream's performance counters */
+parserutils_error parserutils_inputstream_get_stats(
+		parserutils_inputstream *stream,
+		parserutils_inputstream_stats *stats);
+
+/* Find where the cursor is in the document */
+parserutils_error parserutils_inputstream_position(
+		parserutils_inputstream *stream,
+		parserutils_inputstream_pos *pos);
+
+/* Find where invalid input was replaced */
+parserutils_error parserutils_inputstream_get_replacements(
+		parserutils_inputstream *stream,
+		const parserutils_inputstream_replacement **index,
+		size_t *count);
+
+/* Remember the cursor, to return to it later */
+parserutils_error parserutils_inputstream_mark(
+		parserutils_inputstream *stream);
+/* Return to, and forget, the last mark */
+parserutils_error parserutils_inputstream_rewind(
+		parserutils_inputstream *stream);
+/* Forget the last mark */
+parserutils_error parserutils_inputstream_unmark(
+		parserutils_inputstream *stream);
+
 /* Read the document charset */
 const char *parserutils_inputstream_read_charset(
 		parserutils_inputstream *stream, uint32_t *source);
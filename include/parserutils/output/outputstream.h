@@ -0,0 +1,112 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2007 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_output_outputstream_h_
+#define parserutils_output_outputstream_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include <parserutils/errors.h>
+#include <parserutils/functypes.h>
+#include <parserutils/charset/pool.h>
+
+/**
+ * Type of function receiving an output stream's encoded data
+ *
+ * \param data  Data in the stream's charset
+ * \param len   Length, in bytes, of data
+ * \param pw    Client private data given when the stream was created
+ * \return PARSERUTILS_OK if all of the data was written, or an error, in
+ *         which case the stream offers the same data again next time
+ */
+typedef parserutils_error (*parserutils_outputstream_writer)(
+		const uint8_t *data, size_t len, void *pw);
+
+/**
+ * Output stream object
+ */
+typedef struct parserutils_outputstream parserutils_outputstream;
+
+/**
+ * Treatment of characters the output charset cannot represent
+ */
+typedef enum parserutils_outputstream_fallback {
+	/** Replace the character with '?', or U+FFFD where that exists */
+	PARSERUTILS_OUTPUTSTREAM_FALLBACK_LOOSE  = 0,
+	/** Stop at the character, reporting PARSERUTILS_INVALID */
+	PARSERUTILS_OUTPUTSTREAM_FALLBACK_STRICT = 1,
+	/** Replace the character with a reference, such as &#8364; */
+	PARSERUTILS_OUTPUTSTREAM_FALLBACK_NCR    = 2
+} parserutils_outputstream_fallback;
+
+/**
+ * Output stream option types
+ */
+typedef enum parserutils_outputstream_opttype {
+	PARSERUTILS_OUTPUTSTREAM_SET_FALLBACK   = 0,
+	PARSERUTILS_OUTPUTSTREAM_SET_BLOCK_SIZE = 1
+} parserutils_outputstream_opttype;
+
+/**
+ * Output stream option parameters
+ */
+typedef union parserutils_outputstream_optparams {
+	/** Parameters for fallback setting */
+	struct {
+		/** Treatment of unrepresentable characters */
+		parserutils_outputstream_fallback mode;
+	} fallback;
+
+	/** Parameters for block sizing */
+	struct {
+		/** Bytes of UTF-8 to batch, and of output to give the writer
+		 * at once, or 0 for a default */
+		size_t size;
+	} block;
+} parserutils_outputstream_optparams;
+
+/* Create an output stream */
+parserutils_error parserutils_outputstream_create(const char *enc,
+		parserutils_outputstream_writer writer, void *writer_pw,
+		parserutils_alloc alloc, void *pw,
+		parserutils_outputstream **stream);
+/* Create an output stream which takes its charset converters from a pool */
+parserutils_error parserutils_outputstream_create_pooled(const char *enc,
+		parserutils_outputstream_writer writer, void *writer_pw,
+		parserutils_charset_pool *pool,
+		parserutils_alloc alloc, void *pw,
+		parserutils_outputstream **stream);
+/* Destroy an output stream */
+parserutils_error parserutils_outputstream_destroy(
+		parserutils_outputstream *stream);
+
+/* Configure an output stream */
+parserutils_error parserutils_outputstream_setopt(
+		parserutils_outputstream *stream,
+		parserutils_outputstream_opttype type,
+		parserutils_outputstream_optparams *params);
+
+/* Append UTF-8 data to an output stream */
+parserutils_error parserutils_outputstream_append(
+		parserutils_outputstream *stream,
+		const uint8_t *data, size_t len);
+/* Encode and write all complete characters appended to an output stream */
+parserutils_error parserutils_outputstream_flush(
+		parserutils_outputstream *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,52 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_trace_h_
+#define parserutils_trace_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <inttypes.h>
+
+/**
+ * Events reported to trace hooks
+ *
+ * Events are only reported by builds with WITH_TRACE defined. Each has two
+ * arguments, as described.
+ */
+typedef enum parserutils_trace_event {
+	/** A refill moved unread UTF-8 to the start of its buffer.
+	 * Bytes moved, buffer allocation */
+	PARSERUTILS_TRACE_REFILL_MOVE     = 0,
+	/** A buffer's allocation grew. Old size, new size */
+	PARSERUTILS_TRACE_BUFFER_GROW     = 1,
+	/** The filter replaced input iconv rejected. Bytes replaced,
+	 * bytes remaining */
+	PARSERUTILS_TRACE_FILTER_RECOVER  = 2
+} parserutils_trace_event;
+
+/* Type of function receiving trace events */
+typedef void (*parserutils_trace_func)(parserutils_trace_event event,
+		uint64_t a, uint64_t b, void *pw);
+
+/**
+ * Trace hook
+ */
+typedef struct parserutils_trace {
+	parserutils_trace_func func;	/**< Function receiving events */
+	void *pw;			/**< Client private data for func */
+} parserutils_trace;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
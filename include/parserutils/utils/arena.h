@@ -0,0 +1,38 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2008 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_utils_arena_h_
+#define parserutils_utils_arena_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+
+#include <parserutils/errors.h>
+#include <parserutils/functypes.h>
+
+struct parserutils_arena;
+typedef struct parserutils_arena parserutils_arena;
+
+parserutils_error parserutils_arena_create(parserutils_alloc alloc, void *pw,
+		parserutils_arena **arena);
+parserutils_error parserutils_arena_destroy(parserutils_arena *arena);
+
+parserutils_error parserutils_arena_reset(parserutils_arena *arena);
+
+/* Allocation function, for use as a parserutils_alloc with the arena as pw */
+void *parserutils_arena_alloc(void *ptr, size_t len, void *pw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -15,6 +15,7 @@ extern "C"
 
 #include <parserutils/errors.h>
 #include <parserutils/functypes.h>
+#include <parserutils/trace.h>
 
 struct parserutils_buffer
 {
@@ -22,13 +23,28 @@ struct parserutils_buffer
 	size_t length;
 	size_t allocated;
 
+	/* Start of the allocation. Data discarded from the front of the
+	 * buffer is skipped over, rather than moved, so data may lie beyond
+	 * this. allocated counts the space from data onwards. */
+	uint8_t *base;
+
 	parserutils_alloc alloc;
 	void *pw;
+
+	/* Usage statistics */
+	size_t peak;		/* Largest allocation, in bytes */
+	uint32_t grows;		/* Number of times the allocation grew */
+	uint64_t moved;		/* Bytes moved within the allocation */
+
+	/* Hook receiving trace events, or NULL */
+	const parserutils_trace *trace;
 };
 typedef struct parserutils_buffer parserutils_buffer;
 
 parserutils_error parserutils_buffer_create(parserutils_alloc alloc, 
 		void *pw, parserutils_buffer **buffer);
+parserutils_error parserutils_buffer_create_with_capacity(size_t capacity,
+		parserutils_alloc alloc, void *pw, parserutils_buffer **buffer);
 parserutils_error parserutils_buffer_destroy(parserutils_buffer *buffer);
 
 parserutils_error parserutils_buffer_append(parserutils_buffer *buffer, 
@@ -39,6 +55,9 @@ parserutils_error parserutils_buffer_discard(parserutils_buffer *buffer,
 		size_t offset, size_t len);
 
 parserutils_error parserutils_buffer_grow(parserutils_buffer *buffer);
+parserutils_error parserutils_buffer_reserve(parserutils_buffer *buffer,
+		size_t len);
+parserutils_error parserutils_buffer_shrink(parserutils_buffer *buffer);
 
 parserutils_error parserutils_buffer_randomise(parserutils_buffer *buffer);
 
@@ -0,0 +1,47 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_utils_byteset_h_
+#define parserutils_utils_byteset_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <parserutils/errors.h>
+
+/** Largest set whose members are compared against directly */
+#define PARSERUTILS_BYTESET_DIRECT (8)
+
+/**
+ * Set of ASCII bytes to scan for
+ *
+ * Sets are compiled once, by parserutils_byteset_init, and may then be
+ * shared by any number of scans. The members should be treated as opaque.
+ */
+typedef struct parserutils_byteset {
+	uint32_t map[4];		/**< Bitmap of members */
+	uint8_t bytes[PARSERUTILS_BYTESET_DIRECT]; /**< Members, if few */
+	uint8_t count;			/**< Number of members */
+} parserutils_byteset;
+
+parserutils_error parserutils_byteset_init(parserutils_byteset *set,
+		const uint8_t *bytes, size_t count);
+
+size_t parserutils_byteset_scan(const parserutils_byteset *set,
+		const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
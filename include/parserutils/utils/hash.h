@@ -0,0 +1,43 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_utils_hash_h_
+#define parserutils_utils_hash_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <parserutils/errors.h>
+#include <parserutils/functypes.h>
+
+struct parserutils_hash;
+typedef struct parserutils_hash parserutils_hash;
+
+parserutils_error parserutils_hash_create(parserutils_alloc alloc, void *pw,
+		parserutils_hash **hash);
+parserutils_error parserutils_hash_destroy(parserutils_hash *hash);
+
+parserutils_error parserutils_hash_insert(parserutils_hash *hash,
+		const uint8_t *key, size_t len, void *value);
+parserutils_error parserutils_hash_find(const parserutils_hash *hash,
+		const uint8_t *key, size_t len, void **value);
+parserutils_error parserutils_hash_remove(parserutils_hash *hash,
+		const uint8_t *key, size_t len);
+parserutils_error parserutils_hash_get_count(const parserutils_hash *hash,
+		size_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
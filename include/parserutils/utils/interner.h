@@ -0,0 +1,54 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_utils_interner_h_
+#define parserutils_utils_interner_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <parserutils/errors.h>
+#include <parserutils/functypes.h>
+
+struct parserutils_interner;
+typedef struct parserutils_interner parserutils_interner;
+
+/**
+ * Interned string
+ *
+ * Each distinct string is interned once, so interned strings from the
+ * same interner are equal if and only if they are the same object.
+ */
+typedef struct parserutils_interned {
+	const uint8_t *data;	/**< String data, followed by a NUL */
+	size_t len;		/**< Length of string, in bytes */
+} parserutils_interned;
+
+parserutils_error parserutils_interner_create(parserutils_alloc alloc,
+		void *pw, parserutils_interner **interner);
+parserutils_error parserutils_interner_destroy(
+		parserutils_interner *interner);
+
+parserutils_error parserutils_interner_intern(parserutils_interner *interner,
+		const uint8_t *data, size_t len,
+		const parserutils_interned **str);
+parserutils_error parserutils_interner_find(
+		const parserutils_interner *interner,
+		const uint8_t *data, size_t len,
+		const parserutils_interned **str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,56 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2008 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_utils_meter_h_
+#define parserutils_utils_meter_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <parserutils/errors.h>
+#include <parserutils/functypes.h>
+
+struct parserutils_meter;
+typedef struct parserutils_meter parserutils_meter;
+
+/**
+ * Memory use measured by a meter
+ */
+typedef struct parserutils_meter_usage {
+	size_t current;		/**< Bytes allocated now */
+	size_t peak;		/**< Most bytes allocated at once */
+	size_t limit;		/**< Most bytes that may be allocated, or 0 */
+	uint32_t refused;	/**< Allocations refused by the limit */
+} parserutils_meter_usage;
+
+parserutils_error parserutils_meter_create(parserutils_alloc alloc, void *pw,
+		parserutils_meter **meter);
+parserutils_error parserutils_meter_destroy(parserutils_meter *meter);
+
+/* Limit the bytes that may be allocated at once, or 0 for no limit */
+parserutils_error parserutils_meter_set_limit(parserutils_meter *meter,
+		size_t limit);
+/* Read a meter's measurements */
+parserutils_error parserutils_meter_get_usage(parserutils_meter *meter,
+		parserutils_meter_usage *usage);
+/* Start measuring the peak afresh from the current use */
+parserutils_error parserutils_meter_reset_peak(parserutils_meter *meter);
+
+/* Allocation function, for use as a parserutils_alloc with the meter as pw */
+void *parserutils_meter_alloc(void *ptr, size_t len, void *pw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
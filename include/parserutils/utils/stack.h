@@ -14,22 +14,109 @@ extern "C"
 #endif
 
 #include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
 
 #include <parserutils/errors.h>
 #include <parserutils/functypes.h>
 
-struct parserutils_stack;
-typedef struct parserutils_stack parserutils_stack;
+/**
+ * Stack object
+ *
+ * The members are visible so that the common cases of pushing, popping and
+ * inspecting items can be inlined. Clients must not modify them.
+ */
+typedef struct parserutils_stack
+{
+	size_t item_size;		/**< Size of an item in the stack */
+	size_t items_allocated;		/**< Number of slots allocated */
+	int32_t current_item;		/**< Index of current item */
+	void *items;			/**< Items in stack */
+} parserutils_stack;
 
 parserutils_error parserutils_stack_create(size_t item_size, size_t chunk_size,
 		parserutils_alloc alloc, void *pw, parserutils_stack **stack);
+parserutils_error parserutils_stack_create_with_capacity(size_t item_size,
+		size_t chunk_size, size_t capacity,
+		parserutils_alloc alloc, void *pw, parserutils_stack **stack);
 parserutils_error parserutils_stack_destroy(parserutils_stack *stack);
 
-parserutils_error parserutils_stack_push(parserutils_stack *stack, 
+parserutils_error parserutils_stack_reserve(parserutils_stack *stack,
+		size_t count);
+
+/* Slow form of parserutils_stack_push, growing the stack if necessary */
+parserutils_error parserutils_stack_push_slow(parserutils_stack *stack,
 		const void *item);
-parserutils_error parserutils_stack_pop(parserutils_stack *stack, void *item);
 
-void *parserutils_stack_get_current(parserutils_stack *stack);
+/**
+ * Push an item onto the stack
+ *
+ * \param stack  The stack to push onto
+ * \param item   The item to push
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+static inline parserutils_error parserutils_stack_push(
+		parserutils_stack *stack, const void *item)
+{
+	if (stack != NULL && item != NULL && stack->current_item >= -1 &&
+			stack->current_item < INT32_MAX &&
+			(size_t) (stack->current_item + 1) <
+			stack->items_allocated) {
+		stack->current_item++;
+
+		memcpy((uint8_t *) stack->items +
+				((size_t) stack->current_item *
+				stack->item_size),
+				item, stack->item_size);
+
+		return PARSERUTILS_OK;
+	}
+
+	return parserutils_stack_push_slow(stack, item);
+}
+
+/**
+ * Pop an item off a stack
+ *
+ * \param stack  The stack to pop from
+ * \param item   Pointer to location to receive popped item, or NULL
+ * \return PARSERUTILS_OK on success, appropriate error otherwise.
+ */
+static inline parserutils_error parserutils_stack_pop(
+		parserutils_stack *stack, void *item)
+{
+	if (stack == NULL)
+		return PARSERUTILS_BADPARM;
+
+	if (stack->current_item < 0)
+		return PARSERUTILS_INVALID;
+
+	if (item != NULL) {
+		memcpy(item, (uint8_t *) stack->items +
+				((size_t) stack->current_item *
+				stack->item_size),
+				stack->item_size);
+	}
+
+	stack->current_item -= 1;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Retrieve a pointer to the current item on the stack
+ *
+ * \param stack  The stack to inspect
+ * \return Pointer to item on stack, or NULL if none
+ */
+static inline void *parserutils_stack_get_current(parserutils_stack *stack)
+{
+	if (stack == NULL || stack->current_item < 0)
+		return NULL;
+
+	return (uint8_t *) stack->items +
+			((size_t) stack->current_item * stack->item_size);
+}
 
 #ifdef __cplusplus
 }
@@ -24,18 +24,32 @@ typedef struct parserutils_vector parserutils_vector;
 parserutils_error parserutils_vector_create(size_t item_size, 
 		size_t chunk_size, parserutils_alloc alloc, void *pw,
 		parserutils_vector **vector);
+parserutils_error parserutils_vector_create_with_capacity(size_t item_size,
+		size_t chunk_size, size_t capacity,
+		parserutils_alloc alloc, void *pw,
+		parserutils_vector **vector);
 parserutils_error parserutils_vector_destroy(parserutils_vector *vector);
 
 parserutils_error parserutils_vector_append(parserutils_vector *vector, 
 		void *item);
+parserutils_error parserutils_vector_append_n(parserutils_vector *vector,
+		const void *items, size_t count);
+parserutils_error parserutils_vector_reserve(parserutils_vector *vector,
+		size_t count);
 parserutils_error parserutils_vector_clear(parserutils_vector *vector);
 parserutils_error parserutils_vector_remove_last(parserutils_vector *vector);
+parserutils_error parserutils_vector_truncate(parserutils_vector *vector,
+		size_t length);
 parserutils_error parserutils_vector_get_length(parserutils_vector *vector, size_t *length);
 
 const void *parserutils_vector_iterate(const parserutils_vector *vector, 
 		int32_t *ctx);
 const void *parserutils_vector_peek(const parserutils_vector *vector,
 		int32_t ctx);
+const void *parserutils_vector_get(const parserutils_vector *vector,
+		size_t index);
+parserutils_error parserutils_vector_span(const parserutils_vector *vector,
+		const void **items, size_t *length, size_t *stride);
 
 #ifdef __cplusplus
 }
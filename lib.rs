@@ -1 +1,594 @@
-// Intentionally blank
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2008 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+//! Bindings to LibParserUtils' input stream.
+//!
+//! The `ffi` module declares the C interface, as in the headers under
+//! `include/parserutils`. `InputStream` wraps it safely: characters are
+//! handed out as slices of the stream's UTF-8 buffer, borrowed from the
+//! stream, so they can't outlive the cursor moving past them.
+
+#![allow(non_camel_case_types)]
+
+use std::error;
+use std::ffi::{CStr, CString};
+use std::fmt;
+use std::os::raw::{c_char, c_void};
+use std::ptr;
+use std::slice;
+use std::str;
+
+pub mod ffi {
+	use std::os::raw::{c_char, c_int, c_void};
+
+	/* parserutils/errors.h */
+	pub type parserutils_error = c_int;
+
+	pub const PARSERUTILS_OK: parserutils_error = 0;
+	pub const PARSERUTILS_NOMEM: parserutils_error = 1;
+	pub const PARSERUTILS_BADPARM: parserutils_error = 2;
+	pub const PARSERUTILS_INVALID: parserutils_error = 3;
+	pub const PARSERUTILS_FILENOTFOUND: parserutils_error = 4;
+	pub const PARSERUTILS_NEEDDATA: parserutils_error = 5;
+	pub const PARSERUTILS_BADENCODING: parserutils_error = 6;
+	pub const PARSERUTILS_EOF: parserutils_error = 7;
+	pub const PARSERUTILS_FULL: parserutils_error = 8;
+
+	/* parserutils/functypes.h */
+	pub type parserutils_alloc = Option<unsafe extern "C" fn(ptr: *mut c_void,
+			len: usize, pw: *mut c_void) -> *mut c_void>;
+
+	/* parserutils/trace.h */
+	pub enum parserutils_trace {}
+
+	/* parserutils/utils/buffer.h */
+	#[repr(C)]
+	pub struct parserutils_buffer {
+		pub data: *mut u8,
+		pub length: usize,
+		pub allocated: usize,
+		pub base: *mut u8,
+		pub alloc: parserutils_alloc,
+		pub pw: *mut c_void,
+		pub peak: usize,
+		pub grows: u32,
+		pub moved: u64,
+		pub trace: *const parserutils_trace,
+	}
+
+	/* parserutils/input/inputstream.h */
+	pub type parserutils_charset_detect_func = Option<unsafe extern "C" fn(
+			data: *const u8, len: usize,
+			mibenum: *mut u16, source: *mut u32) -> parserutils_error>;
+
+	pub type parserutils_inputstream_release = Option<unsafe extern "C" fn(
+			data: *const u8, len: usize, pw: *mut c_void)>;
+
+	#[repr(C)]
+	pub struct parserutils_inputstream_iov {
+		pub data: *const u8,
+		pub len: usize,
+		pub release: parserutils_inputstream_release,
+		pub pw: *mut c_void,
+	}
+
+	#[repr(C)]
+	pub struct parserutils_inputstream {
+		pub utf8: *mut parserutils_buffer,
+		pub cursor: u32,
+		pub had_eof: bool,
+	}
+
+	#[repr(C)]
+	#[derive(Clone, Copy, Debug, Default)]
+	pub struct parserutils_inputstream_stats {
+		pub peek_slow: u32,
+		pub refills: u32,
+		pub decoded: u64,
+		pub moved: u64,
+		pub grows: u32,
+		pub peak: usize,
+		pub replacements: u32,
+	}
+
+	#[repr(C)]
+	#[derive(Clone, Copy, Debug, Default)]
+	pub struct parserutils_inputstream_pos {
+		pub offset: usize,
+		pub source: usize,
+		pub line: u32,
+		pub column: u32,
+	}
+
+	#[link(name = "parserutils", kind = "static")]
+	extern "C" {
+		pub fn parserutils_error_to_string(error: parserutils_error)
+				-> *const c_char;
+
+		pub fn parserutils_charset_utf8_char_byte_length(s: *const u8,
+				len: *mut usize) -> parserutils_error;
+
+		pub fn parserutils_inputstream_create(enc: *const c_char,
+				encsrc: u32,
+				csdetect: parserutils_charset_detect_func,
+				alloc: parserutils_alloc, pw: *mut c_void,
+				stream: *mut *mut parserutils_inputstream)
+				-> parserutils_error;
+		pub fn parserutils_inputstream_create_from_file(
+				path: *const c_char,
+				enc: *const c_char, encsrc: u32,
+				csdetect: parserutils_charset_detect_func,
+				alloc: parserutils_alloc, pw: *mut c_void,
+				stream: *mut *mut parserutils_inputstream)
+				-> parserutils_error;
+		pub fn parserutils_inputstream_destroy(
+				stream: *mut parserutils_inputstream)
+				-> parserutils_error;
+		pub fn parserutils_inputstream_reset(
+				stream: *mut parserutils_inputstream,
+				enc: *const c_char, encsrc: u32,
+				csdetect: parserutils_charset_detect_func)
+				-> parserutils_error;
+
+		pub fn parserutils_inputstream_append(
+				stream: *mut parserutils_inputstream,
+				data: *const u8, len: usize) -> parserutils_error;
+		pub fn parserutils_inputstream_append_iov(
+				stream: *mut parserutils_inputstream,
+				iov: *const parserutils_inputstream_iov,
+				count: u32) -> parserutils_error;
+		pub fn parserutils_inputstream_append_borrowed(
+				stream: *mut parserutils_inputstream,
+				data: *const u8, len: usize,
+				release: parserutils_inputstream_release,
+				pw: *mut c_void) -> parserutils_error;
+		pub fn parserutils_inputstream_insert(
+				stream: *mut parserutils_inputstream,
+				data: *const u8, len: usize) -> parserutils_error;
+
+		pub fn parserutils_inputstream_peek_slow(
+				stream: *mut parserutils_inputstream,
+				offset: usize, ptr: *mut *const u8,
+				length: *mut usize) -> parserutils_error;
+		pub fn parserutils_inputstream_peek_extern(
+				stream: *mut parserutils_inputstream,
+				offset: usize, ptr: *mut *const u8,
+				length: *mut usize) -> parserutils_error;
+		pub fn parserutils_inputstream_advance_extern(
+				stream: *mut parserutils_inputstream, bytes: usize);
+		pub fn parserutils_inputstream_peek_span(
+				stream: *mut parserutils_inputstream,
+				offset: usize, ptr: *mut *const u8,
+				length: *mut usize) -> parserutils_error;
+
+		pub fn parserutils_inputstream_get_stats(
+				stream: *mut parserutils_inputstream,
+				stats: *mut parserutils_inputstream_stats)
+				-> parserutils_error;
+		pub fn parserutils_inputstream_position(
+				stream: *mut parserutils_inputstream,
+				pos: *mut parserutils_inputstream_pos)
+				-> parserutils_error;
+
+		pub fn parserutils_inputstream_mark(
+				stream: *mut parserutils_inputstream)
+				-> parserutils_error;
+		pub fn parserutils_inputstream_rewind(
+				stream: *mut parserutils_inputstream)
+				-> parserutils_error;
+		pub fn parserutils_inputstream_unmark(
+				stream: *mut parserutils_inputstream)
+				-> parserutils_error;
+
+		pub fn parserutils_inputstream_read_charset(
+				stream: *mut parserutils_inputstream,
+				source: *mut u32) -> *const c_char;
+		pub fn parserutils_inputstream_change_charset(
+				stream: *mut parserutils_inputstream,
+				enc: *const c_char, source: u32)
+				-> parserutils_error;
+	}
+}
+
+extern "C" {
+	fn realloc(ptr: *mut c_void, len: usize) -> *mut c_void;
+	fn free(ptr: *mut c_void);
+}
+
+/* Allocation function for streams created from Rust */
+unsafe extern "C" fn stream_alloc(ptr: *mut c_void, len: usize,
+		_pw: *mut c_void) -> *mut c_void
+{
+	if len == 0 {
+		free(ptr);
+		return ptr::null_mut();
+	}
+
+	realloc(ptr, len)
+}
+
+/// An error reported by the library
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Error {
+	NoMem,
+	BadParm,
+	Invalid,
+	FileNotFound,
+	NeedData,
+	BadEncoding,
+	Eof,
+	Full,
+}
+
+impl Error {
+	fn code(self) -> ffi::parserutils_error {
+		match self {
+			Error::NoMem => ffi::PARSERUTILS_NOMEM,
+			Error::BadParm => ffi::PARSERUTILS_BADPARM,
+			Error::Invalid => ffi::PARSERUTILS_INVALID,
+			Error::FileNotFound => ffi::PARSERUTILS_FILENOTFOUND,
+			Error::NeedData => ffi::PARSERUTILS_NEEDDATA,
+			Error::BadEncoding => ffi::PARSERUTILS_BADENCODING,
+			Error::Eof => ffi::PARSERUTILS_EOF,
+			Error::Full => ffi::PARSERUTILS_FULL,
+		}
+	}
+}
+
+fn check(error: ffi::parserutils_error) -> Result<(), Error> {
+	match error {
+		ffi::PARSERUTILS_OK => Ok(()),
+		ffi::PARSERUTILS_NOMEM => Err(Error::NoMem),
+		ffi::PARSERUTILS_BADPARM => Err(Error::BadParm),
+		ffi::PARSERUTILS_FILENOTFOUND => Err(Error::FileNotFound),
+		ffi::PARSERUTILS_NEEDDATA => Err(Error::NeedData),
+		ffi::PARSERUTILS_BADENCODING => Err(Error::BadEncoding),
+		ffi::PARSERUTILS_EOF => Err(Error::Eof),
+		ffi::PARSERUTILS_FULL => Err(Error::Full),
+		_ => Err(Error::Invalid),
+	}
+}
+
+impl fmt::Display for Error {
+	fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+		let s = unsafe {
+			CStr::from_ptr(ffi::parserutils_error_to_string(self.code()))
+		};
+
+		f.write_str(&s.to_string_lossy())
+	}
+}
+
+impl error::Error for Error {
+	fn description(&self) -> &str {
+		"parserutils error"
+	}
+}
+
+fn charset_name(enc: Option<&str>) -> Result<Option<CString>, Error> {
+	match enc {
+		Some(enc) => CString::new(enc).map(Some)
+				.map_err(|_| Error::BadParm),
+		None => Ok(None),
+	}
+}
+
+fn name_ptr(name: &Option<CString>) -> *const c_char {
+	name.as_ref().map_or(ptr::null(), |name| name.as_ptr())
+}
+
+/// An input stream, decoding a document to UTF-8
+///
+/// Data read from the stream borrows it, so must be finished with before
+/// the stream is advanced past it, or is asked for more.
+pub struct InputStream {
+	stream: *mut ffi::parserutils_inputstream,
+}
+
+impl InputStream {
+	/// Create a stream for a document in the charset `enc`, with the
+	/// source of that information `encsrc`, or in UTF-8 if `enc` is None
+	pub fn new(enc: Option<&str>, encsrc: u32)
+			-> Result<InputStream, Error> {
+		let name = charset_name(enc)?;
+		let mut stream = ptr::null_mut();
+
+		check(unsafe {
+			ffi::parserutils_inputstream_create(name_ptr(&name),
+					encsrc, None, Some(stream_alloc),
+					ptr::null_mut(), &mut stream)
+		})?;
+
+		Ok(InputStream { stream: stream })
+	}
+
+	/// Start reading another document, in the charset `enc`
+	pub fn reset(&mut self, enc: Option<&str>, encsrc: u32)
+			-> Result<(), Error> {
+		let name = charset_name(enc)?;
+
+		check(unsafe {
+			ffi::parserutils_inputstream_reset(self.stream,
+					name_ptr(&name), encsrc, None)
+		})
+	}
+
+	/// The underlying stream, for use with the functions in `ffi`
+	pub fn as_ptr(&self) -> *mut ffi::parserutils_inputstream {
+		self.stream
+	}
+
+	/// Append data, in the document charset, to the stream
+	pub fn append(&mut self, data: &[u8]) -> Result<(), Error> {
+		if data.is_empty() {
+			return Ok(());
+		}
+
+		check(unsafe {
+			ffi::parserutils_inputstream_append(self.stream,
+					data.as_ptr(), data.len())
+		})
+	}
+
+	/// Mark the end of the document
+	pub fn finish(&mut self) -> Result<(), Error> {
+		check(unsafe {
+			ffi::parserutils_inputstream_append(self.stream,
+					ptr::null(), 0)
+		})
+	}
+
+	/// Insert UTF-8 data at the cursor
+	pub fn insert(&mut self, data: &[u8]) -> Result<(), Error> {
+		check(unsafe {
+			ffi::parserutils_inputstream_insert(self.stream,
+					data.as_ptr(), data.len())
+		})
+	}
+
+	/// Look at the character starting `offset` bytes after the cursor
+	///
+	/// Fails with `Error::NeedData` at the end of the data appended,
+	/// and `Error::Eof` at the end of the document. Characters are
+	/// buffered as they're peeked, so panics if `offset` is beyond the
+	/// end of those peeked so far.
+	#[inline]
+	pub fn peek(&mut self, offset: usize) -> Result<&[u8], Error> {
+		let mut ptr = ptr::null();
+		let mut length = 0;
+
+		unsafe {
+			/* ASCII in the buffer needs no call, as in C */
+			let utf8 = &*(*self.stream).utf8;
+			let avail = utf8.length - (*self.stream).cursor as usize;
+
+			if offset > avail {
+				panic!("peeked beyond buffered data");
+			} else if offset < avail {
+				let c = utf8.data.offset(((*self.stream).cursor
+						as usize + offset) as isize);
+
+				if *c < 0x80 {
+					return Ok(slice::from_raw_parts(c, 1));
+				}
+			}
+
+			check(ffi::parserutils_inputstream_peek_extern(
+					self.stream, offset,
+					&mut ptr, &mut length))?;
+
+			Ok(slice::from_raw_parts(ptr, length))
+		}
+	}
+
+	/// Look at the run of complete characters starting `offset` bytes
+	/// after the cursor
+	///
+	/// Any prefix of the run ending on a character boundary may be
+	/// advanced past. Panics if `offset` is beyond the end of the data
+	/// peeked so far.
+	pub fn peek_span(&mut self, offset: usize) -> Result<&[u8], Error> {
+		let mut ptr = ptr::null();
+		let mut length = 0;
+
+		unsafe {
+			let utf8 = &*(*self.stream).utf8;
+
+			if offset > utf8.length - (*self.stream).cursor as usize {
+				panic!("peeked beyond buffered data");
+			}
+
+			check(ffi::parserutils_inputstream_peek_span(
+					self.stream, offset,
+					&mut ptr, &mut length))?;
+
+			Ok(slice::from_raw_parts(ptr, length))
+		}
+	}
+
+	/// Advance the cursor `bytes` bytes, past data that has been peeked
+	///
+	/// Panics if fewer than `bytes` bytes are buffered after the cursor.
+	#[inline]
+	pub fn advance(&mut self, bytes: usize) {
+		unsafe {
+			let stream = &mut *self.stream;
+			let length = (*stream.utf8).length;
+
+			if bytes > length - stream.cursor as usize {
+				panic!("advanced past buffered data");
+			}
+
+			stream.cursor += bytes as u32;
+		}
+	}
+
+	/// Whether the end of the document has been reached
+	pub fn had_eof(&self) -> bool {
+		unsafe { (*self.stream).had_eof }
+	}
+
+	/// The document charset, and the source of that information
+	pub fn charset(&self) -> (&str, u32) {
+		let mut source = 0;
+
+		unsafe {
+			let name = ffi::parserutils_inputstream_read_charset(
+					self.stream, &mut source);
+
+			(str::from_utf8(CStr::from_ptr(name).to_bytes())
+					.unwrap_or(""), source)
+		}
+	}
+
+	/// Change the document charset
+	pub fn change_charset(&mut self, enc: &str, source: u32)
+			-> Result<(), Error> {
+		let name = CString::new(enc).map_err(|_| Error::BadParm)?;
+
+		check(unsafe {
+			ffi::parserutils_inputstream_change_charset(self.stream,
+					name.as_ptr(), source)
+		})
+	}
+
+	/// Where the cursor is in the document
+	pub fn position(&self) -> Result<ffi::parserutils_inputstream_pos,
+			Error> {
+		let mut pos = ffi::parserutils_inputstream_pos::default();
+
+		check(unsafe {
+			ffi::parserutils_inputstream_position(self.stream,
+					&mut pos)
+		})?;
+
+		Ok(pos)
+	}
+
+	/// The stream's performance counters
+	pub fn stats(&self) -> Result<ffi::parserutils_inputstream_stats,
+			Error> {
+		let mut stats = ffi::parserutils_inputstream_stats::default();
+
+		check(unsafe {
+			ffi::parserutils_inputstream_get_stats(self.stream,
+					&mut stats)
+		})?;
+
+		Ok(stats)
+	}
+
+	/// Remember the cursor, to return to it later
+	pub fn mark(&mut self) -> Result<(), Error> {
+		check(unsafe { ffi::parserutils_inputstream_mark(self.stream) })
+	}
+
+	/// Return to, and forget, the last mark
+	pub fn rewind(&mut self) -> Result<(), Error> {
+		check(unsafe { ffi::parserutils_inputstream_rewind(self.stream) })
+	}
+
+	/// Forget the last mark
+	pub fn unmark(&mut self) -> Result<(), Error> {
+		check(unsafe { ffi::parserutils_inputstream_unmark(self.stream) })
+	}
+}
+
+impl Drop for InputStream {
+	fn drop(&mut self) {
+		unsafe {
+			ffi::parserutils_inputstream_destroy(self.stream);
+		}
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::{Error, InputStream};
+
+	fn read_all(stream: &mut InputStream) -> (Vec<u8>, Error) {
+		let mut out = Vec::new();
+
+		loop {
+			let len = match stream.peek(0) {
+				Ok(c) => { out.extend_from_slice(c); c.len() }
+				Err(e) => return (out, e),
+			};
+
+			stream.advance(len);
+		}
+	}
+
+	#[test]
+	fn peek_decodes() {
+		let mut stream = InputStream::new(Some("windows-1252"), 1)
+				.unwrap();
+
+		stream.append(b"caf\xe9 \x80").unwrap();
+		assert_eq!(stream.peek(0), Ok(&b"c"[..]));
+		assert_eq!(stream.peek(3), Ok(&b"\xc3\xa9"[..]));
+		assert_eq!(stream.peek(5), Ok(&b" "[..]));
+
+		let (out, error) = read_all(&mut stream);
+		assert_eq!(out, b"caf\xc3\xa9 \xe2\x82\xac".to_vec());
+		assert_eq!(error, Error::NeedData);
+
+		stream.finish().unwrap();
+		assert_eq!(stream.peek(0), Err(Error::Eof));
+		assert!(stream.had_eof());
+		assert_eq!(stream.charset(), ("windows-1252", 1));
+		assert_eq!(stream.position().unwrap().column, 7);
+	}
+
+	#[test]
+	fn peek_span_runs() {
+		let mut stream = InputStream::new(None, 0).unwrap();
+
+		stream.append(b"ab\xc3\xa9c\xe2\x82").unwrap();
+		assert_eq!(stream.peek_span(0), Ok(&b"ab\xc3\xa9c"[..]));
+		stream.advance(2);
+		assert_eq!(stream.peek_span(0), Ok(&b"\xc3\xa9c"[..]));
+		stream.advance(3);
+		assert_eq!(stream.peek_span(0), Err(Error::NeedData));
+
+		stream.append(b"\xac").unwrap();
+		assert_eq!(stream.peek_span(0), Ok(&b"\xe2\x82\xac"[..]));
+	}
+
+	#[test]
+	fn reset_rereads() {
+		let mut stream = InputStream::new(Some("UTF-8"), 1).unwrap();
+
+		stream.append(b"one").unwrap();
+		stream.finish().unwrap();
+		assert_eq!(read_all(&mut stream), (b"one".to_vec(), Error::Eof));
+
+		stream.reset(Some("ISO-8859-1"), 1).unwrap();
+		stream.append(b"\xfe").unwrap();
+		stream.finish().unwrap();
+		assert_eq!(read_all(&mut stream),
+				(b"\xc3\xbe".to_vec(), Error::Eof));
+	}
+
+	#[test]
+	fn bad_charset() {
+		assert!(InputStream::new(Some("x-no-such-charset"), 1).is_err());
+		assert_eq!(InputStream::new(Some("UTF\0-8"), 1).err(),
+				Some(Error::BadParm));
+	}
+
+	#[test]
+	#[should_panic]
+	fn advance_past_end() {
+		let mut stream = InputStream::new(None, 0).unwrap();
+
+		stream.append(b"ab").unwrap();
+		assert_eq!(stream.peek(0), Ok(&b"a"[..]));
+		assert_eq!(stream.peek(1), Ok(&b"b"[..]));
+		stream.advance(3);
+	}
+}
@@ -5,7 +5,6 @@
  * Copyright 2007 John-Mark Bell <jmb@netsurf-browser.org>
  */
 
-#include <ctype.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -20,53 +19,23 @@
 /* Bring in the aliases tables */
 #include "aliases.inc"
 
-typedef struct {
-        size_t slen;
-        const char *s;
-} lengthed_string;
-
-
-#define IS_PUNCT_OR_SPACE(x)                    \
-        (!(((x) >= 'A' && (x) <= 'Z') ||        \
-           ((x) >= 'a' && (x) <= 'z') ||        \
-           ((x) >= '0' && (x) <= '9')))
+/**
+ * Hash a normalised alias name, as make-aliases.pl does
+ *
+ * \param seed  Hash seed, or 0 for the initial hash
+ * \param key   The normalised name
+ * \param len   The length of the name
+ * \return The hash value
+ */
+static inline uint32_t parserutils_charset_alias_hash(uint32_t seed,
+		const char *key, size_t len)
+{
+	uint32_t h = (seed == 0) ? 0x01000193 : seed;
 
+	while (len-- > 0)
+		h = (h * 0x01000193) ^ (uint8_t) *key++;
 
-static int parserutils_charset_alias_match(const void *a, const void *b)
-{
-        lengthed_string *s = (lengthed_string *)a;
-        parserutils_charset_aliases_alias *alias = (parserutils_charset_aliases_alias*)b;
-        size_t key_left = s->slen;
-        size_t alias_left = alias->name_len;
-        const char *s_alias = alias->name;
-        const char *s_key = s->s;
-        int cmpret;
-        
-        while ((key_left > 0) && (alias_left > 0)) {
-                while ((key_left > 0) && IS_PUNCT_OR_SPACE(*s_key)) {
-                        key_left--; s_key++;
-                }
-                
-                if (key_left == 0)
-                        break;
-                
-                cmpret = tolower(*s_key) - *s_alias;
-                
-                if (cmpret != 0) {
-                        return cmpret;
-                }
-                
-                key_left--;
-                s_key++;
-                alias_left--;
-                s_alias++;
-        }
-        
-        while ((key_left > 0) && IS_PUNCT_OR_SPACE(*s_key)) {
-          key_left--; s_key++;
-        }
-        
-        return key_left - alias_left;
+	return h;
 }
 
 /**
@@ -75,26 +44,73 @@ static int parserutils_charset_alias_match(const void *a, const void *b)
  * \param alias  The alias name
  * \param len    The length of the alias name
  * \return Pointer to canonical form or NULL if not found
+ *
+ * Alias names are compared without regard to case, ignoring any characters
+ * other than ASCII letters and digits.
  */
-parserutils_charset_aliases_canon *parserutils__charset_alias_canonicalise(
+const parserutils_charset_aliases_canon *parserutils__charset_alias_canonicalise(
 		const char *alias, size_t len)
 {
-        parserutils_charset_aliases_alias *c;
-        lengthed_string s;
-        
-        s.slen = len;
-        s.s = alias;
-
-        c = (parserutils_charset_aliases_alias*)bsearch(&s,
-		&charset_aliases[0],
-		charset_aliases_count,
-		sizeof(parserutils_charset_aliases_alias),
-		parserutils_charset_alias_match);
-        
-        if (c == NULL)
-                return NULL;
-        
-        return c->canon;
+	const parserutils_charset_aliases_alias *c;
+	char key[CHARSET_ALIASES_MAX_LEN];
+	size_t keylen = 0, i;
+	int32_t displace;
+	uint32_t slot;
+
+	/* Normalise the name, as make-aliases.pl does */
+	for (i = 0; i < len; i++) {
+		char ch = alias[i];
+
+		if (ch >= 'A' && ch <= 'Z')
+			ch += 'a' - 'A';
+		else if (!((ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9')))
+			continue;
+
+		if (keylen == CHARSET_ALIASES_MAX_LEN)
+			return NULL;
+
+		key[keylen++] = ch;
+	}
+
+	if (keylen == 0)
+		return NULL;
+
+	/* Find the only alias which could match */
+	displace = charset_aliases_displace[parserutils_charset_alias_hash(0,
+			key, keylen) % charset_aliases_count];
+	if (displace < 0) {
+		slot = -displace - 1;
+	} else {
+		slot = parserutils_charset_alias_hash(displace, key, keylen) %
+				charset_aliases_count;
+	}
+
+	c = &charset_aliases[slot];
+	if (c->name_len != keylen || memcmp(c->name, key, keylen) != 0)
+		return NULL;
+
+	return c->canon;
+}
+
+/**
+ * Retrieve the canonical form of a charset from its MIB enum
+ *
+ * \param mibenum  The MIB enum value
+ * \return Pointer to canonical form or NULL if not found
+ */
+const parserutils_charset_aliases_canon *parserutils__charset_alias_from_mibenum(
+		uint16_t mibenum)
+{
+	uint16_t index;
+
+	if (mibenum >= canonical_charset_by_mib_count)
+		return NULL;
+
+	index = canonical_charset_by_mib[mibenum];
+	if (index == 0)
+		return NULL;
+
+	return &canonical_charset_names[index - 1];
 }
 
 /**
@@ -106,7 +122,7 @@ parserutils_charset_aliases_canon *parserutils__charset_alias_canonicalise(
  */
 uint16_t parserutils_charset_mibenum_from_name(const char *alias, size_t len)
 {
-	parserutils_charset_aliases_canon *c;
+	const parserutils_charset_aliases_canon *c;
 
 	if (alias == NULL)
 		return 0;
@@ -126,16 +142,35 @@ uint16_t parserutils_charset_mibenum_from_name(const char *alias, size_t len)
  */
 const char *parserutils_charset_mibenum_to_name(uint16_t mibenum)
 {
-	int i;
-	parserutils_charset_aliases_canon *c;
-        
-        for (i = 0; i < charset_aliases_canon_count; ++i) {
-                c = &canonical_charset_names[i];
-                if (c->mib_enum == mibenum)
-                        return c->name;
-        }
-        
-        return NULL;
+	const parserutils_charset_aliases_canon *c;
+
+	c = parserutils__charset_alias_from_mibenum(mibenum);
+	if (c == NULL)
+		return NULL;
+
+	return c->name;
+}
+
+/**
+ * Retrieve the canonical name of an encoding, and its length, from the
+ * MIB enum
+ *
+ * \param mibenum  The MIB enum value
+ * \param len      Pointer to location to receive length of name
+ * \return Pointer to canonical name, or NULL if not found
+ */
+const char *parserutils_charset_mibenum_to_name_len(uint16_t mibenum,
+		size_t *len)
+{
+	const parserutils_charset_aliases_canon *c;
+
+	c = parserutils__charset_alias_from_mibenum(mibenum);
+	if (c == NULL)
+		return NULL;
+
+	*len = c->name_len;
+
+	return c->name;
 }
 
 /**
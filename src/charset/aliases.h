@@ -12,15 +12,42 @@
 
 #include <parserutils/charset/mibenum.h>
 
+/* MIB enums of the Unicode charsets, from build/Aliases */
+#define MIB_UTF_8    (106)
+#define MIB_UTF_16BE (1013)
+#define MIB_UTF_16LE (1014)
+#define MIB_UTF_16   (1015)
+#define MIB_UTF_32   (1017)
+#define MIB_UTF_32BE (1018)
+#define MIB_UTF_32LE (1019)
+
+/**
+ * Native codec for a charset, as assigned by make-aliases.pl
+ */
+typedef enum parserutils_charset_handler_id {
+	PARSERUTILS_CHARSET_HANDLER_NONE = 0,
+	PARSERUTILS_CHARSET_HANDLER_UTF8,
+	PARSERUTILS_CHARSET_HANDLER_UTF16,
+	PARSERUTILS_CHARSET_HANDLER_UTF32,
+	PARSERUTILS_CHARSET_HANDLER_SBCS,
+	PARSERUTILS_CHARSET_HANDLER_CJK,
+
+	PARSERUTILS_CHARSET_HANDLER_COUNT
+} parserutils_charset_handler_id;
+
 typedef struct parserutils_charset_aliases_canon {
 	/* Do not change the ordering here without changing make-aliases.pl */
 	uint16_t mib_enum;
 	uint16_t name_len;
 	const char *name;
+	parserutils_charset_handler_id handler;
 } parserutils_charset_aliases_canon;
 
 /* Canonicalise an alias name */
-parserutils_charset_aliases_canon *parserutils__charset_alias_canonicalise(
+const parserutils_charset_aliases_canon *parserutils__charset_alias_canonicalise(
 		const char *alias, size_t len);
+/* Find the canonical form of a charset from its MIB enum */
+const parserutils_charset_aliases_canon *parserutils__charset_alias_from_mibenum(
+		uint16_t mibenum);
 
 #endif
@@ -0,0 +1,68 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_charset_bom_h_
+#define parserutils_charset_bom_h_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "charset/aliases.h"
+
+/**
+ * Find the length of the BOM of a byte order specific Unicode charset
+ *
+ * \param mibenum  MIB enum of UTF-8, UTF-16BE/LE or UTF-32BE/LE
+ * \param data     The data to consider
+ * \param len      Length of the data, in bytes
+ * \return Length of the charset's BOM at the start of data, or 0 if it is
+ *         absent or mibenum is some other charset
+ */
+static inline size_t parserutils__charset_bom_length(uint16_t mibenum,
+		const uint8_t *data, size_t len)
+{
+	static const uint8_t utf8[] = { 0xEF, 0xBB, 0xBF };
+	static const uint8_t utf16be[] = { 0xFE, 0xFF };
+	static const uint8_t utf16le[] = { 0xFF, 0xFE };
+	static const uint8_t utf32be[] = { 0x00, 0x00, 0xFE, 0xFF };
+	static const uint8_t utf32le[] = { 0xFF, 0xFE, 0x00, 0x00 };
+	const uint8_t *bom;
+	size_t bomlen;
+
+	switch (mibenum) {
+	case MIB_UTF_8:
+		bom = utf8;
+		bomlen = sizeof(utf8);
+		break;
+	case MIB_UTF_16BE:
+		bom = utf16be;
+		bomlen = sizeof(utf16be);
+		break;
+	case MIB_UTF_16LE:
+		bom = utf16le;
+		bomlen = sizeof(utf16le);
+		break;
+	case MIB_UTF_32BE:
+		bom = utf32be;
+		bomlen = sizeof(utf32be);
+		break;
+	case MIB_UTF_32LE:
+		bom = utf32le;
+		bomlen = sizeof(utf32le);
+		break;
+	default:
+		return 0;
+	}
+
+	if (len < bomlen || memcmp(data, bom, bomlen) != 0)
+		return 0;
+
+	return bomlen;
+}
+
+#endif
@@ -9,22 +9,30 @@
 
 #include "charset/aliases.h"
 #include "charset/codecs/codec_impl.h"
+#include "utils/utils.h"
 
-extern parserutils_charset_handler charset_ascii_codec_handler;
-extern parserutils_charset_handler charset_8859_codec_handler;
-extern parserutils_charset_handler charset_ext8_codec_handler;
-extern parserutils_charset_handler charset_utf8_codec_handler;
-extern parserutils_charset_handler charset_utf16_codec_handler;
-
-static parserutils_charset_handler *handler_table[] = {
-	&charset_utf8_codec_handler,
-	&charset_utf16_codec_handler,
-	&charset_8859_codec_handler,
-	&charset_ext8_codec_handler,
-	&charset_ascii_codec_handler,
-	NULL,
+extern const parserutils_charset_handler charset_sbcs_codec_handler;
+extern const parserutils_charset_handler charset_cjk_codec_handler;
+extern const parserutils_charset_handler charset_utf8_codec_handler;
+extern const parserutils_charset_handler charset_utf16_codec_handler;
+extern const parserutils_charset_handler charset_utf32_codec_handler;
+
+/* Indexed by the handler make-aliases.pl assigns to each charset */
+static const parserutils_charset_handler *const handler_table[
+		PARSERUTILS_CHARSET_HANDLER_COUNT] = {
+	[PARSERUTILS_CHARSET_HANDLER_NONE] = NULL,
+	[PARSERUTILS_CHARSET_HANDLER_UTF8] = &charset_utf8_codec_handler,
+	[PARSERUTILS_CHARSET_HANDLER_UTF16] = &charset_utf16_codec_handler,
+	[PARSERUTILS_CHARSET_HANDLER_UTF32] = &charset_utf32_codec_handler,
+	[PARSERUTILS_CHARSET_HANDLER_SBCS] = &charset_sbcs_codec_handler,
+	[PARSERUTILS_CHARSET_HANDLER_CJK] = &charset_cjk_codec_handler,
 };
 
+static parserutils_error charset_codec_create(
+		const parserutils_charset_aliases_canon *canon,
+		parserutils_alloc alloc, void *pw,
+		parserutils_charset_codec **codec);
+
 /**
  * Create a charset codec
  *
@@ -41,10 +49,7 @@ parserutils_error parserutils_charset_codec_create(const char *charset,
 		parserutils_alloc alloc, void *pw,
 		parserutils_charset_codec **codec)
 {
-	parserutils_charset_codec *c;
-	parserutils_charset_handler **handler;
 	const parserutils_charset_aliases_canon * canon;
-	parserutils_error error;
 
 	if (charset == NULL || alloc == NULL || codec == NULL)
 		return PARSERUTILS_BADPARM;
@@ -55,18 +60,62 @@ parserutils_error parserutils_charset_codec_create(const char *charset,
 	if (canon == NULL)
 		return PARSERUTILS_BADENCODING;
 
-	/* Search for handler class */
-	for (handler = handler_table; *handler != NULL; handler++) {
-		if ((*handler)->handles_charset(canon->name))
-			break;
-	}
+	return charset_codec_create(canon, alloc, pw, codec);
+}
+
+/**
+ * Create a charset codec from the MIB enum of its charset
+ *
+ * \param mibenum  MIB enum of target charset
+ * \param alloc    Memory (de)allocation function
+ * \param pw       Pointer to client-specific private data (may be NULL)
+ * \param codec    Pointer to location to receive codec instance
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhaustion,
+ *         PARSERUTILS_BADENCODING on unsupported charset
+ */
+parserutils_error parserutils_charset_codec_create_mib(uint16_t mibenum,
+		parserutils_alloc alloc, void *pw,
+		parserutils_charset_codec **codec)
+{
+	const parserutils_charset_aliases_canon * canon;
+
+	if (alloc == NULL || codec == NULL)
+		return PARSERUTILS_BADPARM;
+
+	canon = parserutils__charset_alias_from_mibenum(mibenum);
+	if (canon == NULL)
+		return PARSERUTILS_BADENCODING;
+
+	return charset_codec_create(canon, alloc, pw, codec);
+}
+
+/**
+ * Create a codec for a canonical charset
+ *
+ * \param canon  Canonical form of target charset
+ * \param alloc  Memory (de)allocation function
+ * \param pw     Pointer to client-specific private data (may be NULL)
+ * \param codec  Pointer to location to receive codec instance
+ * \return As for parserutils_charset_codec_create
+ */
+parserutils_error charset_codec_create(
+		const parserutils_charset_aliases_canon *canon,
+		parserutils_alloc alloc, void *pw,
+		parserutils_charset_codec **codec)
+{
+	parserutils_charset_codec *c;
+	const parserutils_charset_handler *handler;
+	parserutils_error error;
 
-	/* None found */
-	if ((*handler) == NULL)
+	/* No native codec */
+	handler = handler_table[canon->handler];
+	if (handler == NULL)
 		return PARSERUTILS_BADENCODING;
 
 	/* Instantiate class */
-	error = (*handler)->create(canon->name, alloc, pw, &c);
+	error = handler->create(canon->mib_enum, alloc, pw, &c);
 	if (error != PARSERUTILS_OK)
 		return error;
 
@@ -74,6 +123,7 @@ parserutils_error parserutils_charset_codec_create(const char *charset,
 	c->mibenum = canon->mib_enum;
 
 	c->errormode = PARSERUTILS_CHARSET_CODEC_ERROR_LOOSE;
+	c->host_endian = false;
 
 	c->alloc = alloc;
 	c->alloc_pw = pw;
@@ -122,6 +172,10 @@ parserutils_error parserutils_charset_codec_setopt(
 	case PARSERUTILS_CHARSET_CODEC_ERROR_MODE:
 		codec->errormode = params->error_mode.mode;
 		break;
+	case PARSERUTILS_CHARSET_CODEC_UCS4_ORDER:
+		codec->host_endian = (params->ucs4_order.order ==
+				PARSERUTILS_CHARSET_CODEC_UCS4_HOST);
+		break;
 	}
 
 	return PARSERUTILS_OK;
@@ -194,3 +248,31 @@ parserutils_error parserutils_charset_codec_reset(
 	return codec->handler.reset(codec);
 }
 
+/**
+ * Decode a chunk of data in a codec's charset straight to UTF-8
+ *
+ * \param codec         The codec to use
+ * \param source        Pointer to pointer to source data
+ * \param sourcelen     Pointer to length (in bytes) of source data
+ * \param dest          Pointer to pointer to output buffer
+ * \param destlen       Pointer to length (in bytes) of output buffer
+ * \param replacements  Pointer to counter of U+FFFD characters, updated
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADENCODING if the codec can't decode to UTF-8,
+ *         appropriate error otherwise
+ *
+ * The output is the same as decoding with the codec and then encoding with
+ * a UTF-8 codec, without an intermediate UCS-4 pass. Every U+FFFD output,
+ * whether substituted for invalid input or not, is counted.
+ */
+parserutils_error parserutils__charset_codec_decode_utf8(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen, uint32_t *replacements)
+{
+	if (codec->handler.decode_utf8 == NULL)
+		return PARSERUTILS_BADENCODING;
+
+	return codec->handler.decode_utf8(codec, source, sourcelen,
+			dest, destlen, replacements);
+}
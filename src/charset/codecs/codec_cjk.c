@@ -0,0 +1,1428 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2008 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <parserutils/charset/mibenum.h>
+
+#include "charset/codecs/codec_impl.h"
+#include "charset/encodings/utf8impl.h"
+#include "utils/endian.h"
+#include "utils/simd.h"
+#include "utils/utils.h"
+
+/**
+ * Run of four byte GB18030 sequences mapping to consecutive characters
+ */
+typedef struct gb18030_range {
+	uint16_t index;			/**< Linear index of first sequence */
+	uint16_t ucs4;			/**< First character */
+	uint16_t count;			/**< Number of sequences in run */
+} gb18030_range;
+
+#include "charset/codecs/cjk_tables.h"
+
+/** Two byte GB18030 sequences which map outside the BMP */
+static const struct {
+	uint16_t seq;
+	uint32_t ucs4;
+} gb18030_astral[] = {
+	{ 0xFE51, 0x20087 }, { 0xFE52, 0x20089 }, { 0xFE53, 0x200CC },
+	{ 0xFE6C, 0x215D7 }, { 0xFE76, 0x2298F }, { 0xFE91, 0x241FE }
+};
+
+/** Linear index of the first GB18030 four byte sequence outside the BMP */
+#define GB18030_ASTRAL_INDEX (189000)
+
+/** Kinds of CJK charset */
+typedef enum charset_cjk_kind {
+	CJK_SHIFT_JIS,
+	CJK_EUC_JP,
+	CJK_GBK,
+	CJK_GB18030,
+	CJK_BIG5,
+	CJK_EUC_KR
+} charset_cjk_kind;
+
+/* Charsets handled, with their MIB enums from build/Aliases */
+static const struct {
+	uint16_t mib;
+	charset_cjk_kind kind;
+} known_charsets[] = {
+	{ 17, CJK_SHIFT_JIS },	/* Shift_JIS */
+	{ 18, CJK_EUC_JP },	/* EUC-JP */
+	{ 113, CJK_GBK },	/* GBK */
+	{ 114, CJK_GB18030 },	/* GB18030 */
+	{ 2026, CJK_BIG5 },	/* Big5 */
+	{ 38, CJK_EUC_KR }	/* EUC-KR */
+};
+
+/**
+ * Entry in the map from UCS-4 to a CJK charset
+ */
+typedef struct charset_cjk_reverse {
+	uint32_t ucs4;			/**< Character */
+	uint32_t seq;			/**< Byte sequence, most significant
+					 * byte first */
+} charset_cjk_reverse;
+
+/**
+ * CJK multibyte charset codec
+ */
+typedef struct charset_cjk_codec {
+	parserutils_charset_codec base;	/**< Base class */
+
+	charset_cjk_kind kind;		/**< Charset being handled */
+
+#define INVAL_BUFSIZE (8)
+	uint8_t inval_buf[INVAL_BUFSIZE];	/**< Buffer for fixing up
+						 * incomplete input
+						 * sequences */
+	size_t inval_len;		/*< Byte length of inval_buf **/
+
+#define READ_BUFSIZE (8)
+	uint32_t read_buf[READ_BUFSIZE];	/**< Buffer for partial
+						 * output sequences (decode)
+						 * (host-endian) */
+	size_t read_len;		/**< Character length of read_buf */
+
+#define WRITE_BUFSIZE (8)
+	uint32_t write_buf[WRITE_BUFSIZE];	/**< Buffer for partial
+						 * output sequences (encode)
+						 * (host-endian) */
+	size_t write_len;		/**< Character length of write_buf */
+
+	charset_cjk_reverse *reverse;	/**< Map from UCS-4, sorted by
+					 * character, or NULL if not yet
+					 * built */
+	size_t reverse_len;		/**< Number of entries in reverse */
+
+	bool utf8;			/**< Decoding to UTF-8, not UCS-4 */
+	uint32_t replaced;		/**< U+FFFD decoded to UTF-8 */
+
+} charset_cjk_codec;
+
+static parserutils_error charset_cjk_codec_create(uint16_t mibenum,
+		parserutils_alloc alloc, void *pw,
+		parserutils_charset_codec **codec);
+static parserutils_error charset_cjk_codec_destroy(
+		parserutils_charset_codec *codec);
+static parserutils_error charset_cjk_codec_encode(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
+static parserutils_error charset_cjk_codec_decode(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
+static parserutils_error charset_cjk_codec_reset(
+		parserutils_charset_codec *codec);
+static parserutils_error charset_cjk_codec_decode_utf8(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen, uint32_t *replacements);
+static inline void charset_cjk_codec_decode_run(charset_cjk_codec *c,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
+static inline parserutils_error charset_cjk_codec_read_char(
+		charset_cjk_codec *c,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
+static inline parserutils_error charset_cjk_codec_output_decoded_char(
+		charset_cjk_codec *c,
+		uint32_t ucs4, uint8_t **dest, size_t *destlen);
+static inline parserutils_error charset_cjk_from_ucs4(charset_cjk_codec *c,
+		uint32_t ucs4, uint8_t **s, size_t *len);
+static inline parserutils_error charset_cjk_to_ucs4(charset_cjk_codec *c,
+		const uint8_t *s, size_t len, uint32_t *ucs4, size_t *clen);
+static parserutils_error charset_cjk_build_reverse(charset_cjk_codec *c);
+
+/**
+ * Create a CJK multibyte codec
+ *
+ * \param mibenum  MIB enum of the charset to read from / write to
+ * \param alloc    Memory (de)allocation function
+ * \param pw       Pointer to client-specific private data (may be NULL)
+ * \param codec    Pointer to location to receive codec
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhausion
+ *
+ * GBK is decoded as GB18030, of which it is a subset, but only encoded
+ * using its own two byte sequences.
+ */
+parserutils_error charset_cjk_codec_create(uint16_t mibenum,
+		parserutils_alloc alloc, void *pw,
+		parserutils_charset_codec **codec)
+{
+	uint32_t i;
+	charset_cjk_codec *c;
+
+	for (i = 0; i < N_ELEMENTS(known_charsets); i++) {
+		if (known_charsets[i].mib == mibenum)
+			break;
+	}
+
+	assert(i < N_ELEMENTS(known_charsets));
+
+	c = alloc(NULL, sizeof(charset_cjk_codec), pw);
+	if (c == NULL)
+		return PARSERUTILS_NOMEM;
+
+	c->kind = known_charsets[i].kind;
+
+	c->inval_buf[0] = '\0';
+	c->inval_len = 0;
+
+	c->read_buf[0] = 0;
+	c->read_len = 0;
+
+	c->write_buf[0] = 0;
+	c->write_len = 0;
+
+	c->reverse = NULL;
+	c->reverse_len = 0;
+
+	c->utf8 = false;
+	c->replaced = 0;
+
+	/* Finally, populate vtable */
+	c->base.handler.destroy = charset_cjk_codec_destroy;
+	c->base.handler.encode = charset_cjk_codec_encode;
+	c->base.handler.decode = charset_cjk_codec_decode;
+	c->base.handler.reset = charset_cjk_codec_reset;
+	c->base.handler.decode_utf8 = charset_cjk_codec_decode_utf8;
+
+	*codec = (parserutils_charset_codec *) c;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Destroy a CJK multibyte codec
+ *
+ * \param codec  The codec to destroy
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error charset_cjk_codec_destroy (parserutils_charset_codec *codec)
+{
+	charset_cjk_codec *c = (charset_cjk_codec *) codec;
+
+	if (c->reverse != NULL)
+		c->base.alloc(c->reverse, 0, c->base.alloc_pw);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Encode a chunk of UCS-4 (big endian) data into a CJK charset
+ *
+ * \param codec      The codec to use
+ * \param source     Pointer to pointer to source data
+ * \param sourcelen  Pointer to length (in bytes) of source data
+ * \param dest       Pointer to pointer to output buffer
+ * \param destlen    Pointer to length (in bytes) of output buffer
+ * \return PARSERUTILS_OK          on success,
+ *         PARSERUTILS_NOMEM       if output buffer is too small,
+ *         PARSERUTILS_INVALID     if a character cannot be represented and the
+ *                                 codec's error handling mode is set to STRICT,
+ *
+ * On exit, ::source will point immediately _after_ the last input character
+ * read. Any remaining output for the character will be buffered by the
+ * codec for writing on the next call.
+ *
+ * Note that, if failure occurs whilst attempting to write any output
+ * buffered by the last call, then ::source and ::sourcelen will remain
+ * unchanged (as nothing more has been read).
+ *
+ * ::sourcelen will be reduced appropriately on exit.
+ *
+ * ::dest will point immediately _after_ the last character written.
+ *
+ * ::destlen will be reduced appropriately on exit.
+ *
+ * The map from UCS-4 is built the first time the codec encodes anything.
+ */
+parserutils_error charset_cjk_codec_encode(parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	charset_cjk_codec *c = (charset_cjk_codec *) codec;
+	uint32_t ucs4;
+	uint32_t *towrite;
+	size_t towritelen;
+	parserutils_error error;
+
+	if (c->reverse == NULL) {
+		error = charset_cjk_build_reverse(c);
+		if (error != PARSERUTILS_OK)
+			return error;
+	}
+
+	/* Process any outstanding characters from the previous call */
+	if (c->write_len > 0) {
+		uint32_t *pwrite = c->write_buf;
+
+		while (c->write_len > 0) {
+			error = charset_cjk_from_ucs4(c, pwrite[0],
+					dest, destlen);
+			if (error != PARSERUTILS_OK) {
+				uint32_t len;
+				assert(error == PARSERUTILS_NOMEM);
+
+				for (len = 0; len < c->write_len; len++) {
+					c->write_buf[len] = pwrite[len];
+				}
+
+				return error;
+			}
+
+			pwrite++;
+			c->write_len--;
+		}
+	}
+
+	/* Now process the characters for this call */
+	while (*sourcelen > 0) {
+		ucs4 = parserutils__charset_codec_read_ucs4(codec, *source);
+		towrite = &ucs4;
+		towritelen = 1;
+
+		/* Output current characters */
+		while (towritelen > 0) {
+			error = charset_cjk_from_ucs4(c, towrite[0], dest,
+					destlen);
+			if (error != PARSERUTILS_OK) {
+				uint32_t len;
+				if (error != PARSERUTILS_NOMEM) {
+					return error;
+				}
+
+				/* Insufficient output space */
+				if (towritelen >= WRITE_BUFSIZE)
+					abort();
+
+				c->write_len = towritelen;
+
+				/* Copy pending chars to save area, for
+				 * processing next call. */
+				for (len = 0; len < towritelen; len++)
+					c->write_buf[len] = towrite[len];
+
+				/* Claim character we've just buffered,
+				 * so it's not reprocessed */
+				*source += 4;
+				*sourcelen -= 4;
+
+				return PARSERUTILS_NOMEM;
+			}
+
+			towrite++;
+			towritelen--;
+		}
+
+		*source += 4;
+		*sourcelen -= 4;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Decode a chunk of CJK charset data into UCS-4 (big endian)
+ *
+ * \param codec      The codec to use
+ * \param source     Pointer to pointer to source data
+ * \param sourcelen  Pointer to length (in bytes) of source data
+ * \param dest       Pointer to pointer to output buffer
+ * \param destlen    Pointer to length (in bytes) of output buffer
+ * \return PARSERUTILS_OK          on success,
+ *         PARSERUTILS_NOMEM       if output buffer is too small,
+ *         PARSERUTILS_INVALID     if a character cannot be represented and the
+ *                                 codec's error handling mode is set to STRICT,
+ *
+ * On exit, ::source will point immediately _after_ the last input character
+ * read, if the result is _OK or _NOMEM. Any remaining output for the
+ * character will be buffered by the codec for writing on the next call.
+ *
+ * In the case of the result being _INVALID, ::source will point _at_ the
+ * last input character read; nothing will be written or buffered for the
+ * failed character. It is up to the client to fix the cause of the failure
+ * and retry the decoding process.
+ *
+ * Note that, if failure occurs whilst attempting to write any output
+ * buffered by the last call, then ::source and ::sourcelen will remain
+ * unchanged (as nothing more has been read).
+ *
+ * If STRICT error handling is configured and an illegal sequence is split
+ * over two calls, then _INVALID will be returned from the second call,
+ * but ::source will point mid-way through the invalid sequence (i.e. it
+ * will be unmodified over the second call). In addition, the internal
+ * incomplete-sequence buffer will be emptied, such that subsequent calls
+ * will progress, rather than re-evaluating the same invalid sequence.
+ *
+ * ::sourcelen will be reduced appropriately on exit.
+ *
+ * ::dest will point immediately _after_ the last character written.
+ *
+ * ::destlen will be reduced appropriately on exit.
+ *
+ * Call this with a source length of 0 to flush the output buffer.
+ */
+parserutils_error charset_cjk_codec_decode(parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	charset_cjk_codec *c = (charset_cjk_codec *) codec;
+	parserutils_error error;
+
+	if (c->read_len > 0) {
+		/* Output left over from last decode */
+		uint32_t *pread = c->read_buf;
+
+		while (c->read_len > 0) {
+			if (c->utf8) {
+				uint32_t ucs4 = pread[0];
+
+				UTF8_FROM_UCS4(ucs4, dest, destlen, error);
+				if (error != PARSERUTILS_OK)
+					break;
+			} else {
+				if (*destlen < 4)
+					break;
+
+				parserutils__charset_codec_write_ucs4(codec,
+						pread[0], *dest);
+
+				*dest += 4;
+				*destlen -= 4;
+			}
+
+			pread++;
+			c->read_len--;
+		}
+
+		if (c->read_len > 0) {
+			/* Ran out of output buffer */
+			size_t i;
+
+			/* Shuffle remaining output down */
+			for (i = 0; i < c->read_len; i++)
+				c->read_buf[i] = pread[i];
+
+			return PARSERUTILS_NOMEM;
+		}
+	}
+
+	while (c->inval_len > 0) {
+		/* The last decode ended in an incomplete sequence.
+		 * Fill up inval_buf with data from the start of the
+		 * new chunk and process it. */
+		uint8_t *in = c->inval_buf;
+		size_t ol = c->inval_len;
+		size_t l = min(INVAL_BUFSIZE - ol - 1, *sourcelen);
+		size_t orig_l = l;
+		size_t used;
+
+		memcpy(c->inval_buf + ol, *source, l);
+
+		l += c->inval_len;
+
+		error = charset_cjk_codec_read_char(c,
+				(const uint8_t **) &in, &l, dest, destlen);
+		if (error != PARSERUTILS_OK && error != PARSERUTILS_NOMEM) {
+			return error;
+		}
+
+		/* And now, fix up source pointers */
+		if (c->inval_len > 0) {
+			/* Still incomplete; the new data is now buffered */
+			*source += orig_l;
+			*sourcelen -= orig_l;
+
+			if (orig_l == 0)
+				break;
+		} else {
+			used = (orig_l + ol) - l;
+
+			if (used >= ol) {
+				*source += used - ol;
+				*sourcelen -= used - ol;
+			} else {
+				/* An invalid sequence was skipped, but not
+				 * all of the buffered data; keep the rest */
+				memmove(c->inval_buf, c->inval_buf + used,
+						ol - used);
+				c->inval_len = ol - used;
+			}
+		}
+
+		/* Report memory exhaustion case from above */
+		if (error != PARSERUTILS_OK)
+			return error;
+	}
+
+	/* Finally, the "normal" case; process all outstanding characters */
+	while (*sourcelen > 0) {
+		/* Decode as much well-formed input as possible in bulk */
+		charset_cjk_codec_decode_run(c, source, sourcelen,
+				dest, destlen);
+		if (*sourcelen == 0)
+			break;
+
+		/* Anything else goes through the general decoder */
+		error = charset_cjk_codec_read_char(c,
+				source, sourcelen, dest, destlen);
+		if (error != PARSERUTILS_OK) {
+			return error;
+		}
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Clear a CJK multibyte codec's encoding state
+ *
+ * \param codec  The codec to reset
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error charset_cjk_codec_reset(parserutils_charset_codec *codec)
+{
+	charset_cjk_codec *c = (charset_cjk_codec *) codec;
+
+	c->inval_buf[0] = '\0';
+	c->inval_len = 0;
+
+	c->read_buf[0] = 0;
+	c->read_len = 0;
+
+	c->write_buf[0] = 0;
+	c->write_len = 0;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Decode a chunk of CJK charset data into UTF-8
+ *
+ * \param codec         The codec to use
+ * \param source        Pointer to pointer to source data
+ * \param sourcelen     Pointer to length (in bytes) of source data
+ * \param dest          Pointer to pointer to output buffer
+ * \param destlen       Pointer to length (in bytes) of output buffer
+ * \param replacements  Pointer to counter of U+FFFD characters, updated
+ * \return As for charset_cjk_codec_decode
+ *
+ * This behaves exactly as charset_cjk_codec_decode, except that output
+ * is in UTF-8.
+ */
+parserutils_error charset_cjk_codec_decode_utf8(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen, uint32_t *replacements)
+{
+	charset_cjk_codec *c = (charset_cjk_codec *) codec;
+	parserutils_error error;
+
+	c->utf8 = true;
+	c->replaced = 0;
+
+	error = charset_cjk_codec_decode(codec, source, sourcelen,
+			dest, destlen);
+
+	*replacements += c->replaced;
+	c->utf8 = false;
+
+	return error;
+}
+
+/**
+ * Decode a run of well-formed CJK charset data
+ *
+ * \param c          The codec
+ * \param source     Pointer to pointer to source buffer (updated on exit)
+ * \param sourcelen  Pointer to length of source buffer (updated on exit)
+ * \param dest       Pointer to pointer to output buffer (updated on exit)
+ * \param destlen    Pointer to length of output buffer (updated on exit)
+ *
+ * This stops at the first invalid or incomplete sequence, or once the
+ * output buffer has no room for the next character. ASCII is copied or
+ * widened in blocks. The caller should resume with
+ * charset_cjk_codec_read_char, which handles all of those cases.
+ */
+void charset_cjk_codec_decode_run(charset_cjk_codec *c,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	const uint8_t *s = *source;
+	size_t slen = *sourcelen;
+	uint8_t *d = *dest;
+	size_t dlen = *destlen;
+	bool le = parserutils__charset_codec_ucs4_is_le(&c->base);
+
+	while (slen > 0) {
+		uint32_t ucs4;
+		size_t n;
+
+		if (*s < 0x80) {
+			size_t run;
+
+			if (c->utf8) {
+				run = simd_ascii_prefix(s, min(slen, dlen));
+				memcpy(d, s, run);
+				d += run;
+				dlen -= run;
+			} else {
+				run = simd_ascii_prefix(s, min(slen, dlen / 4));
+				simd_ascii_to_ucs4(s, run, le, d);
+				d += run * 4;
+				dlen -= run * 4;
+			}
+
+			if (run == 0)
+				break;
+
+			s += run;
+			slen -= run;
+
+			continue;
+		}
+
+		if (charset_cjk_to_ucs4(c, s, slen, &ucs4, &n) !=
+				PARSERUTILS_OK)
+			break;
+
+		if (c->utf8) {
+			uint32_t out = ucs4;
+			parserutils_error error;
+
+			UTF8_FROM_UCS4(out, &d, &dlen, error);
+			if (error != PARSERUTILS_OK)
+				break;
+
+			if (ucs4 == 0xFFFD)
+				c->replaced++;
+		} else {
+			if (dlen < 4)
+				break;
+
+			parserutils__charset_codec_write_ucs4(&c->base, ucs4, d);
+			d += 4;
+			dlen -= 4;
+		}
+
+		s += n;
+		slen -= n;
+	}
+
+	*source = s;
+	*sourcelen = slen;
+	*dest = d;
+	*destlen = dlen;
+}
+
+/**
+ * Read a character from a CJK charset to UCS-4 (big endian)
+ *
+ * \param c          The codec
+ * \param source     Pointer to pointer to source buffer (updated on exit)
+ * \param sourcelen  Pointer to length of source buffer (updated on exit)
+ * \param dest       Pointer to pointer to output buffer (updated on exit)
+ * \param destlen    Pointer to length of output buffer (updated on exit)
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM       if output buffer is too small,
+ *         PARSERUTILS_INVALID     if a character cannot be represented and the
+ *                                 codec's error handling mode is set to STRICT,
+ *
+ * On exit, ::source will point immediately _after_ the last input character
+ * read, if the result is _OK or _NOMEM. Any remaining output for the
+ * character will be buffered by the codec for writing on the next call.
+ *
+ * In the case of the result being _INVALID, ::source will point _at_ the
+ * last input character read; nothing will be written or buffered for the
+ * failed character. It is up to the client to fix the cause of the failure
+ * and retry the decoding process.
+ *
+ * ::sourcelen will be reduced appropriately on exit.
+ *
+ * ::dest will point immediately _after_ the last character written.
+ *
+ * ::destlen will be reduced appropriately on exit.
+ */
+parserutils_error charset_cjk_codec_read_char(charset_cjk_codec *c,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	uint32_t ucs4;
+	size_t clen;
+	parserutils_error error;
+
+	/* Convert a single character */
+	error = charset_cjk_to_ucs4(c, *source, *sourcelen, &ucs4, &clen);
+	if (error == PARSERUTILS_OK) {
+		/* Read a character */
+		error = charset_cjk_codec_output_decoded_char(c,
+				ucs4, dest, destlen);
+		if (error == PARSERUTILS_OK || error == PARSERUTILS_NOMEM) {
+			/* output succeeded; update source pointers */
+			*source += clen;
+			*sourcelen -= clen;
+		}
+
+		/* Clear inval buffer */
+		c->inval_buf[0] = '\0';
+		c->inval_len = 0;
+
+		return error;
+	} else if (error == PARSERUTILS_NEEDDATA) {
+		/* Incomplete input sequence */
+		assert(*sourcelen < INVAL_BUFSIZE);
+
+		memmove(c->inval_buf, *source, *sourcelen);
+		c->inval_buf[*sourcelen] = '\0';
+		c->inval_len = *sourcelen;
+
+		*source += *sourcelen;
+		*sourcelen = 0;
+
+		return PARSERUTILS_OK;
+	} else if (error == PARSERUTILS_INVALID) {
+		/* Illegal input sequence */
+
+		/* Clear inval buffer */
+		c->inval_buf[0] = '\0';
+		c->inval_len = 0;
+
+		/* Strict errormode; simply flag invalid character */
+		if (c->base.errormode ==
+				PARSERUTILS_CHARSET_CODEC_ERROR_STRICT) {
+			return PARSERUTILS_INVALID;
+		}
+
+		/* output U+FFFD and continue processing. */
+		error = charset_cjk_codec_output_decoded_char(c,
+				0xFFFD, dest, destlen);
+		if (error == PARSERUTILS_OK || error == PARSERUTILS_NOMEM) {
+			/* output succeeded; update source pointers */
+			*source += clen;
+			*sourcelen -= clen;
+		}
+
+		return error;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Output a UCS-4 character (big endian)
+ *
+ * \param c        Codec to use
+ * \param ucs4     UCS-4 character (host endian)
+ * \param dest     Pointer to pointer to output buffer
+ * \param destlen  Pointer to output buffer length
+ * \return PARSERUTILS_OK          on success,
+ *         PARSERUTILS_NOMEM       if output buffer is too small,
+ */
+parserutils_error charset_cjk_codec_output_decoded_char(charset_cjk_codec *c,
+		uint32_t ucs4, uint8_t **dest, size_t *destlen)
+{
+	if (c->utf8) {
+		uint32_t out = ucs4;
+		parserutils_error error;
+
+		if (ucs4 == 0xFFFD)
+			c->replaced++;
+
+		UTF8_FROM_UCS4(out, dest, destlen, error);
+		if (error != PARSERUTILS_OK) {
+			/* Run out of output buffer */
+			c->read_len = 1;
+			c->read_buf[0] = ucs4;
+
+			return PARSERUTILS_NOMEM;
+		}
+
+		return PARSERUTILS_OK;
+	}
+
+	if (*destlen < 4) {
+		/* Run out of output buffer */
+		c->read_len = 1;
+		c->read_buf[0] = ucs4;
+
+		return PARSERUTILS_NOMEM;
+	}
+
+	parserutils__charset_codec_write_ucs4(&c->base, ucs4, *dest);
+	*dest += 4;
+	*destlen -= 4;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Compare two entries in a map from UCS-4
+ *
+ * \param a  The first entry
+ * \param b  The second entry
+ * \return <0 if a orders before b, >0 if after, 0 if equal
+ *
+ * Entries for the same character are ordered by byte sequence, so that the
+ * shortest sequence is found first.
+ */
+static int charset_cjk_reverse_cmp(const void *a, const void *b)
+{
+	const charset_cjk_reverse *ra = a;
+	const charset_cjk_reverse *rb = b;
+
+	if (ra->ucs4 != rb->ucs4)
+		return ra->ucs4 < rb->ucs4 ? -1 : 1;
+
+	if (ra->seq != rb->seq)
+		return ra->seq < rb->seq ? -1 : 1;
+
+	return 0;
+}
+
+/**
+ * Add the characters of a table to a map from UCS-4
+ *
+ * \param map     The map to add to, or NULL to count entries only
+ * \param len     Pointer to number of entries in map (updated on exit)
+ * \param table   The table to add
+ * \param rows    Number of lead bytes in table
+ * \param cols    Number of trail bytes in table
+ * \param kind    Charset being mapped, which determines the byte sequences
+ * \param prefix  Byte preceding the sequences, or 0 if none
+ */
+static void charset_cjk_reverse_add(charset_cjk_reverse *map, size_t *len,
+		const uint16_t *table, uint32_t rows, uint32_t cols,
+		charset_cjk_kind kind, uint32_t prefix)
+{
+	uint32_t row, col;
+
+	for (row = 0; row < rows; row++) {
+		for (col = 0; col < cols; col++) {
+			uint32_t ucs4 = table[row * cols + col];
+			uint32_t lead, trail;
+
+			if (ucs4 == 0xFFFF || ucs4 == 0xFFFE)
+				continue;
+
+			if (map == NULL) {
+				(*len)++;
+				continue;
+			}
+
+			switch (kind) {
+			case CJK_SHIFT_JIS:
+				/* Rows of JIS X 0208 are paired up */
+				lead = (row >> 1) + (row < 62 ? 0x81 : 0xC1);
+				if (row & 1)
+					trail = col + 0x9F;
+				else
+					trail = col + (col < 0x3F ? 0x40 : 0x41);
+				break;
+			case CJK_GBK:
+			case CJK_GB18030:
+				lead = row + 0x81;
+				trail = col + 0x40;
+				break;
+			case CJK_BIG5:
+				lead = row + 0xA1;
+				trail = col + 0x40;
+				break;
+			default:
+				lead = row + 0xA1;
+				trail = col + 0xA1;
+				break;
+			}
+
+			map[*len].ucs4 = ucs4;
+			map[*len].seq = (prefix << 16) | (lead << 8) | trail;
+			(*len)++;
+		}
+	}
+}
+
+/**
+ * Build a codec's map from UCS-4
+ *
+ * \param c  The codec
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ *
+ * Only characters from the double and triple byte tables are mapped;
+ * single bytes and GB18030's four byte sequences are handled by code.
+ */
+parserutils_error charset_cjk_build_reverse(charset_cjk_codec *c)
+{
+	charset_cjk_reverse *map = NULL;
+	size_t len, i, j;
+	int pass;
+
+	/* Count the entries, then fill them in */
+	for (pass = 0; pass < 2; pass++) {
+		len = 0;
+
+		switch (c->kind) {
+		case CJK_SHIFT_JIS:
+			charset_cjk_reverse_add(map, &len, jis0208, 94, 94,
+					c->kind, 0);
+			break;
+		case CJK_EUC_JP:
+			charset_cjk_reverse_add(map, &len, jis0208, 94, 94,
+					c->kind, 0);
+			charset_cjk_reverse_add(map, &len, jis0212, 94, 94,
+					c->kind, 0x8F);
+			break;
+		case CJK_GBK:
+		case CJK_GB18030:
+			charset_cjk_reverse_add(map, &len, gb18030, 126, 191,
+					c->kind, 0);
+			if (map != NULL) {
+				for (i = 0; i < N_ELEMENTS(gb18030_astral);
+						i++) {
+					map[len + i].ucs4 =
+						gb18030_astral[i].ucs4;
+					map[len + i].seq =
+						gb18030_astral[i].seq;
+				}
+			}
+			len += N_ELEMENTS(gb18030_astral);
+			break;
+		case CJK_BIG5:
+			charset_cjk_reverse_add(map, &len, big5, 89, 191,
+					c->kind, 0);
+			break;
+		case CJK_EUC_KR:
+			charset_cjk_reverse_add(map, &len, ksc5601, 94, 94,
+					c->kind, 0);
+			break;
+		}
+
+		if (map == NULL) {
+			map = c->base.alloc(NULL,
+					len * sizeof(charset_cjk_reverse),
+					c->base.alloc_pw);
+			if (map == NULL)
+				return PARSERUTILS_NOMEM;
+		}
+	}
+
+	qsort(map, len, sizeof(charset_cjk_reverse),
+			charset_cjk_reverse_cmp);
+
+	/* Keep only the first sequence for each character */
+	for (i = 0, j = 0; i < len; i++) {
+		if (j > 0 && map[j - 1].ucs4 == map[i].ucs4)
+			continue;
+
+		map[j++] = map[i];
+	}
+
+	c->reverse = map;
+	c->reverse_len = j;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Convert a UCS4 (host endian) character to a CJK charset
+ *
+ * \param c     The codec instance
+ * \param ucs4  The UCS4 character to convert
+ * \param s     Pointer to pointer to destination buffer
+ * \param len   Pointer to destination buffer length
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM if there's insufficient space in the output buffer,
+ *         PARSERUTILS_INVALID if the character cannot be represented
+ *
+ * _INVALID will only be returned if the codec's conversion mode is STRICT.
+ * Otherwise, '?' will be output.
+ *
+ * On successful conversion, *s and *len will be updated.
+ */
+parserutils_error charset_cjk_from_ucs4(charset_cjk_codec *c,
+		uint32_t ucs4, uint8_t **s, size_t *len)
+{
+	uint32_t seq = 0;
+	size_t n, i;
+
+	if (ucs4 < 0x80) {
+		/* ASCII */
+		seq = ucs4;
+	} else if (ucs4 < 0xA0 && (c->kind == CJK_EUC_KR ||
+			(c->kind == CJK_EUC_JP &&
+			ucs4 != 0x8E && ucs4 != 0x8F))) {
+		/* C1 controls */
+		seq = ucs4;
+	} else if (ucs4 == 0x80 && c->kind == CJK_BIG5) {
+		seq = ucs4;
+	} else if (ucs4 == 0x20AC && c->kind == CJK_GBK) {
+		seq = 0x80;
+	} else if (ucs4 >= 0xFF61 && ucs4 <= 0xFF9F &&
+			c->kind == CJK_SHIFT_JIS) {
+		/* Halfwidth katakana */
+		seq = ucs4 - 0xFF61 + 0xA1;
+	} else if (ucs4 >= 0xFF61 && ucs4 <= 0xFF9F &&
+			c->kind == CJK_EUC_JP) {
+		seq = 0x8E00 | (ucs4 - 0xFF61 + 0xA1);
+	} else {
+		charset_cjk_reverse *found = NULL;
+
+		if (c->reverse_len > 0) {
+			size_t lo = 0, hi = c->reverse_len;
+
+			while (lo < hi) {
+				size_t mid = (lo + hi) / 2;
+
+				if (c->reverse[mid].ucs4 < ucs4)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+
+			if (lo < c->reverse_len &&
+					c->reverse[lo].ucs4 == ucs4)
+				found = &c->reverse[lo];
+		}
+
+		if (found != NULL) {
+			seq = found->seq;
+		} else if (c->kind == CJK_GB18030 && ucs4 <= 0x10FFFF &&
+				(ucs4 < 0xD800 || ucs4 > 0xDFFF)) {
+			uint32_t index = 0;
+
+			if (ucs4 >= 0x10000) {
+				index = GB18030_ASTRAL_INDEX + ucs4 - 0x10000;
+			} else {
+				for (i = 0; i < N_ELEMENTS(gb18030_ranges);
+						i++) {
+					const gb18030_range *r =
+							&gb18030_ranges[i];
+
+					if (ucs4 >= r->ucs4 &&
+						ucs4 < (uint32_t) r->ucs4 +
+								r->count) {
+						index = r->index + ucs4 -
+								r->ucs4;
+						break;
+					}
+				}
+
+				if (i == N_ELEMENTS(gb18030_ranges))
+					index = UINT32_MAX;
+			}
+
+			if (index != UINT32_MAX) {
+				if (*len < 4)
+					return PARSERUTILS_NOMEM;
+
+				(*s)[3] = 0x30 + index % 10;
+				index /= 10;
+				(*s)[2] = 0x81 + index % 126;
+				index /= 126;
+				(*s)[1] = 0x30 + index % 10;
+				(*s)[0] = 0x81 + index / 10;
+
+				*s += 4;
+				*len -= 4;
+
+				return PARSERUTILS_OK;
+			}
+		}
+
+		if (found == NULL) {
+			if (c->base.errormode ==
+					PARSERUTILS_CHARSET_CODEC_ERROR_STRICT)
+				return PARSERUTILS_INVALID;
+			else
+				seq = '?';
+		}
+	}
+
+	n = seq > 0xFFFF ? 3 : seq > 0xFF ? 2 : 1;
+
+	if (*len < n)
+		return PARSERUTILS_NOMEM;
+
+	for (i = 0; i < n; i++)
+		(*s)[i] = (seq >> (8 * (n - 1 - i))) & 0xFF;
+
+	*s += n;
+	*len -= n;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Convert a Shift_JIS character to UCS4 (host endian)
+ *
+ * \param s     Pointer to source buffer
+ * \param len   Source buffer length
+ * \param ucs4  Pointer to location to receive character
+ * \param clen  Pointer to location to receive byte length of sequence,
+ *              or of the bytes to skip if it is invalid
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NEEDDATA if the sequence is incomplete,
+ *         PARSERUTILS_INVALID if the sequence is invalid
+ */
+static inline parserutils_error charset_cjk_sjis_to_ucs4(const uint8_t *s,
+		size_t len, uint32_t *ucs4, size_t *clen)
+{
+	uint32_t lead = s[0], trail, row, col;
+
+	*clen = 1;
+
+	if (lead >= 0xA1 && lead <= 0xDF) {
+		/* Halfwidth katakana */
+		*ucs4 = 0xFF61 + lead - 0xA1;
+		return PARSERUTILS_OK;
+	}
+
+	if (lead < 0x81 || (lead > 0x9F && lead < 0xE0) || lead > 0xFC)
+		return PARSERUTILS_INVALID;
+
+	if (len < 2)
+		return PARSERUTILS_NEEDDATA;
+
+	trail = s[1];
+	if (trail >= 0x80)
+		*clen = 2;
+
+	if (trail < 0x40 || trail == 0x7F || trail > 0xFC)
+		return PARSERUTILS_INVALID;
+
+	if (lead >= 0xF0 && lead <= 0xF9) {
+		/* User-defined characters, in the Private Use Area */
+		*ucs4 = 0xE000 + (lead - 0xF0) * 188 +
+				trail - (trail < 0x80 ? 0x40 : 0x41);
+		*clen = 2;
+		return PARSERUTILS_OK;
+	}
+
+	if (lead > 0xEF)
+		return PARSERUTILS_INVALID;
+
+	/* Each lead byte covers two rows of JIS X 0208 */
+	row = (lead - (lead < 0xA0 ? 0x81 : 0xC1)) * 2;
+	if (trail >= 0x9F) {
+		row++;
+		col = trail - 0x9F;
+	} else {
+		col = trail - (trail < 0x80 ? 0x40 : 0x41);
+	}
+
+	*ucs4 = jis0208[row * 94 + col];
+	if (*ucs4 == 0xFFFF)
+		return PARSERUTILS_INVALID;
+
+	*clen = 2;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Convert an EUC-JP character to UCS4 (host endian)
+ *
+ * \param s     Pointer to source buffer
+ * \param len   Source buffer length
+ * \param ucs4  Pointer to location to receive character
+ * \param clen  Pointer to location to receive byte length of sequence,
+ *              or of the bytes to skip if it is invalid
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NEEDDATA if the sequence is incomplete,
+ *         PARSERUTILS_INVALID if the sequence is invalid
+ */
+static inline parserutils_error charset_cjk_eucjp_to_ucs4(const uint8_t *s,
+		size_t len, uint32_t *ucs4, size_t *clen)
+{
+	uint32_t lead = s[0], trail;
+
+	*clen = 1;
+
+	if (lead < 0xA0 && lead != 0x8E && lead != 0x8F) {
+		/* C1 controls */
+		*ucs4 = lead;
+		return PARSERUTILS_OK;
+	}
+
+	if (lead == 0xA0 || lead == 0xFF)
+		return PARSERUTILS_INVALID;
+
+	if (len < 2)
+		return PARSERUTILS_NEEDDATA;
+
+	trail = s[1];
+	if (trail >= 0x80)
+		*clen = 2;
+
+	if (lead == 0x8E) {
+		/* Halfwidth katakana */
+		if (trail < 0xA1 || trail > 0xDF)
+			return PARSERUTILS_INVALID;
+
+		*ucs4 = 0xFF61 + trail - 0xA1;
+	} else if (lead == 0x8F) {
+		/* JIS X 0212 */
+		if (trail < 0xA1 || trail > 0xFE)
+			return PARSERUTILS_INVALID;
+
+		if (len < 3)
+			return PARSERUTILS_NEEDDATA;
+
+		if (s[2] >= 0x80)
+			*clen = 3;
+
+		if (s[2] < 0xA1 || s[2] > 0xFE)
+			return PARSERUTILS_INVALID;
+
+		*ucs4 = jis0212[(trail - 0xA1) * 94 + s[2] - 0xA1];
+		if (*ucs4 == 0xFFFF)
+			return PARSERUTILS_INVALID;
+
+		*clen = 3;
+
+		return PARSERUTILS_OK;
+	} else {
+		/* JIS X 0208 */
+		if (trail < 0xA1 || trail > 0xFE)
+			return PARSERUTILS_INVALID;
+
+		*ucs4 = jis0208[(lead - 0xA1) * 94 + trail - 0xA1];
+		if (*ucs4 == 0xFFFF)
+			return PARSERUTILS_INVALID;
+	}
+
+	*clen = 2;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Convert a GB18030 character to UCS4 (host endian)
+ *
+ * \param s     Pointer to source buffer
+ * \param len   Source buffer length
+ * \param gbk   Whether the charset is GBK, which maps 0x80 to U+20AC
+ * \param ucs4  Pointer to location to receive character
+ * \param clen  Pointer to location to receive byte length of sequence,
+ *              or of the bytes to skip if it is invalid
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NEEDDATA if the sequence is incomplete,
+ *         PARSERUTILS_INVALID if the sequence is invalid
+ */
+static inline parserutils_error charset_cjk_gb18030_to_ucs4(const uint8_t *s,
+		size_t len, bool gbk, uint32_t *ucs4, size_t *clen)
+{
+	uint32_t lead = s[0], trail, index;
+	size_t i;
+
+	*clen = 1;
+
+	if (lead == 0x80 && gbk) {
+		*ucs4 = 0x20AC;
+		return PARSERUTILS_OK;
+	}
+
+	if (lead == 0x80 || lead == 0xFF)
+		return PARSERUTILS_INVALID;
+
+	if (len < 2)
+		return PARSERUTILS_NEEDDATA;
+
+	trail = s[1];
+
+	if (trail >= 0x30 && trail <= 0x39) {
+		/* Four byte sequence; if invalid, only the lead is skipped */
+		if (len >= 3 && (s[2] < 0x81 || s[2] > 0xFE))
+			return PARSERUTILS_INVALID;
+
+		if (len < 4)
+			return PARSERUTILS_NEEDDATA;
+
+		if (s[3] < 0x30 || s[3] > 0x39)
+			return PARSERUTILS_INVALID;
+
+		index = (((lead - 0x81) * 10 + trail - 0x30) * 126 +
+				s[2] - 0x81) * 10 + s[3] - 0x30;
+
+		if (index >= GB18030_ASTRAL_INDEX) {
+			if (index - GB18030_ASTRAL_INDEX > 0xFFFFF)
+				return PARSERUTILS_INVALID;
+
+			*ucs4 = 0x10000 + index - GB18030_ASTRAL_INDEX;
+		} else {
+			size_t lo = 0, hi = N_ELEMENTS(gb18030_ranges);
+
+			/* Find the last range starting at or before index */
+			while (lo < hi) {
+				size_t mid = (lo + hi) / 2;
+
+				if (gb18030_ranges[mid].index <= index)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+
+			if (lo == 0 || index >= (uint32_t)
+					gb18030_ranges[lo - 1].index +
+					gb18030_ranges[lo - 1].count)
+				return PARSERUTILS_INVALID;
+
+			*ucs4 = gb18030_ranges[lo - 1].ucs4 + index -
+					gb18030_ranges[lo - 1].index;
+		}
+
+		*clen = 4;
+
+		return PARSERUTILS_OK;
+	}
+
+	if (trail >= 0x80)
+		*clen = 2;
+
+	if (trail < 0x40 || trail == 0x7F || trail == 0xFF)
+		return PARSERUTILS_INVALID;
+
+	*ucs4 = gb18030[(lead - 0x81) * 191 + trail - 0x40];
+	if (*ucs4 == 0xFFFE) {
+		for (i = 0; i < N_ELEMENTS(gb18030_astral); i++) {
+			if (gb18030_astral[i].seq == ((lead << 8) | trail)) {
+				*ucs4 = gb18030_astral[i].ucs4;
+				break;
+			}
+		}
+	}
+
+	if (*ucs4 == 0xFFFF || *ucs4 == 0xFFFE)
+		return PARSERUTILS_INVALID;
+
+	*clen = 2;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Convert a Big5 or EUC-KR character to UCS4 (host endian)
+ *
+ * \param s      Pointer to source buffer
+ * \param len    Source buffer length
+ * \param table  Mapping table, indexed by lead and trail
+ * \param lead0  First lead byte in table
+ * \param lead1  Last lead byte in table
+ * \param trail0 First trail byte in table
+ * \param cols   Number of trail bytes in table
+ * \param ucs4   Pointer to location to receive character
+ * \param clen   Pointer to location to receive byte length of sequence,
+ *               or of the bytes to skip if it is invalid
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NEEDDATA if the sequence is incomplete,
+ *         PARSERUTILS_INVALID if the sequence is invalid
+ */
+static inline parserutils_error charset_cjk_dbcs_to_ucs4(const uint8_t *s,
+		size_t len, const uint16_t *table, uint32_t lead0,
+		uint32_t lead1, uint32_t trail0, uint32_t cols,
+		uint32_t *ucs4, size_t *clen)
+{
+	uint32_t lead = s[0], trail;
+
+	*clen = 1;
+
+	if (lead < 0x81 || lead == 0xFF)
+		return PARSERUTILS_INVALID;
+
+	if (len < 2)
+		return PARSERUTILS_NEEDDATA;
+
+	trail = s[1];
+	if (trail >= 0x80)
+		*clen = 2;
+
+	if (lead < lead0 || lead > lead1 || trail < trail0 ||
+			trail - trail0 >= cols)
+		return PARSERUTILS_INVALID;
+
+	*ucs4 = table[(lead - lead0) * cols + trail - trail0];
+	if (*ucs4 == 0xFFFF)
+		return PARSERUTILS_INVALID;
+
+	*clen = 2;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Convert a CJK charset character to UCS4 (host endian)
+ *
+ * \param c     The codec instance
+ * \param s     Pointer to source buffer
+ * \param len   Source buffer length
+ * \param ucs4  Pointer to location to receive character
+ * \param clen  Pointer to location to receive byte length of sequence,
+ *              or of the bytes to skip if it is invalid
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NEEDDATA if the sequence is incomplete,
+ *         PARSERUTILS_INVALID if the sequence is invalid
+ *
+ * Bytes below 0x80 are always ASCII. When a multibyte sequence is invalid
+ * and its second byte is ASCII, only the lead byte is skipped, so that the
+ * ASCII character is not lost.
+ */
+parserutils_error charset_cjk_to_ucs4(charset_cjk_codec *c,
+		const uint8_t *s, size_t len, uint32_t *ucs4, size_t *clen)
+{
+	if (len < 1)
+		return PARSERUTILS_NEEDDATA;
+
+	if (*s < 0x80) {
+		*ucs4 = *s;
+		*clen = 1;
+		return PARSERUTILS_OK;
+	}
+
+	switch (c->kind) {
+	case CJK_SHIFT_JIS:
+		return charset_cjk_sjis_to_ucs4(s, len, ucs4, clen);
+	case CJK_EUC_JP:
+		return charset_cjk_eucjp_to_ucs4(s, len, ucs4, clen);
+	case CJK_GBK:
+	case CJK_GB18030:
+		return charset_cjk_gb18030_to_ucs4(s, len,
+				c->kind == CJK_GBK, ucs4, clen);
+	case CJK_BIG5:
+		if (*s == 0x80) {
+			*ucs4 = 0x80;
+			*clen = 1;
+			return PARSERUTILS_OK;
+		}
+
+		return charset_cjk_dbcs_to_ucs4(s, len, big5,
+				0xA1, 0xF9, 0x40, 191, ucs4, clen);
+	case CJK_EUC_KR:
+		if (*s < 0xA0) {
+			/* C1 controls */
+			*ucs4 = *s;
+			*clen = 1;
+			return PARSERUTILS_OK;
+		}
+
+		return charset_cjk_dbcs_to_ucs4(s, len, ksc5601,
+				0xA1, 0xFE, 0xA1, 94, ucs4, clen);
+	}
+
+	return PARSERUTILS_INVALID;
+}
+
+const parserutils_charset_handler charset_cjk_codec_handler = {
+	charset_cjk_codec_create
+};
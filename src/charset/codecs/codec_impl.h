@@ -13,6 +13,20 @@
 
 #include <parserutils/charset/codec.h>
 
+#include "utils/endian.h"
+
+/**
+ * Map from UCS-4 to bytes 0x80-0xFF of a single-byte charset
+ *
+ * This is an open-addressed hash table, which is never more than half full.
+ * The maps are generated by build/conv.pl.
+ */
+typedef struct parserutils_charset_reverse_map {
+#define REVERSE_MAP_SIZE (256)
+	uint16_t ucs4[REVERSE_MAP_SIZE];	/**< Character, or 0 if free */
+	uint8_t byte[REVERSE_MAP_SIZE];		/**< Byte for character */
+} parserutils_charset_reverse_map;
+
 /**
  * Core charset codec definition; implementations extend this
  */
@@ -21,6 +35,9 @@ struct parserutils_charset_codec {
 
 	parserutils_charset_codec_errormode errormode;	/**< error mode */
 
+	bool host_endian;			/**< UCS-4 is host endian,
+						 * rather than big endian */
+
 	parserutils_alloc alloc;		/**< allocation function */
 	void *alloc_pw;				/**< private word */
 
@@ -33,6 +50,12 @@ struct parserutils_charset_codec {
 				const uint8_t **source, size_t *sourcelen,
 				uint8_t **dest, size_t *destlen);
 		parserutils_error (*reset)(parserutils_charset_codec *codec);
+		/* Decode straight to UTF-8; NULL if unsupported */
+		parserutils_error (*decode_utf8)(
+				parserutils_charset_codec *codec,
+				const uint8_t **source, size_t *sourcelen,
+				uint8_t **dest, size_t *destlen,
+				uint32_t *replacements);
 	} handler; /**< Vtable for handler code */
 };
 
@@ -40,10 +63,100 @@ struct parserutils_charset_codec {
  * Codec factory component definition
  */
 typedef struct parserutils_charset_handler {
-	bool (*handles_charset)(const char *charset);
-	parserutils_error (*create)(const char *charset,
-			parserutils_alloc alloc, void *pw, 
+	/* Create a codec for one of the charsets assigned to the handler */
+	parserutils_error (*create)(uint16_t mibenum,
+			parserutils_alloc alloc, void *pw,
 			parserutils_charset_codec **codec);
 } parserutils_charset_handler;
 
+/**
+ * Read a UCS-4 character in a codec's byte order
+ *
+ * \param codec  The codec
+ * \param s      Pointer to the character, which must be 4 byte aligned
+ * \return The character, in host byte order
+ */
+static inline uint32_t parserutils__charset_codec_read_ucs4(
+		const parserutils_charset_codec *codec, const uint8_t *s)
+{
+	uint32_t ucs4 = *((const uint32_t *) (const void *) s);
+
+	return codec->host_endian ? ucs4 : endian_big_to_host(ucs4);
+}
+
+/**
+ * Write a UCS-4 character in a codec's byte order
+ *
+ * \param codec  The codec
+ * \param ucs4   The character, in host byte order
+ * \param d      Pointer to the destination, which must be 4 byte aligned
+ */
+static inline void parserutils__charset_codec_write_ucs4(
+		const parserutils_charset_codec *codec, uint32_t ucs4,
+		uint8_t *d)
+{
+	*((uint32_t *) (void *) d) =
+			codec->host_endian ? ucs4 : endian_host_to_big(ucs4);
+}
+
+/**
+ * Determine whether a codec's UCS-4 is little endian
+ *
+ * \param codec  The codec
+ * \return true if little endian, false if big endian
+ */
+static inline bool parserutils__charset_codec_ucs4_is_le(
+		const parserutils_charset_codec *codec)
+{
+	return codec->host_endian && endian_host_is_le();
+}
+
+parserutils_error parserutils__charset_codec_decode_utf8(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen, uint32_t *replacements);
+
+/* Mapping table of a single-byte charset, as used by the sniffer */
+const uint16_t *parserutils__charset_sbcs_table(uint16_t mibenum);
+
+/**
+ * Find the slot in a reverse map for a character
+ *
+ * \param ucs4  The character, which must be in the BMP
+ * \return Index of first slot to probe
+ */
+static inline uint32_t parserutils__charset_reverse_map_hash(uint32_t ucs4)
+{
+	return ((ucs4 * 0x9E3779B1u) & 0xFFFFFFFFu) >> 24;
+}
+
+/**
+ * Look up a character in a reverse map
+ *
+ * \param map   The map to search
+ * \param ucs4  The character to find (host endian)
+ * \param byte  Pointer to location to receive byte for character
+ * \return true if the character is present, false otherwise
+ */
+static inline bool parserutils__charset_reverse_map_lookup(
+		const parserutils_charset_reverse_map *map, uint32_t ucs4,
+		uint8_t *byte)
+{
+	uint32_t slot;
+
+	if (ucs4 == 0 || ucs4 > 0xFFFF)
+		return false;
+
+	for (slot = parserutils__charset_reverse_map_hash(ucs4);
+			map->ucs4[slot] != 0;
+			slot = (slot + 1) % REVERSE_MAP_SIZE) {
+		if (map->ucs4[slot] == ucs4) {
+			*byte = map->byte[slot];
+			return true;
+		}
+	}
+
+	return false;
+}
+
 #endif
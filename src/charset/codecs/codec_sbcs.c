@@ -0,0 +1,606 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2008 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <parserutils/charset/mibenum.h>
+
+#include "charset/codecs/codec_impl.h"
+#include "utils/endian.h"
+#include "utils/simd.h"
+#include "utils/utils.h"
+
+/**
+ * A single-byte charset, in which bytes below 0x80 are ASCII
+ */
+typedef struct sbcs_charset {
+	uint16_t mib;			/**< MIB enum, from build/Aliases */
+	uint16_t direct;		/**< First byte from which each byte
+					 * is the code point of the same value,
+					 * or 0x100 if none */
+	const uint16_t *table;		/**< UCS-4 for bytes 0x80-0xFF, with
+					 * U+FFFF for undefined bytes */
+	const parserutils_charset_reverse_map *reverse;	/**< Map from UCS-4,
+					 * excluding direct bytes */
+} sbcs_charset;
+
+/* Generated by build/conv.pl, and found through -Isrc/charset */
+#include "sbcs_tables.inc"
+
+#if defined(__GNUC__)
+/* Have each specialised instance inline the engine, so its charset's
+ * tables and constants are folded in */
+#define SBCS_INLINE inline __attribute__((always_inline))
+#else
+#define SBCS_INLINE inline
+#endif
+
+/**
+ * Single-byte charset codec
+ */
+typedef struct charset_sbcs_codec {
+	parserutils_charset_codec base;	/**< Base class */
+
+	const sbcs_charset *charset;	/**< Charset read from / written to */
+
+	bool read_pending;		/**< read_buf holds a character */
+	uint32_t read_buf;		/**< Decoded character which didn't
+					 * fit in the output (host-endian) */
+
+	bool write_pending;		/**< write_buf holds a byte */
+	uint8_t write_buf;		/**< Encoded byte which didn't fit in
+					 * the output */
+} charset_sbcs_codec;
+
+static parserutils_error charset_sbcs_codec_create(uint16_t mibenum,
+		parserutils_alloc alloc, void *pw,
+		parserutils_charset_codec **codec);
+static parserutils_error charset_sbcs_codec_destroy(
+		parserutils_charset_codec *codec);
+static parserutils_error charset_sbcs_codec_reset(
+		parserutils_charset_codec *codec);
+static SBCS_INLINE uint32_t charset_sbcs_to_ucs4(const sbcs_charset *cs,
+		uint8_t byte);
+static SBCS_INLINE bool charset_sbcs_from_ucs4(const sbcs_charset *cs,
+		uint32_t ucs4, uint8_t *byte);
+static SBCS_INLINE parserutils_error charset_sbcs_encode(
+		charset_sbcs_codec *c, const sbcs_charset *cs,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
+static SBCS_INLINE parserutils_error charset_sbcs_decode(
+		charset_sbcs_codec *c, const sbcs_charset *cs,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
+static SBCS_INLINE parserutils_error charset_sbcs_decode_utf8(
+		charset_sbcs_codec *c, const sbcs_charset *cs,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen, uint32_t *replacements);
+
+/**
+ * Define the handlers of an instance of the codec
+ *
+ * \param name  Suffix for the handlers' names
+ * \param cs    Expression for the instance's charset, given c, the codec
+ *
+ * The generic instance finds its charset through the codec; the others
+ * are specialised for a single charset, with cs a constant.
+ */
+#define SBCS_INSTANCE(name, cs)						\
+static parserutils_error charset_sbcs_encode_##name(			\
+		parserutils_charset_codec *codec,			\
+		const uint8_t **source, size_t *sourcelen,		\
+		uint8_t **dest, size_t *destlen)			\
+{									\
+	charset_sbcs_codec *c = (charset_sbcs_codec *) codec;		\
+									\
+	return charset_sbcs_encode(c, (cs), source, sourcelen,		\
+			dest, destlen);					\
+}									\
+									\
+static parserutils_error charset_sbcs_decode_##name(			\
+		parserutils_charset_codec *codec,			\
+		const uint8_t **source, size_t *sourcelen,		\
+		uint8_t **dest, size_t *destlen)			\
+{									\
+	charset_sbcs_codec *c = (charset_sbcs_codec *) codec;		\
+									\
+	return charset_sbcs_decode(c, (cs), source, sourcelen,		\
+			dest, destlen);					\
+}									\
+									\
+static parserutils_error charset_sbcs_decode_utf8_##name(		\
+		parserutils_charset_codec *codec,			\
+		const uint8_t **source, size_t *sourcelen,		\
+		uint8_t **dest, size_t *destlen, uint32_t *replacements)	\
+{									\
+	charset_sbcs_codec *c = (charset_sbcs_codec *) codec;		\
+									\
+	return charset_sbcs_decode_utf8(c, (cs), source, sourcelen,	\
+			dest, destlen, replacements);			\
+}
+
+SBCS_INSTANCE(generic, c->charset)
+SBCS_INSTANCE(iso_8859_1, &sbcs_charsets[SBCS_ISO_8859_1])
+SBCS_INSTANCE(iso_8859_15, &sbcs_charsets[SBCS_ISO_8859_15])
+SBCS_INSTANCE(windows_1252, &sbcs_charsets[SBCS_WINDOWS_1252])
+
+#undef SBCS_INSTANCE
+
+/* The specialised instances; any other charset uses the generic one */
+static const struct {
+	uint32_t index;			/**< Index in sbcs_charsets */
+	parserutils_error (*encode)(parserutils_charset_codec *codec,
+			const uint8_t **source, size_t *sourcelen,
+			uint8_t **dest, size_t *destlen);
+	parserutils_error (*decode)(parserutils_charset_codec *codec,
+			const uint8_t **source, size_t *sourcelen,
+			uint8_t **dest, size_t *destlen);
+	parserutils_error (*decode_utf8)(parserutils_charset_codec *codec,
+			const uint8_t **source, size_t *sourcelen,
+			uint8_t **dest, size_t *destlen,
+			uint32_t *replacements);
+} instances[] = {
+	{ SBCS_ISO_8859_1, charset_sbcs_encode_iso_8859_1,
+	  charset_sbcs_decode_iso_8859_1,
+	  charset_sbcs_decode_utf8_iso_8859_1 },
+	{ SBCS_ISO_8859_15, charset_sbcs_encode_iso_8859_15,
+	  charset_sbcs_decode_iso_8859_15,
+	  charset_sbcs_decode_utf8_iso_8859_15 },
+	{ SBCS_WINDOWS_1252, charset_sbcs_encode_windows_1252,
+	  charset_sbcs_decode_windows_1252,
+	  charset_sbcs_decode_utf8_windows_1252 }
+};
+
+/**
+ * Find a single-byte charset
+ *
+ * \param mibenum  MIB enum of the charset
+ * \return Index of the charset in sbcs_charsets, or N_ELEMENTS(sbcs_charsets)
+ *         if the charset is not handled by this codec
+ */
+static uint32_t charset_sbcs_find(uint16_t mibenum)
+{
+	uint32_t i;
+
+	for (i = 0; i < N_ELEMENTS(sbcs_charsets); i++) {
+		if (sbcs_charsets[i].mib == mibenum)
+			break;
+	}
+
+	return i;
+}
+
+/**
+ * Find the mapping table for a single-byte charset
+ *
+ * \param mibenum  MIB enum of the charset
+ * \return UCS-4 (host endian) for bytes 0x80-0xFF, with U+FFFF for undefined
+ *         characters, or NULL if the charset is not handled by this codec
+ */
+const uint16_t *parserutils__charset_sbcs_table(uint16_t mibenum)
+{
+	uint32_t i = charset_sbcs_find(mibenum);
+
+	if (i == N_ELEMENTS(sbcs_charsets))
+		return NULL;
+
+	return sbcs_charsets[i].table;
+}
+
+/**
+ * Create a single-byte charset codec
+ *
+ * \param mibenum  MIB enum of the charset to read from / write to
+ * \param alloc    Memory (de)allocation function
+ * \param pw       Pointer to client-specific private data (may be NULL)
+ * \param codec    Pointer to location to receive codec
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhausion
+ */
+parserutils_error charset_sbcs_codec_create(uint16_t mibenum,
+		parserutils_alloc alloc, void *pw,
+		parserutils_charset_codec **codec)
+{
+	charset_sbcs_codec *c;
+	uint32_t index = charset_sbcs_find(mibenum);
+	uint32_t i;
+
+	assert(index < N_ELEMENTS(sbcs_charsets));
+
+	c = alloc(NULL, sizeof(charset_sbcs_codec), pw);
+	if (c == NULL)
+		return PARSERUTILS_NOMEM;
+
+	c->charset = &sbcs_charsets[index];
+
+	c->read_pending = false;
+	c->read_buf = 0;
+
+	c->write_pending = false;
+	c->write_buf = 0;
+
+	/* Finally, populate vtable */
+	c->base.handler.destroy = charset_sbcs_codec_destroy;
+	c->base.handler.encode = charset_sbcs_encode_generic;
+	c->base.handler.decode = charset_sbcs_decode_generic;
+	c->base.handler.reset = charset_sbcs_codec_reset;
+	c->base.handler.decode_utf8 = charset_sbcs_decode_utf8_generic;
+
+	for (i = 0; i < N_ELEMENTS(instances); i++) {
+		if (instances[i].index == index) {
+			c->base.handler.encode = instances[i].encode;
+			c->base.handler.decode = instances[i].decode;
+			c->base.handler.decode_utf8 = instances[i].decode_utf8;
+		}
+	}
+
+	*codec = (parserutils_charset_codec *) c;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Destroy a single-byte charset codec
+ *
+ * \param codec  The codec to destroy
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error charset_sbcs_codec_destroy(parserutils_charset_codec *codec)
+{
+	UNUSED(codec);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Clear a single-byte charset codec's encoding state
+ *
+ * \param codec  The codec to reset
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error charset_sbcs_codec_reset(parserutils_charset_codec *codec)
+{
+	charset_sbcs_codec *c = (charset_sbcs_codec *) codec;
+
+	c->read_pending = false;
+	c->read_buf = 0;
+
+	c->write_pending = false;
+	c->write_buf = 0;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Convert a byte of a single-byte charset to UCS-4 (host endian)
+ *
+ * \param cs    The charset
+ * \param byte  The byte to convert
+ * \return The character, or U+FFFF if the byte is undefined
+ */
+uint32_t charset_sbcs_to_ucs4(const sbcs_charset *cs, uint8_t byte)
+{
+	if (byte < 0x80 || byte >= cs->direct)
+		return byte;
+
+	return cs->table[byte - 0x80];
+}
+
+/**
+ * Convert a UCS-4 (host endian) character to a single-byte charset
+ *
+ * \param cs    The charset
+ * \param ucs4  The character to convert
+ * \param byte  Pointer to location to receive byte
+ * \return true on success, false if the character cannot be represented
+ */
+bool charset_sbcs_from_ucs4(const sbcs_charset *cs, uint32_t ucs4,
+		uint8_t *byte)
+{
+	if (ucs4 < 0x80 || (ucs4 >= cs->direct && ucs4 < 0x100)) {
+		*byte = ucs4;
+		return true;
+	}
+
+	return parserutils__charset_reverse_map_lookup(cs->reverse, ucs4, byte);
+}
+
+/**
+ * Encode a chunk of UCS-4 data into a single-byte charset
+ *
+ * \param c          The codec to use
+ * \param cs         The codec's charset
+ * \param source     Pointer to pointer to source data
+ * \param sourcelen  Pointer to length (in bytes) of source data
+ * \param dest       Pointer to pointer to output buffer
+ * \param destlen    Pointer to length (in bytes) of output buffer
+ * \return PARSERUTILS_OK          on success,
+ *         PARSERUTILS_NOMEM       if output buffer is too small,
+ *         PARSERUTILS_INVALID     if a character cannot be represented and the
+ *                                 codec's error handling mode is set to STRICT,
+ *
+ * On exit, ::source will point immediately _after_ the last input character
+ * read, if the result is _OK or _NOMEM. Any remaining output for the
+ * character will be buffered by the codec for writing on the next call.
+ *
+ * In the case of the result being _INVALID, ::source will point _at_ the
+ * character which cannot be represented.
+ *
+ * Note that, if failure occurs whilst attempting to write any output
+ * buffered by the last call, then ::source and ::sourcelen will remain
+ * unchanged (as nothing more has been read).
+ *
+ * ::sourcelen will be reduced appropriately on exit.
+ *
+ * ::dest will point immediately _after_ the last character written.
+ *
+ * ::destlen will be reduced appropriately on exit.
+ */
+parserutils_error charset_sbcs_encode(charset_sbcs_codec *c,
+		const sbcs_charset *cs,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	const uint8_t *s = *source;
+	size_t slen = *sourcelen;
+	uint8_t *d = *dest;
+	size_t dlen = *destlen;
+	parserutils_error error = PARSERUTILS_OK;
+
+	/* Output any byte which didn't fit last time */
+	if (c->write_pending) {
+		if (dlen < 1)
+			return PARSERUTILS_NOMEM;
+
+		*d++ = c->write_buf;
+		dlen--;
+
+		c->write_pending = false;
+	}
+
+	while (slen >= 4) {
+		uint32_t ucs4 = parserutils__charset_codec_read_ucs4(&c->base, s);
+		uint8_t byte;
+
+		if (charset_sbcs_from_ucs4(cs, ucs4, &byte) == false) {
+			if (c->base.errormode ==
+					PARSERUTILS_CHARSET_CODEC_ERROR_STRICT) {
+				error = PARSERUTILS_INVALID;
+				break;
+			}
+
+			byte = '?';
+		}
+
+		s += 4;
+		slen -= 4;
+
+		if (dlen < 1) {
+			/* Claim the character, and keep the byte for
+			 * writing next call */
+			c->write_buf = byte;
+			c->write_pending = true;
+
+			error = PARSERUTILS_NOMEM;
+			break;
+		}
+
+		*d++ = byte;
+		dlen--;
+	}
+
+	*source = s;
+	*sourcelen = slen;
+	*dest = d;
+	*destlen = dlen;
+
+	return error;
+}
+
+/**
+ * Decode a chunk of a single-byte charset into UCS-4
+ *
+ * \param c          The codec to use
+ * \param cs         The codec's charset
+ * \param source     Pointer to pointer to source data
+ * \param sourcelen  Pointer to length (in bytes) of source data
+ * \param dest       Pointer to pointer to output buffer
+ * \param destlen    Pointer to length (in bytes) of output buffer
+ * \return PARSERUTILS_OK          on success,
+ *         PARSERUTILS_NOMEM       if output buffer is too small,
+ *         PARSERUTILS_INVALID     if a byte is undefined in the charset and the
+ *                                 codec's error handling mode is set to STRICT,
+ *
+ * On exit, ::source will point immediately _after_ the last input character
+ * read, if the result is _OK or _NOMEM. Any remaining output for the
+ * character will be buffered by the codec for writing on the next call.
+ *
+ * In the case of the result being _INVALID, ::source will point _at_ the
+ * last input character read; nothing will be written or buffered for the
+ * failed character. It is up to the client to fix the cause of the failure
+ * and retry the decoding process.
+ *
+ * Note that, if failure occurs whilst attempting to write any output
+ * buffered by the last call, then ::source and ::sourcelen will remain
+ * unchanged (as nothing more has been read).
+ *
+ * ::sourcelen will be reduced appropriately on exit.
+ *
+ * ::dest will point immediately _after_ the last character written.
+ *
+ * ::destlen will be reduced appropriately on exit.
+ *
+ * Call this with a source length of 0 to flush the output buffer.
+ */
+parserutils_error charset_sbcs_decode(charset_sbcs_codec *c,
+		const sbcs_charset *cs,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	const uint8_t *s = *source;
+	size_t slen = *sourcelen;
+	uint8_t *d = *dest;
+	size_t dlen = *destlen;
+	parserutils_error error = PARSERUTILS_OK;
+
+	/* Output left over from last decode */
+	if (c->read_pending) {
+		if (dlen < 4)
+			return PARSERUTILS_NOMEM;
+
+		parserutils__charset_codec_write_ucs4(&c->base, c->read_buf, d);
+		d += 4;
+		dlen -= 4;
+
+		c->read_pending = false;
+	}
+
+	while (slen > 0) {
+		uint32_t ucs4 = charset_sbcs_to_ucs4(cs, s[0]);
+
+		if (ucs4 == 0xFFFF) {
+			if (c->base.errormode ==
+					PARSERUTILS_CHARSET_CODEC_ERROR_STRICT) {
+				error = PARSERUTILS_INVALID;
+				break;
+			}
+
+			ucs4 = 0xFFFD;
+		}
+
+		s++;
+		slen--;
+
+		if (dlen < 4) {
+			/* Run out of output buffer */
+			c->read_buf = ucs4;
+			c->read_pending = true;
+
+			error = PARSERUTILS_NOMEM;
+			break;
+		}
+
+		parserutils__charset_codec_write_ucs4(&c->base, ucs4, d);
+		d += 4;
+		dlen -= 4;
+	}
+
+	*source = s;
+	*sourcelen = slen;
+	*dest = d;
+	*destlen = dlen;
+
+	return error;
+}
+
+/**
+ * Decode a chunk of a single-byte charset straight to UTF-8
+ *
+ * \param c             The codec to use
+ * \param cs            The codec's charset
+ * \param source        Pointer to pointer to source data
+ * \param sourcelen     Pointer to length (in bytes) of source data
+ * \param dest          Pointer to pointer to output buffer
+ * \param destlen       Pointer to length (in bytes) of output buffer
+ * \param replacements  Pointer to counter of U+FFFD substitutions, updated
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM if the output buffer is too small,
+ *         PARSERUTILS_INVALID if a byte is undefined in the charset and the
+ *                             codec's error handling mode is set to STRICT
+ *
+ * No state is kept between calls: on _NOMEM or _INVALID, ::source points at
+ * the character which could not be written.
+ */
+parserutils_error charset_sbcs_decode_utf8(charset_sbcs_codec *c,
+		const sbcs_charset *cs,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen, uint32_t *replacements)
+{
+	const uint8_t *s = *source;
+	size_t slen = *sourcelen;
+	uint8_t *d = *dest;
+	size_t dlen = *destlen;
+	parserutils_error error = PARSERUTILS_OK;
+
+	while (slen > 0) {
+		uint32_t ucs4;
+
+		if (s[0] < 0x80) {
+			/* ASCII passes through unchanged */
+			size_t n = simd_ascii_prefix(s, min(slen, dlen));
+
+			if (n == 0) {
+				error = PARSERUTILS_NOMEM;
+				break;
+			}
+
+			memcpy(d, s, n);
+
+			s += n;
+			slen -= n;
+			d += n;
+			dlen -= n;
+
+			continue;
+		}
+
+		ucs4 = charset_sbcs_to_ucs4(cs, s[0]);
+		if (ucs4 == 0xFFFF) {
+			if (c->base.errormode ==
+					PARSERUTILS_CHARSET_CODEC_ERROR_STRICT) {
+				error = PARSERUTILS_INVALID;
+				break;
+			}
+
+			ucs4 = 0xFFFD;
+		}
+
+		if (ucs4 < 0x800) {
+			if (dlen < 2) {
+				error = PARSERUTILS_NOMEM;
+				break;
+			}
+
+			d[0] = 0xC0 | (ucs4 >> 6);
+			d[1] = 0x80 | (ucs4 & 0x3F);
+			d += 2;
+			dlen -= 2;
+		} else {
+			if (dlen < 3) {
+				error = PARSERUTILS_NOMEM;
+				break;
+			}
+
+			d[0] = 0xE0 | (ucs4 >> 12);
+			d[1] = 0x80 | ((ucs4 >> 6) & 0x3F);
+			d[2] = 0x80 | (ucs4 & 0x3F);
+			d += 3;
+			dlen -= 3;
+
+			if (ucs4 == 0xFFFD)
+				(*replacements)++;
+		}
+
+		s++;
+		slen--;
+	}
+
+	*source = s;
+	*sourcelen = slen;
+	*dest = d;
+	*destlen = dlen;
+
+	return error;
+}
+
+const parserutils_charset_handler charset_sbcs_codec_handler = {
+	charset_sbcs_codec_create
+};
+
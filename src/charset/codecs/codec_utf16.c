@@ -11,8 +11,11 @@
 #include <parserutils/charset/mibenum.h>
 #include <parserutils/charset/utf16.h>
 
+#include "charset/aliases.h"
 #include "charset/codecs/codec_impl.h"
+#include "charset/encodings/utf8impl.h"
 #include "utils/endian.h"
+#include "utils/simd.h"
 #include "utils/utils.h"
 
 /**
@@ -39,11 +42,15 @@ typedef struct charset_utf16_codec {
 						 * (host-endian) */
 	size_t write_len;		/**< Character length of write_buf */
 
+	bool swap;			/**< Byte order differs from host's */
+
+	bool utf8;			/**< Decoding to UTF-8, not UCS-4 */
+	uint32_t replaced;		/**< U+FFFD decoded to UTF-8 */
+
 } charset_utf16_codec;
 
-static bool charset_utf16_codec_handles_charset(const char *charset);
-static parserutils_error charset_utf16_codec_create(
-		const char *charset, parserutils_alloc alloc, void *pw,
+static parserutils_error charset_utf16_codec_create(uint16_t mibenum,
+		parserutils_alloc alloc, void *pw,
 		parserutils_charset_codec **codec);
 static parserutils_error charset_utf16_codec_destroy(
 		parserutils_charset_codec *codec);
@@ -57,6 +64,20 @@ static parserutils_error charset_utf16_codec_decode(
 		uint8_t **dest, size_t *destlen);
 static parserutils_error charset_utf16_codec_reset(
 		parserutils_charset_codec *codec);
+static parserutils_error charset_utf16_codec_decode_utf8(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen, uint32_t *replacements);
+static inline uint32_t charset_utf16_codec_unit(charset_utf16_codec *c,
+		const uint8_t *s);
+static inline parserutils_error charset_utf16_codec_to_ucs4(
+		charset_utf16_codec *c, const uint8_t *s, size_t len,
+		uint32_t *ucs4, size_t *clen);
+static inline uint32_t charset_utf16_codec_next_valid(
+		charset_utf16_codec *c, const uint8_t *s, size_t len);
+static inline void charset_utf16_codec_decode_run(charset_utf16_codec *c,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
 static inline parserutils_error charset_utf16_codec_read_char(
 		charset_utf16_codec *c,
 		const uint8_t **source, size_t *sourcelen,
@@ -65,23 +86,13 @@ static inline parserutils_error charset_utf16_codec_output_decoded_char(
 		charset_utf16_codec *c,
 		uint32_t ucs4, uint8_t **dest, size_t *destlen);
 
-/**
- * Determine whether this codec handles a specific charset
- *
- * \param charset  Charset to test
- * \return true if handleable, false otherwise
- */
-bool charset_utf16_codec_handles_charset(const char *charset)
-{
-	return parserutils_charset_mibenum_from_name(charset, strlen(charset))
-		==
-		parserutils_charset_mibenum_from_name("UTF-16", SLEN("UTF-16"));
-}
-
 /**
  * Create a UTF-16 codec
  *
- * \param charset  The charset to read from / write to
+ * UTF-16 is taken to be in the host's byte order; UTF-16LE and UTF-16BE
+ * are handled regardless of the host.
+ *
+ * \param mibenum  MIB enum of the charset to read from / write to
  * \param alloc    Memory (de)allocation function
  * \param pw       Pointer to client-specific private data (may be NULL)
  * \param codec    Pointer to location to receive codec
@@ -89,14 +100,12 @@ bool charset_utf16_codec_handles_charset(const char *charset)
  *         PARSERUTILS_BADPARM on bad parameters,
  *         PARSERUTILS_NOMEM on memory exhausion
  */
-parserutils_error charset_utf16_codec_create(const char *charset,
+parserutils_error charset_utf16_codec_create(uint16_t mibenum,
 		parserutils_alloc alloc, void *pw,
 		parserutils_charset_codec **codec)
 {
 	charset_utf16_codec *c;
 
-	UNUSED(charset);
-
 	c = alloc(NULL, sizeof(charset_utf16_codec), pw);
 	if (c == NULL)
 		return PARSERUTILS_NOMEM;
@@ -110,11 +119,22 @@ parserutils_error charset_utf16_codec_create(const char *charset,
 	c->write_buf[0] = 0;
 	c->write_len = 0;
 
+	if (mibenum == MIB_UTF_16LE)
+		c->swap = !endian_host_is_le();
+	else if (mibenum == MIB_UTF_16BE)
+		c->swap = endian_host_is_le();
+	else
+		c->swap = false;
+
+	c->utf8 = false;
+	c->replaced = 0;
+
 	/* Finally, populate vtable */
 	c->base.handler.destroy = charset_utf16_codec_destroy;
 	c->base.handler.encode = charset_utf16_codec_encode;
 	c->base.handler.decode = charset_utf16_codec_decode;
 	c->base.handler.reset = charset_utf16_codec_reset;
+	c->base.handler.decode_utf8 = charset_utf16_codec_decode_utf8;
 
 	*codec = (parserutils_charset_codec *) c;
 
@@ -183,6 +203,9 @@ parserutils_error charset_utf16_codec_encode(parserutils_charset_codec *codec,
 			if (error != PARSERUTILS_OK)
 				abort();
 
+			if (c->swap)
+				endian_swap_16(buf, len);
+
 			if (*destlen < len) {
 				/* Insufficient output buffer space */
 				for (len = 0; len < c->write_len; len++)
@@ -203,7 +226,7 @@ parserutils_error charset_utf16_codec_encode(parserutils_charset_codec *codec,
 
 	/* Now process the characters for this call */
 	while (*sourcelen > 0) {
-		ucs4 = endian_big_to_host(*((uint32_t *) (void *) *source));
+		ucs4 = parserutils__charset_codec_read_ucs4(codec, *source);
 		towrite = &ucs4;
 		towritelen = 1;
 
@@ -217,6 +240,9 @@ parserutils_error charset_utf16_codec_encode(parserutils_charset_codec *codec,
 			if (error != PARSERUTILS_OK)
 				abort();
 
+			if (c->swap)
+				endian_swap_16(buf, len);
+
 			if (*destlen < len) {
 				/* Insufficient output space */
 				if (towritelen >= WRITE_BUFSIZE)
@@ -305,18 +331,29 @@ parserutils_error charset_utf16_codec_decode(parserutils_charset_codec *codec,
 		/* Output left over from last decode */
 		uint32_t *pread = c->read_buf;
 
-		while (c->read_len > 0 && *destlen >= c->read_len * 4) {
-			*((uint32_t *) (void *) *dest) =
-					endian_host_to_big(pread[0]);
+		while (c->read_len > 0) {
+			if (c->utf8) {
+				uint32_t ucs4 = pread[0];
+
+				UTF8_FROM_UCS4(ucs4, dest, destlen, error);
+				if (error != PARSERUTILS_OK)
+					break;
+			} else {
+				if (*destlen < 4)
+					break;
+
+				parserutils__charset_codec_write_ucs4(codec,
+						pread[0], *dest);
 
-			*dest += 4;
-			*destlen -= 4;
+				*dest += 4;
+				*destlen -= 4;
+			}
 
 			pread++;
 			c->read_len--;
 		}
 
-		if (*destlen < c->read_len * 4) {
+		if (c->read_len > 0) {
 			/* Ran out of output buffer */
 			size_t i;
 
@@ -328,7 +365,7 @@ parserutils_error charset_utf16_codec_decode(parserutils_charset_codec *codec,
 		}
 	}
 
-	if (c->inval_len > 0) {
+	while (c->inval_len > 0) {
 		/* The last decode ended in an incomplete sequence.
 		 * Fill up inval_buf with data from the start of the
 		 * new chunk and process it. */
@@ -336,6 +373,7 @@ parserutils_error charset_utf16_codec_decode(parserutils_charset_codec *codec,
 		size_t ol = c->inval_len;
 		size_t l = min(INVAL_BUFSIZE - ol - 1, *sourcelen);
 		size_t orig_l = l;
+		size_t used;
 
 		memcpy(c->inval_buf + ol, *source, l);
 
@@ -348,14 +386,27 @@ parserutils_error charset_utf16_codec_decode(parserutils_charset_codec *codec,
 		}
 
 		/* And now, fix up source pointers */
-		*source += max((signed) (orig_l - l), 0);
-		*sourcelen -= max((signed) (orig_l - l), 0);
-
-		/* Failed to resolve an incomplete character and
-		 * ran out of buffer space. No recovery strategy
-		 * possible, so explode everywhere. */
-		if ((orig_l + ol) - l == 0)
-			abort();
+		if (c->inval_len > 0) {
+			/* Still incomplete; the new data is now buffered */
+			*source += orig_l;
+			*sourcelen -= orig_l;
+
+			if (orig_l == 0)
+				break;
+		} else {
+			used = (orig_l + ol) - l;
+
+			if (used >= ol) {
+				*source += used - ol;
+				*sourcelen -= used - ol;
+			} else {
+				/* An invalid sequence was skipped, but not
+				 * all of the buffered data; keep the rest */
+				memmove(c->inval_buf, c->inval_buf + used,
+						ol - used);
+				c->inval_len = ol - used;
+			}
+		}
 
 		/* Report memory exhaustion case from above */
 		if (error != PARSERUTILS_OK)
@@ -364,6 +415,13 @@ parserutils_error charset_utf16_codec_decode(parserutils_charset_codec *codec,
 
 	/* Finally, the "normal" case; process all outstanding characters */
 	while (*sourcelen > 0) {
+		/* Decode as much well-formed input as possible in bulk */
+		charset_utf16_codec_decode_run(c, source, sourcelen,
+				dest, destlen);
+		if (*sourcelen == 0)
+			break;
+
+		/* Anything else goes through the general decoder */
 		error = charset_utf16_codec_read_char(c,
 				source, sourcelen, dest, destlen);
 		if (error != PARSERUTILS_OK) {
@@ -396,6 +454,211 @@ parserutils_error charset_utf16_codec_reset(parserutils_charset_codec *codec)
 	return PARSERUTILS_OK;
 }
 
+/**
+ * Decode a chunk of UTF-16 data into UTF-8
+ *
+ * \param codec         The codec to use
+ * \param source        Pointer to pointer to source data
+ * \param sourcelen     Pointer to length (in bytes) of source data
+ * \param dest          Pointer to pointer to output buffer
+ * \param destlen       Pointer to length (in bytes) of output buffer
+ * \param replacements  Pointer to counter of U+FFFD characters, updated
+ * \return As for charset_utf16_codec_decode
+ *
+ * This behaves exactly as charset_utf16_codec_decode, except that output
+ * is in UTF-8.
+ */
+parserutils_error charset_utf16_codec_decode_utf8(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen, uint32_t *replacements)
+{
+	charset_utf16_codec *c = (charset_utf16_codec *) codec;
+	parserutils_error error;
+
+	c->utf8 = true;
+	c->replaced = 0;
+
+	error = charset_utf16_codec_decode(codec, source, sourcelen,
+			dest, destlen);
+
+	*replacements += c->replaced;
+	c->utf8 = false;
+
+	return error;
+}
+
+/**
+ * Read a UTF-16 code unit
+ *
+ * \param c  The codec
+ * \param s  Pointer to code unit, which need not be aligned
+ * \return The code unit, in host byte order
+ */
+uint32_t charset_utf16_codec_unit(charset_utf16_codec *c, const uint8_t *s)
+{
+	uint16_t unit;
+
+	memcpy(&unit, s, sizeof(unit));
+
+	if (c->swap)
+		unit = (uint16_t) ((unit >> 8) | (unit << 8));
+
+	return unit;
+}
+
+/**
+ * Convert a UTF-16 sequence into a single UCS-4 character
+ *
+ * \param c     The codec
+ * \param s     The sequence to process
+ * \param len   Length of sequence in bytes
+ * \param ucs4  Pointer to location to receive UCS-4 character (host endian)
+ * \param clen  Pointer to location to receive byte length of sequence
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NEEDDATA if the sequence is incomplete,
+ *         PARSERUTILS_INVALID if the sequence is invalid
+ *
+ * This is parserutils_charset_utf16_to_ucs4, in the codec's byte order.
+ */
+parserutils_error charset_utf16_codec_to_ucs4(charset_utf16_codec *c,
+		const uint8_t *s, size_t len, uint32_t *ucs4, size_t *clen)
+{
+	uint32_t high, low;
+
+	if (len < 2)
+		return PARSERUTILS_NEEDDATA;
+
+	high = charset_utf16_codec_unit(c, s);
+
+	if (high < 0xD800 || high > 0xDFFF) {
+		*ucs4 = high;
+		*clen = 2;
+	} else if (high <= 0xDBFF) {
+		/* High-surrogate code unit.  */
+		if (len < 4)
+			return PARSERUTILS_NEEDDATA;
+
+		low = charset_utf16_codec_unit(c, s + 2);
+		if (low < 0xDC00 || low > 0xDFFF)
+			return PARSERUTILS_INVALID;
+
+		/* We have a valid surrogate pair.  */
+		*ucs4 = (((high & 0x3FF) << 10) | (low & 0x3FF)) + (1 << 16);
+		*clen = 4;
+	} else {
+		/* Low-surrogate code unit.  */
+		return PARSERUTILS_INVALID;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Find the next sequence which may be valid, after an invalid one
+ *
+ * \param c    The codec
+ * \param s    The invalid sequence
+ * \param len  Length of data, in bytes
+ * \return Offset of next sequence, in bytes
+ *
+ * An invalid sequence is always a single unpaired surrogate, so each is
+ * replaced by its own U+FFFD, however the input is split into chunks.
+ */
+uint32_t charset_utf16_codec_next_valid(charset_utf16_codec *c,
+		const uint8_t *s, size_t len)
+{
+	UNUSED(c);
+	UNUSED(s);
+
+	return min(2, len);
+}
+
+/**
+ * Decode a run of well-formed UTF-16
+ *
+ * \param c          The codec
+ * \param source     Pointer to pointer to source buffer (updated on exit)
+ * \param sourcelen  Pointer to length of source buffer (updated on exit)
+ * \param dest       Pointer to pointer to output buffer (updated on exit)
+ * \param destlen    Pointer to length of output buffer (updated on exit)
+ *
+ * This stops at the first invalid or incomplete sequence, or once the
+ * output buffer has no room for the next character. ASCII is narrowed to
+ * UTF-8 in blocks. The caller should resume with
+ * charset_utf16_codec_read_char, which handles all of those cases.
+ */
+void charset_utf16_codec_decode_run(charset_utf16_codec *c,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	const uint8_t *s = *source;
+	size_t slen = *sourcelen;
+	uint8_t *d = *dest;
+	size_t dlen = *destlen;
+
+	while (slen >= 2) {
+		uint32_t ucs4 = charset_utf16_codec_unit(c, s);
+		size_t n = 2;
+
+		if (ucs4 < 0x80 && c->utf8) {
+			size_t run = simd_utf16_ascii_to_utf8(s,
+					min(slen / 2, dlen), c->swap, d);
+
+			if (run == 0)
+				break;
+
+			s += run * 2;
+			slen -= run * 2;
+			d += run;
+			dlen -= run;
+
+			continue;
+		}
+
+		if (ucs4 >= 0xD800 && ucs4 <= 0xDFFF) {
+			uint32_t low;
+
+			if (ucs4 > 0xDBFF || slen < 4)
+				break;
+
+			low = charset_utf16_codec_unit(c, s + 2);
+			if (low < 0xDC00 || low > 0xDFFF)
+				break;
+
+			ucs4 = (((ucs4 & 0x3FF) << 10) | (low & 0x3FF)) +
+					(1 << 16);
+			n = 4;
+		}
+
+		if (c->utf8) {
+			uint32_t out = ucs4;
+			parserutils_error error;
+
+			UTF8_FROM_UCS4(out, &d, &dlen, error);
+			if (error != PARSERUTILS_OK)
+				break;
+
+			if (ucs4 == 0xFFFD)
+				c->replaced++;
+		} else {
+			if (dlen < 4)
+				break;
+
+			parserutils__charset_codec_write_ucs4(&c->base, ucs4, d);
+			d += 4;
+			dlen -= 4;
+		}
+
+		s += n;
+		slen -= n;
+	}
+
+	*source = s;
+	*sourcelen = slen;
+	*dest = d;
+	*destlen = dlen;
+}
 
 /**
  * Read a character from the UTF-16 to UCS-4 (big endian)
@@ -434,7 +697,7 @@ parserutils_error charset_utf16_codec_read_char(charset_utf16_codec *c,
 	parserutils_error error;
 
 	/* Convert a single character */
-	error = parserutils_charset_utf16_to_ucs4(*source, *sourcelen,
+	error = charset_utf16_codec_to_ucs4(c, *source, *sourcelen,
 			&ucs4, &sucs4);
 	if (error == PARSERUTILS_OK) {
 		/* Read a character */
@@ -478,29 +741,9 @@ parserutils_error charset_utf16_codec_read_char(charset_utf16_codec *c,
 			return PARSERUTILS_INVALID;
 		}
 
-		/* Find next valid UTF-16 sequence.
-		 * We're processing client-provided data, so let's
-		 * be paranoid about its validity. */
-		error = parserutils_charset_utf16_next_paranoid(
-				*source, *sourcelen, 0, &nextchar);
-		if (error != PARSERUTILS_OK) {
-			if (error == PARSERUTILS_NEEDDATA) {
-				/* Need more data to be sure */
-				if (*sourcelen > INVAL_BUFSIZE)
-					abort();
-
-				memmove(c->inval_buf, *source, *sourcelen);
-				c->inval_buf[*sourcelen] = '\0';
-				c->inval_len = *sourcelen;
-
-				*source += *sourcelen;
-				*sourcelen = 0;
-
-				nextchar = 0;
-			} else {
-				return error;
-			}
-		}
+		/* Skip to the next sequence which may be valid */
+		nextchar = charset_utf16_codec_next_valid(c,
+				*source, *sourcelen);
 
 		/* output U+FFFD and continue processing. */
 		error = charset_utf16_codec_output_decoded_char(c,
@@ -530,6 +773,25 @@ parserutils_error charset_utf16_codec_read_char(charset_utf16_codec *c,
 parserutils_error charset_utf16_codec_output_decoded_char(charset_utf16_codec *c,
 		uint32_t ucs4, uint8_t **dest, size_t *destlen)
 {
+	if (c->utf8) {
+		uint32_t out = ucs4;
+		parserutils_error error;
+
+		if (ucs4 == 0xFFFD)
+			c->replaced++;
+
+		UTF8_FROM_UCS4(out, dest, destlen, error);
+		if (error != PARSERUTILS_OK) {
+			/* Run out of output buffer */
+			c->read_len = 1;
+			c->read_buf[0] = ucs4;
+
+			return PARSERUTILS_NOMEM;
+		}
+
+		return PARSERUTILS_OK;
+	}
+
 	if (*destlen < 4) {
 		/* Run out of output buffer */
 		c->read_len = 1;
@@ -538,7 +800,7 @@ parserutils_error charset_utf16_codec_output_decoded_char(charset_utf16_codec *c
 		return PARSERUTILS_NOMEM;
 	}
 
-	*((uint32_t *) (void *) *dest) = endian_host_to_big(ucs4);
+	parserutils__charset_codec_write_ucs4(&c->base, ucs4, *dest);
 	*dest += 4;
 	*destlen -= 4;
 
@@ -547,6 +809,5 @@ parserutils_error charset_utf16_codec_output_decoded_char(charset_utf16_codec *c
 
 
 const parserutils_charset_handler charset_utf16_codec_handler = {
-	charset_utf16_codec_handles_charset,
 	charset_utf16_codec_create
 };
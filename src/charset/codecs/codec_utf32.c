@@ -0,0 +1,646 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2007 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <parserutils/charset/mibenum.h>
+
+#include "charset/aliases.h"
+#include "charset/codecs/codec_impl.h"
+#include "charset/encodings/utf8impl.h"
+#include "utils/endian.h"
+#include "utils/simd.h"
+#include "utils/utils.h"
+
+/**
+ * UTF-32 charset codec
+ */
+typedef struct charset_utf32_codec {
+	parserutils_charset_codec base;	/**< Base class */
+
+#define INVAL_BUFSIZE (4)
+	uint8_t inval_buf[INVAL_BUFSIZE];	/**< Buffer for fixing up
+						 * incomplete input
+						 * sequences */
+	size_t inval_len;		/*< Byte length of inval_buf **/
+
+#define READ_BUFSIZE (8)
+	uint32_t read_buf[READ_BUFSIZE];	/**< Buffer for partial
+						 * output sequences (decode)
+						 * (host-endian) */
+	size_t read_len;		/**< Character length of read_buf */
+
+	bool swap;			/**< Byte order differs from host's */
+	bool bom;			/**< Byte order is given by a BOM */
+	bool detect;			/**< BOM has yet to be looked for */
+
+	bool utf8;			/**< Decoding to UTF-8, not UCS-4 */
+	uint32_t replaced;		/**< U+FFFD decoded to UTF-8 */
+
+} charset_utf32_codec;
+
+static parserutils_error charset_utf32_codec_create(uint16_t mibenum,
+		parserutils_alloc alloc, void *pw,
+		parserutils_charset_codec **codec);
+static parserutils_error charset_utf32_codec_destroy(
+		parserutils_charset_codec *codec);
+static parserutils_error charset_utf32_codec_encode(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
+static parserutils_error charset_utf32_codec_decode(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
+static parserutils_error charset_utf32_codec_reset(
+		parserutils_charset_codec *codec);
+static parserutils_error charset_utf32_codec_decode_utf8(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen, uint32_t *replacements);
+static inline uint32_t charset_utf32_codec_unit(charset_utf32_codec *c,
+		const uint8_t *s);
+static inline bool charset_utf32_codec_valid(uint32_t ucs4);
+static inline void charset_utf32_codec_decode_run(charset_utf32_codec *c,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
+static inline parserutils_error charset_utf32_codec_read_char(
+		charset_utf32_codec *c,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
+static inline parserutils_error charset_utf32_codec_output_decoded_char(
+		charset_utf32_codec *c,
+		uint32_t ucs4, uint8_t **dest, size_t *destlen);
+
+/**
+ * Create a UTF-32 codec
+ *
+ * UTF-32LE and UTF-32BE are handled in the given byte order. UTF-32 is
+ * decoded in the order given by a leading BOM, which is consumed, or as
+ * big endian in the absence of one. It is always encoded as big endian,
+ * without a BOM.
+ *
+ * \param mibenum  MIB enum of the charset to read from / write to
+ * \param alloc    Memory (de)allocation function
+ * \param pw       Pointer to client-specific private data (may be NULL)
+ * \param codec    Pointer to location to receive codec
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhausion
+ */
+parserutils_error charset_utf32_codec_create(uint16_t mibenum,
+		parserutils_alloc alloc, void *pw,
+		parserutils_charset_codec **codec)
+{
+	charset_utf32_codec *c;
+
+	c = alloc(NULL, sizeof(charset_utf32_codec), pw);
+	if (c == NULL)
+		return PARSERUTILS_NOMEM;
+
+	c->inval_buf[0] = '\0';
+	c->inval_len = 0;
+
+	c->read_buf[0] = 0;
+	c->read_len = 0;
+
+	c->bom = false;
+
+	if (mibenum == MIB_UTF_32LE) {
+		c->swap = !endian_host_is_le();
+	} else if (mibenum == MIB_UTF_32BE) {
+		c->swap = endian_host_is_le();
+	} else {
+		c->swap = endian_host_is_le();
+		c->bom = true;
+	}
+
+	c->detect = c->bom;
+
+	c->utf8 = false;
+	c->replaced = 0;
+
+	/* Finally, populate vtable */
+	c->base.handler.destroy = charset_utf32_codec_destroy;
+	c->base.handler.encode = charset_utf32_codec_encode;
+	c->base.handler.decode = charset_utf32_codec_decode;
+	c->base.handler.reset = charset_utf32_codec_reset;
+	c->base.handler.decode_utf8 = charset_utf32_codec_decode_utf8;
+
+	*codec = (parserutils_charset_codec *) c;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Destroy a UTF-32 codec
+ *
+ * \param codec  The codec to destroy
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error charset_utf32_codec_destroy (parserutils_charset_codec *codec)
+{
+	UNUSED(codec);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Encode a chunk of UCS-4 (big endian) data into UTF-32
+ *
+ * \param codec      The codec to use
+ * \param source     Pointer to pointer to source data
+ * \param sourcelen  Pointer to length (in bytes) of source data
+ * \param dest       Pointer to pointer to output buffer
+ * \param destlen    Pointer to length (in bytes) of output buffer
+ * \return PARSERUTILS_OK          on success,
+ *         PARSERUTILS_NOMEM       if output buffer is too small,
+ *         PARSERUTILS_INVALID     if a character cannot be represented and the
+ *                            codec's error handling mode is set to STRICT,
+ *
+ * On exit, ::source will point immediately _after_ the last input character
+ * read. As each character encodes to a single code unit, nothing is ever
+ * buffered by the codec.
+ *
+ * In the case of the result being _INVALID, ::source will point _at_ the
+ * character which cannot be represented. Otherwise, such characters are
+ * encoded as U+FFFD.
+ *
+ * ::sourcelen will be reduced appropriately on exit.
+ *
+ * ::dest will point immediately _after_ the last character written.
+ *
+ * ::destlen will be reduced appropriately on exit.
+ */
+parserutils_error charset_utf32_codec_encode(parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	charset_utf32_codec *c = (charset_utf32_codec *) codec;
+	uint32_t ucs4;
+
+	while (*sourcelen >= 4) {
+		if (*destlen < 4)
+			return PARSERUTILS_NOMEM;
+
+		ucs4 = parserutils__charset_codec_read_ucs4(codec, *source);
+
+		if (charset_utf32_codec_valid(ucs4) == false) {
+			if (c->base.errormode ==
+					PARSERUTILS_CHARSET_CODEC_ERROR_STRICT)
+				return PARSERUTILS_INVALID;
+
+			ucs4 = 0xFFFD;
+		}
+
+		if (c->swap)
+			ucs4 = endian_swap(ucs4);
+
+		memcpy(*dest, &ucs4, 4);
+
+		*dest += 4;
+		*destlen -= 4;
+
+		*source += 4;
+		*sourcelen -= 4;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Decode a chunk of UTF-32 data into UCS-4 (big endian)
+ *
+ * \param codec      The codec to use
+ * \param source     Pointer to pointer to source data
+ * \param sourcelen  Pointer to length (in bytes) of source data
+ * \param dest       Pointer to pointer to output buffer
+ * \param destlen    Pointer to length (in bytes) of output buffer
+ * \return PARSERUTILS_OK          on success,
+ *         PARSERUTILS_NOMEM       if output buffer is too small,
+ *         PARSERUTILS_INVALID     if a character cannot be represented and the
+ *                            codec's error handling mode is set to STRICT,
+ *
+ * On exit, ::source will point immediately _after_ the last input character
+ * read, if the result is _OK or _NOMEM. Any remaining output for the
+ * character will be buffered by the codec for writing on the next call.
+ *
+ * In the case of the result being _INVALID, ::source will point _at_ the
+ * last input character read; nothing will be written or buffered for the
+ * failed character. It is up to the client to fix the cause of the failure
+ * and retry the decoding process.
+ *
+ * Note that, if failure occurs whilst attempting to write any output
+ * buffered by the last call, then ::source and ::sourcelen will remain
+ * unchanged (as nothing more has been read).
+ *
+ * If STRICT error handling is configured and an illegal code unit is split
+ * over two calls, then _INVALID will be returned from the second call,
+ * but ::source will point mid-way through the invalid code unit. In
+ * addition, the internal incomplete-sequence buffer will be emptied, such
+ * that subsequent calls will progress, rather than re-evaluating the same
+ * invalid code unit.
+ *
+ * Code units above U+10FFFF and surrogates are invalid.
+ *
+ * ::sourcelen will be reduced appropriately on exit.
+ *
+ * ::dest will point immediately _after_ the last character written.
+ *
+ * ::destlen will be reduced appropriately on exit.
+ *
+ * Call this with a source length of 0 to flush the output buffer.
+ */
+parserutils_error charset_utf32_codec_decode(parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	charset_utf32_codec *c = (charset_utf32_codec *) codec;
+	parserutils_error error;
+
+	if (c->read_len > 0) {
+		/* Output left over from last decode */
+		uint32_t *pread = c->read_buf;
+
+		while (c->read_len > 0) {
+			if (c->utf8) {
+				uint32_t ucs4 = pread[0];
+
+				UTF8_FROM_UCS4(ucs4, dest, destlen, error);
+				if (error != PARSERUTILS_OK)
+					break;
+			} else {
+				if (*destlen < 4)
+					break;
+
+				parserutils__charset_codec_write_ucs4(codec,
+						pread[0], *dest);
+
+				*dest += 4;
+				*destlen -= 4;
+			}
+
+			pread++;
+			c->read_len--;
+		}
+
+		if (c->read_len > 0) {
+			/* Ran out of output buffer */
+			size_t i;
+
+			/* Shuffle remaining output down */
+			for (i = 0; i < c->read_len; i++)
+				c->read_buf[i] = pread[i];
+
+			return PARSERUTILS_NOMEM;
+		}
+	}
+
+	if (c->inval_len > 0) {
+		/* The last decode ended in an incomplete code unit.
+		 * Complete it from the start of the new chunk. */
+		const uint8_t *in = c->inval_buf;
+		size_t l = min(INVAL_BUFSIZE - c->inval_len, *sourcelen);
+
+		memcpy(c->inval_buf + c->inval_len, *source, l);
+		c->inval_len += l;
+
+		*source += l;
+		*sourcelen -= l;
+
+		if (c->inval_len < INVAL_BUFSIZE)
+			return PARSERUTILS_OK;
+
+		l = INVAL_BUFSIZE;
+		c->inval_len = 0;
+
+		error = charset_utf32_codec_read_char(c, &in, &l,
+				dest, destlen);
+		if (error != PARSERUTILS_OK)
+			return error;
+	}
+
+	/* Finally, the "normal" case; process all outstanding characters */
+	while (*sourcelen > 0) {
+		/* Decode as much well-formed input as possible in bulk */
+		charset_utf32_codec_decode_run(c, source, sourcelen,
+				dest, destlen);
+		if (*sourcelen == 0)
+			break;
+
+		/* Anything else goes through the general decoder */
+		error = charset_utf32_codec_read_char(c,
+				source, sourcelen, dest, destlen);
+		if (error != PARSERUTILS_OK) {
+			return error;
+		}
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Clear a UTF-32 codec's encoding state
+ *
+ * \param codec  The codec to reset
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * A codec for UTF-32 will look for a BOM again.
+ */
+parserutils_error charset_utf32_codec_reset(parserutils_charset_codec *codec)
+{
+	charset_utf32_codec *c = (charset_utf32_codec *) codec;
+
+	c->inval_buf[0] = '\0';
+	c->inval_len = 0;
+
+	c->read_buf[0] = 0;
+	c->read_len = 0;
+
+	if (c->bom) {
+		c->swap = endian_host_is_le();
+		c->detect = true;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Decode a chunk of UTF-32 data into UTF-8
+ *
+ * \param codec         The codec to use
+ * \param source        Pointer to pointer to source data
+ * \param sourcelen     Pointer to length (in bytes) of source data
+ * \param dest          Pointer to pointer to output buffer
+ * \param destlen       Pointer to length (in bytes) of output buffer
+ * \param replacements  Pointer to counter of U+FFFD characters, updated
+ * \return As for charset_utf32_codec_decode
+ *
+ * This behaves exactly as charset_utf32_codec_decode, except that output
+ * is in UTF-8.
+ */
+parserutils_error charset_utf32_codec_decode_utf8(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen, uint32_t *replacements)
+{
+	charset_utf32_codec *c = (charset_utf32_codec *) codec;
+	parserutils_error error;
+
+	c->utf8 = true;
+	c->replaced = 0;
+
+	error = charset_utf32_codec_decode(codec, source, sourcelen,
+			dest, destlen);
+
+	*replacements += c->replaced;
+	c->utf8 = false;
+
+	return error;
+}
+
+/**
+ * Read a UTF-32 code unit
+ *
+ * \param c  The codec
+ * \param s  Pointer to code unit, which need not be aligned
+ * \return The code unit, in host byte order
+ */
+uint32_t charset_utf32_codec_unit(charset_utf32_codec *c, const uint8_t *s)
+{
+	uint32_t unit;
+
+	memcpy(&unit, s, sizeof(unit));
+
+	return c->swap ? endian_swap(unit) : unit;
+}
+
+/**
+ * Determine whether a UTF-32 code unit is a Unicode scalar value
+ *
+ * \param ucs4  The code unit, in host byte order
+ * \return true if valid, false otherwise
+ */
+bool charset_utf32_codec_valid(uint32_t ucs4)
+{
+	return ucs4 <= 0x10FFFF && (ucs4 < 0xD800 || ucs4 > 0xDFFF);
+}
+
+/**
+ * Decode a run of well-formed UTF-32
+ *
+ * \param c          The codec
+ * \param source     Pointer to pointer to source buffer (updated on exit)
+ * \param sourcelen  Pointer to length of source buffer (updated on exit)
+ * \param dest       Pointer to pointer to output buffer (updated on exit)
+ * \param destlen    Pointer to length of output buffer (updated on exit)
+ *
+ * This stops at the first invalid or incomplete code unit, or once the
+ * output buffer has no room for the next character. ASCII is narrowed to
+ * UTF-8 in blocks. The caller should resume with
+ * charset_utf32_codec_read_char, which handles all of those cases, along
+ * with any BOM.
+ */
+void charset_utf32_codec_decode_run(charset_utf32_codec *c,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	const uint8_t *s = *source;
+	size_t slen = *sourcelen;
+	uint8_t *d = *dest;
+	size_t dlen = *destlen;
+
+	if (c->detect)
+		return;
+
+	while (slen >= 4) {
+		uint32_t ucs4 = charset_utf32_codec_unit(c, s);
+
+		if (ucs4 < 0x80 && c->utf8) {
+			size_t run = simd_utf32_ascii_to_utf8(s,
+					min(slen / 4, dlen), c->swap, d);
+
+			if (run == 0)
+				break;
+
+			s += run * 4;
+			slen -= run * 4;
+			d += run;
+			dlen -= run;
+
+			continue;
+		}
+
+		if (charset_utf32_codec_valid(ucs4) == false)
+			break;
+
+		if (c->utf8) {
+			uint32_t out = ucs4;
+			parserutils_error error;
+
+			UTF8_FROM_UCS4(out, &d, &dlen, error);
+			if (error != PARSERUTILS_OK)
+				break;
+
+			if (ucs4 == 0xFFFD)
+				c->replaced++;
+		} else {
+			if (dlen < 4)
+				break;
+
+			parserutils__charset_codec_write_ucs4(&c->base, ucs4, d);
+			d += 4;
+			dlen -= 4;
+		}
+
+		s += 4;
+		slen -= 4;
+	}
+
+	*source = s;
+	*sourcelen = slen;
+	*dest = d;
+	*destlen = dlen;
+}
+
+/**
+ * Read a character from the UTF-32 to UCS-4 (big endian)
+ *
+ * \param c          The codec
+ * \param source     Pointer to pointer to source buffer (updated on exit)
+ * \param sourcelen  Pointer to length of source buffer (updated on exit)
+ * \param dest       Pointer to pointer to output buffer (updated on exit)
+ * \param destlen    Pointer to length of output buffer (updated on exit)
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM       if output buffer is too small,
+ *         PARSERUTILS_INVALID     if a character cannot be represented and the
+ *                            codec's error handling mode is set to STRICT,
+ *
+ * On exit, ::source will point immediately _after_ the last input character
+ * read, if the result is _OK or _NOMEM. Any remaining output for the
+ * character will be buffered by the codec for writing on the next call.
+ *
+ * In the case of the result being _INVALID, ::source will point _at_ the
+ * last input character read; nothing will be written or buffered for the
+ * failed character. It is up to the client to fix the cause of the failure
+ * and retry the decoding process.
+ *
+ * ::sourcelen will be reduced appropriately on exit.
+ *
+ * ::dest will point immediately _after_ the last character written.
+ *
+ * ::destlen will be reduced appropriately on exit.
+ */
+parserutils_error charset_utf32_codec_read_char(charset_utf32_codec *c,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	uint32_t ucs4;
+	parserutils_error error;
+
+	if (*sourcelen < 4) {
+		/* Incomplete code unit */
+		memcpy(c->inval_buf, *source, *sourcelen);
+		c->inval_len = *sourcelen;
+
+		*source += *sourcelen;
+		*sourcelen = 0;
+
+		return PARSERUTILS_OK;
+	}
+
+	ucs4 = charset_utf32_codec_unit(c, *source);
+
+	if (c->detect) {
+		c->detect = false;
+
+		/* A BOM selects the byte order, and is not output */
+		if (ucs4 == 0xFEFF || ucs4 == 0xFFFE0000) {
+			if (ucs4 == 0xFFFE0000)
+				c->swap = !c->swap;
+
+			*source += 4;
+			*sourcelen -= 4;
+
+			return PARSERUTILS_OK;
+		}
+	}
+
+	if (charset_utf32_codec_valid(ucs4) == false) {
+		/* Strict errormode; simply flag invalid character */
+		if (c->base.errormode ==
+				PARSERUTILS_CHARSET_CODEC_ERROR_STRICT) {
+			return PARSERUTILS_INVALID;
+		}
+
+		/* output U+FFFD and continue processing. */
+		ucs4 = 0xFFFD;
+	}
+
+	error = charset_utf32_codec_output_decoded_char(c,
+			ucs4, dest, destlen);
+	if (error == PARSERUTILS_OK || error == PARSERUTILS_NOMEM) {
+		/* output succeeded; update source pointers */
+		*source += 4;
+		*sourcelen -= 4;
+	}
+
+	return error;
+}
+
+/**
+ * Output a UCS-4 character (big endian)
+ *
+ * \param c        Codec to use
+ * \param ucs4     UCS-4 character (host endian)
+ * \param dest     Pointer to pointer to output buffer
+ * \param destlen  Pointer to output buffer length
+ * \return PARSERUTILS_OK          on success,
+ *         PARSERUTILS_NOMEM       if output buffer is too small,
+ */
+parserutils_error charset_utf32_codec_output_decoded_char(charset_utf32_codec *c,
+		uint32_t ucs4, uint8_t **dest, size_t *destlen)
+{
+	if (c->utf8) {
+		uint32_t out = ucs4;
+		parserutils_error error;
+
+		if (ucs4 == 0xFFFD)
+			c->replaced++;
+
+		UTF8_FROM_UCS4(out, dest, destlen, error);
+		if (error != PARSERUTILS_OK) {
+			/* Run out of output buffer */
+			c->read_len = 1;
+			c->read_buf[0] = ucs4;
+
+			return PARSERUTILS_NOMEM;
+		}
+
+		return PARSERUTILS_OK;
+	}
+
+	if (*destlen < 4) {
+		/* Run out of output buffer */
+		c->read_len = 1;
+		c->read_buf[0] = ucs4;
+
+		return PARSERUTILS_NOMEM;
+	}
+
+	parserutils__charset_codec_write_ucs4(&c->base, ucs4, *dest);
+	*dest += 4;
+	*destlen -= 4;
+
+	return PARSERUTILS_OK;
+}
+
+
+const parserutils_charset_handler charset_utf32_codec_handler = {
+	charset_utf32_codec_create
+};
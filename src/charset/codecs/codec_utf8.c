@@ -13,6 +13,7 @@
 #include "charset/codecs/codec_impl.h"
 #include "charset/encodings/utf8impl.h"
 #include "utils/endian.h"
+#include "utils/simd.h"
 #include "utils/utils.h"
 
 /**
@@ -41,8 +42,7 @@ typedef struct charset_utf8_codec {
 
 } charset_utf8_codec;
 
-static bool charset_utf8_codec_handles_charset(const char *charset);
-static parserutils_error charset_utf8_codec_create(const char *charset,
+static parserutils_error charset_utf8_codec_create(uint16_t mibenum,
 		parserutils_alloc alloc, void *pw,
 		parserutils_charset_codec **codec);
 static parserutils_error charset_utf8_codec_destroy(
@@ -57,6 +57,10 @@ static parserutils_error charset_utf8_codec_decode(
 		uint8_t **dest, size_t *destlen);
 static parserutils_error charset_utf8_codec_reset(
 		parserutils_charset_codec *codec);
+static inline void charset_utf8_codec_decode_run(
+		const parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
 static inline parserutils_error charset_utf8_codec_read_char(
 		charset_utf8_codec *c,
 		const uint8_t **source, size_t *sourcelen,
@@ -65,24 +69,10 @@ static inline parserutils_error charset_utf8_codec_output_decoded_char(
 		charset_utf8_codec *c,
 		uint32_t ucs4, uint8_t **dest, size_t *destlen);
 
-/**
- * Determine whether this codec handles a specific charset
- *
- * \param charset  Charset to test
- * \return true if handleable, false otherwise
- */
-bool charset_utf8_codec_handles_charset(const char *charset)
-{
-	return parserutils_charset_mibenum_from_name(charset,
-				strlen(charset)) ==
-			parserutils_charset_mibenum_from_name("UTF-8",
-				SLEN("UTF-8"));
-}
-
 /**
  * Create a UTF-8 codec
  *
- * \param charset  The charset to read from / write to
+ * \param mibenum  MIB enum of the charset to read from / write to
  * \param alloc    Memory (de)allocation function
  * \param pw       Pointer to client-specific private data (may be NULL)
  * \param codec    Pointer to location to receive codec
@@ -90,13 +80,13 @@ bool charset_utf8_codec_handles_charset(const char *charset)
  *         PARSERUTILS_BADPARM on bad parameters,
  *         PARSERUTILS_NOMEM on memory exhausion
  */
-parserutils_error charset_utf8_codec_create(const char *charset,
+parserutils_error charset_utf8_codec_create(uint16_t mibenum,
 		parserutils_alloc alloc, void *pw,
 		parserutils_charset_codec **codec)
 {
 	charset_utf8_codec *c;
 
-	UNUSED(charset);
+	UNUSED(mibenum);
 
 	c = alloc(NULL, sizeof(charset_utf8_codec), pw);
 	if (c == NULL)
@@ -116,6 +106,7 @@ parserutils_error charset_utf8_codec_create(const char *charset,
 	c->base.handler.encode = charset_utf8_codec_encode;
 	c->base.handler.decode = charset_utf8_codec_decode;
 	c->base.handler.reset = charset_utf8_codec_reset;
+	c->base.handler.decode_utf8 = NULL;
 
 	*codec = (parserutils_charset_codec *) c;
 
@@ -198,7 +189,7 @@ parserutils_error charset_utf8_codec_encode(parserutils_charset_codec *codec,
 
 	/* Now process the characters for this call */
 	while (*sourcelen > 0) {
-		ucs4 = endian_big_to_host(*((uint32_t *) (void *) *source));
+		ucs4 = parserutils__charset_codec_read_ucs4(codec, *source);
 		towrite = &ucs4;
 		towritelen = 1;
 
@@ -293,8 +284,8 @@ parserutils_error charset_utf8_codec_decode(parserutils_charset_codec *codec,
 		uint32_t *pread = c->read_buf;
 
 		while (c->read_len > 0 && *destlen >= c->read_len * 4) {
-			*((uint32_t *) (void *) *dest) =
-					endian_host_to_big(pread[0]);
+			parserutils__charset_codec_write_ucs4(codec,
+					pread[0], *dest);
 
 			*dest += 4;
 			*destlen -= 4;
@@ -351,6 +342,13 @@ parserutils_error charset_utf8_codec_decode(parserutils_charset_codec *codec,
 
 	/* Finally, the "normal" case; process all outstanding characters */
 	while (*sourcelen > 0) {
+		/* Decode as much well-formed input as possible in bulk */
+		charset_utf8_codec_decode_run(codec, source, sourcelen,
+				dest, destlen);
+		if (*sourcelen == 0)
+			break;
+
+		/* Anything else goes through the general decoder */
 		error = charset_utf8_codec_read_char(c,
 				source, sourcelen, dest, destlen);
 		if (error != PARSERUTILS_OK) {
@@ -383,6 +381,85 @@ parserutils_error charset_utf8_codec_reset(parserutils_charset_codec *codec)
 	return PARSERUTILS_OK;
 }
 
+/**
+ * Decode a run of well-formed UTF-8 to UCS-4
+ *
+ * \param codec      The codec, which determines the UCS-4 byte order
+ * \param source     Pointer to pointer to source buffer (updated on exit)
+ * \param sourcelen  Pointer to length of source buffer (updated on exit)
+ * \param dest       Pointer to pointer to output buffer (updated on exit)
+ * \param destlen    Pointer to length of output buffer (updated on exit)
+ *
+ * Blocks of ASCII are widened in bulk, and valid 2 and 3 byte sequences
+ * are decoded directly. This stops at the first sequence which is longer,
+ * invalid or truncated, or when the output buffer has no room for another
+ * character. The caller should resume with charset_utf8_codec_read_char,
+ * which handles all of those cases.
+ */
+void charset_utf8_codec_decode_run(const parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	const uint8_t *s = *source;
+	size_t slen = *sourcelen;
+	uint8_t *d = *dest;
+	size_t dlen = *destlen;
+	bool le = parserutils__charset_codec_ucs4_is_le(codec);
+
+	while (slen > 0 && dlen >= 4) {
+		uint32_t c = s[0];
+		size_t n;
+
+		if (c < 0x80) {
+			n = simd_ascii_prefix(s, min(slen, dlen / 4));
+
+			simd_ascii_to_ucs4(s, n, le, d);
+
+			s += n;
+			slen -= n;
+			d += n * 4;
+			dlen -= n * 4;
+
+			continue;
+		}
+
+		if (c >= 0xC2 && c <= 0xDF) {
+			if (slen < 2 || (s[1] & 0xC0) != 0x80)
+				break;
+
+			c = ((c & 0x1F) << 6) | (s[1] & 0x3F);
+			n = 2;
+		} else if ((c & 0xF0) == 0xE0) {
+			if (slen < 3 || (s[1] & 0xC0) != 0x80 ||
+					(s[2] & 0xC0) != 0x80)
+				break;
+
+			c = ((c & 0x0F) << 12) | ((s[1] & 0x3F) << 6) |
+					(s[2] & 0x3F);
+
+			/* Overlong sequences, surrogates and fffe/ffff */
+			if (c < 0x800 || (c >= 0xD800 && c <= 0xDFFF) ||
+					c == 0xFFFE || c == 0xFFFF)
+				break;
+
+			n = 3;
+		} else {
+			break;
+		}
+
+		parserutils__charset_codec_write_ucs4(codec, c, d);
+
+		s += n;
+		slen -= n;
+		d += 4;
+		dlen -= 4;
+	}
+
+	*source = s;
+	*sourcelen = slen;
+	*dest = d;
+	*destlen = dlen;
+}
 
 /**
  * Read a character from the UTF-8 to UCS-4 (big endian)
@@ -540,7 +617,7 @@ parserutils_error charset_utf8_codec_output_decoded_char(charset_utf8_codec *c,
 		return PARSERUTILS_NOMEM;
 	}
 
-	*((uint32_t *) (void *) *dest) = endian_host_to_big(ucs4);
+	parserutils__charset_codec_write_ucs4(&c->base, ucs4, *dest);
 	*dest += 4;
 	*destlen -= 4;
 
@@ -549,7 +626,6 @@ parserutils_error charset_utf8_codec_output_decoded_char(charset_utf8_codec *c,
 
 
 const parserutils_charset_handler charset_utf8_codec_handler = {
-	charset_utf8_codec_handles_charset,
 	charset_utf8_codec_create
 };
 
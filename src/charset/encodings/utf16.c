@@ -79,7 +79,8 @@ parserutils_error parserutils_charset_utf16_from_ucs4(uint32_t ucs4, uint8_t *s,
 		*ss = (uint16_t) ucs4;
 		l = 2;
 	} else if (ucs4 < 0x110000) {
-		ss[0] = 0xD800 | (((ucs4 >> 16) & 0x1f) - 1) | (ucs4 >> 10);
+		ss[0] = 0xD800 | ((((ucs4 >> 16) & 0x1f) - 1) << 6) |
+				((ucs4 >> 10) & 0x3f);
 		ss[1] = 0xDC00 | (ucs4 & 0x3ff);
 		l = 4;
 	} else {
@@ -214,11 +215,13 @@ parserutils_error parserutils_charset_utf16_next(const uint8_t *s, uint32_t len,
 parserutils_error parserutils_charset_utf16_next_paranoid(const uint8_t *s,
 		uint32_t len, uint32_t off, uint32_t *nextoff)
 {
-	const uint16_t *ss = (const uint16_t *) (const void *) s;
+	const uint16_t *ss;
 
 	if (s == NULL || off >= len || nextoff == NULL)
 		return PARSERUTILS_BADPARM;
 
+	ss = (const uint16_t *) (const void *) (s + off);
+
 	while (1) {
 		if (len - off < 4) {
 			return PARSERUTILS_NEEDDATA;
@@ -230,13 +233,15 @@ parserutils_error parserutils_charset_utf16_next_paranoid(const uint8_t *s,
 				return PARSERUTILS_NEEDDATA;
 
 			if (ss[2] >= 0xDC00 && ss[2] <= 0xDFFF) {
-				*nextoff = off + 4;
+				/* The pair starts immediately after off */
+				*nextoff = off + 2;
 				break;
-			} else {
-				ss++;
-				off += 2;
 			}
 		}
+
+		/* Unpaired surrogate; skip it */
+		ss++;
+		off += 2;
 	}
 
 	return PARSERUTILS_OK;
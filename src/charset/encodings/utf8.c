@@ -15,6 +15,7 @@
 
 #include <parserutils/charset/utf8.h>
 #include "charset/encodings/utf8impl.h"
+#include "utils/simd.h"
 
 /** Number of continuation bytes for a given start byte */
 const uint8_t numContinuations[256] = {
@@ -97,6 +98,76 @@ parserutils_error parserutils_charset_utf8_length(const uint8_t *s, size_t max,
 	return error;
 }
 
+/**
+ * Count the characters, and UTF-16 code units, in a UTF-8 string
+ *
+ * \param s      The string (assumed valid)
+ * \param len    Length of string, in bytes
+ * \param chars  Pointer to location to receive number of characters
+ * \param units  Pointer to location to receive number of UTF-16 code units
+ *               needed to represent the string
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * Unlike ::parserutils_charset_utf8_length, the string is not checked, so
+ * may be counted a block at a time. Each byte which isn't a continuation
+ * byte starts a character, and characters of four bytes need two code
+ * units in UTF-16.
+ */
+parserutils_error parserutils_charset_utf8_count(const uint8_t *s, size_t len,
+		size_t *chars, size_t *units)
+{
+	size_t lines, cont, four;
+
+	if ((s == NULL && len != 0) || chars == NULL || units == NULL)
+		return PARSERUTILS_BADPARM;
+
+	simd_utf8_counts(s, len, &lines, &cont, &four);
+
+	*chars = len - cont;
+	*units = len - cont + four;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Find the character a number of characters into a UTF-8 string
+ *
+ * \param s    The string (assumed valid)
+ * \param len  Length of string, in bytes
+ * \param n    Number of characters to skip
+ * \param off  Pointer to location to receive offset of first byte of the
+ *             character after those skipped
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_EOF if the string has fewer than n characters, in
+ *                         which case off receives len
+ */
+parserutils_error parserutils_charset_utf8_advance(const uint8_t *s,
+		size_t len, size_t n, size_t *off)
+{
+	size_t o;
+
+	if ((s == NULL && len != 0) || off == NULL)
+		return PARSERUTILS_BADPARM;
+
+	o = simd_utf8_skip(s, len, &n);
+
+	/* Finish the character any skipped blocks ended within, then
+	 * count the rest a byte at a time */
+	for (; o < len; o++) {
+		if ((s[o] & 0xC0) == 0x80)
+			continue;
+
+		if (n == 0)
+			break;
+		n--;
+	}
+
+	*off = o;
+
+	return (n == 0) ? PARSERUTILS_OK : PARSERUTILS_EOF;
+}
+
 /**
  * Calculate the length (in bytes) of a UTF-8 character
  *
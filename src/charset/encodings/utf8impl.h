@@ -16,6 +16,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "utils/simd.h"
+
 /** Number of continuation bytes for a given start byte */
 extern const uint8_t numContinuations[256];
 
@@ -182,7 +184,7 @@ do {									\
 #define UTF8_LENGTH(s, max, len, error)					\
 do {									\
 	const uint8_t *end = s + max;					\
-	int l = 0;							\
+	size_t l = 0;							\
 									\
 	error = PARSERUTILS_OK;						\
 									\
@@ -194,9 +196,14 @@ do {									\
 	while (s < end) {						\
 		uint32_t c = s[0];					\
 									\
-		if ((c & 0x80) == 0x00)					\
-			s += 1;						\
-		else if ((c & 0xE0) == 0xC0)				\
+		if ((c & 0x80) == 0x00) {				\
+			/* Skip the whole run of ASCII */		\
+			size_t ascii = simd_ascii_prefix(s, end - s);	\
+									\
+			s += ascii;					\
+			l += ascii;					\
+			continue;					\
+		} else if ((c & 0xE0) == 0xC0)				\
 			s += 2;						\
 		else if ((c & 0xF0) == 0xE0)				\
 			s += 3;						\
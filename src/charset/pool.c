@@ -0,0 +1,242 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <parserutils/charset/mibenum.h>
+
+#include "charset/pool.h"
+#include "charset/codecs/codec_impl.h"
+#include "utils/utils.h"
+
+/**
+ * Charset converter pool
+ *
+ * Each list is ordered from least to most recently returned. When a list
+ * is full, its least recently returned entry is discarded.
+ */
+struct parserutils_charset_pool {
+#define POOL_SIZE (8)
+	parserutils_charset_codec *codecs[POOL_SIZE];	/**< Idle codecs */
+	uint32_t n_codecs;		/**< Number of idle codecs */
+
+#ifndef WITHOUT_ICONV_FILTER
+	struct {
+		iconv_t cd;		/**< Idle descriptor */
+		uint16_t to;		/**< MIB enum of target charset */
+		uint16_t from;		/**< MIB enum of source charset */
+	} iconvs[POOL_SIZE];		/**< Idle iconv descriptors */
+	uint32_t n_iconvs;		/**< Number of idle descriptors */
+#endif
+
+	parserutils_alloc alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client private data */
+};
+
+/**
+ * Create a charset converter pool
+ *
+ * \param alloc  Memory (de)allocation function
+ * \param pw     Pointer to client-specific private data (may be NULL)
+ * \param pool   Pointer to location to receive pool
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ *
+ * Codecs created for the pool use the pool's allocation function, rather
+ * than that of the stream which first needs them.
+ */
+parserutils_error parserutils_charset_pool_create(parserutils_alloc alloc,
+		void *pw, parserutils_charset_pool **pool)
+{
+	parserutils_charset_pool *p;
+
+	if (alloc == NULL || pool == NULL)
+		return PARSERUTILS_BADPARM;
+
+	p = alloc(NULL, sizeof(parserutils_charset_pool), pw);
+	if (p == NULL)
+		return PARSERUTILS_NOMEM;
+
+	p->n_codecs = 0;
+#ifndef WITHOUT_ICONV_FILTER
+	p->n_iconvs = 0;
+#endif
+
+	p->alloc = alloc;
+	p->pw = pw;
+
+	*pool = p;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Destroy a charset converter pool
+ *
+ * \param pool  The pool to destroy
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * All streams using the pool must have been destroyed.
+ */
+parserutils_error parserutils_charset_pool_destroy(
+		parserutils_charset_pool *pool)
+{
+	uint32_t i;
+
+	if (pool == NULL)
+		return PARSERUTILS_BADPARM;
+
+	for (i = 0; i < pool->n_codecs; i++)
+		parserutils_charset_codec_destroy(pool->codecs[i]);
+
+#ifndef WITHOUT_ICONV_FILTER
+	for (i = 0; i < pool->n_iconvs; i++)
+		iconv_close(pool->iconvs[i].cd);
+#endif
+
+	pool->alloc(pool, 0, pool->pw);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Take a codec for a charset from a pool, creating it if necessary
+ *
+ * \param pool     The pool to use
+ * \param mibenum  MIB enum of the charset
+ * \param codec    Pointer to location to receive codec
+ * \return As for parserutils_charset_codec_create_mib
+ *
+ * The codec is in its initial state, with the default options.
+ */
+parserutils_error parserutils__charset_pool_get_codec(
+		parserutils_charset_pool *pool, uint16_t mibenum,
+		parserutils_charset_codec **codec)
+{
+	uint32_t i;
+
+	/* Prefer the most recently returned */
+	for (i = pool->n_codecs; i > 0; i--) {
+		if (pool->codecs[i - 1]->mibenum == mibenum) {
+			*codec = pool->codecs[i - 1];
+
+			memmove(&pool->codecs[i - 1], &pool->codecs[i],
+					(pool->n_codecs - i) *
+					sizeof(pool->codecs[0]));
+			pool->n_codecs--;
+
+			return PARSERUTILS_OK;
+		}
+	}
+
+	return parserutils_charset_codec_create_mib(mibenum, pool->alloc,
+			pool->pw, codec);
+}
+
+/**
+ * Return a codec to a pool
+ *
+ * \param pool   The pool to return the codec to
+ * \param codec  The codec, which must have been taken from the pool
+ *
+ * The codec is reset and its options restored to their defaults.
+ */
+void parserutils__charset_pool_put_codec(parserutils_charset_pool *pool,
+		parserutils_charset_codec *codec)
+{
+	parserutils_charset_codec_reset(codec);
+
+	codec->errormode = PARSERUTILS_CHARSET_CODEC_ERROR_LOOSE;
+	codec->host_endian = false;
+
+	if (pool->n_codecs == POOL_SIZE) {
+		parserutils_charset_codec_destroy(pool->codecs[0]);
+
+		memmove(&pool->codecs[0], &pool->codecs[1],
+				(POOL_SIZE - 1) * sizeof(pool->codecs[0]));
+		pool->n_codecs--;
+	}
+
+	pool->codecs[pool->n_codecs++] = codec;
+}
+
+#ifndef WITHOUT_ICONV_FILTER
+/**
+ * Take an iconv descriptor from a pool, opening it if necessary
+ *
+ * \param pool  The pool to use
+ * \param to    MIB enum of the charset to convert to
+ * \param from  MIB enum of the charset to convert from
+ * \param cd    Pointer to location to receive descriptor
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADENCODING if the conversion is unsupported,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ *
+ * The descriptor is in its initial shift state.
+ */
+parserutils_error parserutils__charset_pool_get_iconv(
+		parserutils_charset_pool *pool, uint16_t to, uint16_t from,
+		iconv_t *cd)
+{
+	uint32_t i;
+
+	/* Prefer the most recently returned */
+	for (i = pool->n_iconvs; i > 0; i--) {
+		if (pool->iconvs[i - 1].to == to &&
+				pool->iconvs[i - 1].from == from) {
+			*cd = pool->iconvs[i - 1].cd;
+
+			memmove(&pool->iconvs[i - 1], &pool->iconvs[i],
+					(pool->n_iconvs - i) *
+					sizeof(pool->iconvs[0]));
+			pool->n_iconvs--;
+
+			return PARSERUTILS_OK;
+		}
+	}
+
+	*cd = iconv_open(parserutils_charset_mibenum_to_name(to),
+			parserutils_charset_mibenum_to_name(from));
+	if (*cd == (iconv_t) -1) {
+		return (errno == EINVAL) ? PARSERUTILS_BADENCODING
+					 : PARSERUTILS_NOMEM;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Return an iconv descriptor to a pool
+ *
+ * \param pool  The pool to return the descriptor to
+ * \param to    MIB enum of the charset the descriptor converts to
+ * \param from  MIB enum of the charset the descriptor converts from
+ * \param cd    The descriptor
+ */
+void parserutils__charset_pool_put_iconv(parserutils_charset_pool *pool,
+		uint16_t to, uint16_t from, iconv_t cd)
+{
+	/* Return to the initial shift state */
+	iconv(cd, NULL, 0, NULL, 0);
+
+	if (pool->n_iconvs == POOL_SIZE) {
+		iconv_close(pool->iconvs[0].cd);
+
+		memmove(&pool->iconvs[0], &pool->iconvs[1],
+				(POOL_SIZE - 1) * sizeof(pool->iconvs[0]));
+		pool->n_iconvs--;
+	}
+
+	pool->iconvs[pool->n_iconvs].cd = cd;
+	pool->iconvs[pool->n_iconvs].to = to;
+	pool->iconvs[pool->n_iconvs].from = from;
+	pool->n_iconvs++;
+}
+#endif
+
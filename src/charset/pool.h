@@ -0,0 +1,39 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_charset_pool_impl_h_
+#define parserutils_charset_pool_impl_h_
+
+#include <inttypes.h>
+
+#ifndef WITHOUT_ICONV_FILTER
+#include <iconv.h>
+#endif
+
+#include <parserutils/charset/codec.h>
+#include <parserutils/charset/pool.h>
+
+/* Take a codec for a charset from a pool, creating it if necessary */
+parserutils_error parserutils__charset_pool_get_codec(
+		parserutils_charset_pool *pool, uint16_t mibenum,
+		parserutils_charset_codec **codec);
+/* Return a codec to a pool */
+void parserutils__charset_pool_put_codec(parserutils_charset_pool *pool,
+		parserutils_charset_codec *codec);
+
+#ifndef WITHOUT_ICONV_FILTER
+/* Take an iconv descriptor from a pool, opening it if necessary */
+parserutils_error parserutils__charset_pool_get_iconv(
+		parserutils_charset_pool *pool, uint16_t to, uint16_t from,
+		iconv_t *cd);
+/* Return an iconv descriptor to a pool */
+void parserutils__charset_pool_put_iconv(parserutils_charset_pool *pool,
+		uint16_t to, uint16_t from, iconv_t cd);
+#endif
+
+#endif
+
@@ -0,0 +1,486 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <parserutils/charset/sniff.h>
+
+#include "charset/bom.h"
+#include "charset/codecs/codec_impl.h"
+#include "charset/encodings/utf8impl.h"
+#include "utils/simd.h"
+#include "utils/utils.h"
+
+/**
+ * Class of a character, as used when scoring single-byte charsets
+ */
+typedef enum sniff_class {
+	SNIFF_OTHER,			/**< Not a letter */
+	SNIFF_LOWER,			/**< Lower case letter */
+	SNIFF_UPPER,			/**< Upper case letter */
+	SNIFF_CASELESS			/**< Letter of a caseless script */
+} sniff_class;
+
+/**
+ * Script of a letter
+ */
+typedef enum sniff_script {
+	SNIFF_LATIN,
+	SNIFF_GREEK,
+	SNIFF_CYRILLIC,
+	SNIFF_HEBREW,
+	SNIFF_ARABIC
+} sniff_script;
+
+/* Commonly used non-ASCII letters of each candidate's languages, sorted */
+static const uint16_t frequent_western[] = {
+	0x00DF, 0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6,
+	0x00E7, 0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE,
+	0x00EF, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F8,
+	0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x0153
+};
+static const uint16_t frequent_central[] = {
+	0x00E1, 0x00E2, 0x00E4, 0x00E9, 0x00ED, 0x00EE, 0x00F3, 0x00F4,
+	0x00F6, 0x00FA, 0x00FC, 0x00FD, 0x0103, 0x0105, 0x0107, 0x010D,
+	0x010F, 0x0119, 0x011B, 0x013E, 0x0142, 0x0144, 0x0148, 0x0151,
+	0x0159, 0x015B, 0x015F, 0x0161, 0x0163, 0x0165, 0x016F, 0x0171,
+	0x017A, 0x017C, 0x017E
+};
+static const uint16_t frequent_cyrillic[] = {
+	0x0430, 0x0432, 0x0435, 0x0438, 0x043B, 0x043D, 0x043E, 0x0440,
+	0x0441, 0x0442, 0x0456
+};
+static const uint16_t frequent_greek[] = {
+	0x03AC, 0x03AD, 0x03AE, 0x03AF, 0x03B1, 0x03B5, 0x03B7, 0x03B9,
+	0x03BA, 0x03BD, 0x03BF, 0x03C1, 0x03C3, 0x03C4, 0x03CC
+};
+static const uint16_t frequent_turkish[] = {
+	0x00E2, 0x00E7, 0x00EE, 0x00F6, 0x00FB, 0x00FC, 0x011F, 0x0131,
+	0x015F
+};
+static const uint16_t frequent_hebrew[] = {
+	0x05D0, 0x05D1, 0x05D4, 0x05D5, 0x05D9, 0x05DC, 0x05DE, 0x05E8,
+	0x05E9, 0x05EA
+};
+static const uint16_t frequent_arabic[] = {
+	0x0627, 0x0628, 0x062A, 0x0631, 0x0644, 0x0645, 0x0646, 0x0647,
+	0x0648, 0x064A, 0x06CC
+};
+static const uint16_t frequent_baltic[] = {
+	0x00E4, 0x00F5, 0x00F6, 0x00FC, 0x0101, 0x0105, 0x010D, 0x0113,
+	0x0117, 0x0119, 0x0123, 0x012B, 0x012F, 0x0137, 0x013C, 0x0146,
+	0x0161, 0x016B, 0x0173, 0x017E
+};
+static const uint16_t frequent_vietnamese[] = {
+	0x00E0, 0x00E1, 0x00E2, 0x00E8, 0x00E9, 0x00EA, 0x00ED, 0x00F3,
+	0x00F4, 0x00FA, 0x0103, 0x0111, 0x01A1, 0x01B0
+};
+
+#define FREQUENT(l) frequent_##l, N_ELEMENTS(frequent_##l)
+
+/* Single-byte charsets considered, in order of preference */
+static const struct {
+	uint16_t mib;
+	bool latin;			/**< Latin script, in which accented
+					 * letters are rarely adjacent */
+	const uint16_t *frequent;	/**< Commonly used letters */
+	size_t n_frequent;		/**< Number of commonly used letters */
+} candidates[] = {
+	{ 2252, true, FREQUENT(western) },	/* windows-1252 */
+	{ 2250, true, FREQUENT(central) },	/* windows-1250 */
+	{ 2251, false, FREQUENT(cyrillic) },	/* windows-1251 */
+	{ 2253, false, FREQUENT(greek) },	/* windows-1253 */
+	{ 2254, true, FREQUENT(turkish) },	/* windows-1254 */
+	{ 2255, false, FREQUENT(hebrew) },	/* windows-1255 */
+	{ 2256, false, FREQUENT(arabic) },	/* windows-1256 */
+	{ 2257, true, FREQUENT(baltic) },	/* windows-1257 */
+	{ 2258, true, FREQUENT(vietnamese) },	/* windows-1258 */
+	{ 5, true, FREQUENT(central) },		/* ISO-8859-2 */
+	{ 8, false, FREQUENT(cyrillic) },	/* ISO-8859-5 */
+	{ 9, false, FREQUENT(arabic) },		/* ISO-8859-6 */
+	{ 10, false, FREQUENT(greek) }		/* ISO-8859-7 */
+};
+
+#undef FREQUENT
+
+static bool sniff_utf16(const uint8_t *data, size_t len, uint16_t *mibenum);
+static bool sniff_utf8(const uint8_t *data, size_t len);
+static bool sniff_score(const uint8_t *data, size_t len, uint32_t candidate,
+		int32_t *score);
+static inline sniff_class sniff_classify(uint32_t ucs4,
+		sniff_script *script);
+static int sniff_frequent_cmp(const void *a, const void *b);
+
+/**
+ * Guess the charset of a document from its first few bytes
+ *
+ * \param data        The start of the document
+ * \param len         Length of data, in bytes
+ * \param mibenum     Pointer to location to receive MIB enum of charset,
+ *                    or 0 if none could be determined
+ * \param confidence  Pointer to location to receive confidence in charset
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters
+ *
+ * Only the first PARSERUTILS_CHARSET_SNIFF_LENGTH bytes are considered.
+ * In order, these are checked for:
+ *
+ *  + A byte order mark, giving the charset with certainty
+ *  + Text in UTF-16 without a BOM, from the pattern of NUL bytes
+ *  + ASCII or valid UTF-8, reported as UTF-8 with high confidence. A
+ *    sequence cut short by the end of the data is not counted as invalid.
+ *  + The ISO-8859-n or Windows-125x charset in which the non-ASCII bytes
+ *    most plausibly form the letters of the charset's languages
+ *
+ * A caller offering successively longer prefixes of a document may stop
+ * once the confidence is PARSERUTILS_CHARSET_CONFIDENCE_HIGH, or once the
+ * prefix reaches PARSERUTILS_CHARSET_SNIFF_LENGTH.
+ */
+parserutils_error parserutils_charset_sniff(const uint8_t *data, size_t len,
+		uint16_t *mibenum, parserutils_charset_confidence *confidence)
+{
+	static const uint16_t boms[] = { MIB_UTF_32BE, MIB_UTF_32LE,
+			MIB_UTF_8, MIB_UTF_16BE, MIB_UTF_16LE };
+	int32_t best = 0;
+	uint32_t i;
+
+	if ((data == NULL && len > 0) || mibenum == NULL ||
+			confidence == NULL)
+		return PARSERUTILS_BADPARM;
+
+	*mibenum = 0;
+	*confidence = PARSERUTILS_CHARSET_CONFIDENCE_NONE;
+
+	if (len == 0)
+		return PARSERUTILS_OK;
+
+	len = min(len, PARSERUTILS_CHARSET_SNIFF_LENGTH);
+
+	/* UTF-32LE must be tried before UTF-16LE, whose BOM it begins with */
+	for (i = 0; i < N_ELEMENTS(boms); i++) {
+		if (parserutils__charset_bom_length(boms[i], data, len) != 0) {
+			*mibenum = boms[i];
+			*confidence = PARSERUTILS_CHARSET_CONFIDENCE_CERTAIN;
+			return PARSERUTILS_OK;
+		}
+	}
+
+	if (sniff_utf16(data, len, mibenum)) {
+		*confidence = PARSERUTILS_CHARSET_CONFIDENCE_TENTATIVE;
+		return PARSERUTILS_OK;
+	}
+
+	if (sniff_utf8(data, len)) {
+		*mibenum = MIB_UTF_8;
+		*confidence = PARSERUTILS_CHARSET_CONFIDENCE_HIGH;
+		return PARSERUTILS_OK;
+	}
+
+	/* Pick the best scoring single-byte charset, preferring earlier
+	 * candidates in a tie. As by far the most widely used, the first
+	 * is only passed over for one scoring clearly better. */
+	for (i = 0; i < N_ELEMENTS(candidates); i++) {
+		int32_t score;
+
+		if (sniff_score(data, len, i, &score) == false)
+			continue;
+
+		if (*mibenum == 0 || score > best) {
+			*mibenum = candidates[i].mib;
+			best = score;
+		}
+
+		if (i == 0)
+			best += (best > 0) ? best / 4 : 0;
+	}
+
+	if (*mibenum != 0)
+		*confidence = PARSERUTILS_CHARSET_CONFIDENCE_TENTATIVE;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Charset detection function for input streams, using the sniffer
+ *
+ * \param data     The start of the document
+ * \param len      Length of data, in bytes
+ * \param mibenum  Pointer to MIB enum of charset, or 0 if unknown; updated
+ * \param source   Pointer to source of charset; updated
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NEEDDATA if there is too little data to rule out a BOM
+ *
+ * This may be passed to parserutils_inputstream_create(). A BOM overrides
+ * any charset given when the stream was created; otherwise, the sniffed
+ * charset is only used if none was given. When the charset is changed, the
+ * source is set to the sniffer's confidence in it.
+ */
+parserutils_error parserutils_charset_detect(const uint8_t *data, size_t len,
+		uint16_t *mibenum, uint32_t *source)
+{
+	parserutils_charset_confidence confidence;
+	parserutils_error error;
+	uint16_t sniffed;
+
+	if (data == NULL || mibenum == NULL || source == NULL)
+		return PARSERUTILS_BADPARM;
+
+	if (len < 4)
+		return PARSERUTILS_NEEDDATA;
+
+	error = parserutils_charset_sniff(data, len, &sniffed, &confidence);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	if (confidence == PARSERUTILS_CHARSET_CONFIDENCE_CERTAIN ||
+			(*mibenum == 0 &&
+			confidence != PARSERUTILS_CHARSET_CONFIDENCE_NONE)) {
+		*mibenum = sniffed;
+		*source = confidence;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Detect ASCII text in UTF-16 without a BOM
+ *
+ * \param data     The data to consider
+ * \param len      Length of data, in bytes
+ * \param mibenum  Pointer to location to receive UTF-16LE or UTF-16BE
+ * \return true if the data appears to be UTF-16, false otherwise
+ *
+ * The data is taken to be UTF-16 if at least half of the code units have
+ * a NUL high byte, and none has a NUL low byte.
+ */
+bool sniff_utf16(const uint8_t *data, size_t len, uint16_t *mibenum)
+{
+	size_t units = len / 2, i;
+	size_t even = 0, odd = 0;
+
+	if (units < 2)
+		return false;
+
+	for (i = 0; i < units; i++) {
+		even += (data[2 * i] == 0);
+		odd += (data[2 * i + 1] == 0);
+	}
+
+	if (even == 0 && odd * 2 >= units) {
+		*mibenum = MIB_UTF_16LE;
+		return true;
+	}
+
+	if (odd == 0 && even * 2 >= units) {
+		*mibenum = MIB_UTF_16BE;
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Determine whether data is valid UTF-8
+ *
+ * \param data  The data to consider
+ * \param len   Length of data, in bytes
+ * \return true if valid, false otherwise
+ *
+ * A sequence cut short by the end of the data is valid.
+ */
+bool sniff_utf8(const uint8_t *data, size_t len)
+{
+	size_t off = 0;
+
+	while (off < len) {
+		parserutils_error error;
+		uint32_t ucs4;
+		size_t clen;
+
+		off += simd_ascii_prefix(data + off, len - off);
+		if (off == len)
+			break;
+
+		{
+			const uint8_t *src = data + off;
+			size_t srclen = len - off;
+			uint32_t *uptr = &ucs4;
+			size_t *clptr = &clen;
+
+			UTF8_TO_UCS4(src, srclen, uptr, clptr, error);
+		}
+		if (error != PARSERUTILS_OK)
+			return (error == PARSERUTILS_NEEDDATA);
+
+		off += clen;
+	}
+
+	return true;
+}
+
+/**
+ * Score the plausibility of data in a single-byte charset
+ *
+ * \param data       The data to consider
+ * \param len        Length of data, in bytes
+ * \param candidate  Index of the charset in the candidates table
+ * \param score      Pointer to location to receive score
+ * \return true if the data is possible in the charset, false if it
+ *         contains bytes which are undefined or control characters
+ *
+ * Each non-ASCII letter scores a point, and one commonly used in the
+ * charset's languages scores more. Points are lost for a letter which
+ * follows another of a different script, for an upper case letter
+ * following a lower case one, and for an accented Latin letter following
+ * another.
+ */
+bool sniff_score(const uint8_t *data, size_t len, uint32_t candidate,
+		int32_t *score)
+{
+	uint16_t mibenum = candidates[candidate].mib;
+	bool latin = candidates[candidate].latin;
+	const uint16_t *table = parserutils__charset_sbcs_table(mibenum);
+	sniff_class prev = SNIFF_OTHER;
+	sniff_script prev_script = SNIFF_LATIN;
+	bool prev_high = false;
+	size_t i;
+
+	*score = 0;
+
+	for (i = 0; i < len; i++) {
+		uint8_t b = data[i];
+		sniff_script script;
+		sniff_class cls;
+		uint32_t ucs4;
+
+		if (b < 0x80) {
+			if (b >= 'a' && b <= 'z')
+				prev = SNIFF_LOWER;
+			else if (b >= 'A' && b <= 'Z')
+				prev = SNIFF_UPPER;
+			else
+				prev = SNIFF_OTHER;
+			prev_script = SNIFF_LATIN;
+			prev_high = false;
+
+			continue;
+		}
+
+		/* Undefined bytes and C1 controls don't appear in text */
+		ucs4 = table[b - 0x80];
+		if (ucs4 == 0xFFFF)
+			return false;
+
+		cls = sniff_classify(ucs4, &script);
+		if (cls != SNIFF_OTHER) {
+			uint16_t key = ucs4;
+
+			*score += 1;
+
+			if (bsearch(&key, candidates[candidate].frequent,
+					candidates[candidate].n_frequent,
+					sizeof(uint16_t),
+					sniff_frequent_cmp) != NULL)
+				*score += 3;
+
+			if (prev != SNIFF_OTHER && script != prev_script)
+				*score -= 4;
+
+			if (cls == SNIFF_UPPER && prev == SNIFF_LOWER)
+				*score -= 4;
+
+			if (latin && prev_high)
+				*score -= 4;
+		}
+
+		prev = cls;
+		prev_script = script;
+		prev_high = (cls != SNIFF_OTHER);
+	}
+
+	return true;
+}
+
+/**
+ * Classify a character found in a single-byte charset
+ *
+ * \param ucs4    The character
+ * \param script  Pointer to location to receive script of a letter
+ * \return The character's class
+ *
+ * Only the letters found in the candidate charsets are recognised.
+ */
+sniff_class sniff_classify(uint32_t ucs4, sniff_script *script)
+{
+	*script = SNIFF_LATIN;
+
+	if (ucs4 >= 0x00C0 && ucs4 <= 0x00FF) {
+		/* Latin-1 Supplement */
+		if (ucs4 == 0x00D7 || ucs4 == 0x00F7)
+			return SNIFF_OTHER;
+
+		return (ucs4 < 0x00DF) ? SNIFF_UPPER : SNIFF_LOWER;
+	} else if (ucs4 >= 0x0100 && ucs4 <= 0x017F) {
+		/* Latin Extended-A: mostly pairs of upper then lower case,
+		 * but offset by one in two ranges */
+		if (ucs4 == 0x0138 || ucs4 == 0x0149 || ucs4 == 0x017F)
+			return SNIFF_LOWER;
+		if (ucs4 == 0x0178)
+			return SNIFF_UPPER;
+		if ((ucs4 >= 0x0139 && ucs4 <= 0x0148) || ucs4 >= 0x0179)
+			return (ucs4 & 1) ? SNIFF_UPPER : SNIFF_LOWER;
+
+		return (ucs4 & 1) ? SNIFF_LOWER : SNIFF_UPPER;
+	} else if (ucs4 == 0x01A0 || ucs4 == 0x01AF) {
+		return SNIFF_UPPER;
+	} else if (ucs4 == 0x01A1 || ucs4 == 0x01B0) {
+		return SNIFF_LOWER;
+	}
+
+	if (ucs4 >= 0x0386 && ucs4 <= 0x03CE && ucs4 != 0x0387) {
+		*script = SNIFF_GREEK;
+		return (ucs4 < 0x03AC) ? SNIFF_UPPER : SNIFF_LOWER;
+	}
+
+	if (ucs4 >= 0x0400 && ucs4 <= 0x045F) {
+		*script = SNIFF_CYRILLIC;
+		return (ucs4 < 0x0430) ? SNIFF_UPPER : SNIFF_LOWER;
+	} else if (ucs4 == 0x0490 || ucs4 == 0x0491) {
+		*script = SNIFF_CYRILLIC;
+		return (ucs4 == 0x0490) ? SNIFF_UPPER : SNIFF_LOWER;
+	}
+
+	if (ucs4 >= 0x05D0 && ucs4 <= 0x05EA) {
+		*script = SNIFF_HEBREW;
+		return SNIFF_CASELESS;
+	}
+
+	if ((ucs4 >= 0x0621 && ucs4 <= 0x064A && ucs4 != 0x0640) ||
+			(ucs4 >= 0x0671 && ucs4 <= 0x06D3)) {
+		*script = SNIFF_ARABIC;
+		return SNIFF_CASELESS;
+	}
+
+	return SNIFF_OTHER;
+}
+
+/**
+ * Comparator for searching the table of commonly used letters
+ *
+ * \param a  Pointer to character sought
+ * \param b  Pointer to table entry
+ * \return <0, 0 or >0 as the character is less than, equal to or greater
+ *         than the entry
+ */
+int sniff_frequent_cmp(const void *a, const void *b)
+{
+	return (int) *((const uint16_t *) a) - (int) *((const uint16_t *) b);
+}
+
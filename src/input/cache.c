@@ -0,0 +1,495 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <string.h>
+
+#include <parserutils/utils/hash.h>
+
+#include "input/cache.h"
+#include "utils/utils.h"
+
+/** Bytes hashed from each end of a document */
+#define CACHE_SAMPLE (1024)
+
+/**
+ * Key of a cached document
+ *
+ * Documents of the same length, with the same bytes at each end, have the
+ * same key. Their raw data is compared in full when one is looked for.
+ */
+typedef struct decode_cache_key {
+	uint64_t length;		/**< Length of raw data, in bytes */
+	uint32_t hash;			/**< Hash of the ends of the data */
+	uint16_t mibenum;		/**< MIB enum of the charset */
+	uint16_t nfc;			/**< Whether the output is normalised */
+} decode_cache_key;
+
+/**
+ * Cached document
+ *
+ * The raw data follows the entry in memory, and the UTF-8 follows that.
+ * Neither changes once the entry is added. An entry discarded while
+ * streams hold it is freed when the last releases it.
+ */
+typedef struct decode_cache_entry {
+	decode_cache_key key;		/**< Key, as held by the index */
+
+	struct decode_cache_entry *prev; /**< More recently used entry */
+	struct decode_cache_entry *next; /**< Less recently used entry */
+
+	size_t utf8_len;		/**< Length of UTF-8, in bytes */
+	uint32_t replacements;		/**< U+FFFD substituted in it */
+	size_t size;			/**< Bytes allocated for the entry */
+
+	uint32_t holders;		/**< Streams holding the entry */
+	bool discarded;			/**< Whether it has left the cache */
+} decode_cache_entry;
+
+/**
+ * Decode cache object
+ *
+ * All but the allocator, the lock and the limit are protected by the lock.
+ */
+struct parserutils_decode_cache {
+	parserutils_hash *index;	/**< Entries by key */
+	decode_cache_entry *first;	/**< Most recently used entry */
+	decode_cache_entry *last;	/**< Least recently used entry */
+
+	size_t limit;			/**< Maximum bytes used by entries */
+	parserutils_decode_cache_stats stats; /**< Statistics */
+
+	parserutils_lock lock;		/**< Lock function, or NULL */
+	void *lock_pw;			/**< Lock function private data */
+
+	parserutils_alloc alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client private data */
+};
+
+static inline void decode_cache_lock(
+		const parserutils_decode_cache *cache, bool acquire);
+static void decode_cache_key_init(decode_cache_key *key, uint16_t mibenum,
+		bool nfc, const uint8_t *raw, size_t len);
+static void decode_cache_unlink(parserutils_decode_cache *cache,
+		decode_cache_entry *entry);
+static void decode_cache_remove(parserutils_decode_cache *cache,
+		decode_cache_entry *entry);
+
+/**
+ * Create a decode cache
+ *
+ * \param size     Maximum bytes used by cached documents
+ * \param lock     Function locking the cache, or NULL for none
+ * \param lock_pw  Pointer to private data for lock (may be NULL)
+ * \param alloc    Memory (de)allocation function
+ * \param pw       Pointer to client-specific private data (may be NULL)
+ * \param cache    Pointer to location to receive cache
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ *
+ * Each cached document uses the length of its raw data and of its UTF-8,
+ * with a little more for bookkeeping. Documents larger than the cache are
+ * never kept. A cache to be shared between threads needs a lock, and alloc
+ * must then be safe to call from any of them.
+ */
+parserutils_error parserutils_decode_cache_create(size_t size,
+		parserutils_lock lock, void *lock_pw,
+		parserutils_alloc alloc, void *pw,
+		parserutils_decode_cache **cache)
+{
+	parserutils_decode_cache *c;
+	parserutils_error error;
+
+	if (alloc == NULL || cache == NULL)
+		return PARSERUTILS_BADPARM;
+
+	c = alloc(NULL, sizeof(parserutils_decode_cache), pw);
+	if (c == NULL)
+		return PARSERUTILS_NOMEM;
+
+	error = parserutils_hash_create(alloc, pw, &c->index);
+	if (error != PARSERUTILS_OK) {
+		alloc(c, 0, pw);
+		return error;
+	}
+
+	c->first = NULL;
+	c->last = NULL;
+	c->limit = size;
+	memset(&c->stats, 0, sizeof(c->stats));
+
+	c->lock = lock;
+	c->lock_pw = lock_pw;
+
+	c->alloc = alloc;
+	c->pw = pw;
+
+	*cache = c;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Destroy a decode cache
+ *
+ * \param cache  The cache to destroy
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * All streams using the cache must have been destroyed.
+ */
+parserutils_error parserutils_decode_cache_destroy(
+		parserutils_decode_cache *cache)
+{
+	decode_cache_entry *entry, *next;
+
+	if (cache == NULL)
+		return PARSERUTILS_BADPARM;
+
+	for (entry = cache->first; entry != NULL; entry = next) {
+		next = entry->next;
+		cache->alloc(entry, 0, cache->pw);
+	}
+
+	parserutils_hash_destroy(cache->index);
+
+	cache->alloc(cache, 0, cache->pw);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Read a decode cache's statistics
+ *
+ * \param cache  The cache to interrogate
+ * \param stats  Pointer to location to receive statistics
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error parserutils_decode_cache_get_stats(
+		const parserutils_decode_cache *cache,
+		parserutils_decode_cache_stats *stats)
+{
+	if (cache == NULL || stats == NULL)
+		return PARSERUTILS_BADPARM;
+
+	decode_cache_lock(cache, true);
+	*stats = cache->stats;
+	decode_cache_lock(cache, false);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Determine whether a document's raw data would fit in a cache
+ *
+ * \param cache  The cache to consider
+ * \param len    Length of raw data, in bytes
+ * \return True if it fits, leaving room for some UTF-8, false otherwise
+ */
+bool parserutils__decode_cache_fits(const parserutils_decode_cache *cache,
+		size_t len)
+{
+	return len < cache->limit &&
+			sizeof(decode_cache_entry) < cache->limit - len;
+}
+
+/**
+ * Find the UTF-8 decoded from a document
+ *
+ * \param cache         The cache to look in
+ * \param mibenum       MIB enum of the document's charset
+ * \param nfc           Whether the UTF-8 is normalised to NFC
+ * \param raw           The document's raw data, following any BOM
+ * \param len           Length of raw data, in bytes
+ * \param entry         Pointer to location to receive the document's entry
+ * \param utf8          Pointer to location to receive UTF-8
+ * \param utf8_len      Pointer to location to receive length of UTF-8
+ * \param replacements  Pointer to location to receive number of U+FFFD
+ *                      characters substituted for invalid input
+ * \return True if the document was found, false otherwise
+ *
+ * A document found is held, and its UTF-8 remains valid, until the entry
+ * is given to parserutils__decode_cache_release().
+ */
+bool parserutils__decode_cache_find(parserutils_decode_cache *cache,
+		uint16_t mibenum, bool nfc, const uint8_t *raw, size_t len,
+		parserutils_decode_cache_entry **entry,
+		const uint8_t **utf8, size_t *utf8_len,
+		uint32_t *replacements)
+{
+	decode_cache_entry *e;
+	decode_cache_key key;
+	void *value;
+
+	decode_cache_key_init(&key, mibenum, nfc, raw, len);
+
+	decode_cache_lock(cache, true);
+
+	if (parserutils_hash_find(cache->index, (const uint8_t *) &key,
+			sizeof(key), &value) != PARSERUTILS_OK) {
+		cache->stats.misses++;
+		decode_cache_lock(cache, false);
+		return false;
+	}
+
+	e = value;
+	e->holders++;
+
+	decode_cache_lock(cache, false);
+
+	/* Documents with the same key may differ in the middle */
+	if (memcmp(e + 1, raw, len) != 0) {
+		decode_cache_lock(cache, true);
+		cache->stats.misses++;
+		decode_cache_lock(cache, false);
+
+		parserutils__decode_cache_release(cache, e);
+		return false;
+	}
+
+	decode_cache_lock(cache, true);
+
+	/* Move to the front, unless discarded meanwhile */
+	if (e->discarded == false) {
+		decode_cache_unlink(cache, e);
+		e->prev = NULL;
+		e->next = cache->first;
+		if (cache->first != NULL)
+			cache->first->prev = e;
+		else
+			cache->last = e;
+		cache->first = e;
+	}
+
+	cache->stats.hits++;
+
+	decode_cache_lock(cache, false);
+
+	*entry = e;
+	*utf8 = (const uint8_t *) (e + 1) + len;
+	*utf8_len = e->utf8_len;
+	*replacements = e->replacements;
+
+	return true;
+}
+
+/**
+ * Release a document found in a cache
+ *
+ * \param cache  The cache it was found in
+ * \param entry  The document's entry
+ */
+void parserutils__decode_cache_release(parserutils_decode_cache *cache,
+		parserutils_decode_cache_entry *entry)
+{
+	bool discarded;
+
+	decode_cache_lock(cache, true);
+	discarded = --entry->holders == 0 && entry->discarded;
+	decode_cache_lock(cache, false);
+
+	if (discarded)
+		cache->alloc(entry, 0, cache->pw);
+}
+
+/**
+ * Add the UTF-8 decoded from a document to a cache
+ *
+ * \param cache         The cache to add to
+ * \param mibenum       MIB enum of the document's charset
+ * \param nfc           Whether the UTF-8 is normalised to NFC
+ * \param raw           The document's raw data, following any BOM
+ * \param len           Length of raw data, in bytes
+ * \param utf8          UTF-8 decoded from the raw data
+ * \param utf8_len      Length of UTF-8, in bytes
+ * \param replacements  Number of U+FFFD characters substituted for invalid
+ *                      input
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * Documents are discarded, least recently used first, until there's room
+ * for this one. A document too large for the cache is not added. A document
+ * replaces any with the same key.
+ */
+parserutils_error parserutils__decode_cache_add(
+		parserutils_decode_cache *cache,
+		uint16_t mibenum, bool nfc, const uint8_t *raw, size_t len,
+		const uint8_t *utf8, size_t utf8_len, uint32_t replacements)
+{
+	decode_cache_entry *entry;
+	parserutils_error error;
+	void *value;
+	size_t size;
+
+	if (len > cache->limit || utf8_len > cache->limit - len ||
+			sizeof(decode_cache_entry) >
+				cache->limit - len - utf8_len)
+		return PARSERUTILS_OK;
+
+	size = sizeof(decode_cache_entry) + len + utf8_len;
+
+	entry = cache->alloc(NULL, size, cache->pw);
+	if (entry == NULL)
+		return PARSERUTILS_NOMEM;
+
+	decode_cache_key_init(&entry->key, mibenum, nfc, raw, len);
+	entry->utf8_len = utf8_len;
+	entry->replacements = replacements;
+	entry->size = size;
+	entry->holders = 0;
+	entry->discarded = false;
+
+	memcpy(entry + 1, raw, len);
+	memcpy((uint8_t *) (entry + 1) + len, utf8, utf8_len);
+
+	decode_cache_lock(cache, true);
+
+	if (parserutils_hash_find(cache->index, (const uint8_t *) &entry->key,
+			sizeof(entry->key), &value) == PARSERUTILS_OK)
+		decode_cache_remove(cache, value);
+
+	while (cache->stats.size > cache->limit - size) {
+		decode_cache_remove(cache, cache->last);
+		cache->stats.evictions++;
+	}
+
+	error = parserutils_hash_insert(cache->index,
+			(const uint8_t *) &entry->key, sizeof(entry->key),
+			entry);
+	if (error != PARSERUTILS_OK) {
+		decode_cache_lock(cache, false);
+		cache->alloc(entry, 0, cache->pw);
+		return error;
+	}
+
+	entry->prev = NULL;
+	entry->next = cache->first;
+	if (cache->first != NULL)
+		cache->first->prev = entry;
+	else
+		cache->last = entry;
+	cache->first = entry;
+
+	cache->stats.entries++;
+	cache->stats.size += size;
+
+	decode_cache_lock(cache, false);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Take or release a cache's lock, if it has one
+ *
+ * \param cache    The cache
+ * \param acquire  Whether to take the lock, rather than release it
+ */
+void decode_cache_lock(const parserutils_decode_cache *cache, bool acquire)
+{
+	if (cache->lock != NULL)
+		cache->lock(acquire, cache->lock_pw);
+}
+
+/**
+ * Fill in the key of a document
+ *
+ * \param key      Pointer to key to fill in
+ * \param mibenum  MIB enum of the document's charset
+ * \param nfc      Whether the UTF-8 is normalised to NFC
+ * \param raw      The document's raw data
+ * \param len      Length of raw data, in bytes
+ *
+ * Only the ends of the data are hashed, so a document is quickly found not
+ * to be cached whatever its length.
+ */
+void decode_cache_key_init(decode_cache_key *key, uint16_t mibenum,
+		bool nfc, const uint8_t *raw, size_t len)
+{
+	uint64_t h = UINT64_C(0x9E3779B97F4A7C15) ^ len;
+	size_t head = min(len, CACHE_SAMPLE);
+	size_t tail = min(len - head, CACHE_SAMPLE);
+	const uint8_t *spans[2];
+	size_t lens[2], i;
+
+	spans[0] = raw;
+	lens[0] = head;
+	spans[1] = raw + len - tail;
+	lens[1] = tail;
+
+	for (i = 0; i < 2; i++) {
+		const uint8_t *data = spans[i];
+		size_t left = lens[i];
+		uint64_t word;
+
+		for (; left >= sizeof(word);
+				data += sizeof(word), left -= sizeof(word)) {
+			memcpy(&word, data, sizeof(word));
+			h = (h ^ word) * UINT64_C(0xFF51AFD7ED558CCD);
+			h ^= h >> 32;
+		}
+
+		if (left > 0) {
+			word = 0;
+			memcpy(&word, data, left);
+			h = (h ^ word) * UINT64_C(0xFF51AFD7ED558CCD);
+		}
+	}
+
+	h ^= h >> 33;
+	h *= UINT64_C(0xC4CEB9FE1A85EC53);
+	h ^= h >> 29;
+
+	/* The key is compared as bytes, so has no padding to clear */
+	key->length = len;
+	key->hash = (uint32_t) h;
+	key->mibenum = mibenum;
+	key->nfc = nfc;
+}
+
+/**
+ * Take an entry out of a cache's list of entries
+ *
+ * \param cache  The cache
+ * \param entry  The entry to take out
+ */
+void decode_cache_unlink(parserutils_decode_cache *cache,
+		decode_cache_entry *entry)
+{
+	if (entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		cache->first = entry->next;
+
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		cache->last = entry->prev;
+}
+
+/**
+ * Discard an entry from a cache
+ *
+ * \param cache  The cache, whose lock is held
+ * \param entry  The entry to discard
+ *
+ * An entry held by a stream is freed when the stream releases it.
+ */
+void decode_cache_remove(parserutils_decode_cache *cache,
+		decode_cache_entry *entry)
+{
+	parserutils_hash_remove(cache->index, (const uint8_t *) &entry->key,
+			sizeof(entry->key));
+
+	decode_cache_unlink(cache, entry);
+
+	cache->stats.entries--;
+	cache->stats.size -= entry->size;
+
+	if (entry->holders > 0)
+		entry->discarded = true;
+	else
+		cache->alloc(entry, 0, cache->pw);
+}
+
@@ -0,0 +1,38 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_input_cache_impl_h_
+#define parserutils_input_cache_impl_h_
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <parserutils/input/cache.h>
+
+/** A cached document, held by a stream reading its UTF-8 */
+typedef struct decode_cache_entry parserutils_decode_cache_entry;
+
+/* Determine whether a document's raw data would fit in a cache */
+bool parserutils__decode_cache_fits(const parserutils_decode_cache *cache,
+		size_t len);
+/* Find the UTF-8 decoded from a document, holding it until released */
+bool parserutils__decode_cache_find(parserutils_decode_cache *cache,
+		uint16_t mibenum, bool nfc, const uint8_t *raw, size_t len,
+		parserutils_decode_cache_entry **entry,
+		const uint8_t **utf8, size_t *utf8_len,
+		uint32_t *replacements);
+/* Release a document found in a cache */
+void parserutils__decode_cache_release(parserutils_decode_cache *cache,
+		parserutils_decode_cache_entry *entry);
+/* Add the UTF-8 decoded from a document to a cache */
+parserutils_error parserutils__decode_cache_add(
+		parserutils_decode_cache *cache,
+		uint16_t mibenum, bool nfc, const uint8_t *raw, size_t len,
+		const uint8_t *utf8, size_t utf8_len, uint32_t replacements);
+
+#endif
+
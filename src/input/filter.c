@@ -7,6 +7,7 @@
 
 #include <errno.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -16,8 +17,14 @@
 
 #include <parserutils/charset/mibenum.h>
 #include <parserutils/charset/codec.h>
+#include <parserutils/charset/utf8.h>
 
+#include "charset/aliases.h"
+#include "charset/codecs/codec_impl.h"
+#include "charset/pool.h"
 #include "input/filter.h"
+#include "input/nfc.h"
+#include "utils/trace.h"
 #include "utils/utils.h"
 
 /** Input filter */
@@ -25,21 +32,57 @@ struct parserutils_filter {
 #ifndef WITHOUT_ICONV_FILTER
 	iconv_t cd;			/**< Iconv conversion descriptor */
 	uint16_t int_enc;		/**< The internal encoding */
+
+	/** Native codec used in place of iconv, or NULL */
+	parserutils_charset_codec *native;
+
+	/** What iconv makes of each byte >= 0x80, by itself */
+	uint8_t byte_kind[128];
+#define BYTE_UNKNOWN (0)	/**< Not yet tried */
+#define BYTE_LEAD    (1)	/**< May start a longer sequence */
+#define BYTE_INVALID (2)	/**< Cannot start a character */
+#define BYTE_SINGLE  (3)	/**< Is a character, given in byte_out */
+	uint8_t byte_out[128][4];	/**< Output for BYTE_SINGLE bytes */
+	uint8_t byte_outlen[128];	/**< Length of output in byte_out */
 #else
 	parserutils_charset_codec *read_codec;	/**< Read codec */
 	parserutils_charset_codec *write_codec;	/**< Write codec */
 
-	uint32_t pivot_buf[64];		/**< Conversion pivot buffer */
+	bool utf8_out;			/**< Write codec is UTF-8 */
+
+#define DEFAULT_PIVOT_SIZE (1024)
+	uint32_t *pivot_buf;		/**< Conversion pivot buffer */
+	size_t pivot_size;		/**< Capacity of pivot, in characters */
 
 	bool leftover;			/**< Data remains from last call */
+	bool read_pending;		/**< Read codec holds decoded output */
 	uint8_t *pivot_left;		/**< Remaining pivot to write */
 	size_t pivot_len;		/**< Length of pivot remaining */
 #endif
 
 	struct {
 		uint16_t encoding;	/**< Input encoding */
+		/** Treatment of unrepresentable characters */
+		parserutils_filter_fallback fallback;
 	} settings;			/**< Filter settings */
 
+/* Output space needed to write any fallback for a character at once */
+#define FALLBACK_SPACE (64)
+/* Input given to iconv after a fallback, at first */
+#define FALLBACK_WINDOW (64)
+
+	uint32_t replacements;		/**< Replacement characters emitted */
+
+/* Each conversion has a cost to start, so is made in large pieces */
+#define NFC_BUFFER_SIZE (16 * 1024)
+	parserutils_nfc *nfc;		/**< Normaliser, or NULL for none */
+	uint8_t *nfc_buf;		/**< Converted data to normalise */
+	size_t nfc_len;			/**< Length of data in nfc_buf */
+
+	const parserutils_trace *trace;	/**< Trace hook, or NULL */
+
+	parserutils_charset_pool *pool;	/**< Converter pool, or NULL */
+
 	parserutils_alloc alloc;	/**< Memory (de)allocation function */
 	void *pw;			/**< Client private data */
 };
@@ -47,6 +90,49 @@ struct parserutils_filter {
 static parserutils_error filter_set_defaults(parserutils_filter *input);
 static parserutils_error filter_set_encoding(parserutils_filter *input,
 		const char *enc);
+#ifdef WITHOUT_ICONV_FILTER
+static parserutils_error filter_set_pivot_size(parserutils_filter *input,
+		size_t size);
+#endif
+static parserutils_error filter_set_normalise(parserutils_filter *input,
+		bool nfc);
+static parserutils_error filter_set_fallback(parserutils_filter *input,
+		parserutils_filter_fallback mode);
+static parserutils_error filter_convert(parserutils_filter *input,
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen);
+static parserutils_error filter_normalise(parserutils_filter *input,
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen);
+static size_t filter_ncr(uint32_t ucs4, char *ref);
+static parserutils_error filter_codec_create(parserutils_filter *input,
+		uint16_t mibenum, parserutils_charset_codec **codec);
+static void filter_codec_destroy(parserutils_filter *input,
+		parserutils_charset_codec *codec);
+#ifndef WITHOUT_ICONV_FILTER
+static parserutils_error filter_iconv_open(parserutils_filter *input,
+		uint16_t mibenum);
+static void filter_iconv_close(parserutils_filter *input);
+static parserutils_error filter_iconv_recover(parserutils_filter *input,
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen);
+static parserutils_error filter_iconv_skip(parserutils_filter *input,
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen);
+static void filter_iconv_probe(parserutils_filter *input, uint8_t byte);
+static parserutils_error filter_iconv_fallback(parserutils_filter *input,
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen);
+static bool filter_iconv_write(parserutils_filter *input,
+		const char *text, size_t textlen,
+		uint8_t **output, size_t *outlen);
+#else
+static parserutils_error filter_encode(parserutils_filter *input,
+		uint8_t **pivot, size_t *pivot_len,
+		uint8_t **output, size_t *outlen);
+static parserutils_error filter_encode_ncr(parserutils_filter *input,
+		uint32_t ucs4, uint8_t **output, size_t *outlen);
+#endif
 
 /**
  * Create an input filter
@@ -62,9 +148,33 @@ static parserutils_error filter_set_encoding(parserutils_filter *input,
  */
 parserutils_error parserutils__filter_create(const char *int_enc,
 		parserutils_alloc alloc, void *pw, parserutils_filter **filter)
+{
+	return parserutils__filter_create_pooled(int_enc, NULL,
+			alloc, pw, filter);
+}
+
+/**
+ * Create an input filter which takes its converters from a pool
+ *
+ * \param int_enc  Desired encoding of document
+ * \param pool     Pool of converters, or NULL for none
+ * \param alloc    Function used to (de)allocate data
+ * \param pw       Pointer to client-specific private data (may be NULL)
+ * \param filter   Pointer to location to receive filter instance
+ * \return As for parserutils__filter_create
+ *
+ * The filter's converters are returned to the pool when it no longer needs
+ * them, so the pool must outlive the filter.
+ */
+parserutils_error parserutils__filter_create_pooled(const char *int_enc,
+		parserutils_charset_pool *pool,
+		parserutils_alloc alloc, void *pw, parserutils_filter **filter)
 {
 	parserutils_filter *f;
 	parserutils_error error;
+#ifdef WITHOUT_ICONV_FILTER
+	parserutils_charset_codec_optparams params;
+#endif
 
 	if (int_enc == NULL || alloc == NULL || filter == NULL)
 		return PARSERUTILS_BADPARM;
@@ -75,6 +185,7 @@ parserutils_error parserutils__filter_create(const char *int_enc,
 
 #ifndef WITHOUT_ICONV_FILTER
 	f->cd = (iconv_t) -1;
+	f->native = NULL;
 	f->int_enc = parserutils_charset_mibenum_from_name(
 			int_enc, strlen(int_enc));
 	if (f->int_enc == 0) {
@@ -82,31 +193,62 @@ parserutils_error parserutils__filter_create(const char *int_enc,
 		return PARSERUTILS_BADENCODING;
 	}
 #else
+	f->pivot_buf = alloc(NULL, DEFAULT_PIVOT_SIZE * sizeof(uint32_t), pw);
+	if (f->pivot_buf == NULL) {
+		alloc(f, 0, pw);
+		return PARSERUTILS_NOMEM;
+	}
+	f->pivot_size = DEFAULT_PIVOT_SIZE;
+
 	f->leftover = false;
+	f->read_pending = false;
 	f->pivot_left = NULL;
 	f->pivot_len = 0;
 #endif
 
+	f->settings.fallback = PARSERUTILS_FILTER_FALLBACK_LOOSE;
+
+	f->replacements = 0;
+
+	f->nfc = NULL;
+	f->nfc_buf = NULL;
+	f->nfc_len = 0;
+
+	f->trace = NULL;
+
+	f->pool = pool;
+
 	f->alloc = alloc;
 	f->pw = pw;
 
 	error = filter_set_defaults(f);
 	if (error != PARSERUTILS_OK) {
+#ifdef WITHOUT_ICONV_FILTER
+		f->alloc(f->pivot_buf, 0, pw);
+#endif
 		f->alloc(f, 0, pw);
 		return error;
 	}
 
 #ifdef WITHOUT_ICONV_FILTER
-	error = parserutils_charset_codec_create(int_enc, alloc, pw, 
-			&f->write_codec);
+	error = filter_codec_create(f, parserutils_charset_mibenum_from_name(
+			int_enc, strlen(int_enc)), &f->write_codec);
 	if (error != PARSERUTILS_OK) {
 		if (f->read_codec != NULL) {
-			parserutils_charset_codec_destroy(f->read_codec);
+			filter_codec_destroy(f, f->read_codec);
 			f->read_codec = NULL;
 		}
+		f->alloc(f->pivot_buf, 0, pw);
 		f->alloc(f, 0, pw);
 		return error;
 	}
+
+	/* The pivot never leaves the filter, so use host byte order */
+	params.ucs4_order.order = PARSERUTILS_CHARSET_CODEC_UCS4_HOST;
+	parserutils_charset_codec_setopt(f->write_codec,
+			PARSERUTILS_CHARSET_CODEC_UCS4_ORDER, &params);
+
+	f->utf8_out = (f->write_codec->mibenum == MIB_UTF_8);
 #endif
 
 	*filter = f;
@@ -126,22 +268,32 @@ parserutils_error parserutils__filter_destroy(parserutils_filter *input)
 		return PARSERUTILS_BADPARM;
 
 #ifndef WITHOUT_ICONV_FILTER
-	if (input->cd != (iconv_t) -1) {
-		iconv_close(input->cd);
-		input->cd = (iconv_t) -1;
+	if (input->cd != (iconv_t) -1)
+		filter_iconv_close(input);
+
+	if (input->native != NULL) {
+		filter_codec_destroy(input, input->native);
+		input->native = NULL;
 	}
 #else
 	if (input->read_codec != NULL) {
-		parserutils_charset_codec_destroy(input->read_codec);
+		filter_codec_destroy(input, input->read_codec);
 		input->read_codec = NULL;
 	}
 
 	if (input->write_codec != NULL) {
-		parserutils_charset_codec_destroy(input->write_codec);
+		filter_codec_destroy(input, input->write_codec);
 		input->write_codec = NULL;
 	}
+
+	input->alloc(input->pivot_buf, 0, input->pw);
 #endif
 
+	if (input->nfc != NULL) {
+		parserutils__nfc_destroy(input->nfc);
+		input->alloc(input->nfc_buf, 0, input->pw);
+	}
+
 	input->alloc(input, 0, input->pw);
 
 	return PARSERUTILS_OK;
@@ -154,6 +306,18 @@ parserutils_error parserutils__filter_destroy(parserutils_filter *input)
  * \param type    Input option type to configure
  * \param params  Option-specific parameters
  * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * The pivot size is the number of characters decoded for each call to the
+ * write codec, when the filter is built without iconv. Larger pivots spread
+ * the cost of those calls over more data. It may not be changed while
+ * output from an earlier call is outstanding.
+ *
+ * Normalisation to NFC is only possible when the filter's output is UTF-8.
+ * It may not be turned off while the normaliser holds data.
+ *
+ * The fallback applies to characters which a filter converting UTF-8 to
+ * another charset cannot write. Filters converting to UTF-8 replace input
+ * they cannot convert with U+FFFD, whatever the fallback.
  */
 parserutils_error parserutils__filter_setopt(parserutils_filter *input,
 		parserutils_filter_opttype type,
@@ -168,6 +332,20 @@ parserutils_error parserutils__filter_setopt(parserutils_filter *input,
 	case PARSERUTILS_FILTER_SET_ENCODING:
 		error = filter_set_encoding(input, params->encoding.name);
 		break;
+	case PARSERUTILS_FILTER_SET_PIVOT_SIZE:
+#ifdef WITHOUT_ICONV_FILTER
+		error = filter_set_pivot_size(input, params->pivot.size);
+#endif
+		break;
+	case PARSERUTILS_FILTER_SET_TRACE:
+		input->trace = params->trace.hook;
+		break;
+	case PARSERUTILS_FILTER_SET_NORMALISE:
+		error = filter_set_normalise(input, params->normalise.nfc);
+		break;
+	case PARSERUTILS_FILTER_SET_FALLBACK:
+		error = filter_set_fallback(input, params->fallback.mode);
+		break;
 	}
 
 	return error;
@@ -183,7 +361,8 @@ parserutils_error parserutils__filter_setopt(parserutils_filter *input,
  * \param outlen  Pointer to length of output buffer
  * \return PARSERUTILS_OK on success, appropriate error otherwise
  *
- * Call this with an input buffer length of 0 to flush any buffers.
+ * Call this with an input buffer length of 0 to flush any buffers. This also
+ * returns a filter writing a stateful charset to its initial shift state.
  */
 parserutils_error parserutils__filter_process_chunk(parserutils_filter *input,
 		const uint8_t **data, size_t *len,
@@ -193,112 +372,94 @@ parserutils_error parserutils__filter_process_chunk(parserutils_filter *input,
 			output == NULL || *output == NULL || outlen == NULL)
 		return PARSERUTILS_BADPARM;
 
-#ifndef WITHOUT_ICONV_FILTER
-	if (iconv(input->cd, (void *) data, len, 
-			(char **) output, outlen) == (size_t) -1) {
-		switch (errno) {
-		case E2BIG:
-			return PARSERUTILS_NOMEM;
-		case EILSEQ:
-			if (*outlen < 3)
-				return PARSERUTILS_NOMEM;
-
-			(*output)[0] = 0xef;
-			(*output)[1] = 0xbf;
-			(*output)[2] = 0xbd;
-
-			*output += 3;
-			*outlen -= 3;
-
-			(*data)++;
-			(*len)--;
-
-			while (*len > 0) {
-				size_t ret;
-				
-				ret = iconv(input->cd, (void *) data, len, 
-						(char **) output, outlen);
-				if (ret != (size_t) -1 || errno != EILSEQ)
-					break;
-
-				if (*outlen < 3)
-					return PARSERUTILS_NOMEM;
-
-				(*output)[0] = 0xef;
-				(*output)[1] = 0xbf;
-				(*output)[2] = 0xbd;
-
-				*output += 3;
-				*outlen -= 3;
+	if (input->nfc != NULL)
+		return filter_normalise(input, data, len, output, outlen);
 
-				(*data)++;
-				(*len)--;
-			}
+	return filter_convert(input, data, len, output, outlen);
+}
 
-			return errno == E2BIG ? PARSERUTILS_NOMEM 
-					      : PARSERUTILS_OK;
-		}
-	}
+/**
+ * Find the codec decoding a filter's input straight to UTF-8, if any
+ *
+ * \param input  The input filter to consider
+ * \return The codec, or NULL if the input is converted some other way
+ *
+ * The codec may be used directly in place of
+ * parserutils__filter_process_chunk. There is none while the output is
+ * normalised.
+ */
+parserutils_charset_codec *parserutils__filter_utf8_codec(
+		parserutils_filter *input)
+{
+	if (input->nfc != NULL)
+		return NULL;
 
-	return PARSERUTILS_OK;
+#ifndef WITHOUT_ICONV_FILTER
+	return input->native;
 #else
-	if (input->leftover) {
-		parserutils_error write_error;
-
-		/* Some data left to be written from last call */
-
-		/* Attempt to flush the remaining data. */
-		write_error = parserutils_charset_codec_encode(
-				input->write_codec,
-				(const uint8_t **) &input->pivot_left,
-				&input->pivot_len,
-				output, outlen);
-
-		if (write_error != PARSERUTILS_OK)
-			return write_error;
-
-
-		/* And clear leftover */
-		input->pivot_left = NULL;
-		input->pivot_len = 0;
-		input->leftover = false;
-	}
-
-	while (*len > 0) {
-		parserutils_error read_error, write_error;
-		size_t pivot_len = sizeof(input->pivot_buf);
-		uint8_t *pivot = (uint8_t *) input->pivot_buf;
+	if (input->utf8_out && input->read_codec->handler.decode_utf8 != NULL)
+		return input->read_codec;
 
-		read_error = parserutils_charset_codec_decode(input->read_codec,
-				data, len,
-				(uint8_t **) &pivot, &pivot_len);
-
-		pivot = (uint8_t *) input->pivot_buf;
-		pivot_len = sizeof(input->pivot_buf) - pivot_len;
-
-		if (pivot_len > 0) {
-			write_error = parserutils_charset_codec_encode(
-					input->write_codec,
-					(const uint8_t **) &pivot,
-					&pivot_len,
-					output, outlen);
+	return NULL;
+#endif
+}
 
-			if (write_error != PARSERUTILS_OK) {
-				input->leftover = true;
-				input->pivot_left = pivot;
-				input->pivot_len = pivot_len;
+/**
+ * Take another codec for a filter's input charset
+ *
+ * \param input  The input filter
+ * \param codec  Pointer to location to receive codec
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * The codec is in its initial state, and is independent of the filter's
+ * own, so may be used concurrently with it. It must be returned with
+ * parserutils__filter_codec_put.
+ */
+parserutils_error parserutils__filter_codec_get(parserutils_filter *input,
+		parserutils_charset_codec **codec)
+{
+	return filter_codec_create(input, input->settings.encoding, codec);
+}
 
-				return write_error;
-			}
-		}
+/**
+ * Return a codec taken by parserutils__filter_codec_get
+ *
+ * \param input  The input filter the codec was taken from
+ * \param codec  The codec
+ */
+void parserutils__filter_codec_put(parserutils_filter *input,
+		parserutils_charset_codec *codec)
+{
+	filter_codec_destroy(input, codec);
+}
 
-		if (read_error != PARSERUTILS_OK && 
-				read_error != PARSERUTILS_NOMEM)
-			return read_error;
-	}
+/**
+ * Count the replacement characters an input filter has emitted
+ *
+ * \param input  The input filter to consider
+ * \return Number of U+FFFD characters substituted for invalid input
+ *
+ * When the input is decoded by a native codec, rather than iconv, this
+ * also counts any U+FFFD characters present in the input.
+ */
+uint32_t parserutils__filter_replacements(parserutils_filter *input)
+{
+	return input->replacements;
+}
 
-	return PARSERUTILS_OK;
-#endif
+/**
+ * Determine whether an input filter holds output it has yet to emit
+ *
+ * \param input  The input filter to consider
+ * \return True if flushing the filter would produce output
+ *
+ * Only a normalising filter holds characters back, as characters in later
+ * input may combine with them.
+ */
+bool parserutils__filter_pending(parserutils_filter *input)
+{
+	return input->nfc != NULL && (input->nfc_len > 0 ||
+			parserutils__nfc_pending(input->nfc));
 }
 
 /**
@@ -314,13 +475,22 @@ parserutils_error parserutils__filter_reset(parserutils_filter *input)
 	if (input == NULL)
 		return PARSERUTILS_BADPARM;
 
+	if (input->nfc != NULL) {
+		parserutils__nfc_reset(input->nfc);
+		input->nfc_len = 0;
+	}
+
 #ifndef WITHOUT_ICONV_FILTER
-	iconv(input->cd, NULL, 0, NULL, 0);
+	if (input->native != NULL)
+		error = parserutils_charset_codec_reset(input->native);
+	else
+		iconv(input->cd, NULL, 0, NULL, 0);
 #else
 	/* Clear pivot buffer leftovers */
 	input->pivot_left = NULL;
 	input->pivot_len = 0;
 	input->leftover = false;
+	input->read_pending = false;
 
 	/* Reset read codec */
 	error = parserutils_charset_codec_reset(input->read_codec);
@@ -374,6 +544,9 @@ parserutils_error filter_set_encoding(parserutils_filter *input,
 {
 	parserutils_error error = PARSERUTILS_OK;
 	uint16_t mibenum;
+#ifdef WITHOUT_ICONV_FILTER
+	parserutils_charset_codec_optparams params;
+#endif
 
 	if (input == NULL || enc == NULL)
 		return PARSERUTILS_BADPARM;
@@ -387,28 +560,51 @@ parserutils_error filter_set_encoding(parserutils_filter *input,
 		return PARSERUTILS_OK;
 
 #ifndef WITHOUT_ICONV_FILTER
-	if (input->cd != (iconv_t) -1) {
-		iconv_close(input->cd);
-		input->cd = (iconv_t) -1;
+	if (input->cd != (iconv_t) -1)
+		filter_iconv_close(input);
+
+	if (input->native != NULL) {
+		filter_codec_destroy(input, input->native);
+		input->native = NULL;
 	}
 
-	input->cd = iconv_open(
-		parserutils_charset_mibenum_to_name(input->int_enc),
-		parserutils_charset_mibenum_to_name(mibenum));
-	if (input->cd == (iconv_t) -1) {
-		return (errno == EINVAL) ? PARSERUTILS_BADENCODING
-					 : PARSERUTILS_NOMEM;
+	/* Prefer a native codec which decodes straight to UTF-8 */
+	if (input->int_enc == MIB_UTF_8) {
+		error = filter_codec_create(input, mibenum, &input->native);
+		if (error == PARSERUTILS_NOMEM)
+			return error;
+
+		if (error == PARSERUTILS_OK &&
+				input->native->handler.decode_utf8 == NULL) {
+			filter_codec_destroy(input, input->native);
+			input->native = NULL;
+		}
+
+		error = PARSERUTILS_OK;
+
+		if (input->native != NULL) {
+			input->settings.encoding = mibenum;
+			return PARSERUTILS_OK;
+		}
 	}
+
+	error = filter_iconv_open(input, mibenum);
+	if (error != PARSERUTILS_OK)
+		return error;
 #else
 	if (input->read_codec != NULL) {
-		parserutils_charset_codec_destroy(input->read_codec);
+		filter_codec_destroy(input, input->read_codec);
 		input->read_codec = NULL;
 	}
 
-	error = parserutils_charset_codec_create(enc, input->alloc,
-			input->pw, &input->read_codec);
+	error = filter_codec_create(input, mibenum,
+			&input->read_codec);
 	if (error != PARSERUTILS_OK)
 		return error;
+
+	params.ucs4_order.order = PARSERUTILS_CHARSET_CODEC_UCS4_HOST;
+	parserutils_charset_codec_setopt(input->read_codec,
+			PARSERUTILS_CHARSET_CODEC_UCS4_ORDER, &params);
 #endif
 
 	input->settings.encoding = mibenum;
@@ -416,3 +612,768 @@ parserutils_error filter_set_encoding(parserutils_filter *input,
 	return error;
 
 }
+
+#ifdef WITHOUT_ICONV_FILTER
+/**
+ * Set the capacity of an input filter's pivot buffer
+ *
+ * \param input  Input filter to configure
+ * \param size   Capacity, in characters
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_INVALID if the pivot holds unwritten output,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ */
+parserutils_error filter_set_pivot_size(parserutils_filter *input,
+		size_t size)
+{
+	uint32_t *pivot;
+
+	if (size == 0 || size > SIZE_MAX / sizeof(uint32_t))
+		return PARSERUTILS_BADPARM;
+
+	if (input->leftover)
+		return PARSERUTILS_INVALID;
+
+	pivot = input->alloc(input->pivot_buf, size * sizeof(uint32_t),
+			input->pw);
+	if (pivot == NULL)
+		return PARSERUTILS_NOMEM;
+
+	input->pivot_buf = pivot;
+	input->pivot_size = size;
+
+	return PARSERUTILS_OK;
+}
+#endif
+
+/**
+ * Turn normalisation of an input filter's output on or off
+ *
+ * \param input  Input filter to configure
+ * \param nfc    Whether to normalise output to NFC
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_INVALID if the output isn't UTF-8, or normalisation is
+ *                             being turned off while data is held,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ */
+parserutils_error filter_set_normalise(parserutils_filter *input, bool nfc)
+{
+	parserutils_error error;
+
+	if (nfc == (input->nfc != NULL))
+		return PARSERUTILS_OK;
+
+	if (nfc == false) {
+		if (parserutils__filter_pending(input))
+			return PARSERUTILS_INVALID;
+
+		parserutils__nfc_destroy(input->nfc);
+		input->alloc(input->nfc_buf, 0, input->pw);
+		input->nfc = NULL;
+		input->nfc_buf = NULL;
+
+		return PARSERUTILS_OK;
+	}
+
+#ifndef WITHOUT_ICONV_FILTER
+	if (input->int_enc != MIB_UTF_8)
+#else
+	if (input->utf8_out == false)
+#endif
+		return PARSERUTILS_INVALID;
+
+	input->nfc_buf = input->alloc(NULL, NFC_BUFFER_SIZE, input->pw);
+	if (input->nfc_buf == NULL)
+		return PARSERUTILS_NOMEM;
+
+	error = parserutils__nfc_create(input->alloc, input->pw, &input->nfc);
+	if (error != PARSERUTILS_OK) {
+		input->alloc(input->nfc_buf, 0, input->pw);
+		input->nfc_buf = NULL;
+		return error;
+	}
+
+	input->nfc_len = 0;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Set the treatment of characters an input filter cannot write
+ *
+ * \param input  Input filter to configure
+ * \param mode   The fallback to use
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error filter_set_fallback(parserutils_filter *input,
+		parserutils_filter_fallback mode)
+{
+#ifdef WITHOUT_ICONV_FILTER
+	parserutils_charset_codec_optparams params;
+	parserutils_error error;
+#endif
+
+	switch (mode) {
+	case PARSERUTILS_FILTER_FALLBACK_LOOSE:
+	case PARSERUTILS_FILTER_FALLBACK_STRICT:
+	case PARSERUTILS_FILTER_FALLBACK_NCR:
+		break;
+	default:
+		return PARSERUTILS_BADPARM;
+	}
+
+#ifdef WITHOUT_ICONV_FILTER
+	/* The write codec substitutes for characters itself, unless strict,
+	 * when it stops at them for references to be written in their place */
+	params.error_mode.mode = (mode == PARSERUTILS_FILTER_FALLBACK_LOOSE)
+			? PARSERUTILS_CHARSET_CODEC_ERROR_LOOSE
+			: PARSERUTILS_CHARSET_CODEC_ERROR_STRICT;
+
+	error = parserutils_charset_codec_setopt(input->write_codec,
+			PARSERUTILS_CHARSET_CODEC_ERROR_MODE, &params);
+	if (error != PARSERUTILS_OK)
+		return error;
+#endif
+
+	input->settings.fallback = mode;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Convert a chunk of data to the filter's internal encoding
+ *
+ * \param input   Pointer to filter instance
+ * \param data    Pointer to pointer to input buffer
+ * \param len     Pointer to length of input buffer
+ * \param output  Pointer to pointer to output buffer
+ * \param outlen  Pointer to length of output buffer
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error filter_convert(parserutils_filter *input,
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen)
+{
+#ifndef WITHOUT_ICONV_FILTER
+	if (input->native != NULL) {
+		return parserutils__charset_codec_decode_utf8(input->native,
+				data, len, output, outlen,
+				&input->replacements);
+	}
+
+	/* When writing UTF-8 to another charset, flushing returns to the
+	 * initial shift state. Input charsets mustn't lose theirs */
+	if (*len == 0 && input->settings.encoding == MIB_UTF_8 &&
+			input->int_enc != MIB_UTF_8) {
+		if (iconv(input->cd, NULL, NULL,
+				(char **) output, outlen) == (size_t) -1)
+			return PARSERUTILS_NOMEM;
+
+		return PARSERUTILS_OK;
+	}
+
+	if (iconv(input->cd, (void *) data, len, 
+			(char **) output, outlen) == (size_t) -1) {
+		switch (errno) {
+		case E2BIG:
+			return PARSERUTILS_NOMEM;
+		case EILSEQ:
+			/* Rejected UTF-8 may be valid, but unrepresentable */
+			if (input->settings.encoding == MIB_UTF_8 &&
+					input->int_enc != MIB_UTF_8)
+				return filter_iconv_fallback(input, data, len,
+						output, outlen);
+
+			return filter_iconv_recover(input, data, len,
+					output, outlen);
+		}
+	}
+
+	return PARSERUTILS_OK;
+#else
+	if (input->leftover) {
+		parserutils_error write_error;
+
+		/* Some data left to be written from last call */
+
+		/* Attempt to flush the remaining data. */
+		write_error = filter_encode(input, &input->pivot_left,
+				&input->pivot_len, output, outlen);
+
+		if (write_error != PARSERUTILS_OK)
+			return write_error;
+
+
+		/* And clear leftover */
+		input->pivot_left = NULL;
+		input->pivot_len = 0;
+		input->leftover = false;
+	}
+
+	/* Some charsets can be decoded straight to UTF-8 */
+	if (input->utf8_out && input->read_codec->handler.decode_utf8 != NULL) {
+		return parserutils__charset_codec_decode_utf8(
+				input->read_codec, data, len, output, outlen,
+				&input->replacements);
+	}
+
+	/* The read codec may have decoded a character that didn't fit in
+	 * the pivot, even if all of the input has been consumed */
+	while (*len > 0 || input->read_pending) {
+		parserutils_error read_error, write_error;
+		size_t pivot_len = input->pivot_size * sizeof(uint32_t);
+		uint8_t *pivot = (uint8_t *) input->pivot_buf;
+		const uint32_t *ucs4;
+
+		read_error = parserutils_charset_codec_decode(input->read_codec,
+				data, len,
+				(uint8_t **) &pivot, &pivot_len);
+
+		input->read_pending = (read_error == PARSERUTILS_NOMEM);
+
+		pivot = (uint8_t *) input->pivot_buf;
+		pivot_len = input->pivot_size * sizeof(uint32_t) - pivot_len;
+
+		/* The codecs substitute U+FFFD for invalid input, so count
+		 * those that come out of the read codec */
+		for (ucs4 = input->pivot_buf; 
+				ucs4 < input->pivot_buf + pivot_len / 4; ucs4++) {
+			if (*ucs4 == 0xFFFD)
+				input->replacements++;
+		}
+
+		if (pivot_len > 0) {
+			write_error = filter_encode(input, &pivot, &pivot_len,
+					output, outlen);
+
+			if (write_error != PARSERUTILS_OK) {
+				input->leftover = true;
+				input->pivot_left = pivot;
+				input->pivot_len = pivot_len;
+
+				return write_error;
+			}
+		}
+
+		if (read_error != PARSERUTILS_OK && 
+				read_error != PARSERUTILS_NOMEM)
+			return read_error;
+	}
+
+	return PARSERUTILS_OK;
+#endif
+}
+
+/**
+ * Convert a chunk of data, and normalise the result to NFC
+ *
+ * \param input   Pointer to filter instance
+ * \param data    Pointer to pointer to input buffer
+ * \param len     Pointer to length of input buffer
+ * \param output  Pointer to pointer to output buffer
+ * \param outlen  Pointer to length of output buffer
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * The data is converted into a buffer of the filter's own, a piece at a
+ * time, and normalised from there into the output. As for conversion, an
+ * input length of 0 flushes the normaliser.
+ */
+parserutils_error filter_normalise(parserutils_filter *input,
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen)
+{
+	bool flush = (*len == 0);
+	parserutils_error error;
+	size_t converted;
+
+	do {
+		/* Convert no more than is likely to fit in the output, as
+		 * what isn't normalised must be moved up for next time. The
+		 * input is limited too, as iconv may look at all it's given */
+		size_t want = min(*outlen, NFC_BUFFER_SIZE);
+		const uint8_t *pending = input->nfc_buf;
+
+		converted = 0;
+
+		if (want > input->nfc_len) {
+			uint8_t *buf = input->nfc_buf + input->nfc_len;
+			size_t space = want - input->nfc_len;
+			size_t chunk = min(*len, space), rest = *len - chunk;
+
+			error = filter_convert(input, data, &chunk,
+					&buf, &space);
+			*len = chunk + rest;
+			if (error != PARSERUTILS_OK &&
+					error != PARSERUTILS_NOMEM)
+				return error;
+
+			converted = (buf - input->nfc_buf) - input->nfc_len;
+			input->nfc_len = buf - input->nfc_buf;
+		}
+
+		error = parserutils__nfc_process(input->nfc, &pending,
+				&input->nfc_len, output, outlen, flush);
+
+		/* Keep what wasn't normalised for next time */
+		memmove(input->nfc_buf, pending, input->nfc_len);
+
+		if (error != PARSERUTILS_OK)
+			return error;
+	} while (*len > 0 && converted > 0);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Write the numeric character reference for a character
+ *
+ * \param ucs4  The character
+ * \param ref   Buffer of at least 16 bytes, to receive the reference
+ * \return Length of the reference, in bytes
+ */
+size_t filter_ncr(uint32_t ucs4, char *ref)
+{
+	return snprintf(ref, 16, "&#%" PRIu32 ";", ucs4);
+}
+
+/**
+ * Create a codec for an input filter
+ *
+ * \param input    The input filter
+ * \param mibenum  MIB enum of codec's charset
+ * \param codec    Pointer to location to receive codec
+ * \return As for parserutils_charset_codec_create_mib
+ *
+ * The codec is taken from the filter's pool, if it has one.
+ */
+parserutils_error filter_codec_create(parserutils_filter *input,
+		uint16_t mibenum, parserutils_charset_codec **codec)
+{
+	if (input->pool != NULL)
+		return parserutils__charset_pool_get_codec(input->pool,
+				mibenum, codec);
+
+	return parserutils_charset_codec_create_mib(mibenum, input->alloc,
+			input->pw, codec);
+}
+
+/**
+ * Destroy a codec created by filter_codec_create
+ *
+ * \param input  The input filter
+ * \param codec  The codec to destroy
+ *
+ * The codec is returned to the filter's pool, if it has one.
+ */
+void filter_codec_destroy(parserutils_filter *input,
+		parserutils_charset_codec *codec)
+{
+	if (input->pool != NULL)
+		parserutils__charset_pool_put_codec(input->pool, codec);
+	else
+		parserutils_charset_codec_destroy(codec);
+}
+
+#ifndef WITHOUT_ICONV_FILTER
+/**
+ * Open an input filter's iconv descriptor
+ *
+ * \param input    The input filter
+ * \param mibenum  MIB enum of the charset to convert from
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADENCODING if the conversion is unsupported,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ *
+ * The descriptor is taken from the filter's pool, if it has one.
+ */
+parserutils_error filter_iconv_open(parserutils_filter *input,
+		uint16_t mibenum)
+{
+	/* Nothing is known of the new charset's bytes */
+	memset(input->byte_kind, BYTE_UNKNOWN, sizeof(input->byte_kind));
+
+	if (input->pool != NULL)
+		return parserutils__charset_pool_get_iconv(input->pool,
+				input->int_enc, mibenum, &input->cd);
+
+	input->cd = iconv_open(
+		parserutils_charset_mibenum_to_name(input->int_enc),
+		parserutils_charset_mibenum_to_name(mibenum));
+	if (input->cd == (iconv_t) -1) {
+		return (errno == EINVAL) ? PARSERUTILS_BADENCODING
+					 : PARSERUTILS_NOMEM;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Close an input filter's iconv descriptor
+ *
+ * \param input  The input filter, whose descriptor converts from the
+ *               charset in its settings
+ *
+ * The descriptor is returned to the filter's pool, if it has one.
+ */
+void filter_iconv_close(parserutils_filter *input)
+{
+	if (input->pool != NULL)
+		parserutils__charset_pool_put_iconv(input->pool,
+				input->int_enc, input->settings.encoding,
+				input->cd);
+	else
+		iconv_close(input->cd);
+
+	input->cd = (iconv_t) -1;
+}
+
+/**
+ * Replace input rejected by iconv, then carry on converting
+ *
+ * \param input   The input filter
+ * \param data    Pointer to pointer to input, at the first rejected byte
+ * \param len     Pointer to length of input
+ * \param output  Pointer to pointer to output buffer
+ * \param outlen  Pointer to length of output buffer
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM if the output buffer is full
+ *
+ * Each rejected byte is replaced by U+FFFD, and conversion resumes after
+ * it. Mislabelled documents consist largely of runs of bytes which either
+ * cannot start a character, or are characters by themselves; those are
+ * converted by filter_iconv_skip, rather than by asking iconv about each
+ * byte in turn.
+ */
+parserutils_error filter_iconv_recover(parserutils_filter *input,
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen)
+{
+	uint32_t replaced = input->replacements;
+	parserutils_error error = PARSERUTILS_OK;
+
+	while (*len > 0) {
+		/* The first byte was rejected, whatever it is */
+		if (*outlen < 3) {
+			error = PARSERUTILS_NOMEM;
+			break;
+		}
+
+		(*output)[0] = 0xef;
+		(*output)[1] = 0xbf;
+		(*output)[2] = 0xbd;
+
+		*output += 3;
+		*outlen -= 3;
+
+		input->replacements++;
+
+		(*data)++;
+		(*len)--;
+
+		error = filter_iconv_skip(input, data, len, output, outlen);
+		if (error != PARSERUTILS_OK || *len == 0)
+			break;
+
+		if (iconv(input->cd, (void *) data, len,
+				(char **) output, outlen) != (size_t) -1)
+			break;
+
+		if (errno != EILSEQ) {
+			if (errno == E2BIG)
+				error = PARSERUTILS_NOMEM;
+			break;
+		}
+	}
+
+	PARSERUTILS_TRACE(input->trace, FILTER_RECOVER,
+			input->replacements - replaced, *len);
+
+	return error;
+}
+
+/**
+ * Convert a run of bytes whose conversion doesn't depend on what follows
+ *
+ * \param input   The input filter
+ * \param data    Pointer to pointer to input
+ * \param len     Pointer to length of input
+ * \param output  Pointer to pointer to output buffer
+ * \param outlen  Pointer to length of output buffer
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM if the output buffer is full
+ *
+ * The run ends at the first byte which may start a longer sequence. Only
+ * bytes >= 0x80 are considered, as in ASCII-compatible charsets they do not
+ * shift into another state. The first time each is seen, iconv is asked to
+ * convert it alone, and the result is kept: it cannot start a character if
+ * that fails with EILSEQ, and is a character by itself if it succeeds.
+ */
+parserutils_error filter_iconv_skip(parserutils_filter *input,
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen)
+{
+	while (*len > 0 && **data >= 0x80) {
+		uint8_t c = **data - 0x80;
+		const uint8_t *out;
+		size_t n;
+
+		if (input->byte_kind[c] == BYTE_UNKNOWN)
+			filter_iconv_probe(input, **data);
+
+		if (input->byte_kind[c] == BYTE_INVALID) {
+			out = (const uint8_t *) "\xef\xbf\xbd";
+			n = 3;
+		} else if (input->byte_kind[c] == BYTE_SINGLE) {
+			out = input->byte_out[c];
+			n = input->byte_outlen[c];
+		} else {
+			break;
+		}
+
+		if (*outlen < n)
+			return PARSERUTILS_NOMEM;
+
+		memcpy(*output, out, n);
+		*output += n;
+		*outlen -= n;
+
+		if (input->byte_kind[c] == BYTE_INVALID)
+			input->replacements++;
+
+		(*data)++;
+		(*len)--;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Find out what iconv makes of a byte by itself
+ *
+ * \param input  The input filter
+ * \param byte   The byte to convert, which must be >= 0x80
+ */
+void filter_iconv_probe(parserutils_filter *input, uint8_t byte)
+{
+	uint8_t c = byte - 0x80, *out = input->byte_out[c];
+	char probe = (char) byte, *in = &probe;
+	size_t inlen = 1, outlen = sizeof(input->byte_out[c]);
+
+	if (iconv(input->cd, &in, &inlen, (char **) &out,
+			&outlen) != (size_t) -1) {
+		input->byte_kind[c] = BYTE_SINGLE;
+		input->byte_outlen[c] = sizeof(input->byte_out[c]) - outlen;
+	} else {
+		/* Anything else, including output too long to keep, may be
+		 * followed by more of its character */
+		input->byte_kind[c] = (errno == EILSEQ) ? BYTE_INVALID
+							: BYTE_LEAD;
+	}
+}
+
+/**
+ * Replace UTF-8 input which iconv cannot write, then carry on converting
+ *
+ * \param input   The input filter
+ * \param data    Pointer to pointer to input, at the rejected character
+ * \param len     Pointer to length of input
+ * \param output  Pointer to pointer to output buffer
+ * \param outlen  Pointer to length of output buffer
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM if the output buffer is full,
+ *         PARSERUTILS_INVALID if the fallback is strict, in which case the
+ *                             input is left at the character
+ *
+ * Invalid UTF-8 is replaced by U+FFFD, as by the codecs, which is itself
+ * then subject to the fallback if the output charset lacks it. Each
+ * replacement is written whole, or not at all.
+ *
+ * A call to iconv which fails takes time in proportion to all of the input
+ * it was given, so after each replacement, conversion resumes on a little
+ * of the input, and on twice as much each time that succeeds. Text with
+ * many unrepresentable characters would otherwise take quadratic time.
+ */
+parserutils_error filter_iconv_fallback(parserutils_filter *input,
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen)
+{
+	uint32_t replaced = input->replacements;
+	parserutils_error error = PARSERUTILS_OK;
+
+	while (*len > 0) {
+		size_t clen, reflen, window, ret;
+		char ref[16];
+		uint32_t ucs4;
+		bool written;
+
+		if (*outlen < FALLBACK_SPACE) {
+			error = PARSERUTILS_NOMEM;
+			break;
+		}
+
+		if (parserutils_charset_utf8_to_ucs4(*data, *len,
+				&ucs4, &clen) != PARSERUTILS_OK) {
+			/* Skip the first byte, and any continuing it */
+			for (clen = 1; clen < min(*len, 4) &&
+					((*data)[clen] & 0xC0) == 0x80; clen++)
+				;
+
+			ucs4 = 0xFFFD;
+		}
+
+		written = (ucs4 == 0xFFFD && filter_iconv_write(input,
+				"\xef\xbf\xbd", 3, output, outlen));
+
+		if (written == false) {
+			if (input->settings.fallback ==
+					PARSERUTILS_FILTER_FALLBACK_STRICT) {
+				error = PARSERUTILS_INVALID;
+				break;
+			}
+
+			if (input->settings.fallback ==
+					PARSERUTILS_FILTER_FALLBACK_NCR) {
+				reflen = filter_ncr(ucs4, ref);
+			} else {
+				ref[0] = '?';
+				reflen = 1;
+			}
+
+			if (filter_iconv_write(input, ref, reflen,
+					output, outlen) == false) {
+				error = PARSERUTILS_INVALID;
+				break;
+			}
+		}
+
+		input->replacements++;
+
+		*data += clen;
+		*len -= clen;
+
+		for (window = FALLBACK_WINDOW; *len > 0; window *= 2) {
+			size_t chunk = min(*len, window), rest = *len - chunk;
+
+			ret = iconv(input->cd, (void *) data, &chunk,
+					(char **) output, outlen);
+			*len = chunk + rest;
+
+			/* A character may continue past the window */
+			if (ret == (size_t) -1 && (errno != EINVAL || rest == 0))
+				break;
+		}
+
+		if (*len == 0 || errno != EILSEQ) {
+			if (*len > 0 && errno == E2BIG)
+				error = PARSERUTILS_NOMEM;
+			break;
+		}
+	}
+
+	PARSERUTILS_TRACE(input->trace, FILTER_RECOVER,
+			input->replacements - replaced, *len);
+
+	return error;
+}
+
+/**
+ * Write some UTF-8 text in place of a character iconv has rejected
+ *
+ * \param input    The input filter
+ * \param text     The text to write
+ * \param textlen  Length of text, in bytes
+ * \param output   Pointer to pointer to output buffer
+ * \param outlen   Pointer to length of output buffer
+ * \return True if all of the text was written, false if none was
+ */
+bool filter_iconv_write(parserutils_filter *input,
+		const char *text, size_t textlen,
+		uint8_t **output, size_t *outlen)
+{
+	uint8_t *out = *output;
+	size_t space = *outlen;
+	char *in = (char *) text;
+
+	if (iconv(input->cd, &in, &textlen, (char **) &out,
+			&space) == (size_t) -1)
+		return false;
+
+	*output = out;
+	*outlen = space;
+
+	return true;
+}
+#else
+/**
+ * Write pivot characters with a filter's write codec, applying its fallback
+ *
+ * \param input      The input filter
+ * \param pivot      Pointer to pointer to characters, in host byte order
+ * \param pivot_len  Pointer to length of characters, in bytes
+ * \param output     Pointer to pointer to output buffer
+ * \param outlen     Pointer to length of output buffer
+ * \return As for parserutils_charset_codec_encode
+ *
+ * Codecs only stop at characters they cannot write when strict, so the
+ * filter writes references in place of those where they do.
+ */
+parserutils_error filter_encode(parserutils_filter *input,
+		uint8_t **pivot, size_t *pivot_len,
+		uint8_t **output, size_t *outlen)
+{
+	parserutils_error error;
+
+	while (true) {
+		error = parserutils_charset_codec_encode(input->write_codec,
+				(const uint8_t **) pivot, pivot_len,
+				output, outlen);
+		if (error != PARSERUTILS_INVALID || input->settings.fallback !=
+				PARSERUTILS_FILTER_FALLBACK_NCR)
+			return error;
+
+		error = filter_encode_ncr(input, *(const uint32_t *) *pivot,
+				output, outlen);
+		if (error != PARSERUTILS_OK)
+			return error;
+
+		input->replacements++;
+
+		*pivot += 4;
+		*pivot_len -= 4;
+	}
+}
+
+/**
+ * Write the numeric character reference for a character the write codec
+ * has rejected
+ *
+ * \param input   The input filter
+ * \param ucs4    The character
+ * \param output  Pointer to pointer to output buffer
+ * \param outlen  Pointer to length of output buffer
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM if the output buffer is full, in which case
+ *                           none of the reference is written
+ */
+parserutils_error filter_encode_ncr(parserutils_filter *input,
+		uint32_t ucs4, uint8_t **output, size_t *outlen)
+{
+	uint32_t chars[16];
+	const uint8_t *src = (const uint8_t *) chars;
+	size_t len, i;
+	char ref[16];
+
+	if (*outlen < FALLBACK_SPACE)
+		return PARSERUTILS_NOMEM;
+
+	len = filter_ncr(ucs4, ref);
+	for (i = 0; i < len; i++)
+		chars[i] = (uint8_t) ref[i];
+
+	len *= 4;
+
+	return parserutils_charset_codec_encode(input->write_codec,
+			&src, &len, output, outlen);
+}
+#endif
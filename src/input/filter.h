@@ -9,9 +9,13 @@
 #define parserutils_input_filter_h_
 
 #include <inttypes.h>
+#include <stdbool.h>
 
 #include <parserutils/errors.h>
 #include <parserutils/functypes.h>
+#include <parserutils/charset/codec.h>
+#include <parserutils/charset/pool.h>
+#include <parserutils/trace.h>
 
 typedef struct parserutils_filter parserutils_filter;
 
@@ -19,9 +23,25 @@ typedef struct parserutils_filter parserutils_filter;
  * Input filter option types
  */
 typedef enum parserutils_filter_opttype {
-	PARSERUTILS_FILTER_SET_ENCODING       = 0
+	PARSERUTILS_FILTER_SET_ENCODING       = 0,
+	PARSERUTILS_FILTER_SET_PIVOT_SIZE     = 1,
+	PARSERUTILS_FILTER_SET_TRACE          = 2,
+	PARSERUTILS_FILTER_SET_NORMALISE      = 3,
+	PARSERUTILS_FILTER_SET_FALLBACK       = 4
 } parserutils_filter_opttype;
 
+/**
+ * Treatment of UTF-8 input which the output charset cannot represent
+ */
+typedef enum parserutils_filter_fallback {
+	/** Replace the character with '?', or U+FFFD if that's written */
+	PARSERUTILS_FILTER_FALLBACK_LOOSE  = 0,
+	/** Stop, reporting PARSERUTILS_INVALID */
+	PARSERUTILS_FILTER_FALLBACK_STRICT = 1,
+	/** Replace the character with a numeric character reference */
+	PARSERUTILS_FILTER_FALLBACK_NCR    = 2
+} parserutils_filter_fallback;
+
 /**
  * Input filter option parameters
  */
@@ -31,12 +51,40 @@ typedef union parserutils_filter_optparams {
 		/** Encoding name */
 		const char *name;
 	} encoding;
+
+	/** Parameters for pivot buffer sizing */
+	struct {
+		/** Capacity of pivot buffer, in characters */
+		size_t size;
+	} pivot;
+
+	/** Parameters for trace hook setting */
+	struct {
+		/** Hook, which must outlive the filter, or NULL for none */
+		const parserutils_trace *hook;
+	} trace;
+
+	/** Parameters for normalisation */
+	struct {
+		/** Whether to normalise output to NFC */
+		bool nfc;
+	} normalise;
+
+	/** Parameters for fallback setting */
+	struct {
+		/** Treatment of unrepresentable characters */
+		parserutils_filter_fallback mode;
+	} fallback;
 } parserutils_filter_optparams;
 
 
 /* Create an input filter */
 parserutils_error parserutils__filter_create(const char *int_enc,
 		parserutils_alloc alloc, void *pw, parserutils_filter **filter);
+/* Create an input filter which takes its converters from a pool */
+parserutils_error parserutils__filter_create_pooled(const char *int_enc,
+		parserutils_charset_pool *pool,
+		parserutils_alloc alloc, void *pw, parserutils_filter **filter);
 /* Destroy an input filter */
 parserutils_error parserutils__filter_destroy(parserutils_filter *input);
 
@@ -50,6 +98,21 @@ parserutils_error parserutils__filter_process_chunk(parserutils_filter *input,
 		const uint8_t **data, size_t *len,
 		uint8_t **output, size_t *outlen);
 
+/* Find the codec decoding a filter's input straight to UTF-8, if any */
+parserutils_charset_codec *parserutils__filter_utf8_codec(
+		parserutils_filter *input);
+/* Take another codec for a filter's input charset */
+parserutils_error parserutils__filter_codec_get(parserutils_filter *input,
+		parserutils_charset_codec **codec);
+/* Return a codec taken by parserutils__filter_codec_get */
+void parserutils__filter_codec_put(parserutils_filter *input,
+		parserutils_charset_codec *codec);
+
+/* Count the replacement characters an input filter has emitted */
+uint32_t parserutils__filter_replacements(parserutils_filter *input);
+/* Determine whether an input filter holds output it has yet to emit */
+bool parserutils__filter_pending(parserutils_filter *input);
+
 /* Reset an input filter's state */
 parserutils_error parserutils__filter_reset(parserutils_filter *input);
 
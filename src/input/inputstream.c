@@ -13,9 +13,140 @@
 #include <parserutils/charset/utf8.h>
 #include <parserutils/input/inputstream.h>
 
+#include "charset/aliases.h"
+#include "charset/bom.h"
+#include "charset/codecs/codec_impl.h"
+#include "charset/encodings/utf8impl.h"
+#include "input/cache.h"
 #include "input/filter.h"
+#include "input/mapping.h"
+#include "utils/simd.h"
+#include "utils/trace.h"
 #include "utils/utils.h"
 
+/**
+ * Part of the raw data, decoded by a task during a parallel refill
+ */
+typedef struct parserutils_inputstream_segment {
+	const uint8_t *data;		/**< Raw data remaining to decode */
+	size_t len;			/**< Length of raw data remaining */
+
+	uint8_t *output;		/**< Start of output region */
+	size_t space;			/**< Size of output region */
+	size_t written;			/**< Length of output */
+
+	parserutils_charset_codec *codec; /**< Codec, or NULL for UTF-8 */
+	uint32_t replacements;		/**< U+FFFD substituted */
+	parserutils_error error;	/**< Result of decoding */
+} parserutils_inputstream_segment;
+
+/**
+ * How raw data in the stream's charset may be split for parallel decoding
+ */
+typedef enum parserutils_inputstream_split {
+	SPLIT_NONE,			/**< Not at all */
+	SPLIT_BYTE,			/**< Anywhere; single-byte charset */
+	SPLIT_UTF8,			/**< Before a UTF-8 start byte */
+	SPLIT_UTF16BE,			/**< Between UTF-16 characters */
+	SPLIT_UTF16LE,
+	SPLIT_UTF32			/**< Between UTF-32 code units */
+} parserutils_inputstream_split;
+
+/** Length the raw data is made up to from lent segments, where a segment
+ * ends with part of a character */
+#define STITCH_LENGTH (64)
+/** Smallest ring of lent segments */
+#define BORROWED_MIN (8)
+
+#define PARALLEL_SEGMENT (64 * 1024)
+#define PARALLEL_MIN_SEGMENT (16)
+#define PARALLEL_TASKS (8)
+/* Space for output the filter's codec has buffered, or for completing a
+ * character it has begun */
+#define PARALLEL_SLACK (64)
+
+#define PIPELINE_SEGMENT (32 * 1024)
+#define PIPELINE_MIN_SEGMENT (16)
+
+#if defined(__GNUC__)
+/* A task publishes its results with a release store of its state, which
+ * the stream reads with an acquire load */
+#define PIPELINE_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define PIPELINE_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define WITHOUT_PIPELINE
+#endif
+
+/** Most starts of decoded output to remember, ahead of the cursor */
+#define CHECKPOINTS (32)
+
+/**
+ * How decoded output relates to the raw data it was decoded from
+ */
+typedef enum parserutils_inputstream_origin {
+	ORIGIN_UNKNOWN,			/**< Not character by character */
+	ORIGIN_BYTES,			/**< One raw byte per UTF-8 byte */
+	ORIGIN_CHARS,			/**< One raw byte per character */
+	ORIGIN_UTF16,			/**< Two raw bytes per UTF-16 unit */
+	ORIGIN_UTF32			/**< Four raw bytes per character */
+} parserutils_inputstream_origin;
+
+/**
+ * Start of the output of a refill, which the cursor has yet to reach
+ */
+typedef struct parserutils_inputstream_checkpoint {
+	size_t offset;			/**< UTF-8 offset of the output */
+	size_t source;			/**< Raw offset it was decoded from */
+	parserutils_inputstream_origin origin; /**< How it was decoded */
+} parserutils_inputstream_checkpoint;
+
+/**
+ * Position to which the cursor may be rewound
+ */
+typedef struct parserutils_inputstream_marker {
+	size_t offset;			/**< UTF-8 offset of the cursor */
+	parserutils_inputstream_pos pos; /**< Position counted up to */
+	parserutils_inputstream_origin origin; /**< How the data after pos
+					 * was decoded */
+	uint32_t next_checkpoint;	/**< First checkpoint after pos */
+} parserutils_inputstream_marker;
+
+/** States of the pipeline's task */
+#define PIPELINE_IDLE (0)		/**< Not started */
+#define PIPELINE_BUSY (1)		/**< Submitted, and not finished */
+#define PIPELINE_DONE (2)		/**< Finished, with results to use */
+
+/**
+ * Decoding ahead of the reader, by a task in the background
+ *
+ * There is at most one task at a time, since decoding must continue from
+ * the state the last left the filter in. While it runs, it owns the fields
+ * below, and the filter; the stream hands them over when submitting it,
+ * and takes them back when the task's state becomes PIPELINE_DONE.
+ */
+typedef struct parserutils_inputstream_pipeline {
+	parserutils_submit_task submit;	/**< Function starting tasks */
+	void (*wait)(void *pw);		/**< Function called while waiting,
+					 * or NULL */
+	void *pw;			/**< Client private data */
+	size_t segment;			/**< Raw bytes decoded by each task */
+
+	parserutils_buffer *in;		/**< Copy of the raw data given */
+	parserutils_buffer *out;	/**< Output, swapped with the stream's
+					 * UTF-8 buffer when that's read */
+
+	const uint8_t *data;		/**< Raw data remaining to decode */
+	size_t len;			/**< Length of raw data remaining */
+	uint8_t *output;		/**< Next byte of output */
+	size_t space;			/**< Space remaining for output */
+	bool eof;			/**< Whether the data ends the input */
+	uint32_t replacements;		/**< U+FFFD substituted */
+	uint32_t filter_replacements;	/**< Filter's count, when started */
+	parserutils_error error;	/**< Result of decoding */
+
+	uint32_t state;			/**< State of the task */
+} parserutils_inputstream_pipeline;
+
 /**
  * Private input stream definition
  */
@@ -24,13 +155,92 @@ typedef struct parserutils_inputstream_private {
 
 	parserutils_buffer *raw;	/**< Buffer containing raw data */
 
+	parserutils_inputstream_iov *borrowed; /**< Ring of lent segments,
+					 * following the raw buffer's data */
+	uint32_t borrowed_alloc;	/**< Size of ring, a power of 2 */
+	uint32_t borrowed_first;	/**< Index of first lent segment */
+	uint32_t borrowed_count;	/**< Number of lent segments */
+	size_t borrowed_offset;		/**< Bytes consumed of the first */
+	size_t borrowed_length;		/**< Lent bytes remaining */
+	size_t stitched;		/**< Bytes at the end of the raw buffer
+					 * copied from the first lent segment */
+
+	parserutils_mapping *file;	/**< Mapped input file, or NULL */
+	size_t file_offset;		/**< Offset of unconsumed file data */
+
 	bool done_first_chunk;		/**< Whether the first chunk has 
 					 * been processed */
+	bool passthrough;		/**< Whether raw data is UTF-8, so
+					 * needs validating, not converting */
+	bool normalise;			/**< Whether decoded data is
+					 * normalised to NFC */
+
+	size_t raw_limit;		/**< Maximum raw data length, or 0 */
+	size_t utf8_limit;		/**< Maximum UTF-8 buffer size, or 0 */
+
+	size_t retain_limit;		/**< Maximum decoded raw data to keep */
+	size_t raw_retained;		/**< Length of decoded data kept at the
+					 * start of the raw buffer */
+	bool restartable;		/**< Whether all decoded raw data has
+					 * been kept */
 
 	uint16_t mibenum;		/**< MIB enum for charset, or 0 */
 	uint32_t encsrc;		/**< Charset source */
 
 	parserutils_filter *input;	/**< Charset conversion filter */
+	uint32_t phase;			/**< Raw bytes decoded since decoding
+					 * began, modulo 4 */
+
+	parserutils_run_tasks run;	/**< Task runner for parallel
+					 * decoding, or NULL */
+	void *run_pw;			/**< Client private data for run */
+	size_t segment;			/**< Raw bytes decoded by each task */
+	uint32_t tasks;			/**< Maximum tasks per refill */
+	parserutils_inputstream_segment *segments; /**< Task storage */
+
+	parserutils_inputstream_pipeline *pipeline; /**< Decoding ahead, or
+					 * NULL */
+
+	parserutils_trace trace;	/**< Trace hook */
+
+	parserutils_decode_cache *cache; /**< Cache of decoded documents, or
+					 * NULL */
+	bool cache_check;		/**< Whether the next refill may use
+					 * the cache */
+
+	size_t utf8_offset;		/**< UTF-8 offset of the start of the
+					 * UTF-8 buffer, modulo SIZE_MAX + 1 */
+	size_t raw_offset;		/**< Raw bytes consumed */
+	parserutils_inputstream_pos pos; /**< Position counted up to */
+	parserutils_inputstream_origin origin; /**< How the data after pos
+					 * was decoded */
+	parserutils_inputstream_checkpoint checkpoints[CHECKPOINTS];
+					/**< Later starts of output, in order */
+	uint32_t n_checkpoints;		/**< Number of checkpoints */
+	uint32_t next_checkpoint;	/**< First checkpoint after pos, with
+					 * those before kept while marked */
+	size_t raw_mapped;		/**< Raw offset of the end of the last
+					 * refill's output, if known */
+	bool mapped;			/**< Whether raw_mapped is known */
+
+	parserutils_inputstream_marker marks[
+			PARSERUTILS_INPUTSTREAM_MAX_MARKS]; /**< Marks, outermost
+					 * first, keeping data from being
+					 * discarded */
+	uint32_t n_marks;		/**< Number of marks */
+
+	uint32_t peek_slow_calls;	/**< Calls to peek_slow */
+	uint32_t refills;		/**< Calls to refill_buffer */
+	uint64_t decoded;		/**< Raw bytes decoded */
+	uint32_t replacements;		/**< U+FFFD emitted in passthrough */
+
+	parserutils_inputstream_replacement *replaced; /**< Replacements
+					 * recorded, in order of offset */
+	size_t n_replaced;		/**< Number recorded */
+	size_t replaced_alloc;		/**< Number there is room for */
+	size_t replaced_limit;		/**< Maximum number to record */
+	bool replaced_nomem;		/**< Whether recording ran out of
+					 * memory */
 
 	parserutils_charset_detect_func csdetect; /**< Charset detection func.*/
 
@@ -40,8 +250,92 @@ typedef struct parserutils_inputstream_private {
 
 static inline parserutils_error parserutils_inputstream_refill_buffer(
 		parserutils_inputstream_private *stream);
-static inline parserutils_error parserutils_inputstream_strip_bom(
-		uint16_t *mibenum, parserutils_buffer *buffer);
+static inline parserutils_error parserutils_inputstream_start_decoding(
+		parserutils_inputstream_private *stream);
+static inline parserutils_error parserutils_inputstream_restart(
+		parserutils_inputstream_private *stream);
+static parserutils_error parserutils_inputstream_cache_decode(
+		parserutils_inputstream_private *stream, bool *done);
+static inline parserutils_error parserutils_inputstream_open_gap(
+		parserutils_inputstream_private *stream, size_t len);
+static inline size_t parserutils_inputstream_strip_bom(
+		uint16_t *mibenum, const uint8_t *data, size_t len);
+static inline void parserutils_inputstream_raw_data(
+		parserutils_inputstream_private *stream,
+		const uint8_t **data, size_t *len);
+static inline bool parserutils_inputstream_raw_final(
+		parserutils_inputstream_private *stream, size_t len);
+static parserutils_error parserutils_inputstream_borrowed_reserve(
+		parserutils_inputstream_private *stream, uint32_t n);
+static void parserutils_inputstream_release_first(
+		parserutils_inputstream_private *stream);
+static void parserutils_inputstream_release_all(
+		parserutils_inputstream_private *stream);
+static void parserutils_inputstream_flatten(
+		parserutils_inputstream_private *stream);
+static parserutils_error parserutils_inputstream_stitch(
+		parserutils_inputstream_private *stream, size_t want);
+static inline parserutils_error parserutils_inputstream_consume_raw(
+		parserutils_inputstream_private *stream, size_t len);
+static inline size_t parserutils_inputstream_span_length(
+		const uint8_t *data, size_t len);
+static inline bool parserutils_inputstream_steal_raw(
+		parserutils_inputstream_private *stream);
+static inline size_t parserutils_inputstream_utf8_valid_length(
+		const uint8_t *data, size_t len, bool *truncated);
+static inline size_t parserutils_inputstream_invalid_length(
+		const uint8_t *data, size_t len);
+static inline parserutils_error parserutils_inputstream_copy_utf8(
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen,
+		bool eof, uint32_t *replacements);
+static inline parserutils_inputstream_split
+		parserutils_inputstream_split_kind(
+		parserutils_inputstream_private *stream);
+static inline size_t parserutils_inputstream_split_bound(
+		parserutils_inputstream_split kind, size_t len);
+static inline size_t parserutils_inputstream_split_point(
+		parserutils_inputstream_split kind, uint32_t phase,
+		const uint8_t *data, size_t len, size_t off);
+static inline size_t parserutils_inputstream_parallel_space(
+		parserutils_inputstream_private *stream, size_t raw_length);
+static parserutils_error parserutils_inputstream_decode_parallel(
+		parserutils_inputstream_private *stream,
+		const uint8_t **raw, size_t *raw_length,
+		uint8_t **utf8, size_t *utf8_space);
+static void parserutils_inputstream_decode_segment(void *ctx, size_t index);
+static parserutils_error parserutils_inputstream_pipeline_set(
+		parserutils_inputstream_private *stream,
+		const parserutils_inputstream_optparams *params);
+static void parserutils_inputstream_pipeline_start(
+		parserutils_inputstream_private *stream);
+static void parserutils_inputstream_pipeline_wait(
+		parserutils_inputstream_private *stream);
+static parserutils_error parserutils_inputstream_pipeline_collect(
+		parserutils_inputstream_private *stream, bool *collected);
+static void parserutils_inputstream_pipeline_task(void *ctx, size_t index);
+static void parserutils_inputstream_reset_position(
+		parserutils_inputstream_private *stream);
+static void parserutils_inputstream_count(
+		parserutils_inputstream_private *stream);
+static void parserutils_inputstream_count_span(
+		parserutils_inputstream_private *stream,
+		const uint8_t *data, size_t len);
+static size_t parserutils_inputstream_rebase(
+		parserutils_inputstream_private *stream);
+static parserutils_inputstream_origin parserutils_inputstream_origin_of(
+		parserutils_inputstream_private *stream, bool replaced);
+static inline size_t parserutils_inputstream_origin_width(
+		parserutils_inputstream_origin origin, size_t len,
+		size_t chars, size_t four);
+static void parserutils_inputstream_checkpoint_add(
+		parserutils_inputstream_private *stream, size_t offset,
+		size_t source, parserutils_inputstream_origin origin,
+		const uint8_t *data, size_t len);
+static void parserutils_inputstream_index_replacements(
+		parserutils_inputstream_private *stream, size_t offset,
+		size_t source, const uint8_t *raw, size_t raw_len,
+		const uint8_t *data, size_t len);
 
 /**
  * Create an input stream
@@ -65,6 +359,32 @@ parserutils_error parserutils_inputstream_create(const char *enc,
 		uint32_t encsrc, parserutils_charset_detect_func csdetect,
 		parserutils_alloc alloc, void *pw,
 		parserutils_inputstream **stream)
+{
+	return parserutils_inputstream_create_pooled(enc, encsrc, csdetect,
+			NULL, alloc, pw, stream);
+}
+
+/**
+ * Create an input stream which takes its charset converters from a pool
+ *
+ * \param enc       Document charset, or NULL to autodetect
+ * \param encsrc    Value for encoding source, if specified, or 0
+ * \param csdetect  Charset detection function, or NULL
+ * \param pool      Pool of charset converters, or NULL for none
+ * \param alloc     Memory (de)allocation function
+ * \param pw        Pointer to client-specific private data (may be NULL)
+ * \param stream    Pointer to location to receive stream instance
+ * \return As for parserutils_inputstream_create
+ *
+ * This behaves exactly as parserutils_inputstream_create, except that the
+ * stream's converters are returned to the pool when it no longer needs
+ * them, for reuse by later streams. The pool must outlive the stream.
+ */
+parserutils_error parserutils_inputstream_create_pooled(const char *enc,
+		uint32_t encsrc, parserutils_charset_detect_func csdetect,
+		parserutils_charset_pool *pool,
+		parserutils_alloc alloc, void *pw,
+		parserutils_inputstream **stream)
 {
 	parserutils_inputstream_private *s;
 	parserutils_error error;
@@ -89,11 +409,59 @@ parserutils_error parserutils_inputstream_create(const char *enc,
 		return error;
 	}
 
+	s->file = NULL;
+	s->file_offset = 0;
+
+	s->borrowed = NULL;
+	s->borrowed_alloc = 0;
+	s->borrowed_first = 0;
+	s->borrowed_count = 0;
+	s->borrowed_offset = 0;
+	s->borrowed_length = 0;
+	s->stitched = 0;
+
+	s->raw_limit = 0;
+	s->utf8_limit = 0;
+
+	s->retain_limit = 0;
+	s->raw_retained = 0;
+	s->restartable = false;
+
+	s->trace.func = NULL;
+	s->trace.pw = NULL;
+
+	s->cache = NULL;
+	s->cache_check = false;
+
+	parserutils_inputstream_reset_position(s);
+
+	s->peek_slow_calls = 0;
+	s->refills = 0;
+	s->decoded = 0;
+	s->replacements = 0;
+
+	s->replaced = NULL;
+	s->n_replaced = 0;
+	s->replaced_alloc = 0;
+	s->replaced_limit = 0;
+	s->replaced_nomem = false;
+
+	s->phase = 0;
+	s->run = NULL;
+	s->run_pw = NULL;
+	s->segment = 0;
+	s->tasks = 0;
+	s->segments = NULL;
+	s->pipeline = NULL;
+
 	s->public.cursor = 0;
 	s->public.had_eof = false;
 	s->done_first_chunk = false;
+	s->passthrough = false;
+	s->normalise = false;
 
-	error = parserutils__filter_create("UTF-8", alloc, pw, &s->input);
+	error = parserutils__filter_create_pooled("UTF-8", pool, alloc, pw,
+			&s->input);
 	if (error != PARSERUTILS_OK) {
 		parserutils_buffer_destroy(s->public.utf8);
 		parserutils_buffer_destroy(s->raw);
@@ -139,6 +507,59 @@ parserutils_error parserutils_inputstream_create(const char *enc,
 	return PARSERUTILS_OK;
 }
 
+/**
+ * Create an input stream reading from a file
+ *
+ * \param path      Path of file to read
+ * \param enc       Document charset, or NULL to autodetect
+ * \param encsrc    Value for encoding source, if specified, or 0
+ * \param csdetect  Charset detection function, or NULL
+ * \param alloc     Memory (de)allocation function
+ * \param pw        Pointer to client-specific private data (may be NULL)
+ * \param stream    Pointer to location to receive stream instance
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhaustion,
+ *         PARSERUTILS_BADENCODING on unsupported encoding,
+ *         PARSERUTILS_FILENOTFOUND if the file cannot be read
+ *
+ * The file is mapped into memory, where possible, and decoded directly from
+ * the mapping, rather than being copied into the stream. The file forms the
+ * entirety of the stream's input, so EOF is flagged immediately and no
+ * further data may be appended. Data may still be inserted.
+ */
+parserutils_error parserutils_inputstream_create_from_file(const char *path,
+		const char *enc, uint32_t encsrc,
+		parserutils_charset_detect_func csdetect,
+		parserutils_alloc alloc, void *pw,
+		parserutils_inputstream **stream)
+{
+	parserutils_inputstream *s;
+	parserutils_mapping *file;
+	parserutils_error error;
+
+	if (path == NULL || alloc == NULL || stream == NULL)
+		return PARSERUTILS_BADPARM;
+
+	error = parserutils_inputstream_create(enc, encsrc, csdetect,
+			alloc, pw, &s);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	error = parserutils__mapping_create(path, alloc, pw, &file);
+	if (error != PARSERUTILS_OK) {
+		parserutils_inputstream_destroy(s);
+		return error;
+	}
+
+	((parserutils_inputstream_private *) s)->file = file;
+	s->had_eof = true;
+
+	*stream = s;
+
+	return PARSERUTILS_OK;
+}
+
 /**
  * Destroy an input stream
  *
@@ -154,462 +575,3158 @@ parserutils_error parserutils_inputstream_destroy(
 	if (stream == NULL)
 		return PARSERUTILS_BADPARM;
 
+	if (s->pipeline != NULL) {
+		parserutils_inputstream_pipeline_wait(s);
+		parserutils_buffer_destroy(s->pipeline->in);
+		parserutils_buffer_destroy(s->pipeline->out);
+		s->alloc(s->pipeline, 0, s->pw);
+	}
+
+	parserutils_inputstream_release_all(s);
+	if (s->borrowed != NULL)
+		s->alloc(s->borrowed, 0, s->pw);
+
+	if (s->file != NULL)
+		parserutils__mapping_destroy(s->file);
 	parserutils__filter_destroy(s->input);
 	parserutils_buffer_destroy(s->public.utf8);
 	parserutils_buffer_destroy(s->raw);
+	if (s->segments != NULL)
+		s->alloc(s->segments, 0, s->pw);
+	if (s->replaced != NULL)
+		s->alloc(s->replaced, 0, s->pw);
 	s->alloc(s, 0, s->pw);
 
 	return PARSERUTILS_OK;
 }
 
 /**
- * Append data to an input stream
+ * Reset an input stream, to read another document
  *
- * \param stream  Input stream to append data to
- * \param data    Data to append (in document charset), or NULL to flag EOF
- * \param len     Length, in bytes, of data
- * \return PARSERUTILS_OK on success, appropriate error otherwise
+ * \param stream    Input stream to reset
+ * \param enc       Document charset, or NULL to autodetect
+ * \param encsrc    Value for encoding source, if specified, or 0
+ * \param csdetect  Charset detection function, or NULL
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhaustion,
+ *         PARSERUTILS_BADENCODING on unsupported encoding
+ *
+ * All data in the stream is discarded, along with its marks and position,
+ * and any lent data released, leaving it as if newly created with the
+ * given charset. Its options and the memory it has allocated are kept, so
+ * documents read one after another need no allocation once the buffers
+ * have grown to suit them, and no new converter while their charset stays
+ * the same. A stream created from a file is left taking appended data.
+ * The performance counters are not reset, and cover every document read.
  */
-parserutils_error parserutils_inputstream_append(
-		parserutils_inputstream *stream, 
-		const uint8_t *data, size_t len)
+parserutils_error parserutils_inputstream_reset(
+		parserutils_inputstream *stream,
+		const char *enc, uint32_t encsrc,
+		parserutils_charset_detect_func csdetect)
 {
-	parserutils_inputstream_private *s = 
+	parserutils_inputstream_private *s =
 			(parserutils_inputstream_private *) stream;
+	parserutils_error error;
+	uint16_t mibenum = 0;
 
 	if (stream == NULL)
 		return PARSERUTILS_BADPARM;
 
-	if (data == NULL) {
-		s->public.had_eof = true;
-		return PARSERUTILS_OK;
+	if (enc != NULL) {
+		mibenum = parserutils_charset_mibenum_from_name(enc,
+				strlen(enc));
+		if (mibenum == 0)
+			return PARSERUTILS_BADENCODING;
 	}
 
-	return parserutils_buffer_append(s->raw, data, len);
-}
+	/* Discard anything decoded ahead */
+	if (s->pipeline != NULL) {
+		parserutils_inputstream_pipeline_wait(s);
+		s->pipeline->state = PIPELINE_IDLE;
+		s->pipeline->in->length = 0;
+		s->pipeline->out->length = 0;
+	}
 
-/**
- * Insert data into stream at current location
- *
- * \param stream  Input stream to insert into
- * \param data    Data to insert (UTF-8 encoded)
- * \param len     Length, in bytes, of data
- * \return PARSERUTILS_OK on success, appropriate error otherwise
- */
-parserutils_error parserutils_inputstream_insert(
-		parserutils_inputstream *stream,
-		const uint8_t *data, size_t len)
-{
-	parserutils_inputstream_private *s = 
-			(parserutils_inputstream_private *) stream;
+	if (s->file != NULL) {
+		parserutils__mapping_destroy(s->file);
+		s->file = NULL;
+	}
+	s->file_offset = 0;
 
-	if (stream == NULL || data == NULL)
-		return PARSERUTILS_BADPARM;
+	parserutils_inputstream_release_all(s);
 
-	return parserutils_buffer_insert(s->public.utf8, s->public.cursor, 
-			data, len);
-}
+	s->raw->length = 0;
+	s->raw_retained = 0;
+	s->restartable = (s->retain_limit != 0);
 
-#define IS_ASCII(x) (((x) & 0x80) == 0)
+	s->public.utf8->length = 0;
+	s->public.cursor = 0;
+	s->public.had_eof = false;
+	s->done_first_chunk = false;
+	s->passthrough = false;
+	s->phase = 0;
+
+	parserutils_inputstream_reset_position(s);
+
+	error = parserutils__filter_reset(s->input);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	/* The filter keeps its converter if the charset is unchanged */
+	if (enc != NULL) {
+		parserutils_filter_optparams params;
+
+		params.encoding.name = enc;
+
+		error = parserutils__filter_setopt(s->input,
+				PARSERUTILS_FILTER_SET_ENCODING, &params);
+		if (error != PARSERUTILS_OK)
+			return error;
+	}
+
+	s->mibenum = mibenum;
+	s->encsrc = (enc != NULL) ? encsrc : 0;
+	s->csdetect = csdetect;
+
+	return PARSERUTILS_OK;
+}
 
 /**
- * Look at the character in the stream that starts at 
- * offset bytes from the cursor (slow version)
+ * Configure an input stream
  *
- * \param stream  Stream to look in
- * \param offset  Byte offset of start of character
- * \param ptr     Pointer to location to receive pointer to character data
- * \param length  Pointer to location to receive character length (in bytes)
- * \return PARSERUTILS_OK on success, 
- *                    _NEEDDATA on reaching the end of available input,
- *                    _EOF on reaching the end of all input,
- *                    _BADENCODING if the input cannot be decoded,
- *                    _NOMEM on memory exhaustion,
- *                    _BADPARM if bad parameters are passed.
+ * \param stream  Input stream to configure
+ * \param type    Option to set
+ * \param params  Option-specific parameters
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_INVALID if retention is set after data has been read,
+ *                             options conflict with the pipeline, or
+ *                             normalisation is turned off part way
+ *                             through a character sequence,
+ *         PARSERUTILS_NOMEM on memory exhaustion
  *
- * Once the character pointed to by the result of this call has been advanced
- * past (i.e. parserutils_inputstream_advance has caused the stream cursor to 
- * pass over the character), then no guarantee is made as to the validity of 
- * the data pointed to. Thus, any attempt to dereference the pointer after 
- * advancing past the data it points to is a bug.
+ * Each option is described with its parameters, in
+ * parserutils_inputstream_optparams.
  */
-parserutils_error parserutils_inputstream_peek_slow(
-		parserutils_inputstream *stream, 
-		size_t offset, const uint8_t **ptr, size_t *length)
+parserutils_error parserutils_inputstream_setopt(
+		parserutils_inputstream *stream,
+		parserutils_inputstream_opttype type,
+		parserutils_inputstream_optparams *params)
 {
-	parserutils_inputstream_private *s = 
+	parserutils_inputstream_private *s =
 			(parserutils_inputstream_private *) stream;
-	parserutils_error error = PARSERUTILS_OK;
+	parserutils_inputstream_segment *segments;
+	parserutils_error error;
+	uint32_t tasks;
 	size_t len;
 
-	if (stream == NULL || ptr == NULL || length == NULL)
+	if (stream == NULL || params == NULL)
 		return PARSERUTILS_BADPARM;
 
-	/* There's insufficient data in the buffer, so read some more */
-	if (s->raw->length == 0) {
-		/* No more data to be had */
-		return s->public.had_eof ? PARSERUTILS_EOF
-					 : PARSERUTILS_NEEDDATA;
-	}
-
-	/* Refill utf8 buffer from raw buffer */
-	error = parserutils_inputstream_refill_buffer(s);
-	if (error != PARSERUTILS_OK)
-		return error;
+	switch (type) {
+	case PARSERUTILS_INPUTSTREAM_SET_LIMITS:
+		if (s->pipeline != NULL && params->limits.utf8 != 0)
+			return PARSERUTILS_INVALID;
+
+		s->raw_limit = params->limits.raw;
+		s->utf8_limit = params->limits.utf8;
+		break;
+	case PARSERUTILS_INPUTSTREAM_SET_RETENTION:
+		if (s->done_first_chunk || (s->pipeline != NULL &&
+				params->retention.limit != 0))
+			return PARSERUTILS_INVALID;
+
+		/* Data kept for a restart must be in the raw buffer */
+		if (params->retention.limit != 0 && s->borrowed_count > 0) {
+			error = parserutils_buffer_reserve(s->raw,
+					s->borrowed_length);
+			if (error != PARSERUTILS_OK)
+				return error;
 
-	/* Refill may have succeeded, but not actually produced any new data */
-	if (s->public.cursor + offset == s->public.utf8->length)
-		return PARSERUTILS_NEEDDATA;
+			parserutils_inputstream_flatten(s);
+		}
 
-	/* Now try the read */
-	if (IS_ASCII(s->public.utf8->data[s->public.cursor + offset])) {
-		len = 1;
-	} else {
-		error = parserutils_charset_utf8_char_byte_length(
-			s->public.utf8->data + s->public.cursor + offset,
-			&len);
+		s->retain_limit = params->retention.limit;
+		s->restartable = (params->retention.limit != 0);
+		break;
+	case PARSERUTILS_INPUTSTREAM_SET_SIZE_HINT:
+		len = params->size_hint.length;
 
-		if (error != PARSERUTILS_OK && error != PARSERUTILS_NEEDDATA)
+		error = parserutils_buffer_reserve(s->raw, s->raw_limit != 0
+				? min(len, s->raw_limit) : len);
+		if (error != PARSERUTILS_OK)
 			return error;
 
-		if (error == PARSERUTILS_NEEDDATA) {
-			return s->public.had_eof ? PARSERUTILS_EOF
-						 : PARSERUTILS_NEEDDATA;
+		return parserutils_buffer_reserve(s->public.utf8,
+				s->utf8_limit != 0
+				? min(len, s->utf8_limit) : len);
+	case PARSERUTILS_INPUTSTREAM_SET_PARALLEL:
+		if (params->parallel.run == NULL) {
+			if (s->segments != NULL)
+				s->alloc(s->segments, 0, s->pw);
+			s->segments = NULL;
+			s->run = NULL;
+			break;
 		}
-	}
 
-	(*length) = len;
-	(*ptr) = (s->public.utf8->data + s->public.cursor + offset);
+		tasks = (params->parallel.tasks != 0)
+				? params->parallel.tasks : PARALLEL_TASKS;
+
+		segments = s->alloc(s->segments,
+				tasks * sizeof(parserutils_inputstream_segment),
+				s->pw);
+		if (segments == NULL)
+			return PARSERUTILS_NOMEM;
+
+		s->segments = segments;
+		s->tasks = tasks;
+		s->segment = (params->parallel.segment != 0)
+				? max(params->parallel.segment,
+					PARALLEL_MIN_SEGMENT)
+				: PARALLEL_SEGMENT;
+		s->run = params->parallel.run;
+		s->run_pw = params->parallel.pw;
+		break;
+	case PARSERUTILS_INPUTSTREAM_SET_TRACE:
+	{
+		parserutils_filter_optparams fparams;
+
+		s->trace.func = params->trace.func;
+		s->trace.pw = params->trace.pw;
+
+		fparams.trace.hook = (s->trace.func != NULL) ? &s->trace : NULL;
+
+		/* The filter mustn't be changed under a running task */
+		if (s->pipeline != NULL) {
+			parserutils_inputstream_pipeline_wait(s);
+			s->pipeline->out->trace = fparams.trace.hook;
+		}
 
-	return PARSERUTILS_OK;
-}
+		s->raw->trace = fparams.trace.hook;
+		s->public.utf8->trace = fparams.trace.hook;
 
-#undef IS_ASCII
+		return parserutils__filter_setopt(s->input,
+				PARSERUTILS_FILTER_SET_TRACE, &fparams);
+	}
+	case PARSERUTILS_INPUTSTREAM_SET_PIPELINE:
+		if (s->normalise && params->pipeline.submit != NULL)
+			return PARSERUTILS_INVALID;
 
-/**
- * Read the source charset of the input stream
- *
- * \param stream  Input stream to query
- * \param source  Pointer to location to receive charset source identifier
- * \return Pointer to charset name (constant; do not free)
- */
-const char *parserutils_inputstream_read_charset(
-		parserutils_inputstream *stream, uint32_t *source)
-{
-	parserutils_inputstream_private *s = 
-			(parserutils_inputstream_private *) stream;
+		return parserutils_inputstream_pipeline_set(s, params);
+	case PARSERUTILS_INPUTSTREAM_SET_NORMALISE:
+	{
+		parserutils_filter_optparams fparams;
 
-	if (stream == NULL || source == NULL)
-		return NULL;
+		if (s->pipeline != NULL && params->normalise.nfc)
+			return PARSERUTILS_INVALID;
 
-	*source = s->encsrc;
+		fparams.normalise.nfc = params->normalise.nfc;
 
-	if (s->encsrc == 0)
-		return "UTF-8";
+		error = parserutils__filter_setopt(s->input,
+				PARSERUTILS_FILTER_SET_NORMALISE, &fparams);
+		if (error != PARSERUTILS_OK)
+			return error;
 
-	return parserutils_charset_mibenum_to_name(s->mibenum);
-}
+		s->normalise = params->normalise.nfc;
+
+		/* Normalised data is always converted by the filter */
+		if (s->done_first_chunk)
+			s->passthrough = (s->mibenum == MIB_UTF_8 &&
+					s->normalise == false);
+		break;
+	}
+	case PARSERUTILS_INPUTSTREAM_SET_CACHE:
+		s->cache = params->cache.cache;
+		break;
+	case PARSERUTILS_INPUTSTREAM_SET_REPLACEMENTS:
+		s->replaced_limit = params->replacements.limit;
+		s->n_replaced = min(s->n_replaced, s->replaced_limit);
+		break;
+	default:
+		return PARSERUTILS_BADPARM;
+	}
+
+	return PARSERUTILS_OK;
+}
 
 /**
- * Change the source charset of the input stream
+ * Append data to an input stream
  *
- * \param stream   Input stream to modify
- * \param enc      Charset name
- * \param source   Charset source identifier
+ * \param stream  Input stream to append data to
+ * \param data    Data to append (in document charset), or NULL to flag EOF
+ * \param len     Length, in bytes, of data
  * \return PARSERUTILS_OK on success,
- *         PARSERUTILS_BADPARM on invalid parameters,
- *         PARSERUTILS_INVALID if called after data has been read from stream,
- *         PARSERUTILS_BADENCODING if the encoding is unsupported,
- *         PARSERUTILS_NOMEM on memory exhaustion.
+ *         PARSERUTILS_FULL if the data would exceed the raw buffer limit,
+ *         PARSERUTILS_INVALID if the stream reads from a file,
+ *         appropriate error otherwise
  */
-parserutils_error parserutils_inputstream_change_charset(
+parserutils_error parserutils_inputstream_append(
 		parserutils_inputstream *stream, 
-		const char *enc, uint32_t source)
+		const uint8_t *data, size_t len)
+{
+	parserutils_inputstream_private *s = 
+			(parserutils_inputstream_private *) stream;
+	parserutils_inputstream_iov iov;
+
+	if (stream == NULL)
+		return PARSERUTILS_BADPARM;
+
+	if (data == NULL) {
+		s->public.had_eof = true;
+
+		/* Start decoding what's arrived, if it's worth it */
+		if (s->pipeline != NULL)
+			parserutils_inputstream_pipeline_start(s);
+
+		return PARSERUTILS_OK;
+	}
+
+	iov.data = data;
+	iov.len = len;
+	iov.release = NULL;
+	iov.pw = NULL;
+
+	return parserutils_inputstream_append_iov(stream, &iov, 1);
+}
+
+/**
+ * Append segments of data to an input stream
+ *
+ * \param stream  Input stream to append data to
+ * \param iov     Segments to append, in order
+ * \param count   Number of segments
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_FULL if the data would exceed the raw buffer limit,
+ *         PARSERUTILS_INVALID if the stream reads from a file,
+ *         appropriate error otherwise
+ *
+ * Segments without a release function are copied, as by
+ * parserutils_inputstream_append. The others are lent to the stream, which
+ * decodes them where they are, and calls their release function once all
+ * of a segment has been decoded, or the stream is reset or destroyed. Only
+ * a character split between segments is copied, to join it up. Streams
+ * keeping their data for a restart, or decoding in the background, copy
+ * all segments, releasing them at once, as does any stream with lent data
+ * followed by copied data, in this call or a later one.
+ *
+ * On failure, nothing has been appended, and segments remain the caller's.
+ */
+parserutils_error parserutils_inputstream_append_iov(
+		parserutils_inputstream *stream,
+		const parserutils_inputstream_iov *iov, uint32_t count)
 {
 	parserutils_inputstream_private *s =
 			(parserutils_inputstream_private *) stream;
-	parserutils_filter_optparams params;
-	uint16_t temp;
+	size_t total = 0, copy = 0;
+	uint32_t i, last = 0, lent = 0;
+	bool borrow, flatten;
 	parserutils_error error;
 
-	if (stream == NULL || enc == NULL)
+	if (stream == NULL || (iov == NULL && count > 0))
 		return PARSERUTILS_BADPARM;
 
-	if (s->done_first_chunk)
+	if (s->file != NULL)
 		return PARSERUTILS_INVALID;
 
-	temp = parserutils_charset_mibenum_from_name(enc, strlen(enc));
-	if (temp == 0)
-		return PARSERUTILS_BADENCODING;
+	/* Data kept for a restart, or decoded ahead, must be in the raw
+	 * buffer */
+	borrow = (s->restartable == false && s->pipeline == NULL);
 
-	/* Ensure filter is using the correct encoding */
-	params.encoding.name = enc;
-	error = parserutils__filter_setopt(s->input,
-			PARSERUTILS_FILTER_SET_ENCODING, 
-			&params);
+	/* Everything up to the last segment that's copied is copied */
+	for (i = 0; i < count; i++) {
+		if (iov[i].data == NULL)
+			return PARSERUTILS_BADPARM;
+
+		total += iov[i].len;
+
+		if (iov[i].len > 0 && (iov[i].release == NULL ||
+				borrow == false))
+			last = i + 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (i < last)
+			copy += iov[i].len;
+		else if (iov[i].len > 0)
+			lent++;
+	}
+
+	if (s->raw_limit != 0 && s->raw->length + s->borrowed_length +
+			total > s->raw_limit)
+		return PARSERUTILS_FULL;
+
+	/* Copied data goes after anything already lent */
+	flatten = (last > 0 && s->borrowed_count > 0);
+
+	error = parserutils_buffer_reserve(s->raw,
+			copy + (flatten ? s->borrowed_length : 0));
 	if (error != PARSERUTILS_OK)
 		return error;
 
-	/* Finally, replace the current settings */
-	s->mibenum = temp;
-	s->encsrc = source;
+	error = parserutils_inputstream_borrowed_reserve(s, lent);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	/* Nothing can fail from here on */
+	if (flatten)
+		parserutils_inputstream_flatten(s);
+
+	for (i = 0; i < count; i++) {
+		if (i < last) {
+			parserutils_buffer_append(s->raw, iov[i].data,
+					iov[i].len);
+		} else if (iov[i].len > 0) {
+			s->borrowed[(s->borrowed_first + s->borrowed_count) &
+					(s->borrowed_alloc - 1)] = iov[i];
+			s->borrowed_count++;
+			s->borrowed_length += iov[i].len;
+			continue;
+		}
+
+		if (iov[i].release != NULL)
+			iov[i].release(iov[i].data, iov[i].len, iov[i].pw);
+	}
+
+	/* Start decoding what's arrived, if it's worth it */
+	if (s->pipeline != NULL)
+		parserutils_inputstream_pipeline_start(s);
 
 	return PARSERUTILS_OK;
 }
 
-/******************************************************************************
- ******************************************************************************/
-
 /**
- * Refill the UTF-8 buffer from the raw buffer
+ * Append data to an input stream, lending it until it has been decoded
  *
- * \param stream  The inputstream to operate on
- * \return PARSERUTILS_OK on success
+ * \param stream   Input stream to append data to
+ * \param data     Data to append (in document charset)
+ * \param len      Length, in bytes, of data
+ * \param release  Function releasing the data
+ * \param pw       Client private data for release
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_FULL if the data would exceed the raw buffer limit,
+ *         PARSERUTILS_INVALID if the stream reads from a file,
+ *         appropriate error otherwise
+ *
+ * The data, which must stay unchanged until released, is lent to the
+ * stream as by parserutils_inputstream_append_iov. On failure, it remains
+ * the caller's.
  */
-parserutils_error parserutils_inputstream_refill_buffer(
-		parserutils_inputstream_private *stream)
+parserutils_error parserutils_inputstream_append_borrowed(
+		parserutils_inputstream *stream,
+		const uint8_t *data, size_t len,
+		parserutils_inputstream_release release, void *pw)
 {
-	const uint8_t *raw;
-	uint8_t *utf8;
-	size_t raw_length, utf8_space;
-	parserutils_error error;
-
-	/* If this is the first chunk of data, we must detect the charset and
-	 * strip the BOM, if one exists */
-	if (stream->done_first_chunk == false) {
-		parserutils_filter_optparams params;
+	parserutils_inputstream_iov iov;
 
-		/* If there is a charset detection routine, give it an 
-		 * opportunity to override any charset specified when the
-		 * inputstream was created */
-		if (stream->csdetect != NULL) {
-			error = stream->csdetect(stream->raw->data, 
-				stream->raw->length,
-				&stream->mibenum, &stream->encsrc);
-			if (error != PARSERUTILS_OK) {
-				if (error != PARSERUTILS_NEEDDATA ||
-						stream->public.had_eof == false)
-					return error;
+	if (data == NULL || release == NULL)
+		return PARSERUTILS_BADPARM;
 
-				/* We don't have enough data to detect the 
-				 * input encoding, but we're not going to get 
-				 * any more as we've been notified of EOF. 
-				 * Therefore, leave the encoding alone
-				 * so that any charset specified when the
-				 * inputstream was created will be preserved.
-				 * If there was no charset specified, then
-				 * we'll default to UTF-8, below */
-			}
-		}
+	iov.data = data;
+	iov.len = len;
+	iov.release = release;
+	iov.pw = pw;
 
-		/* Default to UTF-8 if there is still no encoding information 
-		 * We'll do this if there was no encoding specified up-front
-		 * and:
-		 *    1) there was no charset detection routine
-		 * or 2) there was insufficient data for the charset 
-		 *       detection routine to detect an encoding
-		 */
-		if (stream->mibenum == 0) {
-			stream->mibenum = 
-				parserutils_charset_mibenum_from_name("UTF-8", 
-					SLEN("UTF-8"));
-			stream->encsrc = 0;
-		}
+	return parserutils_inputstream_append_iov(stream, &iov, 1);
+}
 
-		if (stream->mibenum == 0)
-			abort();
+/**
+ * Insert data into stream at current location
+ *
+ * \param stream  Input stream to insert into
+ * \param data    Data to insert (UTF-8 encoded)
+ * \param len     Length, in bytes, of data
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * The data before the cursor has been consumed, so inserted data is written
+ * over it, and the cursor moved back to the start of the inserted data. If
+ * there is insufficient space before the cursor, a gap is opened up there,
+ * large enough that repeated insertions are amortised O(1). While the
+ * stream is marked, the data before the cursor is kept, and a gap is always
+ * opened.
+ */
+parserutils_error parserutils_inputstream_insert(
+		parserutils_inputstream *stream,
+		const uint8_t *data, size_t len)
+{
+	parserutils_inputstream_private *s = 
+			(parserutils_inputstream_private *) stream;
+	parserutils_error error;
 
-		/* Strip any BOM, and update encoding as appropriate */
-		error = parserutils_inputstream_strip_bom(&stream->mibenum, 
-				stream->raw);
-		if (error != PARSERUTILS_OK)
-			return error;
+	if (stream == NULL || data == NULL)
+		return PARSERUTILS_BADPARM;
 
-		/* Ensure filter is using the correct encoding */
-		params.encoding.name = 
-			parserutils_charset_mibenum_to_name(stream->mibenum);
+	/* Count what's been read, before it's written over */
+	parserutils_inputstream_count(s);
 
-		error = parserutils__filter_setopt(stream->input,
-				PARSERUTILS_FILTER_SET_ENCODING, 
-				&params);
+	if (len > s->public.cursor || s->n_marks > 0) {
+		error = parserutils_inputstream_open_gap(s, len);
 		if (error != PARSERUTILS_OK)
 			return error;
+	}
 
-		stream->done_first_chunk = true;
+	s->public.cursor -= len;
+	memcpy(s->public.utf8->data + s->public.cursor, data, len);
+
+	/* The inserted data is read from where the cursor was, and what
+	 * follows it moves along. It has no source of its own. */
+	s->utf8_offset += len;
+
+	if (len != 0) {
+		parserutils_inputstream_checkpoint *cp = s->checkpoints;
+		uint32_t next = s->next_checkpoint, i;
+		size_t n;
+
+		for (i = next; i < s->n_checkpoints; i++)
+			cp[i].offset += len;
+
+		/* As do the replacements recorded in it */
+		for (n = s->n_replaced; n > 0 && s->replaced[n - 1].offset >=
+				s->pos.offset; n--)
+			s->replaced[n - 1].offset += len;
+
+		/* Without room to resume after it, the rest is unknown */
+		if (s->n_checkpoints + 2 <= CHECKPOINTS) {
+			memmove(cp + next + 2, cp + next,
+					(s->n_checkpoints - next) *
+						sizeof(*cp));
+			cp[next].offset = s->pos.offset;
+			cp[next].source = s->pos.source;
+			cp[next].origin = ORIGIN_UNKNOWN;
+			cp[next + 1].offset = s->pos.offset + len;
+			cp[next + 1].source = s->pos.source;
+			cp[next + 1].origin = s->origin;
+			s->n_checkpoints += 2;
+			s->next_checkpoint++;
+		}
+
+		s->origin = ORIGIN_UNKNOWN;
 	}
 
-	/* Work out how to perform the buffer fill */
-	if (stream->public.cursor == stream->public.utf8->length) {
-		/* Cursor's at the end, so simply reuse the entire buffer */
-		utf8 = stream->public.utf8->data;
-		utf8_space = stream->public.utf8->allocated;
-	} else {
-		/* Cursor's not at the end, so shift data after cursor to the
-		 * bottom of the buffer. If the buffer's still over half full, 
-		 * extend it. */
-		memmove(stream->public.utf8->data,
-			stream->public.utf8->data + stream->public.cursor,
-			stream->public.utf8->length - stream->public.cursor);
+	return PARSERUTILS_OK;
+}
 
-		stream->public.utf8->length -= stream->public.cursor;
+#define IS_ASCII(x) (((x) & 0x80) == 0)
 
-		if (stream->public.utf8->length > 
-				stream->public.utf8->allocated / 2) {
-			error = parserutils_buffer_grow(stream->public.utf8);
-			if (error != PARSERUTILS_OK)
-				return error;
-		}
+/**
+ * Look at the character in the stream that starts at 
+ * offset bytes from the cursor (slow version)
+ *
+ * \param stream  Stream to look in
+ * \param offset  Byte offset of start of character
+ * \param ptr     Pointer to location to receive pointer to character data
+ * \param length  Pointer to location to receive character length (in bytes)
+ * \return PARSERUTILS_OK on success, 
+ *                    _NEEDDATA on reaching the end of available input,
+ *                    _EOF on reaching the end of all input,
+ *                    _BADENCODING if the input cannot be decoded,
+ *                    _NOMEM on memory exhaustion,
+ *                    _BADPARM if bad parameters are passed.
+ *
+ * Once the character pointed to by the result of this call has been advanced
+ * past (i.e. parserutils_inputstream_advance has caused the stream cursor to 
+ * pass over the character), then no guarantee is made as to the validity of 
+ * the data pointed to. Thus, any attempt to dereference the pointer after 
+ * advancing past the data it points to is a bug.
+ */
+parserutils_error parserutils_inputstream_peek_slow(
+		parserutils_inputstream *stream, 
+		size_t offset, const uint8_t **ptr, size_t *length)
+{
+	parserutils_inputstream_private *s = 
+			(parserutils_inputstream_private *) stream;
+	parserutils_error error = PARSERUTILS_OK;
+	const uint8_t *raw;
+	size_t len, raw_length;
 
-		utf8 = stream->public.utf8->data + stream->public.utf8->length;
-		utf8_space = stream->public.utf8->allocated - 
-				stream->public.utf8->length;
-	}
+	if (stream == NULL || ptr == NULL || length == NULL)
+		return PARSERUTILS_BADPARM;
 
-	raw = stream->raw->data;
-	raw_length = stream->raw->length;
+	s->peek_slow_calls++;
 
-	/* Try to fill utf8 buffer from the raw data */
-	error = parserutils__filter_process_chunk(stream->input, 
-			&raw, &raw_length, &utf8, &utf8_space);
-	/* _NOMEM implies that there's more input to read than available space
-	 * in the utf8 buffer. That's fine, so we'll ignore that error. */
-	if (error != PARSERUTILS_OK && error != PARSERUTILS_NOMEM)
-		return error;
+	/* There's insufficient data in the buffer, so read some more */
+	parserutils_inputstream_raw_data(s, &raw, &raw_length);
+	if (raw_length == 0 && (s->public.had_eof == false ||
+			parserutils__filter_pending(s->input) == false)) {
+		/* No more data to be had */
+		return s->public.had_eof ? PARSERUTILS_EOF
+					 : PARSERUTILS_NEEDDATA;
+	}
 
-	/* Remove the raw data we've processed from the raw buffer */
-	error = parserutils_buffer_discard(stream->raw, 0, 
-			stream->raw->length - raw_length);
+	/* Refill utf8 buffer from raw buffer */
+	error = parserutils_inputstream_refill_buffer(s);
 	if (error != PARSERUTILS_OK)
 		return error;
 
-	/* Fix up the utf8 buffer information */
-	stream->public.utf8->length = 
-			stream->public.utf8->allocated - utf8_space;
+	/* Normalisation may have held back the last of the data, which can
+	 * be had once the rest has been consumed at EOF */
+	if (s->public.cursor + offset == s->public.utf8->length &&
+			s->public.had_eof &&
+			parserutils__filter_pending(s->input)) {
+		parserutils_inputstream_raw_data(s, &raw, &raw_length);
+		if (raw_length == 0) {
+			error = parserutils_inputstream_refill_buffer(s);
+			if (error != PARSERUTILS_OK)
+				return error;
+		}
+	}
 
-	/* Finally, fix up the cursor */
-	stream->public.cursor = 0;
+	/* Refill may have succeeded, but not actually produced any new data */
+	if (s->public.cursor + offset == s->public.utf8->length)
+		return PARSERUTILS_NEEDDATA;
 
-	return PARSERUTILS_OK;
-}
+	/* Now try the read */
+	if (IS_ASCII(s->public.utf8->data[s->public.cursor + offset])) {
+		len = 1;
+	} else {
+		error = parserutils_charset_utf8_char_byte_length(
+			s->public.utf8->data + s->public.cursor + offset,
+			&len);
 
-/**
- * Strip a BOM from a buffer in the given encoding
- *
- * \param mibenum  Pointer to the character set of the buffer, updated on exit
- * \param buffer   The buffer to process
- */
-parserutils_error parserutils_inputstream_strip_bom(uint16_t *mibenum, 
-		parserutils_buffer *buffer)
-{
-	static uint16_t utf8;
-	static uint16_t utf16;
-	static uint16_t utf16be;
-	static uint16_t utf16le;
-	static uint16_t utf32;
-	static uint16_t utf32be;
-	static uint16_t utf32le;
-
-	if (utf8 == 0) {
-		utf8 = parserutils_charset_mibenum_from_name("UTF-8", 
-				SLEN("UTF-8"));
-		utf16 = parserutils_charset_mibenum_from_name("UTF-16", 
-				SLEN("UTF-16"));
-		utf16be = parserutils_charset_mibenum_from_name("UTF-16BE",
-				SLEN("UTF-16BE"));
-		utf16le = parserutils_charset_mibenum_from_name("UTF-16LE",
-				SLEN("UTF-16LE"));
-		utf32 = parserutils_charset_mibenum_from_name("UTF-32", 
-				SLEN("UTF-32"));
-		utf32be = parserutils_charset_mibenum_from_name("UTF-32BE",
-				SLEN("UTF-32BE"));
-		utf32le = parserutils_charset_mibenum_from_name("UTF-32LE",
-				SLEN("UTF-32LE"));
-	}
-
-#define UTF32_BOM_LEN (4)
-#define UTF16_BOM_LEN (2)
-#define UTF8_BOM_LEN  (3)
-
-	if (*mibenum == utf8) {
-		if (buffer->length >= UTF8_BOM_LEN && 
-				buffer->data[0] == 0xEF &&
-				buffer->data[1] == 0xBB && 
-				buffer->data[2] == 0xBF) {
-			return parserutils_buffer_discard(
-					buffer, 0, UTF8_BOM_LEN);
-		}
-	} else if (*mibenum == utf16be) {
-		if (buffer->length >= UTF16_BOM_LEN &&
-				buffer->data[0] == 0xFE &&
-				buffer->data[1] == 0xFF) {
-			return parserutils_buffer_discard(
-					buffer, 0, UTF16_BOM_LEN);
-		}
-	} else if (*mibenum == utf16le) {
-		if (buffer->length >= UTF16_BOM_LEN &&
-				buffer->data[0] == 0xFF &&
-				buffer->data[1] == 0xFE) {
-			return parserutils_buffer_discard(
-					buffer, 0, UTF16_BOM_LEN);
-		}
-	} else if (*mibenum == utf16) {
-		*mibenum = utf16be;
-
-		if (buffer->length >= UTF16_BOM_LEN) {
-			if (buffer->data[0] == 0xFE && 
-					buffer->data[1] == 0xFF) {
-				return parserutils_buffer_discard(
-						buffer, 0, UTF16_BOM_LEN);
-			} else if (buffer->data[0] == 0xFF && 
-					buffer->data[1] == 0xFE) {
-				*mibenum = utf16le;
-				return parserutils_buffer_discard(
-						buffer, 0, UTF16_BOM_LEN);
-			}
-		}
-	} else if (*mibenum == utf32be) {
-		if (buffer->length >= UTF32_BOM_LEN &&
-				buffer->data[0] == 0x00 &&
-				buffer->data[1] == 0x00 &&
-				buffer->data[2] == 0xFE &&
-				buffer->data[3] == 0xFF) {
-			return parserutils_buffer_discard(
-					buffer, 0, UTF32_BOM_LEN);
-		}
-	} else if (*mibenum == utf32le) {
-		if (buffer->length >= UTF32_BOM_LEN &&
-				buffer->data[0] == 0xFF &&
-				buffer->data[1] == 0xFE &&
-				buffer->data[2] == 0x00 &&
-				buffer->data[3] == 0x00) {
-			return parserutils_buffer_discard(
-					buffer, 0, UTF32_BOM_LEN);
-		}
-	} else if (*mibenum == utf32) {
-		*mibenum = utf32be;
-
-		if (buffer->length >= UTF32_BOM_LEN) {
-			if (buffer->data[0] == 0x00 && 
-					buffer->data[1] == 0x00 &&
-					buffer->data[2] == 0xFE &&
-					buffer->data[3] == 0xFF) {
-				return parserutils_buffer_discard(
-						buffer, 0, UTF32_BOM_LEN);
-			} else if (buffer->data[0] == 0xFF && 
-					buffer->data[1] == 0xFE &&
-					buffer->data[2] == 0x00 &&
-					buffer->data[3] == 0x00) {
-				*mibenum = utf32le;
-				return parserutils_buffer_discard(
-						buffer, 0, UTF32_BOM_LEN);
-			}
+		if (error != PARSERUTILS_OK && error != PARSERUTILS_NEEDDATA)
+			return error;
+
+		if (error == PARSERUTILS_NEEDDATA) {
+			return s->public.had_eof ? PARSERUTILS_EOF
+						 : PARSERUTILS_NEEDDATA;
 		}
 	}
 
-#undef UTF8_BOM_LEN
-#undef UTF16_BOM_LEN
-#undef UTF32_BOM_LEN
+	(*length) = len;
+	(*ptr) = (s->public.utf8->data + s->public.cursor + offset);
 
 	return PARSERUTILS_OK;
 }
 
+#undef IS_ASCII
+
+/**
+ * Look at the character in the stream that starts at
+ * offset bytes from the cursor (out-of-line version)
+ *
+ * \param stream  Stream to look in
+ * \param offset  Byte offset of start of character
+ * \param ptr     Pointer to location to receive pointer to character data
+ * \param length  Pointer to location to receive character length (in bytes)
+ * \return As parserutils_inputstream_peek
+ *
+ * This is parserutils_inputstream_peek, for callers which can't use the
+ * header's inline functions, such as bindings from other languages. Having
+ * a symbol, it may still be inlined into them by link-time optimisation.
+ */
+parserutils_error parserutils_inputstream_peek_extern(
+		parserutils_inputstream *stream,
+		size_t offset, const uint8_t **ptr, size_t *length)
+{
+	return parserutils_inputstream_peek(stream, offset, ptr, length);
+}
+
+/**
+ * Advance the stream's current position (out-of-line version)
+ *
+ * \param stream  The stream whose position to advance
+ * \param bytes   The number of bytes to advance
+ *
+ * This is parserutils_inputstream_advance, for the same callers as
+ * parserutils_inputstream_peek_extern.
+ */
+void parserutils_inputstream_advance_extern(parserutils_inputstream *stream,
+		size_t bytes)
+{
+	parserutils_inputstream_advance(stream, bytes);
+}
+
+/**
+ * Look at the run of complete characters in the stream that starts at
+ * offset bytes from the cursor
+ *
+ * \param stream  Stream to look in
+ * \param offset  Byte offset of start of run
+ * \param ptr     Pointer to location to receive pointer to run data
+ * \param length  Pointer to location to receive run length (in bytes)
+ * \return PARSERUTILS_OK on success,
+ *                    _NEEDDATA on reaching the end of available input,
+ *                    _EOF on reaching the end of all input,
+ *                    _BADENCODING if the input cannot be decoded,
+ *                    _NOMEM on memory exhaustion,
+ *                    _BADPARM if bad parameters are passed.
+ *
+ * The run consists of all the decoded data that is currently buffered after
+ * the given offset, less any trailing incomplete character. On success, it
+ * is at least one character long. The buffer is only refilled if there is
+ * no complete character to return.
+ *
+ * Any prefix of the run that ends on a character boundary may be consumed
+ * by passing its length to parserutils_inputstream_advance. The validity
+ * rules for the returned data are the same as for
+ * parserutils_inputstream_peek: once the cursor has passed over a byte of
+ * the run, that byte must not be dereferenced.
+ */
+parserutils_error parserutils_inputstream_peek_span(
+		parserutils_inputstream *stream,
+		size_t offset, const uint8_t **ptr, size_t *length)
+{
+	parserutils_error error;
+	size_t off, len;
+
+	if (stream == NULL || ptr == NULL || length == NULL)
+		return PARSERUTILS_BADPARM;
+
+	off = stream->cursor + offset;
+
+	if (off > stream->utf8->length)
+		abort();
+
+	len = parserutils_inputstream_span_length(stream->utf8->data + off,
+			stream->utf8->length - off);
+	if (len == 0) {
+		/* Nothing complete buffered: refill via the slow path,
+		 * which will report _NEEDDATA, _EOF, or errors for us */
+		error = parserutils_inputstream_peek_slow(stream, offset,
+				ptr, length);
+		if (error != PARSERUTILS_OK)
+			return error;
+
+		/* Refill will have reset the cursor */
+		off = stream->cursor + offset;
+
+		len = parserutils_inputstream_span_length(
+				stream->utf8->data + off,
+				stream->utf8->length - off);
+		if (len == 0) {
+			return stream->had_eof ? PARSERUTILS_EOF
+					       : PARSERUTILS_NEEDDATA;
+		}
+	}
+
+	(*length) = len;
+	(*ptr) = (stream->utf8->data + off);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Find the first byte in the stream, after the cursor, that is in a set
+ *
+ * \param stream  Stream to look in
+ * \param set     Set of bytes to look for
+ * \param length  Pointer to location to receive offset from cursor of the
+ *                first member of set or, if there is none, the length of
+ *                the complete characters available
+ * \return PARSERUTILS_OK if a member of set was found,
+ *                    _NEEDDATA on reaching the end of available input,
+ *                    _EOF on reaching the end of all input,
+ *                    _BADENCODING if the input cannot be decoded,
+ *                    _NOMEM on memory exhaustion,
+ *                    _BADPARM if bad parameters are passed.
+ *
+ * The buffer is refilled as needed, so all available input is searched.
+ * Whatever is returned, the caller may pass the resulting length to
+ * parserutils_inputstream_advance to skip the bytes before the match or,
+ * if there was none, all the data available.
+ */
+parserutils_error parserutils_inputstream_scan_until(
+		parserutils_inputstream *stream,
+		const parserutils_byteset *set, size_t *length)
+{
+	parserutils_error error;
+	const uint8_t *ptr;
+	size_t off = 0, avail, len;
+
+	if (stream == NULL || set == NULL || length == NULL)
+		return PARSERUTILS_BADPARM;
+
+	while (true) {
+		const uint8_t *data = stream->utf8->data + stream->cursor;
+
+		avail = stream->utf8->length - stream->cursor;
+
+		off += parserutils_byteset_scan(set, data + off, avail - off);
+		if (off < avail) {
+			(*length) = off;
+			return PARSERUTILS_OK;
+		}
+
+		/* Nothing found in the buffer: refill it. Refilling moves
+		 * the unread data, but keeps it after the cursor. */
+		error = parserutils_inputstream_peek_slow(stream, off,
+				&ptr, &len);
+		if (error != PARSERUTILS_OK)
+			break;
+	}
+
+	/* Don't report the start of any trailing incomplete character */
+	(*length) = parserutils_inputstream_span_length(
+			stream->utf8->data + stream->cursor,
+			stream->utf8->length - stream->cursor);
+
+	return error;
+}
+
+/**
+ * Retrieve an input stream's performance counters
+ *
+ * \param stream  Input stream to query
+ * \param stats   Pointer to location to receive counters
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * The counters are only updated on the slow paths, so are always enabled.
+ * The stream's two buffers exchange roles when UTF-8 input is decoded in
+ * place, so their figures are combined, along with those of the buffer
+ * decoded into in the background. Any task decoding in the background is
+ * waited for.
+ */
+parserutils_error parserutils_inputstream_get_stats(
+		parserutils_inputstream *stream,
+		parserutils_inputstream_stats *stats)
+{
+	parserutils_inputstream_private *s =
+			(parserutils_inputstream_private *) stream;
+
+	if (stream == NULL || stats == NULL)
+		return PARSERUTILS_BADPARM;
+
+	/* The filter's counter belongs to any running task */
+	if (s->pipeline != NULL)
+		parserutils_inputstream_pipeline_wait(s);
+
+	stats->peek_slow = s->peek_slow_calls;
+	stats->refills = s->refills;
+	stats->decoded = s->decoded;
+	stats->moved = s->raw->moved + s->public.utf8->moved;
+	stats->grows = s->raw->grows + s->public.utf8->grows;
+	stats->peak = max(s->raw->peak, s->public.utf8->peak);
+	stats->replacements = s->replacements +
+			parserutils__filter_replacements(s->input);
+
+	if (s->pipeline != NULL) {
+		stats->moved += s->pipeline->out->moved;
+		stats->grows += s->pipeline->out->grows;
+		stats->peak = max(stats->peak, s->pipeline->out->peak);
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Find where the cursor is in the document
+ *
+ * \param stream  Input stream to query
+ * \param pos     Pointer to location to receive position
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * The offset, line and column count all the data read, including any
+ * inserted. Lines end at each line feed. The data read is counted when the
+ * buffer is refilled, and when this is called, so reading is unaffected.
+ *
+ * The source offset is that of the raw data the character at the cursor
+ * was decoded from. It is exact for input which was decoded character by
+ * character, without replacing invalid input: UTF-8, UTF-16, UTF-32 and
+ * single-byte charsets. Otherwise, it is the offset of the data decoded by
+ * the refill which produced the character, which may lie a few bytes into
+ * a character begun by the refill before. Inserted data takes the source
+ * offset of the character it was inserted before.
+ */
+parserutils_error parserutils_inputstream_position(
+		parserutils_inputstream *stream,
+		parserutils_inputstream_pos *pos)
+{
+	parserutils_inputstream_private *s =
+			(parserutils_inputstream_private *) stream;
+
+	if (stream == NULL || pos == NULL)
+		return PARSERUTILS_BADPARM;
+
+	parserutils_inputstream_count(s);
+
+	*pos = s->pos;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Find where invalid input was replaced
+ *
+ * \param stream  Input stream to query
+ * \param index   Pointer to location to receive replacements
+ * \param count   Pointer to location to receive number of replacements
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM if memory ran out while recording them
+ *
+ * The replacements are those made in the data decoded so far, which may
+ * extend beyond the cursor, in order of offset. No more are recorded than
+ * the limit set with PARSERUTILS_INPUTSTREAM_SET_REPLACEMENTS, or than
+ * memory allowed, in which case those recorded before memory ran out are
+ * given. They remain valid until the stream is next read or modified.
+ *
+ * The offsets are measured as those of parserutils_inputstream_position,
+ * and include any data inserted before the replacement. The source offset
+ * is exact where the position's is, and U+FFFD present in input in those
+ * charsets is not reported. Otherwise, the source offset is that of the
+ * data decoded by the refill which produced it, and where the charset is
+ * decoded by a native codec, U+FFFD in the input is reported too.
+ */
+parserutils_error parserutils_inputstream_get_replacements(
+		parserutils_inputstream *stream,
+		const parserutils_inputstream_replacement **index,
+		size_t *count)
+{
+	parserutils_inputstream_private *s =
+			(parserutils_inputstream_private *) stream;
+
+	if (stream == NULL || index == NULL || count == NULL)
+		return PARSERUTILS_BADPARM;
+
+	*index = s->replaced;
+	*count = s->n_replaced;
+
+	return s->replaced_nomem ? PARSERUTILS_NOMEM : PARSERUTILS_OK;
+}
+
+/**
+ * Mark the cursor's position, so that it may be rewound to it
+ *
+ * \param stream  Input stream to mark
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_INVALID if PARSERUTILS_INPUTSTREAM_MAX_MARKS marks are
+ *                             already held
+ *
+ * Until the mark is released, by ::parserutils_inputstream_rewind or
+ * ::parserutils_inputstream_unmark, the data after it is kept in the UTF-8
+ * buffer, and pointers into it remain valid until the next refill. Marks
+ * nest, each being released before those made before it. Decoding again in
+ * a new charset releases all marks.
+ */
+parserutils_error parserutils_inputstream_mark(
+		parserutils_inputstream *stream)
+{
+	parserutils_inputstream_private *s =
+			(parserutils_inputstream_private *) stream;
+	parserutils_inputstream_marker *m;
+
+	if (stream == NULL)
+		return PARSERUTILS_BADPARM;
+
+	if (s->n_marks == PARSERUTILS_INPUTSTREAM_MAX_MARKS)
+		return PARSERUTILS_INVALID;
+
+	parserutils_inputstream_count(s);
+
+	m = &s->marks[s->n_marks++];
+	m->offset = s->utf8_offset + stream->cursor;
+	m->pos = s->pos;
+	m->origin = s->origin;
+	m->next_checkpoint = s->next_checkpoint;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Move the cursor back to the last mark, and release it
+ *
+ * \param stream  Input stream to rewind
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_INVALID if the stream is not marked
+ *
+ * Data inserted since the mark was made is read again, as it was.
+ */
+parserutils_error parserutils_inputstream_rewind(
+		parserutils_inputstream *stream)
+{
+	parserutils_inputstream_private *s =
+			(parserutils_inputstream_private *) stream;
+	parserutils_inputstream_marker *m;
+
+	if (stream == NULL)
+		return PARSERUTILS_BADPARM;
+
+	if (s->n_marks == 0)
+		return PARSERUTILS_INVALID;
+
+	m = &s->marks[--s->n_marks];
+	stream->cursor = m->offset - s->utf8_offset;
+	s->pos = m->pos;
+	s->origin = m->origin;
+	s->next_checkpoint = m->next_checkpoint;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Release the last mark, leaving the cursor where it is
+ *
+ * \param stream  Input stream to unmark
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_INVALID if the stream is not marked
+ */
+parserutils_error parserutils_inputstream_unmark(
+		parserutils_inputstream *stream)
+{
+	parserutils_inputstream_private *s =
+			(parserutils_inputstream_private *) stream;
+
+	if (stream == NULL)
+		return PARSERUTILS_BADPARM;
+
+	if (s->n_marks == 0)
+		return PARSERUTILS_INVALID;
+
+	s->n_marks--;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Read the source charset of the input stream
+ *
+ * \param stream  Input stream to query
+ * \param source  Pointer to location to receive charset source identifier
+ * \return Pointer to charset name (constant; do not free)
+ */
+const char *parserutils_inputstream_read_charset(
+		parserutils_inputstream *stream, uint32_t *source)
+{
+	parserutils_inputstream_private *s = 
+			(parserutils_inputstream_private *) stream;
+
+	if (stream == NULL || source == NULL)
+		return NULL;
+
+	*source = s->encsrc;
+
+	if (s->encsrc == 0)
+		return "UTF-8";
+
+	return parserutils_charset_mibenum_to_name(s->mibenum);
+}
+
+/**
+ * Change the source charset of the input stream
+ *
+ * \param stream   Input stream to modify
+ * \param enc      Charset name
+ * \param source   Charset source identifier
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on invalid parameters,
+ *         PARSERUTILS_INVALID if called after data has been read from stream,
+ *                             and the data read has not been retained,
+ *         PARSERUTILS_BADENCODING if the encoding is unsupported,
+ *         PARSERUTILS_NOMEM on memory exhaustion.
+ */
+parserutils_error parserutils_inputstream_change_charset(
+		parserutils_inputstream *stream, 
+		const char *enc, uint32_t source)
+{
+	parserutils_inputstream_private *s =
+			(parserutils_inputstream_private *) stream;
+	parserutils_filter_optparams params;
+	uint16_t temp;
+	parserutils_error error;
+
+	if (stream == NULL || enc == NULL)
+		return PARSERUTILS_BADPARM;
+
+	if (s->done_first_chunk && s->restartable == false)
+		return PARSERUTILS_INVALID;
+
+	temp = parserutils_charset_mibenum_from_name(enc, strlen(enc));
+	if (temp == 0)
+		return PARSERUTILS_BADENCODING;
+
+	/* Ensure filter is using the correct encoding */
+	params.encoding.name = enc;
+	error = parserutils__filter_setopt(s->input,
+			PARSERUTILS_FILTER_SET_ENCODING, 
+			&params);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	/* Finally, replace the current settings */
+	s->mibenum = temp;
+	s->encsrc = source;
+
+	/* Decode again from the start of the retained data */
+	if (s->done_first_chunk)
+		return parserutils_inputstream_restart(s);
+
+	return PARSERUTILS_OK;
+}
+
+/******************************************************************************
+ ******************************************************************************/
+
+/**
+ * Refill the UTF-8 buffer from the raw buffer
+ *
+ * \param stream  The inputstream to operate on
+ * \return PARSERUTILS_OK on success
+ */
+parserutils_error parserutils_inputstream_refill_buffer(
+		parserutils_inputstream_private *stream)
+{
+	const uint8_t *raw, *raw_start;
+	uint8_t *utf8, *utf8_start;
+	size_t raw_length, utf8_space, source;
+	uint32_t replacements;
+	parserutils_error error;
+	bool replaced;
+
+	stream->refills++;
+
+	/* Join up any character split between lent segments */
+	error = parserutils_inputstream_stitch(stream, STITCH_LENGTH);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	parserutils_inputstream_raw_data(stream, &raw, &raw_length);
+
+	/* If this is the first chunk of data, we must detect the charset and
+	 * strip the BOM, if one exists */
+	if (stream->done_first_chunk == false) {
+		/* If there is a charset detection routine, give it an 
+		 * opportunity to override any charset specified when the
+		 * inputstream was created */
+		if (stream->csdetect != NULL) {
+			error = stream->csdetect(raw, raw_length,
+				&stream->mibenum, &stream->encsrc);
+
+			/* Show it more of any lent data */
+			while (error == PARSERUTILS_NEEDDATA &&
+					raw_length < stream->raw->length -
+					stream->raw_retained +
+					stream->borrowed_length) {
+				error = parserutils_inputstream_stitch(stream,
+						max(2 * raw_length,
+						STITCH_LENGTH));
+				if (error != PARSERUTILS_OK)
+					return error;
+
+				parserutils_inputstream_raw_data(stream,
+						&raw, &raw_length);
+
+				error = stream->csdetect(raw, raw_length,
+					&stream->mibenum, &stream->encsrc);
+			}
+			if (error != PARSERUTILS_OK) {
+				if (error != PARSERUTILS_NEEDDATA ||
+						stream->public.had_eof == false)
+					return error;
+
+				/* We don't have enough data to detect the 
+				 * input encoding, but we're not going to get 
+				 * any more as we've been notified of EOF. 
+				 * Therefore, leave the encoding alone
+				 * so that any charset specified when the
+				 * inputstream was created will be preserved.
+				 * If there was no charset specified, then
+				 * we'll default to UTF-8, below */
+			}
+		}
+
+		/* Default to UTF-8 if there is still no encoding information 
+		 * We'll do this if there was no encoding specified up-front
+		 * and:
+		 *    1) there was no charset detection routine
+		 * or 2) there was insufficient data for the charset 
+		 *       detection routine to detect an encoding
+		 */
+		if (stream->mibenum == 0) {
+			stream->mibenum = MIB_UTF_8;
+			stream->encsrc = 0;
+		}
+
+		error = parserutils_inputstream_start_decoding(stream);
+		if (error != PARSERUTILS_OK)
+			return error;
+
+		parserutils_inputstream_raw_data(stream, &raw, &raw_length);
+
+		stream->done_first_chunk = true;
+	}
+
+	/* Decode the whole document at once, if it may be cached */
+	if (stream->cache_check) {
+		bool done;
+
+		stream->cache_check = false;
+
+		error = parserutils_inputstream_cache_decode(stream, &done);
+		if (error != PARSERUTILS_OK || done)
+			return error;
+	}
+
+	/* Use what has been decoded in the background, if anything */
+	if (stream->pipeline != NULL) {
+		bool collected;
+
+		error = parserutils_inputstream_pipeline_collect(stream,
+				&collected);
+		if (error != PARSERUTILS_OK)
+			return error;
+
+		if (collected) {
+			parserutils_inputstream_pipeline_start(stream);
+			return PARSERUTILS_OK;
+		}
+
+		parserutils_inputstream_raw_data(stream, &raw, &raw_length);
+	}
+
+	/* If all the decoded data has been consumed, and the raw data is
+	 * valid UTF-8, then simply use the raw data as the decoded data. */
+	if (stream->passthrough && stream->file == NULL &&
+			stream->restartable == false && stream->n_marks == 0 &&
+			stream->public.cursor == stream->public.utf8->length &&
+			parserutils_inputstream_steal_raw(stream))
+		return PARSERUTILS_OK;
+
+	/* Make room to decode in parallel, unless memory is limited */
+	if (stream->run != NULL && stream->utf8_limit == 0) {
+		size_t space = parserutils_inputstream_parallel_space(stream,
+				raw_length);
+
+		if (space != 0) {
+			error = parserutils_buffer_reserve(stream->public.utf8,
+					space);
+			if (error != PARSERUTILS_OK)
+				return error;
+		}
+	}
+
+	/* Work out how to perform the buffer fill */
+	if (stream->public.cursor == stream->public.utf8->length &&
+			stream->n_marks == 0) {
+		/* Cursor's at the end, so simply reuse the entire buffer,
+		 * returning any excess space if memory is limited */
+		parserutils_inputstream_rebase(stream);
+		stream->public.utf8->length = 0;
+
+		if (stream->utf8_limit != 0) {
+			error = parserutils_buffer_shrink(stream->public.utf8);
+			if (error != PARSERUTILS_OK)
+				return error;
+		}
+
+		utf8 = stream->public.utf8->data;
+		utf8_space = stream->public.utf8->allocated;
+	} else {
+		/* Cursor's not at the end, or data before it is marked, so
+		 * shift data after cursor or mark to the bottom of the buffer.
+		 * If the buffer's still over half full, extend it, unless
+		 * that would exceed its limit. */
+		size_t read = parserutils_inputstream_rebase(stream);
+
+		memmove(stream->public.utf8->data,
+			stream->public.utf8->data + read,
+			stream->public.utf8->length - read);
+		stream->public.utf8->moved += 
+			stream->public.utf8->length - read;
+
+		PARSERUTILS_TRACE(stream->public.utf8->trace, REFILL_MOVE,
+				stream->public.utf8->length - read,
+				stream->public.utf8->allocated);
+
+		stream->public.utf8->length -= read;
+
+		if (stream->public.utf8->length > 
+				stream->public.utf8->allocated / 2 &&
+				(stream->utf8_limit == 0 ||
+				stream->public.utf8->allocated * 2 <=
+						stream->utf8_limit)) {
+			error = parserutils_buffer_grow(stream->public.utf8);
+			if (error != PARSERUTILS_OK)
+				return error;
+		}
+
+		utf8 = stream->public.utf8->data + stream->public.utf8->length;
+		utf8_space = stream->public.utf8->allocated - 
+				stream->public.utf8->length;
+
+		/* Buffer's at its limit and full of unread data */
+		if (utf8_space == 0)
+			return PARSERUTILS_NOMEM;
+	}
+
+	/* Try to fill utf8 buffer from the raw data */
+	raw_start = raw;
+	utf8_start = utf8;
+	source = stream->raw_offset;
+	replacements = stream->replacements +
+			parserutils__filter_replacements(stream->input);
+
+	error = PARSERUTILS_OK;
+	if (stream->run != NULL) {
+		error = parserutils_inputstream_decode_parallel(stream,
+				&raw, &raw_length, &utf8, &utf8_space);
+	}
+
+	if (raw != raw_start || error != PARSERUTILS_OK) {
+		/* Decoded in parallel, so that's enough for now */
+	} else if (stream->passthrough) {
+		error = parserutils_inputstream_copy_utf8(&raw, &raw_length,
+				&utf8, &utf8_space,
+				parserutils_inputstream_raw_final(stream,
+						raw_length),
+				&stream->replacements);
+	} else {
+		error = parserutils__filter_process_chunk(stream->input, 
+				&raw, &raw_length, &utf8, &utf8_space);
+	}
+	/* _NOMEM implies that there's more input to read than available space
+	 * in the utf8 buffer. That's fine, so we'll ignore that error. */
+	if (error != PARSERUTILS_OK && error != PARSERUTILS_NOMEM)
+		return error;
+
+	replaced = (replacements != stream->replacements +
+			parserutils__filter_replacements(stream->input));
+
+	/* Note where invalid input was replaced, while it's to hand */
+	if (replaced && stream->replaced_limit != 0) {
+		parserutils_inputstream_index_replacements(stream,
+				stream->utf8_offset +
+					(utf8_start - stream->public.utf8->data),
+				source, raw_start, raw - raw_start,
+				utf8_start, utf8 - utf8_start);
+	}
+
+	/* Remove the raw data we've processed from the raw buffer */
+	stream->decoded += raw - raw_start;
+	stream->phase = (stream->phase + (raw - raw_start)) & 3;
+
+	error = parserutils_inputstream_consume_raw(stream, raw - raw_start);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	if (stream->raw_limit != 0 && stream->file == NULL) {
+		error = parserutils_buffer_shrink(stream->raw);
+		if (error != PARSERUTILS_OK)
+			return error;
+	}
+
+	/* Fix up the utf8 buffer information */
+	stream->public.utf8->length = 
+			stream->public.utf8->allocated - utf8_space;
+
+	/* Record where the output came from */
+	if (utf8 != utf8_start) {
+		parserutils_inputstream_checkpoint_add(stream,
+				stream->utf8_offset +
+					(utf8_start - stream->public.utf8->data),
+				source, parserutils_inputstream_origin_of(
+					stream, replaced),
+				utf8_start, utf8 - utf8_start);
+	}
+
+	/* And decode what's left while that's read */
+	if (stream->pipeline != NULL)
+		parserutils_inputstream_pipeline_start(stream);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Prepare to decode the raw data from its start in the stream's charset
+ *
+ * \param stream  The inputstream to operate on
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error parserutils_inputstream_start_decoding(
+		parserutils_inputstream_private *stream)
+{
+	parserutils_filter_optparams params;
+	parserutils_error error;
+	const uint8_t *raw;
+	size_t raw_length;
+
+	parserutils_inputstream_raw_data(stream, &raw, &raw_length);
+
+	/* Strip any BOM, and update encoding as appropriate */
+	error = parserutils_inputstream_consume_raw(stream,
+			parserutils_inputstream_strip_bom(
+				&stream->mibenum, raw, raw_length));
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	/* Ensure filter is using the correct encoding */
+	params.encoding.name = 
+		parserutils_charset_mibenum_to_name(stream->mibenum);
+
+	error = parserutils__filter_setopt(stream->input,
+			PARSERUTILS_FILTER_SET_ENCODING, 
+			&params);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	/* UTF-8 input only needs validating, so bypass the filter, unless
+	 * it's to be normalised */
+	stream->passthrough = (stream->mibenum == MIB_UTF_8 &&
+			stream->normalise == false);
+
+	stream->phase = 0;
+	stream->cache_check = (stream->cache != NULL);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Discard the decoded data, and decode the retained raw data again
+ *
+ * \param stream  The inputstream to operate on
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * The cursor returns to the start of the stream. Any data inserted into the
+ * stream is lost.
+ */
+parserutils_error parserutils_inputstream_restart(
+		parserutils_inputstream_private *stream)
+{
+	parserutils_error error;
+
+	stream->raw_retained = 0;
+	stream->file_offset = 0;
+
+	parserutils_inputstream_reset_position(stream);
+
+	error = parserutils__filter_reset(stream->input);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	error = parserutils_inputstream_start_decoding(stream);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	stream->public.utf8->length = 0;
+	stream->public.cursor = 0;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Decode a whole document, reusing the output of an identical one
+ *
+ * \param stream  The inputstream to operate on
+ * \param done    Pointer to location to receive whether the document was
+ *                decoded
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * This is called just after decoding starts, with nothing yet decoded. If
+ * all the raw data has been appended, and is to hand in one piece, the UTF-8
+ * for it is copied from the cache, or failing that decoded and added to the
+ * cache. Otherwise, the stream is left to decode its data as usual.
+ */
+parserutils_error parserutils_inputstream_cache_decode(
+		parserutils_inputstream_private *stream, bool *done)
+{
+	parserutils_buffer *utf8 = stream->public.utf8;
+	parserutils_decode_cache_entry *entry;
+	const uint8_t *raw, *data, *cached;
+	size_t raw_length, len, cached_len, source;
+	uint32_t replacements;
+	parserutils_error error;
+
+	*done = false;
+
+	/* UTF-8 needs only validating, and the pipeline and buffer limits
+	 * decode only some of the data at a time */
+	if (stream->public.had_eof == false || stream->passthrough ||
+			stream->pipeline != NULL || stream->utf8_limit != 0 ||
+			utf8->length != 0)
+		return PARSERUTILS_OK;
+
+	parserutils_inputstream_raw_data(stream, &raw, &raw_length);
+	if (raw_length == 0 || (stream->file == NULL &&
+			raw_length != stream->raw->length -
+				stream->raw_retained +
+				stream->borrowed_length) ||
+			parserutils__decode_cache_fits(stream->cache,
+				raw_length) == false)
+		return PARSERUTILS_OK;
+
+	source = stream->raw_offset;
+	data = raw;
+	len = raw_length;
+
+	if (parserutils__decode_cache_find(stream->cache, stream->mibenum,
+			stream->normalise, raw, raw_length, &entry,
+			&cached, &cached_len, &replacements)) {
+		error = parserutils_buffer_append(utf8, cached, cached_len);
+		parserutils__decode_cache_release(stream->cache, entry);
+		if (error != PARSERUTILS_OK)
+			return error;
+
+		stream->replacements += replacements;
+		stream->phase = (stream->phase + raw_length) & 3;
+		len = 0;
+	} else {
+		uint32_t before = stream->replacements +
+				parserutils__filter_replacements(stream->input);
+
+		/* Most charsets take at most twice the space as UTF-8 */
+		error = parserutils_buffer_reserve(utf8, 2 * raw_length);
+		if (error != PARSERUTILS_OK)
+			return error;
+
+		while (len > 0 || parserutils__filter_pending(stream->input)) {
+			const uint8_t *start = data;
+			uint8_t *out = utf8->data + utf8->length;
+			size_t space = utf8->allocated - utf8->length;
+
+			error = PARSERUTILS_OK;
+			if (stream->run != NULL) {
+				error = parserutils_inputstream_decode_parallel(
+						stream, &data, &len,
+						&out, &space);
+			}
+
+			if (data == start && error == PARSERUTILS_OK) {
+				error = parserutils__filter_process_chunk(
+						stream->input, &data, &len,
+						&out, &space);
+			}
+
+			stream->decoded += data - start;
+			stream->phase = (stream->phase + (data - start)) & 3;
+
+			if (error == PARSERUTILS_NOMEM) {
+				utf8->length = utf8->allocated - space;
+
+				error = parserutils_buffer_grow(utf8);
+				if (error != PARSERUTILS_OK)
+					return error;
+				continue;
+			}
+			if (error != PARSERUTILS_OK)
+				return error;
+
+			/* Anything left is held by the filter until EOF */
+			if (data == start && out == utf8->data + utf8->length)
+				break;
+
+			utf8->length = utf8->allocated - space;
+		}
+
+		replacements = stream->replacements - before +
+				parserutils__filter_replacements(stream->input);
+
+		/* Output from part of the data depends on what follows */
+		if (len == 0) {
+			error = parserutils__decode_cache_add(stream->cache,
+					stream->mibenum, stream->normalise,
+					raw, raw_length, utf8->data,
+					utf8->length, replacements);
+			if (error != PARSERUTILS_OK)
+				return error;
+		}
+	}
+
+	if (replacements != 0 && stream->replaced_limit != 0) {
+		parserutils_inputstream_index_replacements(stream,
+				stream->utf8_offset, source, raw,
+				raw_length - len, utf8->data, utf8->length);
+	}
+
+	error = parserutils_inputstream_consume_raw(stream, raw_length - len);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	if (stream->raw_limit != 0 && stream->file == NULL) {
+		error = parserutils_buffer_shrink(stream->raw);
+		if (error != PARSERUTILS_OK)
+			return error;
+	}
+
+	if (utf8->length > 0) {
+		parserutils_inputstream_checkpoint_add(stream,
+				stream->utf8_offset, source,
+				parserutils_inputstream_origin_of(stream,
+					replacements != 0),
+				utf8->data, utf8->length);
+	}
+
+	*done = true;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Make room before the cursor for data to be inserted
+ *
+ * \param stream  The inputstream to operate on
+ * \param len     Length of data to be inserted, in bytes
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * The gap is made larger than required by the length of the data after the
+ * cursor, so the cost of moving that data is spread over later insertions.
+ * The gap lies in the consumed part of the buffer, and will be reclaimed by
+ * the next refill. If the stream is marked, the data before the cursor may
+ * be read again, so the gap is exactly the length required.
+ */
+parserutils_error parserutils_inputstream_open_gap(
+		parserutils_inputstream_private *stream, size_t len)
+{
+	parserutils_buffer *utf8 = stream->public.utf8;
+	size_t tail = utf8->length - stream->public.cursor;
+	size_t gap = (stream->n_marks > 0)
+			? len : len - stream->public.cursor + tail;
+	parserutils_error error;
+
+	while (utf8->allocated - utf8->length < gap) {
+		error = parserutils_buffer_grow(utf8);
+		if (error != PARSERUTILS_OK)
+			return error;
+	}
+
+	memmove(utf8->data + stream->public.cursor + gap,
+			utf8->data + stream->public.cursor, tail);
+	utf8->moved += tail;
+
+	utf8->length += gap;
+	stream->public.cursor += gap;
+	stream->utf8_offset -= gap;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Find the length of any BOM at the start of data in the given encoding
+ *
+ * \param mibenum  Pointer to the character set of the data, updated on exit
+ * \param data     The data to process
+ * \param len      Length of the data, in bytes
+ * \return Length of the BOM, in bytes, or 0 if there is none
+ */
+size_t parserutils_inputstream_strip_bom(uint16_t *mibenum,
+		const uint8_t *data, size_t len)
+{
+	size_t bomlen;
+
+	switch (*mibenum) {
+	case MIB_UTF_16:
+		/* Big endian, unless the BOM says otherwise */
+		*mibenum = MIB_UTF_16BE;
+
+		bomlen = parserutils__charset_bom_length(MIB_UTF_16BE,
+				data, len);
+		if (bomlen == 0) {
+			bomlen = parserutils__charset_bom_length(MIB_UTF_16LE,
+					data, len);
+			if (bomlen != 0)
+				*mibenum = MIB_UTF_16LE;
+		}
+
+		return bomlen;
+	case MIB_UTF_32:
+		/* Big endian, unless the BOM says otherwise */
+		*mibenum = MIB_UTF_32BE;
+
+		bomlen = parserutils__charset_bom_length(MIB_UTF_32BE,
+				data, len);
+		if (bomlen == 0) {
+			bomlen = parserutils__charset_bom_length(MIB_UTF_32LE,
+					data, len);
+			if (bomlen != 0)
+				*mibenum = MIB_UTF_32LE;
+		}
+
+		return bomlen;
+	default:
+		return parserutils__charset_bom_length(*mibenum, data, len);
+	}
+}
+
+/**
+ * Find the raw data that remains to be decoded
+ *
+ * \param stream  The inputstream to operate on
+ * \param data    Pointer to location to receive pointer to raw data
+ * \param len     Pointer to location to receive length of raw data
+ */
+void parserutils_inputstream_raw_data(parserutils_inputstream_private *stream,
+		const uint8_t **data, size_t *len)
+{
+	if (stream->file != NULL) {
+		*data = stream->file->data + stream->file_offset;
+		*len = stream->file->length - stream->file_offset;
+	} else if (stream->raw->length == stream->raw_retained &&
+			stream->borrowed_count > 0) {
+		const parserutils_inputstream_iov *first =
+				&stream->borrowed[stream->borrowed_first];
+
+		*data = first->data + stream->borrowed_offset;
+		*len = first->len - stream->borrowed_offset;
+	} else {
+		*data = stream->raw->data + stream->raw_retained;
+		*len = stream->raw->length - stream->raw_retained;
+	}
+}
+
+/**
+ * Determine whether the start of the raw data is all that remains of it
+ *
+ * \param stream  The inputstream to consider
+ * \param len     Length of the start of the raw data, in bytes
+ * \return true if EOF has been seen and no data follows, false otherwise
+ *
+ * The raw data returned by parserutils_inputstream_raw_data may be followed
+ * by lent data, so EOF alone doesn't mean a character it ends part way
+ * through is incomplete.
+ */
+bool parserutils_inputstream_raw_final(parserutils_inputstream_private *stream,
+		size_t len)
+{
+	size_t remaining;
+
+	if (stream->public.had_eof == false)
+		return false;
+
+	if (stream->file != NULL) {
+		remaining = stream->file->length - stream->file_offset;
+	} else {
+		remaining = stream->raw->length - stream->raw_retained +
+				stream->borrowed_length;
+	}
+
+	return len == remaining;
+}
+
+/**
+ * Remove decoded data from the front of the raw data
+ *
+ * \param stream  The inputstream to operate on
+ * \param len     Length of data to remove, in bytes
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * If the stream is restartable, the data is kept for as long as the
+ * retention limit allows. Data copied from a lent segment, which remains
+ * once all before it has been removed, is given back to the segment.
+ */
+parserutils_error parserutils_inputstream_consume_raw(
+		parserutils_inputstream_private *stream, size_t len)
+{
+	parserutils_error error;
+	size_t used;
+
+	if (len == 0)
+		return PARSERUTILS_OK;
+
+	stream->raw_offset += len;
+
+	if (stream->file != NULL) {
+		stream->file_offset += len;
+		if (stream->file_offset > stream->retain_limit)
+			stream->restartable = false;
+		return PARSERUTILS_OK;
+	}
+
+	if (stream->restartable) {
+		if (stream->raw_retained + len <= stream->retain_limit) {
+			stream->raw_retained += len;
+			return PARSERUTILS_OK;
+		}
+
+		/* Too much has been decoded to keep all of it */
+		stream->restartable = false;
+		len += stream->raw_retained;
+		stream->raw_retained = 0;
+	}
+
+	used = min(len, stream->raw->length);
+	if (used > 0) {
+		error = parserutils_buffer_discard(stream->raw, 0, used);
+		if (error != PARSERUTILS_OK)
+			return error;
+
+		len -= used;
+
+		if (stream->raw->length <= stream->stitched) {
+			stream->borrowed_offset -= stream->raw->length;
+			stream->borrowed_length += stream->raw->length;
+			stream->raw->length = 0;
+			stream->stitched = 0;
+		}
+	}
+
+	while (len > 0) {
+		const parserutils_inputstream_iov *first =
+				&stream->borrowed[stream->borrowed_first];
+
+		used = min(len, first->len - stream->borrowed_offset);
+
+		stream->borrowed_offset += used;
+		stream->borrowed_length -= used;
+		len -= used;
+
+		if (stream->borrowed_offset == first->len)
+			parserutils_inputstream_release_first(stream);
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Make room for more lent segments
+ *
+ * \param stream  The inputstream to operate on
+ * \param n       Number of segments to make room for
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error parserutils_inputstream_borrowed_reserve(
+		parserutils_inputstream_private *stream, uint32_t n)
+{
+	parserutils_inputstream_iov *ring;
+	uint32_t alloc = stream->borrowed_alloc;
+
+	if (stream->borrowed_count + n <= alloc)
+		return PARSERUTILS_OK;
+
+	while (alloc < stream->borrowed_count + n)
+		alloc = (alloc == 0) ? BORROWED_MIN : alloc * 2;
+
+	ring = stream->alloc(stream->borrowed,
+			alloc * sizeof(parserutils_inputstream_iov),
+			stream->pw);
+	if (ring == NULL)
+		return PARSERUTILS_NOMEM;
+
+	/* Segments which wrapped round to the start now follow the rest */
+	if (stream->borrowed_first + stream->borrowed_count >
+			stream->borrowed_alloc) {
+		memcpy(ring + stream->borrowed_alloc, ring,
+				(stream->borrowed_first +
+				stream->borrowed_count -
+				stream->borrowed_alloc) *
+				sizeof(parserutils_inputstream_iov));
+	}
+
+	stream->borrowed = ring;
+	stream->borrowed_alloc = alloc;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Release the first lent segment
+ *
+ * \param stream  The inputstream to operate on
+ */
+void parserutils_inputstream_release_first(
+		parserutils_inputstream_private *stream)
+{
+	const parserutils_inputstream_iov *first =
+			&stream->borrowed[stream->borrowed_first];
+
+	stream->borrowed_length -= first->len - stream->borrowed_offset;
+
+	first->release(first->data, first->len, first->pw);
+
+	stream->borrowed_first = (stream->borrowed_first + 1) &
+			(stream->borrowed_alloc - 1);
+	stream->borrowed_count--;
+	stream->borrowed_offset = 0;
+	stream->stitched = 0;
+}
+
+/**
+ * Release all lent segments, without decoding them
+ *
+ * \param stream  The inputstream to operate on
+ */
+void parserutils_inputstream_release_all(
+		parserutils_inputstream_private *stream)
+{
+	while (stream->borrowed_count > 0)
+		parserutils_inputstream_release_first(stream);
+
+	stream->borrowed_first = 0;
+}
+
+/**
+ * Copy all lent data to the raw buffer, releasing its segments
+ *
+ * \param stream  The inputstream to operate on
+ *
+ * The raw buffer must have room for the data.
+ */
+void parserutils_inputstream_flatten(parserutils_inputstream_private *stream)
+{
+	while (stream->borrowed_count > 0) {
+		const parserutils_inputstream_iov *first =
+				&stream->borrowed[stream->borrowed_first];
+
+		/* Can't fail, as there's room */
+		parserutils_buffer_append(stream->raw,
+				first->data + stream->borrowed_offset,
+				first->len - stream->borrowed_offset);
+
+		parserutils_inputstream_release_first(stream);
+	}
+
+	stream->borrowed_first = 0;
+}
+
+/**
+ * Make the raw data's first contiguous run reach some length, if there's
+ * that much, by copying lent data to the raw buffer
+ *
+ * \param stream  The inputstream to operate on
+ * \param want    Length wanted, in bytes
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * This joins up a character split between segments, so it can be decoded.
+ * Data copied from the segment that's then first is given back to it once
+ * what's before has been consumed, so the rest is decoded where it is.
+ */
+parserutils_error parserutils_inputstream_stitch(
+		parserutils_inputstream_private *stream, size_t want)
+{
+	size_t span = stream->raw->length - stream->raw_retained;
+	parserutils_error error;
+
+	if (stream->file != NULL || stream->borrowed_count == 0)
+		return PARSERUTILS_OK;
+
+	if (span == 0) {
+		/* All in one segment, or nothing follows it */
+		if (stream->borrowed_count == 1 ||
+				stream->borrowed[stream->borrowed_first].len -
+				stream->borrowed_offset >= want)
+			return PARSERUTILS_OK;
+	} else if (span >= want) {
+		return PARSERUTILS_OK;
+	}
+
+	error = parserutils_buffer_reserve(stream->raw, want - span);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	while (span < want && stream->borrowed_count > 0) {
+		const parserutils_inputstream_iov *first =
+				&stream->borrowed[stream->borrowed_first];
+		size_t len = min(want - span,
+				first->len - stream->borrowed_offset);
+
+		/* Can't fail, as there's room */
+		parserutils_buffer_append(stream->raw,
+				first->data + stream->borrowed_offset, len);
+
+		span += len;
+		stream->borrowed_offset += len;
+		stream->borrowed_length -= len;
+		stream->stitched += len;
+
+		if (stream->borrowed_offset == first->len)
+			parserutils_inputstream_release_first(stream);
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Determine the length of the run of complete characters in a UTF-8 buffer
+ *
+ * \param data  The buffer to consider
+ * \param len   Length of the buffer, in bytes
+ * \return Length of the buffer, less any trailing incomplete character
+ */
+size_t parserutils_inputstream_span_length(const uint8_t *data, size_t len)
+{
+	size_t start = len, clen;
+
+	/* Find the start of the last character */
+	while (start > 0 && len - start < 6 && (data[start - 1] & 0xC0) == 0x80)
+		start--;
+
+	if (start == 0)
+		return len;
+
+	/* Exclude it if it's incomplete */
+	clen = numContinuations[data[start - 1]] + 1;
+	if ((start - 1) + clen > len)
+		return start - 1;
+
+	return len;
+}
+
+/**
+ * Replace the fully-consumed UTF-8 buffer with the raw buffer's contents
+ *
+ * \param stream  The inputstream to operate on
+ * \return true if the buffers were exchanged, false if the raw data
+ *         contains invalid sequences and must be copied instead
+ *
+ * Any incomplete sequence at the end of the raw data is left in the raw
+ * buffer, awaiting the rest of the character.
+ */
+bool parserutils_inputstream_steal_raw(parserutils_inputstream_private *stream)
+{
+	parserutils_buffer *temp;
+	bool truncated;
+	size_t valid;
+
+	valid = parserutils_inputstream_utf8_valid_length(stream->raw->data,
+			stream->raw->length, &truncated);
+
+	if (valid == 0 || (valid != stream->raw->length && 
+			(truncated == false ||
+			parserutils_inputstream_raw_final(stream,
+					stream->raw->length))))
+		return false;
+
+	parserutils_inputstream_rebase(stream);
+	parserutils_inputstream_checkpoint_add(stream, stream->utf8_offset,
+			stream->raw_offset, ORIGIN_BYTES,
+			stream->raw->data, valid);
+	stream->raw_offset += valid;
+
+	temp = stream->public.utf8;
+	stream->public.utf8 = stream->raw;
+	stream->raw = temp;
+
+	stream->raw->length = 0;
+	stream->stitched = 0;
+
+	/* Return excess space if memory is limited. Failure is harmless,
+	 * as the buffer is left as it was. */
+	if (stream->raw_limit != 0)
+		parserutils_buffer_shrink(stream->raw);
+
+	if (valid != stream->public.utf8->length) {
+		/* At most 5 bytes, and the buffer's empty, so can't fail */
+		parserutils_buffer_append(stream->raw,
+				stream->public.utf8->data + valid,
+				stream->public.utf8->length - valid);
+
+		stream->public.utf8->length = valid;
+	}
+
+	stream->public.cursor = 0;
+
+	stream->decoded += valid;
+
+	return true;
+}
+
+/**
+ * Determine the length of the valid UTF-8 prefix of a buffer
+ *
+ * \param data       The buffer to consider
+ * \param len        Length of the buffer, in bytes
+ * \param truncated  Pointer to location to receive whether the prefix is
+ *                   followed by an incomplete (rather than invalid) sequence
+ * \return Length of the valid prefix, in bytes
+ *
+ * Valid sequences are those accepted by the UTF-8 charset codec.
+ */
+size_t parserutils_inputstream_utf8_valid_length(const uint8_t *data,
+		size_t len, bool *truncated)
+{
+	size_t off = 0;
+
+	*truncated = false;
+
+	while (off < len) {
+		parserutils_error error;
+		uint32_t ucs4;
+		size_t clen;
+
+		off += simd_ascii_prefix(data + off, len - off);
+		if (off == len)
+			break;
+
+		{
+			const uint8_t *src = data + off;
+			size_t srclen = len - off;
+			uint32_t *uptr = &ucs4;
+			size_t *clptr = &clen;
+
+			UTF8_TO_UCS4(src, srclen, uptr, clptr, error);
+		}
+		if (error != PARSERUTILS_OK) {
+			*truncated = (error == PARSERUTILS_NEEDDATA);
+			break;
+		}
+
+		off += clen;
+	}
+
+	return off;
+}
+
+/**
+ * Find the length of an invalid UTF-8 sequence
+ *
+ * \param data  The sequence, which is invalid or incomplete
+ * \param len   Length of data, in bytes
+ * \return Number of bytes to replace with a single U+FFFD
+ *
+ * This is the start byte and any continuation bytes that follow it.
+ */
+size_t parserutils_inputstream_invalid_length(const uint8_t *data,
+		size_t len)
+{
+	size_t ncont = numContinuations[data[0]];
+	size_t skip = 1;
+
+	if ((data[0] & 0xC0) == 0xC0) {
+		while (skip <= ncont && skip < len &&
+				(data[skip] & 0xC0) == 0x80)
+			skip++;
+	}
+
+	return skip;
+}
+
+/**
+ * Copy UTF-8 data, replacing invalid sequences with U+FFFD
+ *
+ * \param data          Pointer to pointer to input buffer
+ * \param len           Pointer to length of input buffer
+ * \param output        Pointer to pointer to output buffer
+ * \param outlen        Pointer to length of output buffer
+ * \param eof           Whether the input is followed by no more data
+ * \param replacements  Pointer to counter of U+FFFD characters, updated
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM if the output buffer is too small
+ *
+ * This behaves as parserutils__filter_process_chunk would if converting
+ * from UTF-8 with a loose error mode. Incomplete sequences at the end of the
+ * input are left unconsumed, unless eof is set.
+ */
+parserutils_error parserutils_inputstream_copy_utf8(
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen,
+		bool eof, uint32_t *replacements)
+{
+	while (*len > 0) {
+		const uint8_t *s = *data;
+		size_t window = min(*len, *outlen);
+		bool truncated;
+		size_t valid, skip, ncont;
+
+		/* Only validate as much as there's room for */
+		valid = parserutils_inputstream_utf8_valid_length(s, window,
+				&truncated);
+
+		memcpy(*output, s, valid);
+		*output += valid;
+		*outlen -= valid;
+		*data += valid;
+		*len -= valid;
+
+		/* Out of room, unless the window ends in an error */
+		if (window < valid + *len && (valid == window || truncated))
+			return PARSERUTILS_NOMEM;
+
+		if (*len == 0)
+			break;
+
+		/* Work out how much to replace */
+		s = *data;
+		ncont = numContinuations[s[0]];
+		skip = parserutils_inputstream_invalid_length(s, *len);
+
+		if (skip == *len && (truncated || skip <= ncont) &&
+				eof == false) {
+			/* Need more data to be sure */
+			break;
+		}
+
+		if (*outlen < 3)
+			return PARSERUTILS_NOMEM;
+
+		(*output)[0] = 0xef;
+		(*output)[1] = 0xbf;
+		(*output)[2] = 0xbd;
+
+		*output += 3;
+		*outlen -= 3;
+
+		*data += skip;
+		*len -= skip;
+
+		(*replacements)++;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Determine how the raw data may be split for decoding in parallel
+ *
+ * \param stream  The inputstream to consider
+ * \return How the data may be split
+ *
+ * Only charsets in which a character boundary can be found from the data
+ * around it, and which are decoded by a native codec, can be split.
+ */
+parserutils_inputstream_split parserutils_inputstream_split_kind(
+		parserutils_inputstream_private *stream)
+{
+	const parserutils_charset_aliases_canon *canon;
+	parserutils_charset_codec *codec;
+
+	if (stream->passthrough)
+		return SPLIT_UTF8;
+
+	codec = parserutils__filter_utf8_codec(stream->input);
+	if (codec == NULL)
+		return SPLIT_NONE;
+
+	canon = parserutils__charset_alias_from_mibenum(codec->mibenum);
+	if (canon == NULL)
+		return SPLIT_NONE;
+
+	switch (canon->handler) {
+	case PARSERUTILS_CHARSET_HANDLER_SBCS:
+		return SPLIT_BYTE;
+	case PARSERUTILS_CHARSET_HANDLER_UTF16:
+		if (codec->mibenum == MIB_UTF_16BE)
+			return SPLIT_UTF16BE;
+		if (codec->mibenum == MIB_UTF_16LE)
+			return SPLIT_UTF16LE;
+		break;
+	case PARSERUTILS_CHARSET_HANDLER_UTF32:
+		if (codec->mibenum == MIB_UTF_32BE ||
+				codec->mibenum == MIB_UTF_32LE)
+			return SPLIT_UTF32;
+		break;
+	default:
+		break;
+	}
+
+	return SPLIT_NONE;
+}
+
+/**
+ * Find the most UTF-8 that a segment of raw data can decode to
+ *
+ * \param kind  How the data is split, which must not be SPLIT_NONE
+ * \param len   Length of the segment, in bytes
+ * \return Maximum length of the UTF-8, in bytes
+ */
+size_t parserutils_inputstream_split_bound(parserutils_inputstream_split kind,
+		size_t len)
+{
+	switch (kind) {
+	case SPLIT_UTF16BE:
+	case SPLIT_UTF16LE:
+		/* A BMP character, or U+FFFD for an invalid code unit */
+		return len / 2 * 3;
+	case SPLIT_UTF32:
+		return len;
+	default:
+		/* U+FFFD for each byte */
+		return len * 3;
+	}
+}
+
+/**
+ * Find a place to split raw data for decoding in parallel
+ *
+ * \param kind   How the data may be split, which must not be SPLIT_NONE
+ * \param phase  Offset of data from the start of decoding, modulo 4
+ * \param data   The raw data
+ * \param len    Length of the data, in bytes
+ * \param off    Offset at which to start looking, which must be non-zero
+ * \return Offset of the first split point at or after off, or 0 if none
+ *
+ * A split point is where decoding the data in one go would start a new
+ * character, and would neither end a run of invalid input nor leave an
+ * incomplete character buffered just before. Thus, decoding the data either
+ * side of the split separately gives the same result. Each split point is
+ * followed by at least one byte, so that this can be determined.
+ */
+size_t parserutils_inputstream_split_point(parserutils_inputstream_split kind,
+		uint32_t phase, const uint8_t *data, size_t len, size_t off)
+{
+	switch (kind) {
+	case SPLIT_BYTE:
+		break;
+	case SPLIT_UTF8:
+		/* Invalid sequences are the start byte and any
+		 * continuation bytes after it */
+		while (off < len && (data[off] & 0xC0) == 0x80)
+			off++;
+		break;
+	case SPLIT_UTF16BE:
+	case SPLIT_UTF16LE:
+		/* Each run of invalid code units is replaced as one, so
+		 * split before a BMP character not following a high
+		 * surrogate */
+		for (off += (phase + off) & 1; off + 2 <= len; off += 2) {
+			uint32_t unit, prev;
+
+			if (kind == SPLIT_UTF16BE) {
+				unit = (data[off] << 8) | data[off + 1];
+				prev = (data[off - 2] << 8) | data[off - 1];
+			} else {
+				unit = (data[off + 1] << 8) | data[off];
+				prev = (data[off - 1] << 8) | data[off - 2];
+			}
+
+			if ((unit < 0xD800 || unit > 0xDFFF) &&
+					(prev < 0xD800 || prev > 0xDBFF))
+				return off;
+		}
+
+		return 0;
+	case SPLIT_UTF32:
+		off += (4 - ((phase + off) & 3)) & 3;
+		break;
+	default:
+		return 0;
+	}
+
+	return (off < len) ? off : 0;
+}
+
+/**
+ * Find the space a parallel refill of the UTF-8 buffer would need
+ *
+ * \param stream      The inputstream to consider
+ * \param raw_length  Length of the raw data, in bytes
+ * \return Space needed in the UTF-8 buffer, in bytes, or 0 if the raw data
+ *         won't be decoded in parallel
+ */
+size_t parserutils_inputstream_parallel_space(
+		parserutils_inputstream_private *stream, size_t raw_length)
+{
+	parserutils_inputstream_split kind;
+
+	if (raw_length < 2 * stream->segment)
+		return 0;
+
+	kind = parserutils_inputstream_split_kind(stream);
+	if (kind == SPLIT_NONE)
+		return 0;
+
+	/* Each segment may extend a little past its nominal end */
+	return parserutils_inputstream_split_bound(kind,
+			min(raw_length, stream->tasks * (stream->segment + 4))) +
+			PARALLEL_SLACK;
+}
+
+/**
+ * Decode the raw data in parallel, as a task for each segment of it
+ *
+ * \param stream      The inputstream being refilled
+ * \param raw         Pointer to pointer to raw data, updated
+ * \param raw_length  Pointer to length of raw data, updated
+ * \param utf8        Pointer to pointer to output buffer, updated
+ * \param utf8_space  Pointer to length of output buffer, updated
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * Nothing is decoded if there's too little data, or it can't be split.
+ * Each segment is decoded into its own region of the output buffer, and
+ * the results are then moved together, in order. The first segment is
+ * decoded by the filter's own codec, which may be part way through a
+ * character. The others use codecs of their own, and each ends where the
+ * next begins, at a split point. The last ends at a split point too,
+ * leaving any incomplete character for later.
+ */
+parserutils_error parserutils_inputstream_decode_parallel(
+		parserutils_inputstream_private *stream,
+		const uint8_t **raw, size_t *raw_length,
+		uint8_t **utf8, size_t *utf8_space)
+{
+	parserutils_inputstream_segment *segs = stream->segments;
+	parserutils_inputstream_split kind;
+	parserutils_error error = PARSERUTILS_OK;
+	size_t start = 0, used = 0, consumed = 0, written = 0;
+	uint32_t n = 0, i;
+
+	if (*raw_length < 2 * stream->segment)
+		return PARSERUTILS_OK;
+
+	kind = parserutils_inputstream_split_kind(stream);
+	if (kind == SPLIT_NONE)
+		return PARSERUTILS_OK;
+
+	/* Split the data into segments of roughly equal size, for as
+	 * long as the output buffer can hold all they might decode to */
+	while (n < stream->tasks) {
+		size_t end, bound;
+
+		if (*raw_length - start < stream->segment)
+			break;
+
+		end = parserutils_inputstream_split_point(kind, stream->phase,
+				*raw, *raw_length, start + stream->segment);
+		if (end == 0)
+			break;
+
+		bound = parserutils_inputstream_split_bound(kind, end - start);
+		if (n == 0)
+			bound += PARALLEL_SLACK;
+		if (*utf8_space - used < bound)
+			break;
+
+		segs[n].data = *raw + start;
+		segs[n].len = end - start;
+		segs[n].output = *utf8 + used;
+		segs[n].space = bound;
+		segs[n].written = 0;
+		segs[n].codec = NULL;
+		segs[n].replacements = 0;
+		segs[n].error = PARSERUTILS_OK;
+
+		start = end;
+		used += bound;
+		n++;
+	}
+
+	if (n < 2)
+		return PARSERUTILS_OK;
+
+	if (kind != SPLIT_UTF8) {
+		segs[0].codec = parserutils__filter_utf8_codec(stream->input);
+
+		for (i = 1; i < n; i++) {
+			if (parserutils__filter_codec_get(stream->input,
+					&segs[i].codec) != PARSERUTILS_OK)
+				break;
+		}
+
+		/* Without memory for the codecs, use those there are */
+		n = i;
+	}
+
+	if (n >= 2) {
+		stream->run(parserutils_inputstream_decode_segment, segs, n,
+				stream->run_pw);
+	} else {
+		parserutils_inputstream_decode_segment(segs, 0);
+	}
+
+	/* Gather the results in order. A segment can only be used if all
+	 * before it were decoded completely, and only the first may have
+	 * been decoded in part. The rest are decoded again later. */
+	for (i = 0; i < n; i++) {
+		size_t len = segs[i].data - (*raw + consumed);
+
+		if (i > 0 && (segs[i].len != 0 ||
+				segs[i].error != PARSERUTILS_OK))
+			break;
+
+		memmove(*utf8 + written, segs[i].output, segs[i].written);
+		written += segs[i].written;
+		consumed += len;
+
+		stream->replacements += segs[i].replacements;
+
+		if (segs[i].len != 0 || segs[i].error != PARSERUTILS_OK) {
+			/* Running out of space isn't an error */
+			if (segs[i].error != PARSERUTILS_NOMEM)
+				error = segs[i].error;
+			break;
+		}
+	}
+
+	for (i = 1; i < n; i++) {
+		if (segs[i].codec != NULL)
+			parserutils__filter_codec_put(stream->input,
+					segs[i].codec);
+	}
+
+	*raw += consumed;
+	*raw_length -= consumed;
+	*utf8 += written;
+	*utf8_space -= written;
+
+	return error;
+}
+
+/**
+ * Decode a segment of raw data, as a task of a parallel refill
+ *
+ * \param ctx    The segments being decoded
+ * \param index  Index of the segment to decode
+ */
+void parserutils_inputstream_decode_segment(void *ctx, size_t index)
+{
+	parserutils_inputstream_segment *seg =
+			((parserutils_inputstream_segment *) ctx) + index;
+	uint8_t *output = seg->output;
+	size_t space = seg->space;
+
+	if (seg->codec != NULL) {
+		seg->error = parserutils__charset_codec_decode_utf8(seg->codec,
+				&seg->data, &seg->len, &output, &space,
+				&seg->replacements);
+	} else {
+		seg->error = parserutils_inputstream_copy_utf8(&seg->data,
+				&seg->len, &output, &space, true,
+				&seg->replacements);
+	}
+
+	seg->written = output - seg->output;
+}
+
+/**
+ * Start, stop or reconfigure decoding in the background
+ *
+ * \param stream  The inputstream to configure
+ * \param params  Pipeline parameters
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * Stopping the pipeline keeps any output of its last task.
+ */
+parserutils_error parserutils_inputstream_pipeline_set(
+		parserutils_inputstream_private *stream,
+		const parserutils_inputstream_optparams *params)
+{
+#ifdef WITHOUT_PIPELINE
+	UNUSED(stream);
+	UNUSED(params);
+
+	return PARSERUTILS_BADPARM;
+#else
+	parserutils_inputstream_pipeline *p = stream->pipeline;
+	parserutils_error error;
+
+	if (params->pipeline.submit == NULL) {
+		bool collected;
+
+		if (p == NULL)
+			return PARSERUTILS_OK;
+
+		error = parserutils_inputstream_pipeline_collect(stream,
+				&collected);
+		if (error != PARSERUTILS_OK)
+			return error;
+
+		parserutils_buffer_destroy(p->in);
+		parserutils_buffer_destroy(p->out);
+		stream->alloc(p, 0, stream->pw);
+		stream->pipeline = NULL;
+
+		return PARSERUTILS_OK;
+	}
+
+	if (stream->retain_limit != 0 || stream->utf8_limit != 0)
+		return PARSERUTILS_INVALID;
+
+	if (p == NULL) {
+		p = stream->alloc(NULL, sizeof(*p), stream->pw);
+		if (p == NULL)
+			return PARSERUTILS_NOMEM;
+
+		error = parserutils_buffer_create(stream->alloc, stream->pw,
+				&p->in);
+		if (error != PARSERUTILS_OK) {
+			stream->alloc(p, 0, stream->pw);
+			return error;
+		}
+
+		error = parserutils_buffer_create(stream->alloc, stream->pw,
+				&p->out);
+		if (error != PARSERUTILS_OK) {
+			parserutils_buffer_destroy(p->in);
+			stream->alloc(p, 0, stream->pw);
+			return error;
+		}
+
+		p->out->trace = (stream->trace.func != NULL)
+				? &stream->trace : NULL;
+		p->state = PIPELINE_IDLE;
+
+		stream->pipeline = p;
+	} else {
+		/* Let any task finish with the old settings */
+		parserutils_inputstream_pipeline_wait(stream);
+	}
+
+	p->submit = params->pipeline.submit;
+	p->wait = params->pipeline.wait;
+	p->pw = params->pipeline.pw;
+	p->segment = (params->pipeline.segment != 0)
+			? max(params->pipeline.segment, PIPELINE_MIN_SEGMENT)
+			: PIPELINE_SEGMENT;
+
+	/* There may be enough data already */
+	parserutils_inputstream_pipeline_start(stream);
+
+	return PARSERUTILS_OK;
+#endif
+}
+
+/**
+ * Start decoding the next segment of raw data in the background
+ *
+ * \param stream  The inputstream to decode
+ *
+ * Nothing is started while a task is running or its output is unused,
+ * before the charset is known, or while there is less than a segment of
+ * data and more to come. The task is given a copy of the data, so the raw
+ * buffer may be appended to while it runs; the data is only consumed when
+ * the output is used. Failure to allocate memory leaves the data to be
+ * decoded by the next refill.
+ */
+void parserutils_inputstream_pipeline_start(
+		parserutils_inputstream_private *stream)
+{
+#ifdef WITHOUT_PIPELINE
+	UNUSED(stream);
+#else
+	parserutils_inputstream_pipeline *p = stream->pipeline;
+	const uint8_t *raw;
+	size_t raw_length, len;
+
+	if (PIPELINE_LOAD(&p->state) != PIPELINE_IDLE ||
+			stream->done_first_chunk == false)
+		return;
+
+	parserutils_inputstream_raw_data(stream, &raw, &raw_length);
+
+	if (raw_length == 0 || (raw_length < p->segment &&
+			stream->public.had_eof == false))
+		return;
+
+	len = min(raw_length, p->segment);
+
+	p->in->length = 0;
+	p->out->length = 0;
+
+	if (parserutils_buffer_append(p->in, raw, len) != PARSERUTILS_OK ||
+			parserutils_buffer_reserve(p->out,
+				3 * len + PARALLEL_SLACK) != PARSERUTILS_OK)
+		return;
+
+	p->data = p->in->data;
+	p->len = len;
+	p->output = p->out->data;
+	p->space = p->out->allocated;
+	p->eof = (len == raw_length &&
+			parserutils_inputstream_raw_final(stream, len));
+	p->replacements = 0;
+	p->filter_replacements =
+			parserutils__filter_replacements(stream->input);
+	p->error = PARSERUTILS_OK;
+
+	PIPELINE_STORE(&p->state, PIPELINE_BUSY);
+
+	p->submit(parserutils_inputstream_pipeline_task, stream, p->pw);
+#endif
+}
+
+/**
+ * Wait for any task decoding in the background to finish
+ *
+ * \param stream  The inputstream being decoded
+ */
+void parserutils_inputstream_pipeline_wait(
+		parserutils_inputstream_private *stream)
+{
+#ifdef WITHOUT_PIPELINE
+	UNUSED(stream);
+#else
+	parserutils_inputstream_pipeline *p = stream->pipeline;
+
+	while (PIPELINE_LOAD(&p->state) == PIPELINE_BUSY) {
+		if (p->wait != NULL)
+			p->wait(p->pw);
+	}
+#endif
+}
+
+/**
+ * Use the output of the last task decoding in the background
+ *
+ * \param stream     The inputstream being refilled
+ * \param collected  Pointer to location to receive whether any output was
+ *                   added to the UTF-8 buffer
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * The unread part of the UTF-8 buffer is moved to its start, and the output
+ * added after it, so this leaves the stream as a refill would. If it was
+ * all read, the buffers simply exchange roles.
+ */
+parserutils_error parserutils_inputstream_pipeline_collect(
+		parserutils_inputstream_private *stream, bool *collected)
+{
+#ifdef WITHOUT_PIPELINE
+	UNUSED(stream);
+
+	*collected = false;
+
+	return PARSERUTILS_OK;
+#else
+	parserutils_inputstream_pipeline *p = stream->pipeline;
+	parserutils_buffer *utf8 = stream->public.utf8;
+	parserutils_error error;
+	size_t consumed, written, source = stream->raw_offset;
+	bool replaced;
+
+	*collected = false;
+
+	parserutils_inputstream_pipeline_wait(stream);
+
+	if (p->state == PIPELINE_IDLE)
+		return PARSERUTILS_OK;
+
+	p->state = PIPELINE_IDLE;
+
+	consumed = p->data - p->in->data;
+	written = p->output - p->out->data;
+
+	stream->decoded += consumed;
+	stream->phase = (stream->phase + consumed) & 3;
+	stream->replacements += p->replacements;
+
+	error = parserutils_inputstream_consume_raw(stream, consumed);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	if (written != 0) {
+		size_t read = parserutils_inputstream_rebase(stream);
+		size_t unread = utf8->length - read;
+
+		if (unread == 0) {
+			p->out->length = written;
+
+			stream->public.utf8 = p->out;
+			p->out = utf8;
+		} else {
+			error = parserutils_buffer_discard(utf8, 0, read);
+			if (error == PARSERUTILS_OK)
+				error = parserutils_buffer_append(utf8,
+						p->out->data, written);
+			if (error != PARSERUTILS_OK)
+				return error;
+		}
+
+		replaced = (p->replacements != 0 ||
+				parserutils__filter_replacements(
+					stream->input) !=
+					p->filter_replacements);
+
+		if (replaced && stream->replaced_limit != 0) {
+			parserutils_inputstream_index_replacements(stream,
+					stream->utf8_offset + unread, source,
+					p->in->data, consumed,
+					stream->public.utf8->data + unread,
+					written);
+		}
+
+		parserutils_inputstream_checkpoint_add(stream,
+				stream->utf8_offset + unread, source,
+				parserutils_inputstream_origin_of(stream,
+					replaced),
+				stream->public.utf8->data + unread, written);
+
+		*collected = true;
+	}
+
+	/* Running out of space isn't an error */
+	if (p->error != PARSERUTILS_OK && p->error != PARSERUTILS_NOMEM)
+		return p->error;
+
+	return PARSERUTILS_OK;
+#endif
+}
+
+/**
+ * Decode a segment of raw data, as a task in the background
+ *
+ * \param ctx    The inputstream being decoded
+ * \param index  Unused
+ */
+void parserutils_inputstream_pipeline_task(void *ctx, size_t index)
+{
+	parserutils_inputstream_private *stream = ctx;
+	parserutils_inputstream_pipeline *p = stream->pipeline;
+
+	UNUSED(index);
+
+	if (stream->passthrough) {
+		p->error = parserutils_inputstream_copy_utf8(&p->data, &p->len,
+				&p->output, &p->space, p->eof,
+				&p->replacements);
+	} else {
+		p->error = parserutils__filter_process_chunk(stream->input,
+				&p->data, &p->len, &p->output, &p->space);
+	}
+
+#ifndef WITHOUT_PIPELINE
+	PIPELINE_STORE(&p->state, PIPELINE_DONE);
+#endif
+}
+
+/**
+ * Return the stream's position to the start of the document
+ *
+ * \param stream  The inputstream to reset
+ */
+void parserutils_inputstream_reset_position(
+		parserutils_inputstream_private *stream)
+{
+	stream->utf8_offset = 0;
+	stream->raw_offset = 0;
+
+	stream->pos.offset = 0;
+	stream->pos.source = 0;
+	stream->pos.line = 1;
+	stream->pos.column = 1;
+
+	stream->origin = ORIGIN_UNKNOWN;
+	stream->n_checkpoints = 0;
+	stream->next_checkpoint = 0;
+	stream->mapped = false;
+
+	stream->n_marks = 0;
+
+	stream->n_replaced = 0;
+	stream->replaced_nomem = false;
+}
+
+/**
+ * Bring the stream's position up to its cursor
+ *
+ * \param stream  The inputstream to update
+ *
+ * The data is counted a refill's output at a time, and the source offset
+ * taken from each checkpoint as it's reached. Checkpoints which have been
+ * passed are forgotten, unless the cursor may be rewound to before them.
+ */
+void parserutils_inputstream_count(parserutils_inputstream_private *stream)
+{
+	parserutils_inputstream_checkpoint *cp = stream->checkpoints;
+	size_t target = stream->utf8_offset + stream->public.cursor;
+
+	while (true) {
+		uint32_t next = stream->next_checkpoint;
+		size_t end = target;
+
+		while (next < stream->n_checkpoints &&
+				cp[next].offset <= stream->pos.offset) {
+			stream->pos.source = cp[next].source;
+			stream->origin = cp[next].origin;
+			next++;
+		}
+
+		stream->next_checkpoint = next;
+
+		if (stream->pos.offset == target)
+			break;
+
+		if (next < stream->n_checkpoints && cp[next].offset < end)
+			end = cp[next].offset;
+
+		parserutils_inputstream_count_span(stream,
+				stream->public.utf8->data +
+					(stream->pos.offset -
+						stream->utf8_offset),
+				end - stream->pos.offset);
+	}
+
+	if (stream->n_marks == 0 && stream->next_checkpoint > 0) {
+		stream->n_checkpoints -= stream->next_checkpoint;
+		memmove(cp, cp + stream->next_checkpoint,
+				stream->n_checkpoints * sizeof(*cp));
+		stream->next_checkpoint = 0;
+	}
+}
+
+/**
+ * Advance the stream's position over data decoded in the same way
+ *
+ * \param stream  The inputstream to update
+ * \param data    The data to count
+ * \param len     Length of data, in bytes
+ */
+void parserutils_inputstream_count_span(
+		parserutils_inputstream_private *stream,
+		const uint8_t *data, size_t len)
+{
+	size_t lines, cont, four, chars;
+
+	simd_utf8_counts(data, len, &lines, &cont, &four);
+	chars = len - cont;
+
+	if (lines != 0) {
+		size_t start = len;
+
+		/* Count the characters of the last line only */
+		while (data[start - 1] != '\n')
+			start--;
+
+		stream->pos.line += lines;
+		stream->pos.column = 1;
+
+		for (; start < len; start++)
+			stream->pos.column += ((data[start] & 0xC0) != 0x80);
+	} else {
+		stream->pos.column += chars;
+	}
+
+	stream->pos.source += parserutils_inputstream_origin_width(
+			stream->origin, len, chars, four);
+	stream->pos.offset += len;
+}
+
+/**
+ * Find the length of the raw data some UTF-8 was decoded from
+ *
+ * \param origin  How the UTF-8 was decoded
+ * \param len     Length of the UTF-8, in bytes
+ * \param chars   Number of characters in it
+ * \param four    Number of those which are four bytes long
+ * \return Length of the raw data, or 0 if it can't be known
+ */
+size_t parserutils_inputstream_origin_width(
+		parserutils_inputstream_origin origin, size_t len,
+		size_t chars, size_t four)
+{
+	switch (origin) {
+	case ORIGIN_BYTES:
+		return len;
+	case ORIGIN_CHARS:
+		return chars;
+	case ORIGIN_UTF16:
+		/* Characters beyond the BMP take two units */
+		return 2 * (chars + four);
+	case ORIGIN_UTF32:
+		return 4 * chars;
+	case ORIGIN_UNKNOWN:
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * Count the data before the cursor, and remove it from the UTF-8 buffer
+ *
+ * \param stream  The inputstream being refilled
+ * \return Length of data to discard from the start of the buffer, which the
+ *         caller must do
+ *
+ * Data after the outermost mark is kept; otherwise, the cursor is placed
+ * at the start of the buffer.
+ */
+size_t parserutils_inputstream_rebase(parserutils_inputstream_private *stream)
+{
+	size_t read = stream->public.cursor;
+
+	parserutils_inputstream_count(stream);
+
+	if (stream->n_marks > 0)
+		read = stream->marks[0].offset - stream->utf8_offset;
+
+	stream->utf8_offset += read;
+	stream->public.cursor -= read;
+
+	return read;
+}
+
+/**
+ * Determine how the output of a refill relates to the raw data
+ *
+ * \param stream    The inputstream being refilled
+ * \param replaced  Whether any invalid input was replaced
+ * \return How the output was decoded
+ */
+parserutils_inputstream_origin parserutils_inputstream_origin_of(
+		parserutils_inputstream_private *stream, bool replaced)
+{
+	if (replaced)
+		return ORIGIN_UNKNOWN;
+
+	/* Those charsets which may be split can also be counted */
+	switch (parserutils_inputstream_split_kind(stream)) {
+	case SPLIT_BYTE:
+		return ORIGIN_CHARS;
+	case SPLIT_UTF8:
+		return ORIGIN_BYTES;
+	case SPLIT_UTF16BE:
+	case SPLIT_UTF16LE:
+		return ORIGIN_UTF16;
+	case SPLIT_UTF32:
+		return ORIGIN_UTF32;
+	case SPLIT_NONE:
+		break;
+	}
+
+	return ORIGIN_UNKNOWN;
+}
+
+/**
+ * Record the start of a refill's output
+ *
+ * \param stream  The inputstream being refilled
+ * \param offset  UTF-8 offset of the output
+ * \param source  Raw offset of the data decoded by the refill
+ * \param origin  How it was decoded
+ * \param data    The output
+ * \param len     Length of the output, in bytes
+ *
+ * A codec may have consumed the start of a character in an earlier refill,
+ * so the output is taken to follow on from the last, if that was decoded
+ * character by character. If the cursor is a long way behind, and there's
+ * no room for another checkpoint, the source offset stops advancing at the
+ * last one.
+ */
+void parserutils_inputstream_checkpoint_add(
+		parserutils_inputstream_private *stream, size_t offset,
+		size_t source, parserutils_inputstream_origin origin,
+		const uint8_t *data, size_t len)
+{
+	parserutils_inputstream_checkpoint *cp;
+
+	if (stream->mapped)
+		source = stream->raw_mapped;
+
+	stream->mapped = (origin != ORIGIN_UNKNOWN);
+	if (stream->mapped) {
+		size_t lines, cont, four;
+
+		simd_utf8_counts(data, len, &lines, &cont, &four);
+
+		stream->raw_mapped = source +
+				parserutils_inputstream_origin_width(origin,
+					len, len - cont, four);
+	}
+
+	if (stream->n_checkpoints == CHECKPOINTS) {
+		stream->checkpoints[CHECKPOINTS - 1].origin = ORIGIN_UNKNOWN;
+		if (stream->next_checkpoint == CHECKPOINTS)
+			stream->origin = ORIGIN_UNKNOWN;
+		return;
+	}
+
+	cp = &stream->checkpoints[stream->n_checkpoints++];
+	cp->offset = offset;
+	cp->source = source;
+	cp->origin = origin;
+}
+
+/**
+ * Record where invalid input was replaced in newly decoded data
+ *
+ * \param stream   The inputstream to operate on
+ * \param offset   UTF-8 offset of the decoded data
+ * \param source   Raw offset of the data it was decoded from
+ * \param raw      The raw data decoded
+ * \param raw_len  Length of raw data, in bytes
+ * \param data     The decoded data
+ * \param len      Length of decoded data, in bytes
+ *
+ * This is called before the checkpoint for the data is added. Each U+FFFD
+ * in the decoded data is matched with the raw data, where the charset
+ * allows the characters to be counted, so that it can be told from one
+ * that was present in the input.
+ */
+void parserutils_inputstream_index_replacements(
+		parserutils_inputstream_private *stream, size_t offset,
+		size_t source, const uint8_t *raw, size_t raw_len,
+		const uint8_t *data, size_t len)
+{
+	parserutils_inputstream_split kind =
+			parserutils_inputstream_split_kind(stream);
+	parserutils_inputstream_origin origin =
+			parserutils_inputstream_origin_of(stream, false);
+	size_t at = stream->mapped ? stream->raw_mapped : source;
+	size_t counted = 0, off = 0;
+	bool le = (kind == SPLIT_UTF16LE);
+
+	if (kind == SPLIT_UTF32) {
+		le = (parserutils__filter_utf8_codec(stream->input)->mibenum ==
+				MIB_UTF_32LE);
+	}
+
+	while (stream->n_replaced < stream->replaced_limit &&
+			len - off >= 3) {
+		const uint8_t *p = memchr(data + off, 0xEF, len - off - 2);
+		size_t lines, cont, four, width = 0, k;
+		uint32_t unit = 0;
+		bool literal = false;
+
+		if (p == NULL)
+			break;
+
+		off = p - data + 1;
+		if (p[1] != 0xBF || p[2] != 0xBD)
+			continue;
+
+		/* The raw data of the characters before the U+FFFD */
+		if (origin != ORIGIN_UNKNOWN) {
+			simd_utf8_counts(data + counted, off - 1 - counted,
+					&lines, &cont, &four);
+			at += parserutils_inputstream_origin_width(origin,
+					off - 1 - counted,
+					off - 1 - counted - cont, four);
+		}
+
+		/* And that of the U+FFFD itself, if it's to hand */
+		k = at - source;
+		switch (origin) {
+		case ORIGIN_BYTES:
+			width = 1;
+			if (at >= source && k < raw_len) {
+				literal = (raw_len - k >= 3 &&
+						memcmp(raw + k, p, 3) == 0);
+				width = literal ? 3 :
+					parserutils_inputstream_invalid_length(
+						raw + k, raw_len - k);
+			}
+			break;
+		case ORIGIN_CHARS:
+			width = 1;
+			break;
+		case ORIGIN_UTF16:
+			width = 2;
+			if (at >= source && k < raw_len && raw_len - k >= 2) {
+				unit = le ? raw[k] | (raw[k + 1] << 8)
+					  : (raw[k] << 8) | raw[k + 1];
+				literal = (unit == 0xFFFD);
+			}
+			break;
+		case ORIGIN_UTF32:
+			width = 4;
+			if (at >= source && k < raw_len && raw_len - k >= 4) {
+				unit = le ? raw[k] | (raw[k + 1] << 8) |
+						((uint32_t) raw[k + 2] << 16) |
+						((uint32_t) raw[k + 3] << 24)
+					  : ((uint32_t) raw[k] << 24) |
+						((uint32_t) raw[k + 1] << 16) |
+						(raw[k + 2] << 8) | raw[k + 3];
+				literal = (unit == 0xFFFD);
+			}
+			break;
+		case ORIGIN_UNKNOWN:
+			break;
+		}
+
+		if (literal == false) {
+			parserutils_inputstream_replacement *r;
+
+			if (stream->n_replaced == stream->replaced_alloc) {
+				size_t n = max(stream->replaced_alloc * 2, 16);
+
+				r = stream->alloc(stream->replaced,
+						n * sizeof(*r), stream->pw);
+				if (r == NULL) {
+					stream->replaced_nomem = true;
+					stream->replaced_limit =
+							stream->n_replaced;
+					break;
+				}
+
+				stream->replaced = r;
+				stream->replaced_alloc = n;
+			}
+
+			r = &stream->replaced[stream->n_replaced++];
+			r->offset = offset + (p - data);
+			r->source = at;
+		}
+
+		at += width;
+		off += 2;
+		counted = off;
+	}
+}
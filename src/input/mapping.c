@@ -0,0 +1,178 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2007 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#if !defined(WITHOUT_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define USE_MMAP
+#endif
+
+#ifdef USE_MMAP
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <stdio.h>
+#endif
+
+#include <stdlib.h>
+
+#include "input/mapping.h"
+#include "utils/utils.h"
+
+/**
+ * Private file mapping definition
+ */
+typedef struct parserutils_mapping_private {
+	parserutils_mapping public;	/**< Public part. Must be first */
+
+	parserutils_alloc alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client private data */
+} parserutils_mapping_private;
+
+/**
+ * Map a file into memory
+ *
+ * \param path     Path of file to map
+ * \param alloc    Memory (de)allocation function
+ * \param pw       Pointer to client-specific private data (may be NULL)
+ * \param mapping  Pointer to location to receive mapping instance
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_FILENOTFOUND if the file cannot be opened or read,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ *
+ * Where the platform supports it, the file is mapped read-only and the
+ * kernel is told that it will be read sequentially. Otherwise, the file's
+ * contents are read into a single allocation.
+ */
+parserutils_error parserutils__mapping_create(const char *path,
+		parserutils_alloc alloc, void *pw,
+		parserutils_mapping **mapping)
+{
+	parserutils_mapping_private *m;
+	size_t length;
+	void *data = NULL;
+#ifdef USE_MMAP
+	struct stat st;
+	int fd;
+#else
+	FILE *fp;
+	long len;
+#endif
+
+	if (path == NULL || alloc == NULL || mapping == NULL)
+		return PARSERUTILS_BADPARM;
+
+	m = alloc(NULL, sizeof(parserutils_mapping_private), pw);
+	if (m == NULL)
+		return PARSERUTILS_NOMEM;
+
+#ifdef USE_MMAP
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		alloc(m, 0, pw);
+		return PARSERUTILS_FILENOTFOUND;
+	}
+
+	if (fstat(fd, &st) < 0 || (uintmax_t) st.st_size > SIZE_MAX) {
+		close(fd);
+		alloc(m, 0, pw);
+		return PARSERUTILS_FILENOTFOUND;
+	}
+
+	length = (size_t) st.st_size;
+
+	/* Zero-length mappings are invalid, so empty files have no data */
+	if (length > 0) {
+		data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			alloc(m, 0, pw);
+			return PARSERUTILS_FILENOTFOUND;
+		}
+
+		/* Only a hint, so failure is harmless */
+		(void) posix_madvise(data, length, POSIX_MADV_SEQUENTIAL);
+	}
+
+	/* The mapping remains valid once the descriptor is closed */
+	close(fd);
+#else
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		alloc(m, 0, pw);
+		return PARSERUTILS_FILENOTFOUND;
+	}
+
+	if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 ||
+			fseek(fp, 0, SEEK_SET) != 0) {
+		fclose(fp);
+		alloc(m, 0, pw);
+		return PARSERUTILS_FILENOTFOUND;
+	}
+
+	length = (size_t) len;
+
+	if (length > 0) {
+		data = alloc(NULL, length, pw);
+		if (data == NULL) {
+			fclose(fp);
+			alloc(m, 0, pw);
+			return PARSERUTILS_NOMEM;
+		}
+
+		if (fread(data, 1, length, fp) != length) {
+			alloc(data, 0, pw);
+			fclose(fp);
+			alloc(m, 0, pw);
+			return PARSERUTILS_FILENOTFOUND;
+		}
+	}
+
+	fclose(fp);
+#endif
+
+	m->public.data = data;
+	m->public.length = length;
+	m->alloc = alloc;
+	m->pw = pw;
+
+	*mapping = (parserutils_mapping *) m;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Unmap a file
+ *
+ * \param mapping  The mapping to destroy
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error parserutils__mapping_destroy(parserutils_mapping *mapping)
+{
+	parserutils_mapping_private *m =
+			(parserutils_mapping_private *) mapping;
+
+	if (mapping == NULL)
+		return PARSERUTILS_BADPARM;
+
+	if (m->public.data != NULL) {
+#ifdef USE_MMAP
+		munmap((void *) m->public.data, m->public.length);
+#else
+		m->alloc((void *) m->public.data, 0, m->pw);
+#endif
+	}
+
+	m->alloc(m, 0, m->pw);
+
+	return PARSERUTILS_OK;
+}
+
@@ -0,0 +1,33 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2007 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_input_mapping_h_
+#define parserutils_input_mapping_h_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <parserutils/errors.h>
+#include <parserutils/functypes.h>
+
+/**
+ * Read-only view of the contents of a file
+ */
+typedef struct parserutils_mapping {
+	const uint8_t *data;		/**< File contents */
+	size_t length;			/**< Length of file contents, in bytes */
+} parserutils_mapping;
+
+/* Map a file into memory */
+parserutils_error parserutils__mapping_create(const char *path,
+		parserutils_alloc alloc, void *pw,
+		parserutils_mapping **mapping);
+/* Unmap a file */
+parserutils_error parserutils__mapping_destroy(parserutils_mapping *mapping);
+
+#endif
+
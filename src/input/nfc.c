@@ -0,0 +1,554 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "input/nfc.h"
+#include "input/nfc_tables.h"
+#include "utils/simd.h"
+#include "utils/utils.h"
+
+/** Lowest byte which may start a character that isn't a stable starter.
+ * Every character below U+0300 is a starter, and in NFC. */
+#define UNSTABLE_LEAD (0xCC)
+
+/** Capacity, in code points, of a normaliser's first segment buffer */
+#define MIN_SEGMENT (32)
+
+/* Hangul syllables, composed of leading and vowel jamo, and sometimes a
+ * trailing jamo */
+#define HANGUL_S (0xAC00)
+#define HANGUL_L (0x1100)
+#define HANGUL_V (0x1161)
+#define HANGUL_T (0x11A7)
+#define HANGUL_L_COUNT (19)
+#define HANGUL_V_COUNT (21)
+#define HANGUL_T_COUNT (28)
+#define HANGUL_N_COUNT (HANGUL_V_COUNT * HANGUL_T_COUNT)
+#define HANGUL_S_COUNT (HANGUL_L_COUNT * HANGUL_N_COUNT)
+
+/**
+ * Unicode normaliser
+ *
+ * Text is normalised a segment at a time, a segment being a starter which
+ * nothing before it can combine with, and the characters which follow it
+ * up to the next such starter. Runs of segments of a single character have
+ * nothing to combine, so are copied without decoding them, bar the last,
+ * which later characters may yet combine with.
+ */
+struct parserutils_nfc {
+	uint32_t *seg;			/**< Decomposed segment, in canonical
+					 * order */
+	size_t seg_len;			/**< Code points in segment */
+	size_t seg_size;		/**< Capacity of segment buffer */
+
+	uint8_t *out;			/**< Composed segment, as UTF-8 */
+	size_t out_off;			/**< Offset of data yet to be output */
+	size_t out_len;			/**< Length of composed segment */
+
+	parserutils_alloc alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client private data */
+};
+
+static inline uint16_t nfc_props(uint32_t cp);
+static inline size_t nfc_decode(const uint8_t *s, size_t len, uint32_t *cp);
+static size_t nfc_stable_prefix(const uint8_t *s, size_t len);
+static parserutils_error nfc_append(parserutils_nfc *nfc, uint32_t cp);
+static void nfc_push(parserutils_nfc *nfc, uint32_t cp);
+static uint32_t nfc_compose_pair(uint32_t first, uint32_t second);
+static void nfc_finish(parserutils_nfc *nfc);
+static bool nfc_drain(parserutils_nfc *nfc, uint8_t **output,
+		size_t *outlen);
+
+/**
+ * Create a normaliser
+ *
+ * \param alloc  Memory (de)allocation function
+ * \param pw     Pointer to client-specific private data (may be NULL)
+ * \param nfc    Pointer to location to receive normaliser instance
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ */
+parserutils_error parserutils__nfc_create(parserutils_alloc alloc, void *pw,
+		parserutils_nfc **nfc)
+{
+	parserutils_nfc *n;
+
+	if (alloc == NULL || nfc == NULL)
+		return PARSERUTILS_BADPARM;
+
+	n = alloc(NULL, sizeof(parserutils_nfc), pw);
+	if (n == NULL)
+		return PARSERUTILS_NOMEM;
+
+	n->seg = NULL;
+	n->seg_len = 0;
+	n->seg_size = 0;
+	n->out = NULL;
+	n->out_off = 0;
+	n->out_len = 0;
+	n->alloc = alloc;
+	n->pw = pw;
+
+	*nfc = n;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Destroy a normaliser
+ *
+ * \param nfc  The normaliser to destroy
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error parserutils__nfc_destroy(parserutils_nfc *nfc)
+{
+	if (nfc == NULL)
+		return PARSERUTILS_BADPARM;
+
+	nfc->alloc(nfc->seg, 0, nfc->pw);
+	nfc->alloc(nfc->out, 0, nfc->pw);
+	nfc->alloc(nfc, 0, nfc->pw);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Normalise a chunk of UTF-8 to Normalisation Form C
+ *
+ * \param nfc     The normaliser
+ * \param data    Pointer to pointer to input buffer, updated on exit
+ * \param len     Pointer to length of input buffer, updated on exit
+ * \param output  Pointer to pointer to output buffer, updated on exit
+ * \param outlen  Pointer to length of output buffer, updated on exit
+ * \param flush   Whether no more input follows
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM if the output buffer is too small
+ *
+ * The input must be valid UTF-8. An incomplete character at its end is left
+ * unconsumed. The last segment of the input is held until the next segment
+ * starts, or flush is set, as later input may combine with it.
+ */
+parserutils_error parserutils__nfc_process(parserutils_nfc *nfc,
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen, bool flush)
+{
+	parserutils_error error;
+
+	if (nfc_drain(nfc, output, outlen) == false)
+		return PARSERUTILS_NOMEM;
+
+	while (*len > 0) {
+		const uint8_t *s = *data;
+		size_t run = nfc_stable_prefix(s, *len), last, n;
+		uint32_t cp = 0;
+
+		if (run == 0) {
+			/* A character which may combine with those before
+			 * it joins their segment */
+			n = nfc_decode(s, *len, &cp);
+			if (n == 0)
+				break;
+
+			error = nfc_append(nfc, cp);
+			if (error != PARSERUTILS_OK)
+				return error;
+
+			*data += n;
+			*len -= n;
+			continue;
+		}
+
+		/* A stable starter ends the segment before it */
+		if (nfc->seg_len > 0) {
+			nfc_finish(nfc);
+			if (nfc_drain(nfc, output, outlen) == false)
+				return PARSERUTILS_NOMEM;
+		}
+
+		/* Copy all but the last of the run's characters */
+		last = run - 1;
+		while (last > 0 && (s[last] & 0xC0) == 0x80)
+			last--;
+
+		n = min(last, *outlen);
+		while (n < last && (s[n] & 0xC0) == 0x80)
+			n--;
+
+		memcpy(*output, s, n);
+		*output += n;
+		*outlen -= n;
+		*data += n;
+		*len -= n;
+
+		if (n < last)
+			return PARSERUTILS_NOMEM;
+
+		/* And start a segment with the last */
+		n = nfc_decode(*data, *len, &cp);
+
+		error = nfc_append(nfc, cp);
+		if (error != PARSERUTILS_OK)
+			return error;
+
+		*data += n;
+		*len -= n;
+	}
+
+	if (flush && nfc->seg_len > 0) {
+		nfc_finish(nfc);
+		if (nfc_drain(nfc, output, outlen) == false)
+			return PARSERUTILS_NOMEM;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Determine whether a normaliser holds data yet to be output
+ *
+ * \param nfc  The normaliser to consider
+ * \return True if a segment is held, or not all of one has been output
+ */
+bool parserutils__nfc_pending(const parserutils_nfc *nfc)
+{
+	return nfc->seg_len > 0 || nfc->out_off < nfc->out_len;
+}
+
+/**
+ * Discard a normaliser's state
+ *
+ * \param nfc  The normaliser to reset
+ */
+void parserutils__nfc_reset(parserutils_nfc *nfc)
+{
+	nfc->seg_len = 0;
+	nfc->out_off = 0;
+	nfc->out_len = 0;
+}
+
+/**
+ * Look up the normalisation properties of a code point
+ *
+ * \param cp  The code point
+ * \return Its combining class, quick check value and decomposition flag
+ */
+uint16_t nfc_props(uint32_t cp)
+{
+	if (cp >= NFC_LIMIT)
+		return 0;
+
+	return nfc_stage2[nfc_stage1[cp / NFC_BLOCK] * NFC_BLOCK +
+			cp % NFC_BLOCK];
+}
+
+/**
+ * Decode a character of valid UTF-8
+ *
+ * \param s    The character
+ * \param len  Length of data available, in bytes
+ * \param cp   Pointer to location to receive code point
+ * \return Length of character, or 0 if it is incomplete
+ */
+size_t nfc_decode(const uint8_t *s, size_t len, uint32_t *cp)
+{
+	size_t n, i;
+	uint32_t c = s[0];
+
+	if (c < 0x80) {
+		*cp = c;
+		return 1;
+	}
+
+	n = (c < 0xE0) ? 2 : (c < 0xF0) ? 3 : 4;
+	if (n > len)
+		return 0;
+
+	c &= 0x3F >> (n - 1);
+	for (i = 1; i < n; i++)
+		c = (c << 6) | (s[i] & 0x3F);
+
+	*cp = c;
+
+	return n;
+}
+
+/**
+ * Find the run of stable starters at the start of a string
+ *
+ * \param s    The string, which is valid UTF-8
+ * \param len  Length of string, in bytes
+ * \return Length of the run of complete characters, each of which is a
+ *         starter that is in NFC and combines with nothing before it
+ */
+size_t nfc_stable_prefix(const uint8_t *s, size_t len)
+{
+	size_t off = 0;
+
+	while (off < len) {
+		uint16_t props;
+		uint32_t cp;
+		size_t n;
+
+		/* Skip the characters which are known to be stable, the bulk
+		 * of most documents, without decoding them */
+		off += simd_below_prefix(s + off, len - off, UNSTABLE_LEAD);
+		if (off == len) {
+			size_t lead = off - 1;
+
+			/* Leave an incomplete character at the end */
+			while (lead > 0 && (s[lead] & 0xC0) == 0x80)
+				lead--;
+			if (nfc_decode(s + lead, len - lead, &cp) == 0)
+				off = lead;
+			break;
+		}
+
+		n = nfc_decode(s + off, len - off, &cp);
+		if (n == 0)
+			break;
+
+		props = nfc_props(cp);
+		if ((props & (NFC_CCC_MASK | NFC_QC_MASK)) != 0)
+			break;
+
+		off += n;
+	}
+
+	return off;
+}
+
+/**
+ * Decompose a code point onto the end of the segment
+ *
+ * \param nfc  The normaliser
+ * \param cp   The code point
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM on memory exhaustion, leaving the segment as it
+ *                           was
+ */
+parserutils_error nfc_append(parserutils_nfc *nfc, uint32_t cp)
+{
+	const nfc_decomposition *d = NULL;
+	size_t need = 1, i;
+
+	if (cp - HANGUL_S < HANGUL_S_COUNT) {
+		need = 3;
+	} else if (nfc_props(cp) & NFC_DECOMPOSES) {
+		size_t lo = 0, hi = N_ELEMENTS(nfc_decompositions);
+
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+
+			if (nfc_decompositions[mid].cp < cp)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		d = &nfc_decompositions[lo];
+		need = d->length;
+	}
+
+	/* Make room for all of the decomposition first */
+	if (nfc->seg_len + need > nfc->seg_size) {
+		size_t size = max(nfc->seg_size * 2, MIN_SEGMENT);
+		uint32_t *seg;
+		uint8_t *out;
+
+		while (size < nfc->seg_len + need)
+			size *= 2;
+
+		seg = nfc->alloc(nfc->seg, size * sizeof(uint32_t), nfc->pw);
+		if (seg == NULL)
+			return PARSERUTILS_NOMEM;
+		nfc->seg = seg;
+
+		/* The composed segment is at most as many code points */
+		out = nfc->alloc(nfc->out, size * 4, nfc->pw);
+		if (out == NULL)
+			return PARSERUTILS_NOMEM;
+		nfc->out = out;
+
+		nfc->seg_size = size;
+	}
+
+	if (d != NULL) {
+		for (i = 0; i < d->length; i++)
+			nfc_push(nfc, nfc_pool[d->index + i]);
+	} else if (cp - HANGUL_S < HANGUL_S_COUNT) {
+		uint32_t index = cp - HANGUL_S;
+
+		nfc_push(nfc, HANGUL_L + index / HANGUL_N_COUNT);
+		nfc_push(nfc, HANGUL_V + (index % HANGUL_N_COUNT) /
+				HANGUL_T_COUNT);
+		if (index % HANGUL_T_COUNT != 0)
+			nfc_push(nfc, HANGUL_T + index % HANGUL_T_COUNT);
+	} else {
+		nfc_push(nfc, cp);
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Add a code point to the end of the segment, in canonical order
+ *
+ * \param nfc  The normaliser, with room in its segment
+ * \param cp   The code point, which has no decomposition
+ */
+void nfc_push(parserutils_nfc *nfc, uint32_t cp)
+{
+	uint8_t ccc = nfc_props(cp) & NFC_CCC_MASK;
+	size_t i = nfc->seg_len;
+
+	/* Move it before any marks of a higher class */
+	if (ccc != 0) {
+		while (i > 0 && (nfc_props(nfc->seg[i - 1]) & NFC_CCC_MASK) >
+				ccc) {
+			nfc->seg[i] = nfc->seg[i - 1];
+			i--;
+		}
+	}
+
+	nfc->seg[i] = cp;
+	nfc->seg_len++;
+}
+
+/**
+ * Find the primary composite of a pair of code points
+ *
+ * \param first   The first code point, a starter
+ * \param second  The second code point
+ * \return The composite, or 0 if there is none
+ */
+uint32_t nfc_compose_pair(uint32_t first, uint32_t second)
+{
+	size_t lo = 0, hi = N_ELEMENTS(nfc_compositions);
+
+	if (first - HANGUL_L < HANGUL_L_COUNT &&
+			second - HANGUL_V < HANGUL_V_COUNT) {
+		return HANGUL_S + ((first - HANGUL_L) * HANGUL_V_COUNT +
+				(second - HANGUL_V)) * HANGUL_T_COUNT;
+	}
+
+	if (first - HANGUL_S < HANGUL_S_COUNT &&
+			(first - HANGUL_S) % HANGUL_T_COUNT == 0 &&
+			second - HANGUL_T - 1 < HANGUL_T_COUNT - 1)
+		return first + (second - HANGUL_T);
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		const nfc_composition *c = &nfc_compositions[mid];
+
+		if (c->first < first || (c->first == first &&
+				c->second < second))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo < N_ELEMENTS(nfc_compositions) &&
+			nfc_compositions[lo].first == first &&
+			nfc_compositions[lo].second == second)
+		return nfc_compositions[lo].composite;
+
+	return 0;
+}
+
+/**
+ * Compose the segment, and encode it as UTF-8 ready for output
+ *
+ * \param nfc  The normaliser, holding a segment and no output
+ */
+void nfc_finish(parserutils_nfc *nfc)
+{
+	uint32_t *seg = nfc->seg;
+	size_t starter = 0, comp = 1, i;
+	uint16_t last = nfc_props(seg[0]) & NFC_CCC_MASK;
+	uint8_t *out = nfc->out;
+
+	/* A segment which starts with a mark has no starter to compose with */
+	if (last != 0)
+		last = 256;
+
+	for (i = 1; i < nfc->seg_len; i++) {
+		uint32_t cp = seg[i], composite = 0;
+		uint16_t props = nfc_props(cp);
+		uint16_t ccc = props & NFC_CCC_MASK;
+
+		/* Only characters which may be NFC yet are composed with
+		 * what's before them, and only if unblocked */
+		if ((props & NFC_QC_MASK) == (NFC_QC_MAYBE << NFC_QC_SHIFT) &&
+				(last < ccc || last == 0))
+			composite = nfc_compose_pair(seg[starter], cp);
+
+		if (composite != 0) {
+			seg[starter] = composite;
+		} else {
+			if (ccc == 0)
+				starter = comp;
+			last = ccc;
+			seg[comp++] = cp;
+		}
+	}
+
+	for (i = 0; i < comp; i++) {
+		uint32_t cp = seg[i];
+
+		if (cp < 0x80) {
+			*out++ = cp;
+		} else if (cp < 0x800) {
+			*out++ = 0xC0 | (cp >> 6);
+			*out++ = 0x80 | (cp & 0x3F);
+		} else if (cp < 0x10000) {
+			*out++ = 0xE0 | (cp >> 12);
+			*out++ = 0x80 | ((cp >> 6) & 0x3F);
+			*out++ = 0x80 | (cp & 0x3F);
+		} else {
+			*out++ = 0xF0 | (cp >> 18);
+			*out++ = 0x80 | ((cp >> 12) & 0x3F);
+			*out++ = 0x80 | ((cp >> 6) & 0x3F);
+			*out++ = 0x80 | (cp & 0x3F);
+		}
+	}
+
+	nfc->seg_len = 0;
+	nfc->out_off = 0;
+	nfc->out_len = out - nfc->out;
+}
+
+/**
+ * Write as much of the composed segment as will fit
+ *
+ * \param nfc     The normaliser
+ * \param output  Pointer to pointer to output buffer, updated on exit
+ * \param outlen  Pointer to length of output buffer, updated on exit
+ * \return True if all of the composed segment has been written
+ *
+ * The segment is written whole characters at a time.
+ */
+bool nfc_drain(parserutils_nfc *nfc, uint8_t **output, size_t *outlen)
+{
+	size_t left = nfc->out_len - nfc->out_off;
+	size_t n = min(left, *outlen);
+
+	if (left == 0)
+		return true;
+
+	while (n < left && n > 0 && (nfc->out[nfc->out_off + n] & 0xC0) == 0x80)
+		n--;
+
+	memcpy(*output, nfc->out + nfc->out_off, n);
+	*output += n;
+	*outlen -= n;
+	nfc->out_off += n;
+
+	return n == left;
+}
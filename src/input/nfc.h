@@ -0,0 +1,38 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_input_nfc_h_
+#define parserutils_input_nfc_h_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <parserutils/errors.h>
+#include <parserutils/functypes.h>
+
+typedef struct parserutils_nfc parserutils_nfc;
+
+/* Create a normaliser */
+parserutils_error parserutils__nfc_create(parserutils_alloc alloc, void *pw,
+		parserutils_nfc **nfc);
+/* Destroy a normaliser */
+parserutils_error parserutils__nfc_destroy(parserutils_nfc *nfc);
+
+/* Normalise a chunk of UTF-8 to Normalisation Form C */
+parserutils_error parserutils__nfc_process(parserutils_nfc *nfc,
+		const uint8_t **data, size_t *len,
+		uint8_t **output, size_t *outlen, bool flush);
+
+/* Determine whether a normaliser holds data yet to be output */
+bool parserutils__nfc_pending(const parserutils_nfc *nfc);
+
+/* Discard a normaliser's state */
+void parserutils__nfc_reset(parserutils_nfc *nfc);
+
+#endif
+
@@ -0,0 +1,5450 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#ifndef parserutils_input_nfctables_h_
+#define parserutils_input_nfctables_h_
+
+/* Unicode Normalisation Form C tables, generated by build/make-nfc.pl from
+ * the Unicode 14.0.0 character database. See there for their layout.
+ */
+
+#define NFC_BLOCK (128)
+#define NFC_LIMIT (0x30000)
+
+#define NFC_CCC_MASK   (0x00FF)	/**< Canonical combining class */
+#define NFC_QC_SHIFT   (8)
+#define NFC_QC_MASK    (0x0300)	/**< NFC_Quick_Check */
+#define NFC_QC_YES     (0)
+#define NFC_QC_NO      (1)
+#define NFC_QC_MAYBE   (2)
+#define NFC_DECOMPOSES (0x0400)	/**< Has a canonical decomposition */
+
+/** Canonical decomposition of a code point */
+typedef struct nfc_decomposition {
+	uint32_t cp;		/**< Code point */
+	uint16_t index;		/**< Index of decomposition in nfc_pool */
+	uint16_t length;	/**< Length of decomposition */
+} nfc_decomposition;
+
+/** Primary composite of a pair of code points */
+typedef struct nfc_composition {
+	uint32_t first;		/**< First code point */
+	uint32_t second;	/**< Second code point */
+	uint32_t composite;	/**< Composite */
+} nfc_composition;
+
+static const uint8_t nfc_stage1[1536] = {
+	  0,   1,   2,   3,   4,   0,   5,   6,   7,   8,   0,   9,  10,  11,  12,  13,
+	 14,  15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25,  26,  27,  28,  29,
+	 30,  31,  32,  33,   0,   0,  34,   0,   0,   0,   0,   0,   0,   0,  35,  36,
+	  0,  37,  38,   0,  39,  40,  41,  42,  43,  44,   0,  45,  46,  47,  48,  49,
+	 50,  51,  52,  53,  54,  55,  56,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,  57,   0,   0,   0,  58,  59,  60,   0,   0,   0,   0,
+	 61,  62,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  63,  64,   0,   0,
+	 65,  66,  67,  68,   0,  69,   0,  70,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,  71,  71,  72,  73,  74,   0,   0,   0,   0,   0,  75,   0,   0,   0,
+	  0,   0,   0,  76,   0,  77,  78,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,  79,  80,   0,   0,   0,   0,  81,   0,   0,  82,  83,  84,
+	 85,  86,  87,  88,  89,  90,  91,   0,  92,  93,   0,  94,  95,  96,  97,   0,
+	 98,   0,  99, 100, 101, 102,   0,   0,  95,   0, 103, 104,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0, 105, 106,   0,   0,   0,   0,   0,   0,   0,   0, 107,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0, 108,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0, 109, 110, 111,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	112,   0, 106,   0,   0, 113,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0, 114, 115,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	 71,  71,  71,  71, 116,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+};
+
+static const uint16_t nfc_stage2[14976] = {
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000,
+	0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000,
+	0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0400,
+	0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000, 0x0400, 0x0400,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x02E6, 0x02E6, 0x02E6, 0x02E6, 0x02E6, 0x00E6, 0x02E6, 0x02E6,
+	0x02E6, 0x02E6, 0x02E6, 0x02E6, 0x02E6, 0x00E6, 0x00E6, 0x02E6,
+	0x00E6, 0x02E6, 0x00E6, 0x02E6, 0x02E6, 0x00E8, 0x00DC, 0x00DC,
+	0x00DC, 0x00DC, 0x00E8, 0x02D8, 0x00DC, 0x00DC, 0x00DC, 0x00DC,
+	0x00DC, 0x00CA, 0x00CA, 0x02DC, 0x02DC, 0x02DC, 0x02DC, 0x02CA,
+	0x02CA, 0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x02DC, 0x02DC, 0x00DC,
+	0x02DC, 0x02DC, 0x00DC, 0x00DC, 0x0001, 0x0001, 0x0001, 0x0001,
+	0x0201, 0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x00E6, 0x00E6, 0x00E6,
+	0x05E6, 0x05E6, 0x02E6, 0x05E6, 0x05E6, 0x02F0, 0x00E6, 0x00DC,
+	0x00DC, 0x00DC, 0x00E6, 0x00E6, 0x00E6, 0x00DC, 0x00DC, 0x0000,
+	0x00E6, 0x00E6, 0x00E6, 0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x00E6,
+	0x00E8, 0x00DC, 0x00DC, 0x00E6, 0x00E9, 0x00EA, 0x00EA, 0x00E9,
+	0x00EA, 0x00EA, 0x00E9, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0500, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0500, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0500,
+	0x0400, 0x0400, 0x0400, 0x0000, 0x0400, 0x0000, 0x0400, 0x0400,
+	0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0000, 0x0400, 0x0000, 0x0000, 0x0000, 0x0400,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0000, 0x0400, 0x0000, 0x0000, 0x0000, 0x0400,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0400,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0400, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000, 0x0400, 0x0400,
+	0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x00DC, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00DC, 0x00E6,
+	0x00E6, 0x00E6, 0x00DE, 0x00DC, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x00DC,
+	0x00E6, 0x00E6, 0x00DC, 0x00E6, 0x00E6, 0x00DE, 0x00E4, 0x00E6,
+	0x000A, 0x000B, 0x000C, 0x000D, 0x000E, 0x000F, 0x0010, 0x0011,
+	0x0012, 0x0013, 0x0013, 0x0014, 0x0015, 0x0016, 0x0000, 0x0017,
+	0x0000, 0x0018, 0x0019, 0x0000, 0x00E6, 0x00DC, 0x0000, 0x0012,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x001E, 0x001F, 0x0020, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x001B, 0x001C, 0x001D, 0x001E, 0x001F,
+	0x0020, 0x0021, 0x0022, 0x02E6, 0x02E6, 0x02DC, 0x00DC, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00DC, 0x00E6, 0x00E6, 0x00DC,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0023, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0000, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0400, 0x0000, 0x0000, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x0000, 0x0000, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00DC, 0x00E6, 0x0000, 0x0000, 0x00E6,
+	0x00E6, 0x0000, 0x00DC, 0x00E6, 0x00E6, 0x00DC, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0024, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00DC, 0x00E6, 0x00E6, 0x00DC, 0x00E6, 0x00E6, 0x00DC,
+	0x00DC, 0x00DC, 0x00E6, 0x00DC, 0x00DC, 0x00E6, 0x00DC, 0x00E6,
+	0x00E6, 0x00E6, 0x00DC, 0x00E6, 0x00DC, 0x00E6, 0x00DC, 0x00E6,
+	0x00DC, 0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00DC, 0x00E6, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00DC, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x0000, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x0000, 0x00E6, 0x00E6, 0x00E6,
+	0x0000, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x00DC, 0x00DC, 0x00DC, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00DC, 0x00DC, 0x00DC, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00DC,
+	0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x0000, 0x00DC, 0x00E6, 0x00E6, 0x00DC, 0x00E6,
+	0x00E6, 0x00DC, 0x00E6, 0x00E6, 0x00E6, 0x00DC, 0x00DC, 0x00DC,
+	0x001B, 0x001C, 0x001D, 0x00E6, 0x00E6, 0x00E6, 0x00DC, 0x00E6,
+	0x00E6, 0x00DC, 0x00DC, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0400, 0x0000, 0x0000, 0x0400, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0207, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0000, 0x0000,
+	0x0000, 0x00E6, 0x00DC, 0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0007, 0x0000, 0x0200, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0009, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0200,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0500, 0x0500, 0x0000, 0x0500,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0500, 0x0000, 0x0000, 0x0500, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0007, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0500, 0x0500, 0x0500, 0x0000, 0x0000, 0x0500, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0007, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0007, 0x0000, 0x0200, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0000, 0x0000, 0x0400, 0x0400, 0x0009, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0200, 0x0200,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0500, 0x0500, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0200, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0009, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0200,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0007, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0054, 0x025B, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0007, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0000, 0x0200, 0x0000, 0x0000, 0x0000, 0x0000, 0x0400,
+	0x0400, 0x0000, 0x0400, 0x0400, 0x0000, 0x0009, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0200, 0x0200, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0009, 0x0009, 0x0000, 0x0200, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0009, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0200,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0209, 0x0000, 0x0000, 0x0000, 0x0000, 0x0200,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0400, 0x0000, 0x0400, 0x0400, 0x0400, 0x0200,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0067, 0x0067, 0x0009, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x006B, 0x006B, 0x006B, 0x006B, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0076, 0x0076, 0x0009, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x007A, 0x007A, 0x007A, 0x007A, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00DC, 0x00DC, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00DC, 0x0000, 0x00DC,
+	0x0000, 0x00D8, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0500, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0500, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0500, 0x0000, 0x0000, 0x0000, 0x0000, 0x0500,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0500, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0500, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0081, 0x0082, 0x0500, 0x0084, 0x0500, 0x0500, 0x0000,
+	0x0500, 0x0000, 0x0082, 0x0082, 0x0082, 0x0082, 0x0000, 0x0000,
+	0x0082, 0x0500, 0x00E6, 0x00E6, 0x0009, 0x0000, 0x00E6, 0x00E6,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0500, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0500, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0500, 0x0000, 0x0000, 0x0000, 0x0000, 0x0500,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0500, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0500, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00DC, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0200, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0007,
+	0x0000, 0x0009, 0x0009, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00DC, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+	0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+	0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+	0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+	0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+	0x0200, 0x0200, 0x0200, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6, 0x00E6,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0009, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0009, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x00E4, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x00DE, 0x00E6, 0x00DC, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6,
+	0x00DC, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0009, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x0000, 0x0000, 0x00DC,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00DC, 0x00DC, 0x00DC,
+	0x00DC, 0x00DC, 0x00DC, 0x00E6, 0x00E6, 0x00DC, 0x0000, 0x00DC,
+	0x00DC, 0x00E6, 0x00E6, 0x00DC, 0x00DC, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00DC, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0000,
+	0x0400, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000,
+	0x0000, 0x0000, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0007, 0x0200, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0000, 0x0400, 0x0009, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x00E6, 0x00DC, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0009, 0x0009, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0007, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0009, 0x0009, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0007,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x00E6, 0x0000, 0x0001, 0x00DC, 0x00DC, 0x00DC,
+	0x00DC, 0x00DC, 0x00E6, 0x00E6, 0x00DC, 0x00DC, 0x00DC, 0x00DC,
+	0x00E6, 0x0000, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0001,
+	0x0001, 0x0000, 0x0000, 0x0000, 0x0000, 0x00DC, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x00DC, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00DC, 0x00E6, 0x00E6, 0x00EA, 0x00D6, 0x00DC,
+	0x00CA, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E8, 0x00E4,
+	0x00E4, 0x00DC, 0x00DA, 0x00E6, 0x00E9, 0x00DC, 0x00E6, 0x00DC,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0000, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0000, 0x0400, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0500, 0x0400, 0x0500, 0x0400, 0x0500, 0x0400, 0x0500,
+	0x0400, 0x0500, 0x0400, 0x0500, 0x0400, 0x0500, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0500, 0x0400, 0x0000, 0x0500, 0x0000,
+	0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0400, 0x0400,
+	0x0400, 0x0500, 0x0400, 0x0500, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0500, 0x0000, 0x0000, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0500, 0x0000, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0500, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0500, 0x0400, 0x0400, 0x0500, 0x0500,
+	0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0000, 0x0400, 0x0400,
+	0x0400, 0x0500, 0x0400, 0x0500, 0x0400, 0x0500, 0x0000, 0x0000,
+	0x0500, 0x0500, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x0001, 0x0001, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x0001, 0x0001, 0x0001, 0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x00E6, 0x0000, 0x0000, 0x0000, 0x0001, 0x0001, 0x00E6,
+	0x00DC, 0x00E6, 0x0001, 0x0001, 0x00DC, 0x00DC, 0x00DC, 0x00DC,
+	0x00E6, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0500, 0x0000,
+	0x0000, 0x0000, 0x0500, 0x0500, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0400, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0400,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0400, 0x0000, 0x0000, 0x0400, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0400, 0x0000, 0x0000, 0x0400, 0x0000, 0x0000, 0x0400,
+	0x0000, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0000, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0400,
+	0x0400, 0x0400, 0x0000, 0x0000, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0000, 0x0000, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0400,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0400, 0x0400, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0500, 0x0500, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0500, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6,
+	0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x00DA, 0x00E4, 0x00E8, 0x00DE, 0x00E0, 0x00E0,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000,
+	0x0400, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000,
+	0x0400, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000,
+	0x0400, 0x0000, 0x0400, 0x0000, 0x0000, 0x0400, 0x0000, 0x0400,
+	0x0000, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0000, 0x0400, 0x0400, 0x0000, 0x0400, 0x0400,
+	0x0000, 0x0400, 0x0400, 0x0000, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0208, 0x0208, 0x0000, 0x0000, 0x0000, 0x0400, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000,
+	0x0400, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000,
+	0x0400, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000,
+	0x0400, 0x0000, 0x0400, 0x0000, 0x0000, 0x0400, 0x0000, 0x0400,
+	0x0000, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0400, 0x0000, 0x0400, 0x0400, 0x0000, 0x0400, 0x0400,
+	0x0000, 0x0400, 0x0400, 0x0000, 0x0400, 0x0400, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0000, 0x0000, 0x0400,
+	0x0400, 0x0400, 0x0400, 0x0000, 0x0000, 0x0000, 0x0400, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x00DC, 0x00DC, 0x00DC, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0009, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0007, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0009, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x0000, 0x00E6, 0x00E6, 0x00DC, 0x0000, 0x0000, 0x00E6,
+	0x00E6, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6,
+	0x0000, 0x00E6, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0000, 0x0000,
+	0x0500, 0x0000, 0x0500, 0x0000, 0x0000, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0000,
+	0x0500, 0x0000, 0x0500, 0x0000, 0x0000, 0x0500, 0x0500, 0x0000,
+	0x0000, 0x0000, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0000, 0x0000,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0500, 0x001A, 0x0500,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0000,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0000, 0x0500, 0x0000,
+	0x0500, 0x0500, 0x0000, 0x0500, 0x0500, 0x0000, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00DC,
+	0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x00E6, 0x00E6,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00DC, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00DC, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00DC, 0x0000, 0x00E6,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x0001, 0x00DC, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x00DC, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00DC, 0x00DC,
+	0x00E6, 0x00E6, 0x00E6, 0x00DC, 0x00E6, 0x00DC, 0x00DC, 0x00DC,
+	0x00DC, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x00E6, 0x00DC, 0x00E6, 0x00DC, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0009, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0400, 0x0000, 0x0400, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0400, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0009, 0x0207, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0200,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0400, 0x0400,
+	0x0000, 0x0000, 0x0000, 0x0009, 0x0009, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0007, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0009, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0007, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0007, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0007, 0x0009, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0007, 0x0007, 0x0000, 0x0200, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0400, 0x0400, 0x0009, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0200,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0009, 0x0000, 0x0000, 0x0000, 0x0007, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0200, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0200, 0x0400, 0x0400, 0x0200, 0x0400, 0x0000,
+	0x0000, 0x0000, 0x0009, 0x0007, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0200,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0400, 0x0400, 0x0000, 0x0000, 0x0000, 0x0009,
+	0x0007, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0007,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0009, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0009, 0x0007, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0200, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0400, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0009, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0007, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0009, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0009, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0009, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0007, 0x0000, 0x0009, 0x0009, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0009,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0001, 0x0001, 0x0001, 0x0001, 0x0001, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0006, 0x0006, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0001, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x00D8, 0x00D8, 0x0001,
+	0x0001, 0x0001, 0x0000, 0x0000, 0x0000, 0x00E2, 0x00D8, 0x00D8,
+	0x00D8, 0x00D8, 0x00D8, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x00DC,
+	0x00DC, 0x00DC, 0x00DC, 0x0000, 0x0000, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00DC, 0x00DC, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x00E6, 0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x0000,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x0000, 0x0000, 0x00E6, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x0000, 0x00E6, 0x00E6, 0x0000, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x00E6, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x00DC, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x00E6, 0x00E6, 0x00E6, 0x00E6,
+	0x00E6, 0x00E6, 0x0007, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500,
+	0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0500, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+};
+
+static const nfc_decomposition nfc_decompositions[2061] = {
+	{ 0x000C0,    0, 2 },
+	{ 0x000C1,    2, 2 },
+	{ 0x000C2,    4, 2 },
+	{ 0x000C3,    6, 2 },
+	{ 0x000C4,    8, 2 },
+	{ 0x000C5,   10, 2 },
+	{ 0x000C7,   12, 2 },
+	{ 0x000C8,   14, 2 },
+	{ 0x000C9,   16, 2 },
+	{ 0x000CA,   18, 2 },
+	{ 0x000CB,   20, 2 },
+	{ 0x000CC,   22, 2 },
+	{ 0x000CD,   24, 2 },
+	{ 0x000CE,   26, 2 },
+	{ 0x000CF,   28, 2 },
+	{ 0x000D1,   30, 2 },
+	{ 0x000D2,   32, 2 },
+	{ 0x000D3,   34, 2 },
+	{ 0x000D4,   36, 2 },
+	{ 0x000D5,   38, 2 },
+	{ 0x000D6,   40, 2 },
+	{ 0x000D9,   42, 2 },
+	{ 0x000DA,   44, 2 },
+	{ 0x000DB,   46, 2 },
+	{ 0x000DC,   48, 2 },
+	{ 0x000DD,   50, 2 },
+	{ 0x000E0,   52, 2 },
+	{ 0x000E1,   54, 2 },
+	{ 0x000E2,   56, 2 },
+	{ 0x000E3,   58, 2 },
+	{ 0x000E4,   60, 2 },
+	{ 0x000E5,   62, 2 },
+	{ 0x000E7,   64, 2 },
+	{ 0x000E8,   66, 2 },
+	{ 0x000E9,   68, 2 },
+	{ 0x000EA,   70, 2 },
+	{ 0x000EB,   72, 2 },
+	{ 0x000EC,   74, 2 },
+	{ 0x000ED,   76, 2 },
+	{ 0x000EE,   78, 2 },
+	{ 0x000EF,   80, 2 },
+	{ 0x000F1,   82, 2 },
+	{ 0x000F2,   84, 2 },
+	{ 0x000F3,   86, 2 },
+	{ 0x000F4,   88, 2 },
+	{ 0x000F5,   90, 2 },
+	{ 0x000F6,   92, 2 },
+	{ 0x000F9,   94, 2 },
+	{ 0x000FA,   96, 2 },
+	{ 0x000FB,   98, 2 },
+	{ 0x000FC,  100, 2 },
+	{ 0x000FD,  102, 2 },
+	{ 0x000FF,  104, 2 },
+	{ 0x00100,  106, 2 },
+	{ 0x00101,  108, 2 },
+	{ 0x00102,  110, 2 },
+	{ 0x00103,  112, 2 },
+	{ 0x00104,  114, 2 },
+	{ 0x00105,  116, 2 },
+	{ 0x00106,  118, 2 },
+	{ 0x00107,  120, 2 },
+	{ 0x00108,  122, 2 },
+	{ 0x00109,  124, 2 },
+	{ 0x0010A,  126, 2 },
+	{ 0x0010B,  128, 2 },
+	{ 0x0010C,  130, 2 },
+	{ 0x0010D,  132, 2 },
+	{ 0x0010E,  134, 2 },
+	{ 0x0010F,  136, 2 },
+	{ 0x00112,  138, 2 },
+	{ 0x00113,  140, 2 },
+	{ 0x00114,  142, 2 },
+	{ 0x00115,  144, 2 },
+	{ 0x00116,  146, 2 },
+	{ 0x00117,  148, 2 },
+	{ 0x00118,  150, 2 },
+	{ 0x00119,  152, 2 },
+	{ 0x0011A,  154, 2 },
+	{ 0x0011B,  156, 2 },
+	{ 0x0011C,  158, 2 },
+	{ 0x0011D,  160, 2 },
+	{ 0x0011E,  162, 2 },
+	{ 0x0011F,  164, 2 },
+	{ 0x00120,  166, 2 },
+	{ 0x00121,  168, 2 },
+	{ 0x00122,  170, 2 },
+	{ 0x00123,  172, 2 },
+	{ 0x00124,  174, 2 },
+	{ 0x00125,  176, 2 },
+	{ 0x00128,  178, 2 },
+	{ 0x00129,  180, 2 },
+	{ 0x0012A,  182, 2 },
+	{ 0x0012B,  184, 2 },
+	{ 0x0012C,  186, 2 },
+	{ 0x0012D,  188, 2 },
+	{ 0x0012E,  190, 2 },
+	{ 0x0012F,  192, 2 },
+	{ 0x00130,  194, 2 },
+	{ 0x00134,  196, 2 },
+	{ 0x00135,  198, 2 },
+	{ 0x00136,  200, 2 },
+	{ 0x00137,  202, 2 },
+	{ 0x00139,  204, 2 },
+	{ 0x0013A,  206, 2 },
+	{ 0x0013B,  208, 2 },
+	{ 0x0013C,  210, 2 },
+	{ 0x0013D,  212, 2 },
+	{ 0x0013E,  214, 2 },
+	{ 0x00143,  216, 2 },
+	{ 0x00144,  218, 2 },
+	{ 0x00145,  220, 2 },
+	{ 0x00146,  222, 2 },
+	{ 0x00147,  224, 2 },
+	{ 0x00148,  226, 2 },
+	{ 0x0014C,  228, 2 },
+	{ 0x0014D,  230, 2 },
+	{ 0x0014E,  232, 2 },
+	{ 0x0014F,  234, 2 },
+	{ 0x00150,  236, 2 },
+	{ 0x00151,  238, 2 },
+	{ 0x00154,  240, 2 },
+	{ 0x00155,  242, 2 },
+	{ 0x00156,  244, 2 },
+	{ 0x00157,  246, 2 },
+	{ 0x00158,  248, 2 },
+	{ 0x00159,  250, 2 },
+	{ 0x0015A,  252, 2 },
+	{ 0x0015B,  254, 2 },
+	{ 0x0015C,  256, 2 },
+	{ 0x0015D,  258, 2 },
+	{ 0x0015E,  260, 2 },
+	{ 0x0015F,  262, 2 },
+	{ 0x00160,  264, 2 },
+	{ 0x00161,  266, 2 },
+	{ 0x00162,  268, 2 },
+	{ 0x00163,  270, 2 },
+	{ 0x00164,  272, 2 },
+	{ 0x00165,  274, 2 },
+	{ 0x00168,  276, 2 },
+	{ 0x00169,  278, 2 },
+	{ 0x0016A,  280, 2 },
+	{ 0x0016B,  282, 2 },
+	{ 0x0016C,  284, 2 },
+	{ 0x0016D,  286, 2 },
+	{ 0x0016E,  288, 2 },
+	{ 0x0016F,  290, 2 },
+	{ 0x00170,  292, 2 },
+	{ 0x00171,  294, 2 },
+	{ 0x00172,  296, 2 },
+	{ 0x00173,  298, 2 },
+	{ 0x00174,  300, 2 },
+	{ 0x00175,  302, 2 },
+	{ 0x00176,  304, 2 },
+	{ 0x00177,  306, 2 },
+	{ 0x00178,  308, 2 },
+	{ 0x00179,  310, 2 },
+	{ 0x0017A,  312, 2 },
+	{ 0x0017B,  314, 2 },
+	{ 0x0017C,  316, 2 },
+	{ 0x0017D,  318, 2 },
+	{ 0x0017E,  320, 2 },
+	{ 0x001A0,  322, 2 },
+	{ 0x001A1,  324, 2 },
+	{ 0x001AF,  326, 2 },
+	{ 0x001B0,  328, 2 },
+	{ 0x001CD,  330, 2 },
+	{ 0x001CE,  332, 2 },
+	{ 0x001CF,  334, 2 },
+	{ 0x001D0,  336, 2 },
+	{ 0x001D1,  338, 2 },
+	{ 0x001D2,  340, 2 },
+	{ 0x001D3,  342, 2 },
+	{ 0x001D4,  344, 2 },
+	{ 0x001D5,  346, 3 },
+	{ 0x001D6,  349, 3 },
+	{ 0x001D7,  352, 3 },
+	{ 0x001D8,  355, 3 },
+	{ 0x001D9,  358, 3 },
+	{ 0x001DA,  361, 3 },
+	{ 0x001DB,  364, 3 },
+	{ 0x001DC,  367, 3 },
+	{ 0x001DE,  370, 3 },
+	{ 0x001DF,  373, 3 },
+	{ 0x001E0,  376, 3 },
+	{ 0x001E1,  379, 3 },
+	{ 0x001E2,  382, 2 },
+	{ 0x001E3,  384, 2 },
+	{ 0x001E6,  386, 2 },
+	{ 0x001E7,  388, 2 },
+	{ 0x001E8,  390, 2 },
+	{ 0x001E9,  392, 2 },
+	{ 0x001EA,  394, 2 },
+	{ 0x001EB,  396, 2 },
+	{ 0x001EC,  398, 3 },
+	{ 0x001ED,  401, 3 },
+	{ 0x001EE,  404, 2 },
+	{ 0x001EF,  406, 2 },
+	{ 0x001F0,  408, 2 },
+	{ 0x001F4,  410, 2 },
+	{ 0x001F5,  412, 2 },
+	{ 0x001F8,  414, 2 },
+	{ 0x001F9,  416, 2 },
+	{ 0x001FA,  418, 3 },
+	{ 0x001FB,  421, 3 },
+	{ 0x001FC,  424, 2 },
+	{ 0x001FD,  426, 2 },
+	{ 0x001FE,  428, 2 },
+	{ 0x001FF,  430, 2 },
+	{ 0x00200,  432, 2 },
+	{ 0x00201,  434, 2 },
+	{ 0x00202,  436, 2 },
+	{ 0x00203,  438, 2 },
+	{ 0x00204,  440, 2 },
+	{ 0x00205,  442, 2 },
+	{ 0x00206,  444, 2 },
+	{ 0x00207,  446, 2 },
+	{ 0x00208,  448, 2 },
+	{ 0x00209,  450, 2 },
+	{ 0x0020A,  452, 2 },
+	{ 0x0020B,  454, 2 },
+	{ 0x0020C,  456, 2 },
+	{ 0x0020D,  458, 2 },
+	{ 0x0020E,  460, 2 },
+	{ 0x0020F,  462, 2 },
+	{ 0x00210,  464, 2 },
+	{ 0x00211,  466, 2 },
+	{ 0x00212,  468, 2 },
+	{ 0x00213,  470, 2 },
+	{ 0x00214,  472, 2 },
+	{ 0x00215,  474, 2 },
+	{ 0x00216,  476, 2 },
+	{ 0x00217,  478, 2 },
+	{ 0x00218,  480, 2 },
+	{ 0x00219,  482, 2 },
+	{ 0x0021A,  484, 2 },
+	{ 0x0021B,  486, 2 },
+	{ 0x0021E,  488, 2 },
+	{ 0x0021F,  490, 2 },
+	{ 0x00226,  492, 2 },
+	{ 0x00227,  494, 2 },
+	{ 0x00228,  496, 2 },
+	{ 0x00229,  498, 2 },
+	{ 0x0022A,  500, 3 },
+	{ 0x0022B,  503, 3 },
+	{ 0x0022C,  506, 3 },
+	{ 0x0022D,  509, 3 },
+	{ 0x0022E,  512, 2 },
+	{ 0x0022F,  514, 2 },
+	{ 0x00230,  516, 3 },
+	{ 0x00231,  519, 3 },
+	{ 0x00232,  522, 2 },
+	{ 0x00233,  524, 2 },
+	{ 0x00340,  526, 1 },
+	{ 0x00341,  527, 1 },
+	{ 0x00343,  528, 1 },
+	{ 0x00344,  529, 2 },
+	{ 0x00374,  531, 1 },
+	{ 0x0037E,  532, 1 },
+	{ 0x00385,  533, 2 },
+	{ 0x00386,  535, 2 },
+	{ 0x00387,  537, 1 },
+	{ 0x00388,  538, 2 },
+	{ 0x00389,  540, 2 },
+	{ 0x0038A,  542, 2 },
+	{ 0x0038C,  544, 2 },
+	{ 0x0038E,  546, 2 },
+	{ 0x0038F,  548, 2 },
+	{ 0x00390,  550, 3 },
+	{ 0x003AA,  553, 2 },
+	{ 0x003AB,  555, 2 },
+	{ 0x003AC,  557, 2 },
+	{ 0x003AD,  559, 2 },
+	{ 0x003AE,  561, 2 },
+	{ 0x003AF,  563, 2 },
+	{ 0x003B0,  565, 3 },
+	{ 0x003CA,  568, 2 },
+	{ 0x003CB,  570, 2 },
+	{ 0x003CC,  572, 2 },
+	{ 0x003CD,  574, 2 },
+	{ 0x003CE,  576, 2 },
+	{ 0x003D3,  578, 2 },
+	{ 0x003D4,  580, 2 },
+	{ 0x00400,  582, 2 },
+	{ 0x00401,  584, 2 },
+	{ 0x00403,  586, 2 },
+	{ 0x00407,  588, 2 },
+	{ 0x0040C,  590, 2 },
+	{ 0x0040D,  592, 2 },
+	{ 0x0040E,  594, 2 },
+	{ 0x00419,  596, 2 },
+	{ 0x00439,  598, 2 },
+	{ 0x00450,  600, 2 },
+	{ 0x00451,  602, 2 },
+	{ 0x00453,  604, 2 },
+	{ 0x00457,  606, 2 },
+	{ 0x0045C,  608, 2 },
+	{ 0x0045D,  610, 2 },
+	{ 0x0045E,  612, 2 },
+	{ 0x00476,  614, 2 },
+	{ 0x00477,  616, 2 },
+	{ 0x004C1,  618, 2 },
+	{ 0x004C2,  620, 2 },
+	{ 0x004D0,  622, 2 },
+	{ 0x004D1,  624, 2 },
+	{ 0x004D2,  626, 2 },
+	{ 0x004D3,  628, 2 },
+	{ 0x004D6,  630, 2 },
+	{ 0x004D7,  632, 2 },
+	{ 0x004DA,  634, 2 },
+	{ 0x004DB,  636, 2 },
+	{ 0x004DC,  638, 2 },
+	{ 0x004DD,  640, 2 },
+	{ 0x004DE,  642, 2 },
+	{ 0x004DF,  644, 2 },
+	{ 0x004E2,  646, 2 },
+	{ 0x004E3,  648, 2 },
+	{ 0x004E4,  650, 2 },
+	{ 0x004E5,  652, 2 },
+	{ 0x004E6,  654, 2 },
+	{ 0x004E7,  656, 2 },
+	{ 0x004EA,  658, 2 },
+	{ 0x004EB,  660, 2 },
+	{ 0x004EC,  662, 2 },
+	{ 0x004ED,  664, 2 },
+	{ 0x004EE,  666, 2 },
+	{ 0x004EF,  668, 2 },
+	{ 0x004F0,  670, 2 },
+	{ 0x004F1,  672, 2 },
+	{ 0x004F2,  674, 2 },
+	{ 0x004F3,  676, 2 },
+	{ 0x004F4,  678, 2 },
+	{ 0x004F5,  680, 2 },
+	{ 0x004F8,  682, 2 },
+	{ 0x004F9,  684, 2 },
+	{ 0x00622,  686, 2 },
+	{ 0x00623,  688, 2 },
+	{ 0x00624,  690, 2 },
+	{ 0x00625,  692, 2 },
+	{ 0x00626,  694, 2 },
+	{ 0x006C0,  696, 2 },
+	{ 0x006C2,  698, 2 },
+	{ 0x006D3,  700, 2 },
+	{ 0x00929,  702, 2 },
+	{ 0x00931,  704, 2 },
+	{ 0x00934,  706, 2 },
+	{ 0x00958,  708, 2 },
+	{ 0x00959,  710, 2 },
+	{ 0x0095A,  712, 2 },
+	{ 0x0095B,  714, 2 },
+	{ 0x0095C,  716, 2 },
+	{ 0x0095D,  718, 2 },
+	{ 0x0095E,  720, 2 },
+	{ 0x0095F,  722, 2 },
+	{ 0x009CB,  724, 2 },
+	{ 0x009CC,  726, 2 },
+	{ 0x009DC,  728, 2 },
+	{ 0x009DD,  730, 2 },
+	{ 0x009DF,  732, 2 },
+	{ 0x00A33,  734, 2 },
+	{ 0x00A36,  736, 2 },
+	{ 0x00A59,  738, 2 },
+	{ 0x00A5A,  740, 2 },
+	{ 0x00A5B,  742, 2 },
+	{ 0x00A5E,  744, 2 },
+	{ 0x00B48,  746, 2 },
+	{ 0x00B4B,  748, 2 },
+	{ 0x00B4C,  750, 2 },
+	{ 0x00B5C,  752, 2 },
+	{ 0x00B5D,  754, 2 },
+	{ 0x00B94,  756, 2 },
+	{ 0x00BCA,  758, 2 },
+	{ 0x00BCB,  760, 2 },
+	{ 0x00BCC,  762, 2 },
+	{ 0x00C48,  764, 2 },
+	{ 0x00CC0,  766, 2 },
+	{ 0x00CC7,  768, 2 },
+	{ 0x00CC8,  770, 2 },
+	{ 0x00CCA,  772, 2 },
+	{ 0x00CCB,  774, 3 },
+	{ 0x00D4A,  777, 2 },
+	{ 0x00D4B,  779, 2 },
+	{ 0x00D4C,  781, 2 },
+	{ 0x00DDA,  783, 2 },
+	{ 0x00DDC,  785, 2 },
+	{ 0x00DDD,  787, 3 },
+	{ 0x00DDE,  790, 2 },
+	{ 0x00F43,  792, 2 },
+	{ 0x00F4D,  794, 2 },
+	{ 0x00F52,  796, 2 },
+	{ 0x00F57,  798, 2 },
+	{ 0x00F5C,  800, 2 },
+	{ 0x00F69,  802, 2 },
+	{ 0x00F73,  804, 2 },
+	{ 0x00F75,  806, 2 },
+	{ 0x00F76,  808, 2 },
+	{ 0x00F78,  810, 2 },
+	{ 0x00F81,  812, 2 },
+	{ 0x00F93,  814, 2 },
+	{ 0x00F9D,  816, 2 },
+	{ 0x00FA2,  818, 2 },
+	{ 0x00FA7,  820, 2 },
+	{ 0x00FAC,  822, 2 },
+	{ 0x00FB9,  824, 2 },
+	{ 0x01026,  826, 2 },
+	{ 0x01B06,  828, 2 },
+	{ 0x01B08,  830, 2 },
+	{ 0x01B0A,  832, 2 },
+	{ 0x01B0C,  834, 2 },
+	{ 0x01B0E,  836, 2 },
+	{ 0x01B12,  838, 2 },
+	{ 0x01B3B,  840, 2 },
+	{ 0x01B3D,  842, 2 },
+	{ 0x01B40,  844, 2 },
+	{ 0x01B41,  846, 2 },
+	{ 0x01B43,  848, 2 },
+	{ 0x01E00,  850, 2 },
+	{ 0x01E01,  852, 2 },
+	{ 0x01E02,  854, 2 },
+	{ 0x01E03,  856, 2 },
+	{ 0x01E04,  858, 2 },
+	{ 0x01E05,  860, 2 },
+	{ 0x01E06,  862, 2 },
+	{ 0x01E07,  864, 2 },
+	{ 0x01E08,  866, 3 },
+	{ 0x01E09,  869, 3 },
+	{ 0x01E0A,  872, 2 },
+	{ 0x01E0B,  874, 2 },
+	{ 0x01E0C,  876, 2 },
+	{ 0x01E0D,  878, 2 },
+	{ 0x01E0E,  880, 2 },
+	{ 0x01E0F,  882, 2 },
+	{ 0x01E10,  884, 2 },
+	{ 0x01E11,  886, 2 },
+	{ 0x01E12,  888, 2 },
+	{ 0x01E13,  890, 2 },
+	{ 0x01E14,  892, 3 },
+	{ 0x01E15,  895, 3 },
+	{ 0x01E16,  898, 3 },
+	{ 0x01E17,  901, 3 },
+	{ 0x01E18,  904, 2 },
+	{ 0x01E19,  906, 2 },
+	{ 0x01E1A,  908, 2 },
+	{ 0x01E1B,  910, 2 },
+	{ 0x01E1C,  912, 3 },
+	{ 0x01E1D,  915, 3 },
+	{ 0x01E1E,  918, 2 },
+	{ 0x01E1F,  920, 2 },
+	{ 0x01E20,  922, 2 },
+	{ 0x01E21,  924, 2 },
+	{ 0x01E22,  926, 2 },
+	{ 0x01E23,  928, 2 },
+	{ 0x01E24,  930, 2 },
+	{ 0x01E25,  932, 2 },
+	{ 0x01E26,  934, 2 },
+	{ 0x01E27,  936, 2 },
+	{ 0x01E28,  938, 2 },
+	{ 0x01E29,  940, 2 },
+	{ 0x01E2A,  942, 2 },
+	{ 0x01E2B,  944, 2 },
+	{ 0x01E2C,  946, 2 },
+	{ 0x01E2D,  948, 2 },
+	{ 0x01E2E,  950, 3 },
+	{ 0x01E2F,  953, 3 },
+	{ 0x01E30,  956, 2 },
+	{ 0x01E31,  958, 2 },
+	{ 0x01E32,  960, 2 },
+	{ 0x01E33,  962, 2 },
+	{ 0x01E34,  964, 2 },
+	{ 0x01E35,  966, 2 },
+	{ 0x01E36,  968, 2 },
+	{ 0x01E37,  970, 2 },
+	{ 0x01E38,  972, 3 },
+	{ 0x01E39,  975, 3 },
+	{ 0x01E3A,  978, 2 },
+	{ 0x01E3B,  980, 2 },
+	{ 0x01E3C,  982, 2 },
+	{ 0x01E3D,  984, 2 },
+	{ 0x01E3E,  986, 2 },
+	{ 0x01E3F,  988, 2 },
+	{ 0x01E40,  990, 2 },
+	{ 0x01E41,  992, 2 },
+	{ 0x01E42,  994, 2 },
+	{ 0x01E43,  996, 2 },
+	{ 0x01E44,  998, 2 },
+	{ 0x01E45, 1000, 2 },
+	{ 0x01E46, 1002, 2 },
+	{ 0x01E47, 1004, 2 },
+	{ 0x01E48, 1006, 2 },
+	{ 0x01E49, 1008, 2 },
+	{ 0x01E4A, 1010, 2 },
+	{ 0x01E4B, 1012, 2 },
+	{ 0x01E4C, 1014, 3 },
+	{ 0x01E4D, 1017, 3 },
+	{ 0x01E4E, 1020, 3 },
+	{ 0x01E4F, 1023, 3 },
+	{ 0x01E50, 1026, 3 },
+	{ 0x01E51, 1029, 3 },
+	{ 0x01E52, 1032, 3 },
+	{ 0x01E53, 1035, 3 },
+	{ 0x01E54, 1038, 2 },
+	{ 0x01E55, 1040, 2 },
+	{ 0x01E56, 1042, 2 },
+	{ 0x01E57, 1044, 2 },
+	{ 0x01E58, 1046, 2 },
+	{ 0x01E59, 1048, 2 },
+	{ 0x01E5A, 1050, 2 },
+	{ 0x01E5B, 1052, 2 },
+	{ 0x01E5C, 1054, 3 },
+	{ 0x01E5D, 1057, 3 },
+	{ 0x01E5E, 1060, 2 },
+	{ 0x01E5F, 1062, 2 },
+	{ 0x01E60, 1064, 2 },
+	{ 0x01E61, 1066, 2 },
+	{ 0x01E62, 1068, 2 },
+	{ 0x01E63, 1070, 2 },
+	{ 0x01E64, 1072, 3 },
+	{ 0x01E65, 1075, 3 },
+	{ 0x01E66, 1078, 3 },
+	{ 0x01E67, 1081, 3 },
+	{ 0x01E68, 1084, 3 },
+	{ 0x01E69, 1087, 3 },
+	{ 0x01E6A, 1090, 2 },
+	{ 0x01E6B, 1092, 2 },
+	{ 0x01E6C, 1094, 2 },
+	{ 0x01E6D, 1096, 2 },
+	{ 0x01E6E, 1098, 2 },
+	{ 0x01E6F, 1100, 2 },
+	{ 0x01E70, 1102, 2 },
+	{ 0x01E71, 1104, 2 },
+	{ 0x01E72, 1106, 2 },
+	{ 0x01E73, 1108, 2 },
+	{ 0x01E74, 1110, 2 },
+	{ 0x01E75, 1112, 2 },
+	{ 0x01E76, 1114, 2 },
+	{ 0x01E77, 1116, 2 },
+	{ 0x01E78, 1118, 3 },
+	{ 0x01E79, 1121, 3 },
+	{ 0x01E7A, 1124, 3 },
+	{ 0x01E7B, 1127, 3 },
+	{ 0x01E7C, 1130, 2 },
+	{ 0x01E7D, 1132, 2 },
+	{ 0x01E7E, 1134, 2 },
+	{ 0x01E7F, 1136, 2 },
+	{ 0x01E80, 1138, 2 },
+	{ 0x01E81, 1140, 2 },
+	{ 0x01E82, 1142, 2 },
+	{ 0x01E83, 1144, 2 },
+	{ 0x01E84, 1146, 2 },
+	{ 0x01E85, 1148, 2 },
+	{ 0x01E86, 1150, 2 },
+	{ 0x01E87, 1152, 2 },
+	{ 0x01E88, 1154, 2 },
+	{ 0x01E89, 1156, 2 },
+	{ 0x01E8A, 1158, 2 },
+	{ 0x01E8B, 1160, 2 },
+	{ 0x01E8C, 1162, 2 },
+	{ 0x01E8D, 1164, 2 },
+	{ 0x01E8E, 1166, 2 },
+	{ 0x01E8F, 1168, 2 },
+	{ 0x01E90, 1170, 2 },
+	{ 0x01E91, 1172, 2 },
+	{ 0x01E92, 1174, 2 },
+	{ 0x01E93, 1176, 2 },
+	{ 0x01E94, 1178, 2 },
+	{ 0x01E95, 1180, 2 },
+	{ 0x01E96, 1182, 2 },
+	{ 0x01E97, 1184, 2 },
+	{ 0x01E98, 1186, 2 },
+	{ 0x01E99, 1188, 2 },
+	{ 0x01E9B, 1190, 2 },
+	{ 0x01EA0, 1192, 2 },
+	{ 0x01EA1, 1194, 2 },
+	{ 0x01EA2, 1196, 2 },
+	{ 0x01EA3, 1198, 2 },
+	{ 0x01EA4, 1200, 3 },
+	{ 0x01EA5, 1203, 3 },
+	{ 0x01EA6, 1206, 3 },
+	{ 0x01EA7, 1209, 3 },
+	{ 0x01EA8, 1212, 3 },
+	{ 0x01EA9, 1215, 3 },
+	{ 0x01EAA, 1218, 3 },
+	{ 0x01EAB, 1221, 3 },
+	{ 0x01EAC, 1224, 3 },
+	{ 0x01EAD, 1227, 3 },
+	{ 0x01EAE, 1230, 3 },
+	{ 0x01EAF, 1233, 3 },
+	{ 0x01EB0, 1236, 3 },
+	{ 0x01EB1, 1239, 3 },
+	{ 0x01EB2, 1242, 3 },
+	{ 0x01EB3, 1245, 3 },
+	{ 0x01EB4, 1248, 3 },
+	{ 0x01EB5, 1251, 3 },
+	{ 0x01EB6, 1254, 3 },
+	{ 0x01EB7, 1257, 3 },
+	{ 0x01EB8, 1260, 2 },
+	{ 0x01EB9, 1262, 2 },
+	{ 0x01EBA, 1264, 2 },
+	{ 0x01EBB, 1266, 2 },
+	{ 0x01EBC, 1268, 2 },
+	{ 0x01EBD, 1270, 2 },
+	{ 0x01EBE, 1272, 3 },
+	{ 0x01EBF, 1275, 3 },
+	{ 0x01EC0, 1278, 3 },
+	{ 0x01EC1, 1281, 3 },
+	{ 0x01EC2, 1284, 3 },
+	{ 0x01EC3, 1287, 3 },
+	{ 0x01EC4, 1290, 3 },
+	{ 0x01EC5, 1293, 3 },
+	{ 0x01EC6, 1296, 3 },
+	{ 0x01EC7, 1299, 3 },
+	{ 0x01EC8, 1302, 2 },
+	{ 0x01EC9, 1304, 2 },
+	{ 0x01ECA, 1306, 2 },
+	{ 0x01ECB, 1308, 2 },
+	{ 0x01ECC, 1310, 2 },
+	{ 0x01ECD, 1312, 2 },
+	{ 0x01ECE, 1314, 2 },
+	{ 0x01ECF, 1316, 2 },
+	{ 0x01ED0, 1318, 3 },
+	{ 0x01ED1, 1321, 3 },
+	{ 0x01ED2, 1324, 3 },
+	{ 0x01ED3, 1327, 3 },
+	{ 0x01ED4, 1330, 3 },
+	{ 0x01ED5, 1333, 3 },
+	{ 0x01ED6, 1336, 3 },
+	{ 0x01ED7, 1339, 3 },
+	{ 0x01ED8, 1342, 3 },
+	{ 0x01ED9, 1345, 3 },
+	{ 0x01EDA, 1348, 3 },
+	{ 0x01EDB, 1351, 3 },
+	{ 0x01EDC, 1354, 3 },
+	{ 0x01EDD, 1357, 3 },
+	{ 0x01EDE, 1360, 3 },
+	{ 0x01EDF, 1363, 3 },
+	{ 0x01EE0, 1366, 3 },
+	{ 0x01EE1, 1369, 3 },
+	{ 0x01EE2, 1372, 3 },
+	{ 0x01EE3, 1375, 3 },
+	{ 0x01EE4, 1378, 2 },
+	{ 0x01EE5, 1380, 2 },
+	{ 0x01EE6, 1382, 2 },
+	{ 0x01EE7, 1384, 2 },
+	{ 0x01EE8, 1386, 3 },
+	{ 0x01EE9, 1389, 3 },
+	{ 0x01EEA, 1392, 3 },
+	{ 0x01EEB, 1395, 3 },
+	{ 0x01EEC, 1398, 3 },
+	{ 0x01EED, 1401, 3 },
+	{ 0x01EEE, 1404, 3 },
+	{ 0x01EEF, 1407, 3 },
+	{ 0x01EF0, 1410, 3 },
+	{ 0x01EF1, 1413, 3 },
+	{ 0x01EF2, 1416, 2 },
+	{ 0x01EF3, 1418, 2 },
+	{ 0x01EF4, 1420, 2 },
+	{ 0x01EF5, 1422, 2 },
+	{ 0x01EF6, 1424, 2 },
+	{ 0x01EF7, 1426, 2 },
+	{ 0x01EF8, 1428, 2 },
+	{ 0x01EF9, 1430, 2 },
+	{ 0x01F00, 1432, 2 },
+	{ 0x01F01, 1434, 2 },
+	{ 0x01F02, 1436, 3 },
+	{ 0x01F03, 1439, 3 },
+	{ 0x01F04, 1442, 3 },
+	{ 0x01F05, 1445, 3 },
+	{ 0x01F06, 1448, 3 },
+	{ 0x01F07, 1451, 3 },
+	{ 0x01F08, 1454, 2 },
+	{ 0x01F09, 1456, 2 },
+	{ 0x01F0A, 1458, 3 },
+	{ 0x01F0B, 1461, 3 },
+	{ 0x01F0C, 1464, 3 },
+	{ 0x01F0D, 1467, 3 },
+	{ 0x01F0E, 1470, 3 },
+	{ 0x01F0F, 1473, 3 },
+	{ 0x01F10, 1476, 2 },
+	{ 0x01F11, 1478, 2 },
+	{ 0x01F12, 1480, 3 },
+	{ 0x01F13, 1483, 3 },
+	{ 0x01F14, 1486, 3 },
+	{ 0x01F15, 1489, 3 },
+	{ 0x01F18, 1492, 2 },
+	{ 0x01F19, 1494, 2 },
+	{ 0x01F1A, 1496, 3 },
+	{ 0x01F1B, 1499, 3 },
+	{ 0x01F1C, 1502, 3 },
+	{ 0x01F1D, 1505, 3 },
+	{ 0x01F20, 1508, 2 },
+	{ 0x01F21, 1510, 2 },
+	{ 0x01F22, 1512, 3 },
+	{ 0x01F23, 1515, 3 },
+	{ 0x01F24, 1518, 3 },
+	{ 0x01F25, 1521, 3 },
+	{ 0x01F26, 1524, 3 },
+	{ 0x01F27, 1527, 3 },
+	{ 0x01F28, 1530, 2 },
+	{ 0x01F29, 1532, 2 },
+	{ 0x01F2A, 1534, 3 },
+	{ 0x01F2B, 1537, 3 },
+	{ 0x01F2C, 1540, 3 },
+	{ 0x01F2D, 1543, 3 },
+	{ 0x01F2E, 1546, 3 },
+	{ 0x01F2F, 1549, 3 },
+	{ 0x01F30, 1552, 2 },
+	{ 0x01F31, 1554, 2 },
+	{ 0x01F32, 1556, 3 },
+	{ 0x01F33, 1559, 3 },
+	{ 0x01F34, 1562, 3 },
+	{ 0x01F35, 1565, 3 },
+	{ 0x01F36, 1568, 3 },
+	{ 0x01F37, 1571, 3 },
+	{ 0x01F38, 1574, 2 },
+	{ 0x01F39, 1576, 2 },
+	{ 0x01F3A, 1578, 3 },
+	{ 0x01F3B, 1581, 3 },
+	{ 0x01F3C, 1584, 3 },
+	{ 0x01F3D, 1587, 3 },
+	{ 0x01F3E, 1590, 3 },
+	{ 0x01F3F, 1593, 3 },
+	{ 0x01F40, 1596, 2 },
+	{ 0x01F41, 1598, 2 },
+	{ 0x01F42, 1600, 3 },
+	{ 0x01F43, 1603, 3 },
+	{ 0x01F44, 1606, 3 },
+	{ 0x01F45, 1609, 3 },
+	{ 0x01F48, 1612, 2 },
+	{ 0x01F49, 1614, 2 },
+	{ 0x01F4A, 1616, 3 },
+	{ 0x01F4B, 1619, 3 },
+	{ 0x01F4C, 1622, 3 },
+	{ 0x01F4D, 1625, 3 },
+	{ 0x01F50, 1628, 2 },
+	{ 0x01F51, 1630, 2 },
+	{ 0x01F52, 1632, 3 },
+	{ 0x01F53, 1635, 3 },
+	{ 0x01F54, 1638, 3 },
+	{ 0x01F55, 1641, 3 },
+	{ 0x01F56, 1644, 3 },
+	{ 0x01F57, 1647, 3 },
+	{ 0x01F59, 1650, 2 },
+	{ 0x01F5B, 1652, 3 },
+	{ 0x01F5D, 1655, 3 },
+	{ 0x01F5F, 1658, 3 },
+	{ 0x01F60, 1661, 2 },
+	{ 0x01F61, 1663, 2 },
+	{ 0x01F62, 1665, 3 },
+	{ 0x01F63, 1668, 3 },
+	{ 0x01F64, 1671, 3 },
+	{ 0x01F65, 1674, 3 },
+	{ 0x01F66, 1677, 3 },
+	{ 0x01F67, 1680, 3 },
+	{ 0x01F68, 1683, 2 },
+	{ 0x01F69, 1685, 2 },
+	{ 0x01F6A, 1687, 3 },
+	{ 0x01F6B, 1690, 3 },
+	{ 0x01F6C, 1693, 3 },
+	{ 0x01F6D, 1696, 3 },
+	{ 0x01F6E, 1699, 3 },
+	{ 0x01F6F, 1702, 3 },
+	{ 0x01F70, 1705, 2 },
+	{ 0x01F71, 1707, 2 },
+	{ 0x01F72, 1709, 2 },
+	{ 0x01F73, 1711, 2 },
+	{ 0x01F74, 1713, 2 },
+	{ 0x01F75, 1715, 2 },
+	{ 0x01F76, 1717, 2 },
+	{ 0x01F77, 1719, 2 },
+	{ 0x01F78, 1721, 2 },
+	{ 0x01F79, 1723, 2 },
+	{ 0x01F7A, 1725, 2 },
+	{ 0x01F7B, 1727, 2 },
+	{ 0x01F7C, 1729, 2 },
+	{ 0x01F7D, 1731, 2 },
+	{ 0x01F80, 1733, 3 },
+	{ 0x01F81, 1736, 3 },
+	{ 0x01F82, 1739, 4 },
+	{ 0x01F83, 1743, 4 },
+	{ 0x01F84, 1747, 4 },
+	{ 0x01F85, 1751, 4 },
+	{ 0x01F86, 1755, 4 },
+	{ 0x01F87, 1759, 4 },
+	{ 0x01F88, 1763, 3 },
+	{ 0x01F89, 1766, 3 },
+	{ 0x01F8A, 1769, 4 },
+	{ 0x01F8B, 1773, 4 },
+	{ 0x01F8C, 1777, 4 },
+	{ 0x01F8D, 1781, 4 },
+	{ 0x01F8E, 1785, 4 },
+	{ 0x01F8F, 1789, 4 },
+	{ 0x01F90, 1793, 3 },
+	{ 0x01F91, 1796, 3 },
+	{ 0x01F92, 1799, 4 },
+	{ 0x01F93, 1803, 4 },
+	{ 0x01F94, 1807, 4 },
+	{ 0x01F95, 1811, 4 },
+	{ 0x01F96, 1815, 4 },
+	{ 0x01F97, 1819, 4 },
+	{ 0x01F98, 1823, 3 },
+	{ 0x01F99, 1826, 3 },
+	{ 0x01F9A, 1829, 4 },
+	{ 0x01F9B, 1833, 4 },
+	{ 0x01F9C, 1837, 4 },
+	{ 0x01F9D, 1841, 4 },
+	{ 0x01F9E, 1845, 4 },
+	{ 0x01F9F, 1849, 4 },
+	{ 0x01FA0, 1853, 3 },
+	{ 0x01FA1, 1856, 3 },
+	{ 0x01FA2, 1859, 4 },
+	{ 0x01FA3, 1863, 4 },
+	{ 0x01FA4, 1867, 4 },
+	{ 0x01FA5, 1871, 4 },
+	{ 0x01FA6, 1875, 4 },
+	{ 0x01FA7, 1879, 4 },
+	{ 0x01FA8, 1883, 3 },
+	{ 0x01FA9, 1886, 3 },
+	{ 0x01FAA, 1889, 4 },
+	{ 0x01FAB, 1893, 4 },
+	{ 0x01FAC, 1897, 4 },
+	{ 0x01FAD, 1901, 4 },
+	{ 0x01FAE, 1905, 4 },
+	{ 0x01FAF, 1909, 4 },
+	{ 0x01FB0, 1913, 2 },
+	{ 0x01FB1, 1915, 2 },
+	{ 0x01FB2, 1917, 3 },
+	{ 0x01FB3, 1920, 2 },
+	{ 0x01FB4, 1922, 3 },
+	{ 0x01FB6, 1925, 2 },
+	{ 0x01FB7, 1927, 3 },
+	{ 0x01FB8, 1930, 2 },
+	{ 0x01FB9, 1932, 2 },
+	{ 0x01FBA, 1934, 2 },
+	{ 0x01FBB, 1936, 2 },
+	{ 0x01FBC, 1938, 2 },
+	{ 0x01FBE, 1940, 1 },
+	{ 0x01FC1, 1941, 2 },
+	{ 0x01FC2, 1943, 3 },
+	{ 0x01FC3, 1946, 2 },
+	{ 0x01FC4, 1948, 3 },
+	{ 0x01FC6, 1951, 2 },
+	{ 0x01FC7, 1953, 3 },
+	{ 0x01FC8, 1956, 2 },
+	{ 0x01FC9, 1958, 2 },
+	{ 0x01FCA, 1960, 2 },
+	{ 0x01FCB, 1962, 2 },
+	{ 0x01FCC, 1964, 2 },
+	{ 0x01FCD, 1966, 2 },
+	{ 0x01FCE, 1968, 2 },
+	{ 0x01FCF, 1970, 2 },
+	{ 0x01FD0, 1972, 2 },
+	{ 0x01FD1, 1974, 2 },
+	{ 0x01FD2, 1976, 3 },
+	{ 0x01FD3, 1979, 3 },
+	{ 0x01FD6, 1982, 2 },
+	{ 0x01FD7, 1984, 3 },
+	{ 0x01FD8, 1987, 2 },
+	{ 0x01FD9, 1989, 2 },
+	{ 0x01FDA, 1991, 2 },
+	{ 0x01FDB, 1993, 2 },
+	{ 0x01FDD, 1995, 2 },
+	{ 0x01FDE, 1997, 2 },
+	{ 0x01FDF, 1999, 2 },
+	{ 0x01FE0, 2001, 2 },
+	{ 0x01FE1, 2003, 2 },
+	{ 0x01FE2, 2005, 3 },
+	{ 0x01FE3, 2008, 3 },
+	{ 0x01FE4, 2011, 2 },
+	{ 0x01FE5, 2013, 2 },
+	{ 0x01FE6, 2015, 2 },
+	{ 0x01FE7, 2017, 3 },
+	{ 0x01FE8, 2020, 2 },
+	{ 0x01FE9, 2022, 2 },
+	{ 0x01FEA, 2024, 2 },
+	{ 0x01FEB, 2026, 2 },
+	{ 0x01FEC, 2028, 2 },
+	{ 0x01FED, 2030, 2 },
+	{ 0x01FEE, 2032, 2 },
+	{ 0x01FEF, 2034, 1 },
+	{ 0x01FF2, 2035, 3 },
+	{ 0x01FF3, 2038, 2 },
+	{ 0x01FF4, 2040, 3 },
+	{ 0x01FF6, 2043, 2 },
+	{ 0x01FF7, 2045, 3 },
+	{ 0x01FF8, 2048, 2 },
+	{ 0x01FF9, 2050, 2 },
+	{ 0x01FFA, 2052, 2 },
+	{ 0x01FFB, 2054, 2 },
+	{ 0x01FFC, 2056, 2 },
+	{ 0x01FFD, 2058, 1 },
+	{ 0x02000, 2059, 1 },
+	{ 0x02001, 2060, 1 },
+	{ 0x02126, 2061, 1 },
+	{ 0x0212A, 2062, 1 },
+	{ 0x0212B, 2063, 2 },
+	{ 0x0219A, 2065, 2 },
+	{ 0x0219B, 2067, 2 },
+	{ 0x021AE, 2069, 2 },
+	{ 0x021CD, 2071, 2 },
+	{ 0x021CE, 2073, 2 },
+	{ 0x021CF, 2075, 2 },
+	{ 0x02204, 2077, 2 },
+	{ 0x02209, 2079, 2 },
+	{ 0x0220C, 2081, 2 },
+	{ 0x02224, 2083, 2 },
+	{ 0x02226, 2085, 2 },
+	{ 0x02241, 2087, 2 },
+	{ 0x02244, 2089, 2 },
+	{ 0x02247, 2091, 2 },
+	{ 0x02249, 2093, 2 },
+	{ 0x02260, 2095, 2 },
+	{ 0x02262, 2097, 2 },
+	{ 0x0226D, 2099, 2 },
+	{ 0x0226E, 2101, 2 },
+	{ 0x0226F, 2103, 2 },
+	{ 0x02270, 2105, 2 },
+	{ 0x02271, 2107, 2 },
+	{ 0x02274, 2109, 2 },
+	{ 0x02275, 2111, 2 },
+	{ 0x02278, 2113, 2 },
+	{ 0x02279, 2115, 2 },
+	{ 0x02280, 2117, 2 },
+	{ 0x02281, 2119, 2 },
+	{ 0x02284, 2121, 2 },
+	{ 0x02285, 2123, 2 },
+	{ 0x02288, 2125, 2 },
+	{ 0x02289, 2127, 2 },
+	{ 0x022AC, 2129, 2 },
+	{ 0x022AD, 2131, 2 },
+	{ 0x022AE, 2133, 2 },
+	{ 0x022AF, 2135, 2 },
+	{ 0x022E0, 2137, 2 },
+	{ 0x022E1, 2139, 2 },
+	{ 0x022E2, 2141, 2 },
+	{ 0x022E3, 2143, 2 },
+	{ 0x022EA, 2145, 2 },
+	{ 0x022EB, 2147, 2 },
+	{ 0x022EC, 2149, 2 },
+	{ 0x022ED, 2151, 2 },
+	{ 0x02329, 2153, 1 },
+	{ 0x0232A, 2154, 1 },
+	{ 0x02ADC, 2155, 2 },
+	{ 0x0304C, 2157, 2 },
+	{ 0x0304E, 2159, 2 },
+	{ 0x03050, 2161, 2 },
+	{ 0x03052, 2163, 2 },
+	{ 0x03054, 2165, 2 },
+	{ 0x03056, 2167, 2 },
+	{ 0x03058, 2169, 2 },
+	{ 0x0305A, 2171, 2 },
+	{ 0x0305C, 2173, 2 },
+	{ 0x0305E, 2175, 2 },
+	{ 0x03060, 2177, 2 },
+	{ 0x03062, 2179, 2 },
+	{ 0x03065, 2181, 2 },
+	{ 0x03067, 2183, 2 },
+	{ 0x03069, 2185, 2 },
+	{ 0x03070, 2187, 2 },
+	{ 0x03071, 2189, 2 },
+	{ 0x03073, 2191, 2 },
+	{ 0x03074, 2193, 2 },
+	{ 0x03076, 2195, 2 },
+	{ 0x03077, 2197, 2 },
+	{ 0x03079, 2199, 2 },
+	{ 0x0307A, 2201, 2 },
+	{ 0x0307C, 2203, 2 },
+	{ 0x0307D, 2205, 2 },
+	{ 0x03094, 2207, 2 },
+	{ 0x0309E, 2209, 2 },
+	{ 0x030AC, 2211, 2 },
+	{ 0x030AE, 2213, 2 },
+	{ 0x030B0, 2215, 2 },
+	{ 0x030B2, 2217, 2 },
+	{ 0x030B4, 2219, 2 },
+	{ 0x030B6, 2221, 2 },
+	{ 0x030B8, 2223, 2 },
+	{ 0x030BA, 2225, 2 },
+	{ 0x030BC, 2227, 2 },
+	{ 0x030BE, 2229, 2 },
+	{ 0x030C0, 2231, 2 },
+	{ 0x030C2, 2233, 2 },
+	{ 0x030C5, 2235, 2 },
+	{ 0x030C7, 2237, 2 },
+	{ 0x030C9, 2239, 2 },
+	{ 0x030D0, 2241, 2 },
+	{ 0x030D1, 2243, 2 },
+	{ 0x030D3, 2245, 2 },
+	{ 0x030D4, 2247, 2 },
+	{ 0x030D6, 2249, 2 },
+	{ 0x030D7, 2251, 2 },
+	{ 0x030D9, 2253, 2 },
+	{ 0x030DA, 2255, 2 },
+	{ 0x030DC, 2257, 2 },
+	{ 0x030DD, 2259, 2 },
+	{ 0x030F4, 2261, 2 },
+	{ 0x030F7, 2263, 2 },
+	{ 0x030F8, 2265, 2 },
+	{ 0x030F9, 2267, 2 },
+	{ 0x030FA, 2269, 2 },
+	{ 0x030FE, 2271, 2 },
+	{ 0x0F900, 2273, 1 },
+	{ 0x0F901, 2274, 1 },
+	{ 0x0F902, 2275, 1 },
+	{ 0x0F903, 2276, 1 },
+	{ 0x0F904, 2277, 1 },
+	{ 0x0F905, 2278, 1 },
+	{ 0x0F906, 2279, 1 },
+	{ 0x0F907, 2280, 1 },
+	{ 0x0F908, 2281, 1 },
+	{ 0x0F909, 2282, 1 },
+	{ 0x0F90A, 2283, 1 },
+	{ 0x0F90B, 2284, 1 },
+	{ 0x0F90C, 2285, 1 },
+	{ 0x0F90D, 2286, 1 },
+	{ 0x0F90E, 2287, 1 },
+	{ 0x0F90F, 2288, 1 },
+	{ 0x0F910, 2289, 1 },
+	{ 0x0F911, 2290, 1 },
+	{ 0x0F912, 2291, 1 },
+	{ 0x0F913, 2292, 1 },
+	{ 0x0F914, 2293, 1 },
+	{ 0x0F915, 2294, 1 },
+	{ 0x0F916, 2295, 1 },
+	{ 0x0F917, 2296, 1 },
+	{ 0x0F918, 2297, 1 },
+	{ 0x0F919, 2298, 1 },
+	{ 0x0F91A, 2299, 1 },
+	{ 0x0F91B, 2300, 1 },
+	{ 0x0F91C, 2301, 1 },
+	{ 0x0F91D, 2302, 1 },
+	{ 0x0F91E, 2303, 1 },
+	{ 0x0F91F, 2304, 1 },
+	{ 0x0F920, 2305, 1 },
+	{ 0x0F921, 2306, 1 },
+	{ 0x0F922, 2307, 1 },
+	{ 0x0F923, 2308, 1 },
+	{ 0x0F924, 2309, 1 },
+	{ 0x0F925, 2310, 1 },
+	{ 0x0F926, 2311, 1 },
+	{ 0x0F927, 2312, 1 },
+	{ 0x0F928, 2313, 1 },
+	{ 0x0F929, 2314, 1 },
+	{ 0x0F92A, 2315, 1 },
+	{ 0x0F92B, 2316, 1 },
+	{ 0x0F92C, 2317, 1 },
+	{ 0x0F92D, 2318, 1 },
+	{ 0x0F92E, 2319, 1 },
+	{ 0x0F92F, 2320, 1 },
+	{ 0x0F930, 2321, 1 },
+	{ 0x0F931, 2322, 1 },
+	{ 0x0F932, 2323, 1 },
+	{ 0x0F933, 2324, 1 },
+	{ 0x0F934, 2325, 1 },
+	{ 0x0F935, 2326, 1 },
+	{ 0x0F936, 2327, 1 },
+	{ 0x0F937, 2328, 1 },
+	{ 0x0F938, 2329, 1 },
+	{ 0x0F939, 2330, 1 },
+	{ 0x0F93A, 2331, 1 },
+	{ 0x0F93B, 2332, 1 },
+	{ 0x0F93C, 2333, 1 },
+	{ 0x0F93D, 2334, 1 },
+	{ 0x0F93E, 2335, 1 },
+	{ 0x0F93F, 2336, 1 },
+	{ 0x0F940, 2337, 1 },
+	{ 0x0F941, 2338, 1 },
+	{ 0x0F942, 2339, 1 },
+	{ 0x0F943, 2340, 1 },
+	{ 0x0F944, 2341, 1 },
+	{ 0x0F945, 2342, 1 },
+	{ 0x0F946, 2343, 1 },
+	{ 0x0F947, 2344, 1 },
+	{ 0x0F948, 2345, 1 },
+	{ 0x0F949, 2346, 1 },
+	{ 0x0F94A, 2347, 1 },
+	{ 0x0F94B, 2348, 1 },
+	{ 0x0F94C, 2349, 1 },
+	{ 0x0F94D, 2350, 1 },
+	{ 0x0F94E, 2351, 1 },
+	{ 0x0F94F, 2352, 1 },
+	{ 0x0F950, 2353, 1 },
+	{ 0x0F951, 2354, 1 },
+	{ 0x0F952, 2355, 1 },
+	{ 0x0F953, 2356, 1 },
+	{ 0x0F954, 2357, 1 },
+	{ 0x0F955, 2358, 1 },
+	{ 0x0F956, 2359, 1 },
+	{ 0x0F957, 2360, 1 },
+	{ 0x0F958, 2361, 1 },
+	{ 0x0F959, 2362, 1 },
+	{ 0x0F95A, 2363, 1 },
+	{ 0x0F95B, 2364, 1 },
+	{ 0x0F95C, 2365, 1 },
+	{ 0x0F95D, 2366, 1 },
+	{ 0x0F95E, 2367, 1 },
+	{ 0x0F95F, 2368, 1 },
+	{ 0x0F960, 2369, 1 },
+	{ 0x0F961, 2370, 1 },
+	{ 0x0F962, 2371, 1 },
+	{ 0x0F963, 2372, 1 },
+	{ 0x0F964, 2373, 1 },
+	{ 0x0F965, 2374, 1 },
+	{ 0x0F966, 2375, 1 },
+	{ 0x0F967, 2376, 1 },
+	{ 0x0F968, 2377, 1 },
+	{ 0x0F969, 2378, 1 },
+	{ 0x0F96A, 2379, 1 },
+	{ 0x0F96B, 2380, 1 },
+	{ 0x0F96C, 2381, 1 },
+	{ 0x0F96D, 2382, 1 },
+	{ 0x0F96E, 2383, 1 },
+	{ 0x0F96F, 2384, 1 },
+	{ 0x0F970, 2385, 1 },
+	{ 0x0F971, 2386, 1 },
+	{ 0x0F972, 2387, 1 },
+	{ 0x0F973, 2388, 1 },
+	{ 0x0F974, 2389, 1 },
+	{ 0x0F975, 2390, 1 },
+	{ 0x0F976, 2391, 1 },
+	{ 0x0F977, 2392, 1 },
+	{ 0x0F978, 2393, 1 },
+	{ 0x0F979, 2394, 1 },
+	{ 0x0F97A, 2395, 1 },
+	{ 0x0F97B, 2396, 1 },
+	{ 0x0F97C, 2397, 1 },
+	{ 0x0F97D, 2398, 1 },
+	{ 0x0F97E, 2399, 1 },
+	{ 0x0F97F, 2400, 1 },
+	{ 0x0F980, 2401, 1 },
+	{ 0x0F981, 2402, 1 },
+	{ 0x0F982, 2403, 1 },
+	{ 0x0F983, 2404, 1 },
+	{ 0x0F984, 2405, 1 },
+	{ 0x0F985, 2406, 1 },
+	{ 0x0F986, 2407, 1 },
+	{ 0x0F987, 2408, 1 },
+	{ 0x0F988, 2409, 1 },
+	{ 0x0F989, 2410, 1 },
+	{ 0x0F98A, 2411, 1 },
+	{ 0x0F98B, 2412, 1 },
+	{ 0x0F98C, 2413, 1 },
+	{ 0x0F98D, 2414, 1 },
+	{ 0x0F98E, 2415, 1 },
+	{ 0x0F98F, 2416, 1 },
+	{ 0x0F990, 2417, 1 },
+	{ 0x0F991, 2418, 1 },
+	{ 0x0F992, 2419, 1 },
+	{ 0x0F993, 2420, 1 },
+	{ 0x0F994, 2421, 1 },
+	{ 0x0F995, 2422, 1 },
+	{ 0x0F996, 2423, 1 },
+	{ 0x0F997, 2424, 1 },
+	{ 0x0F998, 2425, 1 },
+	{ 0x0F999, 2426, 1 },
+	{ 0x0F99A, 2427, 1 },
+	{ 0x0F99B, 2428, 1 },
+	{ 0x0F99C, 2429, 1 },
+	{ 0x0F99D, 2430, 1 },
+	{ 0x0F99E, 2431, 1 },
+	{ 0x0F99F, 2432, 1 },
+	{ 0x0F9A0, 2433, 1 },
+	{ 0x0F9A1, 2434, 1 },
+	{ 0x0F9A2, 2435, 1 },
+	{ 0x0F9A3, 2436, 1 },
+	{ 0x0F9A4, 2437, 1 },
+	{ 0x0F9A5, 2438, 1 },
+	{ 0x0F9A6, 2439, 1 },
+	{ 0x0F9A7, 2440, 1 },
+	{ 0x0F9A8, 2441, 1 },
+	{ 0x0F9A9, 2442, 1 },
+	{ 0x0F9AA, 2443, 1 },
+	{ 0x0F9AB, 2444, 1 },
+	{ 0x0F9AC, 2445, 1 },
+	{ 0x0F9AD, 2446, 1 },
+	{ 0x0F9AE, 2447, 1 },
+	{ 0x0F9AF, 2448, 1 },
+	{ 0x0F9B0, 2449, 1 },
+	{ 0x0F9B1, 2450, 1 },
+	{ 0x0F9B2, 2451, 1 },
+	{ 0x0F9B3, 2452, 1 },
+	{ 0x0F9B4, 2453, 1 },
+	{ 0x0F9B5, 2454, 1 },
+	{ 0x0F9B6, 2455, 1 },
+	{ 0x0F9B7, 2456, 1 },
+	{ 0x0F9B8, 2457, 1 },
+	{ 0x0F9B9, 2458, 1 },
+	{ 0x0F9BA, 2459, 1 },
+	{ 0x0F9BB, 2460, 1 },
+	{ 0x0F9BC, 2461, 1 },
+	{ 0x0F9BD, 2462, 1 },
+	{ 0x0F9BE, 2463, 1 },
+	{ 0x0F9BF, 2464, 1 },
+	{ 0x0F9C0, 2465, 1 },
+	{ 0x0F9C1, 2466, 1 },
+	{ 0x0F9C2, 2467, 1 },
+	{ 0x0F9C3, 2468, 1 },
+	{ 0x0F9C4, 2469, 1 },
+	{ 0x0F9C5, 2470, 1 },
+	{ 0x0F9C6, 2471, 1 },
+	{ 0x0F9C7, 2472, 1 },
+	{ 0x0F9C8, 2473, 1 },
+	{ 0x0F9C9, 2474, 1 },
+	{ 0x0F9CA, 2475, 1 },
+	{ 0x0F9CB, 2476, 1 },
+	{ 0x0F9CC, 2477, 1 },
+	{ 0x0F9CD, 2478, 1 },
+	{ 0x0F9CE, 2479, 1 },
+	{ 0x0F9CF, 2480, 1 },
+	{ 0x0F9D0, 2481, 1 },
+	{ 0x0F9D1, 2482, 1 },
+	{ 0x0F9D2, 2483, 1 },
+	{ 0x0F9D3, 2484, 1 },
+	{ 0x0F9D4, 2485, 1 },
+	{ 0x0F9D5, 2486, 1 },
+	{ 0x0F9D6, 2487, 1 },
+	{ 0x0F9D7, 2488, 1 },
+	{ 0x0F9D8, 2489, 1 },
+	{ 0x0F9D9, 2490, 1 },
+	{ 0x0F9DA, 2491, 1 },
+	{ 0x0F9DB, 2492, 1 },
+	{ 0x0F9DC, 2493, 1 },
+	{ 0x0F9DD, 2494, 1 },
+	{ 0x0F9DE, 2495, 1 },
+	{ 0x0F9DF, 2496, 1 },
+	{ 0x0F9E0, 2497, 1 },
+	{ 0x0F9E1, 2498, 1 },
+	{ 0x0F9E2, 2499, 1 },
+	{ 0x0F9E3, 2500, 1 },
+	{ 0x0F9E4, 2501, 1 },
+	{ 0x0F9E5, 2502, 1 },
+	{ 0x0F9E6, 2503, 1 },
+	{ 0x0F9E7, 2504, 1 },
+	{ 0x0F9E8, 2505, 1 },
+	{ 0x0F9E9, 2506, 1 },
+	{ 0x0F9EA, 2507, 1 },
+	{ 0x0F9EB, 2508, 1 },
+	{ 0x0F9EC, 2509, 1 },
+	{ 0x0F9ED, 2510, 1 },
+	{ 0x0F9EE, 2511, 1 },
+	{ 0x0F9EF, 2512, 1 },
+	{ 0x0F9F0, 2513, 1 },
+	{ 0x0F9F1, 2514, 1 },
+	{ 0x0F9F2, 2515, 1 },
+	{ 0x0F9F3, 2516, 1 },
+	{ 0x0F9F4, 2517, 1 },
+	{ 0x0F9F5, 2518, 1 },
+	{ 0x0F9F6, 2519, 1 },
+	{ 0x0F9F7, 2520, 1 },
+	{ 0x0F9F8, 2521, 1 },
+	{ 0x0F9F9, 2522, 1 },
+	{ 0x0F9FA, 2523, 1 },
+	{ 0x0F9FB, 2524, 1 },
+	{ 0x0F9FC, 2525, 1 },
+	{ 0x0F9FD, 2526, 1 },
+	{ 0x0F9FE, 2527, 1 },
+	{ 0x0F9FF, 2528, 1 },
+	{ 0x0FA00, 2529, 1 },
+	{ 0x0FA01, 2530, 1 },
+	{ 0x0FA02, 2531, 1 },
+	{ 0x0FA03, 2532, 1 },
+	{ 0x0FA04, 2533, 1 },
+	{ 0x0FA05, 2534, 1 },
+	{ 0x0FA06, 2535, 1 },
+	{ 0x0FA07, 2536, 1 },
+	{ 0x0FA08, 2537, 1 },
+	{ 0x0FA09, 2538, 1 },
+	{ 0x0FA0A, 2539, 1 },
+	{ 0x0FA0B, 2540, 1 },
+	{ 0x0FA0C, 2541, 1 },
+	{ 0x0FA0D, 2542, 1 },
+	{ 0x0FA10, 2543, 1 },
+	{ 0x0FA12, 2544, 1 },
+	{ 0x0FA15, 2545, 1 },
+	{ 0x0FA16, 2546, 1 },
+	{ 0x0FA17, 2547, 1 },
+	{ 0x0FA18, 2548, 1 },
+	{ 0x0FA19, 2549, 1 },
+	{ 0x0FA1A, 2550, 1 },
+	{ 0x0FA1B, 2551, 1 },
+	{ 0x0FA1C, 2552, 1 },
+	{ 0x0FA1D, 2553, 1 },
+	{ 0x0FA1E, 2554, 1 },
+	{ 0x0FA20, 2555, 1 },
+	{ 0x0FA22, 2556, 1 },
+	{ 0x0FA25, 2557, 1 },
+	{ 0x0FA26, 2558, 1 },
+	{ 0x0FA2A, 2559, 1 },
+	{ 0x0FA2B, 2560, 1 },
+	{ 0x0FA2C, 2561, 1 },
+	{ 0x0FA2D, 2562, 1 },
+	{ 0x0FA2E, 2563, 1 },
+	{ 0x0FA2F, 2564, 1 },
+	{ 0x0FA30, 2565, 1 },
+	{ 0x0FA31, 2566, 1 },
+	{ 0x0FA32, 2567, 1 },
+	{ 0x0FA33, 2568, 1 },
+	{ 0x0FA34, 2569, 1 },
+	{ 0x0FA35, 2570, 1 },
+	{ 0x0FA36, 2571, 1 },
+	{ 0x0FA37, 2572, 1 },
+	{ 0x0FA38, 2573, 1 },
+	{ 0x0FA39, 2574, 1 },
+	{ 0x0FA3A, 2575, 1 },
+	{ 0x0FA3B, 2576, 1 },
+	{ 0x0FA3C, 2577, 1 },
+	{ 0x0FA3D, 2578, 1 },
+	{ 0x0FA3E, 2579, 1 },
+	{ 0x0FA3F, 2580, 1 },
+	{ 0x0FA40, 2581, 1 },
+	{ 0x0FA41, 2582, 1 },
+	{ 0x0FA42, 2583, 1 },
+	{ 0x0FA43, 2584, 1 },
+	{ 0x0FA44, 2585, 1 },
+	{ 0x0FA45, 2586, 1 },
+	{ 0x0FA46, 2587, 1 },
+	{ 0x0FA47, 2588, 1 },
+	{ 0x0FA48, 2589, 1 },
+	{ 0x0FA49, 2590, 1 },
+	{ 0x0FA4A, 2591, 1 },
+	{ 0x0FA4B, 2592, 1 },
+	{ 0x0FA4C, 2593, 1 },
+	{ 0x0FA4D, 2594, 1 },
+	{ 0x0FA4E, 2595, 1 },
+	{ 0x0FA4F, 2596, 1 },
+	{ 0x0FA50, 2597, 1 },
+	{ 0x0FA51, 2598, 1 },
+	{ 0x0FA52, 2599, 1 },
+	{ 0x0FA53, 2600, 1 },
+	{ 0x0FA54, 2601, 1 },
+	{ 0x0FA55, 2602, 1 },
+	{ 0x0FA56, 2603, 1 },
+	{ 0x0FA57, 2604, 1 },
+	{ 0x0FA58, 2605, 1 },
+	{ 0x0FA59, 2606, 1 },
+	{ 0x0FA5A, 2607, 1 },
+	{ 0x0FA5B, 2608, 1 },
+	{ 0x0FA5C, 2609, 1 },
+	{ 0x0FA5D, 2610, 1 },
+	{ 0x0FA5E, 2611, 1 },
+	{ 0x0FA5F, 2612, 1 },
+	{ 0x0FA60, 2613, 1 },
+	{ 0x0FA61, 2614, 1 },
+	{ 0x0FA62, 2615, 1 },
+	{ 0x0FA63, 2616, 1 },
+	{ 0x0FA64, 2617, 1 },
+	{ 0x0FA65, 2618, 1 },
+	{ 0x0FA66, 2619, 1 },
+	{ 0x0FA67, 2620, 1 },
+	{ 0x0FA68, 2621, 1 },
+	{ 0x0FA69, 2622, 1 },
+	{ 0x0FA6A, 2623, 1 },
+	{ 0x0FA6B, 2624, 1 },
+	{ 0x0FA6C, 2625, 1 },
+	{ 0x0FA6D, 2626, 1 },
+	{ 0x0FA70, 2627, 1 },
+	{ 0x0FA71, 2628, 1 },
+	{ 0x0FA72, 2629, 1 },
+	{ 0x0FA73, 2630, 1 },
+	{ 0x0FA74, 2631, 1 },
+	{ 0x0FA75, 2632, 1 },
+	{ 0x0FA76, 2633, 1 },
+	{ 0x0FA77, 2634, 1 },
+	{ 0x0FA78, 2635, 1 },
+	{ 0x0FA79, 2636, 1 },
+	{ 0x0FA7A, 2637, 1 },
+	{ 0x0FA7B, 2638, 1 },
+	{ 0x0FA7C, 2639, 1 },
+	{ 0x0FA7D, 2640, 1 },
+	{ 0x0FA7E, 2641, 1 },
+	{ 0x0FA7F, 2642, 1 },
+	{ 0x0FA80, 2643, 1 },
+	{ 0x0FA81, 2644, 1 },
+	{ 0x0FA82, 2645, 1 },
+	{ 0x0FA83, 2646, 1 },
+	{ 0x0FA84, 2647, 1 },
+	{ 0x0FA85, 2648, 1 },
+	{ 0x0FA86, 2649, 1 },
+	{ 0x0FA87, 2650, 1 },
+	{ 0x0FA88, 2651, 1 },
+	{ 0x0FA89, 2652, 1 },
+	{ 0x0FA8A, 2653, 1 },
+	{ 0x0FA8B, 2654, 1 },
+	{ 0x0FA8C, 2655, 1 },
+	{ 0x0FA8D, 2656, 1 },
+	{ 0x0FA8E, 2657, 1 },
+	{ 0x0FA8F, 2658, 1 },
+	{ 0x0FA90, 2659, 1 },
+	{ 0x0FA91, 2660, 1 },
+	{ 0x0FA92, 2661, 1 },
+	{ 0x0FA93, 2662, 1 },
+	{ 0x0FA94, 2663, 1 },
+	{ 0x0FA95, 2664, 1 },
+	{ 0x0FA96, 2665, 1 },
+	{ 0x0FA97, 2666, 1 },
+	{ 0x0FA98, 2667, 1 },
+	{ 0x0FA99, 2668, 1 },
+	{ 0x0FA9A, 2669, 1 },
+	{ 0x0FA9B, 2670, 1 },
+	{ 0x0FA9C, 2671, 1 },
+	{ 0x0FA9D, 2672, 1 },
+	{ 0x0FA9E, 2673, 1 },
+	{ 0x0FA9F, 2674, 1 },
+	{ 0x0FAA0, 2675, 1 },
+	{ 0x0FAA1, 2676, 1 },
+	{ 0x0FAA2, 2677, 1 },
+	{ 0x0FAA3, 2678, 1 },
+	{ 0x0FAA4, 2679, 1 },
+	{ 0x0FAA5, 2680, 1 },
+	{ 0x0FAA6, 2681, 1 },
+	{ 0x0FAA7, 2682, 1 },
+	{ 0x0FAA8, 2683, 1 },
+	{ 0x0FAA9, 2684, 1 },
+	{ 0x0FAAA, 2685, 1 },
+	{ 0x0FAAB, 2686, 1 },
+	{ 0x0FAAC, 2687, 1 },
+	{ 0x0FAAD, 2688, 1 },
+	{ 0x0FAAE, 2689, 1 },
+	{ 0x0FAAF, 2690, 1 },
+	{ 0x0FAB0, 2691, 1 },
+	{ 0x0FAB1, 2692, 1 },
+	{ 0x0FAB2, 2693, 1 },
+	{ 0x0FAB3, 2694, 1 },
+	{ 0x0FAB4, 2695, 1 },
+	{ 0x0FAB5, 2696, 1 },
+	{ 0x0FAB6, 2697, 1 },
+	{ 0x0FAB7, 2698, 1 },
+	{ 0x0FAB8, 2699, 1 },
+	{ 0x0FAB9, 2700, 1 },
+	{ 0x0FABA, 2701, 1 },
+	{ 0x0FABB, 2702, 1 },
+	{ 0x0FABC, 2703, 1 },
+	{ 0x0FABD, 2704, 1 },
+	{ 0x0FABE, 2705, 1 },
+	{ 0x0FABF, 2706, 1 },
+	{ 0x0FAC0, 2707, 1 },
+	{ 0x0FAC1, 2708, 1 },
+	{ 0x0FAC2, 2709, 1 },
+	{ 0x0FAC3, 2710, 1 },
+	{ 0x0FAC4, 2711, 1 },
+	{ 0x0FAC5, 2712, 1 },
+	{ 0x0FAC6, 2713, 1 },
+	{ 0x0FAC7, 2714, 1 },
+	{ 0x0FAC8, 2715, 1 },
+	{ 0x0FAC9, 2716, 1 },
+	{ 0x0FACA, 2717, 1 },
+	{ 0x0FACB, 2718, 1 },
+	{ 0x0FACC, 2719, 1 },
+	{ 0x0FACD, 2720, 1 },
+	{ 0x0FACE, 2721, 1 },
+	{ 0x0FACF, 2722, 1 },
+	{ 0x0FAD0, 2723, 1 },
+	{ 0x0FAD1, 2724, 1 },
+	{ 0x0FAD2, 2725, 1 },
+	{ 0x0FAD3, 2726, 1 },
+	{ 0x0FAD4, 2727, 1 },
+	{ 0x0FAD5, 2728, 1 },
+	{ 0x0FAD6, 2729, 1 },
+	{ 0x0FAD7, 2730, 1 },
+	{ 0x0FAD8, 2731, 1 },
+	{ 0x0FAD9, 2732, 1 },
+	{ 0x0FB1D, 2733, 2 },
+	{ 0x0FB1F, 2735, 2 },
+	{ 0x0FB2A, 2737, 2 },
+	{ 0x0FB2B, 2739, 2 },
+	{ 0x0FB2C, 2741, 3 },
+	{ 0x0FB2D, 2744, 3 },
+	{ 0x0FB2E, 2747, 2 },
+	{ 0x0FB2F, 2749, 2 },
+	{ 0x0FB30, 2751, 2 },
+	{ 0x0FB31, 2753, 2 },
+	{ 0x0FB32, 2755, 2 },
+	{ 0x0FB33, 2757, 2 },
+	{ 0x0FB34, 2759, 2 },
+	{ 0x0FB35, 2761, 2 },
+	{ 0x0FB36, 2763, 2 },
+	{ 0x0FB38, 2765, 2 },
+	{ 0x0FB39, 2767, 2 },
+	{ 0x0FB3A, 2769, 2 },
+	{ 0x0FB3B, 2771, 2 },
+	{ 0x0FB3C, 2773, 2 },
+	{ 0x0FB3E, 2775, 2 },
+	{ 0x0FB40, 2777, 2 },
+	{ 0x0FB41, 2779, 2 },
+	{ 0x0FB43, 2781, 2 },
+	{ 0x0FB44, 2783, 2 },
+	{ 0x0FB46, 2785, 2 },
+	{ 0x0FB47, 2787, 2 },
+	{ 0x0FB48, 2789, 2 },
+	{ 0x0FB49, 2791, 2 },
+	{ 0x0FB4A, 2793, 2 },
+	{ 0x0FB4B, 2795, 2 },
+	{ 0x0FB4C, 2797, 2 },
+	{ 0x0FB4D, 2799, 2 },
+	{ 0x0FB4E, 2801, 2 },
+	{ 0x1109A, 2803, 2 },
+	{ 0x1109C, 2805, 2 },
+	{ 0x110AB, 2807, 2 },
+	{ 0x1112E, 2809, 2 },
+	{ 0x1112F, 2811, 2 },
+	{ 0x1134B, 2813, 2 },
+	{ 0x1134C, 2815, 2 },
+	{ 0x114BB, 2817, 2 },
+	{ 0x114BC, 2819, 2 },
+	{ 0x114BE, 2821, 2 },
+	{ 0x115BA, 2823, 2 },
+	{ 0x115BB, 2825, 2 },
+	{ 0x11938, 2827, 2 },
+	{ 0x1D15E, 2829, 2 },
+	{ 0x1D15F, 2831, 2 },
+	{ 0x1D160, 2833, 3 },
+	{ 0x1D161, 2836, 3 },
+	{ 0x1D162, 2839, 3 },
+	{ 0x1D163, 2842, 3 },
+	{ 0x1D164, 2845, 3 },
+	{ 0x1D1BB, 2848, 2 },
+	{ 0x1D1BC, 2850, 2 },
+	{ 0x1D1BD, 2852, 3 },
+	{ 0x1D1BE, 2855, 3 },
+	{ 0x1D1BF, 2858, 3 },
+	{ 0x1D1C0, 2861, 3 },
+	{ 0x2F800, 2864, 1 },
+	{ 0x2F801, 2865, 1 },
+	{ 0x2F802, 2866, 1 },
+	{ 0x2F803, 2867, 1 },
+	{ 0x2F804, 2868, 1 },
+	{ 0x2F805, 2869, 1 },
+	{ 0x2F806, 2870, 1 },
+	{ 0x2F807, 2871, 1 },
+	{ 0x2F808, 2872, 1 },
+	{ 0x2F809, 2873, 1 },
+	{ 0x2F80A, 2874, 1 },
+	{ 0x2F80B, 2875, 1 },
+	{ 0x2F80C, 2876, 1 },
+	{ 0x2F80D, 2877, 1 },
+	{ 0x2F80E, 2878, 1 },
+	{ 0x2F80F, 2879, 1 },
+	{ 0x2F810, 2880, 1 },
+	{ 0x2F811, 2881, 1 },
+	{ 0x2F812, 2882, 1 },
+	{ 0x2F813, 2883, 1 },
+	{ 0x2F814, 2884, 1 },
+	{ 0x2F815, 2885, 1 },
+	{ 0x2F816, 2886, 1 },
+	{ 0x2F817, 2887, 1 },
+	{ 0x2F818, 2888, 1 },
+	{ 0x2F819, 2889, 1 },
+	{ 0x2F81A, 2890, 1 },
+	{ 0x2F81B, 2891, 1 },
+	{ 0x2F81C, 2892, 1 },
+	{ 0x2F81D, 2893, 1 },
+	{ 0x2F81E, 2894, 1 },
+	{ 0x2F81F, 2895, 1 },
+	{ 0x2F820, 2896, 1 },
+	{ 0x2F821, 2897, 1 },
+	{ 0x2F822, 2898, 1 },
+	{ 0x2F823, 2899, 1 },
+	{ 0x2F824, 2900, 1 },
+	{ 0x2F825, 2901, 1 },
+	{ 0x2F826, 2902, 1 },
+	{ 0x2F827, 2903, 1 },
+	{ 0x2F828, 2904, 1 },
+	{ 0x2F829, 2905, 1 },
+	{ 0x2F82A, 2906, 1 },
+	{ 0x2F82B, 2907, 1 },
+	{ 0x2F82C, 2908, 1 },
+	{ 0x2F82D, 2909, 1 },
+	{ 0x2F82E, 2910, 1 },
+	{ 0x2F82F, 2911, 1 },
+	{ 0x2F830, 2912, 1 },
+	{ 0x2F831, 2913, 1 },
+	{ 0x2F832, 2914, 1 },
+	{ 0x2F833, 2915, 1 },
+	{ 0x2F834, 2916, 1 },
+	{ 0x2F835, 2917, 1 },
+	{ 0x2F836, 2918, 1 },
+	{ 0x2F837, 2919, 1 },
+	{ 0x2F838, 2920, 1 },
+	{ 0x2F839, 2921, 1 },
+	{ 0x2F83A, 2922, 1 },
+	{ 0x2F83B, 2923, 1 },
+	{ 0x2F83C, 2924, 1 },
+	{ 0x2F83D, 2925, 1 },
+	{ 0x2F83E, 2926, 1 },
+	{ 0x2F83F, 2927, 1 },
+	{ 0x2F840, 2928, 1 },
+	{ 0x2F841, 2929, 1 },
+	{ 0x2F842, 2930, 1 },
+	{ 0x2F843, 2931, 1 },
+	{ 0x2F844, 2932, 1 },
+	{ 0x2F845, 2933, 1 },
+	{ 0x2F846, 2934, 1 },
+	{ 0x2F847, 2935, 1 },
+	{ 0x2F848, 2936, 1 },
+	{ 0x2F849, 2937, 1 },
+	{ 0x2F84A, 2938, 1 },
+	{ 0x2F84B, 2939, 1 },
+	{ 0x2F84C, 2940, 1 },
+	{ 0x2F84D, 2941, 1 },
+	{ 0x2F84E, 2942, 1 },
+	{ 0x2F84F, 2943, 1 },
+	{ 0x2F850, 2944, 1 },
+	{ 0x2F851, 2945, 1 },
+	{ 0x2F852, 2946, 1 },
+	{ 0x2F853, 2947, 1 },
+	{ 0x2F854, 2948, 1 },
+	{ 0x2F855, 2949, 1 },
+	{ 0x2F856, 2950, 1 },
+	{ 0x2F857, 2951, 1 },
+	{ 0x2F858, 2952, 1 },
+	{ 0x2F859, 2953, 1 },
+	{ 0x2F85A, 2954, 1 },
+	{ 0x2F85B, 2955, 1 },
+	{ 0x2F85C, 2956, 1 },
+	{ 0x2F85D, 2957, 1 },
+	{ 0x2F85E, 2958, 1 },
+	{ 0x2F85F, 2959, 1 },
+	{ 0x2F860, 2960, 1 },
+	{ 0x2F861, 2961, 1 },
+	{ 0x2F862, 2962, 1 },
+	{ 0x2F863, 2963, 1 },
+	{ 0x2F864, 2964, 1 },
+	{ 0x2F865, 2965, 1 },
+	{ 0x2F866, 2966, 1 },
+	{ 0x2F867, 2967, 1 },
+	{ 0x2F868, 2968, 1 },
+	{ 0x2F869, 2969, 1 },
+	{ 0x2F86A, 2970, 1 },
+	{ 0x2F86B, 2971, 1 },
+	{ 0x2F86C, 2972, 1 },
+	{ 0x2F86D, 2973, 1 },
+	{ 0x2F86E, 2974, 1 },
+	{ 0x2F86F, 2975, 1 },
+	{ 0x2F870, 2976, 1 },
+	{ 0x2F871, 2977, 1 },
+	{ 0x2F872, 2978, 1 },
+	{ 0x2F873, 2979, 1 },
+	{ 0x2F874, 2980, 1 },
+	{ 0x2F875, 2981, 1 },
+	{ 0x2F876, 2982, 1 },
+	{ 0x2F877, 2983, 1 },
+	{ 0x2F878, 2984, 1 },
+	{ 0x2F879, 2985, 1 },
+	{ 0x2F87A, 2986, 1 },
+	{ 0x2F87B, 2987, 1 },
+	{ 0x2F87C, 2988, 1 },
+	{ 0x2F87D, 2989, 1 },
+	{ 0x2F87E, 2990, 1 },
+	{ 0x2F87F, 2991, 1 },
+	{ 0x2F880, 2992, 1 },
+	{ 0x2F881, 2993, 1 },
+	{ 0x2F882, 2994, 1 },
+	{ 0x2F883, 2995, 1 },
+	{ 0x2F884, 2996, 1 },
+	{ 0x2F885, 2997, 1 },
+	{ 0x2F886, 2998, 1 },
+	{ 0x2F887, 2999, 1 },
+	{ 0x2F888, 3000, 1 },
+	{ 0x2F889, 3001, 1 },
+	{ 0x2F88A, 3002, 1 },
+	{ 0x2F88B, 3003, 1 },
+	{ 0x2F88C, 3004, 1 },
+	{ 0x2F88D, 3005, 1 },
+	{ 0x2F88E, 3006, 1 },
+	{ 0x2F88F, 3007, 1 },
+	{ 0x2F890, 3008, 1 },
+	{ 0x2F891, 3009, 1 },
+	{ 0x2F892, 3010, 1 },
+	{ 0x2F893, 3011, 1 },
+	{ 0x2F894, 3012, 1 },
+	{ 0x2F895, 3013, 1 },
+	{ 0x2F896, 3014, 1 },
+	{ 0x2F897, 3015, 1 },
+	{ 0x2F898, 3016, 1 },
+	{ 0x2F899, 3017, 1 },
+	{ 0x2F89A, 3018, 1 },
+	{ 0x2F89B, 3019, 1 },
+	{ 0x2F89C, 3020, 1 },
+	{ 0x2F89D, 3021, 1 },
+	{ 0x2F89E, 3022, 1 },
+	{ 0x2F89F, 3023, 1 },
+	{ 0x2F8A0, 3024, 1 },
+	{ 0x2F8A1, 3025, 1 },
+	{ 0x2F8A2, 3026, 1 },
+	{ 0x2F8A3, 3027, 1 },
+	{ 0x2F8A4, 3028, 1 },
+	{ 0x2F8A5, 3029, 1 },
+	{ 0x2F8A6, 3030, 1 },
+	{ 0x2F8A7, 3031, 1 },
+	{ 0x2F8A8, 3032, 1 },
+	{ 0x2F8A9, 3033, 1 },
+	{ 0x2F8AA, 3034, 1 },
+	{ 0x2F8AB, 3035, 1 },
+	{ 0x2F8AC, 3036, 1 },
+	{ 0x2F8AD, 3037, 1 },
+	{ 0x2F8AE, 3038, 1 },
+	{ 0x2F8AF, 3039, 1 },
+	{ 0x2F8B0, 3040, 1 },
+	{ 0x2F8B1, 3041, 1 },
+	{ 0x2F8B2, 3042, 1 },
+	{ 0x2F8B3, 3043, 1 },
+	{ 0x2F8B4, 3044, 1 },
+	{ 0x2F8B5, 3045, 1 },
+	{ 0x2F8B6, 3046, 1 },
+	{ 0x2F8B7, 3047, 1 },
+	{ 0x2F8B8, 3048, 1 },
+	{ 0x2F8B9, 3049, 1 },
+	{ 0x2F8BA, 3050, 1 },
+	{ 0x2F8BB, 3051, 1 },
+	{ 0x2F8BC, 3052, 1 },
+	{ 0x2F8BD, 3053, 1 },
+	{ 0x2F8BE, 3054, 1 },
+	{ 0x2F8BF, 3055, 1 },
+	{ 0x2F8C0, 3056, 1 },
+	{ 0x2F8C1, 3057, 1 },
+	{ 0x2F8C2, 3058, 1 },
+	{ 0x2F8C3, 3059, 1 },
+	{ 0x2F8C4, 3060, 1 },
+	{ 0x2F8C5, 3061, 1 },
+	{ 0x2F8C6, 3062, 1 },
+	{ 0x2F8C7, 3063, 1 },
+	{ 0x2F8C8, 3064, 1 },
+	{ 0x2F8C9, 3065, 1 },
+	{ 0x2F8CA, 3066, 1 },
+	{ 0x2F8CB, 3067, 1 },
+	{ 0x2F8CC, 3068, 1 },
+	{ 0x2F8CD, 3069, 1 },
+	{ 0x2F8CE, 3070, 1 },
+	{ 0x2F8CF, 3071, 1 },
+	{ 0x2F8D0, 3072, 1 },
+	{ 0x2F8D1, 3073, 1 },
+	{ 0x2F8D2, 3074, 1 },
+	{ 0x2F8D3, 3075, 1 },
+	{ 0x2F8D4, 3076, 1 },
+	{ 0x2F8D5, 3077, 1 },
+	{ 0x2F8D6, 3078, 1 },
+	{ 0x2F8D7, 3079, 1 },
+	{ 0x2F8D8, 3080, 1 },
+	{ 0x2F8D9, 3081, 1 },
+	{ 0x2F8DA, 3082, 1 },
+	{ 0x2F8DB, 3083, 1 },
+	{ 0x2F8DC, 3084, 1 },
+	{ 0x2F8DD, 3085, 1 },
+	{ 0x2F8DE, 3086, 1 },
+	{ 0x2F8DF, 3087, 1 },
+	{ 0x2F8E0, 3088, 1 },
+	{ 0x2F8E1, 3089, 1 },
+	{ 0x2F8E2, 3090, 1 },
+	{ 0x2F8E3, 3091, 1 },
+	{ 0x2F8E4, 3092, 1 },
+	{ 0x2F8E5, 3093, 1 },
+	{ 0x2F8E6, 3094, 1 },
+	{ 0x2F8E7, 3095, 1 },
+	{ 0x2F8E8, 3096, 1 },
+	{ 0x2F8E9, 3097, 1 },
+	{ 0x2F8EA, 3098, 1 },
+	{ 0x2F8EB, 3099, 1 },
+	{ 0x2F8EC, 3100, 1 },
+	{ 0x2F8ED, 3101, 1 },
+	{ 0x2F8EE, 3102, 1 },
+	{ 0x2F8EF, 3103, 1 },
+	{ 0x2F8F0, 3104, 1 },
+	{ 0x2F8F1, 3105, 1 },
+	{ 0x2F8F2, 3106, 1 },
+	{ 0x2F8F3, 3107, 1 },
+	{ 0x2F8F4, 3108, 1 },
+	{ 0x2F8F5, 3109, 1 },
+	{ 0x2F8F6, 3110, 1 },
+	{ 0x2F8F7, 3111, 1 },
+	{ 0x2F8F8, 3112, 1 },
+	{ 0x2F8F9, 3113, 1 },
+	{ 0x2F8FA, 3114, 1 },
+	{ 0x2F8FB, 3115, 1 },
+	{ 0x2F8FC, 3116, 1 },
+	{ 0x2F8FD, 3117, 1 },
+	{ 0x2F8FE, 3118, 1 },
+	{ 0x2F8FF, 3119, 1 },
+	{ 0x2F900, 3120, 1 },
+	{ 0x2F901, 3121, 1 },
+	{ 0x2F902, 3122, 1 },
+	{ 0x2F903, 3123, 1 },
+	{ 0x2F904, 3124, 1 },
+	{ 0x2F905, 3125, 1 },
+	{ 0x2F906, 3126, 1 },
+	{ 0x2F907, 3127, 1 },
+	{ 0x2F908, 3128, 1 },
+	{ 0x2F909, 3129, 1 },
+	{ 0x2F90A, 3130, 1 },
+	{ 0x2F90B, 3131, 1 },
+	{ 0x2F90C, 3132, 1 },
+	{ 0x2F90D, 3133, 1 },
+	{ 0x2F90E, 3134, 1 },
+	{ 0x2F90F, 3135, 1 },
+	{ 0x2F910, 3136, 1 },
+	{ 0x2F911, 3137, 1 },
+	{ 0x2F912, 3138, 1 },
+	{ 0x2F913, 3139, 1 },
+	{ 0x2F914, 3140, 1 },
+	{ 0x2F915, 3141, 1 },
+	{ 0x2F916, 3142, 1 },
+	{ 0x2F917, 3143, 1 },
+	{ 0x2F918, 3144, 1 },
+	{ 0x2F919, 3145, 1 },
+	{ 0x2F91A, 3146, 1 },
+	{ 0x2F91B, 3147, 1 },
+	{ 0x2F91C, 3148, 1 },
+	{ 0x2F91D, 3149, 1 },
+	{ 0x2F91E, 3150, 1 },
+	{ 0x2F91F, 3151, 1 },
+	{ 0x2F920, 3152, 1 },
+	{ 0x2F921, 3153, 1 },
+	{ 0x2F922, 3154, 1 },
+	{ 0x2F923, 3155, 1 },
+	{ 0x2F924, 3156, 1 },
+	{ 0x2F925, 3157, 1 },
+	{ 0x2F926, 3158, 1 },
+	{ 0x2F927, 3159, 1 },
+	{ 0x2F928, 3160, 1 },
+	{ 0x2F929, 3161, 1 },
+	{ 0x2F92A, 3162, 1 },
+	{ 0x2F92B, 3163, 1 },
+	{ 0x2F92C, 3164, 1 },
+	{ 0x2F92D, 3165, 1 },
+	{ 0x2F92E, 3166, 1 },
+	{ 0x2F92F, 3167, 1 },
+	{ 0x2F930, 3168, 1 },
+	{ 0x2F931, 3169, 1 },
+	{ 0x2F932, 3170, 1 },
+	{ 0x2F933, 3171, 1 },
+	{ 0x2F934, 3172, 1 },
+	{ 0x2F935, 3173, 1 },
+	{ 0x2F936, 3174, 1 },
+	{ 0x2F937, 3175, 1 },
+	{ 0x2F938, 3176, 1 },
+	{ 0x2F939, 3177, 1 },
+	{ 0x2F93A, 3178, 1 },
+	{ 0x2F93B, 3179, 1 },
+	{ 0x2F93C, 3180, 1 },
+	{ 0x2F93D, 3181, 1 },
+	{ 0x2F93E, 3182, 1 },
+	{ 0x2F93F, 3183, 1 },
+	{ 0x2F940, 3184, 1 },
+	{ 0x2F941, 3185, 1 },
+	{ 0x2F942, 3186, 1 },
+	{ 0x2F943, 3187, 1 },
+	{ 0x2F944, 3188, 1 },
+	{ 0x2F945, 3189, 1 },
+	{ 0x2F946, 3190, 1 },
+	{ 0x2F947, 3191, 1 },
+	{ 0x2F948, 3192, 1 },
+	{ 0x2F949, 3193, 1 },
+	{ 0x2F94A, 3194, 1 },
+	{ 0x2F94B, 3195, 1 },
+	{ 0x2F94C, 3196, 1 },
+	{ 0x2F94D, 3197, 1 },
+	{ 0x2F94E, 3198, 1 },
+	{ 0x2F94F, 3199, 1 },
+	{ 0x2F950, 3200, 1 },
+	{ 0x2F951, 3201, 1 },
+	{ 0x2F952, 3202, 1 },
+	{ 0x2F953, 3203, 1 },
+	{ 0x2F954, 3204, 1 },
+	{ 0x2F955, 3205, 1 },
+	{ 0x2F956, 3206, 1 },
+	{ 0x2F957, 3207, 1 },
+	{ 0x2F958, 3208, 1 },
+	{ 0x2F959, 3209, 1 },
+	{ 0x2F95A, 3210, 1 },
+	{ 0x2F95B, 3211, 1 },
+	{ 0x2F95C, 3212, 1 },
+	{ 0x2F95D, 3213, 1 },
+	{ 0x2F95E, 3214, 1 },
+	{ 0x2F95F, 3215, 1 },
+	{ 0x2F960, 3216, 1 },
+	{ 0x2F961, 3217, 1 },
+	{ 0x2F962, 3218, 1 },
+	{ 0x2F963, 3219, 1 },
+	{ 0x2F964, 3220, 1 },
+	{ 0x2F965, 3221, 1 },
+	{ 0x2F966, 3222, 1 },
+	{ 0x2F967, 3223, 1 },
+	{ 0x2F968, 3224, 1 },
+	{ 0x2F969, 3225, 1 },
+	{ 0x2F96A, 3226, 1 },
+	{ 0x2F96B, 3227, 1 },
+	{ 0x2F96C, 3228, 1 },
+	{ 0x2F96D, 3229, 1 },
+	{ 0x2F96E, 3230, 1 },
+	{ 0x2F96F, 3231, 1 },
+	{ 0x2F970, 3232, 1 },
+	{ 0x2F971, 3233, 1 },
+	{ 0x2F972, 3234, 1 },
+	{ 0x2F973, 3235, 1 },
+	{ 0x2F974, 3236, 1 },
+	{ 0x2F975, 3237, 1 },
+	{ 0x2F976, 3238, 1 },
+	{ 0x2F977, 3239, 1 },
+	{ 0x2F978, 3240, 1 },
+	{ 0x2F979, 3241, 1 },
+	{ 0x2F97A, 3242, 1 },
+	{ 0x2F97B, 3243, 1 },
+	{ 0x2F97C, 3244, 1 },
+	{ 0x2F97D, 3245, 1 },
+	{ 0x2F97E, 3246, 1 },
+	{ 0x2F97F, 3247, 1 },
+	{ 0x2F980, 3248, 1 },
+	{ 0x2F981, 3249, 1 },
+	{ 0x2F982, 3250, 1 },
+	{ 0x2F983, 3251, 1 },
+	{ 0x2F984, 3252, 1 },
+	{ 0x2F985, 3253, 1 },
+	{ 0x2F986, 3254, 1 },
+	{ 0x2F987, 3255, 1 },
+	{ 0x2F988, 3256, 1 },
+	{ 0x2F989, 3257, 1 },
+	{ 0x2F98A, 3258, 1 },
+	{ 0x2F98B, 3259, 1 },
+	{ 0x2F98C, 3260, 1 },
+	{ 0x2F98D, 3261, 1 },
+	{ 0x2F98E, 3262, 1 },
+	{ 0x2F98F, 3263, 1 },
+	{ 0x2F990, 3264, 1 },
+	{ 0x2F991, 3265, 1 },
+	{ 0x2F992, 3266, 1 },
+	{ 0x2F993, 3267, 1 },
+	{ 0x2F994, 3268, 1 },
+	{ 0x2F995, 3269, 1 },
+	{ 0x2F996, 3270, 1 },
+	{ 0x2F997, 3271, 1 },
+	{ 0x2F998, 3272, 1 },
+	{ 0x2F999, 3273, 1 },
+	{ 0x2F99A, 3274, 1 },
+	{ 0x2F99B, 3275, 1 },
+	{ 0x2F99C, 3276, 1 },
+	{ 0x2F99D, 3277, 1 },
+	{ 0x2F99E, 3278, 1 },
+	{ 0x2F99F, 3279, 1 },
+	{ 0x2F9A0, 3280, 1 },
+	{ 0x2F9A1, 3281, 1 },
+	{ 0x2F9A2, 3282, 1 },
+	{ 0x2F9A3, 3283, 1 },
+	{ 0x2F9A4, 3284, 1 },
+	{ 0x2F9A5, 3285, 1 },
+	{ 0x2F9A6, 3286, 1 },
+	{ 0x2F9A7, 3287, 1 },
+	{ 0x2F9A8, 3288, 1 },
+	{ 0x2F9A9, 3289, 1 },
+	{ 0x2F9AA, 3290, 1 },
+	{ 0x2F9AB, 3291, 1 },
+	{ 0x2F9AC, 3292, 1 },
+	{ 0x2F9AD, 3293, 1 },
+	{ 0x2F9AE, 3294, 1 },
+	{ 0x2F9AF, 3295, 1 },
+	{ 0x2F9B0, 3296, 1 },
+	{ 0x2F9B1, 3297, 1 },
+	{ 0x2F9B2, 3298, 1 },
+	{ 0x2F9B3, 3299, 1 },
+	{ 0x2F9B4, 3300, 1 },
+	{ 0x2F9B5, 3301, 1 },
+	{ 0x2F9B6, 3302, 1 },
+	{ 0x2F9B7, 3303, 1 },
+	{ 0x2F9B8, 3304, 1 },
+	{ 0x2F9B9, 3305, 1 },
+	{ 0x2F9BA, 3306, 1 },
+	{ 0x2F9BB, 3307, 1 },
+	{ 0x2F9BC, 3308, 1 },
+	{ 0x2F9BD, 3309, 1 },
+	{ 0x2F9BE, 3310, 1 },
+	{ 0x2F9BF, 3311, 1 },
+	{ 0x2F9C0, 3312, 1 },
+	{ 0x2F9C1, 3313, 1 },
+	{ 0x2F9C2, 3314, 1 },
+	{ 0x2F9C3, 3315, 1 },
+	{ 0x2F9C4, 3316, 1 },
+	{ 0x2F9C5, 3317, 1 },
+	{ 0x2F9C6, 3318, 1 },
+	{ 0x2F9C7, 3319, 1 },
+	{ 0x2F9C8, 3320, 1 },
+	{ 0x2F9C9, 3321, 1 },
+	{ 0x2F9CA, 3322, 1 },
+	{ 0x2F9CB, 3323, 1 },
+	{ 0x2F9CC, 3324, 1 },
+	{ 0x2F9CD, 3325, 1 },
+	{ 0x2F9CE, 3326, 1 },
+	{ 0x2F9CF, 3327, 1 },
+	{ 0x2F9D0, 3328, 1 },
+	{ 0x2F9D1, 3329, 1 },
+	{ 0x2F9D2, 3330, 1 },
+	{ 0x2F9D3, 3331, 1 },
+	{ 0x2F9D4, 3332, 1 },
+	{ 0x2F9D5, 3333, 1 },
+	{ 0x2F9D6, 3334, 1 },
+	{ 0x2F9D7, 3335, 1 },
+	{ 0x2F9D8, 3336, 1 },
+	{ 0x2F9D9, 3337, 1 },
+	{ 0x2F9DA, 3338, 1 },
+	{ 0x2F9DB, 3339, 1 },
+	{ 0x2F9DC, 3340, 1 },
+	{ 0x2F9DD, 3341, 1 },
+	{ 0x2F9DE, 3342, 1 },
+	{ 0x2F9DF, 3343, 1 },
+	{ 0x2F9E0, 3344, 1 },
+	{ 0x2F9E1, 3345, 1 },
+	{ 0x2F9E2, 3346, 1 },
+	{ 0x2F9E3, 3347, 1 },
+	{ 0x2F9E4, 3348, 1 },
+	{ 0x2F9E5, 3349, 1 },
+	{ 0x2F9E6, 3350, 1 },
+	{ 0x2F9E7, 3351, 1 },
+	{ 0x2F9E8, 3352, 1 },
+	{ 0x2F9E9, 3353, 1 },
+	{ 0x2F9EA, 3354, 1 },
+	{ 0x2F9EB, 3355, 1 },
+	{ 0x2F9EC, 3356, 1 },
+	{ 0x2F9ED, 3357, 1 },
+	{ 0x2F9EE, 3358, 1 },
+	{ 0x2F9EF, 3359, 1 },
+	{ 0x2F9F0, 3360, 1 },
+	{ 0x2F9F1, 3361, 1 },
+	{ 0x2F9F2, 3362, 1 },
+	{ 0x2F9F3, 3363, 1 },
+	{ 0x2F9F4, 3364, 1 },
+	{ 0x2F9F5, 3365, 1 },
+	{ 0x2F9F6, 3366, 1 },
+	{ 0x2F9F7, 3367, 1 },
+	{ 0x2F9F8, 3368, 1 },
+	{ 0x2F9F9, 3369, 1 },
+	{ 0x2F9FA, 3370, 1 },
+	{ 0x2F9FB, 3371, 1 },
+	{ 0x2F9FC, 3372, 1 },
+	{ 0x2F9FD, 3373, 1 },
+	{ 0x2F9FE, 3374, 1 },
+	{ 0x2F9FF, 3375, 1 },
+	{ 0x2FA00, 3376, 1 },
+	{ 0x2FA01, 3377, 1 },
+	{ 0x2FA02, 3378, 1 },
+	{ 0x2FA03, 3379, 1 },
+	{ 0x2FA04, 3380, 1 },
+	{ 0x2FA05, 3381, 1 },
+	{ 0x2FA06, 3382, 1 },
+	{ 0x2FA07, 3383, 1 },
+	{ 0x2FA08, 3384, 1 },
+	{ 0x2FA09, 3385, 1 },
+	{ 0x2FA0A, 3386, 1 },
+	{ 0x2FA0B, 3387, 1 },
+	{ 0x2FA0C, 3388, 1 },
+	{ 0x2FA0D, 3389, 1 },
+	{ 0x2FA0E, 3390, 1 },
+	{ 0x2FA0F, 3391, 1 },
+	{ 0x2FA10, 3392, 1 },
+	{ 0x2FA11, 3393, 1 },
+	{ 0x2FA12, 3394, 1 },
+	{ 0x2FA13, 3395, 1 },
+	{ 0x2FA14, 3396, 1 },
+	{ 0x2FA15, 3397, 1 },
+	{ 0x2FA16, 3398, 1 },
+	{ 0x2FA17, 3399, 1 },
+	{ 0x2FA18, 3400, 1 },
+	{ 0x2FA19, 3401, 1 },
+	{ 0x2FA1A, 3402, 1 },
+	{ 0x2FA1B, 3403, 1 },
+	{ 0x2FA1C, 3404, 1 },
+	{ 0x2FA1D, 3405, 1 },
+};
+
+static const uint32_t nfc_pool[3406] = {
+	0x00041, 0x00300, 0x00041, 0x00301, 0x00041, 0x00302, 0x00041, 0x00303,
+	0x00041, 0x00308, 0x00041, 0x0030A, 0x00043, 0x00327, 0x00045, 0x00300,
+	0x00045, 0x00301, 0x00045, 0x00302, 0x00045, 0x00308, 0x00049, 0x00300,
+	0x00049, 0x00301, 0x00049, 0x00302, 0x00049, 0x00308, 0x0004E, 0x00303,
+	0x0004F, 0x00300, 0x0004F, 0x00301, 0x0004F, 0x00302, 0x0004F, 0x00303,
+	0x0004F, 0x00308, 0x00055, 0x00300, 0x00055, 0x00301, 0x00055, 0x00302,
+	0x00055, 0x00308, 0x00059, 0x00301, 0x00061, 0x00300, 0x00061, 0x00301,
+	0x00061, 0x00302, 0x00061, 0x00303, 0x00061, 0x00308, 0x00061, 0x0030A,
+	0x00063, 0x00327, 0x00065, 0x00300, 0x00065, 0x00301, 0x00065, 0x00302,
+	0x00065, 0x00308, 0x00069, 0x00300, 0x00069, 0x00301, 0x00069, 0x00302,
+	0x00069, 0x00308, 0x0006E, 0x00303, 0x0006F, 0x00300, 0x0006F, 0x00301,
+	0x0006F, 0x00302, 0x0006F, 0x00303, 0x0006F, 0x00308, 0x00075, 0x00300,
+	0x00075, 0x00301, 0x00075, 0x00302, 0x00075, 0x00308, 0x00079, 0x00301,
+	0x00079, 0x00308, 0x00041, 0x00304, 0x00061, 0x00304, 0x00041, 0x00306,
+	0x00061, 0x00306, 0x00041, 0x00328, 0x00061, 0x00328, 0x00043, 0x00301,
+	0x00063, 0x00301, 0x00043, 0x00302, 0x00063, 0x00302, 0x00043, 0x00307,
+	0x00063, 0x00307, 0x00043, 0x0030C, 0x00063, 0x0030C, 0x00044, 0x0030C,
+	0x00064, 0x0030C, 0x00045, 0x00304, 0x00065, 0x00304, 0x00045, 0x00306,
+	0x00065, 0x00306, 0x00045, 0x00307, 0x00065, 0x00307, 0x00045, 0x00328,
+	0x00065, 0x00328, 0x00045, 0x0030C, 0x00065, 0x0030C, 0x00047, 0x00302,
+	0x00067, 0x00302, 0x00047, 0x00306, 0x00067, 0x00306, 0x00047, 0x00307,
+	0x00067, 0x00307, 0x00047, 0x00327, 0x00067, 0x00327, 0x00048, 0x00302,
+	0x00068, 0x00302, 0x00049, 0x00303, 0x00069, 0x00303, 0x00049, 0x00304,
+	0x00069, 0x00304, 0x00049, 0x00306, 0x00069, 0x00306, 0x00049, 0x00328,
+	0x00069, 0x00328, 0x00049, 0x00307, 0x0004A, 0x00302, 0x0006A, 0x00302,
+	0x0004B, 0x00327, 0x0006B, 0x00327, 0x0004C, 0x00301, 0x0006C, 0x00301,
+	0x0004C, 0x00327, 0x0006C, 0x00327, 0x0004C, 0x0030C, 0x0006C, 0x0030C,
+	0x0004E, 0x00301, 0x0006E, 0x00301, 0x0004E, 0x00327, 0x0006E, 0x00327,
+	0x0004E, 0x0030C, 0x0006E, 0x0030C, 0x0004F, 0x00304, 0x0006F, 0x00304,
+	0x0004F, 0x00306, 0x0006F, 0x00306, 0x0004F, 0x0030B, 0x0006F, 0x0030B,
+	0x00052, 0x00301, 0x00072, 0x00301, 0x00052, 0x00327, 0x00072, 0x00327,
+	0x00052, 0x0030C, 0x00072, 0x0030C, 0x00053, 0x00301, 0x00073, 0x00301,
+	0x00053, 0x00302, 0x00073, 0x00302, 0x00053, 0x00327, 0x00073, 0x00327,
+	0x00053, 0x0030C, 0x00073, 0x0030C, 0x00054, 0x00327, 0x00074, 0x00327,
+	0x00054, 0x0030C, 0x00074, 0x0030C, 0x00055, 0x00303, 0x00075, 0x00303,
+	0x00055, 0x00304, 0x00075, 0x00304, 0x00055, 0x00306, 0x00075, 0x00306,
+	0x00055, 0x0030A, 0x00075, 0x0030A, 0x00055, 0x0030B, 0x00075, 0x0030B,
+	0x00055, 0x00328, 0x00075, 0x00328, 0x00057, 0x00302, 0x00077, 0x00302,
+	0x00059, 0x00302, 0x00079, 0x00302, 0x00059, 0x00308, 0x0005A, 0x00301,
+	0x0007A, 0x00301, 0x0005A, 0x00307, 0x0007A, 0x00307, 0x0005A, 0x0030C,
+	0x0007A, 0x0030C, 0x0004F, 0x0031B, 0x0006F, 0x0031B, 0x00055, 0x0031B,
+	0x00075, 0x0031B, 0x00041, 0x0030C, 0x00061, 0x0030C, 0x00049, 0x0030C,
+	0x00069, 0x0030C, 0x0004F, 0x0030C, 0x0006F, 0x0030C, 0x00055, 0x0030C,
+	0x00075, 0x0030C, 0x00055, 0x00308, 0x00304, 0x00075, 0x00308, 0x00304,
+	0x00055, 0x00308, 0x00301, 0x00075, 0x00308, 0x00301, 0x00055, 0x00308,
+	0x0030C, 0x00075, 0x00308, 0x0030C, 0x00055, 0x00308, 0x00300, 0x00075,
+	0x00308, 0x00300, 0x00041, 0x00308, 0x00304, 0x00061, 0x00308, 0x00304,
+	0x00041, 0x00307, 0x00304, 0x00061, 0x00307, 0x00304, 0x000C6, 0x00304,
+	0x000E6, 0x00304, 0x00047, 0x0030C, 0x00067, 0x0030C, 0x0004B, 0x0030C,
+	0x0006B, 0x0030C, 0x0004F, 0x00328, 0x0006F, 0x00328, 0x0004F, 0x00328,
+	0x00304, 0x0006F, 0x00328, 0x00304, 0x001B7, 0x0030C, 0x00292, 0x0030C,
+	0x0006A, 0x0030C, 0x00047, 0x00301, 0x00067, 0x00301, 0x0004E, 0x00300,
+	0x0006E, 0x00300, 0x00041, 0x0030A, 0x00301, 0x00061, 0x0030A, 0x00301,
+	0x000C6, 0x00301, 0x000E6, 0x00301, 0x000D8, 0x00301, 0x000F8, 0x00301,
+	0x00041, 0x0030F, 0x00061, 0x0030F, 0x00041, 0x00311, 0x00061, 0x00311,
+	0x00045, 0x0030F, 0x00065, 0x0030F, 0x00045, 0x00311, 0x00065, 0x00311,
+	0x00049, 0x0030F, 0x00069, 0x0030F, 0x00049, 0x00311, 0x00069, 0x00311,
+	0x0004F, 0x0030F, 0x0006F, 0x0030F, 0x0004F, 0x00311, 0x0006F, 0x00311,
+	0x00052, 0x0030F, 0x00072, 0x0030F, 0x00052, 0x00311, 0x00072, 0x00311,
+	0x00055, 0x0030F, 0x00075, 0x0030F, 0x00055, 0x00311, 0x00075, 0x00311,
+	0x00053, 0x00326, 0x00073, 0x00326, 0x00054, 0x00326, 0x00074, 0x00326,
+	0x00048, 0x0030C, 0x00068, 0x0030C, 0x00041, 0x00307, 0x00061, 0x00307,
+	0x00045, 0x00327, 0x00065, 0x00327, 0x0004F, 0x00308, 0x00304, 0x0006F,
+	0x00308, 0x00304, 0x0004F, 0x00303, 0x00304, 0x0006F, 0x00303, 0x00304,
+	0x0004F, 0x00307, 0x0006F, 0x00307, 0x0004F, 0x00307, 0x00304, 0x0006F,
+	0x00307, 0x00304, 0x00059, 0x00304, 0x00079, 0x00304, 0x00300, 0x00301,
+	0x00313, 0x00308, 0x00301, 0x002B9, 0x0003B, 0x000A8, 0x00301, 0x00391,
+	0x00301, 0x000B7, 0x00395, 0x00301, 0x00397, 0x00301, 0x00399, 0x00301,
+	0x0039F, 0x00301, 0x003A5, 0x00301, 0x003A9, 0x00301, 0x003B9, 0x00308,
+	0x00301, 0x00399, 0x00308, 0x003A5, 0x00308, 0x003B1, 0x00301, 0x003B5,
+	0x00301, 0x003B7, 0x00301, 0x003B9, 0x00301, 0x003C5, 0x00308, 0x00301,
+	0x003B9, 0x00308, 0x003C5, 0x00308, 0x003BF, 0x00301, 0x003C5, 0x00301,
+	0x003C9, 0x00301, 0x003D2, 0x00301, 0x003D2, 0x00308, 0x00415, 0x00300,
+	0x00415, 0x00308, 0x00413, 0x00301, 0x00406, 0x00308, 0x0041A, 0x00301,
+	0x00418, 0x00300, 0x00423, 0x00306, 0x00418, 0x00306, 0x00438, 0x00306,
+	0x00435, 0x00300, 0x00435, 0x00308, 0x00433, 0x00301, 0x00456, 0x00308,
+	0x0043A, 0x00301, 0x00438, 0x00300, 0x00443, 0x00306, 0x00474, 0x0030F,
+	0x00475, 0x0030F, 0x00416, 0x00306, 0x00436, 0x00306, 0x00410, 0x00306,
+	0x00430, 0x00306, 0x00410, 0x00308, 0x00430, 0x00308, 0x00415, 0x00306,
+	0x00435, 0x00306, 0x004D8, 0x00308, 0x004D9, 0x00308, 0x00416, 0x00308,
+	0x00436, 0x00308, 0x00417, 0x00308, 0x00437, 0x00308, 0x00418, 0x00304,
+	0x00438, 0x00304, 0x00418, 0x00308, 0x00438, 0x00308, 0x0041E, 0x00308,
+	0x0043E, 0x00308, 0x004E8, 0x00308, 0x004E9, 0x00308, 0x0042D, 0x00308,
+	0x0044D, 0x00308, 0x00423, 0x00304, 0x00443, 0x00304, 0x00423, 0x00308,
+	0x00443, 0x00308, 0x00423, 0x0030B, 0x00443, 0x0030B, 0x00427, 0x00308,
+	0x00447, 0x00308, 0x0042B, 0x00308, 0x0044B, 0x00308, 0x00627, 0x00653,
+	0x00627, 0x00654, 0x00648, 0x00654, 0x00627, 0x00655, 0x0064A, 0x00654,
+	0x006D5, 0x00654, 0x006C1, 0x00654, 0x006D2, 0x00654, 0x00928, 0x0093C,
+	0x00930, 0x0093C, 0x00933, 0x0093C, 0x00915, 0x0093C, 0x00916, 0x0093C,
+	0x00917, 0x0093C, 0x0091C, 0x0093C, 0x00921, 0x0093C, 0x00922, 0x0093C,
+	0x0092B, 0x0093C, 0x0092F, 0x0093C, 0x009C7, 0x009BE, 0x009C7, 0x009D7,
+	0x009A1, 0x009BC, 0x009A2, 0x009BC, 0x009AF, 0x009BC, 0x00A32, 0x00A3C,
+	0x00A38, 0x00A3C, 0x00A16, 0x00A3C, 0x00A17, 0x00A3C, 0x00A1C, 0x00A3C,
+	0x00A2B, 0x00A3C, 0x00B47, 0x00B56, 0x00B47, 0x00B3E, 0x00B47, 0x00B57,
+	0x00B21, 0x00B3C, 0x00B22, 0x00B3C, 0x00B92, 0x00BD7, 0x00BC6, 0x00BBE,
+	0x00BC7, 0x00BBE, 0x00BC6, 0x00BD7, 0x00C46, 0x00C56, 0x00CBF, 0x00CD5,
+	0x00CC6, 0x00CD5, 0x00CC6, 0x00CD6, 0x00CC6, 0x00CC2, 0x00CC6, 0x00CC2,
+	0x00CD5, 0x00D46, 0x00D3E, 0x00D47, 0x00D3E, 0x00D46, 0x00D57, 0x00DD9,
+	0x00DCA, 0x00DD9, 0x00DCF, 0x00DD9, 0x00DCF, 0x00DCA, 0x00DD9, 0x00DDF,
+	0x00F42, 0x00FB7, 0x00F4C, 0x00FB7, 0x00F51, 0x00FB7, 0x00F56, 0x00FB7,
+	0x00F5B, 0x00FB7, 0x00F40, 0x00FB5, 0x00F71, 0x00F72, 0x00F71, 0x00F74,
+	0x00FB2, 0x00F80, 0x00FB3, 0x00F80, 0x00F71, 0x00F80, 0x00F92, 0x00FB7,
+	0x00F9C, 0x00FB7, 0x00FA1, 0x00FB7, 0x00FA6, 0x00FB7, 0x00FAB, 0x00FB7,
+	0x00F90, 0x00FB5, 0x01025, 0x0102E, 0x01B05, 0x01B35, 0x01B07, 0x01B35,
+	0x01B09, 0x01B35, 0x01B0B, 0x01B35, 0x01B0D, 0x01B35, 0x01B11, 0x01B35,
+	0x01B3A, 0x01B35, 0x01B3C, 0x01B35, 0x01B3E, 0x01B35, 0x01B3F, 0x01B35,
+	0x01B42, 0x01B35, 0x00041, 0x00325, 0x00061, 0x00325, 0x00042, 0x00307,
+	0x00062, 0x00307, 0x00042, 0x00323, 0x00062, 0x00323, 0x00042, 0x00331,
+	0x00062, 0x00331, 0x00043, 0x00327, 0x00301, 0x00063, 0x00327, 0x00301,
+	0x00044, 0x00307, 0x00064, 0x00307, 0x00044, 0x00323, 0x00064, 0x00323,
+	0x00044, 0x00331, 0x00064, 0x00331, 0x00044, 0x00327, 0x00064, 0x00327,
+	0x00044, 0x0032D, 0x00064, 0x0032D, 0x00045, 0x00304, 0x00300, 0x00065,
+	0x00304, 0x00300, 0x00045, 0x00304, 0x00301, 0x00065, 0x00304, 0x00301,
+	0x00045, 0x0032D, 0x00065, 0x0032D, 0x00045, 0x00330, 0x00065, 0x00330,
+	0x00045, 0x00327, 0x00306, 0x00065, 0x00327, 0x00306, 0x00046, 0x00307,
+	0x00066, 0x00307, 0x00047, 0x00304, 0x00067, 0x00304, 0x00048, 0x00307,
+	0x00068, 0x00307, 0x00048, 0x00323, 0x00068, 0x00323, 0x00048, 0x00308,
+	0x00068, 0x00308, 0x00048, 0x00327, 0x00068, 0x00327, 0x00048, 0x0032E,
+	0x00068, 0x0032E, 0x00049, 0x00330, 0x00069, 0x00330, 0x00049, 0x00308,
+	0x00301, 0x00069, 0x00308, 0x00301, 0x0004B, 0x00301, 0x0006B, 0x00301,
+	0x0004B, 0x00323, 0x0006B, 0x00323, 0x0004B, 0x00331, 0x0006B, 0x00331,
+	0x0004C, 0x00323, 0x0006C, 0x00323, 0x0004C, 0x00323, 0x00304, 0x0006C,
+	0x00323, 0x00304, 0x0004C, 0x00331, 0x0006C, 0x00331, 0x0004C, 0x0032D,
+	0x0006C, 0x0032D, 0x0004D, 0x00301, 0x0006D, 0x00301, 0x0004D, 0x00307,
+	0x0006D, 0x00307, 0x0004D, 0x00323, 0x0006D, 0x00323, 0x0004E, 0x00307,
+	0x0006E, 0x00307, 0x0004E, 0x00323, 0x0006E, 0x00323, 0x0004E, 0x00331,
+	0x0006E, 0x00331, 0x0004E, 0x0032D, 0x0006E, 0x0032D, 0x0004F, 0x00303,
+	0x00301, 0x0006F, 0x00303, 0x00301, 0x0004F, 0x00303, 0x00308, 0x0006F,
+	0x00303, 0x00308, 0x0004F, 0x00304, 0x00300, 0x0006F, 0x00304, 0x00300,
+	0x0004F, 0x00304, 0x00301, 0x0006F, 0x00304, 0x00301, 0x00050, 0x00301,
+	0x00070, 0x00301, 0x00050, 0x00307, 0x00070, 0x00307, 0x00052, 0x00307,
+	0x00072, 0x00307, 0x00052, 0x00323, 0x00072, 0x00323, 0x00052, 0x00323,
+	0x00304, 0x00072, 0x00323, 0x00304, 0x00052, 0x00331, 0x00072, 0x00331,
+	0x00053, 0x00307, 0x00073, 0x00307, 0x00053, 0x00323, 0x00073, 0x00323,
+	0x00053, 0x00301, 0x00307, 0x00073, 0x00301, 0x00307, 0x00053, 0x0030C,
+	0x00307, 0x00073, 0x0030C, 0x00307, 0x00053, 0x00323, 0x00307, 0x00073,
+	0x00323, 0x00307, 0x00054, 0x00307, 0x00074, 0x00307, 0x00054, 0x00323,
+	0x00074, 0x00323, 0x00054, 0x00331, 0x00074, 0x00331, 0x00054, 0x0032D,
+	0x00074, 0x0032D, 0x00055, 0x00324, 0x00075, 0x00324, 0x00055, 0x00330,
+	0x00075, 0x00330, 0x00055, 0x0032D, 0x00075, 0x0032D, 0x00055, 0x00303,
+	0x00301, 0x00075, 0x00303, 0x00301, 0x00055, 0x00304, 0x00308, 0x00075,
+	0x00304, 0x00308, 0x00056, 0x00303, 0x00076, 0x00303, 0x00056, 0x00323,
+	0x00076, 0x00323, 0x00057, 0x00300, 0x00077, 0x00300, 0x00057, 0x00301,
+	0x00077, 0x00301, 0x00057, 0x00308, 0x00077, 0x00308, 0x00057, 0x00307,
+	0x00077, 0x00307, 0x00057, 0x00323, 0x00077, 0x00323, 0x00058, 0x00307,
+	0x00078, 0x00307, 0x00058, 0x00308, 0x00078, 0x00308, 0x00059, 0x00307,
+	0x00079, 0x00307, 0x0005A, 0x00302, 0x0007A, 0x00302, 0x0005A, 0x00323,
+	0x0007A, 0x00323, 0x0005A, 0x00331, 0x0007A, 0x00331, 0x00068, 0x00331,
+	0x00074, 0x00308, 0x00077, 0x0030A, 0x00079, 0x0030A, 0x0017F, 0x00307,
+	0x00041, 0x00323, 0x00061, 0x00323, 0x00041, 0x00309, 0x00061, 0x00309,
+	0x00041, 0x00302, 0x00301, 0x00061, 0x00302, 0x00301, 0x00041, 0x00302,
+	0x00300, 0x00061, 0x00302, 0x00300, 0x00041, 0x00302, 0x00309, 0x00061,
+	0x00302, 0x00309, 0x00041, 0x00302, 0x00303, 0x00061, 0x00302, 0x00303,
+	0x00041, 0x00323, 0x00302, 0x00061, 0x00323, 0x00302, 0x00041, 0x00306,
+	0x00301, 0x00061, 0x00306, 0x00301, 0x00041, 0x00306, 0x00300, 0x00061,
+	0x00306, 0x00300, 0x00041, 0x00306, 0x00309, 0x00061, 0x00306, 0x00309,
+	0x00041, 0x00306, 0x00303, 0x00061, 0x00306, 0x00303, 0x00041, 0x00323,
+	0x00306, 0x00061, 0x00323, 0x00306, 0x00045, 0x00323, 0x00065, 0x00323,
+	0x00045, 0x00309, 0x00065, 0x00309, 0x00045, 0x00303, 0x00065, 0x00303,
+	0x00045, 0x00302, 0x00301, 0x00065, 0x00302, 0x00301, 0x00045, 0x00302,
+	0x00300, 0x00065, 0x00302, 0x00300, 0x00045, 0x00302, 0x00309, 0x00065,
+	0x00302, 0x00309, 0x00045, 0x00302, 0x00303, 0x00065, 0x00302, 0x00303,
+	0x00045, 0x00323, 0x00302, 0x00065, 0x00323, 0x00302, 0x00049, 0x00309,
+	0x00069, 0x00309, 0x00049, 0x00323, 0x00069, 0x00323, 0x0004F, 0x00323,
+	0x0006F, 0x00323, 0x0004F, 0x00309, 0x0006F, 0x00309, 0x0004F, 0x00302,
+	0x00301, 0x0006F, 0x00302, 0x00301, 0x0004F, 0x00302, 0x00300, 0x0006F,
+	0x00302, 0x00300, 0x0004F, 0x00302, 0x00309, 0x0006F, 0x00302, 0x00309,
+	0x0004F, 0x00302, 0x00303, 0x0006F, 0x00302, 0x00303, 0x0004F, 0x00323,
+	0x00302, 0x0006F, 0x00323, 0x00302, 0x0004F, 0x0031B, 0x00301, 0x0006F,
+	0x0031B, 0x00301, 0x0004F, 0x0031B, 0x00300, 0x0006F, 0x0031B, 0x00300,
+	0x0004F, 0x0031B, 0x00309, 0x0006F, 0x0031B, 0x00309, 0x0004F, 0x0031B,
+	0x00303, 0x0006F, 0x0031B, 0x00303, 0x0004F, 0x0031B, 0x00323, 0x0006F,
+	0x0031B, 0x00323, 0x00055, 0x00323, 0x00075, 0x00323, 0x00055, 0x00309,
+	0x00075, 0x00309, 0x00055, 0x0031B, 0x00301, 0x00075, 0x0031B, 0x00301,
+	0x00055, 0x0031B, 0x00300, 0x00075, 0x0031B, 0x00300, 0x00055, 0x0031B,
+	0x00309, 0x00075, 0x0031B, 0x00309, 0x00055, 0x0031B, 0x00303, 0x00075,
+	0x0031B, 0x00303, 0x00055, 0x0031B, 0x00323, 0x00075, 0x0031B, 0x00323,
+	0x00059, 0x00300, 0x00079, 0x00300, 0x00059, 0x00323, 0x00079, 0x00323,
+	0x00059, 0x00309, 0x00079, 0x00309, 0x00059, 0x00303, 0x00079, 0x00303,
+	0x003B1, 0x00313, 0x003B1, 0x00314, 0x003B1, 0x00313, 0x00300, 0x003B1,
+	0x00314, 0x00300, 0x003B1, 0x00313, 0x00301, 0x003B1, 0x00314, 0x00301,
+	0x003B1, 0x00313, 0x00342, 0x003B1, 0x00314, 0x00342, 0x00391, 0x00313,
+	0x00391, 0x00314, 0x00391, 0x00313, 0x00300, 0x00391, 0x00314, 0x00300,
+	0x00391, 0x00313, 0x00301, 0x00391, 0x00314, 0x00301, 0x00391, 0x00313,
+	0x00342, 0x00391, 0x00314, 0x00342, 0x003B5, 0x00313, 0x003B5, 0x00314,
+	0x003B5, 0x00313, 0x00300, 0x003B5, 0x00314, 0x00300, 0x003B5, 0x00313,
+	0x00301, 0x003B5, 0x00314, 0x00301, 0x00395, 0x00313, 0x00395, 0x00314,
+	0x00395, 0x00313, 0x00300, 0x00395, 0x00314, 0x00300, 0x00395, 0x00313,
+	0x00301, 0x00395, 0x00314, 0x00301, 0x003B7, 0x00313, 0x003B7, 0x00314,
+	0x003B7, 0x00313, 0x00300, 0x003B7, 0x00314, 0x00300, 0x003B7, 0x00313,
+	0x00301, 0x003B7, 0x00314, 0x00301, 0x003B7, 0x00313, 0x00342, 0x003B7,
+	0x00314, 0x00342, 0x00397, 0x00313, 0x00397, 0x00314, 0x00397, 0x00313,
+	0x00300, 0x00397, 0x00314, 0x00300, 0x00397, 0x00313, 0x00301, 0x00397,
+	0x00314, 0x00301, 0x00397, 0x00313, 0x00342, 0x00397, 0x00314, 0x00342,
+	0x003B9, 0x00313, 0x003B9, 0x00314, 0x003B9, 0x00313, 0x00300, 0x003B9,
+	0x00314, 0x00300, 0x003B9, 0x00313, 0x00301, 0x003B9, 0x00314, 0x00301,
+	0x003B9, 0x00313, 0x00342, 0x003B9, 0x00314, 0x00342, 0x00399, 0x00313,
+	0x00399, 0x00314, 0x00399, 0x00313, 0x00300, 0x00399, 0x00314, 0x00300,
+	0x00399, 0x00313, 0x00301, 0x00399, 0x00314, 0x00301, 0x00399, 0x00313,
+	0x00342, 0x00399, 0x00314, 0x00342, 0x003BF, 0x00313, 0x003BF, 0x00314,
+	0x003BF, 0x00313, 0x00300, 0x003BF, 0x00314, 0x00300, 0x003BF, 0x00313,
+	0x00301, 0x003BF, 0x00314, 0x00301, 0x0039F, 0x00313, 0x0039F, 0x00314,
+	0x0039F, 0x00313, 0x00300, 0x0039F, 0x00314, 0x00300, 0x0039F, 0x00313,
+	0x00301, 0x0039F, 0x00314, 0x00301, 0x003C5, 0x00313, 0x003C5, 0x00314,
+	0x003C5, 0x00313, 0x00300, 0x003C5, 0x00314, 0x00300, 0x003C5, 0x00313,
+	0x00301, 0x003C5, 0x00314, 0x00301, 0x003C5, 0x00313, 0x00342, 0x003C5,
+	0x00314, 0x00342, 0x003A5, 0x00314, 0x003A5, 0x00314, 0x00300, 0x003A5,
+	0x00314, 0x00301, 0x003A5, 0x00314, 0x00342, 0x003C9, 0x00313, 0x003C9,
+	0x00314, 0x003C9, 0x00313, 0x00300, 0x003C9, 0x00314, 0x00300, 0x003C9,
+	0x00313, 0x00301, 0x003C9, 0x00314, 0x00301, 0x003C9, 0x00313, 0x00342,
+	0x003C9, 0x00314, 0x00342, 0x003A9, 0x00313, 0x003A9, 0x00314, 0x003A9,
+	0x00313, 0x00300, 0x003A9, 0x00314, 0x00300, 0x003A9, 0x00313, 0x00301,
+	0x003A9, 0x00314, 0x00301, 0x003A9, 0x00313, 0x00342, 0x003A9, 0x00314,
+	0x00342, 0x003B1, 0x00300, 0x003B1, 0x00301, 0x003B5, 0x00300, 0x003B5,
+	0x00301, 0x003B7, 0x00300, 0x003B7, 0x00301, 0x003B9, 0x00300, 0x003B9,
+	0x00301, 0x003BF, 0x00300, 0x003BF, 0x00301, 0x003C5, 0x00300, 0x003C5,
+	0x00301, 0x003C9, 0x00300, 0x003C9, 0x00301, 0x003B1, 0x00313, 0x00345,
+	0x003B1, 0x00314, 0x00345, 0x003B1, 0x00313, 0x00300, 0x00345, 0x003B1,
+	0x00314, 0x00300, 0x00345, 0x003B1, 0x00313, 0x00301, 0x00345, 0x003B1,
+	0x00314, 0x00301, 0x00345, 0x003B1, 0x00313, 0x00342, 0x00345, 0x003B1,
+	0x00314, 0x00342, 0x00345, 0x00391, 0x00313, 0x00345, 0x00391, 0x00314,
+	0x00345, 0x00391, 0x00313, 0x00300, 0x00345, 0x00391, 0x00314, 0x00300,
+	0x00345, 0x00391, 0x00313, 0x00301, 0x00345, 0x00391, 0x00314, 0x00301,
+	0x00345, 0x00391, 0x00313, 0x00342, 0x00345, 0x00391, 0x00314, 0x00342,
+	0x00345, 0x003B7, 0x00313, 0x00345, 0x003B7, 0x00314, 0x00345, 0x003B7,
+	0x00313, 0x00300, 0x00345, 0x003B7, 0x00314, 0x00300, 0x00345, 0x003B7,
+	0x00313, 0x00301, 0x00345, 0x003B7, 0x00314, 0x00301, 0x00345, 0x003B7,
+	0x00313, 0x00342, 0x00345, 0x003B7, 0x00314, 0x00342, 0x00345, 0x00397,
+	0x00313, 0x00345, 0x00397, 0x00314, 0x00345, 0x00397, 0x00313, 0x00300,
+	0x00345, 0x00397, 0x00314, 0x00300, 0x00345, 0x00397, 0x00313, 0x00301,
+	0x00345, 0x00397, 0x00314, 0x00301, 0x00345, 0x00397, 0x00313, 0x00342,
+	0x00345, 0x00397, 0x00314, 0x00342, 0x00345, 0x003C9, 0x00313, 0x00345,
+	0x003C9, 0x00314, 0x00345, 0x003C9, 0x00313, 0x00300, 0x00345, 0x003C9,
+	0x00314, 0x00300, 0x00345, 0x003C9, 0x00313, 0x00301, 0x00345, 0x003C9,
+	0x00314, 0x00301, 0x00345, 0x003C9, 0x00313, 0x00342, 0x00345, 0x003C9,
+	0x00314, 0x00342, 0x00345, 0x003A9, 0x00313, 0x00345, 0x003A9, 0x00314,
+	0x00345, 0x003A9, 0x00313, 0x00300, 0x00345, 0x003A9, 0x00314, 0x00300,
+	0x00345, 0x003A9, 0x00313, 0x00301, 0x00345, 0x003A9, 0x00314, 0x00301,
+	0x00345, 0x003A9, 0x00313, 0x00342, 0x00345, 0x003A9, 0x00314, 0x00342,
+	0x00345, 0x003B1, 0x00306, 0x003B1, 0x00304, 0x003B1, 0x00300, 0x00345,
+	0x003B1, 0x00345, 0x003B1, 0x00301, 0x00345, 0x003B1, 0x00342, 0x003B1,
+	0x00342, 0x00345, 0x00391, 0x00306, 0x00391, 0x00304, 0x00391, 0x00300,
+	0x00391, 0x00301, 0x00391, 0x00345, 0x003B9, 0x000A8, 0x00342, 0x003B7,
+	0x00300, 0x00345, 0x003B7, 0x00345, 0x003B7, 0x00301, 0x00345, 0x003B7,
+	0x00342, 0x003B7, 0x00342, 0x00345, 0x00395, 0x00300, 0x00395, 0x00301,
+	0x00397, 0x00300, 0x00397, 0x00301, 0x00397, 0x00345, 0x01FBF, 0x00300,
+	0x01FBF, 0x00301, 0x01FBF, 0x00342, 0x003B9, 0x00306, 0x003B9, 0x00304,
+	0x003B9, 0x00308, 0x00300, 0x003B9, 0x00308, 0x00301, 0x003B9, 0x00342,
+	0x003B9, 0x00308, 0x00342, 0x00399, 0x00306, 0x00399, 0x00304, 0x00399,
+	0x00300, 0x00399, 0x00301, 0x01FFE, 0x00300, 0x01FFE, 0x00301, 0x01FFE,
+	0x00342, 0x003C5, 0x00306, 0x003C5, 0x00304, 0x003C5, 0x00308, 0x00300,
+	0x003C5, 0x00308, 0x00301, 0x003C1, 0x00313, 0x003C1, 0x00314, 0x003C5,
+	0x00342, 0x003C5, 0x00308, 0x00342, 0x003A5, 0x00306, 0x003A5, 0x00304,
+	0x003A5, 0x00300, 0x003A5, 0x00301, 0x003A1, 0x00314, 0x000A8, 0x00300,
+	0x000A8, 0x00301, 0x00060, 0x003C9, 0x00300, 0x00345, 0x003C9, 0x00345,
+	0x003C9, 0x00301, 0x00345, 0x003C9, 0x00342, 0x003C9, 0x00342, 0x00345,
+	0x0039F, 0x00300, 0x0039F, 0x00301, 0x003A9, 0x00300, 0x003A9, 0x00301,
+	0x003A9, 0x00345, 0x000B4, 0x02002, 0x02003, 0x003A9, 0x0004B, 0x00041,
+	0x0030A, 0x02190, 0x00338, 0x02192, 0x00338, 0x02194, 0x00338, 0x021D0,
+	0x00338, 0x021D4, 0x00338, 0x021D2, 0x00338, 0x02203, 0x00338, 0x02208,
+	0x00338, 0x0220B, 0x00338, 0x02223, 0x00338, 0x02225, 0x00338, 0x0223C,
+	0x00338, 0x02243, 0x00338, 0x02245, 0x00338, 0x02248, 0x00338, 0x0003D,
+	0x00338, 0x02261, 0x00338, 0x0224D, 0x00338, 0x0003C, 0x00338, 0x0003E,
+	0x00338, 0x02264, 0x00338, 0x02265, 0x00338, 0x02272, 0x00338, 0x02273,
+	0x00338, 0x02276, 0x00338, 0x02277, 0x00338, 0x0227A, 0x00338, 0x0227B,
+	0x00338, 0x02282, 0x00338, 0x02283, 0x00338, 0x02286, 0x00338, 0x02287,
+	0x00338, 0x022A2, 0x00338, 0x022A8, 0x00338, 0x022A9, 0x00338, 0x022AB,
+	0x00338, 0x0227C, 0x00338, 0x0227D, 0x00338, 0x02291, 0x00338, 0x02292,
+	0x00338, 0x022B2, 0x00338, 0x022B3, 0x00338, 0x022B4, 0x00338, 0x022B5,
+	0x00338, 0x03008, 0x03009, 0x02ADD, 0x00338, 0x0304B, 0x03099, 0x0304D,
+	0x03099, 0x0304F, 0x03099, 0x03051, 0x03099, 0x03053, 0x03099, 0x03055,
+	0x03099, 0x03057, 0x03099, 0x03059, 0x03099, 0x0305B, 0x03099, 0x0305D,
+	0x03099, 0x0305F, 0x03099, 0x03061, 0x03099, 0x03064, 0x03099, 0x03066,
+	0x03099, 0x03068, 0x03099, 0x0306F, 0x03099, 0x0306F, 0x0309A, 0x03072,
+	0x03099, 0x03072, 0x0309A, 0x03075, 0x03099, 0x03075, 0x0309A, 0x03078,
+	0x03099, 0x03078, 0x0309A, 0x0307B, 0x03099, 0x0307B, 0x0309A, 0x03046,
+	0x03099, 0x0309D, 0x03099, 0x030AB, 0x03099, 0x030AD, 0x03099, 0x030AF,
+	0x03099, 0x030B1, 0x03099, 0x030B3, 0x03099, 0x030B5, 0x03099, 0x030B7,
+	0x03099, 0x030B9, 0x03099, 0x030BB, 0x03099, 0x030BD, 0x03099, 0x030BF,
+	0x03099, 0x030C1, 0x03099, 0x030C4, 0x03099, 0x030C6, 0x03099, 0x030C8,
+	0x03099, 0x030CF, 0x03099, 0x030CF, 0x0309A, 0x030D2, 0x03099, 0x030D2,
+	0x0309A, 0x030D5, 0x03099, 0x030D5, 0x0309A, 0x030D8, 0x03099, 0x030D8,
+	0x0309A, 0x030DB, 0x03099, 0x030DB, 0x0309A, 0x030A6, 0x03099, 0x030EF,
+	0x03099, 0x030F0, 0x03099, 0x030F1, 0x03099, 0x030F2, 0x03099, 0x030FD,
+	0x03099, 0x08C48, 0x066F4, 0x08ECA, 0x08CC8, 0x06ED1, 0x04E32, 0x053E5,
+	0x09F9C, 0x09F9C, 0x05951, 0x091D1, 0x05587, 0x05948, 0x061F6, 0x07669,
+	0x07F85, 0x0863F, 0x087BA, 0x088F8, 0x0908F, 0x06A02, 0x06D1B, 0x070D9,
+	0x073DE, 0x0843D, 0x0916A, 0x099F1, 0x04E82, 0x05375, 0x06B04, 0x0721B,
+	0x0862D, 0x09E1E, 0x05D50, 0x06FEB, 0x085CD, 0x08964, 0x062C9, 0x081D8,
+	0x0881F, 0x05ECA, 0x06717, 0x06D6A, 0x072FC, 0x090CE, 0x04F86, 0x051B7,
+	0x052DE, 0x064C4, 0x06AD3, 0x07210, 0x076E7, 0x08001, 0x08606, 0x0865C,
+	0x08DEF, 0x09732, 0x09B6F, 0x09DFA, 0x0788C, 0x0797F, 0x07DA0, 0x083C9,
+	0x09304, 0x09E7F, 0x08AD6, 0x058DF, 0x05F04, 0x07C60, 0x0807E, 0x07262,
+	0x078CA, 0x08CC2, 0x096F7, 0x058D8, 0x05C62, 0x06A13, 0x06DDA, 0x06F0F,
+	0x07D2F, 0x07E37, 0x0964B, 0x052D2, 0x0808B, 0x051DC, 0x051CC, 0x07A1C,
+	0x07DBE, 0x083F1, 0x09675, 0x08B80, 0x062CF, 0x06A02, 0x08AFE, 0x04E39,
+	0x05BE7, 0x06012, 0x07387, 0x07570, 0x05317, 0x078FB, 0x04FBF, 0x05FA9,
+	0x04E0D, 0x06CCC, 0x06578, 0x07D22, 0x053C3, 0x0585E, 0x07701, 0x08449,
+	0x08AAA, 0x06BBA, 0x08FB0, 0x06C88, 0x062FE, 0x082E5, 0x063A0, 0x07565,
+	0x04EAE, 0x05169, 0x051C9, 0x06881, 0x07CE7, 0x0826F, 0x08AD2, 0x091CF,
+	0x052F5, 0x05442, 0x05973, 0x05EEC, 0x065C5, 0x06FFE, 0x0792A, 0x095AD,
+	0x09A6A, 0x09E97, 0x09ECE, 0x0529B, 0x066C6, 0x06B77, 0x08F62, 0x05E74,
+	0x06190, 0x06200, 0x0649A, 0x06F23, 0x07149, 0x07489, 0x079CA, 0x07DF4,
+	0x0806F, 0x08F26, 0x084EE, 0x09023, 0x0934A, 0x05217, 0x052A3, 0x054BD,
+	0x070C8, 0x088C2, 0x08AAA, 0x05EC9, 0x05FF5, 0x0637B, 0x06BAE, 0x07C3E,
+	0x07375, 0x04EE4, 0x056F9, 0x05BE7, 0x05DBA, 0x0601C, 0x073B2, 0x07469,
+	0x07F9A, 0x08046, 0x09234, 0x096F6, 0x09748, 0x09818, 0x04F8B, 0x079AE,
+	0x091B4, 0x096B8, 0x060E1, 0x04E86, 0x050DA, 0x05BEE, 0x05C3F, 0x06599,
+	0x06A02, 0x071CE, 0x07642, 0x084FC, 0x0907C, 0x09F8D, 0x06688, 0x0962E,
+	0x05289, 0x0677B, 0x067F3, 0x06D41, 0x06E9C, 0x07409, 0x07559, 0x0786B,
+	0x07D10, 0x0985E, 0x0516D, 0x0622E, 0x09678, 0x0502B, 0x05D19, 0x06DEA,
+	0x08F2A, 0x05F8B, 0x06144, 0x06817, 0x07387, 0x09686, 0x05229, 0x0540F,
+	0x05C65, 0x06613, 0x0674E, 0x068A8, 0x06CE5, 0x07406, 0x075E2, 0x07F79,
+	0x088CF, 0x088E1, 0x091CC, 0x096E2, 0x0533F, 0x06EBA, 0x0541D, 0x071D0,
+	0x07498, 0x085FA, 0x096A3, 0x09C57, 0x09E9F, 0x06797, 0x06DCB, 0x081E8,
+	0x07ACB, 0x07B20, 0x07C92, 0x072C0, 0x07099, 0x08B58, 0x04EC0, 0x08336,
+	0x0523A, 0x05207, 0x05EA6, 0x062D3, 0x07CD6, 0x05B85, 0x06D1E, 0x066B4,
+	0x08F3B, 0x0884C, 0x0964D, 0x0898B, 0x05ED3, 0x05140, 0x055C0, 0x0585A,
+	0x06674, 0x051DE, 0x0732A, 0x076CA, 0x0793C, 0x0795E, 0x07965, 0x0798F,
+	0x09756, 0x07CBE, 0x07FBD, 0x08612, 0x08AF8, 0x09038, 0x090FD, 0x098EF,
+	0x098FC, 0x09928, 0x09DB4, 0x090DE, 0x096B7, 0x04FAE, 0x050E7, 0x0514D,
+	0x052C9, 0x052E4, 0x05351, 0x0559D, 0x05606, 0x05668, 0x05840, 0x058A8,
+	0x05C64, 0x05C6E, 0x06094, 0x06168, 0x0618E, 0x061F2, 0x0654F, 0x065E2,
+	0x06691, 0x06885, 0x06D77, 0x06E1A, 0x06F22, 0x0716E, 0x0722B, 0x07422,
+	0x07891, 0x0793E, 0x07949, 0x07948, 0x07950, 0x07956, 0x0795D, 0x0798D,
+	0x0798E, 0x07A40, 0x07A81, 0x07BC0, 0x07DF4, 0x07E09, 0x07E41, 0x07F72,
+	0x08005, 0x081ED, 0x08279, 0x08279, 0x08457, 0x08910, 0x08996, 0x08B01,
+	0x08B39, 0x08CD3, 0x08D08, 0x08FB6, 0x09038, 0x096E3, 0x097FF, 0x0983B,
+	0x06075, 0x242EE, 0x08218, 0x04E26, 0x051B5, 0x05168, 0x04F80, 0x05145,
+	0x05180, 0x052C7, 0x052FA, 0x0559D, 0x05555, 0x05599, 0x055E2, 0x0585A,
+	0x058B3, 0x05944, 0x05954, 0x05A62, 0x05B28, 0x05ED2, 0x05ED9, 0x05F69,
+	0x05FAD, 0x060D8, 0x0614E, 0x06108, 0x0618E, 0x06160, 0x061F2, 0x06234,
+	0x063C4, 0x0641C, 0x06452, 0x06556, 0x06674, 0x06717, 0x0671B, 0x06756,
+	0x06B79, 0x06BBA, 0x06D41, 0x06EDB, 0x06ECB, 0x06F22, 0x0701E, 0x0716E,
+	0x077A7, 0x07235, 0x072AF, 0x0732A, 0x07471, 0x07506, 0x0753B, 0x0761D,
+	0x0761F, 0x076CA, 0x076DB, 0x076F4, 0x0774A, 0x07740, 0x078CC, 0x07AB1,
+	0x07BC0, 0x07C7B, 0x07D5B, 0x07DF4, 0x07F3E, 0x08005, 0x08352, 0x083EF,
+	0x08779, 0x08941, 0x08986, 0x08996, 0x08ABF, 0x08AF8, 0x08ACB, 0x08B01,
+	0x08AFE, 0x08AED, 0x08B39, 0x08B8A, 0x08D08, 0x08F38, 0x09072, 0x09199,
+	0x09276, 0x0967C, 0x096E3, 0x09756, 0x097DB, 0x097FF, 0x0980B, 0x0983B,
+	0x09B12, 0x09F9C, 0x2284A, 0x22844, 0x233D5, 0x03B9D, 0x04018, 0x04039,
+	0x25249, 0x25CD0, 0x27ED3, 0x09F43, 0x09F8E, 0x005D9, 0x005B4, 0x005F2,
+	0x005B7, 0x005E9, 0x005C1, 0x005E9, 0x005C2, 0x005E9, 0x005BC, 0x005C1,
+	0x005E9, 0x005BC, 0x005C2, 0x005D0, 0x005B7, 0x005D0, 0x005B8, 0x005D0,
+	0x005BC, 0x005D1, 0x005BC, 0x005D2, 0x005BC, 0x005D3, 0x005BC, 0x005D4,
+	0x005BC, 0x005D5, 0x005BC, 0x005D6, 0x005BC, 0x005D8, 0x005BC, 0x005D9,
+	0x005BC, 0x005DA, 0x005BC, 0x005DB, 0x005BC, 0x005DC, 0x005BC, 0x005DE,
+	0x005BC, 0x005E0, 0x005BC, 0x005E1, 0x005BC, 0x005E3, 0x005BC, 0x005E4,
+	0x005BC, 0x005E6, 0x005BC, 0x005E7, 0x005BC, 0x005E8, 0x005BC, 0x005E9,
+	0x005BC, 0x005EA, 0x005BC, 0x005D5, 0x005B9, 0x005D1, 0x005BF, 0x005DB,
+	0x005BF, 0x005E4, 0x005BF, 0x11099, 0x110BA, 0x1109B, 0x110BA, 0x110A5,
+	0x110BA, 0x11131, 0x11127, 0x11132, 0x11127, 0x11347, 0x1133E, 0x11347,
+	0x11357, 0x114B9, 0x114BA, 0x114B9, 0x114B0, 0x114B9, 0x114BD, 0x115B8,
+	0x115AF, 0x115B9, 0x115AF, 0x11935, 0x11930, 0x1D157, 0x1D165, 0x1D158,
+	0x1D165, 0x1D158, 0x1D165, 0x1D16E, 0x1D158, 0x1D165, 0x1D16F, 0x1D158,
+	0x1D165, 0x1D170, 0x1D158, 0x1D165, 0x1D171, 0x1D158, 0x1D165, 0x1D172,
+	0x1D1B9, 0x1D165, 0x1D1BA, 0x1D165, 0x1D1B9, 0x1D165, 0x1D16E, 0x1D1BA,
+	0x1D165, 0x1D16E, 0x1D1B9, 0x1D165, 0x1D16F, 0x1D1BA, 0x1D165, 0x1D16F,
+	0x04E3D, 0x04E38, 0x04E41, 0x20122, 0x04F60, 0x04FAE, 0x04FBB, 0x05002,
+	0x0507A, 0x05099, 0x050E7, 0x050CF, 0x0349E, 0x2063A, 0x0514D, 0x05154,
+	0x05164, 0x05177, 0x2051C, 0x034B9, 0x05167, 0x0518D, 0x2054B, 0x05197,
+	0x051A4, 0x04ECC, 0x051AC, 0x051B5, 0x291DF, 0x051F5, 0x05203, 0x034DF,
+	0x0523B, 0x05246, 0x05272, 0x05277, 0x03515, 0x052C7, 0x052C9, 0x052E4,
+	0x052FA, 0x05305, 0x05306, 0x05317, 0x05349, 0x05351, 0x0535A, 0x05373,
+	0x0537D, 0x0537F, 0x0537F, 0x0537F, 0x20A2C, 0x07070, 0x053CA, 0x053DF,
+	0x20B63, 0x053EB, 0x053F1, 0x05406, 0x0549E, 0x05438, 0x05448, 0x05468,
+	0x054A2, 0x054F6, 0x05510, 0x05553, 0x05563, 0x05584, 0x05584, 0x05599,
+	0x055AB, 0x055B3, 0x055C2, 0x05716, 0x05606, 0x05717, 0x05651, 0x05674,
+	0x05207, 0x058EE, 0x057CE, 0x057F4, 0x0580D, 0x0578B, 0x05832, 0x05831,
+	0x058AC, 0x214E4, 0x058F2, 0x058F7, 0x05906, 0x0591A, 0x05922, 0x05962,
+	0x216A8, 0x216EA, 0x059EC, 0x05A1B, 0x05A27, 0x059D8, 0x05A66, 0x036EE,
+	0x036FC, 0x05B08, 0x05B3E, 0x05B3E, 0x219C8, 0x05BC3, 0x05BD8, 0x05BE7,
+	0x05BF3, 0x21B18, 0x05BFF, 0x05C06, 0x05F53, 0x05C22, 0x03781, 0x05C60,
+	0x05C6E, 0x05CC0, 0x05C8D, 0x21DE4, 0x05D43, 0x21DE6, 0x05D6E, 0x05D6B,
+	0x05D7C, 0x05DE1, 0x05DE2, 0x0382F, 0x05DFD, 0x05E28, 0x05E3D, 0x05E69,
+	0x03862, 0x22183, 0x0387C, 0x05EB0, 0x05EB3, 0x05EB6, 0x05ECA, 0x2A392,
+	0x05EFE, 0x22331, 0x22331, 0x08201, 0x05F22, 0x05F22, 0x038C7, 0x232B8,
+	0x261DA, 0x05F62, 0x05F6B, 0x038E3, 0x05F9A, 0x05FCD, 0x05FD7, 0x05FF9,
+	0x06081, 0x0393A, 0x0391C, 0x06094, 0x226D4, 0x060C7, 0x06148, 0x0614C,
+	0x0614E, 0x0614C, 0x0617A, 0x0618E, 0x061B2, 0x061A4, 0x061AF, 0x061DE,
+	0x061F2, 0x061F6, 0x06210, 0x0621B, 0x0625D, 0x062B1, 0x062D4, 0x06350,
+	0x22B0C, 0x0633D, 0x062FC, 0x06368, 0x06383, 0x063E4, 0x22BF1, 0x06422,
+	0x063C5, 0x063A9, 0x03A2E, 0x06469, 0x0647E, 0x0649D, 0x06477, 0x03A6C,
+	0x0654F, 0x0656C, 0x2300A, 0x065E3, 0x066F8, 0x06649, 0x03B19, 0x06691,
+	0x03B08, 0x03AE4, 0x05192, 0x05195, 0x06700, 0x0669C, 0x080AD, 0x043D9,
+	0x06717, 0x0671B, 0x06721, 0x0675E, 0x06753, 0x233C3, 0x03B49, 0x067FA,
+	0x06785, 0x06852, 0x06885, 0x2346D, 0x0688E, 0x0681F, 0x06914, 0x03B9D,
+	0x06942, 0x069A3, 0x069EA, 0x06AA8, 0x236A3, 0x06ADB, 0x03C18, 0x06B21,
+	0x238A7, 0x06B54, 0x03C4E, 0x06B72, 0x06B9F, 0x06BBA, 0x06BBB, 0x23A8D,
+	0x21D0B, 0x23AFA, 0x06C4E, 0x23CBC, 0x06CBF, 0x06CCD, 0x06C67, 0x06D16,
+	0x06D3E, 0x06D77, 0x06D41, 0x06D69, 0x06D78, 0x06D85, 0x23D1E, 0x06D34,
+	0x06E2F, 0x06E6E, 0x03D33, 0x06ECB, 0x06EC7, 0x23ED1, 0x06DF9, 0x06F6E,
+	0x23F5E, 0x23F8E, 0x06FC6, 0x07039, 0x0701E, 0x0701B, 0x03D96, 0x0704A,
+	0x0707D, 0x07077, 0x070AD, 0x20525, 0x07145, 0x24263, 0x0719C, 0x243AB,
+	0x07228, 0x07235, 0x07250, 0x24608, 0x07280, 0x07295, 0x24735, 0x24814,
+	0x0737A, 0x0738B, 0x03EAC, 0x073A5, 0x03EB8, 0x03EB8, 0x07447, 0x0745C,
+	0x07471, 0x07485, 0x074CA, 0x03F1B, 0x07524, 0x24C36, 0x0753E, 0x24C92,
+	0x07570, 0x2219F, 0x07610, 0x24FA1, 0x24FB8, 0x25044, 0x03FFC, 0x04008,
+	0x076F4, 0x250F3, 0x250F2, 0x25119, 0x25133, 0x0771E, 0x0771F, 0x0771F,
+	0x0774A, 0x04039, 0x0778B, 0x04046, 0x04096, 0x2541D, 0x0784E, 0x0788C,
+	0x078CC, 0x040E3, 0x25626, 0x07956, 0x2569A, 0x256C5, 0x0798F, 0x079EB,
+	0x0412F, 0x07A40, 0x07A4A, 0x07A4F, 0x2597C, 0x25AA7, 0x25AA7, 0x07AEE,
+	0x04202, 0x25BAB, 0x07BC6, 0x07BC9, 0x04227, 0x25C80, 0x07CD2, 0x042A0,
+	0x07CE8, 0x07CE3, 0x07D00, 0x25F86, 0x07D63, 0x04301, 0x07DC7, 0x07E02,
+	0x07E45, 0x04334, 0x26228, 0x26247, 0x04359, 0x262D9, 0x07F7A, 0x2633E,
+	0x07F95, 0x07FFA, 0x08005, 0x264DA, 0x26523, 0x08060, 0x265A8, 0x08070,
+	0x2335F, 0x043D5, 0x080B2, 0x08103, 0x0440B, 0x0813E, 0x05AB5, 0x267A7,
+	0x267B5, 0x23393, 0x2339C, 0x08201, 0x08204, 0x08F9E, 0x0446B, 0x08291,
+	0x0828B, 0x0829D, 0x052B3, 0x082B1, 0x082B3, 0x082BD, 0x082E6, 0x26B3C,
+	0x082E5, 0x0831D, 0x08363, 0x083AD, 0x08323, 0x083BD, 0x083E7, 0x08457,
+	0x08353, 0x083CA, 0x083CC, 0x083DC, 0x26C36, 0x26D6B, 0x26CD5, 0x0452B,
+	0x084F1, 0x084F3, 0x08516, 0x273CA, 0x08564, 0x26F2C, 0x0455D, 0x04561,
+	0x26FB1, 0x270D2, 0x0456B, 0x08650, 0x0865C, 0x08667, 0x08669, 0x086A9,
+	0x08688, 0x0870E, 0x086E2, 0x08779, 0x08728, 0x0876B, 0x08786, 0x045D7,
+	0x087E1, 0x08801, 0x045F9, 0x08860, 0x08863, 0x27667, 0x088D7, 0x088DE,
+	0x04635, 0x088FA, 0x034BB, 0x278AE, 0x27966, 0x046BE, 0x046C7, 0x08AA0,
+	0x08AED, 0x08B8A, 0x08C55, 0x27CA8, 0x08CAB, 0x08CC1, 0x08D1B, 0x08D77,
+	0x27F2F, 0x20804, 0x08DCB, 0x08DBC, 0x08DF0, 0x208DE, 0x08ED4, 0x08F38,
+	0x285D2, 0x285ED, 0x09094, 0x090F1, 0x09111, 0x2872E, 0x0911B, 0x09238,
+	0x092D7, 0x092D8, 0x0927C, 0x093F9, 0x09415, 0x28BFA, 0x0958B, 0x04995,
+	0x095B7, 0x28D77, 0x049E6, 0x096C3, 0x05DB2, 0x09723, 0x29145, 0x2921A,
+	0x04A6E, 0x04A76, 0x097E0, 0x2940A, 0x04AB2, 0x29496, 0x0980B, 0x0980B,
+	0x09829, 0x295B6, 0x098E2, 0x04B33, 0x09929, 0x099A7, 0x099C2, 0x099FE,
+	0x04BCE, 0x29B30, 0x09B12, 0x09C40, 0x09CFD, 0x04CCE, 0x04CED, 0x09D67,
+	0x2A0CE, 0x04CF8, 0x2A105, 0x2A20E, 0x2A291, 0x09EBB, 0x04D56, 0x09EF9,
+	0x09EFE, 0x09F05, 0x09F0F, 0x09F16, 0x09F3B, 0x2A600,
+};
+
+static const nfc_composition nfc_compositions[941] = {
+	{ 0x0003C, 0x00338, 0x0226E },
+	{ 0x0003D, 0x00338, 0x02260 },
+	{ 0x0003E, 0x00338, 0x0226F },
+	{ 0x00041, 0x00300, 0x000C0 },
+	{ 0x00041, 0x00301, 0x000C1 },
+	{ 0x00041, 0x00302, 0x000C2 },
+	{ 0x00041, 0x00303, 0x000C3 },
+	{ 0x00041, 0x00304, 0x00100 },
+	{ 0x00041, 0x00306, 0x00102 },
+	{ 0x00041, 0x00307, 0x00226 },
+	{ 0x00041, 0x00308, 0x000C4 },
+	{ 0x00041, 0x00309, 0x01EA2 },
+	{ 0x00041, 0x0030A, 0x000C5 },
+	{ 0x00041, 0x0030C, 0x001CD },
+	{ 0x00041, 0x0030F, 0x00200 },
+	{ 0x00041, 0x00311, 0x00202 },
+	{ 0x00041, 0x00323, 0x01EA0 },
+	{ 0x00041, 0x00325, 0x01E00 },
+	{ 0x00041, 0x00328, 0x00104 },
+	{ 0x00042, 0x00307, 0x01E02 },
+	{ 0x00042, 0x00323, 0x01E04 },
+	{ 0x00042, 0x00331, 0x01E06 },
+	{ 0x00043, 0x00301, 0x00106 },
+	{ 0x00043, 0x00302, 0x00108 },
+	{ 0x00043, 0x00307, 0x0010A },
+	{ 0x00043, 0x0030C, 0x0010C },
+	{ 0x00043, 0x00327, 0x000C7 },
+	{ 0x00044, 0x00307, 0x01E0A },
+	{ 0x00044, 0x0030C, 0x0010E },
+	{ 0x00044, 0x00323, 0x01E0C },
+	{ 0x00044, 0x00327, 0x01E10 },
+	{ 0x00044, 0x0032D, 0x01E12 },
+	{ 0x00044, 0x00331, 0x01E0E },
+	{ 0x00045, 0x00300, 0x000C8 },
+	{ 0x00045, 0x00301, 0x000C9 },
+	{ 0x00045, 0x00302, 0x000CA },
+	{ 0x00045, 0x00303, 0x01EBC },
+	{ 0x00045, 0x00304, 0x00112 },
+	{ 0x00045, 0x00306, 0x00114 },
+	{ 0x00045, 0x00307, 0x00116 },
+	{ 0x00045, 0x00308, 0x000CB },
+	{ 0x00045, 0x00309, 0x01EBA },
+	{ 0x00045, 0x0030C, 0x0011A },
+	{ 0x00045, 0x0030F, 0x00204 },
+	{ 0x00045, 0x00311, 0x00206 },
+	{ 0x00045, 0x00323, 0x01EB8 },
+	{ 0x00045, 0x00327, 0x00228 },
+	{ 0x00045, 0x00328, 0x00118 },
+	{ 0x00045, 0x0032D, 0x01E18 },
+	{ 0x00045, 0x00330, 0x01E1A },
+	{ 0x00046, 0x00307, 0x01E1E },
+	{ 0x00047, 0x00301, 0x001F4 },
+	{ 0x00047, 0x00302, 0x0011C },
+	{ 0x00047, 0x00304, 0x01E20 },
+	{ 0x00047, 0x00306, 0x0011E },
+	{ 0x00047, 0x00307, 0x00120 },
+	{ 0x00047, 0x0030C, 0x001E6 },
+	{ 0x00047, 0x00327, 0x00122 },
+	{ 0x00048, 0x00302, 0x00124 },
+	{ 0x00048, 0x00307, 0x01E22 },
+	{ 0x00048, 0x00308, 0x01E26 },
+	{ 0x00048, 0x0030C, 0x0021E },
+	{ 0x00048, 0x00323, 0x01E24 },
+	{ 0x00048, 0x00327, 0x01E28 },
+	{ 0x00048, 0x0032E, 0x01E2A },
+	{ 0x00049, 0x00300, 0x000CC },
+	{ 0x00049, 0x00301, 0x000CD },
+	{ 0x00049, 0x00302, 0x000CE },
+	{ 0x00049, 0x00303, 0x00128 },
+	{ 0x00049, 0x00304, 0x0012A },
+	{ 0x00049, 0x00306, 0x0012C },
+	{ 0x00049, 0x00307, 0x00130 },
+	{ 0x00049, 0x00308, 0x000CF },
+	{ 0x00049, 0x00309, 0x01EC8 },
+	{ 0x00049, 0x0030C, 0x001CF },
+	{ 0x00049, 0x0030F, 0x00208 },
+	{ 0x00049, 0x00311, 0x0020A },
+	{ 0x00049, 0x00323, 0x01ECA },
+	{ 0x00049, 0x00328, 0x0012E },
+	{ 0x00049, 0x00330, 0x01E2C },
+	{ 0x0004A, 0x00302, 0x00134 },
+	{ 0x0004B, 0x00301, 0x01E30 },
+	{ 0x0004B, 0x0030C, 0x001E8 },
+	{ 0x0004B, 0x00323, 0x01E32 },
+	{ 0x0004B, 0x00327, 0x00136 },
+	{ 0x0004B, 0x00331, 0x01E34 },
+	{ 0x0004C, 0x00301, 0x00139 },
+	{ 0x0004C, 0x0030C, 0x0013D },
+	{ 0x0004C, 0x00323, 0x01E36 },
+	{ 0x0004C, 0x00327, 0x0013B },
+	{ 0x0004C, 0x0032D, 0x01E3C },
+	{ 0x0004C, 0x00331, 0x01E3A },
+	{ 0x0004D, 0x00301, 0x01E3E },
+	{ 0x0004D, 0x00307, 0x01E40 },
+	{ 0x0004D, 0x00323, 0x01E42 },
+	{ 0x0004E, 0x00300, 0x001F8 },
+	{ 0x0004E, 0x00301, 0x00143 },
+	{ 0x0004E, 0x00303, 0x000D1 },
+	{ 0x0004E, 0x00307, 0x01E44 },
+	{ 0x0004E, 0x0030C, 0x00147 },
+	{ 0x0004E, 0x00323, 0x01E46 },
+	{ 0x0004E, 0x00327, 0x00145 },
+	{ 0x0004E, 0x0032D, 0x01E4A },
+	{ 0x0004E, 0x00331, 0x01E48 },
+	{ 0x0004F, 0x00300, 0x000D2 },
+	{ 0x0004F, 0x00301, 0x000D3 },
+	{ 0x0004F, 0x00302, 0x000D4 },
+	{ 0x0004F, 0x00303, 0x000D5 },
+	{ 0x0004F, 0x00304, 0x0014C },
+	{ 0x0004F, 0x00306, 0x0014E },
+	{ 0x0004F, 0x00307, 0x0022E },
+	{ 0x0004F, 0x00308, 0x000D6 },
+	{ 0x0004F, 0x00309, 0x01ECE },
+	{ 0x0004F, 0x0030B, 0x00150 },
+	{ 0x0004F, 0x0030C, 0x001D1 },
+	{ 0x0004F, 0x0030F, 0x0020C },
+	{ 0x0004F, 0x00311, 0x0020E },
+	{ 0x0004F, 0x0031B, 0x001A0 },
+	{ 0x0004F, 0x00323, 0x01ECC },
+	{ 0x0004F, 0x00328, 0x001EA },
+	{ 0x00050, 0x00301, 0x01E54 },
+	{ 0x00050, 0x00307, 0x01E56 },
+	{ 0x00052, 0x00301, 0x00154 },
+	{ 0x00052, 0x00307, 0x01E58 },
+	{ 0x00052, 0x0030C, 0x00158 },
+	{ 0x00052, 0x0030F, 0x00210 },
+	{ 0x00052, 0x00311, 0x00212 },
+	{ 0x00052, 0x00323, 0x01E5A },
+	{ 0x00052, 0x00327, 0x00156 },
+	{ 0x00052, 0x00331, 0x01E5E },
+	{ 0x00053, 0x00301, 0x0015A },
+	{ 0x00053, 0x00302, 0x0015C },
+	{ 0x00053, 0x00307, 0x01E60 },
+	{ 0x00053, 0x0030C, 0x00160 },
+	{ 0x00053, 0x00323, 0x01E62 },
+	{ 0x00053, 0x00326, 0x00218 },
+	{ 0x00053, 0x00327, 0x0015E },
+	{ 0x00054, 0x00307, 0x01E6A },
+	{ 0x00054, 0x0030C, 0x00164 },
+	{ 0x00054, 0x00323, 0x01E6C },
+	{ 0x00054, 0x00326, 0x0021A },
+	{ 0x00054, 0x00327, 0x00162 },
+	{ 0x00054, 0x0032D, 0x01E70 },
+	{ 0x00054, 0x00331, 0x01E6E },
+	{ 0x00055, 0x00300, 0x000D9 },
+	{ 0x00055, 0x00301, 0x000DA },
+	{ 0x00055, 0x00302, 0x000DB },
+	{ 0x00055, 0x00303, 0x00168 },
+	{ 0x00055, 0x00304, 0x0016A },
+	{ 0x00055, 0x00306, 0x0016C },
+	{ 0x00055, 0x00308, 0x000DC },
+	{ 0x00055, 0x00309, 0x01EE6 },
+	{ 0x00055, 0x0030A, 0x0016E },
+	{ 0x00055, 0x0030B, 0x00170 },
+	{ 0x00055, 0x0030C, 0x001D3 },
+	{ 0x00055, 0x0030F, 0x00214 },
+	{ 0x00055, 0x00311, 0x00216 },
+	{ 0x00055, 0x0031B, 0x001AF },
+	{ 0x00055, 0x00323, 0x01EE4 },
+	{ 0x00055, 0x00324, 0x01E72 },
+	{ 0x00055, 0x00328, 0x00172 },
+	{ 0x00055, 0x0032D, 0x01E76 },
+	{ 0x00055, 0x00330, 0x01E74 },
+	{ 0x00056, 0x00303, 0x01E7C },
+	{ 0x00056, 0x00323, 0x01E7E },
+	{ 0x00057, 0x00300, 0x01E80 },
+	{ 0x00057, 0x00301, 0x01E82 },
+	{ 0x00057, 0x00302, 0x00174 },
+	{ 0x00057, 0x00307, 0x01E86 },
+	{ 0x00057, 0x00308, 0x01E84 },
+	{ 0x00057, 0x00323, 0x01E88 },
+	{ 0x00058, 0x00307, 0x01E8A },
+	{ 0x00058, 0x00308, 0x01E8C },
+	{ 0x00059, 0x00300, 0x01EF2 },
+	{ 0x00059, 0x00301, 0x000DD },
+	{ 0x00059, 0x00302, 0x00176 },
+	{ 0x00059, 0x00303, 0x01EF8 },
+	{ 0x00059, 0x00304, 0x00232 },
+	{ 0x00059, 0x00307, 0x01E8E },
+	{ 0x00059, 0x00308, 0x00178 },
+	{ 0x00059, 0x00309, 0x01EF6 },
+	{ 0x00059, 0x00323, 0x01EF4 },
+	{ 0x0005A, 0x00301, 0x00179 },
+	{ 0x0005A, 0x00302, 0x01E90 },
+	{ 0x0005A, 0x00307, 0x0017B },
+	{ 0x0005A, 0x0030C, 0x0017D },
+	{ 0x0005A, 0x00323, 0x01E92 },
+	{ 0x0005A, 0x00331, 0x01E94 },
+	{ 0x00061, 0x00300, 0x000E0 },
+	{ 0x00061, 0x00301, 0x000E1 },
+	{ 0x00061, 0x00302, 0x000E2 },
+	{ 0x00061, 0x00303, 0x000E3 },
+	{ 0x00061, 0x00304, 0x00101 },
+	{ 0x00061, 0x00306, 0x00103 },
+	{ 0x00061, 0x00307, 0x00227 },
+	{ 0x00061, 0x00308, 0x000E4 },
+	{ 0x00061, 0x00309, 0x01EA3 },
+	{ 0x00061, 0x0030A, 0x000E5 },
+	{ 0x00061, 0x0030C, 0x001CE },
+	{ 0x00061, 0x0030F, 0x00201 },
+	{ 0x00061, 0x00311, 0x00203 },
+	{ 0x00061, 0x00323, 0x01EA1 },
+	{ 0x00061, 0x00325, 0x01E01 },
+	{ 0x00061, 0x00328, 0x00105 },
+	{ 0x00062, 0x00307, 0x01E03 },
+	{ 0x00062, 0x00323, 0x01E05 },
+	{ 0x00062, 0x00331, 0x01E07 },
+	{ 0x00063, 0x00301, 0x00107 },
+	{ 0x00063, 0x00302, 0x00109 },
+	{ 0x00063, 0x00307, 0x0010B },
+	{ 0x00063, 0x0030C, 0x0010D },
+	{ 0x00063, 0x00327, 0x000E7 },
+	{ 0x00064, 0x00307, 0x01E0B },
+	{ 0x00064, 0x0030C, 0x0010F },
+	{ 0x00064, 0x00323, 0x01E0D },
+	{ 0x00064, 0x00327, 0x01E11 },
+	{ 0x00064, 0x0032D, 0x01E13 },
+	{ 0x00064, 0x00331, 0x01E0F },
+	{ 0x00065, 0x00300, 0x000E8 },
+	{ 0x00065, 0x00301, 0x000E9 },
+	{ 0x00065, 0x00302, 0x000EA },
+	{ 0x00065, 0x00303, 0x01EBD },
+	{ 0x00065, 0x00304, 0x00113 },
+	{ 0x00065, 0x00306, 0x00115 },
+	{ 0x00065, 0x00307, 0x00117 },
+	{ 0x00065, 0x00308, 0x000EB },
+	{ 0x00065, 0x00309, 0x01EBB },
+	{ 0x00065, 0x0030C, 0x0011B },
+	{ 0x00065, 0x0030F, 0x00205 },
+	{ 0x00065, 0x00311, 0x00207 },
+	{ 0x00065, 0x00323, 0x01EB9 },
+	{ 0x00065, 0x00327, 0x00229 },
+	{ 0x00065, 0x00328, 0x00119 },
+	{ 0x00065, 0x0032D, 0x01E19 },
+	{ 0x00065, 0x00330, 0x01E1B },
+	{ 0x00066, 0x00307, 0x01E1F },
+	{ 0x00067, 0x00301, 0x001F5 },
+	{ 0x00067, 0x00302, 0x0011D },
+	{ 0x00067, 0x00304, 0x01E21 },
+	{ 0x00067, 0x00306, 0x0011F },
+	{ 0x00067, 0x00307, 0x00121 },
+	{ 0x00067, 0x0030C, 0x001E7 },
+	{ 0x00067, 0x00327, 0x00123 },
+	{ 0x00068, 0x00302, 0x00125 },
+	{ 0x00068, 0x00307, 0x01E23 },
+	{ 0x00068, 0x00308, 0x01E27 },
+	{ 0x00068, 0x0030C, 0x0021F },
+	{ 0x00068, 0x00323, 0x01E25 },
+	{ 0x00068, 0x00327, 0x01E29 },
+	{ 0x00068, 0x0032E, 0x01E2B },
+	{ 0x00068, 0x00331, 0x01E96 },
+	{ 0x00069, 0x00300, 0x000EC },
+	{ 0x00069, 0x00301, 0x000ED },
+	{ 0x00069, 0x00302, 0x000EE },
+	{ 0x00069, 0x00303, 0x00129 },
+	{ 0x00069, 0x00304, 0x0012B },
+	{ 0x00069, 0x00306, 0x0012D },
+	{ 0x00069, 0x00308, 0x000EF },
+	{ 0x00069, 0x00309, 0x01EC9 },
+	{ 0x00069, 0x0030C, 0x001D0 },
+	{ 0x00069, 0x0030F, 0x00209 },
+	{ 0x00069, 0x00311, 0x0020B },
+	{ 0x00069, 0x00323, 0x01ECB },
+	{ 0x00069, 0x00328, 0x0012F },
+	{ 0x00069, 0x00330, 0x01E2D },
+	{ 0x0006A, 0x00302, 0x00135 },
+	{ 0x0006A, 0x0030C, 0x001F0 },
+	{ 0x0006B, 0x00301, 0x01E31 },
+	{ 0x0006B, 0x0030C, 0x001E9 },
+	{ 0x0006B, 0x00323, 0x01E33 },
+	{ 0x0006B, 0x00327, 0x00137 },
+	{ 0x0006B, 0x00331, 0x01E35 },
+	{ 0x0006C, 0x00301, 0x0013A },
+	{ 0x0006C, 0x0030C, 0x0013E },
+	{ 0x0006C, 0x00323, 0x01E37 },
+	{ 0x0006C, 0x00327, 0x0013C },
+	{ 0x0006C, 0x0032D, 0x01E3D },
+	{ 0x0006C, 0x00331, 0x01E3B },
+	{ 0x0006D, 0x00301, 0x01E3F },
+	{ 0x0006D, 0x00307, 0x01E41 },
+	{ 0x0006D, 0x00323, 0x01E43 },
+	{ 0x0006E, 0x00300, 0x001F9 },
+	{ 0x0006E, 0x00301, 0x00144 },
+	{ 0x0006E, 0x00303, 0x000F1 },
+	{ 0x0006E, 0x00307, 0x01E45 },
+	{ 0x0006E, 0x0030C, 0x00148 },
+	{ 0x0006E, 0x00323, 0x01E47 },
+	{ 0x0006E, 0x00327, 0x00146 },
+	{ 0x0006E, 0x0032D, 0x01E4B },
+	{ 0x0006E, 0x00331, 0x01E49 },
+	{ 0x0006F, 0x00300, 0x000F2 },
+	{ 0x0006F, 0x00301, 0x000F3 },
+	{ 0x0006F, 0x00302, 0x000F4 },
+	{ 0x0006F, 0x00303, 0x000F5 },
+	{ 0x0006F, 0x00304, 0x0014D },
+	{ 0x0006F, 0x00306, 0x0014F },
+	{ 0x0006F, 0x00307, 0x0022F },
+	{ 0x0006F, 0x00308, 0x000F6 },
+	{ 0x0006F, 0x00309, 0x01ECF },
+	{ 0x0006F, 0x0030B, 0x00151 },
+	{ 0x0006F, 0x0030C, 0x001D2 },
+	{ 0x0006F, 0x0030F, 0x0020D },
+	{ 0x0006F, 0x00311, 0x0020F },
+	{ 0x0006F, 0x0031B, 0x001A1 },
+	{ 0x0006F, 0x00323, 0x01ECD },
+	{ 0x0006F, 0x00328, 0x001EB },
+	{ 0x00070, 0x00301, 0x01E55 },
+	{ 0x00070, 0x00307, 0x01E57 },
+	{ 0x00072, 0x00301, 0x00155 },
+	{ 0x00072, 0x00307, 0x01E59 },
+	{ 0x00072, 0x0030C, 0x00159 },
+	{ 0x00072, 0x0030F, 0x00211 },
+	{ 0x00072, 0x00311, 0x00213 },
+	{ 0x00072, 0x00323, 0x01E5B },
+	{ 0x00072, 0x00327, 0x00157 },
+	{ 0x00072, 0x00331, 0x01E5F },
+	{ 0x00073, 0x00301, 0x0015B },
+	{ 0x00073, 0x00302, 0x0015D },
+	{ 0x00073, 0x00307, 0x01E61 },
+	{ 0x00073, 0x0030C, 0x00161 },
+	{ 0x00073, 0x00323, 0x01E63 },
+	{ 0x00073, 0x00326, 0x00219 },
+	{ 0x00073, 0x00327, 0x0015F },
+	{ 0x00074, 0x00307, 0x01E6B },
+	{ 0x00074, 0x00308, 0x01E97 },
+	{ 0x00074, 0x0030C, 0x00165 },
+	{ 0x00074, 0x00323, 0x01E6D },
+	{ 0x00074, 0x00326, 0x0021B },
+	{ 0x00074, 0x00327, 0x00163 },
+	{ 0x00074, 0x0032D, 0x01E71 },
+	{ 0x00074, 0x00331, 0x01E6F },
+	{ 0x00075, 0x00300, 0x000F9 },
+	{ 0x00075, 0x00301, 0x000FA },
+	{ 0x00075, 0x00302, 0x000FB },
+	{ 0x00075, 0x00303, 0x00169 },
+	{ 0x00075, 0x00304, 0x0016B },
+	{ 0x00075, 0x00306, 0x0016D },
+	{ 0x00075, 0x00308, 0x000FC },
+	{ 0x00075, 0x00309, 0x01EE7 },
+	{ 0x00075, 0x0030A, 0x0016F },
+	{ 0x00075, 0x0030B, 0x00171 },
+	{ 0x00075, 0x0030C, 0x001D4 },
+	{ 0x00075, 0x0030F, 0x00215 },
+	{ 0x00075, 0x00311, 0x00217 },
+	{ 0x00075, 0x0031B, 0x001B0 },
+	{ 0x00075, 0x00323, 0x01EE5 },
+	{ 0x00075, 0x00324, 0x01E73 },
+	{ 0x00075, 0x00328, 0x00173 },
+	{ 0x00075, 0x0032D, 0x01E77 },
+	{ 0x00075, 0x00330, 0x01E75 },
+	{ 0x00076, 0x00303, 0x01E7D },
+	{ 0x00076, 0x00323, 0x01E7F },
+	{ 0x00077, 0x00300, 0x01E81 },
+	{ 0x00077, 0x00301, 0x01E83 },
+	{ 0x00077, 0x00302, 0x00175 },
+	{ 0x00077, 0x00307, 0x01E87 },
+	{ 0x00077, 0x00308, 0x01E85 },
+	{ 0x00077, 0x0030A, 0x01E98 },
+	{ 0x00077, 0x00323, 0x01E89 },
+	{ 0x00078, 0x00307, 0x01E8B },
+	{ 0x00078, 0x00308, 0x01E8D },
+	{ 0x00079, 0x00300, 0x01EF3 },
+	{ 0x00079, 0x00301, 0x000FD },
+	{ 0x00079, 0x00302, 0x00177 },
+	{ 0x00079, 0x00303, 0x01EF9 },
+	{ 0x00079, 0x00304, 0x00233 },
+	{ 0x00079, 0x00307, 0x01E8F },
+	{ 0x00079, 0x00308, 0x000FF },
+	{ 0x00079, 0x00309, 0x01EF7 },
+	{ 0x00079, 0x0030A, 0x01E99 },
+	{ 0x00079, 0x00323, 0x01EF5 },
+	{ 0x0007A, 0x00301, 0x0017A },
+	{ 0x0007A, 0x00302, 0x01E91 },
+	{ 0x0007A, 0x00307, 0x0017C },
+	{ 0x0007A, 0x0030C, 0x0017E },
+	{ 0x0007A, 0x00323, 0x01E93 },
+	{ 0x0007A, 0x00331, 0x01E95 },
+	{ 0x000A8, 0x00300, 0x01FED },
+	{ 0x000A8, 0x00301, 0x00385 },
+	{ 0x000A8, 0x00342, 0x01FC1 },
+	{ 0x000C2, 0x00300, 0x01EA6 },
+	{ 0x000C2, 0x00301, 0x01EA4 },
+	{ 0x000C2, 0x00303, 0x01EAA },
+	{ 0x000C2, 0x00309, 0x01EA8 },
+	{ 0x000C4, 0x00304, 0x001DE },
+	{ 0x000C5, 0x00301, 0x001FA },
+	{ 0x000C6, 0x00301, 0x001FC },
+	{ 0x000C6, 0x00304, 0x001E2 },
+	{ 0x000C7, 0x00301, 0x01E08 },
+	{ 0x000CA, 0x00300, 0x01EC0 },
+	{ 0x000CA, 0x00301, 0x01EBE },
+	{ 0x000CA, 0x00303, 0x01EC4 },
+	{ 0x000CA, 0x00309, 0x01EC2 },
+	{ 0x000CF, 0x00301, 0x01E2E },
+	{ 0x000D4, 0x00300, 0x01ED2 },
+	{ 0x000D4, 0x00301, 0x01ED0 },
+	{ 0x000D4, 0x00303, 0x01ED6 },
+	{ 0x000D4, 0x00309, 0x01ED4 },
+	{ 0x000D5, 0x00301, 0x01E4C },
+	{ 0x000D5, 0x00304, 0x0022C },
+	{ 0x000D5, 0x00308, 0x01E4E },
+	{ 0x000D6, 0x00304, 0x0022A },
+	{ 0x000D8, 0x00301, 0x001FE },
+	{ 0x000DC, 0x00300, 0x001DB },
+	{ 0x000DC, 0x00301, 0x001D7 },
+	{ 0x000DC, 0x00304, 0x001D5 },
+	{ 0x000DC, 0x0030C, 0x001D9 },
+	{ 0x000E2, 0x00300, 0x01EA7 },
+	{ 0x000E2, 0x00301, 0x01EA5 },
+	{ 0x000E2, 0x00303, 0x01EAB },
+	{ 0x000E2, 0x00309, 0x01EA9 },
+	{ 0x000E4, 0x00304, 0x001DF },
+	{ 0x000E5, 0x00301, 0x001FB },
+	{ 0x000E6, 0x00301, 0x001FD },
+	{ 0x000E6, 0x00304, 0x001E3 },
+	{ 0x000E7, 0x00301, 0x01E09 },
+	{ 0x000EA, 0x00300, 0x01EC1 },
+	{ 0x000EA, 0x00301, 0x01EBF },
+	{ 0x000EA, 0x00303, 0x01EC5 },
+	{ 0x000EA, 0x00309, 0x01EC3 },
+	{ 0x000EF, 0x00301, 0x01E2F },
+	{ 0x000F4, 0x00300, 0x01ED3 },
+	{ 0x000F4, 0x00301, 0x01ED1 },
+	{ 0x000F4, 0x00303, 0x01ED7 },
+	{ 0x000F4, 0x00309, 0x01ED5 },
+	{ 0x000F5, 0x00301, 0x01E4D },
+	{ 0x000F5, 0x00304, 0x0022D },
+	{ 0x000F5, 0x00308, 0x01E4F },
+	{ 0x000F6, 0x00304, 0x0022B },
+	{ 0x000F8, 0x00301, 0x001FF },
+	{ 0x000FC, 0x00300, 0x001DC },
+	{ 0x000FC, 0x00301, 0x001D8 },
+	{ 0x000FC, 0x00304, 0x001D6 },
+	{ 0x000FC, 0x0030C, 0x001DA },
+	{ 0x00102, 0x00300, 0x01EB0 },
+	{ 0x00102, 0x00301, 0x01EAE },
+	{ 0x00102, 0x00303, 0x01EB4 },
+	{ 0x00102, 0x00309, 0x01EB2 },
+	{ 0x00103, 0x00300, 0x01EB1 },
+	{ 0x00103, 0x00301, 0x01EAF },
+	{ 0x00103, 0x00303, 0x01EB5 },
+	{ 0x00103, 0x00309, 0x01EB3 },
+	{ 0x00112, 0x00300, 0x01E14 },
+	{ 0x00112, 0x00301, 0x01E16 },
+	{ 0x00113, 0x00300, 0x01E15 },
+	{ 0x00113, 0x00301, 0x01E17 },
+	{ 0x0014C, 0x00300, 0x01E50 },
+	{ 0x0014C, 0x00301, 0x01E52 },
+	{ 0x0014D, 0x00300, 0x01E51 },
+	{ 0x0014D, 0x00301, 0x01E53 },
+	{ 0x0015A, 0x00307, 0x01E64 },
+	{ 0x0015B, 0x00307, 0x01E65 },
+	{ 0x00160, 0x00307, 0x01E66 },
+	{ 0x00161, 0x00307, 0x01E67 },
+	{ 0x00168, 0x00301, 0x01E78 },
+	{ 0x00169, 0x00301, 0x01E79 },
+	{ 0x0016A, 0x00308, 0x01E7A },
+	{ 0x0016B, 0x00308, 0x01E7B },
+	{ 0x0017F, 0x00307, 0x01E9B },
+	{ 0x001A0, 0x00300, 0x01EDC },
+	{ 0x001A0, 0x00301, 0x01EDA },
+	{ 0x001A0, 0x00303, 0x01EE0 },
+	{ 0x001A0, 0x00309, 0x01EDE },
+	{ 0x001A0, 0x00323, 0x01EE2 },
+	{ 0x001A1, 0x00300, 0x01EDD },
+	{ 0x001A1, 0x00301, 0x01EDB },
+	{ 0x001A1, 0x00303, 0x01EE1 },
+	{ 0x001A1, 0x00309, 0x01EDF },
+	{ 0x001A1, 0x00323, 0x01EE3 },
+	{ 0x001AF, 0x00300, 0x01EEA },
+	{ 0x001AF, 0x00301, 0x01EE8 },
+	{ 0x001AF, 0x00303, 0x01EEE },
+	{ 0x001AF, 0x00309, 0x01EEC },
+	{ 0x001AF, 0x00323, 0x01EF0 },
+	{ 0x001B0, 0x00300, 0x01EEB },
+	{ 0x001B0, 0x00301, 0x01EE9 },
+	{ 0x001B0, 0x00303, 0x01EEF },
+	{ 0x001B0, 0x00309, 0x01EED },
+	{ 0x001B0, 0x00323, 0x01EF1 },
+	{ 0x001B7, 0x0030C, 0x001EE },
+	{ 0x001EA, 0x00304, 0x001EC },
+	{ 0x001EB, 0x00304, 0x001ED },
+	{ 0x00226, 0x00304, 0x001E0 },
+	{ 0x00227, 0x00304, 0x001E1 },
+	{ 0x00228, 0x00306, 0x01E1C },
+	{ 0x00229, 0x00306, 0x01E1D },
+	{ 0x0022E, 0x00304, 0x00230 },
+	{ 0x0022F, 0x00304, 0x00231 },
+	{ 0x00292, 0x0030C, 0x001EF },
+	{ 0x00391, 0x00300, 0x01FBA },
+	{ 0x00391, 0x00301, 0x00386 },
+	{ 0x00391, 0x00304, 0x01FB9 },
+	{ 0x00391, 0x00306, 0x01FB8 },
+	{ 0x00391, 0x00313, 0x01F08 },
+	{ 0x00391, 0x00314, 0x01F09 },
+	{ 0x00391, 0x00345, 0x01FBC },
+	{ 0x00395, 0x00300, 0x01FC8 },
+	{ 0x00395, 0x00301, 0x00388 },
+	{ 0x00395, 0x00313, 0x01F18 },
+	{ 0x00395, 0x00314, 0x01F19 },
+	{ 0x00397, 0x00300, 0x01FCA },
+	{ 0x00397, 0x00301, 0x00389 },
+	{ 0x00397, 0x00313, 0x01F28 },
+	{ 0x00397, 0x00314, 0x01F29 },
+	{ 0x00397, 0x00345, 0x01FCC },
+	{ 0x00399, 0x00300, 0x01FDA },
+	{ 0x00399, 0x00301, 0x0038A },
+	{ 0x00399, 0x00304, 0x01FD9 },
+	{ 0x00399, 0x00306, 0x01FD8 },
+	{ 0x00399, 0x00308, 0x003AA },
+	{ 0x00399, 0x00313, 0x01F38 },
+	{ 0x00399, 0x00314, 0x01F39 },
+	{ 0x0039F, 0x00300, 0x01FF8 },
+	{ 0x0039F, 0x00301, 0x0038C },
+	{ 0x0039F, 0x00313, 0x01F48 },
+	{ 0x0039F, 0x00314, 0x01F49 },
+	{ 0x003A1, 0x00314, 0x01FEC },
+	{ 0x003A5, 0x00300, 0x01FEA },
+	{ 0x003A5, 0x00301, 0x0038E },
+	{ 0x003A5, 0x00304, 0x01FE9 },
+	{ 0x003A5, 0x00306, 0x01FE8 },
+	{ 0x003A5, 0x00308, 0x003AB },
+	{ 0x003A5, 0x00314, 0x01F59 },
+	{ 0x003A9, 0x00300, 0x01FFA },
+	{ 0x003A9, 0x00301, 0x0038F },
+	{ 0x003A9, 0x00313, 0x01F68 },
+	{ 0x003A9, 0x00314, 0x01F69 },
+	{ 0x003A9, 0x00345, 0x01FFC },
+	{ 0x003AC, 0x00345, 0x01FB4 },
+	{ 0x003AE, 0x00345, 0x01FC4 },
+	{ 0x003B1, 0x00300, 0x01F70 },
+	{ 0x003B1, 0x00301, 0x003AC },
+	{ 0x003B1, 0x00304, 0x01FB1 },
+	{ 0x003B1, 0x00306, 0x01FB0 },
+	{ 0x003B1, 0x00313, 0x01F00 },
+	{ 0x003B1, 0x00314, 0x01F01 },
+	{ 0x003B1, 0x00342, 0x01FB6 },
+	{ 0x003B1, 0x00345, 0x01FB3 },
+	{ 0x003B5, 0x00300, 0x01F72 },
+	{ 0x003B5, 0x00301, 0x003AD },
+	{ 0x003B5, 0x00313, 0x01F10 },
+	{ 0x003B5, 0x00314, 0x01F11 },
+	{ 0x003B7, 0x00300, 0x01F74 },
+	{ 0x003B7, 0x00301, 0x003AE },
+	{ 0x003B7, 0x00313, 0x01F20 },
+	{ 0x003B7, 0x00314, 0x01F21 },
+	{ 0x003B7, 0x00342, 0x01FC6 },
+	{ 0x003B7, 0x00345, 0x01FC3 },
+	{ 0x003B9, 0x00300, 0x01F76 },
+	{ 0x003B9, 0x00301, 0x003AF },
+	{ 0x003B9, 0x00304, 0x01FD1 },
+	{ 0x003B9, 0x00306, 0x01FD0 },
+	{ 0x003B9, 0x00308, 0x003CA },
+	{ 0x003B9, 0x00313, 0x01F30 },
+	{ 0x003B9, 0x00314, 0x01F31 },
+	{ 0x003B9, 0x00342, 0x01FD6 },
+	{ 0x003BF, 0x00300, 0x01F78 },
+	{ 0x003BF, 0x00301, 0x003CC },
+	{ 0x003BF, 0x00313, 0x01F40 },
+	{ 0x003BF, 0x00314, 0x01F41 },
+	{ 0x003C1, 0x00313, 0x01FE4 },
+	{ 0x003C1, 0x00314, 0x01FE5 },
+	{ 0x003C5, 0x00300, 0x01F7A },
+	{ 0x003C5, 0x00301, 0x003CD },
+	{ 0x003C5, 0x00304, 0x01FE1 },
+	{ 0x003C5, 0x00306, 0x01FE0 },
+	{ 0x003C5, 0x00308, 0x003CB },
+	{ 0x003C5, 0x00313, 0x01F50 },
+	{ 0x003C5, 0x00314, 0x01F51 },
+	{ 0x003C5, 0x00342, 0x01FE6 },
+	{ 0x003C9, 0x00300, 0x01F7C },
+	{ 0x003C9, 0x00301, 0x003CE },
+	{ 0x003C9, 0x00313, 0x01F60 },
+	{ 0x003C9, 0x00314, 0x01F61 },
+	{ 0x003C9, 0x00342, 0x01FF6 },
+	{ 0x003C9, 0x00345, 0x01FF3 },
+	{ 0x003CA, 0x00300, 0x01FD2 },
+	{ 0x003CA, 0x00301, 0x00390 },
+	{ 0x003CA, 0x00342, 0x01FD7 },
+	{ 0x003CB, 0x00300, 0x01FE2 },
+	{ 0x003CB, 0x00301, 0x003B0 },
+	{ 0x003CB, 0x00342, 0x01FE7 },
+	{ 0x003CE, 0x00345, 0x01FF4 },
+	{ 0x003D2, 0x00301, 0x003D3 },
+	{ 0x003D2, 0x00308, 0x003D4 },
+	{ 0x00406, 0x00308, 0x00407 },
+	{ 0x00410, 0x00306, 0x004D0 },
+	{ 0x00410, 0x00308, 0x004D2 },
+	{ 0x00413, 0x00301, 0x00403 },
+	{ 0x00415, 0x00300, 0x00400 },
+	{ 0x00415, 0x00306, 0x004D6 },
+	{ 0x00415, 0x00308, 0x00401 },
+	{ 0x00416, 0x00306, 0x004C1 },
+	{ 0x00416, 0x00308, 0x004DC },
+	{ 0x00417, 0x00308, 0x004DE },
+	{ 0x00418, 0x00300, 0x0040D },
+	{ 0x00418, 0x00304, 0x004E2 },
+	{ 0x00418, 0x00306, 0x00419 },
+	{ 0x00418, 0x00308, 0x004E4 },
+	{ 0x0041A, 0x00301, 0x0040C },
+	{ 0x0041E, 0x00308, 0x004E6 },
+	{ 0x00423, 0x00304, 0x004EE },
+	{ 0x00423, 0x00306, 0x0040E },
+	{ 0x00423, 0x00308, 0x004F0 },
+	{ 0x00423, 0x0030B, 0x004F2 },
+	{ 0x00427, 0x00308, 0x004F4 },
+	{ 0x0042B, 0x00308, 0x004F8 },
+	{ 0x0042D, 0x00308, 0x004EC },
+	{ 0x00430, 0x00306, 0x004D1 },
+	{ 0x00430, 0x00308, 0x004D3 },
+	{ 0x00433, 0x00301, 0x00453 },
+	{ 0x00435, 0x00300, 0x00450 },
+	{ 0x00435, 0x00306, 0x004D7 },
+	{ 0x00435, 0x00308, 0x00451 },
+	{ 0x00436, 0x00306, 0x004C2 },
+	{ 0x00436, 0x00308, 0x004DD },
+	{ 0x00437, 0x00308, 0x004DF },
+	{ 0x00438, 0x00300, 0x0045D },
+	{ 0x00438, 0x00304, 0x004E3 },
+	{ 0x00438, 0x00306, 0x00439 },
+	{ 0x00438, 0x00308, 0x004E5 },
+	{ 0x0043A, 0x00301, 0x0045C },
+	{ 0x0043E, 0x00308, 0x004E7 },
+	{ 0x00443, 0x00304, 0x004EF },
+	{ 0x00443, 0x00306, 0x0045E },
+	{ 0x00443, 0x00308, 0x004F1 },
+	{ 0x00443, 0x0030B, 0x004F3 },
+	{ 0x00447, 0x00308, 0x004F5 },
+	{ 0x0044B, 0x00308, 0x004F9 },
+	{ 0x0044D, 0x00308, 0x004ED },
+	{ 0x00456, 0x00308, 0x00457 },
+	{ 0x00474, 0x0030F, 0x00476 },
+	{ 0x00475, 0x0030F, 0x00477 },
+	{ 0x004D8, 0x00308, 0x004DA },
+	{ 0x004D9, 0x00308, 0x004DB },
+	{ 0x004E8, 0x00308, 0x004EA },
+	{ 0x004E9, 0x00308, 0x004EB },
+	{ 0x00627, 0x00653, 0x00622 },
+	{ 0x00627, 0x00654, 0x00623 },
+	{ 0x00627, 0x00655, 0x00625 },
+	{ 0x00648, 0x00654, 0x00624 },
+	{ 0x0064A, 0x00654, 0x00626 },
+	{ 0x006C1, 0x00654, 0x006C2 },
+	{ 0x006D2, 0x00654, 0x006D3 },
+	{ 0x006D5, 0x00654, 0x006C0 },
+	{ 0x00928, 0x0093C, 0x00929 },
+	{ 0x00930, 0x0093C, 0x00931 },
+	{ 0x00933, 0x0093C, 0x00934 },
+	{ 0x009C7, 0x009BE, 0x009CB },
+	{ 0x009C7, 0x009D7, 0x009CC },
+	{ 0x00B47, 0x00B3E, 0x00B4B },
+	{ 0x00B47, 0x00B56, 0x00B48 },
+	{ 0x00B47, 0x00B57, 0x00B4C },
+	{ 0x00B92, 0x00BD7, 0x00B94 },
+	{ 0x00BC6, 0x00BBE, 0x00BCA },
+	{ 0x00BC6, 0x00BD7, 0x00BCC },
+	{ 0x00BC7, 0x00BBE, 0x00BCB },
+	{ 0x00C46, 0x00C56, 0x00C48 },
+	{ 0x00CBF, 0x00CD5, 0x00CC0 },
+	{ 0x00CC6, 0x00CC2, 0x00CCA },
+	{ 0x00CC6, 0x00CD5, 0x00CC7 },
+	{ 0x00CC6, 0x00CD6, 0x00CC8 },
+	{ 0x00CCA, 0x00CD5, 0x00CCB },
+	{ 0x00D46, 0x00D3E, 0x00D4A },
+	{ 0x00D46, 0x00D57, 0x00D4C },
+	{ 0x00D47, 0x00D3E, 0x00D4B },
+	{ 0x00DD9, 0x00DCA, 0x00DDA },
+	{ 0x00DD9, 0x00DCF, 0x00DDC },
+	{ 0x00DD9, 0x00DDF, 0x00DDE },
+	{ 0x00DDC, 0x00DCA, 0x00DDD },
+	{ 0x01025, 0x0102E, 0x01026 },
+	{ 0x01B05, 0x01B35, 0x01B06 },
+	{ 0x01B07, 0x01B35, 0x01B08 },
+	{ 0x01B09, 0x01B35, 0x01B0A },
+	{ 0x01B0B, 0x01B35, 0x01B0C },
+	{ 0x01B0D, 0x01B35, 0x01B0E },
+	{ 0x01B11, 0x01B35, 0x01B12 },
+	{ 0x01B3A, 0x01B35, 0x01B3B },
+	{ 0x01B3C, 0x01B35, 0x01B3D },
+	{ 0x01B3E, 0x01B35, 0x01B40 },
+	{ 0x01B3F, 0x01B35, 0x01B41 },
+	{ 0x01B42, 0x01B35, 0x01B43 },
+	{ 0x01E36, 0x00304, 0x01E38 },
+	{ 0x01E37, 0x00304, 0x01E39 },
+	{ 0x01E5A, 0x00304, 0x01E5C },
+	{ 0x01E5B, 0x00304, 0x01E5D },
+	{ 0x01E62, 0x00307, 0x01E68 },
+	{ 0x01E63, 0x00307, 0x01E69 },
+	{ 0x01EA0, 0x00302, 0x01EAC },
+	{ 0x01EA0, 0x00306, 0x01EB6 },
+	{ 0x01EA1, 0x00302, 0x01EAD },
+	{ 0x01EA1, 0x00306, 0x01EB7 },
+	{ 0x01EB8, 0x00302, 0x01EC6 },
+	{ 0x01EB9, 0x00302, 0x01EC7 },
+	{ 0x01ECC, 0x00302, 0x01ED8 },
+	{ 0x01ECD, 0x00302, 0x01ED9 },
+	{ 0x01F00, 0x00300, 0x01F02 },
+	{ 0x01F00, 0x00301, 0x01F04 },
+	{ 0x01F00, 0x00342, 0x01F06 },
+	{ 0x01F00, 0x00345, 0x01F80 },
+	{ 0x01F01, 0x00300, 0x01F03 },
+	{ 0x01F01, 0x00301, 0x01F05 },
+	{ 0x01F01, 0x00342, 0x01F07 },
+	{ 0x01F01, 0x00345, 0x01F81 },
+	{ 0x01F02, 0x00345, 0x01F82 },
+	{ 0x01F03, 0x00345, 0x01F83 },
+	{ 0x01F04, 0x00345, 0x01F84 },
+	{ 0x01F05, 0x00345, 0x01F85 },
+	{ 0x01F06, 0x00345, 0x01F86 },
+	{ 0x01F07, 0x00345, 0x01F87 },
+	{ 0x01F08, 0x00300, 0x01F0A },
+	{ 0x01F08, 0x00301, 0x01F0C },
+	{ 0x01F08, 0x00342, 0x01F0E },
+	{ 0x01F08, 0x00345, 0x01F88 },
+	{ 0x01F09, 0x00300, 0x01F0B },
+	{ 0x01F09, 0x00301, 0x01F0D },
+	{ 0x01F09, 0x00342, 0x01F0F },
+	{ 0x01F09, 0x00345, 0x01F89 },
+	{ 0x01F0A, 0x00345, 0x01F8A },
+	{ 0x01F0B, 0x00345, 0x01F8B },
+	{ 0x01F0C, 0x00345, 0x01F8C },
+	{ 0x01F0D, 0x00345, 0x01F8D },
+	{ 0x01F0E, 0x00345, 0x01F8E },
+	{ 0x01F0F, 0x00345, 0x01F8F },
+	{ 0x01F10, 0x00300, 0x01F12 },
+	{ 0x01F10, 0x00301, 0x01F14 },
+	{ 0x01F11, 0x00300, 0x01F13 },
+	{ 0x01F11, 0x00301, 0x01F15 },
+	{ 0x01F18, 0x00300, 0x01F1A },
+	{ 0x01F18, 0x00301, 0x01F1C },
+	{ 0x01F19, 0x00300, 0x01F1B },
+	{ 0x01F19, 0x00301, 0x01F1D },
+	{ 0x01F20, 0x00300, 0x01F22 },
+	{ 0x01F20, 0x00301, 0x01F24 },
+	{ 0x01F20, 0x00342, 0x01F26 },
+	{ 0x01F20, 0x00345, 0x01F90 },
+	{ 0x01F21, 0x00300, 0x01F23 },
+	{ 0x01F21, 0x00301, 0x01F25 },
+	{ 0x01F21, 0x00342, 0x01F27 },
+	{ 0x01F21, 0x00345, 0x01F91 },
+	{ 0x01F22, 0x00345, 0x01F92 },
+	{ 0x01F23, 0x00345, 0x01F93 },
+	{ 0x01F24, 0x00345, 0x01F94 },
+	{ 0x01F25, 0x00345, 0x01F95 },
+	{ 0x01F26, 0x00345, 0x01F96 },
+	{ 0x01F27, 0x00345, 0x01F97 },
+	{ 0x01F28, 0x00300, 0x01F2A },
+	{ 0x01F28, 0x00301, 0x01F2C },
+	{ 0x01F28, 0x00342, 0x01F2E },
+	{ 0x01F28, 0x00345, 0x01F98 },
+	{ 0x01F29, 0x00300, 0x01F2B },
+	{ 0x01F29, 0x00301, 0x01F2D },
+	{ 0x01F29, 0x00342, 0x01F2F },
+	{ 0x01F29, 0x00345, 0x01F99 },
+	{ 0x01F2A, 0x00345, 0x01F9A },
+	{ 0x01F2B, 0x00345, 0x01F9B },
+	{ 0x01F2C, 0x00345, 0x01F9C },
+	{ 0x01F2D, 0x00345, 0x01F9D },
+	{ 0x01F2E, 0x00345, 0x01F9E },
+	{ 0x01F2F, 0x00345, 0x01F9F },
+	{ 0x01F30, 0x00300, 0x01F32 },
+	{ 0x01F30, 0x00301, 0x01F34 },
+	{ 0x01F30, 0x00342, 0x01F36 },
+	{ 0x01F31, 0x00300, 0x01F33 },
+	{ 0x01F31, 0x00301, 0x01F35 },
+	{ 0x01F31, 0x00342, 0x01F37 },
+	{ 0x01F38, 0x00300, 0x01F3A },
+	{ 0x01F38, 0x00301, 0x01F3C },
+	{ 0x01F38, 0x00342, 0x01F3E },
+	{ 0x01F39, 0x00300, 0x01F3B },
+	{ 0x01F39, 0x00301, 0x01F3D },
+	{ 0x01F39, 0x00342, 0x01F3F },
+	{ 0x01F40, 0x00300, 0x01F42 },
+	{ 0x01F40, 0x00301, 0x01F44 },
+	{ 0x01F41, 0x00300, 0x01F43 },
+	{ 0x01F41, 0x00301, 0x01F45 },
+	{ 0x01F48, 0x00300, 0x01F4A },
+	{ 0x01F48, 0x00301, 0x01F4C },
+	{ 0x01F49, 0x00300, 0x01F4B },
+	{ 0x01F49, 0x00301, 0x01F4D },
+	{ 0x01F50, 0x00300, 0x01F52 },
+	{ 0x01F50, 0x00301, 0x01F54 },
+	{ 0x01F50, 0x00342, 0x01F56 },
+	{ 0x01F51, 0x00300, 0x01F53 },
+	{ 0x01F51, 0x00301, 0x01F55 },
+	{ 0x01F51, 0x00342, 0x01F57 },
+	{ 0x01F59, 0x00300, 0x01F5B },
+	{ 0x01F59, 0x00301, 0x01F5D },
+	{ 0x01F59, 0x00342, 0x01F5F },
+	{ 0x01F60, 0x00300, 0x01F62 },
+	{ 0x01F60, 0x00301, 0x01F64 },
+	{ 0x01F60, 0x00342, 0x01F66 },
+	{ 0x01F60, 0x00345, 0x01FA0 },
+	{ 0x01F61, 0x00300, 0x01F63 },
+	{ 0x01F61, 0x00301, 0x01F65 },
+	{ 0x01F61, 0x00342, 0x01F67 },
+	{ 0x01F61, 0x00345, 0x01FA1 },
+	{ 0x01F62, 0x00345, 0x01FA2 },
+	{ 0x01F63, 0x00345, 0x01FA3 },
+	{ 0x01F64, 0x00345, 0x01FA4 },
+	{ 0x01F65, 0x00345, 0x01FA5 },
+	{ 0x01F66, 0x00345, 0x01FA6 },
+	{ 0x01F67, 0x00345, 0x01FA7 },
+	{ 0x01F68, 0x00300, 0x01F6A },
+	{ 0x01F68, 0x00301, 0x01F6C },
+	{ 0x01F68, 0x00342, 0x01F6E },
+	{ 0x01F68, 0x00345, 0x01FA8 },
+	{ 0x01F69, 0x00300, 0x01F6B },
+	{ 0x01F69, 0x00301, 0x01F6D },
+	{ 0x01F69, 0x00342, 0x01F6F },
+	{ 0x01F69, 0x00345, 0x01FA9 },
+	{ 0x01F6A, 0x00345, 0x01FAA },
+	{ 0x01F6B, 0x00345, 0x01FAB },
+	{ 0x01F6C, 0x00345, 0x01FAC },
+	{ 0x01F6D, 0x00345, 0x01FAD },
+	{ 0x01F6E, 0x00345, 0x01FAE },
+	{ 0x01F6F, 0x00345, 0x01FAF },
+	{ 0x01F70, 0x00345, 0x01FB2 },
+	{ 0x01F74, 0x00345, 0x01FC2 },
+	{ 0x01F7C, 0x00345, 0x01FF2 },
+	{ 0x01FB6, 0x00345, 0x01FB7 },
+	{ 0x01FBF, 0x00300, 0x01FCD },
+	{ 0x01FBF, 0x00301, 0x01FCE },
+	{ 0x01FBF, 0x00342, 0x01FCF },
+	{ 0x01FC6, 0x00345, 0x01FC7 },
+	{ 0x01FF6, 0x00345, 0x01FF7 },
+	{ 0x01FFE, 0x00300, 0x01FDD },
+	{ 0x01FFE, 0x00301, 0x01FDE },
+	{ 0x01FFE, 0x00342, 0x01FDF },
+	{ 0x02190, 0x00338, 0x0219A },
+	{ 0x02192, 0x00338, 0x0219B },
+	{ 0x02194, 0x00338, 0x021AE },
+	{ 0x021D0, 0x00338, 0x021CD },
+	{ 0x021D2, 0x00338, 0x021CF },
+	{ 0x021D4, 0x00338, 0x021CE },
+	{ 0x02203, 0x00338, 0x02204 },
+	{ 0x02208, 0x00338, 0x02209 },
+	{ 0x0220B, 0x00338, 0x0220C },
+	{ 0x02223, 0x00338, 0x02224 },
+	{ 0x02225, 0x00338, 0x02226 },
+	{ 0x0223C, 0x00338, 0x02241 },
+	{ 0x02243, 0x00338, 0x02244 },
+	{ 0x02245, 0x00338, 0x02247 },
+	{ 0x02248, 0x00338, 0x02249 },
+	{ 0x0224D, 0x00338, 0x0226D },
+	{ 0x02261, 0x00338, 0x02262 },
+	{ 0x02264, 0x00338, 0x02270 },
+	{ 0x02265, 0x00338, 0x02271 },
+	{ 0x02272, 0x00338, 0x02274 },
+	{ 0x02273, 0x00338, 0x02275 },
+	{ 0x02276, 0x00338, 0x02278 },
+	{ 0x02277, 0x00338, 0x02279 },
+	{ 0x0227A, 0x00338, 0x02280 },
+	{ 0x0227B, 0x00338, 0x02281 },
+	{ 0x0227C, 0x00338, 0x022E0 },
+	{ 0x0227D, 0x00338, 0x022E1 },
+	{ 0x02282, 0x00338, 0x02284 },
+	{ 0x02283, 0x00338, 0x02285 },
+	{ 0x02286, 0x00338, 0x02288 },
+	{ 0x02287, 0x00338, 0x02289 },
+	{ 0x02291, 0x00338, 0x022E2 },
+	{ 0x02292, 0x00338, 0x022E3 },
+	{ 0x022A2, 0x00338, 0x022AC },
+	{ 0x022A8, 0x00338, 0x022AD },
+	{ 0x022A9, 0x00338, 0x022AE },
+	{ 0x022AB, 0x00338, 0x022AF },
+	{ 0x022B2, 0x00338, 0x022EA },
+	{ 0x022B3, 0x00338, 0x022EB },
+	{ 0x022B4, 0x00338, 0x022EC },
+	{ 0x022B5, 0x00338, 0x022ED },
+	{ 0x03046, 0x03099, 0x03094 },
+	{ 0x0304B, 0x03099, 0x0304C },
+	{ 0x0304D, 0x03099, 0x0304E },
+	{ 0x0304F, 0x03099, 0x03050 },
+	{ 0x03051, 0x03099, 0x03052 },
+	{ 0x03053, 0x03099, 0x03054 },
+	{ 0x03055, 0x03099, 0x03056 },
+	{ 0x03057, 0x03099, 0x03058 },
+	{ 0x03059, 0x03099, 0x0305A },
+	{ 0x0305B, 0x03099, 0x0305C },
+	{ 0x0305D, 0x03099, 0x0305E },
+	{ 0x0305F, 0x03099, 0x03060 },
+	{ 0x03061, 0x03099, 0x03062 },
+	{ 0x03064, 0x03099, 0x03065 },
+	{ 0x03066, 0x03099, 0x03067 },
+	{ 0x03068, 0x03099, 0x03069 },
+	{ 0x0306F, 0x03099, 0x03070 },
+	{ 0x0306F, 0x0309A, 0x03071 },
+	{ 0x03072, 0x03099, 0x03073 },
+	{ 0x03072, 0x0309A, 0x03074 },
+	{ 0x03075, 0x03099, 0x03076 },
+	{ 0x03075, 0x0309A, 0x03077 },
+	{ 0x03078, 0x03099, 0x03079 },
+	{ 0x03078, 0x0309A, 0x0307A },
+	{ 0x0307B, 0x03099, 0x0307C },
+	{ 0x0307B, 0x0309A, 0x0307D },
+	{ 0x0309D, 0x03099, 0x0309E },
+	{ 0x030A6, 0x03099, 0x030F4 },
+	{ 0x030AB, 0x03099, 0x030AC },
+	{ 0x030AD, 0x03099, 0x030AE },
+	{ 0x030AF, 0x03099, 0x030B0 },
+	{ 0x030B1, 0x03099, 0x030B2 },
+	{ 0x030B3, 0x03099, 0x030B4 },
+	{ 0x030B5, 0x03099, 0x030B6 },
+	{ 0x030B7, 0x03099, 0x030B8 },
+	{ 0x030B9, 0x03099, 0x030BA },
+	{ 0x030BB, 0x03099, 0x030BC },
+	{ 0x030BD, 0x03099, 0x030BE },
+	{ 0x030BF, 0x03099, 0x030C0 },
+	{ 0x030C1, 0x03099, 0x030C2 },
+	{ 0x030C4, 0x03099, 0x030C5 },
+	{ 0x030C6, 0x03099, 0x030C7 },
+	{ 0x030C8, 0x03099, 0x030C9 },
+	{ 0x030CF, 0x03099, 0x030D0 },
+	{ 0x030CF, 0x0309A, 0x030D1 },
+	{ 0x030D2, 0x03099, 0x030D3 },
+	{ 0x030D2, 0x0309A, 0x030D4 },
+	{ 0x030D5, 0x03099, 0x030D6 },
+	{ 0x030D5, 0x0309A, 0x030D7 },
+	{ 0x030D8, 0x03099, 0x030D9 },
+	{ 0x030D8, 0x0309A, 0x030DA },
+	{ 0x030DB, 0x03099, 0x030DC },
+	{ 0x030DB, 0x0309A, 0x030DD },
+	{ 0x030EF, 0x03099, 0x030F7 },
+	{ 0x030F0, 0x03099, 0x030F8 },
+	{ 0x030F1, 0x03099, 0x030F9 },
+	{ 0x030F2, 0x03099, 0x030FA },
+	{ 0x030FD, 0x03099, 0x030FE },
+	{ 0x11099, 0x110BA, 0x1109A },
+	{ 0x1109B, 0x110BA, 0x1109C },
+	{ 0x110A5, 0x110BA, 0x110AB },
+	{ 0x11131, 0x11127, 0x1112E },
+	{ 0x11132, 0x11127, 0x1112F },
+	{ 0x11347, 0x1133E, 0x1134B },
+	{ 0x11347, 0x11357, 0x1134C },
+	{ 0x114B9, 0x114B0, 0x114BC },
+	{ 0x114B9, 0x114BA, 0x114BB },
+	{ 0x114B9, 0x114BD, 0x114BE },
+	{ 0x115B8, 0x115AF, 0x115BA },
+	{ 0x115B9, 0x115AF, 0x115BB },
+	{ 0x11935, 0x11930, 0x11938 },
+};
+
+#endif
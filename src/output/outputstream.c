@@ -0,0 +1,446 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <parserutils/output/outputstream.h>
+#include <parserutils/utils/buffer.h>
+
+#include "charset/encodings/utf8impl.h"
+#include "input/filter.h"
+#include "utils/utils.h"
+
+/* Each conversion, and each write, has a cost to start, so is made in
+ * large pieces */
+#define BLOCK_SIZE (16 * 1024)
+/* Room for the longest fallback the filter writes, and then some */
+#define BLOCK_MIN_SIZE (256)
+
+/**
+ * Output stream object
+ */
+struct parserutils_outputstream {
+	parserutils_buffer *utf8;	/**< UTF-8 data yet to be encoded */
+
+	parserutils_filter *output;	/**< Filter encoding the data */
+
+	uint8_t *block;			/**< Encoded data for the writer */
+	size_t block_size;		/**< Capacity of block */
+	size_t block_len;		/**< Length of data in block */
+
+	parserutils_outputstream_writer writer;	/**< Writer of encoded data */
+	void *writer_pw;		/**< Client private data for writer */
+
+	parserutils_alloc alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client private data */
+};
+
+static parserutils_error parserutils_outputstream_encode(
+		parserutils_outputstream *stream, bool end);
+static parserutils_error parserutils_outputstream_convert(
+		parserutils_outputstream *stream,
+		const uint8_t **data, size_t *len);
+static parserutils_error parserutils_outputstream_write(
+		parserutils_outputstream *stream);
+static size_t parserutils_outputstream_incomplete(const uint8_t *data,
+		size_t len);
+
+/**
+ * Create an output stream
+ *
+ * \param enc        Charset to write
+ * \param writer     Function receiving the encoded data
+ * \param writer_pw  Client private data for writer (may be NULL)
+ * \param alloc      Memory (de)allocation function
+ * \param pw         Pointer to client-specific private data (may be NULL)
+ * \param stream     Pointer to location to receive stream instance
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhaustion,
+ *         PARSERUTILS_BADENCODING on unsupported encoding
+ *
+ * Characters which the charset cannot represent are replaced loosely,
+ * until another fallback is set.
+ */
+parserutils_error parserutils_outputstream_create(const char *enc,
+		parserutils_outputstream_writer writer, void *writer_pw,
+		parserutils_alloc alloc, void *pw,
+		parserutils_outputstream **stream)
+{
+	return parserutils_outputstream_create_pooled(enc, writer, writer_pw,
+			NULL, alloc, pw, stream);
+}
+
+/**
+ * Create an output stream which takes its charset converters from a pool
+ *
+ * \param enc        Charset to write
+ * \param writer     Function receiving the encoded data
+ * \param writer_pw  Client private data for writer (may be NULL)
+ * \param pool       Pool of charset converters, or NULL for none
+ * \param alloc      Memory (de)allocation function
+ * \param pw         Pointer to client-specific private data (may be NULL)
+ * \param stream     Pointer to location to receive stream instance
+ * \return As for parserutils_outputstream_create
+ *
+ * This behaves exactly as parserutils_outputstream_create, except that the
+ * stream's converters are returned to the pool when it is destroyed, for
+ * reuse by later streams. The pool must outlive the stream.
+ */
+parserutils_error parserutils_outputstream_create_pooled(const char *enc,
+		parserutils_outputstream_writer writer, void *writer_pw,
+		parserutils_charset_pool *pool,
+		parserutils_alloc alloc, void *pw,
+		parserutils_outputstream **stream)
+{
+	parserutils_outputstream *s;
+	parserutils_error error;
+
+	if (enc == NULL || writer == NULL || alloc == NULL || stream == NULL)
+		return PARSERUTILS_BADPARM;
+
+	s = alloc(NULL, sizeof(parserutils_outputstream), pw);
+	if (s == NULL)
+		return PARSERUTILS_NOMEM;
+
+	error = parserutils_buffer_create_with_capacity(BLOCK_SIZE,
+			alloc, pw, &s->utf8);
+	if (error != PARSERUTILS_OK) {
+		alloc(s, 0, pw);
+		return error;
+	}
+
+	s->block = alloc(NULL, BLOCK_SIZE, pw);
+	if (s->block == NULL) {
+		parserutils_buffer_destroy(s->utf8);
+		alloc(s, 0, pw);
+		return PARSERUTILS_NOMEM;
+	}
+
+	s->block_size = BLOCK_SIZE;
+	s->block_len = 0;
+
+	/* The filter writes its own charset, reading UTF-8 by default */
+	error = parserutils__filter_create_pooled(enc, pool, alloc, pw,
+			&s->output);
+	if (error != PARSERUTILS_OK) {
+		alloc(s->block, 0, pw);
+		parserutils_buffer_destroy(s->utf8);
+		alloc(s, 0, pw);
+		return error;
+	}
+
+	s->writer = writer;
+	s->writer_pw = writer_pw;
+
+	s->alloc = alloc;
+	s->pw = pw;
+
+	*stream = s;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Destroy an output stream
+ *
+ * \param stream  Output stream to destroy
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * Data which has not been written is discarded.
+ */
+parserutils_error parserutils_outputstream_destroy(
+		parserutils_outputstream *stream)
+{
+	if (stream == NULL)
+		return PARSERUTILS_BADPARM;
+
+	parserutils__filter_destroy(stream->output);
+	stream->alloc(stream->block, 0, stream->pw);
+	parserutils_buffer_destroy(stream->utf8);
+	stream->alloc(stream, 0, stream->pw);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Configure an output stream
+ *
+ * \param stream  Output stream to configure
+ * \param type    Option type to configure
+ * \param params  Option-specific parameters
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * A strict fallback stops encoding at the first character which can't be
+ * represented. The character, and the data after it, are kept, and setting
+ * another fallback allows them to be written.
+ *
+ * Before the block size changes, any encoded data is written out, so this
+ * may return the writer's error.
+ */
+parserutils_error parserutils_outputstream_setopt(
+		parserutils_outputstream *stream,
+		parserutils_outputstream_opttype type,
+		parserutils_outputstream_optparams *params)
+{
+	parserutils_filter_optparams fparams;
+	parserutils_error error;
+	uint8_t *block;
+	size_t size;
+
+	if (stream == NULL || params == NULL)
+		return PARSERUTILS_BADPARM;
+
+	switch (type) {
+	case PARSERUTILS_OUTPUTSTREAM_SET_FALLBACK:
+		switch (params->fallback.mode) {
+		case PARSERUTILS_OUTPUTSTREAM_FALLBACK_LOOSE:
+			fparams.fallback.mode =
+					PARSERUTILS_FILTER_FALLBACK_LOOSE;
+			break;
+		case PARSERUTILS_OUTPUTSTREAM_FALLBACK_STRICT:
+			fparams.fallback.mode =
+					PARSERUTILS_FILTER_FALLBACK_STRICT;
+			break;
+		case PARSERUTILS_OUTPUTSTREAM_FALLBACK_NCR:
+			fparams.fallback.mode =
+					PARSERUTILS_FILTER_FALLBACK_NCR;
+			break;
+		default:
+			return PARSERUTILS_BADPARM;
+		}
+
+		return parserutils__filter_setopt(stream->output,
+				PARSERUTILS_FILTER_SET_FALLBACK, &fparams);
+	case PARSERUTILS_OUTPUTSTREAM_SET_BLOCK_SIZE:
+		size = (params->block.size != 0)
+				? max(params->block.size, BLOCK_MIN_SIZE)
+				: BLOCK_SIZE;
+
+		error = parserutils_outputstream_write(stream);
+		if (error != PARSERUTILS_OK)
+			return error;
+
+		block = stream->alloc(stream->block, size, stream->pw);
+		if (block == NULL)
+			return PARSERUTILS_NOMEM;
+
+		stream->block = block;
+		stream->block_size = size;
+		break;
+	default:
+		return PARSERUTILS_BADPARM;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Append UTF-8 data to an output stream
+ *
+ * \param stream  Output stream to append data to
+ * \param data    Data to append (UTF-8 encoded), or NULL to end the data
+ * \param len     Length, in bytes, of data
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_INVALID if the fallback is strict, and a character
+ *                             cannot be represented,
+ *         the writer's error if it fails,
+ *         appropriate error otherwise
+ *
+ * The data is batched, and encoded and written a block at a time. A
+ * character may be split between calls. Ending the data writes all that
+ * remains, with any incomplete character at the end replaced as invalid
+ * input, and returns a stateful charset to its initial state. More data may
+ * be appended afterwards.
+ *
+ * The data is appended even if encoding it fails, so should not be appended
+ * again.
+ */
+parserutils_error parserutils_outputstream_append(
+		parserutils_outputstream *stream,
+		const uint8_t *data, size_t len)
+{
+	parserutils_error error;
+
+	if (stream == NULL)
+		return PARSERUTILS_BADPARM;
+
+	if (data == NULL)
+		return parserutils_outputstream_encode(stream, true);
+
+	error = parserutils_buffer_append(stream->utf8, data, len);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	if (stream->utf8->length < stream->block_size)
+		return PARSERUTILS_OK;
+
+	return parserutils_outputstream_encode(stream, false);
+}
+
+/**
+ * Encode and write all complete characters appended to an output stream
+ *
+ * \param stream  Output stream to flush
+ * \return As for parserutils_outputstream_append
+ *
+ * An incomplete character at the end of the data is kept, to be completed
+ * by the next append.
+ */
+parserutils_error parserutils_outputstream_flush(
+		parserutils_outputstream *stream)
+{
+	if (stream == NULL)
+		return PARSERUTILS_BADPARM;
+
+	return parserutils_outputstream_encode(stream, false);
+}
+
+/******************************************************************************
+ ******************************************************************************/
+
+/**
+ * Encode an output stream's data, and write it out
+ *
+ * \param stream  The output stream
+ * \param end     Whether the data ends here
+ * \return As for parserutils_outputstream_append
+ *
+ * The filter is handed the data whole, into block-sized pieces of output.
+ * It stops at the end of each piece, which is then given to the writer.
+ */
+parserutils_error parserutils_outputstream_encode(
+		parserutils_outputstream *stream, bool end)
+{
+	parserutils_error error;
+	const uint8_t *data;
+	size_t len, held;
+
+	/* The writer may have refused the last block */
+	error = parserutils_outputstream_write(stream);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	held = parserutils_outputstream_incomplete(stream->utf8->data,
+			stream->utf8->length);
+
+	if (end && held > 0) {
+		/* Nothing will complete the character, so it's invalid */
+		error = parserutils_buffer_discard(stream->utf8,
+				stream->utf8->length - held, held);
+		if (error != PARSERUTILS_OK)
+			return error;
+
+		error = parserutils_buffer_append(stream->utf8,
+				(const uint8_t *) "\xef\xbf\xbd", 3);
+		if (error != PARSERUTILS_OK)
+			return error;
+
+		held = 0;
+	}
+
+	data = stream->utf8->data;
+	len = stream->utf8->length - held;
+
+	/* Even with no data, the filter may hold some output */
+	error = parserutils_outputstream_convert(stream, &data, &len);
+
+	/* Ending the data also flushes the filter, which it does when given
+	 * none */
+	if (end && len == 0 && error == PARSERUTILS_OK)
+		error = parserutils_outputstream_convert(stream, &data, &len);
+
+	parserutils_buffer_discard(stream->utf8, 0, data - stream->utf8->data);
+
+	return error;
+}
+
+/**
+ * Convert data with an output stream's filter, writing each block filled
+ *
+ * \param stream  The output stream
+ * \param data    Pointer to pointer to UTF-8 data
+ * \param len     Pointer to length of data
+ * \return As for parserutils_outputstream_append
+ */
+parserutils_error parserutils_outputstream_convert(
+		parserutils_outputstream *stream,
+		const uint8_t **data, size_t *len)
+{
+	parserutils_error error, werror;
+
+	do {
+		uint8_t *out = stream->block + stream->block_len;
+		size_t space = stream->block_size - stream->block_len;
+
+		error = parserutils__filter_process_chunk(stream->output,
+				data, len, &out, &space);
+
+		stream->block_len = out - stream->block;
+
+		werror = parserutils_outputstream_write(stream);
+		if (werror != PARSERUTILS_OK)
+			return werror;
+	} while (error == PARSERUTILS_NOMEM);
+
+	return error;
+}
+
+/**
+ * Give an output stream's encoded data to its writer
+ *
+ * \param stream  The output stream
+ * \return PARSERUTILS_OK on success, or the writer's error
+ */
+parserutils_error parserutils_outputstream_write(
+		parserutils_outputstream *stream)
+{
+	parserutils_error error;
+
+	if (stream->block_len == 0)
+		return PARSERUTILS_OK;
+
+	error = stream->writer(stream->block, stream->block_len,
+			stream->writer_pw);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	stream->block_len = 0;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Find the length of an incomplete UTF-8 character at the end of some data
+ *
+ * \param data  The data
+ * \param len   Length of data, in bytes
+ * \return Length of the character begun, or 0 if the last is complete
+ *
+ * Only the length of the sequence is considered. Bytes which cannot be
+ * part of a character are left for the filter to replace.
+ */
+size_t parserutils_outputstream_incomplete(const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	for (i = 1; i <= min(len, 4); i++) {
+		uint8_t c = data[len - i];
+
+		if ((c & 0xC0) == 0x80)
+			continue;
+
+		if (c >= 0xC2 && c <= 0xF4 && (size_t) numContinuations[c] >= i)
+			return i;
+
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,358 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2008 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <parserutils/utils/arena.h>
+
+/** Smallest size class is 16 bytes */
+#define MIN_CLASS_SHIFT (4)
+/** Number of size classes; the largest is 64kB */
+#define NUM_CLASSES (13)
+/** Size of the largest size class */
+#define MAX_CLASS_SIZE ((size_t) 1 << (MIN_CLASS_SHIFT + NUM_CLASSES - 1))
+/** Size of a chunk from which blocks are allocated */
+#define CHUNK_SIZE (256 * 1024)
+
+/**
+ * Header preceding each allocated block
+ */
+typedef union parserutils_arena_header {
+	size_t size;			/**< Usable size of block */
+
+	/* Ensure the data that follows is suitably aligned */
+	uintmax_t align_int;
+	long double align_float;
+	void *align_ptr;
+} parserutils_arena_header;
+
+/**
+ * Chunk of memory from which blocks are carved
+ */
+typedef struct parserutils_arena_chunk {
+	struct parserutils_arena_chunk *next;	/**< Next chunk in arena */
+
+	parserutils_arena_header align;	/**< Aligns the blocks that follow */
+} parserutils_arena_chunk;
+
+/**
+ * Block too large for any size class, allocated individually
+ */
+typedef struct parserutils_arena_large {
+	struct parserutils_arena_large *prev;	/**< Previous large block */
+	struct parserutils_arena_large *next;	/**< Next large block */
+
+	parserutils_arena_header header;	/**< Block header. Must be last */
+} parserutils_arena_large;
+
+/**
+ * Arena object
+ */
+struct parserutils_arena
+{
+	parserutils_arena_chunk *chunks;	/**< List of chunks */
+	parserutils_arena_chunk *current;	/**< Chunk being allocated from */
+	uint8_t *next;			/**< Next free byte in current chunk */
+	uint8_t *end;			/**< End of current chunk */
+
+	/** Free blocks in each size class */
+	parserutils_arena_header *free[NUM_CLASSES];
+
+	parserutils_arena_large *large;	/**< List of large blocks */
+
+	parserutils_alloc alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client-specific data */
+};
+
+static inline void *parserutils_arena_get(parserutils_arena *arena,
+		size_t len);
+static inline void parserutils_arena_put(parserutils_arena *arena,
+		parserutils_arena_header *header);
+static inline bool parserutils_arena_next_chunk(parserutils_arena *arena);
+
+/**
+ * Create an arena
+ *
+ * \param alloc   Memory (de)allocation function
+ * \param pw      Pointer to client-specific private data
+ * \param arena   Pointer to location to receive arena instance
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ *
+ * Memory is obtained from alloc in large chunks, and handed out by
+ * parserutils_arena_alloc. Blocks are rounded up to a power of two in size,
+ * and freed blocks are reused for later allocations of the same size.
+ * Blocks larger than the largest size class are passed straight through to
+ * alloc. Everything allocated from the arena is freed by destroying it.
+ *
+ * Objects that own resources other than memory, such as input streams,
+ * which may hold an iconv descriptor, must still be destroyed.
+ */
+parserutils_error parserutils_arena_create(parserutils_alloc alloc, void *pw,
+		parserutils_arena **arena)
+{
+	parserutils_arena *a;
+
+	if (alloc == NULL || arena == NULL)
+		return PARSERUTILS_BADPARM;
+
+	a = alloc(NULL, sizeof(parserutils_arena), pw);
+	if (a == NULL)
+		return PARSERUTILS_NOMEM;
+
+	a->chunks = NULL;
+	a->current = NULL;
+	a->next = NULL;
+	a->end = NULL;
+	memset(a->free, 0, sizeof(a->free));
+	a->large = NULL;
+
+	a->alloc = alloc;
+	a->pw = pw;
+
+	*arena = a;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Destroy an arena, freeing everything allocated from it
+ *
+ * \param arena  The arena to destroy
+ * \return PARSERUTILS_OK on success, appropriate error otherwise.
+ */
+parserutils_error parserutils_arena_destroy(parserutils_arena *arena)
+{
+	parserutils_arena_chunk *chunk, *next;
+
+	if (arena == NULL)
+		return PARSERUTILS_BADPARM;
+
+	parserutils_arena_reset(arena);
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		arena->alloc(chunk, 0, arena->pw);
+	}
+
+	arena->alloc(arena, 0, arena->pw);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Free everything allocated from an arena, but keep it for reuse
+ *
+ * \param arena  The arena to reset
+ * \return PARSERUTILS_OK on success, appropriate error otherwise.
+ *
+ * The arena's chunks are retained, so allocating the same objects again
+ * will not need to obtain any more memory from the arena's alloc function.
+ */
+parserutils_error parserutils_arena_reset(parserutils_arena *arena)
+{
+	parserutils_arena_large *large, *next;
+
+	if (arena == NULL)
+		return PARSERUTILS_BADPARM;
+
+	for (large = arena->large; large != NULL; large = next) {
+		next = large->next;
+		arena->alloc(large, 0, arena->pw);
+	}
+	arena->large = NULL;
+
+	memset(arena->free, 0, sizeof(arena->free));
+
+	arena->current = arena->chunks;
+	if (arena->current != NULL) {
+		arena->next = (uint8_t *) (arena->current + 1);
+		arena->end = (uint8_t *) arena->current + CHUNK_SIZE;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Allocate, resize or free memory from an arena
+ *
+ * \param ptr  Block to resize or free, or NULL to allocate
+ * \param len  Size of block required, or 0 to free ptr
+ * \param pw   The arena
+ * \return Pointer to block, or NULL on failure or when freeing
+ *
+ * This has the semantics of realloc, so may be passed to any parserutils
+ * constructor as its alloc function, with the arena as its pw.
+ */
+void *parserutils_arena_alloc(void *ptr, size_t len, void *pw)
+{
+	parserutils_arena *arena = pw;
+	parserutils_arena_header *header;
+	void *temp;
+
+	if (ptr == NULL)
+		return len == 0 ? NULL : parserutils_arena_get(arena, len);
+
+	header = ((parserutils_arena_header *) ptr) - 1;
+
+	if (len == 0) {
+		parserutils_arena_put(arena, header);
+		return NULL;
+	}
+
+	/* Block may already be big enough */
+	if (len <= header->size)
+		return ptr;
+
+	temp = parserutils_arena_get(arena, len);
+	if (temp == NULL)
+		return NULL;
+
+	memcpy(temp, ptr, header->size);
+
+	parserutils_arena_put(arena, header);
+
+	return temp;
+}
+
+/******************************************************************************
+ ******************************************************************************/
+
+/**
+ * Obtain a block from an arena
+ *
+ * \param arena  The arena to allocate from
+ * \param len    Minimum usable size of block, in bytes
+ * \return Pointer to block's data, or NULL on memory exhaustion
+ */
+void *parserutils_arena_get(parserutils_arena *arena, size_t len)
+{
+	parserutils_arena_header *header;
+	size_t size = (size_t) 1 << MIN_CLASS_SHIFT;
+	int sclass = 0;
+
+	if (len > MAX_CLASS_SIZE) {
+		parserutils_arena_large *large;
+
+		large = arena->alloc(NULL,
+				sizeof(parserutils_arena_large) + len, arena->pw);
+		if (large == NULL)
+			return NULL;
+
+		large->prev = NULL;
+		large->next = arena->large;
+		if (arena->large != NULL)
+			arena->large->prev = large;
+		arena->large = large;
+
+		large->header.size = len;
+
+		return &large->header + 1;
+	}
+
+	while (size < len) {
+		size <<= 1;
+		sclass++;
+	}
+
+	/* Reuse a freed block, if there is one. Free blocks hold a pointer
+	 * to the next free block in their data. */
+	if (arena->free[sclass] != NULL) {
+		header = arena->free[sclass];
+		memcpy(&arena->free[sclass], header + 1,
+				sizeof(parserutils_arena_header *));
+
+		return header + 1;
+	}
+
+	if ((size_t) (arena->end - arena->next) < sizeof(*header) + size &&
+			parserutils_arena_next_chunk(arena) == false)
+		return NULL;
+
+	header = (parserutils_arena_header *) (void *) arena->next;
+	arena->next += sizeof(*header) + size;
+
+	header->size = size;
+
+	return header + 1;
+}
+
+/**
+ * Return a block to an arena
+ *
+ * \param arena   The arena the block was allocated from
+ * \param header  The block's header
+ */
+void parserutils_arena_put(parserutils_arena *arena,
+		parserutils_arena_header *header)
+{
+	size_t size = (size_t) 1 << MIN_CLASS_SHIFT;
+	int sclass = 0;
+
+	if (header->size > MAX_CLASS_SIZE) {
+		parserutils_arena_large *large = (parserutils_arena_large *)
+				(void *) ((uint8_t *) header -
+				offsetof(parserutils_arena_large, header));
+
+		if (large->prev != NULL)
+			large->prev->next = large->next;
+		else
+			arena->large = large->next;
+		if (large->next != NULL)
+			large->next->prev = large->prev;
+
+		arena->alloc(large, 0, arena->pw);
+
+		return;
+	}
+
+	while (size < header->size) {
+		size <<= 1;
+		sclass++;
+	}
+
+	memcpy(header + 1, &arena->free[sclass],
+			sizeof(parserutils_arena_header *));
+	arena->free[sclass] = header;
+}
+
+/**
+ * Move on to an arena's next chunk, allocating one if necessary
+ *
+ * \param arena  The arena to consider
+ * \return true on success, false on memory exhaustion
+ *
+ * Any space remaining in the current chunk is abandoned.
+ */
+bool parserutils_arena_next_chunk(parserutils_arena *arena)
+{
+	parserutils_arena_chunk *chunk;
+
+	if (arena->current != NULL && arena->current->next != NULL) {
+		chunk = arena->current->next;
+	} else {
+		chunk = arena->alloc(NULL, CHUNK_SIZE, arena->pw);
+		if (chunk == NULL)
+			return false;
+
+		chunk->next = NULL;
+
+		if (arena->current != NULL)
+			arena->current->next = chunk;
+		else
+			arena->chunks = chunk;
+	}
+
+	arena->current = chunk;
+	arena->next = (uint8_t *) (chunk + 1);
+	arena->end = (uint8_t *) chunk + CHUNK_SIZE;
+
+	return true;
+}
+
@@ -5,12 +5,19 @@
  * Copyright 2008 John-Mark Bell <jmb@netsurf-browser.org>
  */
 
+#include <stdint.h>
 #include <string.h>
 
 #include <parserutils/utils/buffer.h>
 
+#include "utils/trace.h"
+
 #define DEFAULT_SIZE (4096)
 
+static inline void parserutils_buffer_compact(parserutils_buffer *buffer);
+static inline void parserutils_buffer_reclaim(parserutils_buffer *buffer,
+		size_t len);
+
 /**
  * Create a memory buffer
  *
@@ -23,28 +30,59 @@
  */
 parserutils_error parserutils_buffer_create(parserutils_alloc alloc, void *pw,
 		parserutils_buffer **buffer)
+{
+	return parserutils_buffer_create_with_capacity(0, alloc, pw, buffer);
+}
+
+/**
+ * Create a memory buffer, able to hold a given amount of data
+ *
+ * \param capacity  Length of data that may be appended without reallocation
+ * \param alloc     Memory (de)allocation function
+ * \param pw        Pointer to client-specific private data
+ * \param buffer    Pointer to location to receive memory buffer
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhausion
+ */
+parserutils_error parserutils_buffer_create_with_capacity(size_t capacity,
+		parserutils_alloc alloc, void *pw, parserutils_buffer **buffer)
 {
 	parserutils_buffer *b;
+	size_t size = DEFAULT_SIZE;
 
 	if (alloc == NULL || buffer == NULL)
 		return PARSERUTILS_BADPARM;
 
+	if (capacity >= SIZE_MAX / 2)
+		return PARSERUTILS_NOMEM;
+
+	while (size <= capacity)
+		size *= 2;
+
 	b = alloc(NULL, sizeof(parserutils_buffer), pw);
 	if (b == NULL)
 		return PARSERUTILS_NOMEM;
 
-	b->data = alloc(NULL, DEFAULT_SIZE, pw);
+	b->data = alloc(NULL, size, pw);
 	if (b->data == NULL) {
 		alloc(b, 0, pw);
 		return PARSERUTILS_NOMEM;
 	}
 
 	b->length = 0;
-	b->allocated = DEFAULT_SIZE;
+	b->allocated = size;
+	b->base = b->data;
 
 	b->alloc = alloc;
 	b->pw = pw;
 
+	b->peak = size;
+	b->grows = 0;
+	b->moved = 0;
+
+	b->trace = NULL;
+
 	*buffer = b;
 
 	return PARSERUTILS_OK;
@@ -61,7 +99,7 @@ parserutils_error parserutils_buffer_destroy(parserutils_buffer *buffer)
 	if (buffer == NULL)
 		return PARSERUTILS_BADPARM;
 
-	buffer->alloc(buffer->data, 0, buffer->pw);
+	buffer->alloc(buffer->base, 0, buffer->pw);
 	buffer->alloc(buffer, 0, buffer->pw);
 
 	return PARSERUTILS_OK;
@@ -78,11 +116,11 @@ parserutils_error parserutils_buffer_destroy(parserutils_buffer *buffer)
 parserutils_error parserutils_buffer_append(parserutils_buffer *buffer, 
 		const uint8_t *data, size_t len)
 {
-	while (len >= buffer->allocated - buffer->length) {
-		parserutils_error error = parserutils_buffer_grow(buffer);
-		if (error != PARSERUTILS_OK)
-			return error;
-	}
+	parserutils_error error;
+
+	error = parserutils_buffer_reserve(buffer, len);
+	if (error != PARSERUTILS_OK)
+		return error;
 
 	memcpy(buffer->data + buffer->length, data, len);
 
@@ -103,20 +141,33 @@ parserutils_error parserutils_buffer_append(parserutils_buffer *buffer,
 parserutils_error parserutils_buffer_insert(parserutils_buffer *buffer, 
 		size_t offset, const uint8_t *data, size_t len)
 {
+	parserutils_error error;
+
 	if (offset > buffer->length)
 		return PARSERUTILS_BADPARM;
 
 	if (offset == buffer->length)
 		return parserutils_buffer_append(buffer, data, len);
 
-	while (len >= buffer->allocated - buffer->length) {
-		parserutils_error error = parserutils_buffer_grow(buffer);
-		if (error != PARSERUTILS_OK)
-			return error;
+	/* Inserting at the front can reuse discarded space */
+	if (offset == 0 && len <= (size_t) (buffer->data - buffer->base)) {
+		buffer->data -= len;
+		buffer->allocated += len;
+
+		memcpy(buffer->data, data, len);
+
+		buffer->length += len;
+
+		return PARSERUTILS_OK;
 	}
 
+	error = parserutils_buffer_reserve(buffer, len);
+	if (error != PARSERUTILS_OK)
+		return error;
+
 	memmove(buffer->data + offset + len,
 			buffer->data + offset, buffer->length - offset);
+	buffer->moved += buffer->length - offset;
 
 	memcpy(buffer->data + offset, data, len);
 
@@ -132,6 +183,10 @@ parserutils_error parserutils_buffer_insert(parserutils_buffer *buffer,
  * \param offset  The offset into the buffer of the start of the section
  * \param len     The number of bytes to discard
  * \return PARSERUTILS_OK on success, appropriate error otherwise.
+ *
+ * Discarding from the front of the buffer takes constant time: the start of
+ * the data is simply moved forwards. The space is reclaimed later, when it
+ * is cheaper to do so than to grow the buffer.
  */
 parserutils_error parserutils_buffer_discard(parserutils_buffer *buffer, 
 		size_t offset, size_t len)
@@ -139,8 +194,21 @@ parserutils_error parserutils_buffer_discard(parserutils_buffer *buffer,
 	if (offset >= buffer->length || offset + len > buffer->length)
 		return PARSERUTILS_BADPARM;
 
+	if (offset == 0) {
+		buffer->data += len;
+		buffer->allocated -= len;
+		buffer->length -= len;
+
+		/* Empty buffers may as well start from the beginning */
+		if (buffer->length == 0)
+			parserutils_buffer_compact(buffer);
+
+		return PARSERUTILS_OK;
+	}
+
 	memmove(buffer->data + offset, buffer->data + offset + len, 
-			buffer->length - len);
+			buffer->length - offset - len);
+	buffer->moved += buffer->length - offset - len;
 
 	buffer->length -= len;
 
@@ -155,14 +223,118 @@ parserutils_error parserutils_buffer_discard(parserutils_buffer *buffer,
  */
 parserutils_error parserutils_buffer_grow(parserutils_buffer *buffer)
 {
-	uint8_t *temp = buffer->alloc(buffer->data, 
-			buffer->allocated * 2, buffer->pw);
+	uint8_t *temp;
+
+	/* Don't copy discarded data around */
+	parserutils_buffer_compact(buffer);
+
+	temp = buffer->alloc(buffer->base, buffer->allocated * 2, buffer->pw);
 	if (temp == NULL)
 		return PARSERUTILS_NOMEM;
 
+	PARSERUTILS_TRACE(buffer->trace, BUFFER_GROW, buffer->allocated,
+			buffer->allocated * 2);
+
 	buffer->data = temp;
+	buffer->base = temp;
 	buffer->allocated *= 2;
 
+	buffer->grows++;
+	if (buffer->allocated > buffer->peak)
+		buffer->peak = buffer->allocated;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Ensure a memory buffer has space for a given amount of further data
+ *
+ * \param buffer  The buffer to consider
+ * \param len     Length of data that may then be appended without
+ *                reallocation
+ * \return PARSERUTILS_OK on success, appropriate error otherwise.
+ *
+ * The allocation is grown in a single step, to the size it would have
+ * reached had the data been appended.
+ */
+parserutils_error parserutils_buffer_reserve(parserutils_buffer *buffer,
+		size_t len)
+{
+	size_t size;
+	uint8_t *temp;
+
+	if (buffer == NULL)
+		return PARSERUTILS_BADPARM;
+
+	parserutils_buffer_reclaim(buffer, len);
+
+	if (len < buffer->allocated - buffer->length)
+		return PARSERUTILS_OK;
+
+	if (len >= SIZE_MAX / 2 - buffer->length)
+		return PARSERUTILS_NOMEM;
+
+	/* Don't copy discarded data around */
+	parserutils_buffer_compact(buffer);
+
+	size = buffer->allocated;
+	while (len >= size - buffer->length)
+		size *= 2;
+
+	temp = buffer->alloc(buffer->base, size, buffer->pw);
+	if (temp == NULL)
+		return PARSERUTILS_NOMEM;
+
+	PARSERUTILS_TRACE(buffer->trace, BUFFER_GROW, buffer->allocated, size);
+
+	buffer->data = temp;
+	buffer->base = temp;
+	buffer->allocated = size;
+
+	buffer->grows++;
+	if (buffer->allocated > buffer->peak)
+		buffer->peak = buffer->allocated;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Release space allocated for a memory buffer that is not in use
+ *
+ * \param buffer  The buffer to shrink
+ * \return PARSERUTILS_OK on success, appropriate error otherwise.
+ *
+ * The allocation is halved for as long as the data would fill no more than
+ * half of the result, but is never made smaller than a newly-created
+ * buffer's. Thus, a buffer that's shrunk and then refilled to the same
+ * level won't immediately need to grow again.
+ */
+parserutils_error parserutils_buffer_shrink(parserutils_buffer *buffer)
+{
+	size_t size;
+	uint8_t *temp;
+
+	if (buffer == NULL)
+		return PARSERUTILS_BADPARM;
+
+	size = buffer->allocated + (buffer->data - buffer->base);
+
+	while (size / 2 >= DEFAULT_SIZE && buffer->length <= size / 4)
+		size /= 2;
+
+	if (size == buffer->allocated + (size_t) (buffer->data - buffer->base))
+		return PARSERUTILS_OK;
+
+	parserutils_buffer_compact(buffer);
+
+	temp = buffer->alloc(buffer->base, size, buffer->pw);
+	if (temp == NULL)
+		return PARSERUTILS_NOMEM;
+
+	buffer->data = temp;
+	buffer->base = temp;
+	buffer->allocated = size;
+
 	return PARSERUTILS_OK;
 }
 
@@ -188,9 +360,46 @@ parserutils_error parserutils_buffer_randomise(parserutils_buffer *buffer)
 	/* buffer->alloc(buffer->data, 0, buffer->pw); */
 
 	buffer->data = temp;
+	buffer->base = temp;
 #endif
 
 
 	return PARSERUTILS_OK;
 }
 
+
+/**
+ * Move a memory buffer's data to the start of its allocation
+ *
+ * \param buffer  The buffer to compact
+ */
+void parserutils_buffer_compact(parserutils_buffer *buffer)
+{
+	if (buffer->data == buffer->base)
+		return;
+
+	memmove(buffer->base, buffer->data, buffer->length);
+	buffer->moved += buffer->length;
+
+	buffer->allocated += buffer->data - buffer->base;
+	buffer->data = buffer->base;
+}
+
+/**
+ * Reclaim discarded space, if needed to accommodate more data
+ *
+ * \param buffer  The buffer to consider
+ * \param len     The number of bytes about to be added
+ *
+ * Space is only reclaimed if there is at least as much of it as there is
+ * data to move, so the cost of compaction is bounded by the number of bytes
+ * previously discarded.
+ */
+void parserutils_buffer_reclaim(parserutils_buffer *buffer, size_t len)
+{
+	size_t discarded = buffer->data - buffer->base;
+
+	if (len >= buffer->allocated - buffer->length &&
+			discarded >= buffer->length)
+		parserutils_buffer_compact(buffer);
+}
@@ -0,0 +1,81 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <string.h>
+
+#include <parserutils/utils/byteset.h>
+
+#include "utils/simd.h"
+
+/**
+ * Compile a set of bytes to scan for
+ *
+ * \param set    Pointer to set to initialise
+ * \param bytes  The members of the set
+ * \param count  Number of members
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters
+ *
+ * Members must be ASCII, so that a match in UTF-8 text always starts a
+ * character. A member may be listed more than once. Sets of at most
+ * PARSERUTILS_BYTESET_DIRECT distinct members are scanned fastest.
+ */
+parserutils_error parserutils_byteset_init(parserutils_byteset *set,
+		const uint8_t *bytes, size_t count)
+{
+	size_t i;
+
+	if (set == NULL || (bytes == NULL && count != 0))
+		return PARSERUTILS_BADPARM;
+
+	memset(set, 0, sizeof(*set));
+
+	for (i = 0; i < count; i++) {
+		uint8_t c = bytes[i];
+
+		if (c >= 0x80)
+			return PARSERUTILS_BADPARM;
+
+		if (set->map[c >> 5] & (1u << (c & 31)))
+			continue;
+
+		set->map[c >> 5] |= 1u << (c & 31);
+
+		if (set->count < PARSERUTILS_BYTESET_DIRECT)
+			set->bytes[set->count] = c;
+		set->count++;
+	}
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Find the first member of a set in a string
+ *
+ * \param set   The set to look for
+ * \param data  The string to scan
+ * \param len   Length of string, in bytes
+ * \return Offset of first member, or len if there is none
+ */
+size_t parserutils_byteset_scan(const parserutils_byteset *set,
+		const uint8_t *data, size_t len)
+{
+	size_t off;
+
+	if (set->count <= PARSERUTILS_BYTESET_DIRECT)
+		return simd_find_any(data, len, set->bytes, set->count);
+
+	/* Larger sets are looked up a byte at a time, skipping non-ASCII */
+	for (off = 0; off < len; off++) {
+		uint8_t c = data[off];
+
+		if (c < 0x80 && (set->map[c >> 5] & (1u << (c & 31))))
+			return off;
+	}
+
+	return len;
+}
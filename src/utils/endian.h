@@ -10,9 +10,9 @@
 
 static inline bool endian_host_is_le(void)
 {
-	static uint32_t magic = 0x10000002;
+	static const uint32_t magic = 0x10000002;
 
-	return (((uint8_t *) &magic)[0] == 0x02);
+	return (((const uint8_t *) &magic)[0] == 0x02);
 }
 
 static inline uint32_t endian_swap(uint32_t val)
@@ -21,6 +21,18 @@ static inline uint32_t endian_swap(uint32_t val)
 		((val & 0x0000ff00) << 8) | ((val & 0x000000ff) << 24);
 }
 
+static inline void endian_swap_16(uint8_t *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < len; i += 2) {
+		uint8_t t = s[i];
+
+		s[i] = s[i + 1];
+		s[i + 1] = t;
+	}
+}
+
 static inline uint32_t endian_host_to_big(uint32_t host)
 {
 	if (endian_host_is_le())
@@ -44,6 +44,9 @@ const char *parserutils_error_to_string(parserutils_error error)
 	case PARSERUTILS_EOF:
 		result = "EOF";
 		break;
+	case PARSERUTILS_FULL:
+		result = "Buffer full";
+		break;
 	}
 
 	return result;
@@ -74,6 +77,8 @@ parserutils_error parserutils_error_from_string(const char *str, size_t len)
 		return PARSERUTILS_BADENCODING;
 	} else if (strncmp(str, "PARSERUTILS_EOF", len) == 0) {
 		return PARSERUTILS_EOF;
+	} else if (strncmp(str, "PARSERUTILS_FULL", len) == 0) {
+		return PARSERUTILS_FULL;
 	}
 
 	return PARSERUTILS_OK;
@@ -0,0 +1,430 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <parserutils/utils/hash.h>
+
+#include "utils/simd.h"
+#include "utils/utils.h"
+
+/** Number of slots whose control bytes are examined together */
+#define GROUP_SIZE (16)
+/** Smallest number of slots allocated */
+#define MIN_CAPACITY (GROUP_SIZE)
+
+/** Control byte of a slot which has never been used */
+#define CTRL_EMPTY (0x80)
+/** Control byte of a slot whose entry has been removed */
+#define CTRL_DELETED (0xFE)
+
+/**
+ * Entry in a hash table
+ */
+typedef struct parserutils_hash_slot {
+	const uint8_t *key;		/**< Key data */
+	size_t len;			/**< Length of key, in bytes */
+	void *value;			/**< Value for key */
+} parserutils_hash_slot;
+
+/**
+ * Hash table object
+ *
+ * Slots are grouped, and a key is looked for in a sequence of groups
+ * derived from its hash. Each slot has a control byte holding the low 7 bits
+ * of its key's hash, or marking it as empty or deleted. A whole group's
+ * control bytes are compared at once, so few keys are compared in full. The
+ * search ends at the first group with an empty slot.
+ */
+struct parserutils_hash
+{
+	parserutils_hash_slot *slots;	/**< Slots, a power of two of them */
+	uint8_t *ctrl;			/**< Control byte for each slot */
+	size_t capacity;		/**< Number of slots */
+	size_t count;			/**< Number of entries */
+	size_t used;			/**< Number of slots not empty */
+
+	parserutils_alloc alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client-specific data */
+};
+
+static inline uint32_t parserutils_hash_bytes(const uint8_t *data,
+		size_t len);
+static inline parserutils_hash_slot *parserutils_hash_lookup(
+		const parserutils_hash *hash, const uint8_t *key, size_t len,
+		uint32_t h);
+static inline size_t parserutils_hash_free_slot(const parserutils_hash *hash,
+		uint32_t h);
+static parserutils_error parserutils_hash_resize(parserutils_hash *hash,
+		size_t capacity);
+
+/**
+ * Create a hash table
+ *
+ * \param alloc  Memory (de)allocation function
+ * \param pw     Pointer to client-specific private data
+ * \param hash   Pointer to location to receive hash table instance
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ *
+ * No slots are allocated until the first insertion.
+ */
+parserutils_error parserutils_hash_create(parserutils_alloc alloc, void *pw,
+		parserutils_hash **hash)
+{
+	parserutils_hash *h;
+
+	if (alloc == NULL || hash == NULL)
+		return PARSERUTILS_BADPARM;
+
+	h = alloc(NULL, sizeof(parserutils_hash), pw);
+	if (h == NULL)
+		return PARSERUTILS_NOMEM;
+
+	h->slots = NULL;
+	h->ctrl = NULL;
+	h->capacity = 0;
+	h->count = 0;
+	h->used = 0;
+
+	h->alloc = alloc;
+	h->pw = pw;
+
+	*hash = h;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Destroy a hash table
+ *
+ * \param hash  The hash table to destroy
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * Neither the keys nor the values are freed.
+ */
+parserutils_error parserutils_hash_destroy(parserutils_hash *hash)
+{
+	if (hash == NULL)
+		return PARSERUTILS_BADPARM;
+
+	if (hash->slots != NULL)
+		hash->alloc(hash->slots, 0, hash->pw);
+	hash->alloc(hash, 0, hash->pw);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Insert an entry into a hash table, or replace the value of an existing one
+ *
+ * \param hash   The hash table to insert into
+ * \param key    The key, which must remain valid until it is removed or the
+ *               hash table is destroyed
+ * \param len    Length of key, in bytes
+ * \param value  Value to associate with the key
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error parserutils_hash_insert(parserutils_hash *hash,
+		const uint8_t *key, size_t len, void *value)
+{
+	parserutils_hash_slot *slot;
+	parserutils_error error;
+	uint32_t h;
+	size_t index;
+
+	if (hash == NULL || (key == NULL && len > 0))
+		return PARSERUTILS_BADPARM;
+
+	h = parserutils_hash_bytes(key, len);
+
+	slot = parserutils_hash_lookup(hash, key, len, h);
+	if (slot != NULL) {
+		slot->value = value;
+		return PARSERUTILS_OK;
+	}
+
+	/* Keep at least one slot in eight empty, so lookups end early */
+	if ((hash->used + 1) * 8 > hash->capacity * 7) {
+		size_t capacity = max(hash->capacity, MIN_CAPACITY);
+
+		/* Grow, unless removing deleted entries would suffice */
+		if ((hash->count + 1) * 2 > capacity) {
+			if (capacity > SIZE_MAX / 2 /
+					sizeof(parserutils_hash_slot))
+				return PARSERUTILS_NOMEM;
+			capacity *= 2;
+		}
+
+		error = parserutils_hash_resize(hash, capacity);
+		if (error != PARSERUTILS_OK)
+			return error;
+	}
+
+	index = parserutils_hash_free_slot(hash, h);
+
+	if (hash->ctrl[index] == CTRL_EMPTY)
+		hash->used++;
+	hash->count++;
+
+	hash->ctrl[index] = h & 0x7F;
+	hash->slots[index].key = key;
+	hash->slots[index].len = len;
+	hash->slots[index].value = value;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Find the value associated with a key in a hash table
+ *
+ * \param hash   The hash table to look in
+ * \param key    The key to look for
+ * \param len    Length of key, in bytes
+ * \param value  Pointer to location to receive value, or NULL
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_INVALID if the key is not present,
+ *         PARSERUTILS_BADPARM on bad parameters
+ */
+parserutils_error parserutils_hash_find(const parserutils_hash *hash,
+		const uint8_t *key, size_t len, void **value)
+{
+	parserutils_hash_slot *slot;
+
+	if (hash == NULL || (key == NULL && len > 0))
+		return PARSERUTILS_BADPARM;
+
+	slot = parserutils_hash_lookup(hash, key, len,
+			parserutils_hash_bytes(key, len));
+	if (slot == NULL)
+		return PARSERUTILS_INVALID;
+
+	if (value != NULL)
+		*value = slot->value;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Remove an entry from a hash table
+ *
+ * \param hash  The hash table to remove from
+ * \param key   The key of the entry to remove
+ * \param len   Length of key, in bytes
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_INVALID if the key is not present,
+ *         PARSERUTILS_BADPARM on bad parameters
+ */
+parserutils_error parserutils_hash_remove(parserutils_hash *hash,
+		const uint8_t *key, size_t len)
+{
+	parserutils_hash_slot *slot;
+	size_t index, group;
+
+	if (hash == NULL || (key == NULL && len > 0))
+		return PARSERUTILS_BADPARM;
+
+	slot = parserutils_hash_lookup(hash, key, len,
+			parserutils_hash_bytes(key, len));
+	if (slot == NULL)
+		return PARSERUTILS_INVALID;
+
+	index = slot - hash->slots;
+	group = index & ~((size_t) GROUP_SIZE - 1);
+
+	/* If the group already has an empty slot, no lookup can have
+	 * passed it, so this slot may be emptied too */
+	if (simd_match_byte16(hash->ctrl + group, CTRL_EMPTY) != 0) {
+		hash->ctrl[index] = CTRL_EMPTY;
+		hash->used--;
+	} else {
+		hash->ctrl[index] = CTRL_DELETED;
+	}
+
+	hash->count--;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Retrieve the number of entries in a hash table
+ *
+ * \param hash   The hash table to interrogate
+ * \param count  Pointer to location to receive number of entries
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error parserutils_hash_get_count(const parserutils_hash *hash,
+		size_t *count)
+{
+	if (hash == NULL || count == NULL)
+		return PARSERUTILS_BADPARM;
+
+	*count = hash->count;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Hash a byte string
+ *
+ * \param data  The data to hash
+ * \param len   Length of data, in bytes
+ * \return Hash of data
+ *
+ * The data is consumed a machine word at a time, so the hash of a given
+ * string depends upon the host's byte order.
+ */
+uint32_t parserutils_hash_bytes(const uint8_t *data, size_t len)
+{
+	uint64_t h = UINT64_C(0x9E3779B97F4A7C15) ^ len;
+	uint64_t word;
+
+	for (; len >= sizeof(word); data += sizeof(word), len -= sizeof(word)) {
+		memcpy(&word, data, sizeof(word));
+		h = (h ^ word) * UINT64_C(0xFF51AFD7ED558CCD);
+		h ^= h >> 32;
+	}
+
+	if (len > 0) {
+		word = 0;
+		memcpy(&word, data, len);
+		h = (h ^ word) * UINT64_C(0xFF51AFD7ED558CCD);
+	}
+
+	h ^= h >> 33;
+	h *= UINT64_C(0xC4CEB9FE1A85EC53);
+	h ^= h >> 29;
+
+	return (uint32_t) h;
+}
+
+/**
+ * Find the slot holding a key
+ *
+ * \param hash  The hash table to look in
+ * \param key   The key to look for
+ * \param len   Length of key, in bytes
+ * \param h     Hash of key
+ * \return Pointer to slot, or NULL if the key is not present
+ */
+parserutils_hash_slot *parserutils_hash_lookup(const parserutils_hash *hash,
+		const uint8_t *key, size_t len, uint32_t h)
+{
+	size_t mask = hash->capacity / GROUP_SIZE - 1;
+	size_t group = (h >> 7) & mask;
+	size_t step = 0;
+
+	if (hash->capacity == 0)
+		return NULL;
+
+	/* Triangular probing visits every group, and there's always an
+	 * empty slot, so this terminates */
+	while (true) {
+		const uint8_t *ctrl = hash->ctrl + group * GROUP_SIZE;
+		uint32_t match = simd_match_byte16(ctrl, h & 0x7F);
+
+		while (match != 0) {
+			size_t index = group * GROUP_SIZE +
+					__builtin_ctz(match);
+			parserutils_hash_slot *slot = &hash->slots[index];
+
+			if (slot->len == len && (len == 0 ||
+					memcmp(slot->key, key, len) == 0))
+				return slot;
+
+			match &= match - 1;
+		}
+
+		if (simd_match_byte16(ctrl, CTRL_EMPTY) != 0)
+			return NULL;
+
+		step++;
+		group = (group + step) & mask;
+	}
+}
+
+/**
+ * Find a slot in which to insert a key
+ *
+ * \param hash  The hash table to look in, which must have an empty slot
+ * \param h     Hash of key
+ * \return Index of the first empty or deleted slot in the key's sequence
+ */
+size_t parserutils_hash_free_slot(const parserutils_hash *hash, uint32_t h)
+{
+	size_t mask = hash->capacity / GROUP_SIZE - 1;
+	size_t group = (h >> 7) & mask;
+	size_t step = 0;
+
+	while (true) {
+		const uint8_t *ctrl = hash->ctrl + group * GROUP_SIZE;
+		uint32_t match = simd_match_byte16(ctrl, CTRL_EMPTY) |
+				simd_match_byte16(ctrl, CTRL_DELETED);
+
+		if (match != 0)
+			return group * GROUP_SIZE + __builtin_ctz(match);
+
+		step++;
+		group = (group + step) & mask;
+	}
+}
+
+/**
+ * Reallocate a hash table's slots, and reinsert its entries
+ *
+ * \param hash      The hash table to resize
+ * \param capacity  New number of slots, a power of two at least
+ *                  MIN_CAPACITY and more than the number of entries
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ *
+ * Deleted entries are discarded.
+ */
+parserutils_error parserutils_hash_resize(parserutils_hash *hash,
+		size_t capacity)
+{
+	parserutils_hash_slot *old_slots = hash->slots;
+	uint8_t *old_ctrl = hash->ctrl;
+	size_t old_capacity = hash->capacity;
+	size_t i;
+
+	/* Slots and control bytes share an allocation */
+	hash->slots = hash->alloc(NULL, capacity *
+			(sizeof(parserutils_hash_slot) + 1), hash->pw);
+	if (hash->slots == NULL) {
+		hash->slots = old_slots;
+		return PARSERUTILS_NOMEM;
+	}
+
+	hash->ctrl = (uint8_t *) (hash->slots + capacity);
+	memset(hash->ctrl, CTRL_EMPTY, capacity);
+	hash->capacity = capacity;
+	hash->used = hash->count;
+
+	for (i = 0; i < old_capacity; i++) {
+		size_t index;
+
+		if (old_ctrl[i] & 0x80)
+			continue;
+
+		index = parserutils_hash_free_slot(hash,
+				parserutils_hash_bytes(old_slots[i].key,
+				old_slots[i].len));
+
+		hash->ctrl[index] = old_ctrl[i];
+		hash->slots[index] = old_slots[i];
+	}
+
+	if (old_slots != NULL)
+		hash->alloc(old_slots, 0, hash->pw);
+
+	return PARSERUTILS_OK;
+}
+
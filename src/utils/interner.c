@@ -0,0 +1,257 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <parserutils/utils/hash.h>
+#include <parserutils/utils/interner.h>
+
+/** Size of a block from which strings are allocated */
+#define BLOCK_SIZE (4096)
+/** Largest string allocated from a shared block */
+#define MAX_SHARED (BLOCK_SIZE / 8)
+
+/**
+ * Block of interned strings
+ */
+typedef struct parserutils_interner_block {
+	struct parserutils_interner_block *next;	/**< Next block */
+	size_t used;			/**< Bytes used, after the header */
+	size_t size;			/**< Bytes available, after the header */
+
+	parserutils_interned align;	/**< Aligns the strings that follow */
+} parserutils_interner_block;
+
+/**
+ * String interner object
+ *
+ * Each string is stored once, immediately after its parserutils_interned,
+ * in blocks which are only freed when the interner is destroyed. The hash
+ * table maps the strings to their parserutils_interned.
+ */
+struct parserutils_interner
+{
+	parserutils_hash *hash;		/**< Strings, by content */
+	parserutils_interner_block *blocks;	/**< Blocks, most recent first */
+
+	parserutils_alloc alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client-specific data */
+};
+
+static inline parserutils_interned *parserutils_interner_store(
+		parserutils_interner *interner, const uint8_t *data,
+		size_t len);
+
+/**
+ * Create a string interner
+ *
+ * \param alloc     Memory (de)allocation function
+ * \param pw        Pointer to client-specific private data
+ * \param interner  Pointer to location to receive interner instance
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ */
+parserutils_error parserutils_interner_create(parserutils_alloc alloc,
+		void *pw, parserutils_interner **interner)
+{
+	parserutils_interner *i;
+	parserutils_error error;
+
+	if (alloc == NULL || interner == NULL)
+		return PARSERUTILS_BADPARM;
+
+	i = alloc(NULL, sizeof(parserutils_interner), pw);
+	if (i == NULL)
+		return PARSERUTILS_NOMEM;
+
+	error = parserutils_hash_create(alloc, pw, &i->hash);
+	if (error != PARSERUTILS_OK) {
+		alloc(i, 0, pw);
+		return error;
+	}
+
+	i->blocks = NULL;
+
+	i->alloc = alloc;
+	i->pw = pw;
+
+	*interner = i;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Destroy a string interner, and all the strings interned in it
+ *
+ * \param interner  The interner to destroy
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error parserutils_interner_destroy(parserutils_interner *interner)
+{
+	parserutils_interner_block *block, *next;
+
+	if (interner == NULL)
+		return PARSERUTILS_BADPARM;
+
+	for (block = interner->blocks; block != NULL; block = next) {
+		next = block->next;
+		interner->alloc(block, 0, interner->pw);
+	}
+
+	parserutils_hash_destroy(interner->hash);
+	interner->alloc(interner, 0, interner->pw);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Intern a string
+ *
+ * \param interner  The interner to use
+ * \param data      The string data, which need not be NUL-terminated
+ * \param len       Length of string, in bytes
+ * \param str       Pointer to location to receive interned string
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ *
+ * The interned string remains valid until the interner is destroyed.
+ */
+parserutils_error parserutils_interner_intern(parserutils_interner *interner,
+		const uint8_t *data, size_t len,
+		const parserutils_interned **str)
+{
+	parserutils_interned *s;
+	parserutils_error error;
+	void *value;
+
+	if (interner == NULL || (data == NULL && len > 0) || str == NULL)
+		return PARSERUTILS_BADPARM;
+
+	if (parserutils_hash_find(interner->hash, data, len, &value) ==
+			PARSERUTILS_OK) {
+		*str = value;
+		return PARSERUTILS_OK;
+	}
+
+	s = parserutils_interner_store(interner, data, len);
+	if (s == NULL)
+		return PARSERUTILS_NOMEM;
+
+	/* The stored string is left in its block if this fails; it's
+	 * reclaimed when the interner is destroyed */
+	error = parserutils_hash_insert(interner->hash, s->data, len, s);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	*str = s;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Find a string, if it has been interned
+ *
+ * \param interner  The interner to look in
+ * \param data      The string data
+ * \param len       Length of string, in bytes
+ * \param str       Pointer to location to receive interned string
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_INVALID if the string has not been interned,
+ *         PARSERUTILS_BADPARM on bad parameters
+ */
+parserutils_error parserutils_interner_find(
+		const parserutils_interner *interner,
+		const uint8_t *data, size_t len,
+		const parserutils_interned **str)
+{
+	parserutils_error error;
+	void *value;
+
+	if (interner == NULL || str == NULL)
+		return PARSERUTILS_BADPARM;
+
+	error = parserutils_hash_find(interner->hash, data, len, &value);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	*str = value;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Store a copy of a string in an interner's blocks
+ *
+ * \param interner  The interner to store the string in
+ * \param data      The string data
+ * \param len       Length of string, in bytes
+ * \return Pointer to the stored string, or NULL on memory exhaustion
+ *
+ * Large strings are given blocks of their own, behind the current block.
+ */
+parserutils_interned *parserutils_interner_store(
+		parserutils_interner *interner, const uint8_t *data,
+		size_t len)
+{
+	parserutils_interner_block *block = interner->blocks;
+	parserutils_interned *s;
+	uint8_t *mem;
+	size_t size;
+
+	if (len > SIZE_MAX - sizeof(parserutils_interner_block) -
+			2 * sizeof(parserutils_interned))
+		return NULL;
+
+	/* Keep each parserutils_interned aligned */
+	size = (sizeof(parserutils_interned) + len + 1 +
+			sizeof(parserutils_interned) - 1) /
+			sizeof(parserutils_interned) *
+			sizeof(parserutils_interned);
+
+	if (block == NULL || block->size - block->used < size) {
+		size_t avail = (size > MAX_SHARED) ? size : BLOCK_SIZE -
+				offsetof(parserutils_interner_block, align);
+		parserutils_interner_block *b;
+
+		b = interner->alloc(NULL,
+				offsetof(parserutils_interner_block, align) +
+				avail, interner->pw);
+		if (b == NULL)
+			return NULL;
+
+		b->used = 0;
+		b->size = avail;
+
+		if (size > MAX_SHARED && block != NULL) {
+			b->next = block->next;
+			block->next = b;
+		} else {
+			b->next = block;
+			interner->blocks = b;
+		}
+
+		block = b;
+	}
+
+	/* The strings follow the header, starting at its align member */
+	mem = (uint8_t *) block + offsetof(parserutils_interner_block, align) +
+			block->used;
+	block->used += size;
+
+	if (len > 0)
+		memcpy(mem + sizeof(parserutils_interned), data, len);
+	mem[sizeof(parserutils_interned) + len] = '\0';
+
+	s = (parserutils_interned *) (void *) mem;
+	s->data = mem + sizeof(parserutils_interned);
+	s->len = len;
+
+	return s;
+}
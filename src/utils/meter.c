@@ -0,0 +1,223 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2008 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <parserutils/utils/meter.h>
+
+/**
+ * Header preceding each allocated block
+ */
+typedef union parserutils_meter_header {
+	size_t size;			/**< Size of block, as requested */
+
+	/* Ensure the data that follows is suitably aligned */
+	uintmax_t align_int;
+	long double align_float;
+	void *align_ptr;
+} parserutils_meter_header;
+
+/**
+ * Meter object
+ */
+struct parserutils_meter
+{
+	size_t current;			/**< Bytes allocated now */
+	size_t peak;			/**< Most bytes allocated at once */
+	size_t limit;			/**< Allocation limit, or 0 */
+	uint32_t refused;		/**< Allocations refused */
+
+	parserutils_alloc alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client-specific data */
+};
+
+/**
+ * Create a meter
+ *
+ * \param alloc   Memory (de)allocation function
+ * \param pw      Pointer to client-specific private data
+ * \param meter   Pointer to location to receive meter instance
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ *
+ * Memory is obtained from alloc by parserutils_meter_alloc, which counts
+ * the bytes requested of it, so giving it to an object's constructor
+ * measures all the memory the object and those it creates have allocated:
+ * an input stream's buffers, charset filter and codecs, for example, or a
+ * stack's items. Memory allocated by the system's iconv, or by a charset
+ * pool given to a stream, is not counted.
+ *
+ * The meter itself, and the header preceding each block, are not counted.
+ */
+parserutils_error parserutils_meter_create(parserutils_alloc alloc, void *pw,
+		parserutils_meter **meter)
+{
+	parserutils_meter *m;
+
+	if (alloc == NULL || meter == NULL)
+		return PARSERUTILS_BADPARM;
+
+	m = alloc(NULL, sizeof(parserutils_meter), pw);
+	if (m == NULL)
+		return PARSERUTILS_NOMEM;
+
+	m->current = 0;
+	m->peak = 0;
+	m->limit = 0;
+	m->refused = 0;
+
+	m->alloc = alloc;
+	m->pw = pw;
+
+	*meter = m;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Destroy a meter
+ *
+ * \param meter  The meter to destroy
+ * \return PARSERUTILS_OK on success, appropriate error otherwise.
+ *
+ * Everything allocated through the meter must have been freed first.
+ */
+parserutils_error parserutils_meter_destroy(parserutils_meter *meter)
+{
+	if (meter == NULL)
+		return PARSERUTILS_BADPARM;
+
+	meter->alloc(meter, 0, meter->pw);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Limit the memory that may be allocated through a meter
+ *
+ * \param meter  The meter to limit
+ * \param limit  Most bytes that may be allocated at once, or 0 for no limit
+ * \return PARSERUTILS_OK on success, appropriate error otherwise.
+ *
+ * Allocations which would take the meter past its limit fail, as if the
+ * memory were exhausted, so the objects using the meter report
+ * PARSERUTILS_NOMEM. A limit below current use leaves what's allocated
+ * alone, only refusing more.
+ */
+parserutils_error parserutils_meter_set_limit(parserutils_meter *meter,
+		size_t limit)
+{
+	if (meter == NULL)
+		return PARSERUTILS_BADPARM;
+
+	meter->limit = limit;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Read a meter's measurements
+ *
+ * \param meter  The meter to read
+ * \param usage  Pointer to location to receive measurements
+ * \return PARSERUTILS_OK on success, appropriate error otherwise.
+ */
+parserutils_error parserutils_meter_get_usage(parserutils_meter *meter,
+		parserutils_meter_usage *usage)
+{
+	if (meter == NULL || usage == NULL)
+		return PARSERUTILS_BADPARM;
+
+	usage->current = meter->current;
+	usage->peak = meter->peak;
+	usage->limit = meter->limit;
+	usage->refused = meter->refused;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Start measuring a meter's peak afresh
+ *
+ * \param meter  The meter to reset
+ * \return PARSERUTILS_OK on success, appropriate error otherwise.
+ *
+ * The peak becomes the current use, and the count of refused allocations
+ * is cleared, so that the use of each document read by a reused object
+ * may be seen.
+ */
+parserutils_error parserutils_meter_reset_peak(parserutils_meter *meter)
+{
+	if (meter == NULL)
+		return PARSERUTILS_BADPARM;
+
+	meter->peak = meter->current;
+	meter->refused = 0;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Allocate, resize or free memory through a meter
+ *
+ * \param ptr  Block to resize or free, or NULL to allocate
+ * \param len  Size of block required, or 0 to free ptr
+ * \param pw   The meter
+ * \return Pointer to block, or NULL on failure or when freeing
+ *
+ * This has the semantics of realloc, so may be passed to any parserutils
+ * constructor as its alloc function, with the meter as its pw. A block
+ * which can't be resized is left as it was.
+ */
+void *parserutils_meter_alloc(void *ptr, size_t len, void *pw)
+{
+	parserutils_meter *meter = pw;
+	parserutils_meter_header *header = NULL;
+	size_t old = 0;
+
+	if (ptr != NULL) {
+		header = ((parserutils_meter_header *) ptr) - 1;
+		old = header->size;
+	}
+
+	if (len == 0) {
+		if (header != NULL) {
+			meter->current -= old;
+			meter->alloc(header, 0, meter->pw);
+		}
+
+		return NULL;
+	}
+
+	if (len > SIZE_MAX - sizeof(parserutils_meter_header))
+		return NULL;
+
+	/* Refuse to grow past the limit */
+	if (len > old && meter->limit != 0 &&
+			(meter->current >= meter->limit ||
+			len - old > meter->limit - meter->current)) {
+		meter->refused++;
+		return NULL;
+	}
+
+	header = meter->alloc(header, sizeof(parserutils_meter_header) + len,
+			meter->pw);
+	if (header == NULL)
+		return NULL;
+
+	header->size = len;
+
+	meter->current = meter->current - old + len;
+	if (meter->current > meter->peak)
+		meter->peak = meter->current;
+
+	return header + 1;
+}
+
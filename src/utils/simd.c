@@ -0,0 +1,897 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/simd.h"
+
+static size_t ascii_prefix_scalar(const uint8_t *s, size_t len);
+static size_t below_prefix_scalar(const uint8_t *s, size_t len,
+		uint8_t limit);
+static void ascii_to_ucs4_scalar(const uint8_t *s, size_t len, bool le,
+		uint8_t *dest);
+static size_t utf16_ascii_to_utf8_scalar(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest);
+static size_t utf32_ascii_to_utf8_scalar(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest);
+static size_t find_any_scalar(const uint8_t *s, size_t len,
+		const uint8_t *bytes, size_t count);
+static void utf8_counts_scalar(const uint8_t *s, size_t len,
+		size_t *lines, size_t *cont, size_t *four);
+static size_t utf8_skip_scalar(const uint8_t *s, size_t len, size_t *n);
+
+#ifdef SIMD_SSE2
+static size_t ascii_prefix_sse2(const uint8_t *s, size_t len);
+static size_t below_prefix_sse2(const uint8_t *s, size_t len,
+		uint8_t limit);
+static void ascii_to_ucs4_sse2(const uint8_t *s, size_t len, bool le,
+		uint8_t *dest);
+static size_t utf16_ascii_to_utf8_sse2(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest);
+static size_t utf32_ascii_to_utf8_sse2(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest);
+static size_t find_any_sse2(const uint8_t *s, size_t len,
+		const uint8_t *bytes, size_t count);
+static void utf8_counts_sse2(const uint8_t *s, size_t len,
+		size_t *lines, size_t *cont, size_t *four);
+static size_t utf8_skip_sse2(const uint8_t *s, size_t len, size_t *n);
+#endif
+
+#ifdef SIMD_AVX2
+static void ascii_to_ucs4_avx2(const uint8_t *s, size_t len, bool le,
+		uint8_t *dest);
+static void utf8_counts_avx2(const uint8_t *s, size_t len,
+		size_t *lines, size_t *cont, size_t *four);
+static size_t utf8_skip_avx2(const uint8_t *s, size_t len, size_t *n);
+#endif
+
+#ifdef SIMD_NEON
+static size_t ascii_prefix_neon(const uint8_t *s, size_t len);
+static size_t below_prefix_neon(const uint8_t *s, size_t len,
+		uint8_t limit);
+static void ascii_to_ucs4_neon(const uint8_t *s, size_t len, bool le,
+		uint8_t *dest);
+static size_t utf16_ascii_to_utf8_neon(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest);
+static size_t utf32_ascii_to_utf8_neon(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest);
+static size_t find_any_neon(const uint8_t *s, size_t len,
+		const uint8_t *bytes, size_t count);
+static void utf8_counts_neon(const uint8_t *s, size_t len,
+		size_t *lines, size_t *cont, size_t *four);
+static size_t utf8_skip_neon(const uint8_t *s, size_t len, size_t *n);
+#endif
+
+static bool cpu_supports(parserutils_simd_level level);
+
+static const parserutils_simd_kernels scalar = {
+	"scalar",
+	ascii_prefix_scalar, below_prefix_scalar, ascii_to_ucs4_scalar,
+	utf16_ascii_to_utf8_scalar, utf32_ascii_to_utf8_scalar,
+	find_any_scalar, utf8_counts_scalar, utf8_skip_scalar
+};
+
+#ifdef SIMD_SSE2
+static const parserutils_simd_kernels sse2 = {
+	"sse2",
+	ascii_prefix_sse2, below_prefix_sse2, ascii_to_ucs4_sse2,
+	utf16_ascii_to_utf8_sse2, utf32_ascii_to_utf8_sse2,
+	find_any_sse2, utf8_counts_sse2, utf8_skip_sse2
+};
+#endif
+
+#ifdef SIMD_AVX2
+/* Narrowing gains little from wider vectors, so is left to SSE2 */
+static const parserutils_simd_kernels avx2 = {
+	"avx2",
+	parserutils__simd_avx2_ascii_prefix,
+	parserutils__simd_avx2_below_prefix, ascii_to_ucs4_avx2,
+	utf16_ascii_to_utf8_sse2, utf32_ascii_to_utf8_sse2,
+	parserutils__simd_avx2_find_any, utf8_counts_avx2, utf8_skip_avx2
+};
+#endif
+
+#ifdef SIMD_NEON
+static const parserutils_simd_kernels neon = {
+	"neon",
+	ascii_prefix_neon, below_prefix_neon, ascii_to_ucs4_neon,
+	utf16_ascii_to_utf8_neon, utf32_ascii_to_utf8_neon,
+	find_any_neon, utf8_counts_neon, utf8_skip_neon
+};
+#endif
+
+/**
+ * Implementations built, by level
+ */
+static const parserutils_simd_kernels *const
+		levels[PARSERUTILS_SIMD_LEVELS] = {
+	&scalar,
+#ifdef SIMD_SSE2
+	&sse2,
+#else
+	NULL,
+#endif
+#ifdef SIMD_AVX2
+	&avx2,
+#else
+	NULL,
+#endif
+#ifdef SIMD_NEON
+	&neon,
+#else
+	NULL,
+#endif
+};
+
+#if defined(__GNUC__)
+static void simd_choose(void) __attribute__((constructor));
+
+const parserutils_simd_kernels *parserutils__simd;
+#elif defined(SIMD_SSE2)
+const parserutils_simd_kernels *const parserutils__simd = &sse2;
+#elif defined(SIMD_NEON)
+const parserutils_simd_kernels *const parserutils__simd = &neon;
+#else
+const parserutils_simd_kernels *const parserutils__simd = &scalar;
+#endif
+
+/**
+ * Retrieve the implementations using an instruction set
+ *
+ * \param level  The instruction set
+ * \return The implementations, or NULL if they weren't built, or the CPU
+ *         doesn't support the instruction set
+ */
+const parserutils_simd_kernels *parserutils__simd_kernels(
+		parserutils_simd_level level)
+{
+	if ((unsigned int) level >= PARSERUTILS_SIMD_LEVELS ||
+			levels[level] == NULL || !cpu_supports(level))
+		return NULL;
+
+	return levels[level];
+}
+
+/**
+ * Choose the implementations to use
+ *
+ * \return The implementations chosen
+ *
+ * These are those named by PARSERUTILS_SIMD in the environment, if it names
+ * a supported set, or else the best supported.
+ */
+const parserutils_simd_kernels *parserutils__simd_resolve(void)
+{
+	const parserutils_simd_kernels *k = NULL;
+	const char *want = getenv("PARSERUTILS_SIMD");
+	int level;
+
+	if (want != NULL) {
+		for (level = 0; level < PARSERUTILS_SIMD_LEVELS; level++) {
+			if (levels[level] != NULL &&
+					strcmp(levels[level]->name, want) == 0)
+				k = parserutils__simd_kernels(level);
+		}
+	}
+
+	/* Later levels are better */
+	for (level = PARSERUTILS_SIMD_LEVELS - 1; k == NULL; level--)
+		k = parserutils__simd_kernels(level);
+
+	return k;
+}
+
+#if defined(__GNUC__)
+/**
+ * Choose the implementations to use, as the library is loaded
+ *
+ * This is the only write to global state, and happens before any thread
+ * the client creates can read it.
+ */
+void simd_choose(void)
+{
+	parserutils__simd = parserutils__simd_resolve();
+}
+#endif
+
+/**
+ * Determine whether the CPU supports an instruction set
+ *
+ * \param level  The instruction set
+ * \return Whether the CPU (and OS) support it
+ */
+bool cpu_supports(parserutils_simd_level level)
+{
+	switch (level) {
+	case PARSERUTILS_SIMD_SCALAR:
+		return true;
+#ifdef SIMD_SSE2
+	case PARSERUTILS_SIMD_SSE2:
+		/* Required by the build */
+		return true;
+#endif
+#ifdef SIMD_AVX2
+	case PARSERUTILS_SIMD_AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") &&
+				__builtin_cpu_supports("popcnt");
+#endif
+#ifdef SIMD_NEON
+	case PARSERUTILS_SIMD_NEON:
+		/* Part of AArch64 */
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+/******************************************************************************
+ * Portable implementations                                                   *
+ ******************************************************************************/
+
+size_t ascii_prefix_scalar(const uint8_t *s, size_t len)
+{
+	size_t off = 0;
+
+	for (; off + 8 <= len; off += 8) {
+		uint64_t word;
+
+		memcpy(&word, s + off, sizeof(word));
+		if ((word & UINT64_C(0x8080808080808080)) != 0)
+			break;
+	}
+
+	/* Locate the exact position within the final block */
+	while (off < len && s[off] < 0x80)
+		off++;
+
+	return off;
+}
+
+size_t below_prefix_scalar(const uint8_t *s, size_t len, uint8_t limit)
+{
+	/* Skip whole words of ASCII, which are below any limit allowed */
+	size_t off = ascii_prefix_scalar(s, len);
+
+	while (off < len && s[off] < limit)
+		off++;
+
+	return off;
+}
+
+void ascii_to_ucs4_scalar(const uint8_t *s, size_t len, bool le,
+		uint8_t *dest)
+{
+	size_t off;
+
+	for (off = 0; off < len; off++) {
+		uint8_t *d = dest + off * 4;
+
+		d[0] = d[1] = d[2] = d[3] = 0;
+		d[le ? 0 : 3] = s[off];
+	}
+}
+
+size_t utf16_ascii_to_utf8_scalar(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest)
+{
+	size_t off;
+
+	for (off = 0; off < units; off++) {
+		uint16_t unit;
+
+		memcpy(&unit, s + off * 2, sizeof(unit));
+		if (swap)
+			unit = (uint16_t) ((unit >> 8) | (unit << 8));
+
+		if (unit >= 0x80)
+			break;
+
+		dest[off] = (uint8_t) unit;
+	}
+
+	return off;
+}
+
+size_t utf32_ascii_to_utf8_scalar(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest)
+{
+	size_t off;
+
+	for (off = 0; off < units; off++) {
+		uint32_t unit;
+
+		memcpy(&unit, s + off * 4, sizeof(unit));
+		if (swap)
+			unit = (unit >> 24) | ((unit >> 8) & 0xFF00) |
+					((unit << 8) & 0xFF0000) | (unit << 24);
+
+		if (unit >= 0x80)
+			break;
+
+		dest[off] = (uint8_t) unit;
+	}
+
+	return off;
+}
+
+size_t find_any_scalar(const uint8_t *s, size_t len,
+		const uint8_t *bytes, size_t count)
+{
+	const uint64_t ones = UINT64_C(0x0101010101010101);
+	uint64_t needles[8];
+	size_t off = 0, i;
+
+	if (count == 0)
+		return len;
+
+	for (i = 0; i < count; i++)
+		needles[i] = ones * bytes[i];
+
+	for (; off + 8 <= len; off += 8) {
+		uint64_t word, hit = 0;
+
+		memcpy(&word, s + off, sizeof(word));
+
+		/* Non-zero if any byte of word ^ needle is zero */
+		for (i = 0; i < count; i++) {
+			uint64_t x = word ^ needles[i];
+
+			hit |= (x - ones) & ~x & UINT64_C(0x8080808080808080);
+		}
+
+		if (hit != 0)
+			break;
+	}
+
+	/* Locate the exact position within the final block */
+	for (; off < len; off++) {
+		for (i = 0; i < count; i++) {
+			if (s[off] == bytes[i])
+				return off;
+		}
+	}
+
+	return len;
+}
+
+void utf8_counts_scalar(const uint8_t *s, size_t len,
+		size_t *lines, size_t *cont, size_t *four)
+{
+	size_t off, nl = 0, nc = 0, nf = 0;
+
+	for (off = 0; off < len; off++) {
+		nl += (s[off] == '\n');
+		nc += ((s[off] & 0xC0) == 0x80);
+		nf += (s[off] >= 0xF0);
+	}
+
+	*lines = nl;
+	*cont = nc;
+	*four = nf;
+}
+
+size_t utf8_skip_scalar(const uint8_t *s, size_t len, size_t *n)
+{
+	size_t off = 0, left = *n;
+
+	for (; len - off >= 8; off += 8) {
+		uint64_t word, cont;
+		size_t count;
+
+		memcpy(&word, s + off, sizeof(word));
+
+		/* Continuation bytes have the top bit set, and the next clear;
+		 * the multiply sums their flags into the top byte */
+		cont = word & ~(word << 1) & UINT64_C(0x8080808080808080);
+		count = 8 - (size_t) (((cont >> 7) *
+				UINT64_C(0x0101010101010101)) >> 56);
+
+		if (count > left)
+			break;
+
+		left -= count;
+	}
+
+	*n = left;
+
+	return off;
+}
+
+/******************************************************************************
+ * SSE2 implementations                                                       *
+ ******************************************************************************/
+
+#ifdef SIMD_SSE2
+
+size_t ascii_prefix_sse2(const uint8_t *s, size_t len)
+{
+	size_t off = 0;
+
+	for (; off + 16 <= len; off += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + off));
+		uint32_t mask = (uint32_t) _mm_movemask_epi8(v);
+
+		if (mask != 0)
+			return off + __builtin_ctz(mask);
+	}
+
+	while (off < len && s[off] < 0x80)
+		off++;
+
+	return off;
+}
+
+size_t below_prefix_sse2(const uint8_t *s, size_t len, uint8_t limit)
+{
+	const __m128i lim = _mm_set1_epi8((char) limit);
+	size_t off = 0;
+
+	for (; off + 16 <= len; off += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + off));
+		/* Bytes at or above the limit are their maximum */
+		uint32_t mask = (uint32_t) _mm_movemask_epi8(
+				_mm_cmpeq_epi8(_mm_max_epu8(v, lim), v));
+
+		if (mask != 0)
+			return off + __builtin_ctz(mask);
+	}
+
+	while (off < len && s[off] < limit)
+		off++;
+
+	return off;
+}
+
+void ascii_to_ucs4_sse2(const uint8_t *s, size_t len, bool le,
+		uint8_t *dest)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t off = 0;
+
+	for (; off + 16 <= len; off += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + off));
+		uint8_t *d = dest + off * 4;
+
+		if (le) {
+			/* Interleaving zeroes after each byte, twice, gives
+			 * each character as xx 00 00 00 */
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+
+			_mm_storeu_si128((__m128i *) d,
+					_mm_unpacklo_epi16(lo, zero));
+			_mm_storeu_si128((__m128i *) (d + 16),
+					_mm_unpackhi_epi16(lo, zero));
+			_mm_storeu_si128((__m128i *) (d + 32),
+					_mm_unpacklo_epi16(hi, zero));
+			_mm_storeu_si128((__m128i *) (d + 48),
+					_mm_unpackhi_epi16(hi, zero));
+		} else {
+			/* Interleaving zeroes in front of each byte, twice,
+			 * gives each character as 00 00 00 xx */
+			__m128i lo = _mm_unpacklo_epi8(zero, v);
+			__m128i hi = _mm_unpackhi_epi8(zero, v);
+
+			_mm_storeu_si128((__m128i *) d,
+					_mm_unpacklo_epi16(zero, lo));
+			_mm_storeu_si128((__m128i *) (d + 16),
+					_mm_unpackhi_epi16(zero, lo));
+			_mm_storeu_si128((__m128i *) (d + 32),
+					_mm_unpacklo_epi16(zero, hi));
+			_mm_storeu_si128((__m128i *) (d + 48),
+					_mm_unpackhi_epi16(zero, hi));
+		}
+	}
+
+	ascii_to_ucs4_scalar(s + off, len - off, le, dest + off * 4);
+}
+
+size_t utf16_ascii_to_utf8_sse2(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest)
+{
+	/* Bits which must be clear in each unit, as loaded */
+	const __m128i mask = _mm_set1_epi16(swap ? (short) 0x80FF
+						 : (short) 0xFF80);
+	const __m128i zero = _mm_setzero_si128();
+	size_t off = 0;
+
+	for (; off + 8 <= units; off += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + off * 2));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(
+				_mm_and_si128(v, mask), zero)) != 0xFFFF)
+			break;
+
+		if (swap)
+			v = _mm_srli_epi16(v, 8);
+
+		_mm_storel_epi64((__m128i *) (dest + off),
+				_mm_packus_epi16(v, v));
+	}
+
+	return off + utf16_ascii_to_utf8_scalar(s + off * 2, units - off,
+			swap, dest + off);
+}
+
+size_t utf32_ascii_to_utf8_sse2(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest)
+{
+	/* Bits which must be clear in each unit, as loaded */
+	const __m128i mask = _mm_set1_epi32(swap ? (int) 0x80FFFFFF
+						 : (int) 0xFFFFFF80);
+	const __m128i zero = _mm_setzero_si128();
+	size_t off = 0;
+
+	for (; off + 8 <= units; off += 8) {
+		__m128i lo = _mm_loadu_si128((const __m128i *) (s + off * 4));
+		__m128i hi = _mm_loadu_si128((const __m128i *)
+				(s + off * 4 + 16));
+		__m128i v;
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(
+				_mm_or_si128(lo, hi), mask), zero)) != 0xFFFF)
+			break;
+
+		if (swap) {
+			lo = _mm_srli_epi32(lo, 24);
+			hi = _mm_srli_epi32(hi, 24);
+		}
+
+		v = _mm_packs_epi32(lo, hi);
+		_mm_storel_epi64((__m128i *) (dest + off),
+				_mm_packus_epi16(v, v));
+	}
+
+	return off + utf32_ascii_to_utf8_scalar(s + off * 4, units - off,
+			swap, dest + off);
+}
+
+size_t find_any_sse2(const uint8_t *s, size_t len,
+		const uint8_t *bytes, size_t count)
+{
+	__m128i needles[8];
+	size_t off = 0, i;
+
+	if (count == 0)
+		return len;
+
+	for (i = 0; i < count; i++)
+		needles[i] = _mm_set1_epi8((char) bytes[i]);
+
+	for (; off + 16 <= len; off += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + off));
+		__m128i eq = _mm_cmpeq_epi8(v, needles[0]);
+		uint32_t mask;
+
+		for (i = 1; i < count; i++)
+			eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, needles[i]));
+
+		mask = (uint32_t) _mm_movemask_epi8(eq);
+		if (mask != 0)
+			return off + __builtin_ctz(mask);
+	}
+
+	return off + find_any_scalar(s + off, len - off, bytes, count);
+}
+
+void utf8_counts_sse2(const uint8_t *s, size_t len,
+		size_t *lines, size_t *cont, size_t *four)
+{
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i c0 = _mm_set1_epi8((char) 0xC0);
+	const __m128i f0 = _mm_set1_epi8((char) 0xF0);
+	const __m128i zero = _mm_setzero_si128();
+	size_t off = 0, nl = 0, nc = 0, nf = 0;
+
+	while (len - off >= 16) {
+		size_t blocks = (len - off) / 16, i;
+		__m128i al = zero, ac = zero, af = zero;
+
+		/* Counts are kept per byte lane, so at most 255 blocks fit */
+		if (blocks > 255)
+			blocks = 255;
+
+		for (i = 0; i < blocks; i++, off += 16) {
+			__m128i v = _mm_loadu_si128(
+					(const __m128i *) (s + off));
+
+			al = _mm_sub_epi8(al, _mm_cmpeq_epi8(v, lf));
+			/* Bytes 0x80-0xBF are those below 0xC0, signed */
+			ac = _mm_sub_epi8(ac, _mm_cmplt_epi8(v, c0));
+			af = _mm_sub_epi8(af, _mm_cmpeq_epi8(
+					_mm_max_epu8(v, f0), v));
+		}
+
+		al = _mm_sad_epu8(al, zero);
+		ac = _mm_sad_epu8(ac, zero);
+		af = _mm_sad_epu8(af, zero);
+
+		nl += _mm_cvtsi128_si32(al) +
+				_mm_cvtsi128_si32(_mm_srli_si128(al, 8));
+		nc += _mm_cvtsi128_si32(ac) +
+				_mm_cvtsi128_si32(_mm_srli_si128(ac, 8));
+		nf += _mm_cvtsi128_si32(af) +
+				_mm_cvtsi128_si32(_mm_srli_si128(af, 8));
+	}
+
+	utf8_counts_scalar(s + off, len - off, lines, cont, four);
+
+	*lines += nl;
+	*cont += nc;
+	*four += nf;
+}
+
+size_t utf8_skip_sse2(const uint8_t *s, size_t len, size_t *n)
+{
+	const __m128i c0 = _mm_set1_epi8((char) 0xC0);
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i zero = _mm_setzero_si128();
+	size_t off = 0, left = *n;
+
+	for (; len - off >= 16; off += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + off));
+		/* Start bytes are those not below 0xC0, signed */
+		__m128i starts = _mm_sad_epu8(_mm_andnot_si128(
+				_mm_cmplt_epi8(v, c0), one), zero);
+		size_t count = _mm_cvtsi128_si32(starts) +
+				_mm_cvtsi128_si32(_mm_srli_si128(starts, 8));
+
+		if (count > left)
+			break;
+
+		left -= count;
+	}
+
+	*n = left;
+
+	return off;
+}
+
+#endif
+
+/******************************************************************************
+ * AVX2 implementations, finishing blocks with SSE2                           *
+ ******************************************************************************/
+
+#ifdef SIMD_AVX2
+
+void ascii_to_ucs4_avx2(const uint8_t *s, size_t len, bool le,
+		uint8_t *dest)
+{
+	size_t off = parserutils__simd_avx2_ascii_to_ucs4(s, len, le, dest);
+
+	ascii_to_ucs4_sse2(s + off, len - off, le, dest + off * 4);
+}
+
+void utf8_counts_avx2(const uint8_t *s, size_t len,
+		size_t *lines, size_t *cont, size_t *four)
+{
+	size_t nl, nc, nf;
+	size_t off = parserutils__simd_avx2_utf8_counts(s, len,
+			&nl, &nc, &nf);
+
+	utf8_counts_sse2(s + off, len - off, lines, cont, four);
+
+	*lines += nl;
+	*cont += nc;
+	*four += nf;
+}
+
+size_t utf8_skip_avx2(const uint8_t *s, size_t len, size_t *n)
+{
+	size_t off = parserutils__simd_avx2_utf8_skip(s, len, n);
+
+	return off + utf8_skip_sse2(s + off, len - off, n);
+}
+
+#endif
+
+/******************************************************************************
+ * NEON implementations                                                       *
+ ******************************************************************************/
+
+#ifdef SIMD_NEON
+
+size_t ascii_prefix_neon(const uint8_t *s, size_t len)
+{
+	size_t off = 0;
+
+	for (; off + 16 <= len; off += 16) {
+		uint8x16_t v = vld1q_u8(s + off);
+
+		if (vmaxvq_u8(v) >= 0x80)
+			break;
+	}
+
+	/* Locate the exact position within the final block */
+	while (off < len && s[off] < 0x80)
+		off++;
+
+	return off;
+}
+
+size_t below_prefix_neon(const uint8_t *s, size_t len, uint8_t limit)
+{
+	const uint8x16_t lim = vdupq_n_u8(limit);
+	size_t off = 0;
+
+	for (; off + 16 <= len; off += 16) {
+		uint8x16_t v = vld1q_u8(s + off);
+
+		if (vmaxvq_u8(vcgeq_u8(v, lim)) != 0)
+			break;
+	}
+
+	while (off < len && s[off] < limit)
+		off++;
+
+	return off;
+}
+
+void ascii_to_ucs4_neon(const uint8_t *s, size_t len, bool le,
+		uint8_t *dest)
+{
+	size_t off = 0;
+
+	for (; off + 16 <= len; off += 16) {
+		uint8x16x4_t out;
+
+		out.val[0] = vdupq_n_u8(0);
+		out.val[1] = out.val[0];
+		out.val[2] = out.val[0];
+		out.val[3] = out.val[0];
+		out.val[le ? 0 : 3] = vld1q_u8(s + off);
+
+		/* Interleaved store writes each character as 00 00 00 xx,
+		 * or xx 00 00 00 */
+		vst4q_u8(dest + off * 4, out);
+	}
+
+	ascii_to_ucs4_scalar(s + off, len - off, le, dest + off * 4);
+}
+
+size_t utf16_ascii_to_utf8_neon(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest)
+{
+	const uint16x8_t mask = vdupq_n_u16(swap ? 0x80FF : 0xFF80);
+	size_t off = 0;
+
+	for (; off + 8 <= units; off += 8) {
+		uint16x8_t v = vld1q_u16((const uint16_t *) (const void *)
+				(s + off * 2));
+
+		if (vmaxvq_u16(vandq_u16(v, mask)) != 0)
+			break;
+
+		if (swap)
+			v = vshrq_n_u16(v, 8);
+
+		vst1_u8(dest + off, vmovn_u16(v));
+	}
+
+	return off + utf16_ascii_to_utf8_scalar(s + off * 2, units - off,
+			swap, dest + off);
+}
+
+size_t utf32_ascii_to_utf8_neon(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest)
+{
+	const uint32x4_t mask = vdupq_n_u32(swap ? 0x80FFFFFF : 0xFFFFFF80);
+	size_t off = 0;
+
+	for (; off + 8 <= units; off += 8) {
+		uint32x4_t lo = vld1q_u32((const uint32_t *) (const void *)
+				(s + off * 4));
+		uint32x4_t hi = vld1q_u32((const uint32_t *) (const void *)
+				(s + off * 4 + 16));
+
+		if (vmaxvq_u32(vandq_u32(vorrq_u32(lo, hi), mask)) != 0)
+			break;
+
+		if (swap) {
+			lo = vshrq_n_u32(lo, 24);
+			hi = vshrq_n_u32(hi, 24);
+		}
+
+		vst1_u8(dest + off, vmovn_u16(vcombine_u16(vmovn_u32(lo),
+				vmovn_u32(hi))));
+	}
+
+	return off + utf32_ascii_to_utf8_scalar(s + off * 4, units - off,
+			swap, dest + off);
+}
+
+size_t find_any_neon(const uint8_t *s, size_t len,
+		const uint8_t *bytes, size_t count)
+{
+	uint8x16_t needles[8];
+	size_t off = 0, i;
+
+	if (count == 0)
+		return len;
+
+	for (i = 0; i < count; i++)
+		needles[i] = vdupq_n_u8(bytes[i]);
+
+	for (; off + 16 <= len; off += 16) {
+		uint8x16_t v = vld1q_u8(s + off);
+		uint8x16_t eq = vceqq_u8(v, needles[0]);
+
+		for (i = 1; i < count; i++)
+			eq = vorrq_u8(eq, vceqq_u8(v, needles[i]));
+
+		if (vmaxvq_u8(eq) != 0)
+			break;
+	}
+
+	return off + find_any_scalar(s + off, len - off, bytes, count);
+}
+
+void utf8_counts_neon(const uint8_t *s, size_t len,
+		size_t *lines, size_t *cont, size_t *four)
+{
+	const uint8x16_t lf = vdupq_n_u8('\n');
+	const uint8x16_t c0 = vdupq_n_u8(0xC0);
+	const uint8x16_t x80 = vdupq_n_u8(0x80);
+	const uint8x16_t f0 = vdupq_n_u8(0xF0);
+	size_t off = 0, nl = 0, nc = 0, nf = 0;
+
+	while (len - off >= 16) {
+		size_t blocks = (len - off) / 16, i;
+		uint8x16_t al = vdupq_n_u8(0), ac = al, af = al;
+
+		/* Counts are kept per byte lane, so at most 255 blocks fit */
+		if (blocks > 255)
+			blocks = 255;
+
+		for (i = 0; i < blocks; i++, off += 16) {
+			uint8x16_t v = vld1q_u8(s + off);
+
+			al = vsubq_u8(al, vceqq_u8(v, lf));
+			ac = vsubq_u8(ac, vceqq_u8(vandq_u8(v, c0), x80));
+			af = vsubq_u8(af, vcgeq_u8(v, f0));
+		}
+
+		nl += vaddlvq_u8(al);
+		nc += vaddlvq_u8(ac);
+		nf += vaddlvq_u8(af);
+	}
+
+	utf8_counts_scalar(s + off, len - off, lines, cont, four);
+
+	*lines += nl;
+	*cont += nc;
+	*four += nf;
+}
+
+size_t utf8_skip_neon(const uint8_t *s, size_t len, size_t *n)
+{
+	const uint8x16_t c0 = vdupq_n_u8(0xC0);
+	const uint8x16_t x80 = vdupq_n_u8(0x80);
+	size_t off = 0, left = *n;
+
+	for (; len - off >= 16; off += 16) {
+		uint8x16_t v = vld1q_u8(s + off);
+		size_t count = 16 - vaddvq_u8(vandq_u8(vceqq_u8(
+				vandq_u8(v, c0), x80), vdupq_n_u8(1)));
+
+		if (count > left)
+			break;
+
+		left -= count;
+	}
+
+	*n = left;
+
+	return off;
+}
+
+#endif
+
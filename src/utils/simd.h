@@ -0,0 +1,312 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_simd_h_
+#define parserutils_simd_h_
+
+/** \file
+ * Block operations on byte strings, vectorised where the CPU allows.
+ *
+ * Each operation has a portable implementation, processing bytes a machine
+ * word at a time, and others using SSE2 or AVX2 on x86, or NEON on AArch64.
+ * The best the CPU supports is chosen as the library is loaded, so one
+ * build suits every CPU of an architecture. Setting PARSERUTILS_SIMD in
+ * the environment to "scalar", "sse2", "avx2" or "neon" chooses that one
+ * instead, if it's supported, to compare them. Defining WITHOUT_SIMD builds
+ * only the portable implementations.
+ *
+ * SSE2 and NEON are part of the x86-64 and AArch64 baselines, so are used
+ * when the compiler targets them. AVX2 is used by GCC-compatible compilers,
+ * which can build functions for it whatever the target.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef WITHOUT_SIMD
+#if defined(__SSE2__)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define SIMD_AVX2
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+/**
+ * Instruction sets the operations may be implemented with
+ */
+typedef enum parserutils_simd_level {
+	PARSERUTILS_SIMD_SCALAR,
+	PARSERUTILS_SIMD_SSE2,
+	PARSERUTILS_SIMD_AVX2,
+	PARSERUTILS_SIMD_NEON,
+
+	PARSERUTILS_SIMD_LEVELS		/**< Number of levels */
+} parserutils_simd_level;
+
+/**
+ * Implementations of the operations, using one instruction set.
+ * See the wrappers below for their descriptions.
+ */
+typedef struct parserutils_simd_kernels {
+	const char *name;		/**< Name, as used in the environment */
+
+	size_t (*ascii_prefix)(const uint8_t *s, size_t len);
+	size_t (*below_prefix)(const uint8_t *s, size_t len, uint8_t limit);
+	void (*ascii_to_ucs4)(const uint8_t *s, size_t len, bool le,
+			uint8_t *dest);
+	size_t (*utf16_ascii_to_utf8)(const uint8_t *s, size_t units,
+			bool swap, uint8_t *dest);
+	size_t (*utf32_ascii_to_utf8)(const uint8_t *s, size_t units,
+			bool swap, uint8_t *dest);
+	size_t (*find_any)(const uint8_t *s, size_t len,
+			const uint8_t *bytes, size_t count);
+	void (*utf8_counts)(const uint8_t *s, size_t len,
+			size_t *lines, size_t *cont, size_t *four);
+	size_t (*utf8_skip)(const uint8_t *s, size_t len, size_t *n);
+} parserutils_simd_kernels;
+
+#if defined(__GNUC__)
+/* The implementations chosen as the library is loaded, or NULL before */
+extern const parserutils_simd_kernels *parserutils__simd;
+#else
+/* The best implementations built */
+extern const parserutils_simd_kernels *const parserutils__simd;
+#endif
+
+/* Implementations using an instruction set, or NULL if it's unsupported */
+const parserutils_simd_kernels *parserutils__simd_kernels(
+		parserutils_simd_level level);
+/* Choose the implementations to use */
+const parserutils_simd_kernels *parserutils__simd_resolve(void);
+
+#ifdef SIMD_AVX2
+/* AVX2 implementations, some only looping over whole blocks */
+size_t parserutils__simd_avx2_ascii_prefix(const uint8_t *s, size_t len);
+size_t parserutils__simd_avx2_below_prefix(const uint8_t *s, size_t len,
+		uint8_t limit);
+size_t parserutils__simd_avx2_ascii_to_ucs4(const uint8_t *s, size_t len,
+		bool le, uint8_t *dest);
+size_t parserutils__simd_avx2_find_any(const uint8_t *s, size_t len,
+		const uint8_t *bytes, size_t count);
+size_t parserutils__simd_avx2_utf8_counts(const uint8_t *s, size_t len,
+		size_t *lines, size_t *cont, size_t *four);
+size_t parserutils__simd_avx2_utf8_skip(const uint8_t *s, size_t len,
+		size_t *n);
+#endif
+
+/** Bytes of a prefix examined inline, before calling an implementation */
+#define SIMD_INLINE_PREFIX (16)
+
+/**
+ * Retrieve the implementations to use
+ *
+ * \return The implementations
+ *
+ * These are chosen once, before main() runs, and never change, so need no
+ * synchronisation. Only code run as another library is loaded may find
+ * them unchosen, and it chooses them itself. Compilers other than GCC and
+ * those compatible with it build only one set, so there's no choice.
+ */
+static inline const parserutils_simd_kernels *simd_kernels(void)
+{
+#if defined(__GNUC__)
+	if (parserutils__simd == NULL)
+		return parserutils__simd_resolve();
+#endif
+
+	return parserutils__simd;
+}
+
+/**
+ * Find the length of the run of ASCII bytes at the start of a string
+ *
+ * \param s    The string to scan
+ * \param len  Length of string, in bytes
+ * \return Number of leading bytes < 0x80
+ */
+static inline size_t simd_ascii_prefix(const uint8_t *s, size_t len)
+{
+	size_t off = 0;
+
+	/* Short runs are common, and found quicker here than by a call */
+	while (off < len && off < SIMD_INLINE_PREFIX) {
+		if (s[off] >= 0x80)
+			return off;
+		off++;
+	}
+
+	if (off == len)
+		return off;
+
+	return off + simd_kernels()->ascii_prefix(s + off, len - off);
+}
+
+/**
+ * Find the length of the run of bytes below a limit at the start of a string
+ *
+ * \param s      The string to scan
+ * \param len    Length of string, in bytes
+ * \param limit  The limit, which must be at least 0x80
+ * \return Number of leading bytes < limit
+ */
+static inline size_t simd_below_prefix(const uint8_t *s, size_t len,
+		uint8_t limit)
+{
+	size_t off = 0;
+
+	while (off < len && off < SIMD_INLINE_PREFIX) {
+		if (s[off] >= limit)
+			return off;
+		off++;
+	}
+
+	if (off == len)
+		return off;
+
+	return off + simd_kernels()->below_prefix(s + off, len - off, limit);
+}
+
+/**
+ * Widen a run of ASCII bytes to UCS-4
+ *
+ * \param s     The bytes to widen, all of which must be < 0x80
+ * \param len   Number of bytes to widen
+ * \param le    Whether to write little endian, rather than big endian, UCS-4
+ * \param dest  Output buffer, at least 4 * len bytes long
+ */
+static inline void simd_ascii_to_ucs4(const uint8_t *s, size_t len, bool le,
+		uint8_t *dest)
+{
+	simd_kernels()->ascii_to_ucs4(s, len, le, dest);
+}
+
+/**
+ * Narrow a run of ASCII UTF-16 code units to bytes
+ *
+ * \param s      The UTF-16 to narrow
+ * \param units  Maximum number of code units to narrow
+ * \param swap   Whether the code units are in the opposite byte order to
+ *               the host's
+ * \param dest   Output buffer, at least units bytes long
+ * \return Number of leading code units < 0x80, all of which were narrowed
+ */
+static inline size_t simd_utf16_ascii_to_utf8(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest)
+{
+	return simd_kernels()->utf16_ascii_to_utf8(s, units, swap, dest);
+}
+
+/**
+ * Narrow a run of ASCII UTF-32 code units to bytes
+ *
+ * \param s      The UTF-32 to narrow
+ * \param units  Maximum number of code units to narrow
+ * \param swap   Whether the code units are in the opposite byte order to
+ *               the host's
+ * \param dest   Output buffer, at least units bytes long
+ * \return Number of leading code units < 0x80, all of which were narrowed
+ */
+static inline size_t simd_utf32_ascii_to_utf8(const uint8_t *s, size_t units,
+		bool swap, uint8_t *dest)
+{
+	return simd_kernels()->utf32_ascii_to_utf8(s, units, swap, dest);
+}
+
+/**
+ * Find the bytes in a group of 16 which equal a given value
+ *
+ * \param group  The group of bytes to search
+ * \param byte   The value to look for
+ * \return Bitmask of matching bytes, with bit n set if group[n] == byte
+ *
+ * This is too short to be worth choosing an implementation for at run time,
+ * so uses what the compiler targets.
+ */
+static inline uint32_t simd_match_byte16(const uint8_t *group, uint8_t byte)
+{
+#if defined(SIMD_SSE2)
+	__m128i v = _mm_loadu_si128((const __m128i *) group);
+
+	return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v,
+			_mm_set1_epi8((char) byte)));
+#elif defined(SIMD_NEON)
+	static const uint8_t weights[16] = {
+		1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+	};
+	uint8x16_t eq = vandq_u8(vceqq_u8(vld1q_u8(group), vdupq_n_u8(byte)),
+			vld1q_u8(weights));
+
+	/* Sum each half's weights to give its byte of the mask */
+	return (uint32_t) vaddv_u8(vget_low_u8(eq)) |
+			((uint32_t) vaddv_u8(vget_high_u8(eq)) << 8);
+#else
+	uint32_t mask = 0;
+	size_t off;
+
+	for (off = 0; off < 16; off++)
+		mask |= (uint32_t) (group[off] == byte) << off;
+
+	return mask;
+#endif
+}
+
+/**
+ * Find the first byte of a string which equals any of a few values
+ *
+ * \param s      The string to scan
+ * \param len    Length of string, in bytes
+ * \param bytes  The values to look for
+ * \param count  Number of values, at most 8
+ * \return Offset of first matching byte, or len if there is none
+ */
+static inline size_t simd_find_any(const uint8_t *s, size_t len,
+		const uint8_t *bytes, size_t count)
+{
+	return simd_kernels()->find_any(s, len, bytes, count);
+}
+
+/**
+ * Count the line feeds, and the bytes of various kinds, in UTF-8
+ *
+ * \param s      The string to scan
+ * \param len    Length of string, in bytes
+ * \param lines  Pointer to location to receive count of line feeds
+ * \param cont   Pointer to location to receive count of continuation bytes
+ * \param four   Pointer to location to receive count of start bytes of
+ *               four byte sequences
+ */
+static inline void simd_utf8_counts(const uint8_t *s, size_t len,
+		size_t *lines, size_t *cont, size_t *four)
+{
+	simd_kernels()->utf8_counts(s, len, lines, cont, four);
+}
+
+/**
+ * Skip whole blocks of UTF-8 starting no more than a number of characters
+ *
+ * \param s    The string to scan
+ * \param len  Length of string, in bytes
+ * \param n    Pointer to number of characters to skip, updated on exit
+ * \return Offset of the first block not skipped
+ *
+ * The offset returned may be part way through a character. What remains is
+ * left to the caller, which must skip the rest of a character before
+ * counting more.
+ */
+static inline size_t simd_utf8_skip(const uint8_t *s, size_t len, size_t *n)
+{
+	return simd_kernels()->utf8_skip(s, len, n);
+}
+
+#endif
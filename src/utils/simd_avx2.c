@@ -0,0 +1,222 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+/** \file
+ * AVX2 implementations of the operations in simd.h.
+ *
+ * These are built for AVX2 whatever the compiler targets, and only called
+ * once the CPU is known to support it. Those finding a prefix or a byte are
+ * complete, as they're often called for a few bytes. The rest loop over
+ * whole 32 byte blocks, returning the offset of the first they didn't
+ * finish with, for simd.c to finish with SSE2.
+ */
+
+#include "utils/simd.h"
+
+#ifdef SIMD_AVX2
+
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2,popcnt")))
+
+AVX2 size_t parserutils__simd_avx2_ascii_prefix(const uint8_t *s, size_t len)
+{
+	size_t off = 0;
+
+	for (; off + 32 <= len; off += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (s + off));
+		uint32_t mask = (uint32_t) _mm256_movemask_epi8(v);
+
+		if (mask != 0)
+			return off + __builtin_ctz(mask);
+	}
+
+	for (; off + 16 <= len; off += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + off));
+		uint32_t mask = (uint32_t) _mm_movemask_epi8(v);
+
+		if (mask != 0)
+			return off + __builtin_ctz(mask);
+	}
+
+	while (off < len && s[off] < 0x80)
+		off++;
+
+	return off;
+}
+
+AVX2 size_t parserutils__simd_avx2_below_prefix(const uint8_t *s, size_t len,
+		uint8_t limit)
+{
+	const __m256i lim = _mm256_set1_epi8((char) limit);
+	size_t off = 0;
+
+	for (; off + 32 <= len; off += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (s + off));
+		/* Bytes at or above the limit are their maximum */
+		uint32_t mask = (uint32_t) _mm256_movemask_epi8(
+				_mm256_cmpeq_epi8(_mm256_max_epu8(v, lim), v));
+
+		if (mask != 0)
+			return off + __builtin_ctz(mask);
+	}
+
+	for (; off + 16 <= len; off += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + off));
+		uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(
+				_mm_max_epu8(v, _mm256_castsi256_si128(lim)), v));
+
+		if (mask != 0)
+			return off + __builtin_ctz(mask);
+	}
+
+	while (off < len && s[off] < limit)
+		off++;
+
+	return off;
+}
+
+AVX2 size_t parserutils__simd_avx2_ascii_to_ucs4(const uint8_t *s, size_t len,
+		bool le, uint8_t *dest)
+{
+	size_t off = 0;
+
+	for (; off + 32 <= len; off += 32) {
+		uint8_t *d = dest + off * 4;
+		size_t i;
+
+		/* Zero extending each byte gives xx 00 00 00; shifting that
+		 * gives 00 00 00 xx */
+		for (i = 0; i < 32; i += 8) {
+			__m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+					(const __m128i *) (s + off + i)));
+
+			if (le == false)
+				v = _mm256_slli_epi32(v, 24);
+
+			_mm256_storeu_si256((__m256i *) (d + i * 4), v);
+		}
+	}
+
+	return off;
+}
+
+AVX2 size_t parserutils__simd_avx2_find_any(const uint8_t *s, size_t len,
+		const uint8_t *bytes, size_t count)
+{
+	__m256i needles[8];
+	size_t off = 0, i;
+
+	if (count == 0)
+		return len;
+
+	for (i = 0; i < count; i++)
+		needles[i] = _mm256_set1_epi8((char) bytes[i]);
+
+	for (; off + 32 <= len; off += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (s + off));
+		__m256i eq = _mm256_cmpeq_epi8(v, needles[0]);
+		uint32_t mask;
+
+		for (i = 1; i < count; i++)
+			eq = _mm256_or_si256(eq,
+					_mm256_cmpeq_epi8(v, needles[i]));
+
+		mask = (uint32_t) _mm256_movemask_epi8(eq);
+		if (mask != 0)
+			return off + __builtin_ctz(mask);
+	}
+
+	/* Locate the exact position within the final block */
+	for (; off < len; off++) {
+		for (i = 0; i < count; i++) {
+			if (s[off] == bytes[i])
+				return off;
+		}
+	}
+
+	return len;
+}
+
+/**
+ * Sum the four 64 bit lanes of a vector
+ */
+static inline AVX2 size_t sum_lanes(__m256i v)
+{
+	__m128i x = _mm_add_epi64(_mm256_castsi256_si128(v),
+			_mm256_extracti128_si256(v, 1));
+
+	/* Each lane holds a sum of bytes, so fits in 32 bits */
+	return (size_t) _mm_cvtsi128_si32(x) +
+			(size_t) _mm_cvtsi128_si32(_mm_unpackhi_epi64(x, x));
+}
+
+AVX2 size_t parserutils__simd_avx2_utf8_counts(const uint8_t *s, size_t len,
+		size_t *lines, size_t *cont, size_t *four)
+{
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i c0 = _mm256_set1_epi8((char) 0xC0);
+	const __m256i f0 = _mm256_set1_epi8((char) 0xF0);
+	const __m256i zero = _mm256_setzero_si256();
+	size_t off = 0, nl = 0, nc = 0, nf = 0;
+
+	while (len - off >= 32) {
+		size_t blocks = (len - off) / 32, i;
+		__m256i al = zero, ac = zero, af = zero;
+
+		/* Counts are kept per byte lane, so at most 255 blocks fit */
+		if (blocks > 255)
+			blocks = 255;
+
+		for (i = 0; i < blocks; i++, off += 32) {
+			__m256i v = _mm256_loadu_si256(
+					(const __m256i *) (s + off));
+
+			al = _mm256_sub_epi8(al, _mm256_cmpeq_epi8(v, lf));
+			/* Bytes 0x80-0xBF are those below 0xC0, signed */
+			ac = _mm256_sub_epi8(ac, _mm256_cmpgt_epi8(c0, v));
+			af = _mm256_sub_epi8(af, _mm256_cmpeq_epi8(
+					_mm256_max_epu8(v, f0), v));
+		}
+
+		nl += sum_lanes(_mm256_sad_epu8(al, zero));
+		nc += sum_lanes(_mm256_sad_epu8(ac, zero));
+		nf += sum_lanes(_mm256_sad_epu8(af, zero));
+	}
+
+	*lines = nl;
+	*cont = nc;
+	*four = nf;
+
+	return off;
+}
+
+AVX2 size_t parserutils__simd_avx2_utf8_skip(const uint8_t *s, size_t len,
+		size_t *n)
+{
+	const __m256i c0 = _mm256_set1_epi8((char) 0xC0);
+	size_t off = 0, left = *n;
+
+	for (; len - off >= 32; off += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (s + off));
+		/* Continuation bytes are those below 0xC0, signed */
+		size_t count = 32 - __builtin_popcount((uint32_t)
+				_mm256_movemask_epi8(_mm256_cmpgt_epi8(c0, v)));
+
+		if (count > left)
+			break;
+
+		left -= count;
+	}
+
+	*n = left;
+
+	return off;
+}
+
+#endif
+
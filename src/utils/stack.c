@@ -6,24 +6,35 @@
  */
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include <parserutils/utils/stack.h>
 
 /**
- * Stack object
+ * Largest initial allocation of items made along with the stack itself
  */
-struct parserutils_stack
+#define STACK_INLINE_MAX (512)
+
+/**
+ * Private stack object
+ *
+ * If small enough, the initial slots immediately follow this structure, in
+ * the same allocation. They are abandoned when the stack first grows.
+ */
+typedef struct parserutils_stack_private
 {
-	size_t item_size;		/**< Size of an item in the stack */
+	parserutils_stack public;	/**< Public part. Must be first */
+
 	size_t chunk_size;		/**< Size of a stack chunk */
-	size_t items_allocated;		/**< Number of slots allocated */
-	int32_t current_item;		/**< Index of current item */
-	void *items;			/**< Items in stack */
 
 	parserutils_alloc alloc;	/**< Memory (de)allocation function */
 	void *pw;			/**< Client-specific data */
-};
+} parserutils_stack_private;
+
+static inline bool parserutils_stack_is_inline(parserutils_stack_private *s);
+static parserutils_error parserutils_stack_grow(parserutils_stack_private *s,
+		size_t slots);
 
 /**
  * Create a stack
@@ -40,30 +51,73 @@ struct parserutils_stack
 parserutils_error parserutils_stack_create(size_t item_size, size_t chunk_size,
 		parserutils_alloc alloc, void *pw, parserutils_stack **stack)
 {
-	parserutils_stack *s;
+	return parserutils_stack_create_with_capacity(item_size, chunk_size,
+			0, alloc, pw, stack);
+}
+
+/**
+ * Create a stack, able to hold a given number of items
+ *
+ * \param item_size   Length, in bytes, of an item in the stack
+ * \param chunk_size  Number of stack slots in a chunk
+ * \param capacity    Number of items the stack may hold without reallocation
+ * \param alloc       Memory (de)allocation function
+ * \param pw          Pointer to client-specific private data
+ * \param stack       Pointer to location to receive stack instance
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ *
+ * If the initial slots are small enough, they are allocated along with the
+ * stack, so a stack which never grows costs a single allocation.
+ */
+parserutils_error parserutils_stack_create_with_capacity(size_t item_size,
+		size_t chunk_size, size_t capacity,
+		parserutils_alloc alloc, void *pw, parserutils_stack **stack)
+{
+	parserutils_stack_private *s;
+	size_t slots = chunk_size;
+	bool inline_items;
 
 	if (item_size == 0 || chunk_size == 0 || alloc == NULL || stack == NULL)
 		return PARSERUTILS_BADPARM;
 
-	s = alloc(NULL, sizeof(parserutils_stack), pw);
-	if (s == NULL)
+	if (capacity > SIZE_MAX - chunk_size)
 		return PARSERUTILS_NOMEM;
 
-	s->items = alloc(NULL, item_size * chunk_size, pw);
-	if (s->items == NULL) {
-		alloc(s, 0, pw);
+	/* Round capacity up to a whole number of chunks */
+	if (capacity > slots)
+		slots = (capacity + chunk_size - 1) / chunk_size * chunk_size;
+
+	if (slots > SIZE_MAX / item_size)
+		return PARSERUTILS_NOMEM;
+
+	inline_items = (item_size * slots <= STACK_INLINE_MAX);
+
+	s = alloc(NULL, sizeof(parserutils_stack_private) +
+			(inline_items ? item_size * slots : 0), pw);
+	if (s == NULL)
 		return PARSERUTILS_NOMEM;
+
+	if (inline_items) {
+		s->public.items = s + 1;
+	} else {
+		s->public.items = alloc(NULL, item_size * slots, pw);
+		if (s->public.items == NULL) {
+			alloc(s, 0, pw);
+			return PARSERUTILS_NOMEM;
+		}
 	}
 
-	s->item_size = item_size;
+	s->public.item_size = item_size;
+	s->public.items_allocated = slots;
+	s->public.current_item = -1;
 	s->chunk_size = chunk_size;
-	s->items_allocated = chunk_size;
-	s->current_item = -1;
 
 	s->alloc = alloc;
 	s->pw = pw;
 
-	*stack = s;
+	*stack = &s->public;
 
 	return PARSERUTILS_OK;
 }
@@ -76,25 +130,33 @@ parserutils_error parserutils_stack_create(size_t item_size, size_t chunk_size,
  */
 parserutils_error parserutils_stack_destroy(parserutils_stack *stack)
 {
+	parserutils_stack_private *s = (parserutils_stack_private *) stack;
+
 	if (stack == NULL)
 		return PARSERUTILS_BADPARM;
 
-	stack->alloc(stack->items, 0, stack->pw);
-	stack->alloc(stack, 0, stack->pw);
+	if (parserutils_stack_is_inline(s) == false)
+		s->alloc(s->public.items, 0, s->pw);
+	s->alloc(s, 0, s->pw);
 
 	return PARSERUTILS_OK;
 }
 
 /**
- * Push an item onto the stack
+ * Push an item onto the stack, growing it if necessary
  *
  * \param stack  The stack to push onto
  * \param item   The item to push
  * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * The stack grows geometrically, so a run of pushes costs amortised
+ * constant time.
  */
-parserutils_error parserutils_stack_push(parserutils_stack *stack, 
+parserutils_error parserutils_stack_push_slow(parserutils_stack *stack,
 		const void *item)
 {
+	parserutils_stack_private *s = (parserutils_stack_private *) stack;
+	parserutils_error error;
 	int32_t slot;
 
 	if (stack == NULL || item == NULL)
@@ -107,17 +169,21 @@ parserutils_error parserutils_stack_push(parserutils_stack *stack,
 	slot = stack->current_item + 1;
 
 	if ((size_t) slot >= stack->items_allocated) {
-		void *temp = stack->alloc(stack->items,
-				(stack->items_allocated + stack->chunk_size) *
-				stack->item_size, stack->pw);
-		if (temp == NULL)
+		size_t slots = stack->items_allocated;
+
+		/* Double the allocation, in whole chunks */
+		if (slots > SIZE_MAX / 2 - s->chunk_size)
 			return PARSERUTILS_NOMEM;
 
-		stack->items = temp;
-		stack->items_allocated += stack->chunk_size;
+		slots = (2 * slots + s->chunk_size - 1) / s->chunk_size *
+				s->chunk_size;
+
+		error = parserutils_stack_grow(s, slots);
+		if (error != PARSERUTILS_OK)
+			return error;
 	}
 
-	memcpy((uint8_t *) stack->items + (slot * stack->item_size), 
+	memcpy((uint8_t *) stack->items + ((size_t) slot * stack->item_size),
 			item, stack->item_size);
 	stack->current_item = slot;
 
@@ -125,44 +191,35 @@ parserutils_error parserutils_stack_push(parserutils_stack *stack,
 }
 
 /**
- * Pop an item off a stack
+ * Ensure a stack has space for a given number of further items
  *
- * \param stack  The stack to pop from
- * \param item   Pointer to location to receive popped item, or NULL
- * \return PARSERUTILS_OK on success, appropriate error otherwise.
+ * \param stack  The stack to consider
+ * \param count  Number of items that may then be pushed onto it
+ *               without reallocation
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
  */
-parserutils_error parserutils_stack_pop(parserutils_stack *stack, void *item)
+parserutils_error parserutils_stack_reserve(parserutils_stack *stack, 
+		size_t count)
 {
+	parserutils_stack_private *s = (parserutils_stack_private *) stack;
+	size_t slots;
+
 	if (stack == NULL)
 		return PARSERUTILS_BADPARM;
 
-	if (stack->current_item < 0)
-		return PARSERUTILS_INVALID;
+	slots = (size_t) (stack->current_item + 1);
 
-	if (item != NULL) {
-		memcpy(item, (uint8_t *) stack->items + 
-				(stack->current_item * stack->item_size), 
-				stack->item_size);
-	}
+	if (count <= stack->items_allocated - slots)
+		return PARSERUTILS_OK;
 
-	stack->current_item -= 1;
-
-	return PARSERUTILS_OK;
-}
+	if (count > SIZE_MAX - slots - s->chunk_size)
+		return PARSERUTILS_NOMEM;
 
-/**
- * Retrieve a pointer to the current item on the stack
- *
- * \param stack  The stack to inspect
- * \return Pointer to item on stack, or NULL if none
- */
-void *parserutils_stack_get_current(parserutils_stack *stack)
-{
-	if (stack == NULL || stack->current_item < 0)
-		return NULL;
+	/* Round up to a whole number of chunks */
+	slots = (slots + count + s->chunk_size - 1) /
+			s->chunk_size * s->chunk_size;
 
-	return (uint8_t *) stack->items + 
-			(stack->current_item * stack->item_size);
+	return parserutils_stack_grow(s, slots);
 }
 
 #ifndef NDEBUG
@@ -188,3 +245,52 @@ void parserutils_stack_dump(parserutils_stack *stack, const char *prefix,
 
 #endif
 
+/**
+ * Determine whether a stack's items are allocated along with it
+ *
+ * \param s  The stack to consider
+ * \return True if the items immediately follow the stack, false otherwise
+ */
+bool parserutils_stack_is_inline(parserutils_stack_private *s)
+{
+	return s->public.items == (void *) (s + 1);
+}
+
+/**
+ * Reallocate a stack's items
+ *
+ * \param s      The stack to grow
+ * \param slots  Number of slots to allocate, which must exceed the current
+ *               number and not overflow when multiplied by the item size
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ */
+parserutils_error parserutils_stack_grow(parserutils_stack_private *s,
+		size_t slots)
+{
+	size_t item_size = s->public.item_size;
+	void *temp;
+
+	if (slots > SIZE_MAX / item_size)
+		return PARSERUTILS_NOMEM;
+
+	if (parserutils_stack_is_inline(s)) {
+		/* Move the items out of the stack's own allocation */
+		temp = s->alloc(NULL, slots * item_size, s->pw);
+		if (temp == NULL)
+			return PARSERUTILS_NOMEM;
+
+		memcpy(temp, s->public.items,
+				(size_t) (s->public.current_item + 1) *
+				item_size);
+	} else {
+		temp = s->alloc(s->public.items, slots * item_size, s->pw);
+		if (temp == NULL)
+			return PARSERUTILS_NOMEM;
+	}
+
+	s->public.items = temp;
+	s->public.items_allocated = slots;
+
+	return PARSERUTILS_OK;
+}
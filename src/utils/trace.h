@@ -0,0 +1,51 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2009 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_utils_trace_h_
+#define parserutils_utils_trace_h_
+
+/** \file
+ * Trace points.
+ *
+ * PARSERUTILS_TRACE(hook, EVENT, a, b) reports PARSERUTILS_TRACE_EVENT to
+ * hook, a const parserutils_trace pointer which is NULL when no hook is
+ * attached. Without WITH_TRACE, trace points compile to nothing and their
+ * arguments are not evaluated. With it, an unattached trace point costs a
+ * test of the hook pointer. Defining WITH_USDT as well places a USDT probe,
+ * named after the event, in the libparserutils provider at each point.
+ */
+
+#include <parserutils/trace.h>
+
+#ifdef WITH_TRACE
+#ifdef WITH_USDT
+#include <sys/sdt.h>
+#define PARSERUTILS_TRACE_PROBE(event, a, b) \
+	DTRACE_PROBE2(libparserutils, event, a, b)
+#else
+#define PARSERUTILS_TRACE_PROBE(event, a, b) ((void) 0)
+#endif
+
+#define PARSERUTILS_TRACE(hook, event, a, b)				\
+	do {								\
+		const parserutils_trace *trace_hook_ = (hook);		\
+									\
+		PARSERUTILS_TRACE_PROBE(event, (uint64_t) (a),		\
+				(uint64_t) (b));			\
+		if (trace_hook_ != NULL)				\
+			trace_hook_->func(PARSERUTILS_TRACE_##event,	\
+					(a), (b), trace_hook_->pw);	\
+	} while (0)
+#else
+/* Unevaluated, but keeps variables used only for tracing from seeming
+ * unused */
+#define PARSERUTILS_TRACE(hook, event, a, b) \
+	((void) sizeof(hook), (void) sizeof(a), (void) sizeof(b))
+#endif
+
+#endif
+
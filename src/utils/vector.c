@@ -6,6 +6,7 @@
  */
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include <parserutils/utils/vector.h>
@@ -25,6 +26,9 @@ struct parserutils_vector
 	void *pw;			/**< Client-specific data */
 };
 
+static parserutils_error parserutils_vector_grow(parserutils_vector *vector,
+		size_t count, bool geometric);
+
 /**
  * Create a vector
  *
@@ -40,18 +44,50 @@ struct parserutils_vector
 parserutils_error parserutils_vector_create(size_t item_size, 
 		size_t chunk_size, parserutils_alloc alloc, void *pw,
 		parserutils_vector **vector)
+{
+	return parserutils_vector_create_with_capacity(item_size, chunk_size,
+			0, alloc, pw, vector);
+}
+
+/**
+ * Create a vector, able to hold a given number of items
+ *
+ * \param item_size   Length, in bytes, of an item in the vector
+ * \param chunk_size  Number of vector slots in a chunk
+ * \param capacity    Number of items the vector may hold without reallocation
+ * \param alloc       Memory (de)allocation function
+ * \param pw          Pointer to client-specific private data
+ * \param vector      Pointer to location to receive vector instance
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_BADPARM on bad parameters,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ */
+parserutils_error parserutils_vector_create_with_capacity(size_t item_size,
+		size_t chunk_size, size_t capacity,
+		parserutils_alloc alloc, void *pw, parserutils_vector **vector)
 {
 	parserutils_vector *v;
+	size_t slots = chunk_size;
 
 	if (item_size == 0 || chunk_size == 0 || alloc == NULL || 
 			vector == NULL)
 		return PARSERUTILS_BADPARM;
 
+	if (capacity > SIZE_MAX - chunk_size)
+		return PARSERUTILS_NOMEM;
+
+	/* Round capacity up to a whole number of chunks */
+	if (capacity > slots)
+		slots = (capacity + chunk_size - 1) / chunk_size * chunk_size;
+
+	if (slots > SIZE_MAX / item_size)
+		return PARSERUTILS_NOMEM;
+
 	v = alloc(NULL, sizeof(parserutils_vector), pw);
 	if (v == NULL)
 		return PARSERUTILS_NOMEM;
 
-	v->items = alloc(NULL, item_size * chunk_size, pw);
+	v->items = alloc(NULL, item_size * slots, pw);
 	if (v->items == NULL) {
 		alloc(v, 0, pw);
 		return PARSERUTILS_NOMEM;
@@ -59,7 +95,7 @@ parserutils_error parserutils_vector_create(size_t item_size,
 
 	v->item_size = item_size;
 	v->chunk_size = chunk_size;
-	v->items_allocated = chunk_size;
+	v->items_allocated = slots;
 	v->current_item = -1;
 
 	v->alloc = alloc;
@@ -97,6 +133,7 @@ parserutils_error parserutils_vector_destroy(parserutils_vector *vector)
 parserutils_error parserutils_vector_append(parserutils_vector *vector, 
 		void *item)
 {
+	parserutils_error error;
 	int32_t slot;
 
 	if (vector == NULL || item == NULL)
@@ -109,23 +146,81 @@ parserutils_error parserutils_vector_append(parserutils_vector *vector,
 	slot = vector->current_item + 1;
 
 	if ((size_t) slot >= vector->items_allocated) {
-		void *temp = vector->alloc(vector->items,
-				(vector->items_allocated + vector->chunk_size) *
-				vector->item_size, vector->pw);
-		if (temp == NULL)
-			return PARSERUTILS_NOMEM;
-
-		vector->items = temp;
-		vector->items_allocated += vector->chunk_size;
+		error = parserutils_vector_grow(vector, 1, true);
+		if (error != PARSERUTILS_OK)
+			return error;
 	}
 
-	memcpy((uint8_t *) vector->items + (slot * vector->item_size), 
+	memcpy((uint8_t *) vector->items + ((size_t) slot * vector->item_size),
 			item, vector->item_size);
 	vector->current_item = slot;
 
 	return PARSERUTILS_OK;
 }
 
+/**
+ * Append a number of items to the vector
+ *
+ * \param vector  The vector to append to
+ * \param items   Pointer to the items, which are contiguous
+ * \param count   Number of items to append
+ * eturn PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error parserutils_vector_append_n(parserutils_vector *vector,
+		const void *items, size_t count)
+{
+	parserutils_error error;
+	size_t length;
+
+	if (vector == NULL || (items == NULL && count > 0))
+		return PARSERUTILS_BADPARM;
+
+	if (vector->current_item < -1)
+		return PARSERUTILS_INVALID;
+
+	length = (size_t) (vector->current_item + 1);
+
+	/* Ensure the items will get valid slots */
+	if (count > (size_t) INT32_MAX + 1 - length)
+		return PARSERUTILS_INVALID;
+
+	if (count == 0)
+		return PARSERUTILS_OK;
+
+	if (count > vector->items_allocated - length) {
+		error = parserutils_vector_grow(vector, count, true);
+		if (error != PARSERUTILS_OK)
+			return error;
+	}
+
+	memcpy((uint8_t *) vector->items + (length * vector->item_size),
+			items, count * vector->item_size);
+	vector->current_item = (int32_t) (length + count - 1);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Ensure a vector has space for a given number of further items
+ *
+ * \param vector  The vector to consider
+ * \param count   Number of items that may then be appended to it
+ *                without reallocation
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error parserutils_vector_reserve(parserutils_vector *vector, 
+		size_t count)
+{
+	if (vector == NULL)
+		return PARSERUTILS_BADPARM;
+
+	if (count <= vector->items_allocated -
+			(size_t) (vector->current_item + 1))
+		return PARSERUTILS_OK;
+
+	return parserutils_vector_grow(vector, count, false);
+}
+
 /**
  * Clear a vector
  *
@@ -164,6 +259,28 @@ parserutils_error parserutils_vector_remove_last(parserutils_vector *vector)
 	return PARSERUTILS_OK;
 }
 
+/**
+ * Truncate a vector
+ *
+ * \param vector  The vector to truncate
+ * \param length  Number of items to keep, which must not exceed the
+ *                vector's length
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+parserutils_error parserutils_vector_truncate(parserutils_vector *vector,
+		size_t length)
+{
+	if (vector == NULL)
+		return PARSERUTILS_BADPARM;
+
+	if (length > (size_t) (vector->current_item + 1))
+		return PARSERUTILS_BADPARM;
+
+	vector->current_item = (int32_t) length - 1;
+
+	return PARSERUTILS_OK;
+}
+
 /**
  * Acquire the length (in items) of the vector.
  *
@@ -231,6 +348,51 @@ const void *parserutils_vector_peek(const parserutils_vector *vector,
 	return (uint8_t *) vector->items + (ctx * vector->item_size);
 }
 
+/**
+ * Retrieve an item in a vector
+ *
+ * \param vector  The vector to look in
+ * \param index   Index of the item
+ * \return Pointer to item, or NULL if index is out of range
+ *
+ * The pointer remains valid until the vector is next lengthened.
+ */
+const void *parserutils_vector_get(const parserutils_vector *vector,
+		size_t index)
+{
+	if (vector == NULL || vector->current_item < 0 ||
+			index > (size_t) vector->current_item)
+		return NULL;
+
+	return (uint8_t *) vector->items + (index * vector->item_size);
+}
+
+/**
+ * Retrieve the items in a vector as a contiguous array
+ *
+ * \param vector  The vector to look in
+ * \param items   Pointer to location to receive pointer to first item
+ * \param length  Pointer to location to receive number of items
+ * \param stride  Pointer to location to receive distance between items,
+ *                in bytes, or NULL
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * The items remain valid until the vector is next lengthened. If the
+ * vector is empty, *items may be any value.
+ */
+parserutils_error parserutils_vector_span(const parserutils_vector *vector,
+		const void **items, size_t *length, size_t *stride)
+{
+	if (vector == NULL || items == NULL || length == NULL)
+		return PARSERUTILS_BADPARM;
+
+	*items = vector->items;
+	*length = (size_t) (vector->current_item + 1);
+	if (stride != NULL)
+		*stride = vector->item_size;
+
+	return PARSERUTILS_OK;
+}
 
 #ifndef NDEBUG
 #include <stdio.h>
@@ -255,3 +417,49 @@ void parserutils_vector_dump(parserutils_vector *vector, const char *prefix,
 
 #endif
 
+/**
+ * Enlarge a vector's allocation
+ *
+ * \param vector     The vector to grow
+ * \param count      Number of further items it must then hold
+ * \param geometric  Whether to at least double the allocation, so that
+ *                   repeated appends take amortised constant time
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ *
+ * The new allocation is a whole number of chunks.
+ */
+parserutils_error parserutils_vector_grow(parserutils_vector *vector,
+		size_t count, bool geometric)
+{
+	size_t slots = (size_t) (vector->current_item + 1);
+	void *temp;
+
+	if (count > SIZE_MAX - slots - vector->chunk_size)
+		return PARSERUTILS_NOMEM;
+
+	slots += count;
+
+	if (geometric && slots < vector->items_allocated * 2 &&
+			vector->items_allocated <= SIZE_MAX / 2)
+		slots = vector->items_allocated * 2;
+
+	if (slots > SIZE_MAX - vector->chunk_size)
+		return PARSERUTILS_NOMEM;
+
+	/* Round up to a whole number of chunks */
+	slots = (slots + vector->chunk_size - 1) /
+			vector->chunk_size * vector->chunk_size;
+
+	if (slots > SIZE_MAX / vector->item_size)
+		return PARSERUTILS_NOMEM;
+
+	temp = vector->alloc(vector->items, slots * vector->item_size,
+			vector->pw);
+	if (temp == NULL)
+		return PARSERUTILS_NOMEM;
+
+	vector->items = temp;
+	vector->items_allocated = slots;
+
+	return PARSERUTILS_OK;
+}
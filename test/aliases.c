@@ -2,12 +2,28 @@
 #include <string.h>
 
 #include "charset/aliases.h"
+#include "utils/utils.h"
 
 #include "testutils.h"
 
+static const struct {
+	const char *name;
+	uint16_t mib;
+} unicode[] = {
+	{ "UTF-8", MIB_UTF_8 },
+	{ "UTF-16", MIB_UTF_16 },
+	{ "UTF-16BE", MIB_UTF_16BE },
+	{ "UTF-16LE", MIB_UTF_16LE },
+	{ "UTF-32", MIB_UTF_32 },
+	{ "UTF-32BE", MIB_UTF_32BE },
+	{ "UTF-32LE", MIB_UTF_32LE }
+};
+
 int main (int argc, char **argv)
 {
-	parserutils_charset_aliases_canon *c;
+	const parserutils_charset_aliases_canon *c;
+	const char *name;
+	size_t len, i;
 
 	UNUSED(argc);
 	UNUSED(argv);
@@ -47,6 +63,31 @@ int main (int argc, char **argv)
 
 	printf("%s\n", parserutils_charset_mibenum_to_name(c->mib_enum));
 
+	name = parserutils_charset_mibenum_to_name_len(c->mib_enum, &len);
+	if (name == NULL || len != strlen(c->name) ||
+			strcmp(name, c->name) != 0) {
+		printf("FAIL - failed finding name of %d\n", c->mib_enum);
+		return 1;
+	}
+
+	if (parserutils_charset_mibenum_to_name(0) != NULL ||
+			parserutils_charset_mibenum_to_name(65535) != NULL ||
+			parserutils_charset_mibenum_to_name_len(65535,
+					&len) != NULL) {
+		printf("FAIL - found name of invalid MIB enum\n");
+		return 1;
+	}
+
+
+	/* The library's built in MIB enums must match the aliases file */
+	for (i = 0; i < N_ELEMENTS(unicode); i++) {
+		if (parserutils_charset_mibenum_from_name(unicode[i].name,
+				strlen(unicode[i].name)) != unicode[i].mib) {
+			printf("FAIL - MIB enum of '%s' differs from aliases\n",
+					unicode[i].name);
+			return 1;
+		}
+	}
 
 	c = parserutils__charset_alias_canonicalise("u.t.f.8", 7);
 	if (c) {
@@ -56,6 +97,27 @@ int main (int argc, char **argv)
 		return 1;
 	}
 
+	c = parserutils__charset_alias_canonicalise(" Shift_JIS ", 11);
+	if (c) {
+		printf("%s %d\n", c->name, c->mib_enum);
+	} else {
+		printf("FAIL - failed finding encoding ' Shift_JIS '\n");
+		return 1;
+	}
+
+	c = parserutils__charset_alias_canonicalise("-.-", 3);
+	if (c) {
+		printf("FAIL - found invalid encoding '-.-'\n");
+		return 1;
+	}
+
+	c = parserutils__charset_alias_canonicalise(
+			"utf8utf8utf8utf8utf8utf8utf8utf8utf8utf8utf8", 44);
+	if (c) {
+		printf("FAIL - found invalid encoding 'utf8utf8...'\n");
+		return 1;
+	}
+
 	printf("PASS\n");
 
 	return 0;
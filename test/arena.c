@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+#include <parserutils/utils/arena.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static int outstanding;
+static int allocations;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	if (ptr == NULL && len > 0) {
+		outstanding++;
+		allocations++;
+	} else if (ptr != NULL && len == 0) {
+		outstanding--;
+	}
+
+	return realloc(ptr, len);
+}
+
+/* Read a file through an input stream allocated from the arena */
+static void run(parserutils_arena *arena, const char *path)
+{
+	parserutils_inputstream *stream;
+	FILE *fp;
+	size_t len;
+#define CHUNK_SIZE (4096)
+	uint8_t buf[CHUNK_SIZE];
+	const uint8_t *c;
+	size_t clen;
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			parserutils_arena_alloc, arena, &stream) ==
+			PARSERUTILS_OK);
+
+	fp = fopen(path, "rb");
+	assert(fp != NULL);
+
+	while ((len = fread(buf, 1, CHUNK_SIZE, fp)) > 0) {
+		assert(parserutils_inputstream_append(stream,
+				buf, len) == PARSERUTILS_OK);
+	}
+
+	fclose(fp);
+
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	while (parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK)
+		parserutils_inputstream_advance(stream, clen);
+
+	/* Freed blocks return to the arena, but the stream still needs
+	 * destroying to release its iconv descriptor */
+	parserutils_inputstream_destroy(stream);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_arena *arena;
+	uint8_t *a, *b, *big;
+	int i, after_first;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	assert(parserutils_arena_create(myrealloc, NULL, &arena) ==
+			PARSERUTILS_OK);
+
+	/* Freed blocks are reused for allocations of the same class */
+	a = parserutils_arena_alloc(NULL, 10, arena);
+	assert(a != NULL);
+	memset(a, 'a', 10);
+	assert(parserutils_arena_alloc(a, 0, arena) == NULL);
+	b = parserutils_arena_alloc(NULL, 16, arena);
+	assert(b == a);
+
+	/* Resizing preserves contents */
+	memcpy(b, "0123456789abcdef", 16);
+	b = parserutils_arena_alloc(b, 1000, arena);
+	assert(b != NULL && memcmp(b, "0123456789abcdef", 16) == 0);
+	assert(parserutils_arena_alloc(b, 500, arena) == b);
+
+	/* Large blocks are passed through */
+	big = parserutils_arena_alloc(NULL, 1024 * 1024, arena);
+	assert(big != NULL);
+	memset(big, 'b', 1024 * 1024);
+	big = parserutils_arena_alloc(big, 2 * 1024 * 1024, arena);
+	assert(big != NULL && big[1024 * 1024 - 1] == 'b');
+
+	/* Resetting reuses the arena's memory */
+	assert(parserutils_arena_reset(arena) == PARSERUTILS_OK);
+
+	run(arena, argv[1]);
+	assert(parserutils_arena_reset(arena) == PARSERUTILS_OK);
+	after_first = allocations;
+
+	for (i = 0; i < 10; i++) {
+		run(arena, argv[1]);
+		assert(parserutils_arena_reset(arena) == PARSERUTILS_OK);
+	}
+
+	printf("Allocations: %d, after first run: %d\n",
+			allocations, after_first);
+	assert(allocations == after_first);
+
+	assert(parserutils_arena_destroy(arena) == PARSERUTILS_OK);
+	assert(outstanding == 0);
+
+	printf("PASS\n");
+
+	return 0;
+}
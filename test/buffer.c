@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/utils/buffer.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_buffer *buffer;
+	uint8_t chunk[1000];
+	size_t i, total;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	for (i = 0; i < sizeof(chunk); i++)
+		chunk[i] = (uint8_t) i;
+
+	assert(parserutils_buffer_create(myrealloc, NULL, &buffer) ==
+			PARSERUTILS_OK);
+
+	/* Discarding from the front must not move data */
+	assert(parserutils_buffer_append(buffer, chunk, sizeof(chunk)) ==
+			PARSERUTILS_OK);
+	assert(parserutils_buffer_discard(buffer, 0, 10) == PARSERUTILS_OK);
+	assert(buffer->length == sizeof(chunk) - 10);
+	assert(buffer->data == buffer->base + 10);
+	assert(memcmp(buffer->data, chunk + 10, buffer->length) == 0);
+
+	/* Discarding from the middle moves only the tail */
+	assert(parserutils_buffer_discard(buffer, 10, 20) == PARSERUTILS_OK);
+	assert(buffer->length == sizeof(chunk) - 30);
+	assert(memcmp(buffer->data, chunk + 10, 10) == 0);
+	assert(memcmp(buffer->data + 10, chunk + 40,
+			buffer->length - 10) == 0);
+
+	/* Inserting at the front reuses discarded space */
+	assert(parserutils_buffer_insert(buffer, 0, chunk + 5, 5) ==
+			PARSERUTILS_OK);
+	assert(buffer->data == buffer->base + 5);
+	assert(memcmp(buffer->data, chunk + 5, 15) == 0);
+
+	assert(parserutils_buffer_insert(buffer, 2, (const uint8_t *) "xy",
+			2) == PARSERUTILS_OK);
+	assert(memcmp(buffer->data, chunk + 5, 2) == 0);
+	assert(memcmp(buffer->data + 2, "xy", 2) == 0);
+	assert(memcmp(buffer->data + 4, chunk + 7, 13) == 0);
+
+	/* Emptying the buffer rewinds it */
+	assert(parserutils_buffer_discard(buffer, 0, buffer->length) ==
+			PARSERUTILS_OK);
+	assert(buffer->length == 0);
+	assert(buffer->data == buffer->base);
+
+	/* Streaming through the buffer shouldn't grow it without bound */
+	for (total = 0; total < 1000 * sizeof(chunk); total += sizeof(chunk)) {
+		assert(parserutils_buffer_append(buffer, chunk,
+				sizeof(chunk)) == PARSERUTILS_OK);
+		assert(memcmp(buffer->data + buffer->length - sizeof(chunk),
+				chunk, sizeof(chunk)) == 0);
+		assert(parserutils_buffer_discard(buffer, 0,
+				sizeof(chunk) - 1) == PARSERUTILS_OK);
+	}
+
+	printf("Length: %u Allocated: %u\n", (unsigned int) buffer->length,
+			(unsigned int) (buffer->allocated +
+					(buffer->data - buffer->base)));
+
+	assert(buffer->length == 1000);
+	assert(buffer->allocated + (buffer->data - buffer->base) <= 4096);
+
+	assert(parserutils_buffer_destroy(buffer) == PARSERUTILS_OK);
+
+	/* A capacity hint sizes the buffer once, up front */
+	assert(parserutils_buffer_create_with_capacity(100 * sizeof(chunk),
+			myrealloc, NULL, &buffer) == PARSERUTILS_OK);
+	assert(buffer->allocated > 100 * sizeof(chunk));
+
+	for (i = 0; i < 100; i++) {
+		assert(parserutils_buffer_append(buffer, chunk,
+				sizeof(chunk)) == PARSERUTILS_OK);
+	}
+	assert(buffer->grows == 0);
+
+	/* As does reserving space for a large append */
+	assert(parserutils_buffer_reserve(buffer, 1000 * sizeof(chunk)) ==
+			PARSERUTILS_OK);
+	assert(buffer->grows == 1);
+	assert(buffer->allocated - buffer->length > 1000 * sizeof(chunk));
+	assert(memcmp(buffer->data + 99 * sizeof(chunk), chunk,
+			sizeof(chunk)) == 0);
+
+	assert(parserutils_buffer_destroy(buffer) == PARSERUTILS_OK);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,195 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/charset/sniff.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+typedef struct sniff_test {
+	uint16_t mibenum;
+	const char *data;
+} sniff_test;
+
+/* Short texts in single-byte charsets */
+static const sniff_test texts[] = {
+	{ 2252,	/* windows-1252 */
+		"Le caf\xe9 est tr\xe8s bon \xe0 Paris, o\xf9 l'\xe9t\xe9"
+		" dure longtemps." },
+	{ 2252,	/* windows-1252 */
+		"\xdc" "ber die Br\xfc" "cke gehen M\xfcller und Sch\xe4" "f"
+		"er t\xe4glich zum Flu\xdf." },
+	{ 2252,	/* windows-1252 */
+		"El ni\xf1o comi\xf3 pi\xf1" "ata en la monta\xf1" "a, "
+		"\xbfverdad? S\xed, se\xf1or." },
+	{ 2250,	/* windows-1250 */
+		"Za\xbf\xf3\xb3\xe6 g\xea\x9cl\xb9 ja\x9f\xf1. P\xf8\xedl"
+		"i\x9a \x9elu\x9dou\xe8k\xfd k\xf9\xf2 \xfap\xecl \xef"
+		"\xe1" "belsk\xe9 \xf3" "dy." },
+	{ 2251,	/* windows-1251 */
+		"\xcf\xf0\xe8\xe2\xe5\xf2, \xea\xe0\xea \xe4\xe5\xeb\xe0?"
+		" \xdd\xf2\xee \xef\xf0\xee\xf1\xf2\xee\xe9 \xf2\xe5\xf1"
+		"\xf2 \xe4\xeb\xff \xef\xf0\xee\xe2\xe5\xf0\xea\xe8 \xea"
+		"\xee\xe4\xe8\xf0\xee\xe2\xea\xe8." },
+	{ 2253,	/* windows-1253 */
+		"\xca\xe1\xeb\xe7\xec\xdd\xf1\xe1 \xea\xfc\xf3\xec\xe5, "
+		"\xe1\xf5\xf4\xfc \xe5\xdf\xed\xe1\xe9 \xdd\xed\xe1 \xe1"
+		"\xf0\xeb\xfc \xea\xe5\xdf\xec\xe5\xed\xef \xe4\xef\xea"
+		"\xe9\xec\xde\xf2." },
+	{ 2254,	/* windows-1254 */
+		"T\xfcrk\xe7" "e \xf6\xf0renmek g\xfczeldir, \xfeimdi "
+		"\xfdl\xfdk bir \xe7" "ay i\xe7" "elim." },
+	{ 2255,	/* windows-1255 */
+		"\xf9\xec\xe5\xed \xf2\xe5\xec\xed, \xe6\xe4\xe5 \xe8\xf7"
+		"\xf1\xe8 \xf4\xf9\xe5\xe8 \xec\xe1\xe3\xe9\xf7\xe4 \xf9"
+		"\xec \xf7\xe9\xe3\xe5\xe3 \xfa\xe5\xe5\xe9\xed." },
+	{ 2256,	/* windows-1256 */
+		"\xe3\xd1\xcd\xc8\xc7 \xc8\xc7\xe1\xda\xc7\xe1\xe3\xa1 "
+		"\xe5\xd0\xc7 \xe4\xd5 \xc8\xd3\xed\xd8 \xe1\xc7\xce\xca"
+		"\xc8\xc7\xd1 \xca\xd1\xe3\xed\xd2 \xc7\xe1\xc3\xcd\xd1"
+		"\xdd." },
+	{ 2257,	/* windows-1257 */
+		"Labas rytas, a\xe8i\xfb u\xfe pagalb\xe0. \xd0i diena gr"
+		"a\xfei, k\xe0 tu veiki?" },
+	{ 5,	/* ISO-8859-2 */
+		"Za\xbf\xf3\xb3\xe6 g\xea\xb6l\xb1 ja\xbc\xf1, p\xf3jd"
+		"\xbcmy wi\xea" "c \xb6piewa\xe6." },
+	{ 8,	/* ISO-8859-5 */
+		"\xbf\xe0\xd8\xd2\xd5\xe2, \xda\xd0\xda \xd4\xd5\xdb\xd0?"
+		" \xcd\xe2\xde \xdf\xe0\xde\xe1\xe2\xde\xd9 \xe2\xd5\xe1"
+		"\xe2 \xd4\xdb\xef \xdf\xe0\xde\xd2\xd5\xe0\xda\xd8 \xda"
+		"\xde\xd4\xd8\xe0\xde\xd2\xda\xd8." }
+};
+
+static void check(const char *data, size_t len, uint16_t mibenum,
+		parserutils_charset_confidence confidence)
+{
+	parserutils_charset_confidence c;
+	uint16_t mib;
+
+	assert(parserutils_charset_sniff((const uint8_t *) data, len,
+			&mib, &c) == PARSERUTILS_OK);
+
+	if (mib != mibenum || c != confidence) {
+		printf("FAIL - sniffed %d (%d), expected %d (%d)\n",
+				mib, c, mibenum, confidence);
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_inputstream *stream;
+	const uint8_t *c;
+	uint16_t mib;
+	uint32_t source;
+	size_t i, clen;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	/* Nothing can be said of no data */
+	check("", 0, 0, PARSERUTILS_CHARSET_CONFIDENCE_NONE);
+
+	/* Byte order marks */
+	check("\xef\xbb\xbf" "abc", 6, 106,
+			PARSERUTILS_CHARSET_CONFIDENCE_CERTAIN);
+	check("\xfe\xff\x00" "a", 4, 1013,
+			PARSERUTILS_CHARSET_CONFIDENCE_CERTAIN);
+	check("\xff\xfe" "a\x00", 4, 1014,
+			PARSERUTILS_CHARSET_CONFIDENCE_CERTAIN);
+	check("\x00\x00\xfe\xff", 4, 1018,
+			PARSERUTILS_CHARSET_CONFIDENCE_CERTAIN);
+	check("\xff\xfe\x00\x00", 4, 1019,
+			PARSERUTILS_CHARSET_CONFIDENCE_CERTAIN);
+
+	/* UTF-16 without a BOM */
+	check("<\x00h\x00t\x00m\x00l\x00>\x00", 12, 1014,
+			PARSERUTILS_CHARSET_CONFIDENCE_TENTATIVE);
+	check("\x00<\x00h\x00t\x00m\x00l\x00>", 12, 1013,
+			PARSERUTILS_CHARSET_CONFIDENCE_TENTATIVE);
+
+	/* ASCII and UTF-8, even when cut short mid-character */
+	check("<html>", 6, 106, PARSERUTILS_CHARSET_CONFIDENCE_HIGH);
+	check("caf\xc3\xa9", 5, 106, PARSERUTILS_CHARSET_CONFIDENCE_HIGH);
+	check("caf\xc3", 4, 106, PARSERUTILS_CHARSET_CONFIDENCE_HIGH);
+
+	/* Single-byte charsets */
+	for (i = 0; i < N_ELEMENTS(texts); i++) {
+		check(texts[i].data, strlen(texts[i].data), texts[i].mibenum,
+				PARSERUTILS_CHARSET_CONFIDENCE_TENTATIVE);
+	}
+
+	/* Without letters, the most widely used charset is assumed */
+	check("1\xa0" "000", 5, 2252,
+			PARSERUTILS_CHARSET_CONFIDENCE_TENTATIVE);
+
+	/* Detection needs enough data to rule out a BOM */
+	mib = 0;
+	assert(parserutils_charset_detect((const uint8_t *) "abc", 3,
+			&mib, &source) == PARSERUTILS_NEEDDATA);
+
+	/* A BOM overrides the charset given */
+	mib = 2252;
+	source = 1;
+	assert(parserutils_charset_detect(
+			(const uint8_t *) "\xef\xbb\xbf" "abc", 6,
+			&mib, &source) == PARSERUTILS_OK);
+	assert(mib == 106 && source == PARSERUTILS_CHARSET_CONFIDENCE_CERTAIN);
+
+	/* Otherwise, it is left alone */
+	mib = 2252;
+	source = 1;
+	assert(parserutils_charset_detect((const uint8_t *) "caf\xc3\xa9", 5,
+			&mib, &source) == PARSERUTILS_OK);
+	assert(mib == 2252 && source == 1);
+
+	/* Unless none was given */
+	mib = 0;
+	source = 0;
+	assert(parserutils_charset_detect((const uint8_t *) texts[0].data,
+			strlen(texts[0].data), &mib, &source) == PARSERUTILS_OK);
+	assert(mib == 2252 &&
+			source == PARSERUTILS_CHARSET_CONFIDENCE_TENTATIVE);
+
+	/* Streams decode the sniffed charset */
+	assert(parserutils_inputstream_create(NULL, 0,
+			parserutils_charset_detect, myrealloc, NULL,
+			&stream) == PARSERUTILS_OK);
+
+	assert(parserutils_inputstream_append(stream,
+			(const uint8_t *) "caf\xe9 cr\xe8me", 10) ==
+			PARSERUTILS_OK);
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	for (i = 0; i < 3; i++) {
+		assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+				PARSERUTILS_OK);
+		parserutils_inputstream_advance(stream, clen);
+	}
+
+	assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK);
+	assert(clen == 2 && memcmp(c, "\xc3\xa9", 2) == 0);
+
+	assert(strcmp(parserutils_inputstream_read_charset(stream, &source),
+			"windows-1252") == 0);
+	assert(source == PARSERUTILS_CHARSET_CONFIDENCE_TENTATIVE);
+
+	parserutils_inputstream_destroy(stream);
+
+	printf("PASS\n");
+
+	return 0;
+}
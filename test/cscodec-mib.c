@@ -0,0 +1,59 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/charset/codec.h>
+#include <parserutils/charset/mibenum.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_charset_codec *codec;
+	uint32_t mibenum, native = 0;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	assert(parserutils_charset_codec_create_mib(106, NULL, NULL,
+			&codec) == PARSERUTILS_BADPARM);
+	assert(parserutils_charset_codec_create_mib(106, myrealloc, NULL,
+			NULL) == PARSERUTILS_BADPARM);
+
+	/* Creating by MIB enum finds the same codecs as creating by name */
+	for (mibenum = 0; mibenum <= UINT16_MAX; mibenum++) {
+		const char *name = parserutils_charset_mibenum_to_name(mibenum);
+		parserutils_error expected = PARSERUTILS_BADENCODING;
+
+		if (name != NULL) {
+			expected = parserutils_charset_codec_create(name,
+					myrealloc, NULL, &codec);
+			if (expected == PARSERUTILS_OK)
+				parserutils_charset_codec_destroy(codec);
+		}
+
+		assert(parserutils_charset_codec_create_mib(mibenum,
+				myrealloc, NULL, &codec) == expected);
+
+		if (expected == PARSERUTILS_OK) {
+			parserutils_charset_codec_destroy(codec);
+			native++;
+		}
+	}
+
+	printf("%u charsets have native codecs\n", native);
+	assert(native > 0);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,98 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/charset/codec.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+typedef struct testcase {
+	const char *charset;		/**< Charset under test */
+	const char *data;		/**< Encoded data */
+	size_t len;			/**< Byte length of data */
+} testcase;
+
+/* Each is "Long enough to be widened in bulk: " followed by U+00E9 */
+#define PREFIX "Long enough to be widened in bulk: "
+
+static const testcase tests[] = {
+	{ "UTF-8", PREFIX "\xc3\xa9", SLEN(PREFIX "\xc3\xa9") },
+	{ "ISO-8859-1", PREFIX "\xe9", SLEN(PREFIX "\xe9") },
+	{ "windows-1252", PREFIX "\xe9", SLEN(PREFIX "\xe9") },
+	{ "EUC-JP", PREFIX "\x8f\xab\xb1", SLEN(PREFIX "\x8f\xab\xb1") },
+	{ "GB18030", PREFIX "\xa8\xa6", SLEN(PREFIX "\xa8\xa6") },
+};
+
+static void run_test(const testcase *t)
+{
+	parserutils_charset_codec *codec;
+	parserutils_charset_codec_optparams params;
+	uint32_t ucs4[64];
+	uint8_t out[64];
+	const uint8_t *src;
+	uint8_t *dest;
+	size_t srclen, destlen, i;
+
+	assert(parserutils_charset_codec_create(t->charset, myrealloc, NULL,
+			&codec) == PARSERUTILS_OK);
+
+	params.ucs4_order.order = PARSERUTILS_CHARSET_CODEC_UCS4_HOST;
+	assert(parserutils_charset_codec_setopt(codec,
+			PARSERUTILS_CHARSET_CODEC_UCS4_ORDER,
+			&params) == PARSERUTILS_OK);
+
+	/* Decoding produces host endian UCS-4 */
+	src = (const uint8_t *) t->data;
+	srclen = t->len;
+	dest = (uint8_t *) ucs4;
+	destlen = sizeof(ucs4);
+
+	assert(parserutils_charset_codec_decode(codec, &src, &srclen,
+			&dest, &destlen) == PARSERUTILS_OK);
+	assert(srclen == 0);
+	assert(dest == (uint8_t *) ucs4 + (SLEN(PREFIX) + 1) * 4);
+
+	for (i = 0; i < SLEN(PREFIX); i++)
+		assert(ucs4[i] == (uint8_t) PREFIX[i]);
+	assert(ucs4[i] == 0xE9);
+
+	/* And encoding consumes it */
+	src = (const uint8_t *) ucs4;
+	srclen = (SLEN(PREFIX) + 1) * 4;
+	dest = out;
+	destlen = sizeof(out);
+
+	assert(parserutils_charset_codec_encode(codec, &src, &srclen,
+			&dest, &destlen) == PARSERUTILS_OK);
+	assert(srclen == 0);
+	assert((size_t) (dest - out) == t->len);
+	assert(memcmp(out, t->data, t->len) == 0);
+
+	parserutils_charset_codec_destroy(codec);
+
+	printf("%s: OK\n", t->charset);
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	for (i = 0; i < N_ELEMENTS(tests); i++)
+		run_test(&tests[i]);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -94,6 +94,7 @@ int main(int argc, char **argv)
 	run_test(&ctx);
 
 	free(ctx.buf);
+	free(ctx.exp);
 
 	parserutils_charset_codec_destroy(ctx.codec);
 
@@ -121,10 +122,12 @@ bool handle_line(const char *data, size_t datalen, void *pw)
 		if (ctx->inexp) {
 			/* This marks end of testcase, so run it */
 
-			if (ctx->buf[ctx->bufused - 1] == '\n')
+			if (ctx->bufused > 0 &&
+					ctx->buf[ctx->bufused - 1] == '\n')
 				ctx->bufused -= 1;
 
-			if (ctx->exp[ctx->expused - 1] == '\n')
+			if (ctx->expused > 0 &&
+					ctx->exp[ctx->expused - 1] == '\n')
 				ctx->expused -= 1;
 
 			run_test(ctx);
@@ -317,5 +320,27 @@ void run_test(line_ctx *ctx)
 
 	assert(pdest == dest + ctx->expused);
 	assert(memcmp(dest, ctx->exp, ctx->expused) == 0);
+
+	/* Decoding a byte at a time gives the same result */
+	if (ctx->dir == DECODE && ctx->exp_ret == PARSERUTILS_OK) {
+		assert(parserutils_charset_codec_reset(ctx->codec) ==
+				PARSERUTILS_OK);
+
+		psrc = ctx->buf;
+		pdest = dest;
+		destlen = ctx->bufused * 4;
+
+		for (i = 0; i < ctx->bufused; i++) {
+			srclen = 1;
+
+			assert(parserutils_charset_codec_decode(ctx->codec,
+					&psrc, &srclen,
+					&pdest, &destlen) == PARSERUTILS_OK);
+			assert(srclen == 0);
+		}
+
+		assert(pdest == dest + ctx->expused);
+		assert(memcmp(dest, ctx->exp, ctx->expused) == 0);
+	}
 }
 
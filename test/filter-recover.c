@@ -0,0 +1,180 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WITHOUT_ICONV_FILTER
+#include <errno.h>
+#include <iconv.h>
+#endif
+
+#include <parserutils/parserutils.h>
+
+#include "utils/utils.h"
+
+#include "input/filter.h"
+
+#include "testutils.h"
+
+#define DOC_LEN (16 * 1024)
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+
+	return (seed >> 16) & 0x7fff;
+}
+
+/* Text, interrupted by runs of random bytes, as if mislabelled */
+static size_t make_doc(uint8_t *doc)
+{
+	size_t len = 0;
+
+	while (len < DOC_LEN - 64) {
+		size_t run = rnd() % 40, i;
+
+		if (rnd() & 1) {
+			for (i = 0; i < run; i++)
+				doc[len++] = 0x80 + rnd() % 0x80;
+		} else {
+			for (i = 0; i < run; i++)
+				doc[len++] = 'a' + rnd() % 26;
+		}
+
+		if (rnd() % 4 == 0) {
+			/* A character, in UTF-8 or TIS-620 */
+			doc[len++] = 0xE0;
+			doc[len++] = 0xB8;
+			doc[len++] = 0x81 + rnd() % 0x30;
+		}
+	}
+
+	return len;
+}
+
+/* Convert a document, into output buffers of random sizes */
+static size_t filter(const char *enc, const uint8_t *doc, size_t len,
+		uint8_t *out, uint32_t *replacements)
+{
+	parserutils_filter_optparams params;
+	parserutils_filter *input;
+	const uint8_t *in = doc;
+	uint8_t *o = out;
+	size_t inlen = len;
+
+	assert(parserutils__filter_create("UTF-8", myrealloc, NULL, &input) ==
+			PARSERUTILS_OK);
+
+	params.encoding.name = enc;
+	assert(parserutils__filter_setopt(input,
+			PARSERUTILS_FILTER_SET_ENCODING, &params) ==
+			PARSERUTILS_OK);
+
+	while (inlen > 0) {
+		size_t space = 1 + rnd() % 200, outlen = space;
+		parserutils_error error;
+
+		error = parserutils__filter_process_chunk(input, &in, &inlen,
+				&o, &outlen);
+		assert(error == PARSERUTILS_OK || error == PARSERUTILS_NOMEM);
+
+		/* Only incomplete input may be left over */
+		if (error == PARSERUTILS_OK && inlen > 0)
+			break;
+	}
+
+	*replacements = parserutils__filter_replacements(input);
+
+	parserutils__filter_destroy(input);
+
+	return o - out;
+}
+
+#ifndef WITHOUT_ICONV_FILTER
+/* Convert a document as iconv would, replacing each byte it rejects */
+static size_t reference(const char *enc, const uint8_t *doc, size_t len,
+		uint8_t *out, uint32_t *replacements)
+{
+	iconv_t cd = iconv_open("UTF-8", enc);
+	char *in = (char *) doc, *o = (char *) out;
+	size_t inlen = len, outlen = len * 4;
+
+	assert(cd != (iconv_t) -1);
+
+	*replacements = 0;
+
+	while (inlen > 0 && iconv(cd, &in, &inlen, &o, &outlen) ==
+			(size_t) -1 && errno == EILSEQ) {
+		memcpy(o, "\xef\xbf\xbd", 3);
+		o += 3;
+		outlen -= 3;
+		in++;
+		inlen--;
+		(*replacements)++;
+	}
+
+	iconv_close(cd);
+
+	return o - (char *) out;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	static const char *encs[] = { "UTF-8", "TIS-620" };
+	uint8_t *doc, *out;
+	size_t i, len;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	doc = malloc(DOC_LEN);
+	out = malloc(DOC_LEN * 4);
+	assert(doc != NULL && out != NULL);
+
+	len = make_doc(doc);
+
+	for (i = 0; i < N_ELEMENTS(encs); i++) {
+#ifndef WITHOUT_ICONV_FILTER
+		uint8_t *expect = malloc(DOC_LEN * 4);
+		uint32_t repl, expect_repl;
+		size_t outlen, expect_len;
+
+		assert(expect != NULL);
+
+		outlen = filter(encs[i], doc, len, out, &repl);
+		expect_len = reference(encs[i], doc, len, expect,
+				&expect_repl);
+
+		if (outlen != expect_len || memcmp(out, expect, outlen) != 0 ||
+				repl != expect_repl) {
+			printf("FAIL - %s recovered differently\n", encs[i]);
+			return 1;
+		}
+
+		free(expect);
+#else
+		uint32_t repl;
+
+		/* Only UTF-8 is supported, by a native codec */
+		if (i == 0)
+			assert(filter(encs[i], doc, len, out, &repl) > len);
+#endif
+	}
+
+	free(out);
+	free(doc);
+
+	printf("PASS\n");
+
+	return 0;
+}
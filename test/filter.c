@@ -340,6 +340,193 @@ int main(int argc, char **argv)
 			SLEN("hell\xe2\x80\xa2o!")) == 0);
 
 
+	/* A tiny pivot buffer needs many round trips */
+	params.pivot.size = 2;
+	assert(parserutils__filter_setopt(input,
+			PARSERUTILS_FILTER_SET_PIVOT_SIZE,
+			(parserutils_filter_optparams *) &params) ==
+			PARSERUTILS_OK);
+
+	in = inbuf;
+	out = outbuf;
+	strcpy((char *) inbuf, "hell\xc2\xa0o!");
+	inlen = strlen((const char *) inbuf);
+	outbuf[0] = '\0';
+	outlen = 64;
+
+	assert(parserutils__filter_process_chunk(input, &in, &inlen,
+			&out, &outlen) == PARSERUTILS_OK);
+
+	printf("'%.*s' %d '%.*s' %d\n", (int) inlen, in, (int) inlen,
+			(int) (out - ((uint8_t *) outbuf)),
+			outbuf, (int) outlen);
+
+	assert(parserutils__filter_reset(input) == PARSERUTILS_OK);
+
+	assert(out == outbuf + SLEN("hell\xc2\xa0o!"));
+	assert(memcmp(outbuf, "hell\xc2\xa0o!",
+			SLEN("hell\xc2\xa0o!")) == 0);
+
+	params.pivot.size = 0;
+	assert(parserutils__filter_setopt(input,
+			PARSERUTILS_FILTER_SET_PIVOT_SIZE,
+			(parserutils_filter_optparams *) &params) !=
+			PARSERUTILS_NOMEM);
+
+	params.pivot.size = 4096;
+	assert(parserutils__filter_setopt(input,
+			PARSERUTILS_FILTER_SET_PIVOT_SIZE,
+			(parserutils_filter_optparams *) &params) ==
+			PARSERUTILS_OK);
+
+
+	/* Single-byte charset, with a character the output buffer can't
+	 * fit and one which is undefined */
+	params.encoding.name = "Windows-1252";
+	assert(parserutils__filter_setopt(input, PARSERUTILS_FILTER_SET_ENCODING,
+			(parserutils_filter_optparams *) &params) ==
+			PARSERUTILS_OK);
+
+	in = inbuf;
+	out = outbuf;
+	strcpy((char *) inbuf, "hell\x80o\x81!");
+	inlen = strlen((const char *) inbuf);
+	outbuf[0] = '\0';
+	outlen = 6;
+
+	assert(parserutils__filter_process_chunk(input, &in, &inlen,
+			&out, &outlen) == PARSERUTILS_NOMEM);
+
+	printf("'%.*s' %d '%.*s' %d\n", (int) inlen, in, (int) inlen,
+			(int) (out - ((uint8_t *) outbuf)),
+			outbuf, (int) outlen);
+
+	assert(inlen == 4 && out == outbuf + 4);
+
+	outlen = 64 - 6 + outlen;
+
+	assert(parserutils__filter_process_chunk(input, &in, &inlen,
+			&out, &outlen) == PARSERUTILS_OK);
+
+	printf("'%.*s' %d '%.*s' %d\n", (int) inlen, in, (int) inlen,
+			(int) (out - ((uint8_t *) outbuf)),
+			outbuf, (int) outlen);
+
+	assert(parserutils__filter_reset(input) == PARSERUTILS_OK);
+
+	assert(out == outbuf + SLEN("hell\xe2\x82\xaco\xef\xbf\xbd!"));
+	assert(memcmp(outbuf, "hell\xe2\x82\xaco\xef\xbf\xbd!",
+			SLEN("hell\xe2\x82\xaco\xef\xbf\xbd!")) == 0);
+
+
+	/* ISO-8859-n, whose bytes 0x80-0x9F are the C1 controls */
+	params.encoding.name = "ISO-8859-1";
+	assert(parserutils__filter_setopt(input, PARSERUTILS_FILTER_SET_ENCODING,
+			(parserutils_filter_optparams *) &params) ==
+			PARSERUTILS_OK);
+
+	in = inbuf;
+	out = outbuf;
+	strcpy((char *) inbuf, "a\x80\x98\x9f");
+	inlen = strlen((const char *) inbuf);
+	outbuf[0] = '\0';
+	outlen = 64;
+
+	assert(parserutils__filter_process_chunk(input, &in, &inlen,
+			&out, &outlen) == PARSERUTILS_OK);
+
+	printf("'%.*s' %d '%.*s' %d\n", (int) inlen, in, (int) inlen,
+			(int) (out - ((uint8_t *) outbuf)),
+			outbuf, (int) outlen);
+
+	assert(parserutils__filter_reset(input) == PARSERUTILS_OK);
+
+	assert(out == outbuf + SLEN("a\xc2\x80\xc2\x98\xc2\x9f"));
+	assert(memcmp(outbuf, "a\xc2\x80\xc2\x98\xc2\x9f",
+			SLEN("a\xc2\x80\xc2\x98\xc2\x9f")) == 0);
+
+
+	/* Little endian UTF-16, containing a surrogate pair */
+	params.encoding.name = "UTF-16LE";
+	assert(parserutils__filter_setopt(input, PARSERUTILS_FILTER_SET_ENCODING,
+			(parserutils_filter_optparams *) &params) ==
+			PARSERUTILS_OK);
+
+	in = inbuf;
+	out = outbuf;
+	memcpy(inbuf, "h\0e\0l\0l\0\x3d\xd8\x00\xdeo\0!\0", 16);
+	inlen = 16;
+	outbuf[0] = '\0';
+	outlen = 64;
+
+	assert(parserutils__filter_process_chunk(input, &in, &inlen,
+			&out, &outlen) == PARSERUTILS_OK);
+
+	printf("'%.*s' %d '%.*s' %d\n", (int) inlen, in, (int) inlen,
+			(int) (out - ((uint8_t *) outbuf)),
+			outbuf, (int) outlen);
+
+	assert(parserutils__filter_reset(input) == PARSERUTILS_OK);
+
+	assert(out == outbuf + SLEN("hell\xf0\x9f\x98\x80o!"));
+	assert(memcmp(outbuf, "hell\xf0\x9f\x98\x80o!",
+			SLEN("hell\xf0\x9f\x98\x80o!")) == 0);
+
+
+	/* Little endian UTF-32, with an out of range code unit */
+	params.encoding.name = "UTF-32LE";
+	assert(parserutils__filter_setopt(input, PARSERUTILS_FILTER_SET_ENCODING,
+			(parserutils_filter_optparams *) &params) ==
+			PARSERUTILS_OK);
+
+	in = inbuf;
+	out = outbuf;
+	memcpy(inbuf, "h\0\0\0e\0\0\0l\0\0\0l\0\0\0\x00\xf6\x01\0"
+			"\0\0\x11\0o\0\0\0!\0\0\0", 32);
+	inlen = 32;
+	outbuf[0] = '\0';
+	outlen = 64;
+
+	assert(parserutils__filter_process_chunk(input, &in, &inlen,
+			&out, &outlen) == PARSERUTILS_OK);
+
+	printf("'%.*s' %d '%.*s' %d\n", (int) inlen, in, (int) inlen,
+			(int) (out - ((uint8_t *) outbuf)),
+			outbuf, (int) outlen);
+
+	assert(parserutils__filter_reset(input) == PARSERUTILS_OK);
+
+	assert(out == outbuf + SLEN("hell\xf0\x9f\x98\x80\xef\xbf\xbdo!"));
+	assert(memcmp(outbuf, "hell\xf0\x9f\x98\x80\xef\xbf\xbdo!",
+			SLEN("hell\xf0\x9f\x98\x80\xef\xbf\xbdo!")) == 0);
+
+
+	/* Shift_JIS, with an invalid trail byte */
+	params.encoding.name = "Shift_JIS";
+	assert(parserutils__filter_setopt(input, PARSERUTILS_FILTER_SET_ENCODING,
+			(parserutils_filter_optparams *) &params) ==
+			PARSERUTILS_OK);
+
+	in = inbuf;
+	out = outbuf;
+	memcpy(inbuf, "hell\x82\xa0\x82\x41o!", 10);
+	inlen = 10;
+	outbuf[0] = '\0';
+	outlen = 64;
+
+	assert(parserutils__filter_process_chunk(input, &in, &inlen,
+			&out, &outlen) == PARSERUTILS_OK);
+
+	printf("'%.*s' %d '%.*s' %d\n", (int) inlen, in, (int) inlen,
+			(int) (out - ((uint8_t *) outbuf)),
+			outbuf, (int) outlen);
+
+	assert(parserutils__filter_reset(input) == PARSERUTILS_OK);
+
+	assert(out == outbuf + SLEN("hell\xe3\x81\x82\xef\xbf\xbd" "Ao!"));
+	assert(memcmp(outbuf, "hell\xe3\x81\x82\xef\xbf\xbd" "Ao!",
+			SLEN("hell\xe3\x81\x82\xef\xbf\xbd" "Ao!")) == 0);
+
 	/* Clean up */
 	parserutils__filter_destroy(input);
 
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/utils/hash.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define N_KEYS (20000)
+
+static int outstanding;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	if (ptr == NULL && len > 0)
+		outstanding++;
+	else if (ptr != NULL && len == 0)
+		outstanding--;
+
+	return realloc(ptr, len);
+}
+
+static char keys[N_KEYS][16];
+
+int main(int argc, char **argv)
+{
+	parserutils_hash *hash;
+	size_t count, i;
+	void *value;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	assert(parserutils_hash_create(myrealloc, NULL, &hash) ==
+			PARSERUTILS_OK);
+
+	assert(parserutils_hash_find(hash, (const uint8_t *) "a", 1,
+			&value) == PARSERUTILS_INVALID);
+
+	for (i = 0; i < N_KEYS; i++) {
+		sprintf(keys[i], "key%u", (unsigned) i);
+		assert(parserutils_hash_insert(hash, (const uint8_t *) keys[i],
+				strlen(keys[i]), keys[i]) == PARSERUTILS_OK);
+	}
+
+	/* The empty string is a key like any other */
+	assert(parserutils_hash_insert(hash, NULL, 0, hash) ==
+			PARSERUTILS_OK);
+
+	assert(parserutils_hash_get_count(hash, &count) == PARSERUTILS_OK);
+	assert(count == N_KEYS + 1);
+
+	for (i = 0; i < N_KEYS; i++) {
+		assert(parserutils_hash_find(hash, (const uint8_t *) keys[i],
+				strlen(keys[i]), &value) == PARSERUTILS_OK);
+		assert(value == keys[i]);
+	}
+	assert(parserutils_hash_find(hash, (const uint8_t *) "", 0,
+			&value) == PARSERUTILS_OK && value == hash);
+
+	/* Keys are compared in full, not by prefix */
+	assert(parserutils_hash_find(hash, (const uint8_t *) "key1", 3,
+			NULL) == PARSERUTILS_INVALID);
+	assert(parserutils_hash_find(hash, (const uint8_t *) "key100000", 9,
+			NULL) == PARSERUTILS_INVALID);
+
+	/* Replace a value */
+	assert(parserutils_hash_insert(hash, (const uint8_t *) "key7", 4,
+			NULL) == PARSERUTILS_OK);
+	assert(parserutils_hash_find(hash, (const uint8_t *) "key7", 4,
+			&value) == PARSERUTILS_OK && value == NULL);
+
+	/* Remove every other key, then insert and remove many more times,
+	 * so deleted entries accumulate and are discarded */
+	for (i = 0; i < N_KEYS; i += 2) {
+		assert(parserutils_hash_remove(hash, (const uint8_t *) keys[i],
+				strlen(keys[i])) == PARSERUTILS_OK);
+	}
+	assert(parserutils_hash_remove(hash, (const uint8_t *) keys[0],
+			strlen(keys[0])) == PARSERUTILS_INVALID);
+
+	for (i = 0; i < 10 * N_KEYS; i++) {
+		const uint8_t *k = (const uint8_t *) keys[(i % (N_KEYS / 2)) * 2];
+		size_t len = strlen((const char *) k);
+
+		assert(parserutils_hash_insert(hash, k, len, NULL) ==
+				PARSERUTILS_OK);
+		assert(parserutils_hash_remove(hash, k, len) ==
+				PARSERUTILS_OK);
+	}
+
+	assert(parserutils_hash_get_count(hash, &count) == PARSERUTILS_OK);
+	assert(count == N_KEYS / 2 + 1);
+
+	for (i = 0; i < N_KEYS; i++) {
+		parserutils_error expected = (i % 2 == 0)
+				? PARSERUTILS_INVALID : PARSERUTILS_OK;
+
+		assert(parserutils_hash_find(hash, (const uint8_t *) keys[i],
+				strlen(keys[i]), NULL) == expected);
+	}
+
+	assert(parserutils_hash_destroy(hash) == PARSERUTILS_OK);
+	assert(outstanding == 0);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,371 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/charset/mibenum.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Segments lent to a stream, in order */
+typedef struct lender {
+	const uint8_t *data[4096];	/* Start of each segment */
+	size_t len[4096];		/* Length of each segment */
+	uint32_t lent;			/* Segments lent */
+	uint32_t released;		/* Segments released */
+} lender;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Segments are released once, in the order they were lent */
+static void release(const uint8_t *data, size_t len, void *pw)
+{
+	lender *l = pw;
+
+	assert(l->released < l->lent);
+	assert(data == l->data[l->released] && len == l->len[l->released]);
+
+	l->released++;
+}
+
+static parserutils_error lend(parserutils_inputstream *stream, lender *l,
+		const uint8_t *data, size_t len)
+{
+	parserutils_error error;
+
+	l->data[l->lent] = data;
+	l->len[l->lent] = len;
+	l->lent++;
+
+	error = parserutils_inputstream_append_borrowed(stream, data, len,
+			release, l);
+	if (error != PARSERUTILS_OK)
+		l->lent--;
+
+	return error;
+}
+
+/* Read what's available, checking it matches the expected data */
+static parserutils_error expect(parserutils_inputstream *stream,
+		const char *data, size_t len, size_t *off)
+{
+	const uint8_t *c;
+	size_t clen;
+	parserutils_error error;
+
+	while ((error = parserutils_inputstream_peek(stream, 0, &c, &clen)) ==
+			PARSERUTILS_OK) {
+		assert(*off + clen <= len && memcmp(c, data + *off, clen) == 0);
+
+		parserutils_inputstream_advance(stream, clen);
+		*off += clen;
+	}
+
+	return error;
+}
+
+/* Needs a few bytes to decide that the document is Shift_JIS */
+static parserutils_error detect(const uint8_t *data, size_t len,
+		uint16_t *mibenum, uint32_t *source)
+{
+	if (len < 8)
+		return PARSERUTILS_NEEDDATA;
+
+	assert(memcmp(data, "\x82\xa0\x82\xa2\x82\xa4\x82\xa6", 8) == 0);
+
+	*mibenum = parserutils_charset_mibenum_from_name("Shift_JIS",
+			SLEN("Shift_JIS"));
+	*source = 2;
+
+	return PARSERUTILS_OK;
+}
+
+/* A document lent in pieces of every size decodes as if copied, with
+ * each piece released once it's been decoded */
+static void check_split(const char *enc, const char *doc, size_t len,
+		const char *utf8, size_t utf8_len)
+{
+	size_t size;
+
+	for (size = 1; size < 9; size++) {
+		parserutils_inputstream *stream;
+		size_t in = 0, out = 0;
+		lender l;
+
+		memset(&l, 0, sizeof(l));
+
+		assert(parserutils_inputstream_create(enc, 1, NULL,
+				myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+		while (in < len) {
+			size_t n = min(size, len - in);
+
+			assert(lend(stream, &l, (const uint8_t *) doc + in,
+					n) == PARSERUTILS_OK);
+			in += n;
+
+			/* Anything wholly decoded has been released */
+			assert(expect(stream, utf8, utf8_len, &out) ==
+					PARSERUTILS_NEEDDATA);
+			assert(l.lent - l.released <= 2);
+		}
+
+		assert(parserutils_inputstream_append(stream, NULL, 0) ==
+				PARSERUTILS_OK);
+		assert(expect(stream, utf8, utf8_len, &out) ==
+				PARSERUTILS_EOF);
+		assert(out == utf8_len && l.released == l.lent);
+
+		parserutils_inputstream_destroy(stream);
+	}
+}
+
+/* A large document is decoded where it is */
+static void check_in_place(void)
+{
+	static char doc[256 * 1024], utf8[512 * 1024];
+	parserutils_inputstream_stats stats;
+	parserutils_inputstream *stream;
+	size_t i, len = 0, out = 0;
+	lender l;
+
+	for (i = 0; i < sizeof(doc); i++) {
+		doc[i] = (i % 29 == 0) ? '\x80' : (char) ('a' + i % 26);
+
+		if (doc[i] == '\x80') {
+			memcpy(utf8 + len, "\xe2\x82\xac", 3);
+			len += 3;
+		} else {
+			utf8[len++] = doc[i];
+		}
+	}
+
+	memset(&l, 0, sizeof(l));
+
+	assert(parserutils_inputstream_create("windows-1252", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	for (i = 0; i < sizeof(doc); i += 4096) {
+		assert(lend(stream, &l, (const uint8_t *) doc + i, 4096) ==
+				PARSERUTILS_OK);
+	}
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	assert(expect(stream, utf8, len, &out) == PARSERUTILS_EOF);
+	assert(out == len && l.released == l.lent);
+
+	/* Nothing like the document's size was copied */
+	assert(parserutils_inputstream_get_stats(stream, &stats) ==
+			PARSERUTILS_OK);
+	assert(stats.decoded == sizeof(doc) && stats.peak < sizeof(doc) / 4);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+/* Copied and lent data may be mixed, in one call or several */
+static void check_mixed(void)
+{
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream_iov iov[4];
+	parserutils_inputstream *stream;
+	size_t out = 0;
+	lender l;
+
+	memset(&l, 0, sizeof(l));
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	/* Lent data followed by copied data is copied */
+	assert(lend(stream, &l, (const uint8_t *) "ab\xc3", 3) ==
+			PARSERUTILS_OK);
+	assert(parserutils_inputstream_append(stream,
+			(const uint8_t *) "\xa9" "c", 2) == PARSERUTILS_OK);
+	assert(l.released == 1);
+
+	l.data[1] = (const uint8_t *) "d";
+	l.len[1] = 1;
+	l.data[2] = (const uint8_t *) "\xe2\x82";
+	l.len[2] = 2;
+	l.data[3] = (const uint8_t *) "\xac" "f";
+	l.len[3] = 2;
+	l.lent = 4;
+
+	iov[0].data = l.data[1];
+	iov[0].len = 1;
+	iov[1].data = (const uint8_t *) "e";
+	iov[1].len = 1;
+	iov[1].release = NULL;
+	iov[2].data = l.data[2];
+	iov[2].len = 2;
+	iov[3].data = l.data[3];
+	iov[3].len = 2;
+	iov[0].release = iov[2].release = iov[3].release = release;
+	iov[0].pw = iov[2].pw = iov[3].pw = &l;
+
+	assert(parserutils_inputstream_append_iov(stream, iov, 4) ==
+			PARSERUTILS_OK);
+	assert(l.released == 2);
+
+	assert(expect(stream, "ab\xc3\xa9" "cde\xe2\x82\xac" "f", 11, &out) ==
+			PARSERUTILS_NEEDDATA);
+	assert(out == 11 && l.released == 4);
+
+	/* Data that won't fit is left with the caller */
+	params.limits.raw = 4;
+	params.limits.utf8 = 0;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_LIMITS, &params) ==
+			PARSERUTILS_OK);
+
+	assert(lend(stream, &l, (const uint8_t *) "ghi", 3) ==
+			PARSERUTILS_OK);
+	assert(lend(stream, &l, (const uint8_t *) "jk", 2) ==
+			PARSERUTILS_FULL);
+	assert(parserutils_inputstream_append_borrowed(stream,
+			(const uint8_t *) "l", 1, NULL, NULL) ==
+			PARSERUTILS_BADPARM);
+	assert(l.released == 4);
+
+	/* Resetting the stream releases what it hasn't read */
+	assert(parserutils_inputstream_reset(stream, "UTF-8", 1, NULL) ==
+			PARSERUTILS_OK);
+	assert(l.released == 5);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+/* Streams which keep their data copy it */
+static void check_retained(void)
+{
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream *stream;
+	size_t out = 0;
+	lender l;
+
+	memset(&l, 0, sizeof(l));
+
+	assert(parserutils_inputstream_create(NULL, 0, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	/* Including data lent before a retention limit was set */
+	assert(lend(stream, &l, (const uint8_t *) "caf", 3) ==
+			PARSERUTILS_OK);
+
+	params.retention.limit = 1024;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_RETENTION, &params) ==
+			PARSERUTILS_OK);
+	assert(l.released == 1);
+
+	assert(lend(stream, &l, (const uint8_t *) "\xe9", 1) ==
+			PARSERUTILS_OK);
+	assert(l.released == 2);
+
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+	assert(expect(stream, "caf\xef\xbf\xbd", 6, &out) ==
+			PARSERUTILS_EOF);
+
+	/* So may be decoded again, differently */
+	assert(parserutils_inputstream_change_charset(stream, "ISO-8859-1",
+			2) == PARSERUTILS_OK);
+	out = 0;
+	assert(expect(stream, "caf\xc3\xa9", 5, &out) == PARSERUTILS_EOF);
+	assert(out == 5);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+/* Charset detection sees past a short first segment */
+static void check_detect(void)
+{
+	static const char *doc = "\x82\xa0\x82\xa2\x82\xa4\x82\xa6";
+	parserutils_inputstream *stream;
+	size_t i, out = 0;
+	uint32_t source;
+	lender l;
+
+	memset(&l, 0, sizeof(l));
+
+	assert(parserutils_inputstream_create(NULL, 0, detect,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	for (i = 0; i < 8; i += 2) {
+		assert(lend(stream, &l, (const uint8_t *) doc + i, 2) ==
+				PARSERUTILS_OK);
+	}
+
+	assert(expect(stream, "\xe3\x81\x82\xe3\x81\x84\xe3\x81\x86"
+			"\xe3\x81\x88", 12, &out) == PARSERUTILS_NEEDDATA);
+	assert(out == 12 && l.released == 4);
+	assert(strcmp(parserutils_inputstream_read_charset(stream, &source),
+			"Shift_JIS") == 0 && source == 2);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+/* A character split after the first stitched bytes isn't cut short by EOF */
+static void check_stitched(void)
+{
+	static char doc[129], utf8[129];
+	parserutils_inputstream *stream;
+	size_t out = 0;
+	lender l;
+
+	memset(doc, 'a', 126);
+	memcpy(doc + 126, "\xe2\xac\x98", 3);
+	memcpy(utf8, doc, sizeof(doc));
+
+	memset(&l, 0, sizeof(l));
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	assert(lend(stream, &l, (const uint8_t *) doc, 6) == PARSERUTILS_OK);
+	assert(lend(stream, &l, (const uint8_t *) doc + 6, 119) ==
+			PARSERUTILS_OK);
+	assert(lend(stream, &l, (const uint8_t *) doc + 125, 4) ==
+			PARSERUTILS_OK);
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	assert(expect(stream, utf8, sizeof(utf8), &out) == PARSERUTILS_EOF);
+	assert(out == sizeof(utf8) && l.released == l.lent);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+int main(int argc, char **argv)
+{
+	UNUSED(argc);
+	UNUSED(argv);
+
+	check_split("UTF-8", "a\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80" "b",
+			11, "a\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80" "b", 11);
+	check_split("Shift_JIS", "a\x82\xa0\x82\xa2" "b\x82\xa4", 8,
+			"a\xe3\x81\x82\xe3\x81\x84" "b\xe3\x81\x86", 11);
+	check_split("UTF-16LE", "a\0\xe9\0\x3d\xd8\x00\xde" "b\0", 10,
+			"a\xc3\xa9\xf0\x9f\x98\x80" "b", 8);
+	check_split("windows-1252", "caf\xe9 \x80", 6,
+			"caf\xc3\xa9 \xe2\x82\xac", 9);
+
+	check_in_place();
+	check_mixed();
+	check_retained();
+	check_detect();
+	check_stitched();
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,240 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/charset/mibenum.h>
+#include <parserutils/input/cache.h>
+#include <parserutils/input/inputstream.h>
+
+#include "input/cache.h"
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define DOC_LEN (10000)
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* A lock, checking that it's taken and released in turn */
+typedef struct test_lock {
+	bool held;
+	uint32_t taken;
+} test_lock;
+
+static void mylock(bool acquire, void *pw)
+{
+	test_lock *lock = pw;
+
+	assert(lock->held != acquire);
+
+	lock->held = acquire;
+	if (acquire)
+		lock->taken++;
+}
+
+/* Fill a document with Latin-1 text, and a byte undefined in Windows-1252 */
+static void fill(uint8_t *doc, size_t len, uint8_t mark)
+{
+	static const char text[] =
+			"Caf\xE9 cr\xE8me, na\xEFve \x93quotes\x94\n";
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		doc[i] = text[i % (sizeof(text) - 1)];
+
+	doc[len / 2] = mark;
+	doc[len / 3] = 0x81;
+}
+
+/* Read a document from a stream using a cache, returning its UTF-8 */
+static size_t read_doc(parserutils_decode_cache *cache, const char *enc,
+		const uint8_t *doc, size_t len, uint8_t *out,
+		parserutils_inputstream_stats *stats,
+		parserutils_inputstream_pos *pos)
+{
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream *stream;
+	const uint8_t *c;
+	size_t clen, off = 0;
+
+	assert(parserutils_inputstream_create(enc, 1, NULL, myrealloc, NULL,
+			&stream) == PARSERUTILS_OK);
+
+	params.cache.cache = cache;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_CACHE, &params) ==
+			PARSERUTILS_OK);
+
+	assert(parserutils_inputstream_append(stream, doc, len) ==
+			PARSERUTILS_OK);
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	while (parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK) {
+		memcpy(out + off, c, clen);
+		off += clen;
+
+		parserutils_inputstream_advance(stream, clen);
+
+		/* Note the position part way through */
+		if (off <= len / 2 && off + clen > len / 2) {
+			assert(parserutils_inputstream_position(stream, pos) ==
+					PARSERUTILS_OK);
+		}
+	}
+
+	assert(parserutils_inputstream_get_stats(stream, stats) ==
+			PARSERUTILS_OK);
+
+	parserutils_inputstream_destroy(stream);
+
+	return off;
+}
+
+int main(int argc, char **argv)
+{
+	static uint8_t doc[DOC_LEN], out1[DOC_LEN * 3], out2[DOC_LEN * 3];
+	parserutils_inputstream_stats s1, s2;
+	parserutils_inputstream_pos p1, p2;
+	parserutils_decode_cache_entry *entry;
+	parserutils_decode_cache_stats cs;
+	parserutils_decode_cache *cache;
+	test_lock lock = { false, 0 };
+	const uint8_t *utf8;
+	size_t len1, len2;
+	uint32_t replacements;
+	uint8_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	assert(parserutils_decode_cache_create(DOC_LEN * 10, mylock, &lock,
+			myrealloc, NULL, &cache) == PARSERUTILS_OK);
+
+	/* The first read decodes the document, and the second copies it */
+	fill(doc, DOC_LEN, 'x');
+
+	len1 = read_doc(cache, "windows-1252", doc, DOC_LEN, out1, &s1, &p1);
+	assert(s1.decoded == DOC_LEN && s1.replacements > 0);
+
+	len2 = read_doc(cache, "windows-1252", doc, DOC_LEN, out2, &s2, &p2);
+	assert(s2.decoded == 0 && s2.replacements == s1.replacements);
+	assert(len1 == len2 && memcmp(out1, out2, len1) == 0);
+	assert(p1.offset == p2.offset && p1.source == p2.source &&
+			p1.line == p2.line && p1.column == p2.column);
+
+	assert(parserutils_decode_cache_get_stats(cache, &cs) ==
+			PARSERUTILS_OK);
+	assert(cs.hits == 1 && cs.misses == 1 && cs.entries == 1);
+	assert(cs.size > 2 * DOC_LEN && cs.size <= DOC_LEN * 10);
+
+	/* A document differing only in the middle is decoded, and replaces
+	 * the one with the same ends */
+	fill(doc, DOC_LEN, 'y');
+
+	len2 = read_doc(cache, "windows-1252", doc, DOC_LEN, out2, &s2, &p2);
+	assert(s2.decoded == DOC_LEN && len2 == len1);
+	assert(memcmp(out1, out2, len1) != 0);
+
+	assert(parserutils_decode_cache_get_stats(cache, &cs) ==
+			PARSERUTILS_OK);
+	assert(cs.hits == 1 && cs.misses == 2 && cs.entries == 1);
+
+	/* So does one in a different charset */
+	len2 = read_doc(cache, "ISO-8859-1", doc, DOC_LEN, out2, &s2, &p2);
+	assert(s2.decoded == DOC_LEN);
+
+	len2 = read_doc(cache, "ISO-8859-1", doc, DOC_LEN, out2, &s2, &p2);
+	assert(s2.decoded == 0);
+
+	assert(parserutils_decode_cache_get_stats(cache, &cs) ==
+			PARSERUTILS_OK);
+	assert(cs.hits == 2 && cs.misses == 3 && cs.entries == 2);
+
+	/* UTF-8 is only validated, so isn't cached */
+	len2 = read_doc(cache, "UTF-8", (const uint8_t *) "abc", 3, out2,
+			&s2, &p2);
+	assert(len2 == 3);
+
+	assert(parserutils_decode_cache_get_stats(cache, &cs) ==
+			PARSERUTILS_OK);
+	assert(cs.hits == 2 && cs.misses == 3 && cs.entries == 2);
+
+	/* The least recently used documents make room for new ones */
+	for (i = 0; i < 20; i++) {
+		fill(doc, DOC_LEN, 'a' + i);
+		doc[0] = 'a' + i;
+
+		read_doc(cache, "windows-1252", doc, DOC_LEN, out2, &s2, &p2);
+		assert(s2.decoded == DOC_LEN);
+	}
+
+	assert(parserutils_decode_cache_get_stats(cache, &cs) ==
+			PARSERUTILS_OK);
+	assert(cs.evictions > 0 && cs.entries < 10);
+	assert(cs.size <= DOC_LEN * 10);
+
+	read_doc(cache, "windows-1252", doc, DOC_LEN, out2, &s2, &p2);
+	assert(s2.decoded == 0);
+
+	fill(doc, DOC_LEN, 'a');
+	doc[0] = 'a';
+	len2 = read_doc(cache, "windows-1252", doc, DOC_LEN, out2, &s2, &p2);
+	assert(s2.decoded == DOC_LEN);
+
+	/* A document discarded while held stays readable until released */
+	assert(parserutils__decode_cache_find(cache,
+			parserutils_charset_mibenum_from_name("windows-1252",
+				SLEN("windows-1252")), false, doc, DOC_LEN,
+			&entry, &utf8, &len1, &replacements));
+	assert(len1 == len2 && replacements == s2.replacements);
+
+	for (i = 0; i < 20; i++) {
+		fill(out1, DOC_LEN, 'a' + i);
+		out1[0] = 'A' + i;
+
+		read_doc(cache, "windows-1252", out1, DOC_LEN, out1 + DOC_LEN,
+				&s1, &p1);
+		assert(s1.decoded == DOC_LEN);
+	}
+
+	assert(memcmp(utf8, out2, len2) == 0);
+	parserutils__decode_cache_release(cache, entry);
+
+	read_doc(cache, "windows-1252", doc, DOC_LEN, out2, &s2, &p2);
+	assert(s2.decoded == DOC_LEN);
+
+	/* Every lookup and addition took the lock */
+	assert(parserutils_decode_cache_get_stats(cache, &cs) ==
+			PARSERUTILS_OK);
+	assert(lock.held == false && lock.taken > cs.hits + cs.misses);
+
+	parserutils_decode_cache_destroy(cache);
+
+	/* Documents larger than the cache aren't kept */
+	assert(parserutils_decode_cache_create(DOC_LEN, NULL, NULL,
+			myrealloc, NULL, &cache) == PARSERUTILS_OK);
+
+	len1 = read_doc(cache, "windows-1252", doc, DOC_LEN, out1, &s1, &p1);
+	len2 = read_doc(cache, "windows-1252", doc, DOC_LEN, out2, &s2, &p2);
+	assert(s2.decoded == DOC_LEN);
+	assert(len1 == len2 && memcmp(out1, out2, len1) == 0);
+
+	assert(parserutils_decode_cache_get_stats(cache, &cs) ==
+			PARSERUTILS_OK);
+	assert(cs.entries == 0 && cs.size == 0);
+
+	parserutils_decode_cache_destroy(cache);
+
+	printf("PASS\n");
+
+	return 0;
+}
+
@@ -0,0 +1,96 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Check that reading from a file gives the same result as appending it */
+static void compare(const char *path, const char *enc)
+{
+	parserutils_inputstream *mapped, *appended;
+	FILE *fp;
+	size_t len, total = 0;
+#define CHUNK_SIZE (4096)
+	uint8_t buf[CHUNK_SIZE];
+	const uint8_t *a, *b;
+	size_t alen, blen;
+	parserutils_error aerror, berror;
+
+	assert(parserutils_inputstream_create_from_file(path, enc, 1, NULL,
+			myrealloc, NULL, &mapped) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_create(enc, 1, NULL,
+			myrealloc, NULL, &appended) == PARSERUTILS_OK);
+
+	/* The file is the whole of the input */
+	assert(parserutils_inputstream_append(mapped, buf, 1) ==
+			PARSERUTILS_INVALID);
+
+	fp = fopen(path, "rb");
+	assert(fp != NULL);
+
+	while ((len = fread(buf, 1, CHUNK_SIZE, fp)) > 0) {
+		assert(parserutils_inputstream_append(appended,
+				buf, len) == PARSERUTILS_OK);
+	}
+
+	fclose(fp);
+
+	assert(parserutils_inputstream_append(appended, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	do {
+		aerror = parserutils_inputstream_peek(mapped, 0, &a, &alen);
+		berror = parserutils_inputstream_peek(appended, 0, &b, &blen);
+
+		assert(aerror == berror);
+
+		if (aerror == PARSERUTILS_OK) {
+			assert(alen == blen && memcmp(a, b, alen) == 0);
+
+			parserutils_inputstream_advance(mapped, alen);
+			parserutils_inputstream_advance(appended, blen);
+
+			total += alen;
+		}
+	} while (aerror == PARSERUTILS_OK);
+
+	assert(aerror == PARSERUTILS_EOF);
+
+	printf("%s: %u bytes\n", enc, (unsigned int) total);
+
+	parserutils_inputstream_destroy(appended);
+	parserutils_inputstream_destroy(mapped);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_inputstream *stream;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	assert(parserutils_inputstream_create_from_file(
+			"this-file-does-not-exist", "UTF-8", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_FILENOTFOUND);
+
+	compare(argv[1], "UTF-8");
+	compare(argv[1], "ISO-8859-1");
+
+	printf("PASS\n");
+
+	return 0;
+}
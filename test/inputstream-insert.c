@@ -0,0 +1,91 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Consume characters from the stream, checking they match those expected */
+static void expect(parserutils_inputstream *stream, const char *data,
+		size_t len, parserutils_error then)
+{
+	const uint8_t *c;
+	size_t clen, off;
+
+	for (off = 0; off < len; off++) {
+		assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+				PARSERUTILS_OK);
+		assert(clen == 1 && *c == (uint8_t) data[off]);
+
+		parserutils_inputstream_advance(stream, clen);
+	}
+
+	assert(parserutils_inputstream_peek(stream, 0, &c, &clen) == then);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_inputstream *stream;
+	const uint8_t *c;
+	size_t clen, i;
+	char expected[1000];
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	/* Insertion into an empty stream */
+	assert(parserutils_inputstream_insert(stream,
+			(const uint8_t *) "abc", SLEN("abc")) == PARSERUTILS_OK);
+	expect(stream, "abc", SLEN("abc"), PARSERUTILS_NEEDDATA);
+
+	/* Repeated insertion without advancing reads back in reverse */
+	for (i = 0; i < 1000; i++) {
+		uint8_t ch = '0' + (i % 10);
+
+		assert(parserutils_inputstream_insert(stream, &ch, 1) ==
+				PARSERUTILS_OK);
+		expected[999 - i] = (char) ch;
+	}
+	expect(stream, expected, 1000, PARSERUTILS_NEEDDATA);
+
+	/* Insertion between appended characters, as a script would */
+	for (i = 0; i < 1000; i++) {
+		assert(parserutils_inputstream_append(stream,
+				(const uint8_t *) "x", 1) == PARSERUTILS_OK);
+	}
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	for (i = 0; i < 1000; i++) {
+		assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+				PARSERUTILS_OK);
+		assert(*c == 'x');
+		parserutils_inputstream_advance(stream, clen);
+
+		assert(parserutils_inputstream_insert(stream,
+				(const uint8_t *) "yz", SLEN("yz")) ==
+				PARSERUTILS_OK);
+		expect(stream, "yz", SLEN("yz"), i == 999 ? PARSERUTILS_EOF
+							    : PARSERUTILS_OK);
+	}
+
+	parserutils_inputstream_destroy(stream);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_inputstream *stream;
+	parserutils_inputstream_optparams params;
+	parserutils_error error;
+	uint8_t chunk[1000];
+	const uint8_t *c;
+	size_t clen, offset, appended = 0, total = 0;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	memset(chunk, 'a', sizeof(chunk));
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	params.limits.raw = 4096;
+	params.limits.utf8 = 8192;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_LIMITS, &params) ==
+			PARSERUTILS_OK);
+
+	/* Appending stops once the raw limit is reached */
+	while ((error = parserutils_inputstream_append(stream, chunk,
+			sizeof(chunk))) == PARSERUTILS_OK)
+		appended += sizeof(chunk);
+	assert(error == PARSERUTILS_FULL);
+	assert(appended == 4000);
+
+	/* Looking ahead further than the UTF-8 buffer can hold fails */
+	offset = 0;
+	while ((error = parserutils_inputstream_peek(stream, offset,
+			&c, &clen)) != PARSERUTILS_NOMEM) {
+		if (error == PARSERUTILS_NEEDDATA) {
+			assert(parserutils_inputstream_append(stream, chunk,
+					sizeof(chunk)) == PARSERUTILS_OK);
+			appended += sizeof(chunk);
+			continue;
+		}
+
+		assert(error == PARSERUTILS_OK);
+		offset += clen;
+	}
+	assert(offset == 8192);
+	assert(stream->utf8->allocated <= 8192);
+
+	/* A consumer that keeps up can stream any amount of data */
+	while (appended < 1000 * sizeof(chunk)) {
+		while ((error = parserutils_inputstream_peek(stream, 0,
+				&c, &clen)) == PARSERUTILS_OK) {
+			parserutils_inputstream_advance(stream, clen);
+			total += clen;
+		}
+		assert(error == PARSERUTILS_NEEDDATA);
+
+		while (parserutils_inputstream_append(stream, chunk,
+				sizeof(chunk)) == PARSERUTILS_OK)
+			appended += sizeof(chunk);
+	}
+
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	while ((error = parserutils_inputstream_peek(stream, 0,
+			&c, &clen)) == PARSERUTILS_OK) {
+		parserutils_inputstream_advance(stream, clen);
+		total += clen;
+	}
+	assert(error == PARSERUTILS_EOF);
+	assert(total == appended);
+
+	/* Having caught up, the decoded data buffer is back to its usual size */
+	assert(stream->utf8->allocated <= 4096);
+
+	parserutils_inputstream_destroy(stream);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,249 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define DOC_LEN (32 * 1024)
+
+/* Room for the document, and everything inserted into it */
+#define MODEL_LEN (DOC_LEN * 2)
+
+typedef struct mark {
+	size_t off;
+	parserutils_inputstream_pos pos;
+} mark;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static void submit(parserutils_task task, void *ctx, void *pw)
+{
+	UNUSED(pw);
+
+	task(ctx, 0);
+}
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+
+	return (seed >> 16) & 0x7fff;
+}
+
+/* Lines of valid UTF-8 */
+static size_t make_doc(uint8_t *doc)
+{
+	size_t len = 0;
+
+	while (len < DOC_LEN - 4) {
+		uint32_t r = rnd() % 32;
+
+		if (r == 0) {
+			doc[len++] = '\n';
+		} else if (r < 28) {
+			doc[len++] = 'a' + rnd() % 26;
+		} else {
+			doc[len++] = 0xE3;
+			doc[len++] = 0x81 + rnd() % 2;
+			doc[len++] = 0x80 | (rnd() % 0x40);
+		}
+	}
+
+	return len;
+}
+
+/* Where a reader of the model would be, at an offset into it */
+static void locate(const uint8_t *model, size_t off,
+		parserutils_inputstream_pos *pos)
+{
+	size_t i;
+
+	pos->offset = off;
+	pos->line = 1;
+	pos->column = 1;
+
+	for (i = 0; i < off; i++) {
+		if (model[i] == '\n') {
+			pos->line++;
+			pos->column = 1;
+		} else if ((model[i] & 0xC0) != 0x80) {
+			pos->column++;
+		}
+	}
+}
+
+/* Read a document speculatively, checking it's read the same each time */
+static void check(const uint8_t *doc, size_t len, bool pipeline)
+{
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream_pos pos, expect;
+	parserutils_inputstream *stream;
+	mark marks[PARSERUTILS_INPUTSTREAM_MAX_MARKS];
+	uint8_t *model;
+	size_t off = 0, appended = 0, model_len = 0, inserted = 0;
+	uint32_t n_marks = 0, rewinds = 0;
+	parserutils_error error;
+
+	model = malloc(MODEL_LEN);
+	assert(model != NULL);
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL, myrealloc,
+			NULL, &stream) == PARSERUTILS_OK);
+
+	if (pipeline) {
+		params.pipeline.submit = submit;
+		params.pipeline.wait = NULL;
+		params.pipeline.pw = NULL;
+		params.pipeline.segment = 1000;
+
+		assert(parserutils_inputstream_setopt(stream,
+				PARSERUTILS_INPUTSTREAM_SET_PIPELINE,
+				&params) == PARSERUTILS_OK);
+	}
+
+	/* Nothing to rewind to, or to release */
+	assert(parserutils_inputstream_rewind(stream) == PARSERUTILS_INVALID);
+	assert(parserutils_inputstream_unmark(stream) == PARSERUTILS_INVALID);
+
+	while (true) {
+		const uint8_t *c;
+		size_t clen;
+		uint32_t r = rnd() % 64;
+
+		if (r == 0 && n_marks < PARSERUTILS_INPUTSTREAM_MAX_MARKS) {
+			assert(parserutils_inputstream_mark(stream) ==
+					PARSERUTILS_OK);
+			marks[n_marks].off = off;
+			locate(model, off, &marks[n_marks].pos);
+			n_marks++;
+		} else if (r == 1 && n_marks > 0) {
+			assert(parserutils_inputstream_rewind(stream) ==
+					PARSERUTILS_OK);
+			off = marks[--n_marks].off;
+			rewinds++;
+
+			/* The position is that of the mark */
+			assert(parserutils_inputstream_position(stream, &pos) ==
+					PARSERUTILS_OK);
+			assert(pos.offset == marks[n_marks].pos.offset);
+			assert(pos.line == marks[n_marks].pos.line);
+			assert(pos.column == marks[n_marks].pos.column);
+		} else if (r == 2 && n_marks > 0) {
+			assert(parserutils_inputstream_unmark(stream) ==
+					PARSERUTILS_OK);
+			n_marks--;
+		} else if (r == 3 && inserted < DOC_LEN / 2) {
+			/* Inserted data is kept, though read speculatively */
+			assert(parserutils_inputstream_insert(stream,
+					(const uint8_t *) "x\ny", 3) ==
+					PARSERUTILS_OK);
+			memmove(model + off + 3, model + off, model_len - off);
+			memcpy(model + off, "x\ny", 3);
+			model_len += 3;
+			inserted += 3;
+		} else if (r == 4) {
+			assert(parserutils_inputstream_position(stream, &pos) ==
+					PARSERUTILS_OK);
+			locate(model, off, &expect);
+			assert(pos.offset == expect.offset);
+			assert(pos.line == expect.line);
+			assert(pos.column == expect.column);
+		}
+
+		error = parserutils_inputstream_peek(stream, 0, &c, &clen);
+		if (error == PARSERUTILS_NEEDDATA) {
+			size_t chunk = 1 + rnd() % 3000;
+
+			chunk = min(len - appended, chunk);
+
+			assert(parserutils_inputstream_append(stream,
+					chunk != 0 ? doc + appended : NULL,
+					chunk) == PARSERUTILS_OK);
+			memcpy(model + model_len, doc + appended, chunk);
+			model_len += chunk;
+			appended += chunk;
+			continue;
+		}
+
+		if (error == PARSERUTILS_EOF) {
+			/* Read it all again, from the outermost mark */
+			if (n_marks == 0)
+				break;
+
+			while (n_marks > 0) {
+				assert(parserutils_inputstream_rewind(stream) ==
+						PARSERUTILS_OK);
+				off = marks[--n_marks].off;
+				rewinds++;
+			}
+			continue;
+		}
+
+		assert(error == PARSERUTILS_OK);
+		assert(off + clen <= model_len);
+		assert(memcmp(c, model + off, clen) == 0);
+
+		parserutils_inputstream_advance(stream, clen);
+		off += clen;
+	}
+
+	assert(off == model_len && appended == len && rewinds > 0);
+
+	/* Marks nest only so deep */
+	for (n_marks = 0; n_marks < PARSERUTILS_INPUTSTREAM_MAX_MARKS;
+			n_marks++)
+		assert(parserutils_inputstream_mark(stream) ==
+				PARSERUTILS_OK);
+	assert(parserutils_inputstream_mark(stream) == PARSERUTILS_INVALID);
+
+	/* Releasing the marks leaves the cursor at the end */
+	for (; n_marks > 0; n_marks--)
+		assert(parserutils_inputstream_unmark(stream) ==
+				PARSERUTILS_OK);
+	assert(parserutils_inputstream_position(stream, &pos) ==
+			PARSERUTILS_OK);
+	assert(pos.offset == model_len);
+
+	parserutils_inputstream_destroy(stream);
+
+	free(model);
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *doc;
+	size_t len;
+	int i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	doc = malloc(DOC_LEN);
+	assert(doc != NULL);
+
+	for (i = 0; i < 4; i++) {
+		seed = i + 1;
+		len = make_doc(doc);
+
+		check(doc, len, false);
+		check(doc, len, true);
+	}
+
+	free(doc);
+
+	printf("PASS\n");
+
+	return 0;
+}
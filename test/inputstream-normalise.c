@@ -0,0 +1,229 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+
+#include "input/nfc.h"
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Text, and its Normalisation Form C */
+static const struct {
+	const char *text;
+	const char *nfc;
+} cases[] = {
+	/* Already NFC */
+	{ "plain text", "plain text" },
+	{ "caf\xc3\xa9 \xe6\x97\xa5\xe6\x9c\xac \xf0\x9f\x98\x80",
+	  "caf\xc3\xa9 \xe6\x97\xa5\xe6\x9c\xac \xf0\x9f\x98\x80" },
+	/* e + COMBINING ACUTE ACCENT */
+	{ "cafe\xcc\x81!", "caf\xc3\xa9!" },
+	/* Marks out of canonical order: a + U+0315 + U+0301 */
+	{ "a\xcc\x95\xcc\x81", "\xc3\xa1\xcc\x95" },
+	/* s + dot below + dot above, either way round */
+	{ "s\xcc\xa3\xcc\x87", "\xe1\xb9\xa9" },
+	{ "s\xcc\x87\xcc\xa3", "\xe1\xb9\xa9" },
+	/* A second mark of the same class is blocked */
+	{ "a\xcc\x81\xcc\x81", "\xc3\xa1\xcc\x81" },
+	/* A mark with no starter before it */
+	{ "\xcc\x81" "e", "\xcc\x81" "e" },
+	/* Singletons: ANGSTROM SIGN, OHM SIGN */
+	{ "\xe2\x84\xab\xe2\x84\xa6", "\xc3\x85\xce\xa9" },
+	/* Composition exclusion: DEVANAGARI LETTER QA */
+	{ "\xe0\xa5\x98", "\xe0\xa4\x95\xe0\xa4\xbc" },
+	/* Excluded, with a three code point decomposition: U+1D162 */
+	{ "\xf0\x9d\x85\xa2",
+	  "\xf0\x9d\x85\x98\xf0\x9d\x85\xa5\xf0\x9d\x85\xb0" },
+	/* Hangul jamo L V T, and LV + T */
+	{ "\xe1\x84\x80\xe1\x85\xa1\xe1\x86\xa8", "\xea\xb0\x81" },
+	{ "\xea\xb0\x80\xe1\x86\xa8", "\xea\xb0\x81" },
+	/* A decomposed character recomposed with a later mark: U+1E0A
+	 * + dot below, to U+1E0C + dot above */
+	{ "\xe1\xb8\x8a\xcc\xa3", "\xe1\xb8\x8c\xcc\x87" }
+};
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static void submit(parserutils_task task, void *ctx, void *pw)
+{
+	UNUSED(pw);
+
+	task(ctx, 0);
+}
+
+/* Normalise some text, given a byte at a time, a few bytes at a time */
+static void check_normaliser(const char *text, const char *expect)
+{
+	size_t len = strlen(text), off = 0, outlen = 0, held = 0;
+	uint8_t out[64], in[8];
+	parserutils_nfc *nfc;
+
+	assert(parserutils__nfc_create(myrealloc, NULL, &nfc) ==
+			PARSERUTILS_OK);
+
+	while (off <= len) {
+		bool flush = (off == len);
+		const uint8_t *data = in;
+		parserutils_error error;
+
+		if (!flush)
+			in[held++] = text[off];
+		off++;
+
+		do {
+			uint8_t *output = out + outlen;
+			size_t space = 4;
+
+			error = parserutils__nfc_process(nfc, &data, &held,
+					&output, &space, flush);
+			assert(error == PARSERUTILS_OK ||
+					error == PARSERUTILS_NOMEM);
+
+			outlen = output - out;
+		} while (error == PARSERUTILS_NOMEM);
+
+		memmove(in, data, held);
+	}
+
+	assert(held == 0 && parserutils__nfc_pending(nfc) == false);
+
+	if (outlen != strlen(expect) || memcmp(out, expect, outlen) != 0) {
+		printf("FAIL - normalised '%s' to '%.*s'\n", text,
+				(int) outlen, out);
+		exit(1);
+	}
+
+	parserutils__nfc_destroy(nfc);
+}
+
+/* Read text appended to a normalising inputstream a byte at a time */
+static void check_stream(const char *text, const char *expect)
+{
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream *stream;
+	size_t len = strlen(text), off = 0, outlen = 0;
+	parserutils_error error = PARSERUTILS_NEEDDATA;
+	uint8_t out[64];
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL, myrealloc,
+			NULL, &stream) == PARSERUTILS_OK);
+
+	params.normalise.nfc = true;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_NORMALISE, &params) ==
+			PARSERUTILS_OK);
+
+	while (error == PARSERUTILS_NEEDDATA) {
+		assert(parserutils_inputstream_append(stream,
+				off < len ? (const uint8_t *) text + off : NULL,
+				off < len ? 1 : 0) == PARSERUTILS_OK);
+		off++;
+
+		while (true) {
+			const uint8_t *c;
+			size_t clen;
+
+			error = parserutils_inputstream_peek(stream, 0,
+					&c, &clen);
+			if (error != PARSERUTILS_OK)
+				break;
+
+			memcpy(out + outlen, c, clen);
+			outlen += clen;
+
+			parserutils_inputstream_advance(stream, clen);
+		}
+	}
+
+	assert(error == PARSERUTILS_EOF);
+
+	if (outlen != strlen(expect) || memcmp(out, expect, outlen) != 0) {
+		printf("FAIL - read '%s' as '%.*s'\n", text,
+				(int) outlen, out);
+		exit(1);
+	}
+
+	parserutils_inputstream_destroy(stream);
+}
+
+/* Options which conflict with normalisation are refused */
+static void check_conflicts(void)
+{
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream *stream;
+	const uint8_t *c;
+	size_t clen, i;
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL, myrealloc,
+			NULL, &stream) == PARSERUTILS_OK);
+
+	params.normalise.nfc = true;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_NORMALISE, &params) ==
+			PARSERUTILS_OK);
+
+	params.pipeline.submit = submit;
+	params.pipeline.wait = NULL;
+	params.pipeline.pw = NULL;
+	params.pipeline.segment = 0;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_PIPELINE, &params) ==
+			PARSERUTILS_INVALID);
+
+	/* The e is held back, as a mark may follow it */
+	assert(parserutils_inputstream_append(stream,
+			(const uint8_t *) "abcde", 5) == PARSERUTILS_OK);
+	for (i = 0; i < 4; i++) {
+		assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+				PARSERUTILS_OK);
+		assert(clen == 1 && c[0] == "abcd"[i]);
+		parserutils_inputstream_advance(stream, clen);
+	}
+	assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_NEEDDATA);
+
+	params.normalise.nfc = false;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_NORMALISE, &params) ==
+			PARSERUTILS_INVALID);
+
+	assert(parserutils_inputstream_append(stream,
+			(const uint8_t *) "\xcc\x81", 2) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+	assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK);
+	assert(clen == 2 && memcmp(c, "\xc3\xa9", 2) == 0);
+	parserutils_inputstream_advance(stream, clen);
+	assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_EOF);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	for (i = 0; i < N_ELEMENTS(cases); i++) {
+		check_normaliser(cases[i].text, cases[i].nfc);
+		check_stream(cases[i].text, cases[i].nfc);
+	}
+
+	check_conflicts();
+
+	printf("PASS\n");
+
+	return 0;
+}
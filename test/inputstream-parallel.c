@@ -0,0 +1,234 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define DOC_LEN (256 * 1024)
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Runs the tasks last first, to show they don't depend on each other */
+static void run_backwards(parserutils_task task, void *ctx, size_t count,
+		void *pw)
+{
+	size_t *runs = pw;
+
+	(*runs)++;
+
+	while (count-- > 0)
+		task(ctx, count);
+}
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+
+	return (seed >> 16) & 0x7fff;
+}
+
+/* A character likely to be found in documents, or sometimes garbage */
+static uint32_t rnd_char(void)
+{
+	switch (rnd() % 8) {
+	case 0:
+		return 0x80 + rnd() % 0x780;
+	case 1:
+		return 0x800 + rnd() % 0xF800;
+	case 2:
+		return 0x10000 + ((rnd() << 5) ^ rnd()) % 0x100000;
+	case 3:
+		/* A surrogate, or out of range */
+		return (rnd() & 1) ? 0xD800 + rnd() % 0x800 : 0x110000;
+	default:
+		return 0x20 + rnd() % 0x5f;
+	}
+}
+
+static size_t make_doc(const char *enc, uint8_t *doc)
+{
+	size_t len = 0;
+
+	while (len < DOC_LEN - 8) {
+		uint32_t c = rnd_char();
+
+		if (strcmp(enc, "UTF-8") == 0) {
+			if (c >= 0xD800 && (c < 0xE000 || c > 0x10FFFF)) {
+				/* Stray bytes */
+				doc[len++] = 0x80 + rnd() % 0x80;
+				if (rnd() & 1)
+					doc[len++] = 0xC0 + rnd() % 0x40;
+			} else if (c < 0x80) {
+				doc[len++] = c;
+			} else if (c < 0x800) {
+				doc[len++] = 0xC0 | (c >> 6);
+				doc[len++] = 0x80 | (c & 0x3F);
+			} else if (c < 0x10000) {
+				doc[len++] = 0xE0 | (c >> 12);
+				doc[len++] = 0x80 | ((c >> 6) & 0x3F);
+				doc[len++] = 0x80 | (c & 0x3F);
+			} else {
+				doc[len++] = 0xF0 | (c >> 18);
+				doc[len++] = 0x80 | ((c >> 12) & 0x3F);
+				doc[len++] = 0x80 | ((c >> 6) & 0x3F);
+				doc[len++] = 0x80 | (c & 0x3F);
+			}
+		} else if (strncmp(enc, "UTF-16", 6) == 0) {
+			bool le = (strcmp(enc, "UTF-16LE") == 0);
+			uint32_t units[2], n = 1, i;
+
+			if (c > 0x10FFFF) {
+				units[0] = 0xDC00 + rnd() % 0x400;
+			} else if (c >= 0x10000) {
+				units[0] = 0xD800 | ((c - 0x10000) >> 10);
+				units[1] = 0xDC00 | ((c - 0x10000) & 0x3FF);
+				n = 2;
+			} else {
+				units[0] = c;
+			}
+
+			for (i = 0; i < n; i++) {
+				doc[len++] = le ? units[i] : units[i] >> 8;
+				doc[len++] = le ? units[i] >> 8 : units[i];
+			}
+		} else if (strncmp(enc, "UTF-32", 6) == 0) {
+			doc[len++] = c >> 24;
+			doc[len++] = c >> 16;
+			doc[len++] = c >> 8;
+			doc[len++] = c;
+		} else {
+			doc[len++] = (c < 0x80) ? c : 0x80 + (c & 0x7F);
+		}
+	}
+
+	return len;
+}
+
+/* Decode a document given in pieces, reading it as it arrives */
+static size_t decode(const char *enc, const uint8_t *doc, size_t len,
+		parserutils_run_tasks run, void *pw, uint8_t *out,
+		uint32_t *replacements)
+{
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream_stats stats;
+	parserutils_inputstream *stream;
+	size_t off = 0, outlen = 0;
+
+	assert(parserutils_inputstream_create(enc, 1, NULL, myrealloc, NULL,
+			&stream) == PARSERUTILS_OK);
+
+	if (run != NULL) {
+		params.parallel.run = run;
+		params.parallel.pw = pw;
+		params.parallel.segment = 1000;
+		params.parallel.tasks = 5;
+
+		assert(parserutils_inputstream_setopt(stream,
+				PARSERUTILS_INPUTSTREAM_SET_PARALLEL,
+				&params) == PARSERUTILS_OK);
+	}
+
+	seed = 7;
+
+	while (off <= len) {
+		size_t chunk = min(len - off, 1 + rnd() * 3);
+		const uint8_t *c;
+		size_t clen;
+
+		if (chunk == 0) {
+			assert(parserutils_inputstream_append(stream,
+					NULL, 0) == PARSERUTILS_OK);
+		} else {
+			assert(parserutils_inputstream_append(stream,
+					doc + off, chunk) == PARSERUTILS_OK);
+		}
+
+		while (parserutils_inputstream_peek_span(stream, 0,
+				&c, &clen) == PARSERUTILS_OK) {
+			memcpy(out + outlen, c, clen);
+			outlen += clen;
+
+			parserutils_inputstream_advance(stream, clen);
+		}
+
+		if (chunk == 0)
+			break;
+
+		off += chunk;
+	}
+
+	assert(parserutils_inputstream_get_stats(stream, &stats) ==
+			PARSERUTILS_OK);
+	*replacements = stats.replacements;
+
+	parserutils_inputstream_destroy(stream);
+
+	return outlen;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *encs[] = {
+		"ISO-8859-1", "windows-1252", "UTF-8",
+		"UTF-16LE", "UTF-16BE", "UTF-32LE", "UTF-32BE",
+		/* Can't be split, so is always decoded serially */
+		"Shift_JIS"
+	};
+	uint8_t *doc, *serial, *parallel;
+	size_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	doc = malloc(DOC_LEN);
+	serial = malloc(DOC_LEN * 3);
+	parallel = malloc(DOC_LEN * 3);
+	assert(doc != NULL && serial != NULL && parallel != NULL);
+
+	for (i = 0; i < N_ELEMENTS(encs); i++) {
+		uint32_t serial_repl, parallel_repl;
+		size_t len, serial_len, parallel_len, runs = 0;
+
+		seed = i + 1;
+		len = make_doc(encs[i], doc);
+
+		serial_len = decode(encs[i], doc, len, NULL, NULL,
+				serial, &serial_repl);
+		parallel_len = decode(encs[i], doc, len, run_backwards, &runs,
+				parallel, &parallel_repl);
+
+		if (serial_len != parallel_len ||
+				memcmp(serial, parallel, serial_len) != 0 ||
+				serial_repl != parallel_repl) {
+			printf("FAIL - %s decoded differently in parallel\n",
+					encs[i]);
+			return 1;
+		}
+
+		if ((runs == 0) != (strcmp(encs[i], "Shift_JIS") == 0)) {
+			printf("FAIL - %s %sdecoded in parallel\n", encs[i],
+					runs == 0 ? "not " : "");
+			return 1;
+		}
+	}
+
+	free(parallel);
+	free(serial);
+	free(doc);
+
+	printf("PASS\n");
+
+	return 0;
+}
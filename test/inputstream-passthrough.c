@@ -0,0 +1,184 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/charset/codec.h>
+#include <parserutils/charset/utf8.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define OUT_LEN (256)
+#define PAD_LEN (8)
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Convert UTF-8 as the filter does without iconv, with the UTF-8 codec in
+ * its loose error mode, consuming as much of it as possible */
+static size_t codec_utf8(const char *doc, size_t len, uint8_t *out,
+		uint32_t *replacements)
+{
+	parserutils_charset_codec_optparams params;
+	parserutils_charset_codec *codec;
+	const uint8_t *in = (const uint8_t *) doc;
+	uint8_t ucs4[OUT_LEN * 4];
+	uint8_t *pivot = ucs4, *o = out;
+	size_t pivot_len = sizeof(ucs4), outlen = OUT_LEN, i;
+
+	assert(parserutils_charset_codec_create("UTF-8", myrealloc, NULL,
+			&codec) == PARSERUTILS_OK);
+
+	params.error_mode.mode = PARSERUTILS_CHARSET_CODEC_ERROR_LOOSE;
+	assert(parserutils_charset_codec_setopt(codec,
+			PARSERUTILS_CHARSET_CODEC_ERROR_MODE, &params) ==
+			PARSERUTILS_OK);
+
+	assert(parserutils_charset_codec_decode(codec, &in, &len,
+			&pivot, &pivot_len) == PARSERUTILS_OK);
+
+	/* Flush any output it has buffered */
+	assert(parserutils_charset_codec_decode(codec, &in, &len,
+			&pivot, &pivot_len) == PARSERUTILS_OK);
+
+	/* The documents hold no U+FFFD, so each is a replacement */
+	*replacements = 0;
+
+	/* The codec writes big-endian UCS-4 */
+	for (i = 0; i < sizeof(ucs4) - pivot_len; i += 4) {
+		uint32_t c = ((uint32_t) ucs4[i] << 24) | (ucs4[i + 1] << 16) |
+				(ucs4[i + 2] << 8) | ucs4[i + 3];
+
+		if (c == 0xFFFD)
+			(*replacements)++;
+
+		assert(parserutils_charset_utf8_from_ucs4(c, &o, &outlen) ==
+				PARSERUTILS_OK);
+	}
+
+	parserutils_charset_codec_destroy(codec);
+
+	return o - out;
+}
+
+/* Read a document appended in pieces of a size, returning its UTF-8 */
+static size_t read_split(const char *doc, size_t len, size_t size,
+		uint8_t *out, uint32_t *replacements)
+{
+	parserutils_inputstream_stats stats;
+	parserutils_inputstream *stream;
+	const uint8_t *c;
+	size_t clen, in = 0, off = 0;
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL, myrealloc,
+			NULL, &stream) == PARSERUTILS_OK);
+
+	while (in < len) {
+		size_t n = min(size, len - in);
+
+		assert(parserutils_inputstream_append(stream,
+				(const uint8_t *) doc + in, n) ==
+				PARSERUTILS_OK);
+		in += n;
+
+		while (parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+				PARSERUTILS_OK) {
+			assert(off + clen <= OUT_LEN);
+			memcpy(out + off, c, clen);
+			off += clen;
+
+			parserutils_inputstream_advance(stream, clen);
+		}
+	}
+
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	while (parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK) {
+		assert(off + clen <= OUT_LEN);
+		memcpy(out + off, c, clen);
+		off += clen;
+
+		parserutils_inputstream_advance(stream, clen);
+	}
+
+	assert(parserutils_inputstream_get_stats(stream, &stats) ==
+			PARSERUTILS_OK);
+	*replacements = stats.replacements;
+
+	parserutils_inputstream_destroy(stream);
+
+	return off;
+}
+
+/* A document read straight through, however it's split, reads as the
+ * codec converts it. The codec doesn't know where input ends, so is given
+ * the document followed by ASCII, ending any character left incomplete.
+ * The stream should treat such a character at EOF as if it were followed
+ * by something else. */
+static void check(const char *doc, size_t len)
+{
+	uint8_t expected[OUT_LEN], out[OUT_LEN];
+	uint32_t exp_replacements, replacements;
+	char padded[OUT_LEN];
+	size_t exp_len, out_len, size;
+
+	memcpy(padded, doc, len);
+	memset(padded + len, '!', PAD_LEN);
+
+	exp_len = codec_utf8(padded, len + PAD_LEN, expected,
+			&exp_replacements);
+	assert(exp_len >= PAD_LEN &&
+			memcmp(expected + exp_len - PAD_LEN, "!!!!!!!!",
+			PAD_LEN) == 0);
+	exp_len -= PAD_LEN;
+
+	for (size = 1; size <= len; size++) {
+		out_len = read_split(doc, len, size, out, &replacements);
+
+		assert(out_len == exp_len &&
+				memcmp(out, expected, exp_len) == 0);
+		assert(replacements == exp_replacements);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	UNUSED(argc);
+	UNUSED(argv);
+
+	/* Valid text, in characters of every length */
+	check("a\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80z", 11);
+
+	/* Invalid bytes, and stray or missing continuation bytes */
+	check("a\xff" "b\xfe\x80" "c\x80\xbf" "d\xc3" "e\xe2\x82" "f", 14);
+
+	/* Overlong forms, surrogates, and characters beyond Unicode */
+	check("a\xc0\xaf" "b\xc1\xbf" "c\xe0\x80\xaf" "d\xf0\x80\x80\xaf"
+			"e", 16);
+	check("a\xed\xa0\x80" "b\xed\xbf\xbf" "c\xf4\x90\x80\x80"
+			"d\xf8\x88\x80\x80\x80" "e", 20);
+
+	/* A long valid run, then a sequence split across appends */
+	check("abcdefghijklmnopqrstuvwxyz0123456789\xe2\x82\xac"
+			"\xf0\x9f\x98\x80", 43);
+
+	/* Truncated sequences at EOF */
+	check("ab\xc3", 3);
+	check("ab\xe2\x82", 4);
+	check("ab\xf0\x9f\x98", 5);
+	check("\xf0\x9f", 2);
+	check("a\xff" "b\xe2\x82\xac\xe2", 7);
+
+	printf("PASS\n");
+
+	return 0;
+}
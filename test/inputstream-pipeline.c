@@ -0,0 +1,305 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define DOC_LEN (128 * 1024)
+
+/* Holds a submitted task until the test, or the stream, chooses to run it */
+typedef struct executor {
+	parserutils_task task;
+	void *ctx;
+	uint32_t submitted;
+	uint32_t waits;
+} executor;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static void submit(parserutils_task task, void *ctx, void *pw)
+{
+	executor *ex = pw;
+
+	/* Only one task is ever outstanding */
+	assert(ex->task == NULL);
+
+	ex->task = task;
+	ex->ctx = ctx;
+	ex->submitted++;
+}
+
+static void run_pending(executor *ex)
+{
+	parserutils_task task = ex->task;
+
+	if (task != NULL) {
+		ex->task = NULL;
+		task(ex->ctx, 0);
+	}
+}
+
+static void wait(void *pw)
+{
+	executor *ex = pw;
+
+	ex->waits++;
+
+	/* Nothing else will run it */
+	assert(ex->task != NULL);
+	run_pending(ex);
+}
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+
+	return (seed >> 16) & 0x7fff;
+}
+
+/* Text with some multibyte characters, and some garbage */
+static size_t make_doc(const char *enc, uint8_t *doc)
+{
+	size_t len = 0;
+
+	while (len < DOC_LEN - 8) {
+		uint32_t r = rnd() % 16;
+		uint32_t c = (r < 12) ? 0x20 + rnd() % 0x5f
+				: (r < 15) ? 0xA0 + rnd() % 0x2F00
+				: 0xD800 + rnd() % 0x800;
+
+		if (strcmp(enc, "UTF-8") == 0) {
+			if (c >= 0xD800) {
+				doc[len++] = 0x80 + rnd() % 0x80;
+			} else if (c < 0x80) {
+				doc[len++] = c;
+			} else if (c < 0x800) {
+				doc[len++] = 0xC0 | (c >> 6);
+				doc[len++] = 0x80 | (c & 0x3F);
+			} else {
+				doc[len++] = 0xE0 | (c >> 12);
+				doc[len++] = 0x80 | ((c >> 6) & 0x3F);
+				doc[len++] = 0x80 | (c & 0x3F);
+			}
+		} else if (strcmp(enc, "UTF-16LE") == 0) {
+			doc[len++] = c;
+			doc[len++] = c >> 8;
+
+			/* Runs of stray surrogates are replaced together, so
+			 * how they're replaced depends on where they're split */
+			if (c >= 0xD800) {
+				doc[len++] = 'x';
+				doc[len++] = 0;
+			}
+		} else {
+			doc[len++] = (c < 0x80) ? c : 0x80 + (c & 0x7F);
+		}
+	}
+
+	return len;
+}
+
+/* Decode a document given in pieces, reading some of it as it arrives */
+static size_t decode(const char *enc, const uint8_t *doc, size_t len,
+		executor *ex, bool stop, uint8_t *out, uint32_t *replacements)
+{
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream_stats stats;
+	parserutils_inputstream *stream;
+	size_t off = 0, outlen = 0;
+
+	assert(parserutils_inputstream_create(enc, 1, NULL, myrealloc, NULL,
+			&stream) == PARSERUTILS_OK);
+
+	if (ex != NULL) {
+		params.pipeline.submit = submit;
+		params.pipeline.wait = wait;
+		params.pipeline.pw = ex;
+		params.pipeline.segment = 1000 + rnd() % 3000;
+
+		assert(parserutils_inputstream_setopt(stream,
+				PARSERUTILS_INPUTSTREAM_SET_PIPELINE,
+				&params) == PARSERUTILS_OK);
+	}
+
+	while (off <= len) {
+		size_t chunk = 1 + rnd() % 4000;
+		const uint8_t *c;
+		size_t clen;
+
+		chunk = min(len - off, chunk);
+
+		assert(parserutils_inputstream_append(stream,
+				chunk != 0 ? doc + off : NULL,
+				chunk) == PARSERUTILS_OK);
+
+		/* Let the task run before it's needed, sometimes */
+		if (ex != NULL && rnd() % 2 == 0)
+			run_pending(ex);
+
+		/* Stop decoding in the background, keeping its output */
+		if (ex != NULL && stop && off >= len / 2) {
+			params.pipeline.submit = NULL;
+			assert(parserutils_inputstream_setopt(stream,
+					PARSERUTILS_INPUTSTREAM_SET_PIPELINE,
+					&params) == PARSERUTILS_OK);
+			assert(ex->task == NULL);
+			ex = NULL;
+		}
+
+		/* Read some of what's available, or all of it at the end */
+		while ((chunk == 0 || rnd() % 8 != 0) &&
+				parserutils_inputstream_peek_span(stream, 0,
+					&c, &clen) == PARSERUTILS_OK) {
+			if (chunk != 0 && rnd() % 2 == 0) {
+				/* Read part of the span, ending at a character */
+				size_t n = 1 + rnd() % clen;
+
+				while (n < clen && (c[n] & 0xC0) == 0x80)
+					n++;
+				clen = n;
+			}
+
+			memcpy(out + outlen, c, clen);
+			outlen += clen;
+
+			parserutils_inputstream_advance(stream, clen);
+		}
+
+		if (chunk == 0)
+			break;
+
+		off += chunk;
+	}
+
+	assert(parserutils_inputstream_get_stats(stream, &stats) ==
+			PARSERUTILS_OK);
+	*replacements = stats.replacements;
+
+	parserutils_inputstream_destroy(stream);
+
+	return outlen;
+}
+
+/* Options which conflict with decoding ahead are refused */
+static void check_conflicts(void)
+{
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream *stream;
+	executor ex = { NULL, NULL, 0, 0 };
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL, myrealloc,
+			NULL, &stream) == PARSERUTILS_OK);
+
+	params.retention.limit = 1024;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_RETENTION, &params) ==
+			PARSERUTILS_OK);
+
+	params.pipeline.submit = submit;
+	params.pipeline.wait = wait;
+	params.pipeline.pw = &ex;
+	params.pipeline.segment = 0;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_PIPELINE, &params) ==
+			PARSERUTILS_INVALID);
+
+	params.retention.limit = 0;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_RETENTION, &params) ==
+			PARSERUTILS_OK);
+
+	params.pipeline.submit = submit;
+	params.pipeline.wait = wait;
+	params.pipeline.pw = &ex;
+	params.pipeline.segment = 0;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_PIPELINE, &params) ==
+			PARSERUTILS_OK);
+
+	params.retention.limit = 1024;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_RETENTION, &params) ==
+			PARSERUTILS_INVALID);
+
+	params.limits.raw = 0;
+	params.limits.utf8 = 4096;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_LIMITS, &params) ==
+			PARSERUTILS_INVALID);
+
+	params.limits.raw = 4096;
+	params.limits.utf8 = 0;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_LIMITS, &params) ==
+			PARSERUTILS_OK);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *encs[] = {
+		"UTF-8", "UTF-16LE", "windows-1252", "Shift_JIS"
+	};
+	uint8_t *doc, *serial, *piped;
+	size_t i, j;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	check_conflicts();
+
+	doc = malloc(DOC_LEN);
+	serial = malloc(DOC_LEN * 3);
+	piped = malloc(DOC_LEN * 3);
+	assert(doc != NULL && serial != NULL && piped != NULL);
+
+	for (i = 0; i < N_ELEMENTS(encs); i++) {
+		for (j = 0; j < 4; j++) {
+			executor ex = { NULL, NULL, 0, 0 };
+			uint32_t serial_repl, piped_repl;
+			size_t len, serial_len, piped_len;
+
+			seed = i + 1;
+			len = make_doc(encs[i], doc);
+
+			/* The same pieces are given, and read, each time */
+			seed = 7 + j;
+			serial_len = decode(encs[i], doc, len, NULL, false,
+					serial, &serial_repl);
+			seed = 7 + j;
+			piped_len = decode(encs[i], doc, len, &ex, j == 3,
+					piped, &piped_repl);
+
+			if (serial_len != piped_len ||
+					memcmp(serial, piped, serial_len) != 0 ||
+					serial_repl != piped_repl) {
+				printf("FAIL - %s decoded differently in the "
+						"background\n", encs[i]);
+				return 1;
+			}
+
+			assert(ex.submitted > 0 && ex.task == NULL);
+		}
+	}
+
+	free(piped);
+	free(serial);
+	free(doc);
+
+	printf("PASS\n");
+
+	return 0;
+}
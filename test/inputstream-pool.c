@@ -0,0 +1,126 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/charset/pool.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Counts the live allocations made through it */
+static void *poolrealloc(void *ptr, size_t len, void *pw)
+{
+	int *live = pw;
+
+	if (ptr == NULL && len > 0)
+		(*live)++;
+	else if (ptr != NULL && len == 0)
+		(*live)--;
+
+	return realloc(ptr, len);
+}
+
+/* Read the stream as far as possible, checking it matches the expected data */
+static void expect(parserutils_inputstream *stream, const char *data,
+		size_t len)
+{
+	const uint8_t *c;
+	size_t clen, off = 0;
+
+	while (parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK) {
+		assert(off + clen <= len && memcmp(c, data + off, clen) == 0);
+
+		parserutils_inputstream_advance(stream, clen);
+		off += clen;
+	}
+
+	assert(off == len);
+}
+
+/* Create a stream using a pool, and give it some data */
+static parserutils_inputstream *stream_create(const char *enc,
+		parserutils_charset_pool *pool, const char *data, size_t len,
+		bool eof)
+{
+	parserutils_inputstream *stream;
+
+	assert(parserutils_inputstream_create_pooled(enc, 1, NULL, pool,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	assert(parserutils_inputstream_append(stream,
+			(const uint8_t *) data, len) == PARSERUTILS_OK);
+
+	if (eof) {
+		assert(parserutils_inputstream_append(stream, NULL, 0) ==
+				PARSERUTILS_OK);
+	}
+
+	return stream;
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_charset_pool *pool;
+	parserutils_inputstream *stream;
+	int live = 0, pooled;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	assert(parserutils_charset_pool_create(poolrealloc, &live, &pool) ==
+			PARSERUTILS_OK);
+
+	/* Leave the codec part way through a character */
+	stream = stream_create("Shift_JIS", pool, "a\x82\xa0\x82",
+			SLEN("a\x82\xa0\x82"), false);
+	expect(stream, "a\xe3\x81\x82", SLEN("a\xe3\x81\x82"));
+	parserutils_inputstream_destroy(stream);
+
+	/* The codecs stay in the pool */
+	pooled = live;
+	assert(pooled > 0);
+
+	/* The next stream for the charset reuses them, reset */
+	stream = stream_create("Shift_JIS", pool, "\x82\xa0" "b",
+			SLEN("\x82\xa0" "b"), true);
+	assert(live == pooled);
+	expect(stream, "\xe3\x81\x82" "b", SLEN("\xe3\x81\x82" "b"));
+	assert(live == pooled);
+	parserutils_inputstream_destroy(stream);
+
+	/* Streams may use other charsets meanwhile */
+	stream = stream_create("ISO-8859-1", pool, "caf\xe9",
+			SLEN("caf\xe9"), true);
+	expect(stream, "caf\xc3\xa9", SLEN("caf\xc3\xa9"));
+	parserutils_inputstream_destroy(stream);
+
+#ifndef WITHOUT_ICONV_FILTER
+	/* Iconv descriptors are reused in their initial shift state */
+	stream = stream_create("ISO-2022-JP", pool, "\x1b$B$\"\x1b$B",
+			SLEN("\x1b$B$\"\x1b$B"), false);
+	expect(stream, "\xe3\x81\x82", SLEN("\xe3\x81\x82"));
+	parserutils_inputstream_destroy(stream);
+
+	stream = stream_create("ISO-2022-JP", pool, "$\"", SLEN("$\""), true);
+	expect(stream, "$\"", SLEN("$\""));
+	parserutils_inputstream_destroy(stream);
+#endif
+
+	assert(parserutils_charset_pool_destroy(pool) == PARSERUTILS_OK);
+	assert(live == 0);
+
+	printf("PASS\n");
+
+	return 0;
+}
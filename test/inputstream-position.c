@@ -0,0 +1,280 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define DOC_LEN (64 * 1024)
+
+/* Ways of decoding the document */
+enum { SERIAL, PARALLEL, PIPELINE, N_MODES };
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static void run_tasks(parserutils_task task, void *ctx, size_t count,
+		void *pw)
+{
+	size_t i;
+
+	UNUSED(pw);
+
+	for (i = 0; i < count; i++)
+		task(ctx, i);
+}
+
+static void submit(parserutils_task task, void *ctx, void *pw)
+{
+	UNUSED(pw);
+
+	task(ctx, 0);
+}
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+
+	return (seed >> 16) & 0x7fff;
+}
+
+/* Lines of text in a charset, optionally with invalid bytes */
+static size_t make_doc(const char *enc, bool garbage, uint8_t *doc)
+{
+	size_t len = 0;
+
+	if (strcmp(enc, "UTF-16") == 0) {
+		doc[len++] = 0xFF;
+		doc[len++] = 0xFE;
+	}
+
+	while (len < DOC_LEN - 8) {
+		uint32_t r = rnd() % 32;
+		uint32_t c = (r == 0) ? '\n' : (r < 24) ? 'a' + rnd() % 26
+				: (r < 28) ? 0xE0 + rnd() % 0x10
+				: (r < 31) ? 0x3041 + rnd() % 0x50
+				: 0x1F600 + rnd() % 0x40;
+
+		if (garbage && rnd() % 256 == 0)
+			doc[len++] = 0xFF;
+
+		if (strcmp(enc, "UTF-8") == 0) {
+			if (c < 0x80) {
+				doc[len++] = c;
+			} else if (c < 0x800) {
+				doc[len++] = 0xC0 | (c >> 6);
+				doc[len++] = 0x80 | (c & 0x3F);
+			} else if (c < 0x10000) {
+				doc[len++] = 0xE0 | (c >> 12);
+				doc[len++] = 0x80 | ((c >> 6) & 0x3F);
+				doc[len++] = 0x80 | (c & 0x3F);
+			} else {
+				doc[len++] = 0xF0 | (c >> 18);
+				doc[len++] = 0x80 | ((c >> 12) & 0x3F);
+				doc[len++] = 0x80 | ((c >> 6) & 0x3F);
+				doc[len++] = 0x80 | (c & 0x3F);
+			}
+		} else if (strcmp(enc, "UTF-16") == 0) {
+			uint32_t units[2], n = 1, i;
+
+			if (c >= 0x10000) {
+				units[0] = 0xD800 | ((c - 0x10000) >> 10);
+				units[1] = 0xDC00 | ((c - 0x10000) & 0x3FF);
+				n = 2;
+			} else {
+				units[0] = c;
+			}
+
+			for (i = 0; i < n; i++) {
+				doc[len++] = units[i];
+				doc[len++] = units[i] >> 8;
+			}
+		} else if (strcmp(enc, "Shift_JIS") == 0) {
+			if (c < 0x80) {
+				doc[len++] = c;
+			} else {
+				/* Hiragana */
+				doc[len++] = 0x82;
+				doc[len++] = 0x9F + c % 0x50;
+			}
+		} else {
+			doc[len++] = (c < 0x80) ? c : 0xE0 + c % 0x20;
+		}
+	}
+
+	return len;
+}
+
+/* Raw bytes a decoded character was read from */
+static size_t width(const char *enc, size_t clen)
+{
+	if (strcmp(enc, "UTF-8") == 0)
+		return clen;
+	if (strcmp(enc, "UTF-16") == 0)
+		return (clen == 4) ? 4 : 2;
+	if (strcmp(enc, "Shift_JIS") == 0)
+		return (clen == 1) ? 1 : 2;
+
+	return 1;
+}
+
+/* Read a document, checking the stream's position against our own */
+static void check(const char *enc, const uint8_t *doc, size_t len,
+		int mode, bool exact)
+{
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream_pos expect, pos;
+	parserutils_inputstream *stream;
+	size_t off = 0, inserted = 0, last_source = 0;
+	parserutils_error error = PARSERUTILS_NEEDDATA;
+
+	assert(parserutils_inputstream_create(enc, 1, NULL, myrealloc, NULL,
+			&stream) == PARSERUTILS_OK);
+
+	if (mode == PARALLEL) {
+		params.parallel.run = run_tasks;
+		params.parallel.pw = NULL;
+		params.parallel.segment = 1000;
+		params.parallel.tasks = 4;
+
+		assert(parserutils_inputstream_setopt(stream,
+				PARSERUTILS_INPUTSTREAM_SET_PARALLEL,
+				&params) == PARSERUTILS_OK);
+	} else if (mode == PIPELINE) {
+		params.pipeline.submit = submit;
+		params.pipeline.wait = NULL;
+		params.pipeline.pw = NULL;
+		params.pipeline.segment = 2000;
+
+		assert(parserutils_inputstream_setopt(stream,
+				PARSERUTILS_INPUTSTREAM_SET_PIPELINE,
+				&params) == PARSERUTILS_OK);
+	}
+
+	expect.offset = 0;
+	expect.source = (strcmp(enc, "UTF-16") == 0) ? 2 : 0;
+	expect.line = 1;
+	expect.column = 1;
+
+	while (error == PARSERUTILS_NEEDDATA) {
+		size_t chunk = 1 + rnd() % 5000;
+
+		chunk = min(len - off, chunk);
+
+		assert(parserutils_inputstream_append(stream,
+				chunk != 0 ? doc + off : NULL,
+				chunk) == PARSERUTILS_OK);
+		off += chunk;
+
+		while (true) {
+			const uint8_t *c;
+			size_t clen;
+
+			if (inserted == 0 && rnd() % 256 == 0) {
+				assert(parserutils_inputstream_insert(stream,
+						(const uint8_t *) "x\ny",
+						3) == PARSERUTILS_OK);
+				inserted = 3;
+			}
+
+			error = parserutils_inputstream_peek(stream, 0,
+					&c, &clen);
+			if (error != PARSERUTILS_OK)
+				break;
+
+			if (rnd() % 16 == 0) {
+				assert(parserutils_inputstream_position(stream,
+						&pos) == PARSERUTILS_OK);
+				assert(pos.offset == expect.offset);
+				assert(pos.line == expect.line);
+				assert(pos.column == expect.column);
+				if (exact) {
+					assert(pos.source == expect.source);
+				} else {
+					/* The start of a character may have
+					 * been consumed by an earlier refill */
+					assert(pos.source <= expect.source + 3);
+					assert(pos.source >= last_source);
+				}
+				last_source = pos.source;
+			}
+
+			parserutils_inputstream_advance(stream, clen);
+
+			expect.offset += clen;
+			if (c[0] == '\n') {
+				expect.line++;
+				expect.column = 1;
+			} else {
+				expect.column++;
+			}
+
+			/* Inserted data has no source of its own */
+			if (inserted > 0)
+				inserted -= clen;
+			else
+				expect.source += width(enc, clen);
+		}
+	}
+
+	assert(error == PARSERUTILS_EOF);
+
+	/* At the end, only inexact positions lag behind */
+	assert(parserutils_inputstream_position(stream, &pos) ==
+			PARSERUTILS_OK);
+	assert(pos.offset == expect.offset && pos.line == expect.line &&
+			pos.column == expect.column);
+	assert(exact ? pos.source == len : pos.source <= len);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct {
+		const char *enc;
+		bool garbage;
+		bool exact;
+	} docs[] = {
+		{ "UTF-8", false, true },
+		{ "UTF-16", false, true },
+		{ "windows-1252", false, true },
+		/* Invalid input and multibyte charsets resynchronise at
+		 * the start of each refill's output */
+		{ "UTF-8", true, false },
+		{ "Shift_JIS", false, false }
+	};
+	uint8_t *doc;
+	size_t i, len;
+	int mode;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	doc = malloc(DOC_LEN);
+	assert(doc != NULL);
+
+	for (i = 0; i < N_ELEMENTS(docs); i++) {
+		seed = i + 1;
+		len = make_doc(docs[i].enc, docs[i].garbage, doc);
+
+		for (mode = 0; mode < N_MODES; mode++)
+			check(docs[i].enc, doc, len, mode, docs[i].exact);
+	}
+
+	free(doc);
+
+	printf("PASS\n");
+
+	return 0;
+}
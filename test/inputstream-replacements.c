@@ -0,0 +1,253 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/cache.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define LONG_LEN (100000)
+#define GAP (997)
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Create a stream recording replacements, holding a whole document */
+static parserutils_inputstream *stream_create(const char *enc, size_t limit,
+		const char *data, size_t len)
+{
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream *stream;
+
+	assert(parserutils_inputstream_create(enc, 1, NULL, myrealloc, NULL,
+			&stream) == PARSERUTILS_OK);
+
+	params.replacements.limit = limit;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_REPLACEMENTS, &params) ==
+			PARSERUTILS_OK);
+
+	assert(parserutils_inputstream_append(stream,
+			(const uint8_t *) data, len) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	return stream;
+}
+
+/* Read the rest of a stream */
+static void drain(parserutils_inputstream *stream)
+{
+	const uint8_t *c;
+	size_t clen;
+
+	while (parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK)
+		parserutils_inputstream_advance(stream, clen);
+}
+
+/* Runs the tasks one after another, counting the calls */
+static void run(parserutils_task task, void *ctx, size_t count, void *pw)
+{
+	size_t *runs = pw, i;
+
+	(*runs)++;
+
+	for (i = 0; i < count; i++)
+		task(ctx, i);
+}
+
+/* Runs a task as soon as it is submitted, counting the calls */
+static void submit(parserutils_task task, void *ctx, void *pw)
+{
+	size_t *runs = pw;
+
+	(*runs)++;
+
+	task(ctx, 0);
+}
+
+/* Read a long document, with replacements throughout, in some way */
+static void read_long(const char *doc, parserutils_inputstream_opttype type,
+		parserutils_inputstream_optparams *params)
+{
+	const parserutils_inputstream_replacement *index;
+	parserutils_inputstream_optparams rparams;
+	parserutils_inputstream_stats stats;
+	parserutils_inputstream *stream;
+	size_t n, i;
+
+	assert(parserutils_inputstream_create("windows-1252", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	rparams.replacements.limit = LONG_LEN;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_REPLACEMENTS, &rparams) ==
+			PARSERUTILS_OK);
+
+	/* The pipeline may be unsupported */
+	if (parserutils_inputstream_setopt(stream, type, params) !=
+			PARSERUTILS_OK) {
+		parserutils_inputstream_destroy(stream);
+		return;
+	}
+
+	assert(parserutils_inputstream_append(stream,
+			(const uint8_t *) doc, LONG_LEN) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+	drain(stream);
+
+	assert(parserutils_inputstream_get_replacements(stream, &index,
+			&n) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_get_stats(stream, &stats) ==
+			PARSERUTILS_OK);
+	assert(n == LONG_LEN / GAP && n == stats.replacements);
+
+	for (i = 0; i < n; i++) {
+		/* Each replacement before is two bytes longer than its input */
+		assert(index[i].source == i * GAP + GAP - 1);
+		assert(index[i].offset == index[i].source + 2 * i);
+	}
+
+	parserutils_inputstream_destroy(stream);
+}
+
+/* Check the replacements a stream has recorded */
+static void expect(parserutils_inputstream *stream, size_t count,
+		const size_t *offsets, const size_t *sources)
+{
+	const parserutils_inputstream_replacement *index;
+	size_t n, i;
+
+	assert(parserutils_inputstream_get_replacements(stream, &index,
+			&n) == PARSERUTILS_OK);
+	assert(n == count);
+
+	for (i = 0; i < n; i++) {
+		assert(index[i].offset == offsets[i]);
+		assert(index[i].source == sources[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t utf8_off[] = { 1, 9 }, utf8_src[] = { 1, 7 };
+	static const size_t sbcs_off[] = { 2, 7 }, sbcs_src[] = { 2, 4 };
+	static const size_t ins_off[] = { 2, 10 }, ins_src[] = { 2, 4 };
+	static const size_t wide_off[] = { 1 }, wide_src16[] = { 2 };
+	static const size_t wide_src32[] = { 4 };
+	static char doc[LONG_LEN];
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream *stream;
+	const uint8_t *c;
+	size_t clen, runs, i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	/* Invalid UTF-8 is indexed, but U+FFFD in the input isn't */
+	stream = stream_create("UTF-8", 10,
+			"a\xFF" "b\xEF\xBF\xBD" "c\xE2\x82", 9);
+	drain(stream);
+	expect(stream, 2, utf8_off, utf8_src);
+	parserutils_inputstream_destroy(stream);
+
+	/* Lone surrogates and characters beyond Unicode, in UTF-16 and
+	 * UTF-32 */
+	stream = stream_create("UTF-16LE", 10,
+			"a\0" "\0\xD8" "b\0" "\xFD\xFF" "c\0", 10);
+	drain(stream);
+	expect(stream, 1, wide_off, wide_src16);
+	parserutils_inputstream_destroy(stream);
+
+	stream = stream_create("UTF-32BE", 10,
+			"\0\0\0a" "\0\x11\0\0" "\0\0\0b" "\0\0\xFF\xFD",
+			16);
+	drain(stream);
+	expect(stream, 1, wide_off, wide_src32);
+	parserutils_inputstream_destroy(stream);
+
+	/* Bytes undefined in a single-byte charset */
+	stream = stream_create("windows-1252", 10, "ab\x81\xE9\x81", 5);
+	drain(stream);
+	expect(stream, 2, sbcs_off, sbcs_src);
+
+	/* Reset forgets them */
+	assert(parserutils_inputstream_reset(stream, "windows-1252", 1,
+			NULL) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_append(stream,
+			(const uint8_t *) "abc", 3) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+	drain(stream);
+	expect(stream, 0, NULL, NULL);
+	parserutils_inputstream_destroy(stream);
+
+	/* No more are recorded than the limit, and none by default */
+	stream = stream_create("windows-1252", 1, "ab\x81\xE9\x81", 5);
+	drain(stream);
+	expect(stream, 1, sbcs_off, sbcs_src);
+	parserutils_inputstream_destroy(stream);
+
+	stream = stream_create("windows-1252", 0, "ab\x81\xE9\x81", 5);
+	drain(stream);
+	expect(stream, 0, NULL, NULL);
+	parserutils_inputstream_destroy(stream);
+
+	/* Data inserted before a replacement moves it along */
+	stream = stream_create("windows-1252", 10, "ab\x81\xE9\x81", 5);
+	assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK);
+	parserutils_inputstream_advance(stream, 2);
+	assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK);
+	parserutils_inputstream_advance(stream, 3);
+	assert(parserutils_inputstream_insert(stream,
+			(const uint8_t *) "xyz", 3) == PARSERUTILS_OK);
+	drain(stream);
+	expect(stream, 2, ins_off, ins_src);
+	parserutils_inputstream_destroy(stream);
+
+	/* Replacements throughout a document needing many refills */
+	for (i = 0; i < LONG_LEN; i++)
+		doc[i] = (i % GAP == GAP - 1) ? '\x81' : (char) ('a' + i % 26);
+
+	params.size_hint.length = 0;
+	read_long(doc, PARSERUTILS_INPUTSTREAM_SET_SIZE_HINT, &params);
+
+	runs = 0;
+	params.parallel.run = run;
+	params.parallel.pw = &runs;
+	params.parallel.segment = 4096;
+	params.parallel.tasks = 4;
+	read_long(doc, PARSERUTILS_INPUTSTREAM_SET_PARALLEL, &params);
+	assert(runs > 0);
+
+	params.pipeline.submit = submit;
+	params.pipeline.wait = NULL;
+	params.pipeline.pw = &runs;
+	params.pipeline.segment = 4096;
+	read_long(doc, PARSERUTILS_INPUTSTREAM_SET_PIPELINE, &params);
+
+	/* Whether decoded, or copied from the cache */
+	assert(parserutils_decode_cache_create(4 * LONG_LEN, NULL, NULL,
+			myrealloc, NULL, &params.cache.cache) ==
+			PARSERUTILS_OK);
+	read_long(doc, PARSERUTILS_INPUTSTREAM_SET_CACHE, &params);
+	read_long(doc, PARSERUTILS_INPUTSTREAM_SET_CACHE, &params);
+	parserutils_decode_cache_destroy(params.cache.cache);
+
+	printf("PASS\n");
+
+	return 0;
+}
+
@@ -0,0 +1,233 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Counts the allocations made through it */
+static void *countrealloc(void *ptr, size_t len, void *pw)
+{
+	uint32_t *count = pw;
+
+	if (len > 0)
+		(*count)++;
+
+	return realloc(ptr, len);
+}
+
+/* Runs each task as it's submitted */
+static void submit(parserutils_task task, void *ctx, void *pw)
+{
+	UNUSED(pw);
+
+	task(ctx, 0);
+}
+
+/* Give a stream a document, in pieces */
+static void feed(parserutils_inputstream *stream, const char *data,
+		size_t len)
+{
+	size_t off;
+
+	for (off = 0; off < len; off += 1000) {
+		assert(parserutils_inputstream_append(stream,
+				(const uint8_t *) data + off,
+				min(len - off, 1000)) == PARSERUTILS_OK);
+	}
+
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+}
+
+/* Read the stream to its end, checking it matches the expected data */
+static void expect(parserutils_inputstream *stream, const char *data,
+		size_t len)
+{
+	const uint8_t *c;
+	size_t clen, off = 0;
+	parserutils_error error;
+
+	while ((error = parserutils_inputstream_peek(stream, 0, &c, &clen)) ==
+			PARSERUTILS_OK) {
+		assert(off + clen <= len && memcmp(c, data + off, clen) == 0);
+
+		parserutils_inputstream_advance(stream, clen);
+		off += clen;
+	}
+
+	assert(error == PARSERUTILS_EOF && off == len);
+}
+
+/* A stream left part way through a document reads the next from scratch */
+static void check_documents(void)
+{
+	parserutils_inputstream_pos pos;
+	parserutils_inputstream *stream;
+	const uint8_t *c;
+	uint32_t count = 0, source;
+	size_t clen;
+
+	assert(parserutils_inputstream_create("Shift_JIS", 1, NULL,
+			countrealloc, &count, &stream) == PARSERUTILS_OK);
+
+	/* Stop part way through a character, with a mark set and data
+	 * inserted */
+	assert(parserutils_inputstream_append(stream,
+			(const uint8_t *) "a\nb\x82", 4) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK);
+	parserutils_inputstream_advance(stream, 2);
+	assert(parserutils_inputstream_mark(stream) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_insert(stream,
+			(const uint8_t *) "xyz", 3) == PARSERUTILS_OK);
+
+	/* A bad charset leaves the stream as it was */
+	assert(parserutils_inputstream_reset(stream, "NOT-A-CHARSET", 1,
+			NULL) == PARSERUTILS_BADENCODING);
+	assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK && clen == 1 && *c == 'x');
+	assert(parserutils_inputstream_reset(NULL, NULL, 0, NULL) ==
+			PARSERUTILS_BADPARM);
+
+	/* The same charset, with nothing left over from the last document */
+	assert(parserutils_inputstream_reset(stream, "Shift_JIS", 2, NULL) ==
+			PARSERUTILS_OK);
+	assert(strcmp(parserutils_inputstream_read_charset(stream, &source),
+			"Shift_JIS") == 0 && source == 2);
+	assert(parserutils_inputstream_rewind(stream) == PARSERUTILS_INVALID);
+
+	feed(stream, "\x82\xa0" "c", 3);
+	expect(stream, "\xe3\x81\x82" "c", 4);
+
+	assert(parserutils_inputstream_position(stream, &pos) ==
+			PARSERUTILS_OK);
+	assert(pos.offset == 4 && pos.source <= 3 && pos.line == 1 &&
+			pos.column == 3);
+
+	/* Another charset */
+	assert(parserutils_inputstream_reset(stream, "ISO-8859-1", 1, NULL) ==
+			PARSERUTILS_OK);
+	feed(stream, "caf\xe9\n!", 6);
+	expect(stream, "caf\xc3\xa9\n!", 7);
+
+	assert(parserutils_inputstream_position(stream, &pos) ==
+			PARSERUTILS_OK);
+	assert(pos.offset == 7 && pos.source == 6 && pos.line == 2 &&
+			pos.column == 2);
+
+	/* Detected afresh, with no charset given */
+	assert(parserutils_inputstream_reset(stream, NULL, 0, NULL) ==
+			PARSERUTILS_OK);
+	feed(stream, "\xef\xbb\xbf" "d\xc3\xa9", 6);
+	expect(stream, "d\xc3\xa9", 3);
+	assert(strcmp(parserutils_inputstream_read_charset(stream, &source),
+			"UTF-8") == 0);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+/* Documents no bigger than those before need no memory */
+static void check_reuse(void)
+{
+	static char doc[32 * 1024], utf8[64 * 1024];
+	parserutils_inputstream *stream;
+	uint32_t count = 0, before;
+	size_t i, len = 0;
+	int n;
+
+	for (i = 0; i < sizeof(doc); i++) {
+		doc[i] = (i % 37 == 0) ? (char) '\xe9' : (char) ('a' + i % 26);
+
+		if (doc[i] == '\xe9') {
+			utf8[len++] = '\xc3';
+			utf8[len++] = '\xa9';
+		} else {
+			utf8[len++] = doc[i];
+		}
+	}
+
+	assert(parserutils_inputstream_create("windows-1252", 1, NULL,
+			countrealloc, &count, &stream) == PARSERUTILS_OK);
+
+	feed(stream, doc, sizeof(doc));
+	expect(stream, utf8, len);
+
+	before = count;
+
+	for (n = 0; n < 3; n++) {
+		assert(parserutils_inputstream_reset(stream, "windows-1252", 1,
+				NULL) == PARSERUTILS_OK);
+		feed(stream, doc, sizeof(doc));
+		expect(stream, utf8, len);
+	}
+
+	assert(count == before);
+
+	/* Shorter documents fit too */
+	assert(parserutils_inputstream_reset(stream, "windows-1252", 1,
+			NULL) == PARSERUTILS_OK);
+	feed(stream, doc, sizeof(doc) / 3);
+	expect(stream, utf8, sizeof(doc) / 3 + (sizeof(doc) / 3 + 36) / 37);
+
+	assert(count == before);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+/* Data decoded ahead is thrown away with the rest */
+static void check_pipeline(void)
+{
+	static char doc[8 * 1024];
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream *stream;
+	uint32_t count = 0;
+	const uint8_t *c;
+	size_t clen;
+
+	memset(doc, 'p', sizeof(doc));
+
+	assert(parserutils_inputstream_create("ISO-8859-1", 1, NULL,
+			countrealloc, &count, &stream) == PARSERUTILS_OK);
+
+	params.pipeline.submit = submit;
+	params.pipeline.wait = NULL;
+	params.pipeline.pw = NULL;
+	params.pipeline.segment = 1024;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_PIPELINE, &params) ==
+			PARSERUTILS_OK);
+
+	/* Leave a segment decoded ahead */
+	assert(parserutils_inputstream_append(stream,
+			(const uint8_t *) doc, sizeof(doc)) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK && *c == 'p');
+
+	memset(doc, 'q', sizeof(doc));
+
+	assert(parserutils_inputstream_reset(stream, "ISO-8859-1", 1, NULL) ==
+			PARSERUTILS_OK);
+	feed(stream, doc, sizeof(doc));
+	expect(stream, doc, sizeof(doc));
+
+	parserutils_inputstream_destroy(stream);
+}
+
+int main(int argc, char **argv)
+{
+	UNUSED(argc);
+	UNUSED(argv);
+
+	check_documents();
+	check_reuse();
+	check_pipeline();
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,112 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Read the stream to its end, checking it matches the expected data */
+static void expect(parserutils_inputstream *stream, const char *data,
+		size_t len)
+{
+	const uint8_t *c;
+	size_t clen, off = 0;
+
+	while (parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK) {
+		assert(off + clen <= len && memcmp(c, data + off, clen) == 0);
+
+		parserutils_inputstream_advance(stream, clen);
+		off += clen;
+	}
+
+	assert(off == len);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_inputstream *stream;
+	parserutils_inputstream_optparams params;
+	uint32_t source;
+	const uint8_t *c;
+	size_t clen, i;
+	const char latin1[] = "caf\xe9";
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	params.retention.limit = 4096;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_RETENTION, &params) ==
+			PARSERUTILS_OK);
+
+	assert(parserutils_inputstream_append(stream,
+			(const uint8_t *) latin1, SLEN(latin1)) ==
+			PARSERUTILS_OK);
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	/* Read with the wrong charset */
+	expect(stream, "caf\xef\xbf\xbd", SLEN("caf\xef\xbf\xbd"));
+
+	/* Changing charset decodes the stream again */
+	assert(parserutils_inputstream_change_charset(stream,
+			"ISO-8859-1", 2) == PARSERUTILS_OK);
+	assert(strcmp(parserutils_inputstream_read_charset(stream, &source),
+			"ISO-8859-1") == 0 && source == 2);
+
+	expect(stream, "caf\xc3\xa9", SLEN("caf\xc3\xa9"));
+
+	/* And may be done repeatedly */
+	assert(parserutils_inputstream_change_charset(stream,
+			"UTF-8", 3) == PARSERUTILS_OK);
+	expect(stream, "caf\xef\xbf\xbd", SLEN("caf\xef\xbf\xbd"));
+
+	parserutils_inputstream_destroy(stream);
+
+	/* Once more than the limit has been decoded, it's too late */
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	params.retention.limit = 16;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_RETENTION, &params) ==
+			PARSERUTILS_OK);
+
+	for (i = 0; i < 8; i++) {
+		assert(parserutils_inputstream_append(stream,
+				(const uint8_t *) latin1, SLEN(latin1)) ==
+				PARSERUTILS_OK);
+	}
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK);
+
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_RETENTION, &params) ==
+			PARSERUTILS_INVALID);
+	assert(parserutils_inputstream_change_charset(stream,
+			"ISO-8859-1", 2) == PARSERUTILS_INVALID);
+
+	parserutils_inputstream_destroy(stream);
+
+	printf("PASS\n");
+
+	return 0;
+}
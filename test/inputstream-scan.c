@@ -0,0 +1,196 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+#include <parserutils/utils/byteset.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define DOC_LEN (64 * 1024)
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+
+	return (seed >> 16) & 0x7fff;
+}
+
+/* Sets to scan for, of various sizes */
+static const char *sets[] = {
+	"", "<", "<&\r", "<&\r\n\"'=>", "\"'\\\n\r\f\t <>=/&", "<&\r\n\"'="
+};
+
+static bool member(const char *set, size_t count, uint8_t c)
+{
+	return memchr(set, c, count) != NULL;
+}
+
+/* Valid UTF-8, mostly text, with some bytes from every set */
+static size_t make_doc(uint8_t *doc)
+{
+	size_t len = 0;
+
+	while (len < DOC_LEN - 4) {
+		uint32_t r = rnd() % 64;
+
+		if (r == 0) {
+			doc[len++] = "<&\r\n\"'=>\\\f\t /"[rnd() % 14];
+		} else if (r == 1) {
+			doc[len++] = 0;
+		} else if (r < 6) {
+			doc[len++] = 0xD0 | (rnd() % 0x10);
+			doc[len++] = 0x80 | (rnd() % 0x40);
+		} else if (r < 8) {
+			doc[len++] = 0xE3;
+			doc[len++] = 0x81 + rnd() % 2;
+			doc[len++] = 0x80 | (rnd() % 0x40);
+		} else {
+			doc[len++] = 'a' + rnd() % 26;
+		}
+	}
+
+	return len;
+}
+
+/* Scan strings of every alignment and length against a simple search */
+static void check_byteset(const uint8_t *doc, const char *members,
+		size_t count)
+{
+	parserutils_byteset set;
+	size_t start, len, expect;
+
+	assert(parserutils_byteset_init(&set, (const uint8_t *) members,
+			count) == PARSERUTILS_OK);
+
+	for (start = 0; start < 64; start++) {
+		for (len = 0; len < 200; len++) {
+			for (expect = 0; expect < len; expect++) {
+				if (member(members, count,
+						doc[start + expect]))
+					break;
+			}
+
+			assert(parserutils_byteset_scan(&set, doc + start,
+					len) == expect);
+		}
+	}
+}
+
+/* Read a document by scanning, checking each match, in chunks */
+static void check_stream(const uint8_t *doc, size_t len, const char *members,
+		size_t count)
+{
+	parserutils_inputstream *stream;
+	parserutils_byteset set;
+	parserutils_error error;
+	size_t off = 0, pos = 0, n;
+
+	assert(parserutils_byteset_init(&set, (const uint8_t *) members,
+			count) == PARSERUTILS_OK);
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL, myrealloc,
+			NULL, &stream) == PARSERUTILS_OK);
+
+	while (true) {
+		size_t chunk = 1 + rnd() % 5000;
+
+		chunk = min(len - off, chunk);
+
+		assert(parserutils_inputstream_append(stream,
+				chunk != 0 ? doc + off : NULL,
+				chunk) == PARSERUTILS_OK);
+		off += chunk;
+
+		while ((error = parserutils_inputstream_scan_until(stream,
+				&set, &n)) == PARSERUTILS_OK) {
+			/* Nothing skipped matches; the match does */
+			parserutils_inputstream_advance(stream, n);
+			for (; n > 0; n--, pos++)
+				assert(!member(members, count, doc[pos]));
+			assert(member(members, count, doc[pos]));
+
+			/* Step over the match, or leave it to be found again
+			 * after reading a little */
+			if (rnd() % 4 != 0) {
+				parserutils_inputstream_advance(stream, 1);
+				pos++;
+			}
+			if (rnd() % 8 == 0) {
+				const uint8_t *c;
+				size_t clen;
+
+				if (parserutils_inputstream_peek(stream, 0, &c,
+						&clen) == PARSERUTILS_OK) {
+					parserutils_inputstream_advance(stream,
+							clen);
+					pos += clen;
+				}
+			}
+		}
+
+		/* Skip all the data available */
+		parserutils_inputstream_advance(stream, n);
+		for (; n > 0; n--, pos++)
+			assert(!member(members, count, doc[pos]));
+
+		if (chunk == 0) {
+			assert(error == PARSERUTILS_EOF);
+			break;
+		}
+
+		assert(error == PARSERUTILS_NEEDDATA);
+	}
+
+	/* Everything was read */
+	assert(pos == len);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_byteset set;
+	uint8_t *doc;
+	size_t i, len;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	doc = malloc(DOC_LEN);
+	assert(doc != NULL);
+
+	len = make_doc(doc);
+
+	/* Non-ASCII members are rejected */
+	assert(parserutils_byteset_init(&set, (const uint8_t *) "<\x80",
+			2) == PARSERUTILS_BADPARM);
+	assert(parserutils_byteset_init(&set, NULL, 0) == PARSERUTILS_OK);
+	assert(parserutils_byteset_scan(&set, doc, len) == len);
+
+	for (i = 0; i < N_ELEMENTS(sets); i++) {
+		/* Include the NUL terminator in the other sets */
+		size_t count = strlen(sets[i]) + (i % 2);
+
+		check_byteset(doc, sets[i], count);
+		check_stream(doc, len, sets[i], count);
+	}
+
+	free(doc);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,128 @@
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/charset/utf8.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Consume the available data a character at a time */
+static size_t drain_chars(parserutils_inputstream *stream,
+		parserutils_error until)
+{
+	const uint8_t *c;
+	size_t clen, total = 0;
+
+	while (parserutils_inputstream_peek(stream, 0, &c, &clen) != until) {
+		parserutils_inputstream_advance(stream, clen);
+		total += clen;
+	}
+
+	return total;
+}
+
+/* Consume the available data a run at a time */
+static size_t drain_spans(parserutils_inputstream *stream,
+		parserutils_error until)
+{
+	const uint8_t *s;
+	size_t slen, clen, total = 0;
+	parserutils_error error;
+
+	while ((error = parserutils_inputstream_peek_span(stream, 0,
+			&s, &slen)) != until) {
+		assert(error == PARSERUTILS_OK);
+		assert(slen > 0);
+
+		/* The run must end on a character boundary */
+		assert(parserutils_charset_utf8_char_byte_length(s,
+				&clen) == PARSERUTILS_OK);
+		assert(clen <= slen);
+		assert((s[slen - 1] & 0xC0) != 0xC0);
+
+		parserutils_inputstream_advance(stream, slen);
+		total += slen;
+	}
+
+	return total;
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_inputstream *chars, *spans;
+	FILE *fp;
+	size_t len, by_char = 0, by_span = 0;
+#define CHUNK_SIZE (1000)
+	uint8_t buf[CHUNK_SIZE];
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &chars) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &spans) == PARSERUTILS_OK);
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	/* Chunks deliberately don't align with character boundaries */
+	while (len > 0) {
+		size_t want = len < CHUNK_SIZE ? len : CHUNK_SIZE;
+		size_t read = fread(buf, 1, want, fp);
+		assert(read == want);
+
+		assert(parserutils_inputstream_append(chars,
+				buf, read) == PARSERUTILS_OK);
+		assert(parserutils_inputstream_append(spans,
+				buf, read) == PARSERUTILS_OK);
+
+		len -= read;
+
+		by_char += drain_chars(chars, PARSERUTILS_NEEDDATA);
+		by_span += drain_spans(spans, PARSERUTILS_NEEDDATA);
+
+		assert(by_char == by_span);
+	}
+
+	fclose(fp);
+
+	assert(parserutils_inputstream_append(chars, NULL, 0) ==
+			PARSERUTILS_OK);
+	assert(parserutils_inputstream_append(spans, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	by_char += drain_chars(chars, PARSERUTILS_EOF);
+	by_span += drain_spans(spans, PARSERUTILS_EOF);
+
+	printf("%u bytes by character, %u bytes by span\n",
+			(unsigned int) by_char, (unsigned int) by_span);
+
+	assert(by_char == by_span);
+
+	parserutils_inputstream_destroy(spans);
+	parserutils_inputstream_destroy(chars);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Read a file through a stream, returning the stream's counters */
+static void run(const char *path, const char *enc,
+		parserutils_inputstream_stats *stats, size_t *flen)
+{
+	parserutils_inputstream *stream;
+	FILE *fp;
+	size_t len;
+#define CHUNK_SIZE (1000)
+	uint8_t buf[CHUNK_SIZE];
+	const uint8_t *c;
+	size_t clen;
+
+	assert(parserutils_inputstream_create(enc, 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	assert(parserutils_inputstream_get_stats(stream, stats) ==
+			PARSERUTILS_OK);
+	assert(stats->peek_slow == 0 && stats->refills == 0 &&
+			stats->decoded == 0 && stats->replacements == 0);
+
+	fp = fopen(path, "rb");
+	assert(fp != NULL);
+
+	*flen = 0;
+	while ((len = fread(buf, 1, CHUNK_SIZE, fp)) > 0) {
+		assert(parserutils_inputstream_append(stream,
+				buf, len) == PARSERUTILS_OK);
+		*flen += len;
+
+		while (parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+				PARSERUTILS_OK)
+			parserutils_inputstream_advance(stream, clen);
+	}
+
+	fclose(fp);
+
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	while (parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK)
+		parserutils_inputstream_advance(stream, clen);
+
+	assert(parserutils_inputstream_get_stats(stream, stats) ==
+			PARSERUTILS_OK);
+
+	printf("%s: peek_slow %u refills %u decoded %u moved %u "
+			"grows %u peak %u replacements %u\n", enc,
+			stats->peek_slow, stats->refills,
+			(unsigned int) stats->decoded,
+			(unsigned int) stats->moved,
+			stats->grows, (unsigned int) stats->peak,
+			stats->replacements);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_inputstream_stats stats;
+	size_t len;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	run(argv[1], "UTF-8", &stats, &len);
+
+	assert(stats.decoded == len);
+	assert(stats.refills > 0 && stats.peek_slow >= stats.refills);
+	assert(stats.peak >= 4096);
+
+	/* The test data contains malformed sequences */
+	assert(stats.replacements > 0);
+
+	/* Decoding through the filter is counted in the same way */
+	run(argv[1], "ISO-8859-1", &stats, &len);
+
+	assert(stats.decoded == len);
+	assert(stats.refills > 0 && stats.peek_slow >= stats.refills);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,144 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define DOC_LEN (64 * 1024)
+#define CHUNK_SIZE (3000)
+
+typedef struct events {
+	uint32_t grows;
+	uint32_t moves;
+} events;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static void trace(parserutils_trace_event event, uint64_t a, uint64_t b,
+		void *pw)
+{
+	events *ev = pw;
+
+	switch (event) {
+	case PARSERUTILS_TRACE_BUFFER_GROW:
+		assert(a < b);
+		ev->grows++;
+		break;
+	case PARSERUTILS_TRACE_REFILL_MOVE:
+		assert(a > 0 && a <= b);
+		ev->moves++;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Peek at all available data, then read half of it */
+static void read_half(parserutils_inputstream *stream)
+{
+	const uint8_t *c;
+	size_t clen, n = 0;
+
+	while (parserutils_inputstream_peek(stream, n, &c, &clen) ==
+			PARSERUTILS_OK)
+		n += clen;
+
+	parserutils_inputstream_advance(stream, (n + 1) / 2);
+}
+
+/* Read a document, peeking ahead of the cursor */
+static void run(parserutils_inputstream *stream, const uint8_t *doc,
+		size_t len)
+{
+	const uint8_t *c;
+	size_t clen, off;
+
+	for (off = 0; off < len; off += CHUNK_SIZE) {
+		assert(parserutils_inputstream_append(stream, doc + off,
+				min(len - off, CHUNK_SIZE)) == PARSERUTILS_OK);
+
+		read_half(stream);
+	}
+
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	while (parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK)
+		parserutils_inputstream_advance(stream, clen);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_inputstream_optparams params;
+	parserutils_inputstream *stream;
+	events ev = { 0, 0 };
+	uint8_t *doc;
+	size_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	doc = malloc(DOC_LEN);
+	assert(doc != NULL);
+	for (i = 0; i < DOC_LEN; i++)
+		doc[i] = 'a' + i % 26;
+
+	/* Attached */
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	params.trace.func = trace;
+	params.trace.pw = &ev;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_TRACE, &params) ==
+			PARSERUTILS_OK);
+
+	run(stream, doc, DOC_LEN);
+
+	parserutils_inputstream_destroy(stream);
+
+#ifdef WITH_TRACE
+	assert(ev.grows > 0 && ev.moves > 0);
+#else
+	assert(ev.grows == 0 && ev.moves == 0);
+#endif
+
+	/* Attached, then detached again */
+	ev.grows = ev.moves = 0;
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_TRACE, &params) ==
+			PARSERUTILS_OK);
+
+	params.trace.func = NULL;
+	params.trace.pw = NULL;
+	assert(parserutils_inputstream_setopt(stream,
+			PARSERUTILS_INPUTSTREAM_SET_TRACE, &params) ==
+			PARSERUTILS_OK);
+
+	run(stream, doc, DOC_LEN);
+
+	parserutils_inputstream_destroy(stream);
+
+	assert(ev.grows == 0 && ev.moves == 0);
+
+	free(doc);
+
+	printf("PASS\n");
+
+	return 0;
+}
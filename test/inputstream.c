@@ -95,6 +95,39 @@ int main(int argc, char **argv)
 
 	parserutils_inputstream_destroy(stream);
 
+	/* The out-of-line forms read the same as the inline ones */
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	assert(parserutils_inputstream_append(stream,
+			(const uint8_t *) "caf\xc3\xa9 \xe2\x82\xac!",
+			SLEN("caf\xc3\xa9 \xe2\x82\xac!")) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	len = 0;
+	while (parserutils_inputstream_peek(stream, 0, &c, &clen) !=
+			PARSERUTILS_EOF) {
+		const uint8_t *ec;
+		size_t eclen;
+
+		assert(parserutils_inputstream_peek_extern(stream, 0,
+				&ec, &eclen) == PARSERUTILS_OK);
+		assert(ec == c && eclen == clen);
+
+		/* Alternate between the two ways of advancing */
+		if (len++ % 2 == 0)
+			parserutils_inputstream_advance(stream, clen);
+		else
+			parserutils_inputstream_advance_extern(stream, clen);
+	}
+
+	assert(len == 7);
+	assert(parserutils_inputstream_peek_extern(stream, 0, &c, &clen) ==
+			PARSERUTILS_EOF);
+
+	parserutils_inputstream_destroy(stream);
+
 	printf("PASS\n");
 
 	return 0;
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/utils/interner.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static int outstanding;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	if (ptr == NULL && len > 0)
+		outstanding++;
+	else if (ptr != NULL && len == 0)
+		outstanding--;
+
+	return realloc(ptr, len);
+}
+
+int main(int argc, char **argv)
+{
+	const parserutils_interned *div, *div2, *span, *found, *empty, *big;
+	parserutils_interner *interner;
+	uint8_t large[10000];
+	char name[16];
+	size_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	assert(parserutils_interner_create(myrealloc, NULL, &interner) ==
+			PARSERUTILS_OK);
+
+	assert(parserutils_interner_find(interner, (const uint8_t *) "div", 3,
+			&found) == PARSERUTILS_INVALID);
+
+	assert(parserutils_interner_intern(interner,
+			(const uint8_t *) "divx", 3, &div) == PARSERUTILS_OK);
+	assert(div->len == 3 && strcmp((const char *) div->data, "div") == 0);
+
+	/* Interning again yields the same object */
+	strcpy(name, "div");
+	assert(parserutils_interner_intern(interner, (const uint8_t *) name,
+			3, &div2) == PARSERUTILS_OK);
+	assert(div2 == div);
+
+	assert(parserutils_interner_intern(interner,
+			(const uint8_t *) "span", 4, &span) == PARSERUTILS_OK);
+	assert(span != div);
+
+	assert(parserutils_interner_find(interner, (const uint8_t *) "span", 4,
+			&found) == PARSERUTILS_OK && found == span);
+
+	assert(parserutils_interner_intern(interner, NULL, 0, &empty) ==
+			PARSERUTILS_OK);
+	assert(empty->len == 0 && empty->data[0] == '\0');
+
+	/* Enough strings to need several blocks, and one needing its own */
+	memset(large, 'x', sizeof(large));
+	assert(parserutils_interner_intern(interner, large, sizeof(large),
+			&big) == PARSERUTILS_OK);
+	assert(big->len == sizeof(large) &&
+			memcmp(big->data, large, sizeof(large)) == 0);
+
+	for (i = 0; i < 5000; i++) {
+		const parserutils_interned *s, *t;
+
+		sprintf(name, "name-%u", (unsigned) i);
+		assert(parserutils_interner_intern(interner,
+				(const uint8_t *) name, strlen(name), &s) ==
+				PARSERUTILS_OK);
+		assert(parserutils_interner_intern(interner,
+				(const uint8_t *) name, strlen(name), &t) ==
+				PARSERUTILS_OK);
+		assert(s == t && strcmp((const char *) s->data, name) == 0);
+	}
+
+	/* Earlier strings are unaffected by later ones */
+	assert(strcmp((const char *) div->data, "div") == 0);
+	assert(parserutils_interner_find(interner, large, sizeof(large),
+			&found) == PARSERUTILS_OK && found == big);
+
+	assert(parserutils_interner_destroy(interner) == PARSERUTILS_OK);
+	assert(outstanding == 0);
+
+	printf("PASS\n");
+
+	return 0;
+}
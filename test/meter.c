@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+#include <parserutils/utils/meter.h>
+#include <parserutils/utils/stack.h>
+#include <parserutils/utils/vector.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static parserutils_meter_usage usage_of(parserutils_meter *meter)
+{
+	parserutils_meter_usage usage;
+
+	assert(parserutils_meter_get_usage(meter, &usage) == PARSERUTILS_OK);
+
+	return usage;
+}
+
+/* Blocks are counted as they're allocated, resized and freed */
+static void check_blocks(parserutils_meter *meter)
+{
+	uint8_t *a, *b, *c;
+
+	a = parserutils_meter_alloc(NULL, 100, meter);
+	assert(a != NULL && usage_of(meter).current == 100);
+
+	memset(a, 'a', 100);
+	a = parserutils_meter_alloc(a, 300, meter);
+	assert(a != NULL && a[99] == 'a' && usage_of(meter).current == 300);
+
+	a = parserutils_meter_alloc(a, 50, meter);
+	assert(a != NULL && usage_of(meter).current == 50);
+	assert(usage_of(meter).peak == 300);
+
+	assert(parserutils_meter_reset_peak(meter) == PARSERUTILS_OK);
+	assert(usage_of(meter).peak == 50);
+
+	/* Beyond the limit, allocations fail, leaving blocks as they were */
+	assert(parserutils_meter_set_limit(meter, 1000) == PARSERUTILS_OK);
+
+	b = parserutils_meter_alloc(NULL, 900, meter);
+	assert(b != NULL && usage_of(meter).current == 950);
+
+	c = parserutils_meter_alloc(NULL, 51, meter);
+	assert(c == NULL && usage_of(meter).refused == 1);
+
+	memset(b, 'b', 900);
+	assert(parserutils_meter_alloc(b, 951, meter) == NULL);
+	assert(b[899] == 'b' && usage_of(meter).current == 950);
+
+	/* Shrinking is always allowed */
+	assert(parserutils_meter_set_limit(meter, 10) == PARSERUTILS_OK);
+	b = parserutils_meter_alloc(b, 400, meter);
+	assert(b != NULL && b[399] == 'b' && usage_of(meter).current == 450);
+	assert(usage_of(meter).refused == 2 && usage_of(meter).limit == 10);
+
+	assert(parserutils_meter_alloc(b, 0, meter) == NULL);
+	assert(parserutils_meter_alloc(a, 0, meter) == NULL);
+	assert(usage_of(meter).current == 0);
+
+	assert(parserutils_meter_set_limit(meter, 0) == PARSERUTILS_OK);
+	assert(parserutils_meter_reset_peak(meter) == PARSERUTILS_OK);
+}
+
+/* Read a document, returning the first error other than needing data */
+static parserutils_error read_document(parserutils_meter *meter,
+		const uint8_t *doc, size_t len)
+{
+	parserutils_inputstream *stream;
+	parserutils_error error = PARSERUTILS_OK;
+	size_t off, read = 0;
+
+	error = parserutils_inputstream_create("windows-1252", 1, NULL,
+			parserutils_meter_alloc, meter, &stream);
+	if (error != PARSERUTILS_OK)
+		return error;
+
+	for (off = 0; off <= len && error == PARSERUTILS_OK; off += 4096) {
+		const uint8_t *c;
+		size_t clen;
+
+		if (off < len) {
+			error = parserutils_inputstream_append(stream, doc + off,
+					min(len - off, 4096));
+		} else {
+			error = parserutils_inputstream_append(stream, NULL, 0);
+		}
+
+		/* Read half as fast as it arrives, until the end */
+		while (error == PARSERUTILS_OK && (off >= len ||
+				read < off / 2)) {
+			error = parserutils_inputstream_peek(stream, 0,
+					&c, &clen);
+			if (error == PARSERUTILS_OK) {
+				parserutils_inputstream_advance(stream, clen);
+				read += clen;
+			}
+		}
+
+		if (error == PARSERUTILS_NEEDDATA)
+			error = PARSERUTILS_OK;
+	}
+
+	/* Everything the stream holds is counted */
+	assert(usage_of(meter).current > 0);
+
+	parserutils_inputstream_destroy(stream);
+
+	return error == PARSERUTILS_EOF ? PARSERUTILS_OK : error;
+}
+
+/* A stream's memory is all counted, and may be limited */
+static void check_stream(parserutils_meter *meter)
+{
+	static uint8_t doc[256 * 1024];
+	parserutils_meter_usage usage;
+	size_t i;
+
+	for (i = 0; i < sizeof(doc); i++)
+		doc[i] = (i % 17 == 0) ? 0xe9 : (uint8_t) ('a' + i % 26);
+
+	assert(read_document(meter, doc, sizeof(doc)) == PARSERUTILS_OK);
+
+	usage = usage_of(meter);
+	assert(usage.current == 0 && usage.peak > sizeof(doc) / 4);
+
+	/* The same document can't be read in half the memory */
+	assert(parserutils_meter_reset_peak(meter) == PARSERUTILS_OK);
+	assert(parserutils_meter_set_limit(meter, usage.peak / 2) ==
+			PARSERUTILS_OK);
+
+	assert(read_document(meter, doc, sizeof(doc)) == PARSERUTILS_NOMEM);
+
+	usage = usage_of(meter);
+	assert(usage.current == 0 && usage.peak <= usage.limit &&
+			usage.refused > 0);
+
+	assert(parserutils_meter_set_limit(meter, 0) == PARSERUTILS_OK);
+	assert(parserutils_meter_reset_peak(meter) == PARSERUTILS_OK);
+}
+
+/* So are a stack's and a vector's */
+static void check_containers(parserutils_meter *meter)
+{
+	parserutils_vector *vector;
+	parserutils_stack *stack;
+	uint32_t i, item = 0;
+	parserutils_error error;
+
+	assert(parserutils_stack_create(sizeof(uint32_t), 16,
+			parserutils_meter_alloc, meter, &stack) ==
+			PARSERUTILS_OK);
+	assert(parserutils_vector_create(sizeof(uint32_t), 16,
+			parserutils_meter_alloc, meter, &vector) ==
+			PARSERUTILS_OK);
+
+	assert(parserutils_meter_set_limit(meter,
+			usage_of(meter).current + 8192) == PARSERUTILS_OK);
+
+	for (i = 0; i < 1024; i++) {
+		assert(parserutils_stack_push(stack, &i) == PARSERUTILS_OK);
+		assert(parserutils_vector_append(vector, &i) ==
+				PARSERUTILS_OK);
+	}
+
+	assert(usage_of(meter).current >= 2 * 1024 * sizeof(uint32_t));
+
+	/* Until the limit is reached */
+	do {
+		error = parserutils_stack_push(stack, &item);
+		if (error == PARSERUTILS_OK)
+			error = parserutils_vector_append(vector, &item);
+	} while (error == PARSERUTILS_OK);
+
+	assert(error == PARSERUTILS_NOMEM);
+	assert(usage_of(meter).current <= usage_of(meter).limit);
+
+	parserutils_vector_destroy(vector);
+	parserutils_stack_destroy(stack);
+
+	assert(usage_of(meter).current == 0);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_meter *meter;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	assert(parserutils_meter_create(myrealloc, NULL, &meter) ==
+			PARSERUTILS_OK);
+
+	check_blocks(meter);
+	check_stream(meter);
+	check_containers(meter);
+
+	assert(parserutils_meter_destroy(meter) == PARSERUTILS_OK);
+
+	assert(parserutils_meter_create(NULL, NULL, &meter) ==
+			PARSERUTILS_BADPARM);
+
+	printf("PASS\n");
+
+	return 0;
+}
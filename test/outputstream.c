@@ -0,0 +1,268 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/output/outputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Text, and its encoding with each fallback */
+static const struct {
+	const char *enc;
+	const char *text;
+	size_t len;
+	const char *loose;
+	const char *ncr;
+	size_t outlen;
+} cases[] = {
+	{ "windows-1252", "caf\xc3\xa9 \xe2\x82\xac", 9,
+	  "caf\xe9 \x80", "caf\xe9 \x80", 6 },
+	/* Unrepresentable characters, in and beyond the BMP */
+	{ "windows-1252", "\xe6\x97\xa5" "a\xf0\x9f\x98\x80", 8,
+	  "?a?", "&#26085;a&#128512;", 0 },
+	{ "ISO-8859-1", "\xc2\xa0\xe2\x82\xac", 5,
+	  "\xa0?", "\xa0&#8364;", 0 },
+	{ "KOI8-R", "\xd0\x96\xd0\xb6!", 5,
+	  "\xf6\xd6!", "\xf6\xd6!", 3 },
+	/* Invalid UTF-8, and an incomplete character at the end */
+	{ "windows-1252", "a\x80" "b\xe2\x82", 5,
+	  "a?b?", "a&#65533;b&#65533;", 0 },
+	/* Unicode charsets have U+FFFD for invalid input */
+	{ "UTF-16BE", "a\xe2\x82\xac\xff", 5,
+	  "\x00\x61\x20\xac\xff\xfd", "\x00\x61\x20\xac\xff\xfd", 6 },
+	{ "UTF-16LE", "\xf0\x9f\x98\x80", 4,
+	  "\x3d\xd8\x00\xde", "\x3d\xd8\x00\xde", 4 }
+};
+
+typedef struct output {
+	uint8_t data[96 * 1024];	/* Data written */
+	size_t len;			/* Length of data written */
+	uint32_t writes;		/* Calls to the writer */
+	uint32_t refuse;		/* Calls to fail */
+} output;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static parserutils_error writer(const uint8_t *data, size_t len, void *pw)
+{
+	output *out = pw;
+
+	assert(len > 0 && out->len + len <= sizeof(out->data));
+
+	out->writes++;
+	if (out->refuse > 0) {
+		out->refuse--;
+		return PARSERUTILS_NOMEM;
+	}
+
+	memcpy(out->data + out->len, data, len);
+	out->len += len;
+
+	return PARSERUTILS_OK;
+}
+
+static parserutils_outputstream *create(const char *enc,
+		parserutils_outputstream_fallback mode, size_t block,
+		output *out)
+{
+	parserutils_outputstream_optparams params;
+	parserutils_outputstream *stream;
+
+	memset(out, 0, sizeof(*out));
+
+	assert(parserutils_outputstream_create(enc, writer, out, myrealloc,
+			NULL, &stream) == PARSERUTILS_OK);
+
+	params.fallback.mode = mode;
+	assert(parserutils_outputstream_setopt(stream,
+			PARSERUTILS_OUTPUTSTREAM_SET_FALLBACK, &params) ==
+			PARSERUTILS_OK);
+
+	params.block.size = block;
+	assert(parserutils_outputstream_setopt(stream,
+			PARSERUTILS_OUTPUTSTREAM_SET_BLOCK_SIZE, &params) ==
+			PARSERUTILS_OK);
+
+	return stream;
+}
+
+/* Encode some text, a byte at a time and all at once */
+static void check_case(const char *enc, const char *text, size_t len,
+		parserutils_outputstream_fallback mode,
+		const char *expect, size_t outlen)
+{
+	parserutils_outputstream *stream;
+	output out;
+	size_t i;
+
+	if (outlen == 0)
+		outlen = strlen(expect);
+
+	stream = create(enc, mode, 0, &out);
+
+	for (i = 0; i < len; i++) {
+		assert(parserutils_outputstream_append(stream,
+				(const uint8_t *) text + i, 1) ==
+				PARSERUTILS_OK);
+		assert(parserutils_outputstream_flush(stream) ==
+				PARSERUTILS_OK);
+	}
+	assert(parserutils_outputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+
+	if (out.len != outlen || memcmp(out.data, expect, outlen) != 0) {
+		printf("FAIL - encoded '%.*s' to %s as '%.*s'\n",
+				(int) len, text, enc, (int) out.len, out.data);
+		exit(1);
+	}
+
+	parserutils_outputstream_destroy(stream);
+
+	stream = create(enc, mode, 0, &out);
+
+	assert(parserutils_outputstream_append(stream,
+			(const uint8_t *) text, len) == PARSERUTILS_OK);
+	assert(out.writes == 0);
+	assert(parserutils_outputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+	assert(out.writes == 1);
+
+	assert(out.len == outlen && memcmp(out.data, expect, outlen) == 0);
+
+	parserutils_outputstream_destroy(stream);
+}
+
+/* A strict stream stops at a character, until the fallback is changed */
+static void check_strict(void)
+{
+	parserutils_outputstream_optparams params;
+	parserutils_outputstream *stream;
+	output out;
+
+	stream = create("windows-1252", PARSERUTILS_OUTPUTSTREAM_FALLBACK_STRICT,
+			0, &out);
+
+	assert(parserutils_outputstream_append(stream,
+			(const uint8_t *) "ab\xe6\x97\xa5" "cd", 7) ==
+			PARSERUTILS_OK);
+	assert(parserutils_outputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_INVALID);
+	assert(out.len == 2 && memcmp(out.data, "ab", 2) == 0);
+
+	/* Trying again makes no difference */
+	assert(parserutils_outputstream_flush(stream) == PARSERUTILS_INVALID);
+	assert(out.len == 2);
+
+	params.fallback.mode = PARSERUTILS_OUTPUTSTREAM_FALLBACK_NCR;
+	assert(parserutils_outputstream_setopt(stream,
+			PARSERUTILS_OUTPUTSTREAM_SET_FALLBACK, &params) ==
+			PARSERUTILS_OK);
+	assert(parserutils_outputstream_append(stream, NULL, 0) ==
+			PARSERUTILS_OK);
+	assert(out.len == 12 && memcmp(out.data, "ab&#26085;cd", 12) == 0);
+
+	params.fallback.mode = 42;
+	assert(parserutils_outputstream_setopt(stream,
+			PARSERUTILS_OUTPUTSTREAM_SET_FALLBACK, &params) ==
+			PARSERUTILS_BADPARM);
+
+	parserutils_outputstream_destroy(stream);
+}
+
+/* A long document, given in pieces splitting its characters, is written a
+ * block at a time, and a refused block is offered again */
+static void check_blocks(void)
+{
+	static const char *words[] = { "plain ", "caf\xc3\xa9 ",
+			"\xe2\x82\xac" "5 ", "\xe6\x97\xa5\xe6\x9c\xac " };
+	static const char *encoded[] = { "plain ", "caf\xe9 ",
+			"\x80" "5 ", "&#26085;&#26412; " };
+	static uint8_t doc[32 * 1024], expect[96 * 1024];
+	parserutils_outputstream *stream;
+	size_t len = 0, outlen = 0, off = 0, chunk = 1;
+	parserutils_error error;
+	bool refused = false;
+	output out;
+
+	while (len < sizeof(doc) - 16) {
+		size_t w = (len * 7 + outlen) % N_ELEMENTS(words);
+
+		memcpy(doc + len, words[w], strlen(words[w]));
+		len += strlen(words[w]);
+		memcpy(expect + outlen, encoded[w], strlen(encoded[w]));
+		outlen += strlen(encoded[w]);
+	}
+
+	stream = create("windows-1252", PARSERUTILS_OUTPUTSTREAM_FALLBACK_NCR,
+			1024, &out);
+
+	while (off < len) {
+		size_t n = min(chunk, len - off);
+
+		if (off > len / 2 && refused == false) {
+			out.refuse = 2;
+			refused = true;
+		}
+
+		error = parserutils_outputstream_append(stream, doc + off, n);
+		assert(error == PARSERUTILS_OK || error == PARSERUTILS_NOMEM);
+
+		off += n;
+		chunk = chunk % 13 + 1;
+	}
+
+	do {
+		error = parserutils_outputstream_append(stream, NULL, 0);
+	} while (error == PARSERUTILS_NOMEM);
+	assert(error == PARSERUTILS_OK);
+
+	/* A block's worth of UTF-8 encodes to about as much */
+	assert(out.writes > len / 1024 && out.writes < 2 * len / 1024 + 8);
+
+	if (out.len != outlen || memcmp(out.data, expect, outlen) != 0) {
+		printf("FAIL - encoded %zu bytes as %zu, not %zu\n",
+				len, out.len, outlen);
+		exit(1);
+	}
+
+	parserutils_outputstream_destroy(stream);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_outputstream *stream;
+	output out;
+	size_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	for (i = 0; i < N_ELEMENTS(cases); i++) {
+		check_case(cases[i].enc, cases[i].text, cases[i].len,
+				PARSERUTILS_OUTPUTSTREAM_FALLBACK_LOOSE,
+				cases[i].loose, cases[i].outlen);
+		check_case(cases[i].enc, cases[i].text, cases[i].len,
+				PARSERUTILS_OUTPUTSTREAM_FALLBACK_NCR,
+				cases[i].ncr, cases[i].outlen);
+	}
+
+	check_strict();
+	check_blocks();
+
+	assert(parserutils_outputstream_create("NOT-A-CHARSET", writer, &out,
+			myrealloc, NULL, &stream) == PARSERUTILS_BADENCODING);
+	assert(parserutils_outputstream_create("UTF-8", NULL, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_BADPARM);
+
+	printf("PASS\n");
+
+	return 0;
+}
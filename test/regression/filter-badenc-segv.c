@@ -32,12 +32,12 @@ int main(int argc, char **argv)
 	assert(parserutils__filter_create("UTF-8", myrealloc, NULL, &input) ==
 			PARSERUTILS_OK);
 
-	params.encoding.name = "GBK";
+	params.encoding.name = "ISO-2022-JP";
 	assert(parserutils__filter_setopt(input, 
 			PARSERUTILS_FILTER_SET_ENCODING, &params) == 
 			expected);
 
-	params.encoding.name = "GBK";
+	params.encoding.name = "ISO-2022-JP";
 	assert(parserutils__filter_setopt(input, 
 			PARSERUTILS_FILTER_SET_ENCODING, &params) == 
 			expected);
@@ -0,0 +1,180 @@
+/* For setenv */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/simd.h"
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define LEN (300)
+
+/* Fill a buffer with bytes of a kind, from a simple generator */
+static void fill(uint8_t *buf, size_t len, int kind, uint32_t *seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		*seed = *seed * 1103515245 + 12345;
+
+		switch (kind) {
+		case 0:
+			/* ASCII, with line feeds */
+			buf[i] = (*seed >> 16) % 16 == 0 ? '\n' :
+					(uint8_t) ('a' + (*seed >> 16) % 26);
+			break;
+		case 1:
+			/* Mostly ASCII, with some of everything else */
+			buf[i] = (*seed >> 16) % 64 == 0 ?
+					(uint8_t) (*seed >> 24) :
+					(uint8_t) ('a' + (*seed >> 16) % 26);
+			break;
+		default:
+			buf[i] = (uint8_t) (*seed >> 16);
+			break;
+		}
+	}
+}
+
+/* An implementation gives the same results as the portable one */
+static void check_kernels(const parserutils_simd_kernels *k,
+		const parserutils_simd_kernels *ref)
+{
+	static const uint8_t bytes[] = { '<', '&', '\n', 0xE9, 0, 'z', 0x80,
+			0xFF };
+	uint8_t s[LEN + 1], d1[LEN * 4], d2[LEN * 4];
+	uint32_t seed = 1;
+	size_t len, count, i;
+	int kind;
+
+	for (kind = 0; kind < 3; kind++)
+	for (len = 0; len < LEN; len++) {
+		size_t l1, c1, f1, l2, c2, f2, n, skipped;
+
+		/* Misalign the data, by starting one byte in */
+		fill(s, len + 1, kind, &seed);
+
+		assert(k->ascii_prefix(s + 1, len) ==
+				ref->ascii_prefix(s + 1, len));
+		assert(k->below_prefix(s + 1, len, 0xC2) ==
+				ref->below_prefix(s + 1, len, 0xC2));
+		assert(k->below_prefix(s + 1, len, 0x80) ==
+				ref->below_prefix(s + 1, len, 0x80));
+
+		for (count = 0; count <= 8; count++) {
+			assert(k->find_any(s + 1, len, bytes + 8 - count,
+					count) == ref->find_any(s + 1, len,
+					bytes + 8 - count, count));
+		}
+
+		k->utf8_counts(s + 1, len, &l1, &c1, &f1);
+		ref->utf8_counts(s + 1, len, &l2, &c2, &f2);
+		assert(l1 == l2 && c1 == c2 && f1 == f2);
+
+		/* Skipping may stop at a different block, but no later than
+		 * the characters allow */
+		n = len / 3;
+		skipped = k->utf8_skip(s + 1, len, &n);
+		ref->utf8_counts(s + 1, skipped, &l1, &c1, &f1);
+		assert(skipped <= len && skipped - c1 == len / 3 - n);
+
+		/* The ASCII prefix may be widened and narrowed */
+		l1 = ref->ascii_prefix(s + 1, len);
+
+		memset(d1, 0xAA, sizeof(d1));
+		memset(d2, 0xAA, sizeof(d2));
+		for (i = 0; i < 2; i++) {
+			k->ascii_to_ucs4(s + 1, l1, i == 0, d1);
+			ref->ascii_to_ucs4(s + 1, l1, i == 0, d2);
+			assert(memcmp(d1, d2, sizeof(d1)) == 0);
+		}
+
+		if (kind == 0) {
+			/* Big endian UTF-16 and UTF-32 of the ASCII */
+			uint8_t wide[LEN * 4];
+
+			for (i = 0; i < len; i++) {
+				wide[i * 2] = 0;
+				wide[i * 2 + 1] = s[1 + i];
+			}
+			if (len > 0 && (seed >> 20) % 2 == 0)
+				wide[(seed >> 8) % len * 2] = 0x01;
+
+			for (i = 0; i < 2; i++) {
+				memset(d1, 0, len);
+				memset(d2, 0, len);
+				assert(k->utf16_ascii_to_utf8(wide, len, i,
+						d1) ==
+						ref->utf16_ascii_to_utf8(wide,
+						len, i, d2));
+				assert(memcmp(d1, d2, len) == 0);
+			}
+
+			ref->ascii_to_ucs4(s + 1, len, false, wide);
+			if (len > 0 && (seed >> 20) % 2 == 0)
+				wide[(seed >> 8) % len * 4 + 2] = 0x01;
+
+			for (i = 0; i < 2; i++) {
+				memset(d1, 0, len);
+				memset(d2, 0, len);
+				assert(k->utf32_ascii_to_utf8(wide, len, i,
+						d1) ==
+						ref->utf32_ascii_to_utf8(wide,
+						len, i, d2));
+				assert(memcmp(d1, d2, len) == 0);
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const parserutils_simd_kernels *ref, *k;
+	int level;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	ref = parserutils__simd_kernels(PARSERUTILS_SIMD_SCALAR);
+	assert(ref != NULL);
+
+	for (level = 0; level < PARSERUTILS_SIMD_LEVELS; level++) {
+		k = parserutils__simd_kernels(level);
+		if (k == NULL)
+			continue;
+
+		printf("%s\n", k->name);
+		check_kernels(k, ref);
+	}
+
+	assert(parserutils__simd_kernels(PARSERUTILS_SIMD_LEVELS) == NULL);
+
+	/* The implementations were chosen as the library was loaded */
+	k = simd_kernels();
+	assert(k == parserutils__simd && k != NULL);
+
+	/* The environment may choose lesser implementations, but not
+	 * unsupported ones. Those in use stay as they were. */
+	setenv("PARSERUTILS_SIMD", "scalar", 1);
+	assert(parserutils__simd_resolve() == ref);
+	assert(simd_kernels() == k);
+
+	setenv("PARSERUTILS_SIMD", "no-such-thing", 1);
+	k = parserutils__simd_resolve();
+	assert(k != NULL);
+
+	for (level = PARSERUTILS_SIMD_LEVELS - 1; level >= 0; level--) {
+		if (parserutils__simd_kernels(level) != NULL)
+			break;
+	}
+	assert(k == parserutils__simd_kernels(level));
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/utils/stack.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static int outstanding;
+static int allocations;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	if (len > 0)
+		allocations++;
+
+	if (ptr == NULL && len > 0)
+		outstanding++;
+	else if (ptr != NULL && len == 0)
+		outstanding--;
+
+	return realloc(ptr, len);
+}
+
+typedef struct item {
+	uint32_t index;
+	char name[16];
+} item;
+
+int main(int argc, char **argv)
+{
+	parserutils_stack *stack;
+	item it, *cur;
+	uint32_t i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	/* A small stack costs a single allocation */
+	assert(parserutils_stack_create(sizeof(item), 4, myrealloc, NULL,
+			&stack) == PARSERUTILS_OK);
+	assert(allocations == 1);
+	assert(parserutils_stack_get_current(stack) == NULL);
+	assert(parserutils_stack_pop(stack, NULL) == PARSERUTILS_INVALID);
+
+	for (i = 0; i < 4; i++) {
+		it.index = i;
+		sprintf(it.name, "item %u", i);
+		assert(parserutils_stack_push(stack, &it) == PARSERUTILS_OK);
+	}
+	assert(allocations == 1);
+
+	/* Growing copies the items out of the initial allocation */
+	it.index = 4;
+	assert(parserutils_stack_push(stack, &it) == PARSERUTILS_OK);
+	assert(allocations == 2);
+
+	/* Growth is geometric, so deep stacks reallocate rarely */
+	for (i = 5; i < 100000; i++) {
+		it.index = i;
+		sprintf(it.name, "item %u", i);
+		assert(parserutils_stack_push(stack, &it) == PARSERUTILS_OK);
+	}
+	assert(allocations < 24);
+
+	cur = parserutils_stack_get_current(stack);
+	assert(cur != NULL && cur->index == 99999);
+
+	for (i = 100000; i > 0; i--) {
+		assert(parserutils_stack_pop(stack, &it) == PARSERUTILS_OK);
+		assert(it.index == i - 1);
+		if (i != 5) {
+			char name[16];
+
+			sprintf(name, "item %u", i - 1);
+			assert(strcmp(it.name, name) == 0);
+		}
+	}
+	assert(parserutils_stack_get_current(stack) == NULL);
+
+	assert(parserutils_stack_destroy(stack) == PARSERUTILS_OK);
+	assert(outstanding == 0);
+
+	/* Reserving space moves the items out too */
+	allocations = 0;
+	assert(parserutils_stack_create(sizeof(uint32_t), 8, myrealloc, NULL,
+			&stack) == PARSERUTILS_OK);
+	for (i = 0; i < 3; i++)
+		assert(parserutils_stack_push(stack, &i) == PARSERUTILS_OK);
+	assert(parserutils_stack_reserve(stack, 100) == PARSERUTILS_OK);
+	assert(allocations == 2);
+	for (i = 3; i < 103; i++)
+		assert(parserutils_stack_push(stack, &i) == PARSERUTILS_OK);
+	assert(allocations == 2);
+	for (i = 103; i > 0; i--) {
+		uint32_t v;
+
+		assert(parserutils_stack_pop(stack, &v) == PARSERUTILS_OK);
+		assert(v == i - 1);
+	}
+	assert(parserutils_stack_destroy(stack) == PARSERUTILS_OK);
+
+	/* A large initial capacity is allocated separately */
+	allocations = 0;
+	assert(parserutils_stack_create_with_capacity(sizeof(item), 4, 1000,
+			myrealloc, NULL, &stack) == PARSERUTILS_OK);
+	assert(allocations == 2);
+	for (i = 0; i < 1000; i++) {
+		it.index = i;
+		assert(parserutils_stack_push(stack, &it) == PARSERUTILS_OK);
+	}
+	assert(allocations == 2);
+	assert(parserutils_stack_destroy(stack) == PARSERUTILS_OK);
+	assert(outstanding == 0);
+
+	assert(parserutils_stack_push(NULL, &it) == PARSERUTILS_BADPARM);
+	assert(parserutils_stack_pop(NULL, NULL) == PARSERUTILS_BADPARM);
+	assert(parserutils_stack_get_current(NULL) == NULL);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,137 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/charset/utf8.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define DOC_LEN (16 * 1024)
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+
+	return (seed >> 16) & 0x7fff;
+}
+
+/* Valid UTF-8, with runs of ASCII between characters of every length */
+static size_t make_doc(uint8_t *doc)
+{
+	size_t len = 0;
+
+	while (len < DOC_LEN - 4) {
+		uint32_t r = rnd() % 16, c;
+		uint8_t *s = doc + len;
+		size_t clen = 6;
+
+		c = (r < 10) ? rnd() % 0x80 : (r < 12) ? 0x80 + rnd() % 0x780
+				: (r < 15) ? 0x800 + rnd() % 0xF000
+				: 0x10000 + rnd() % 0x10000;
+		if (c >= 0xD800 && c < 0xE000)
+			c = 'x';
+
+		assert(parserutils_charset_utf8_from_ucs4(c, &s, &clen) ==
+				PARSERUTILS_OK);
+		len += 6 - clen;
+	}
+
+	return len;
+}
+
+/* Count by looking at every byte */
+static void reference(const uint8_t *s, size_t len, size_t *chars,
+		size_t *units)
+{
+	size_t i;
+
+	*chars = *units = 0;
+
+	for (i = 0; i < len; i++) {
+		if ((s[i] & 0xC0) != 0x80)
+			(*chars)++;
+		if (s[i] >= 0xF0)
+			(*units)++;
+	}
+
+	*units += *chars;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *doc;
+	size_t len, start, n, i;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	doc = malloc(DOC_LEN);
+	assert(doc != NULL);
+
+	len = make_doc(doc);
+
+	/* Strings of every alignment, ending anywhere */
+	for (i = 0; i < 2000; i++) {
+		size_t sublen, chars, units, expect_chars, expect_units, off;
+
+		start = rnd() % 64;
+		sublen = (i < 500) ? i : rnd() % (len - start);
+
+		/* Start at a character */
+		while ((doc[start] & 0xC0) == 0x80)
+			start++;
+
+		reference(doc + start, sublen, &expect_chars, &expect_units);
+
+		assert(parserutils_charset_utf8_count(doc + start, sublen,
+				&chars, &units) == PARSERUTILS_OK);
+		assert(chars == expect_chars && units == expect_units);
+
+		/* Advance to each of a few characters, and beyond the end */
+		for (n = 0; n <= expect_chars + 1; n += 1 + rnd() % 64) {
+			size_t seen = 0;
+
+			for (off = 0; off < sublen; off++) {
+				if ((doc[start + off] & 0xC0) != 0x80 &&
+						seen++ == n)
+					break;
+			}
+
+			assert(parserutils_charset_utf8_advance(doc + start,
+					sublen, n, &chars) == (n <= expect_chars
+					? PARSERUTILS_OK : PARSERUTILS_EOF));
+			assert(chars == off);
+		}
+
+		/* Strings of whole characters are measured the same by the
+		 * checked length, which skips runs of ASCII */
+		if (start + sublen == len ||
+				(doc[start + sublen] & 0xC0) != 0x80) {
+			assert(parserutils_charset_utf8_length(doc + start,
+					sublen, &chars) == PARSERUTILS_OK);
+			assert(chars == expect_chars);
+		}
+	}
+
+	/* Stray continuation bytes are still rejected */
+	memset(doc, 'a', 100);
+	doc[70] = 0x80;
+	assert(parserutils_charset_utf8_length(doc, 100, &n) ==
+			PARSERUTILS_INVALID);
+
+	assert(parserutils_charset_utf8_count(NULL, 0, &n, &i) ==
+			PARSERUTILS_OK && n == 0 && i == 0);
+	assert(parserutils_charset_utf8_advance(doc, 100, 0, NULL) ==
+			PARSERUTILS_BADPARM);
+
+	free(doc);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/utils/vector.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static int allocations;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	if (len > 0)
+		allocations++;
+
+	return realloc(ptr, len);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_vector *vector, *copy;
+	uint32_t items[1000], i;
+	const uint32_t *span, *item;
+	size_t length, stride;
+	int32_t ctx = 0;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	for (i = 0; i < N_ELEMENTS(items); i++)
+		items[i] = i * 7;
+
+	assert(parserutils_vector_create(sizeof(uint32_t), 4, myrealloc, NULL,
+			&vector) == PARSERUTILS_OK);
+
+	assert(parserutils_vector_span(vector, (const void **) &span,
+			&length, &stride) == PARSERUTILS_OK);
+	assert(length == 0 && stride == sizeof(uint32_t));
+	assert(parserutils_vector_get(vector, 0) == NULL);
+
+	/* Growth is geometric, so many appends reallocate rarely */
+	allocations = 0;
+	for (i = 0; i < 100000; i++) {
+		uint32_t v = i * 7;
+
+		assert(parserutils_vector_append(vector, &v) == PARSERUTILS_OK);
+	}
+	assert(allocations < 20);
+
+	item = parserutils_vector_get(vector, 12345);
+	assert(item != NULL && *item == 12345 * 7);
+	assert(parserutils_vector_get(vector, 100000) == NULL);
+
+	assert(parserutils_vector_truncate(vector, 100001) ==
+			PARSERUTILS_BADPARM);
+	assert(parserutils_vector_truncate(vector, 3) == PARSERUTILS_OK);
+	assert(parserutils_vector_get_length(vector, &length) ==
+			PARSERUTILS_OK && length == 3);
+	assert(parserutils_vector_get(vector, 3) == NULL);
+
+	/* Bulk append, after what's left */
+	assert(parserutils_vector_append_n(vector, items + 3,
+			N_ELEMENTS(items) - 3) == PARSERUTILS_OK);
+	assert(parserutils_vector_append_n(vector, NULL, 0) == PARSERUTILS_OK);
+
+	assert(parserutils_vector_span(vector, (const void **) &span,
+			&length, NULL) == PARSERUTILS_OK);
+	assert(length == N_ELEMENTS(items));
+	assert(memcmp(span, items, sizeof(items)) == 0);
+
+	/* Copy one vector to another in bulk */
+	assert(parserutils_vector_create(sizeof(uint32_t), 16, myrealloc, NULL,
+			&copy) == PARSERUTILS_OK);
+	assert(parserutils_vector_reserve(copy, length) == PARSERUTILS_OK);
+	allocations = 0;
+	assert(parserutils_vector_append_n(copy, span, length) ==
+			PARSERUTILS_OK);
+	assert(allocations == 0);
+
+	for (i = 0; (item = parserutils_vector_iterate(copy, &ctx)) != NULL;
+			i++)
+		assert(*item == items[i]);
+	assert(i == N_ELEMENTS(items));
+
+	assert(parserutils_vector_truncate(copy, 0) == PARSERUTILS_OK);
+	assert(parserutils_vector_get(copy, 0) == NULL);
+	assert(parserutils_vector_get_length(copy, &length) ==
+			PARSERUTILS_OK && length == 0);
+
+	assert(parserutils_vector_destroy(copy) == PARSERUTILS_OK);
+	assert(parserutils_vector_destroy(vector) == PARSERUTILS_OK);
+
+	assert(parserutils_vector_append_n(NULL, items, 1) ==
+			PARSERUTILS_BADPARM);
+	assert(parserutils_vector_span(NULL, (const void **) &span, &length,
+			NULL) == PARSERUTILS_BADPARM);
+
+	printf("PASS\n");
+
+	return 0;
+}